@@ -18,25 +18,20 @@
 #include "omaha/base/apply_tag.h"
 
 #include <intsafe.h>
-#include <algorithm>
+#include <limits>
 #include <regex>
+#include <string>
 #include <vector>
 
+#include "omaha/base/certificate_tag.h"
+#include "omaha/base/file.h"
+#include "omaha/base/scope_guard.h"
 #include "omaha/base/utils.h"
-#include "omaha/base/extractor.h"
 
 namespace omaha {
 
-// TODO(omaha3): There is duplication between this code and the Extractor class.
-// Would be nice to eliminate or reduce the duplication.
-const char kMagicBytes[]    = "Gact2.0Omaha";
-const size_t kMagicBytesLen = arraysize(kMagicBytes) - 1;
-
-const uint32 kPEHeaderOffset = 60;
-
 ApplyTag::ApplyTag()
-    : prev_tag_string_length_(0),
-      append_(0) {}
+    : append_(0) {}
 
 bool ApplyTag::IsValidTagString(const char* tag_string) {
   ASSERT1(tag_string);
@@ -69,147 +64,258 @@ HRESULT ApplyTag::Init(const TCHAR* signed_exe_file,
 }
 
 HRESULT ApplyTag::EmbedTagString() {
-  std::vector<byte> input_file_buffer;
-  HRESULT hr = ReadEntireFileShareMode(signed_exe_file_,
-                                       0,
-                                       FILE_SHARE_READ,
-                                       &input_file_buffer);
+  ApplyTagBatch batch;
+  HRESULT hr = batch.Init(signed_exe_file_, append_);
   if (FAILED(hr)) {
     return hr;
   }
 
-  ASSERT1(!input_file_buffer.empty());
-  VERIFY1(ReadExistingTag(&input_file_buffer));
-  if (!append_ && prev_tag_string_length_) {
-    // If there is a previous tag and the append flag is not set, then
-    // we should error out.
-    return APPLYTAG_E_ALREADY_TAGGED;
+  return batch.EmbedTagString(tag_string_.empty() ? "" : &tag_string_.front(),
+                              static_cast<int>(tag_string_.size()),
+                              tagged_file_);
+}
+
+// Takes the outputs of a batch one at a time, on several threads.
+class ApplyTagBatch::Writer {
+ public:
+  Writer(const ApplyTagBatch& batch, std::vector<Output>* outputs)
+      : batch_(batch),
+        outputs_(*outputs),
+        next_output_(0) {
+  }
+
+  void Run(int num_threads);
+
+ private:
+  static DWORD WINAPI ThreadProc(void* param);
+  void WriteOutputs();
+
+  const ApplyTagBatch& batch_;
+  std::vector<Output>& outputs_;
+  volatile LONG next_output_;
+
+  DISALLOW_COPY_AND_ASSIGN(Writer);
+};
+
+void ApplyTagBatch::Writer::Run(int num_threads) {
+  if (num_threads <= 0) {
+    SYSTEM_INFO system_info = {};
+    ::GetSystemInfo(&system_info);
+    num_threads = static_cast<int>(system_info.dwNumberOfProcessors);
+  }
+  if (static_cast<size_t>(num_threads) > outputs_.size()) {
+    num_threads = static_cast<int>(outputs_.size());
   }
 
-  if (!CreateBufferToWrite()) {
-    return E_FAIL;
+  std::vector<HANDLE> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    HANDLE thread = ::CreateThread(NULL, 0, &ThreadProc, this, 0, NULL);
+    if (!thread) {
+      break;
+    }
+    threads.push_back(thread);
   }
 
-  buffer_data_.resize(input_file_buffer.size());
+  WriteOutputs();
 
-  copy(input_file_buffer.begin(),
-       input_file_buffer.end(),
-       buffer_data_.begin());
+  for (size_t i = 0; i != threads.size(); ++i) {
+    ::WaitForSingleObject(threads[i], INFINITE);
+    ::CloseHandle(threads[i]);
+  }
+}
+
+DWORD WINAPI ApplyTagBatch::Writer::ThreadProc(void* param) {
+  static_cast<Writer*>(param)->WriteOutputs();
+  return 0;
+}
+
+void ApplyTagBatch::Writer::WriteOutputs() {
+  for (;;) {
+    const LONG i = ::InterlockedIncrement(&next_output_) - 1;
+    if (static_cast<size_t>(i) >= outputs_.size()) {
+      return;
+    }
+    Output& output = outputs_[i];
+    output.hr = batch_.EmbedTagString(output.tag_string,
+                                      output.tag_string.GetLength(),
+                                      output.tagged_file);
+  }
+}
+
+ApplyTagBatch::ApplyTagBatch()
+    : valid_tag_string_regex_(kValidTagStringRegEx),
+      tag_offset_(0),
+      tag_space_(0),
+      append_(false) {}
+
+ApplyTagBatch::~ApplyTagBatch() {}
+
+HRESULT ApplyTagBatch::Init(const TCHAR* signed_exe_file, bool append) {
+  ASSERT1(signed_exe_file);
+
+  append_ = append;
+  HRESULT hr = ReadEntireFileShareMode(signed_exe_file,
+                                       0,
+                                       FILE_SHARE_READ,
+                                       &binary_);
+  if (FAILED(hr)) {
+    return hr;
+  }
 
   // Applying tags require the file be signed with Authenticode and have a
-  // padded certificate that contains kMagicBytes.
-  if (!ApplyTagToBuffer()) {
+  // padded certificate that contains kCertificateTagMagic.
+  CertificateTag certificate_tag;
+  if (binary_.empty() ||
+      !ParseCertificateTag(&binary_.front(), binary_.size(),
+                           &certificate_tag)) {
     return APPLYTAG_E_NOT_SIGNED;
   }
+  ASSERT1(certificate_tag.cert_dir_offset + certificate_tag.cert_dir_length ==
+          binary_.size());
 
-  return WriteEntireFile(tagged_file_, buffer_data_);
+  if (certificate_tag.tag) {
+    prev_tag_string_.assign(certificate_tag.tag,
+                            certificate_tag.tag + certificate_tag.tag_length);
+  }
+  if (!append_ && !prev_tag_string_.empty()) {
+    // If there is a previous tag and the append flag is not set, then
+    // we should error out.
+    return APPLYTAG_E_ALREADY_TAGGED;
+  }
+
+  if (!certificate_tag.tag_region_offset) {
+    return APPLYTAG_E_NOT_SIGNED;
+  }
+  tag_offset_ = certificate_tag.tag_region_offset;
+  tag_space_ = certificate_tag.tag_region_length;
+  return S_OK;
 }
 
-uint32 ApplyTag::GetUint32(const void* p) {
-  ASSERT1(p);
+HRESULT ApplyTagBatch::EmbedTagString(const char* tag_string,
+                                      int tag_string_length,
+                                      const TCHAR* tagged_file) const {
+  ASSERT1(tag_string);
+  ASSERT1(tagged_file);
+  ASSERT1(tag_space_);
 
-  const uint32* pu = reinterpret_cast<const uint32*>(p);
-  return *pu;
-}
+  if (tag_string_length < 0 ||
+      !std::regex_match(tag_string,
+                        tag_string + tag_string_length,
+                        valid_tag_string_regex_)) {
+    return E_INVALIDARG;
+  }
 
-void ApplyTag::PutUint32(uint32 i, void* p) {
-  ASSERT1(p);
+  std::vector<byte> tag_buffer;
+  if (!BuildTagBuffer(tag_string, tag_string_length, &tag_buffer)) {
+    return E_INVALIDARG;
+  }
+  if (tag_buffer.size() > tag_space_) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
 
-  uint32* pu = reinterpret_cast<uint32*>(p);
-  *pu = i;
+  return WriteTaggedFile(tagged_file, tag_buffer);
 }
 
-bool ApplyTag::ReadExistingTag(std::vector<byte>* binary) {
-  ASSERT1(binary);
-
-  int len = 0;
-  TagExtractor tag;
-  char* bin = reinterpret_cast<char*>(&binary->front());
-  ASSERT1(bin);
-  if (tag.ExtractTag(bin, binary->size(), NULL, &len)) {
-    prev_tag_string_.resize(len);
-    if (tag.ExtractTag(bin, binary->size(), &prev_tag_string_.front(), &len)) {
-      // The extractor returns the actual length
-      // of the string + 1 for the terminating null.
-      prev_tag_string_length_ = len - 1;
+HRESULT ApplyTagBatch::EmbedTagStrings(std::vector<Output>* outputs,
+                                       int num_threads) const {
+  ASSERT1(outputs);
+
+  Writer writer(*this, outputs);
+  writer.Run(num_threads);
+
+  for (size_t i = 0; i != outputs->size(); ++i) {
+    if (FAILED((*outputs)[i].hr)) {
+      return (*outputs)[i].hr;
     }
   }
-
-  return true;
+  return S_OK;
 }
 
-bool ApplyTag::CreateBufferToWrite() {
-  ASSERT1(!append_ && !prev_tag_string_length_ || append_);
-  ASSERT1(!tag_string_.empty());
-  ASSERT1(!prev_tag_string_.size() ||
-          prev_tag_string_.size() ==
-          static_cast<size_t>(prev_tag_string_length_ + 1));
+bool ApplyTagBatch::BuildTagBuffer(const char* tag_string,
+                                   int tag_string_length,
+                                   std::vector<byte>* tag_buffer) const {
+  ASSERT1(tag_buffer);
 
   // Build the tag buffer.
   // The format of the tag buffer is:
   // 000000-00000B: 12-byte magic (big-endian)
   // 00000C-00000D: unsigned 16-bit int string length (big-endian)
   // 00000E-??????: ASCII string
-  size_t tag_string_len = tag_string_.size() + prev_tag_string_length_;
-  size_t tag_header_len = kMagicBytesLen + 2;
-  size_t tag_buffer_length = tag_string_len + tag_header_len;
-
-  tag_buffer_.clear();
-  tag_buffer_.resize(tag_buffer_length, 0);
-  memcpy(&tag_buffer_.front(), kMagicBytes, kMagicBytesLen);
-  tag_buffer_[kMagicBytesLen] =
-      static_cast<char>((tag_string_len & 0xff00) >> 8);
-  tag_buffer_[kMagicBytesLen+1] = static_cast<char>(tag_string_len & 0xff);
-
-  if (prev_tag_string_length_ > 0) {
-    copy(prev_tag_string_.begin(),
-         prev_tag_string_.end(),
-         tag_buffer_.begin() + tag_header_len);
+  const size_t tag_string_len = tag_string_length + prev_tag_string_.size();
+  if (tag_string_len > 0xffff) {
+    return false;
   }
-
-  copy(tag_string_.begin(),
-       tag_string_.end(),
-       tag_buffer_.begin() + tag_header_len + prev_tag_string_length_);
-  ASSERT1(static_cast<int>(tag_buffer_.size()) == tag_buffer_length);
+  const size_t tag_header_len = kCertificateTagHeaderLength;
+
+  tag_buffer->resize(tag_header_len);
+  memcpy(&tag_buffer->front(), kCertificateTagMagic,
+         kCertificateTagMagicLength);
+  (*tag_buffer)[kCertificateTagMagicLength] =
+      static_cast<byte>((tag_string_len & 0xff00) >> 8);
+  (*tag_buffer)[kCertificateTagMagicLength + 1] =
+      static_cast<byte>(tag_string_len & 0xff);
+
+  tag_buffer->insert(tag_buffer->end(),
+                     prev_tag_string_.begin(),
+                     prev_tag_string_.end());
+  tag_buffer->insert(tag_buffer->end(),
+                     tag_string,
+                     tag_string + tag_string_length);
+  ASSERT1(tag_buffer->size() == tag_header_len + tag_string_len);
 
   return true;
 }
 
-bool ApplyTag::ApplyTagToBuffer() {
-  uint32 peheader = GetUint32(&buffer_data_.front() + kPEHeaderOffset);
-  uint32 kCertDirAddressOffset = 152;
-  uint32 kCertDirInfoSize = 4 + 4;
-
-  ASSERT1(peheader + kCertDirAddressOffset + kCertDirInfoSize <=
-          buffer_data_.size());
+HRESULT ApplyTagBatch::WriteTaggedFile(
+    const TCHAR* tagged_file,
+    const std::vector<byte>& tag_buffer) const {
+  ASSERT1(tagged_file);
+  ASSERT1(tag_offset_ + tag_buffer.size() <= binary_.size());
 
-  // Read certificate directory info.
-  uint32 cert_dir_offset = GetUint32(&buffer_data_.front() + peheader +
-                                     kCertDirAddressOffset);
-  if (cert_dir_offset == 0) {
-    return false;
+  if (binary_.size() > std::numeric_limits<uint32>::max()) {
+    return E_INVALIDARG;
   }
 
-  uint32 cert_dir_len = GetUint32(&buffer_data_.front() + peheader +
-                                  kCertDirAddressOffset + 4);
-  ASSERT1(cert_dir_offset + cert_dir_len == buffer_data_.size());
-
-  // Find kMagicBytes and add the tag buffer there.
-  const byte* cert_dir_start = &buffer_data_.front() + cert_dir_offset;
-  const byte* cert_dir_end = cert_dir_start + cert_dir_len;
-  const byte* mc = std::search(cert_dir_start,
-                               cert_dir_end,
-                               kMagicBytes,
-                               kMagicBytes + kMagicBytesLen);
-  if (mc >= cert_dir_end) {
-    return false;
+  // File::Open does not truncate, so an existing file is deleted first.
+  if (File::Exists(tagged_file)) {
+    HRESULT hr = File::Remove(tagged_file);
+    if (FAILED(hr)) {
+      return hr;
+    }
   }
 
-  // Copy the tag buffer.
-  copy(tag_buffer_.begin(), tag_buffer_.end(),
-       buffer_data_.begin() + (mc - &buffer_data_.front()));
+  File file;
+  HRESULT hr = file.Open(tagged_file, true, false);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  ON_SCOPE_EXIT_OBJ(file, &File::Close);
+
+  // The file is written in three sequential runs: the untouched bytes up to
+  // the tag, the tag, and the untouched bytes after it.
+  const size_t tag_end = tag_offset_ + tag_buffer.size();
+  const struct {
+    const byte* data;
+    size_t size;
+  } runs[] = {
+    { &binary_.front(), tag_offset_ },
+    { &tag_buffer.front(), tag_buffer.size() },
+    { &binary_.front() + tag_end, binary_.size() - tag_end },
+  };
+  for (size_t i = 0; i != arraysize(runs); ++i) {
+    if (!runs[i].size) {
+      continue;
+    }
+    uint32 bytes_written = 0;
+    hr = file.Write(runs[i].data,
+                    static_cast<uint32>(runs[i].size),
+                    &bytes_written);
+    if (FAILED(hr)) {
+      return hr;
+    }
+  }
 
-  return true;
+  return S_OK;
 }
 
 }  // namespace omaha
@@ -19,6 +19,7 @@
 #include <atlbase.h>
 #include <atlstr.h>
 
+#include <regex>
 #include <vector>
 
 #include "base/basictypes.h"
@@ -53,22 +54,11 @@ class ApplyTag {
   HRESULT EmbedTagString();
 
  private:
-  static uint32 GetUint32(const void* p);
-  static void PutUint32(uint32 i, void* p);
-  bool ReadExistingTag(std::vector<byte>* binary);
-  bool CreateBufferToWrite();
-  bool ApplyTagToBuffer();
   bool IsValidTagString(const char* tag_string);
 
   // The string to be tagged into the binary.
   std::vector<char> tag_string_;
 
-  // Existing tag string inside the binary.
-  std::vector<char> prev_tag_string_;
-
-  // This is prev_tag_string_.size - 1, to exclude the terminating null.
-  int prev_tag_string_length_;
-
   // The input binary to be tagged.
   CString signed_exe_file_;
 
@@ -78,14 +68,72 @@ class ApplyTag {
   // Whether to append the tag string to the existing one.
   bool append_;
 
-  // Internal buffer to hold the appended string.
-  std::vector<char> tag_buffer_;
+  DISALLOW_COPY_AND_ASSIGN(ApplyTag);
+};
+
+// Stamps many tag strings into copies of the same signed file, which is read
+// and parsed only once. Tagging overwrites the padding of the certificate
+// directory and nothing else, so each output is written straight from the
+// input: the bytes before the tag, the tag, then the bytes after it.
+class ApplyTagBatch {
+ public:
+  struct Output {
+    Output() : hr(E_PENDING) {}
 
-  // The output buffer that contains the original binary
-  // data with the tagged information.
-  std::vector<byte> buffer_data_;
+    CStringA tag_string;
+    CString tagged_file;
 
-  DISALLOW_COPY_AND_ASSIGN(ApplyTag);
+    // The result of tagging this output.
+    HRESULT hr;
+  };
+
+  ApplyTagBatch();
+  ~ApplyTagBatch();
+
+  // Reads |signed_exe_file| and finds its existing tag and the padding that
+  // takes the new ones. Fails with APPLYTAG_E_ALREADY_TAGGED if the file has
+  // a tag and |append| is false.
+  HRESULT Init(const TCHAR* signed_exe_file, bool append);
+
+  // Writes one tagged copy of the file. Several threads can call this at the
+  // same time.
+  HRESULT EmbedTagString(const char* tag_string,
+                         int tag_string_length,
+                         const TCHAR* tagged_file) const;
+
+  // Writes all the |outputs|, on up to |num_threads| threads, 0 meaning one
+  // per processor. Every output is attempted and gets its own result; the
+  // first failure is returned.
+  HRESULT EmbedTagStrings(std::vector<Output>* outputs, int num_threads) const;
+
+  size_t file_size() const { return binary_.size(); }
+
+ private:
+  class Writer;
+
+  bool BuildTagBuffer(const char* tag_string,
+                      int tag_string_length,
+                      std::vector<byte>* tag_buffer) const;
+  HRESULT WriteTaggedFile(const TCHAR* tagged_file,
+                          const std::vector<byte>& tag_buffer) const;
+
+  // Compiled once and shared by the writer threads, which only match it.
+  const std::regex valid_tag_string_regex_;
+
+  // The signed file.
+  std::vector<byte> binary_;
+
+  // The existing tag, without a terminating null.
+  std::vector<char> prev_tag_string_;
+
+  // Where the tag goes, and the room there is for it up to the end of the
+  // certificate directory.
+  size_t tag_offset_;
+  size_t tag_space_;
+
+  bool append_;
+
+  DISALLOW_COPY_AND_ASSIGN(ApplyTagBatch);
 };
 
 }  // namespace omaha
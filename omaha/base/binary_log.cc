@@ -0,0 +1,745 @@
+// Copyright 2003-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/base/binary_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace omaha {
+
+using binary_log::ArgType;
+using binary_log::RecordType;
+
+namespace {
+
+// Reads the fields of a record, and fails for good on the first field which
+// runs past its end.
+class Reader {
+ public:
+  Reader(const uint8* data, size_t size)
+      : data_(data), end_(data + size), failed_(false) {}
+
+  bool at_end() const { return data_ == end_; }
+  bool failed() const { return failed_; }
+  size_t remaining() const { return static_cast<size_t>(end_ - data_); }
+
+  uint8 ReadByte() {
+    if (data_ == end_) {
+      failed_ = true;
+      return 0;
+    }
+    return *data_++;
+  }
+
+  uint64 ReadVarint() {
+    uint64 value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      const uint8 byte = ReadByte();
+      value |= static_cast<uint64>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return value;
+      }
+    }
+    failed_ = true;
+    return 0;
+  }
+
+  int64 ReadSignedVarint() {
+    const uint64 value = ReadVarint();
+    return static_cast<int64>(value >> 1) ^ -static_cast<int64>(value & 1);
+  }
+
+  // Returns the next |size| bytes, or NULL if there are not as many left.
+  const uint8* ReadBytes(size_t size) {
+    if (size > remaining()) {
+      failed_ = true;
+      data_ = end_;
+      return NULL;
+    }
+    const uint8* bytes = data_;
+    data_ += size;
+    return bytes;
+  }
+
+  std::string ReadString() {
+    const uint64 length = ReadVarint();
+    if (failed_ || length > remaining() / 2) {
+      failed_ = true;
+      return std::string();
+    }
+    const size_t num_units = static_cast<size_t>(length);
+    const uint8* bytes = ReadBytes(num_units * 2);
+    std::basic_string<uint16> units(num_units, 0);
+    for (size_t i = 0; i < num_units; ++i) {
+      units[i] = static_cast<uint16>(bytes[2 * i] | (bytes[2 * i + 1] << 8));
+    }
+    return BinaryLogDecoder::Utf16ToUtf8(units.data(), num_units);
+  }
+
+ private:
+  const uint8* data_;
+  const uint8* const end_;
+  bool failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(Reader);
+};
+
+// An argument of a message record.
+struct Arg {
+  ArgType type;
+  size_t size;
+  uint64 value;
+  double double_value;
+  std::string string_value;
+};
+
+bool ReadArg(Reader* reader, Arg* arg) {
+  const uint8 tag = reader->ReadByte();
+  arg->type = static_cast<ArgType>(tag >> 4);
+  arg->size = tag & 0x0f;
+  arg->value = 0;
+  arg->double_value = 0;
+  arg->string_value.clear();
+
+  switch (arg->type) {
+    case binary_log::kIntArg:
+      arg->value = static_cast<uint64>(reader->ReadSignedVarint());
+      break;
+    case binary_log::kUintArg:
+    case binary_log::kPointerArg:
+      arg->value = reader->ReadVarint();
+      break;
+    case binary_log::kDoubleArg: {
+      const uint8* bytes = reader->ReadBytes(8);
+      if (bytes) {
+        uint64 bits = 0;
+        for (int i = 7; i >= 0; --i) {
+          bits = (bits << 8) | bytes[i];
+        }
+        memcpy(&arg->double_value, &bits, sizeof(bits));
+      }
+      break;
+    }
+    case binary_log::kStringArg:
+      arg->string_value = reader->ReadString();
+      break;
+    case binary_log::kAnsiStringArg: {
+      const uint64 length = reader->ReadVarint();
+      if (length > reader->remaining()) {
+        return false;
+      }
+      const uint8* bytes = reader->ReadBytes(static_cast<size_t>(length));
+      arg->string_value.assign(reinterpret_cast<const char*>(bytes),
+                               static_cast<size_t>(length));
+      break;
+    }
+    case binary_log::kNullStringArg:
+      break;
+    default:
+      return false;
+  }
+  return !reader->failed();
+}
+
+bool IsStringArg(const Arg& arg) {
+  return arg.type == binary_log::kStringArg ||
+         arg.type == binary_log::kAnsiStringArg ||
+         arg.type == binary_log::kNullStringArg;
+}
+
+// Returns |value| truncated to |size| bytes, and sign extended if |is_signed|.
+uint64 Truncate(uint64 value, size_t size, bool is_signed) {
+  if (size == 0 || size >= 8) {
+    return value;
+  }
+  const int bits = static_cast<int>(size * 8);
+  value &= (static_cast<uint64>(1) << bits) - 1;
+  if (is_signed && (value >> (bits - 1))) {
+    value |= ~static_cast<uint64>(0) << bits;
+  }
+  return value;
+}
+
+// Reads the width or the precision of a conversion at |*i| in |format|, from
+// the arguments if it is '*'. Leaves |*field| as it is if there is none.
+bool ReadField(const std::string& format,
+               size_t* i,
+               Reader* reader,
+               int* field) {
+  if (*i < format.size() && format[*i] == '*') {
+    ++*i;
+    if (reader->at_end()) {
+      return true;
+    }
+    Arg arg;
+    if (!ReadArg(reader, &arg)) {
+      return false;
+    }
+    *field = static_cast<int>(Truncate(arg.value, 4, true));
+    return true;
+  }
+  while (*i < format.size() && format[*i] >= '0' && format[*i] <= '9') {
+    *field = (*field > 0 ? *field * 10 : 0) + (format[(*i)++] - '0');
+  }
+  return true;
+}
+
+void AppendCodePoint(uint32 code_point, std::string* text) {
+  if (code_point < 0x80) {
+    text->push_back(static_cast<char>(code_point));
+  } else if (code_point < 0x800) {
+    text->push_back(static_cast<char>(0xc0 | (code_point >> 6)));
+    text->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  } else if (code_point < 0x10000) {
+    text->push_back(static_cast<char>(0xe0 | (code_point >> 12)));
+    text->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+    text->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  } else {
+    text->push_back(static_cast<char>(0xf0 | (code_point >> 18)));
+    text->push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3f)));
+    text->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+    text->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  }
+}
+
+// Returns the number of bytes of the first |num_chars| characters of the
+// UTF-8 |text|.
+size_t Utf8Prefix(const std::string& text, size_t num_chars) {
+  size_t i = 0;
+  for (; i < text.size() && num_chars; --num_chars) {
+    ++i;
+    while (i < text.size() && (text[i] & 0xc0) == 0x80) {
+      ++i;
+    }
+  }
+  return i;
+}
+
+void AppendPadded(const std::string& value,
+                  int width,
+                  bool left_align,
+                  std::string* text) {
+  size_t num_chars = 0;
+  for (size_t i = 0; i < value.size(); ++i) {
+    if ((value[i] & 0xc0) != 0x80) {
+      ++num_chars;
+    }
+  }
+  const size_t padding = width > 0 && static_cast<size_t>(width) > num_chars ?
+                         static_cast<size_t>(width) - num_chars : 0;
+  if (!left_align) {
+    text->append(padding, ' ');
+  }
+  text->append(value);
+  if (left_align) {
+    text->append(padding, ' ');
+  }
+}
+
+void AppendGenericArg(const Arg& arg, std::string* text) {
+  char buffer[32] = {};
+  switch (arg.type) {
+    case binary_log::kIntArg:
+      snprintf(buffer, sizeof(buffer), "%lld",
+               static_cast<long long>(arg.value));  // NOLINT
+      text->append(buffer);
+      break;
+    case binary_log::kUintArg:
+      snprintf(buffer, sizeof(buffer), "%llu",
+               static_cast<unsigned long long>(arg.value));  // NOLINT
+      text->append(buffer);
+      break;
+    case binary_log::kPointerArg:
+      snprintf(buffer, sizeof(buffer), "0x%llx",
+               static_cast<unsigned long long>(arg.value));  // NOLINT
+      text->append(buffer);
+      break;
+    case binary_log::kDoubleArg:
+      snprintf(buffer, sizeof(buffer), "%g", arg.double_value);
+      text->append(buffer);
+      break;
+    case binary_log::kNullStringArg:
+      text->append("(null)");
+      break;
+    default:
+      text->append(arg.string_value);
+      break;
+  }
+}
+
+// Converts 100ns intervals since 1601 to "[MM/DD/YY HH:MM:SS.mmm]", the time
+// prefix of text logs.
+void AppendTime(uint64 time, std::string* text) {
+  const uint64 ms = time / 10000;
+  const uint64 ms_per_day = 24 * 60 * 60 * 1000ULL;
+  const int64 days_since_1970 = static_cast<int64>(ms / ms_per_day) - 134774;
+  const uint64 ms_of_day = ms % ms_per_day;
+
+  // Converts the days to a date in the proleptic Gregorian calendar.
+  const int64 z = days_since_1970 + 719468;
+  const int64 era = (z >= 0 ? z : z - 146096) / 146097;
+  const int64 day_of_era = z - era * 146097;
+  const int64 year_of_era = (day_of_era - day_of_era / 1460 +
+                             day_of_era / 36524 - day_of_era / 146096) / 365;
+  const int64 day_of_year = day_of_era -
+      (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  const int64 mp = (5 * day_of_year + 2) / 153;
+  const int64 day = day_of_year - (153 * mp + 2) / 5 + 1;
+  const int64 month = mp < 10 ? mp + 3 : mp - 9;
+  const int64 year = year_of_era + era * 400 + (month <= 2 ? 1 : 0);
+
+  char buffer[64] = {};
+  snprintf(buffer, sizeof(buffer), "[%02d/%02d/%02d %02d:%02d:%02d.%03d]",
+           static_cast<int>(month),
+           static_cast<int>(day),
+           static_cast<int>(year % 100),
+           static_cast<int>(ms_of_day / 3600000),
+           static_cast<int>(ms_of_day / 60000 % 60),
+           static_cast<int>(ms_of_day / 1000 % 60),
+           static_cast<int>(ms_of_day % 1000));
+  text->append(buffer);
+}
+
+}  // namespace
+
+BinaryLogEncoder::BinaryLogEncoder(uint8* buffer, size_t capacity)
+    : buffer_(buffer),
+      capacity_(capacity),
+      size_(0),
+      failed_(false) {
+}
+
+void BinaryLogEncoder::PutByte(uint8 value) {
+  PutBytes(&value, 1);
+}
+
+void BinaryLogEncoder::PutVarint(uint64 value) {
+  uint8 bytes[10] = {};
+  size_t size = 0;
+  while (value >= 0x80) {
+    bytes[size++] = static_cast<uint8>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  bytes[size++] = static_cast<uint8>(value);
+  PutBytes(bytes, size);
+}
+
+void BinaryLogEncoder::PutSignedVarint(int64 value) {
+  const uint64 bits = static_cast<uint64>(value);
+  PutVarint((bits << 1) ^ (value < 0 ? ~0ULL : 0ULL));
+}
+
+void BinaryLogEncoder::PutBytes(const void* data, size_t size) {
+  if (failed_ || size > capacity_ - size_) {
+    failed_ = true;
+    return;
+  }
+  memcpy(buffer_ + size_, data, size);
+  size_ += size;
+}
+
+void BinaryLogEncoder::PutString(const uint16* units, size_t length) {
+  PutVarint(length);
+  if (failed_ || length > (capacity_ - size_) / 2) {
+    failed_ = true;
+    return;
+  }
+  for (size_t i = 0; i < length; ++i) {
+    buffer_[size_++] = static_cast<uint8>(units[i]);
+    buffer_[size_++] = static_cast<uint8>(units[i] >> 8);
+  }
+}
+
+void BinaryLogEncoder::PutRecordHeader(RecordType type, size_t payload_size) {
+  PutByte(static_cast<uint8>(type));
+  PutVarint(payload_size);
+}
+
+void BinaryLogEncoder::PutArgTag(ArgType type, size_t size) {
+  PutByte(static_cast<uint8>((type << 4) | (size & 0x0f)));
+}
+
+void BinaryLogEncoder::PutIntArg(int64 value, size_t size) {
+  PutArgTag(binary_log::kIntArg, size);
+  PutSignedVarint(value);
+}
+
+void BinaryLogEncoder::PutUintArg(uint64 value, size_t size) {
+  PutArgTag(binary_log::kUintArg, size);
+  PutVarint(value);
+}
+
+void BinaryLogEncoder::PutDoubleArg(double value) {
+  PutArgTag(binary_log::kDoubleArg, sizeof(value));
+  uint64 bits = 0;
+  memcpy(&bits, &value, sizeof(bits));
+  uint8 bytes[8] = {};
+  for (int i = 0; i < 8; ++i) {
+    bytes[i] = static_cast<uint8>(bits >> (8 * i));
+  }
+  PutBytes(bytes, sizeof(bytes));
+}
+
+void BinaryLogEncoder::PutPointerArg(uint64 value, size_t size) {
+  PutArgTag(binary_log::kPointerArg, size);
+  PutVarint(value);
+}
+
+void BinaryLogEncoder::PutStringArg(const uint16* units, size_t length) {
+  PutArgTag(binary_log::kStringArg, sizeof(*units));
+  PutString(units, length);
+}
+
+void BinaryLogEncoder::PutAnsiStringArg(const char* chars, size_t length) {
+  PutArgTag(binary_log::kAnsiStringArg, sizeof(*chars));
+  PutVarint(length);
+  PutBytes(chars, length);
+}
+
+void BinaryLogEncoder::PutNullStringArg() {
+  PutArgTag(binary_log::kNullStringArg, 0);
+}
+
+size_t BinaryLogEncoder::VarintSize(uint64 value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++size;
+  }
+  return size;
+}
+
+size_t BinaryLogEncoder::StringSize(size_t length) {
+  return VarintSize(length) + 2 * length;
+}
+
+size_t BinaryLogEncoder::RecordSize(size_t payload_size) {
+  return 1 + VarintSize(payload_size) + payload_size;
+}
+
+BinaryLogDecoder::BinaryLogDecoder() {
+}
+
+BinaryLogDecoder::~BinaryLogDecoder() {
+}
+
+std::string BinaryLogDecoder::Utf16ToUtf8(const uint16* units, size_t length) {
+  std::string text;
+  text.reserve(length);
+  for (size_t i = 0; i < length; ++i) {
+    uint32 code_point = units[i];
+    if (code_point >= 0xd800 && code_point < 0xdc00 && i + 1 < length &&
+        units[i + 1] >= 0xdc00 && units[i + 1] < 0xe000) {
+      code_point = 0x10000 + ((code_point - 0xd800) << 10) +
+                   (units[++i] - 0xdc00);
+    } else if (code_point >= 0xd800 && code_point < 0xe000) {
+      code_point = 0xfffd;
+    }
+    AppendCodePoint(code_point, &text);
+  }
+  return text;
+}
+
+bool BinaryLogDecoder::FormatArgs(const std::string& format,
+                                  const uint8* args,
+                                  size_t args_size,
+                                  std::string* text) {
+  Reader reader(args, args_size);
+  for (size_t i = 0; i < format.size(); ++i) {
+    if (format[i] != '%') {
+      text->push_back(format[i]);
+      continue;
+    }
+
+    const size_t spec_start = i++;
+    if (i < format.size() && format[i] == '%') {
+      text->push_back('%');
+      continue;
+    }
+
+    // Parses %[flags][width][.precision][size]type, reading the width and the
+    // precision from the arguments when they are '*'.
+    std::string flags;
+    while (i < format.size() && format[i] && strchr("-+ #0", format[i])) {
+      flags.push_back(format[i++]);
+    }
+
+    int width = -1;
+    if (!ReadField(format, &i, &reader, &width)) {
+      return false;
+    }
+    if (width < -1) {
+      flags.push_back('-');
+      width = -width;
+    }
+    int precision = -1;
+    if (i < format.size() && format[i] == '.') {
+      ++i;
+      precision = 0;
+      if (!ReadField(format, &i, &reader, &precision)) {
+        return false;
+      }
+    }
+
+    // The size of the argument, as given by the format, or 0 to use the
+    // size of the argument itself.
+    size_t size = 4;
+    if (format.compare(i, 3, "I64") == 0) {
+      size = 8;
+      i += 3;
+    } else if (format.compare(i, 3, "I32") == 0) {
+      size = 4;
+      i += 3;
+    } else if (format.compare(i, 2, "ll") == 0) {
+      size = 8;
+      i += 2;
+    } else if (format.compare(i, 2, "hh") == 0) {
+      size = 1;
+      i += 2;
+    } else if (i < format.size() && strchr("IzjtlhwL", format[i])) {
+      switch (format[i++]) {
+        case 'h':
+          size = 2;
+          break;
+        case 'j':
+          size = 8;
+          break;
+        case 'I':
+        case 'z':
+        case 't':
+          size = 0;
+          break;
+        default:
+          break;
+      }
+    }
+    if (i >= format.size()) {
+      text->append(format, spec_start, std::string::npos);
+      return true;
+    }
+    const char type = format[i];
+
+    if (reader.at_end()) {
+      // Missing arguments are left as they are in the format.
+      text->append(format, spec_start, i + 1 - spec_start);
+      continue;
+    }
+    Arg arg;
+    if (!ReadArg(&reader, &arg)) {
+      return false;
+    }
+
+    const bool is_integer = arg.type == binary_log::kIntArg ||
+                            arg.type == binary_log::kUintArg ||
+                            arg.type == binary_log::kPointerArg;
+    std::string spec("%");
+    spec += flags;
+    if (width >= 0) {
+      spec += std::to_string(width);
+    }
+    if (precision >= 0) {
+      spec += "." + std::to_string(precision);
+    }
+
+    char buffer[512] = {};
+    switch (type) {
+      case 'd':
+      case 'i':
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        if (!is_integer) {
+          AppendGenericArg(arg, text);
+          break;
+        }
+        spec += "ll";
+        spec.push_back(type);
+        snprintf(buffer, sizeof(buffer), spec.c_str(),
+                 static_cast<unsigned long long>(  // NOLINT
+                     Truncate(arg.value, size ? size : arg.size,
+                              type == 'd' || type == 'i')));
+        text->append(buffer);
+        break;
+      case 'c':
+      case 'C':
+        if (!is_integer) {
+          AppendGenericArg(arg, text);
+          break;
+        }
+        {
+          std::string value;
+          AppendCodePoint(static_cast<uint32>(arg.value & 0xffff), &value);
+          AppendPadded(value, width, flags.find('-') != std::string::npos,
+                       text);
+        }
+        break;
+      case 's':
+      case 'S':
+      case 'Z':
+        if (!IsStringArg(arg)) {
+          AppendGenericArg(arg, text);
+          break;
+        }
+        {
+          std::string value(arg.type == binary_log::kNullStringArg ?
+                            std::string("(null)") : arg.string_value);
+          if (precision >= 0) {
+            value.resize(Utf8Prefix(value, static_cast<size_t>(precision)));
+          }
+          AppendPadded(value, width, flags.find('-') != std::string::npos,
+                       text);
+        }
+        break;
+      case 'p':
+        if (!is_integer) {
+          AppendGenericArg(arg, text);
+          break;
+        }
+        snprintf(buffer, sizeof(buffer), "%0*llX",
+                 static_cast<int>(arg.size * 2),
+                 static_cast<unsigned long long>(arg.value));  // NOLINT
+        text->append(buffer);
+        break;
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        if (arg.type != binary_log::kDoubleArg) {
+          AppendGenericArg(arg, text);
+          break;
+        }
+        spec.push_back(type);
+        snprintf(buffer, sizeof(buffer), spec.c_str(), arg.double_value);
+        text->append(buffer);
+        break;
+      case 'n':
+        break;
+      default:
+        text->append(format, spec_start, i + 1 - spec_start);
+        break;
+    }
+  }
+  return true;
+}
+
+bool BinaryLogDecoder::Decode(const uint8* data,
+                              size_t size,
+                              std::string* text) {
+  if (size < binary_log::kHeaderSize ||
+      memcmp(data, binary_log::kMagic, binary_log::kMagicSize) != 0 ||
+      data[binary_log::kMagicSize] != binary_log::kVersion) {
+    return false;
+  }
+
+  Reader reader(data + binary_log::kHeaderSize,
+                size - binary_log::kHeaderSize);
+  while (!reader.at_end()) {
+    const uint8 type = reader.ReadByte();
+    const uint64 payload_size = reader.ReadVarint();
+    if (reader.failed() || payload_size > reader.remaining()) {
+      return false;
+    }
+    const size_t record_size = static_cast<size_t>(payload_size);
+    const uint8* payload = reader.ReadBytes(record_size);
+    if (!DecodeRecord(type, payload, record_size, text)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool BinaryLogDecoder::DecodeRecord(uint8 type,
+                                    const uint8* payload,
+                                    size_t size,
+                                    std::string* text) {
+  Reader reader(payload, size);
+  switch (type) {
+    case binary_log::kProcessRecord: {
+      const uint64 pid = reader.ReadVarint();
+      Process& process = processes_[pid];
+      process.name = reader.ReadString();
+      process.formats.clear();
+      break;
+    }
+    case binary_log::kSiteRecord: {
+      const uint64 pid = reader.ReadVarint();
+      const uint64 site_id = reader.ReadVarint();
+      processes_[pid].formats[site_id] = reader.ReadString();
+      break;
+    }
+    case binary_log::kMessageRecord: {
+      const uint64 pid = reader.ReadVarint();
+      const uint64 tid = reader.ReadVarint();
+      const uint64 time = reader.ReadVarint();
+      const uint64 site_id = reader.ReadVarint();
+      if (reader.failed()) {
+        return false;
+      }
+
+      const Process& process = processes_[pid];
+      if (time) {
+        AppendTime(time, text);
+      }
+      char buffer[64] = {};
+      snprintf(buffer, sizeof(buffer), "][%llu:%llu]",
+               static_cast<unsigned long long>(pid),   // NOLINT
+               static_cast<unsigned long long>(tid));  // NOLINT
+      text->append("[");
+      text->append(process.name);
+      text->append(buffer);
+
+      const size_t args_size = reader.remaining();
+      const uint8* args = reader.ReadBytes(args_size);
+      std::map<uint64, std::string>::const_iterator it =
+          process.formats.find(site_id);
+      if (it != process.formats.end()) {
+        if (!FormatArgs(it->second, args, args_size, text)) {
+          return false;
+        }
+      } else {
+        snprintf(buffer, sizeof(buffer), "[unknown call site %llu]",
+                 static_cast<unsigned long long>(site_id));  // NOLINT
+        text->append(buffer);
+        Reader args_reader(args, args_size);
+        Arg arg;
+        while (!args_reader.at_end()) {
+          if (!ReadArg(&args_reader, &arg)) {
+            return false;
+          }
+          text->push_back(' ');
+          AppendGenericArg(arg, text);
+        }
+      }
+      text->append("\r\n");
+      break;
+    }
+    case binary_log::kTextRecord:
+      text->append(reader.ReadString());
+      text->append("\r\n");
+      break;
+    default:
+      // Records of unknown types are skipped.
+      return true;
+  }
+  return !reader.failed();
+}
+
+}  // namespace omaha
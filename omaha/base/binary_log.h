@@ -0,0 +1,161 @@
+// Copyright 2003-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// The binary log format, written by FileLogWriter in binary mode, and its
+// decoder. In binary mode, a log statement records the id of its call site and
+// its raw arguments instead of formatting its message. The format string of a
+// call site is written once per process, the first time the statement logs.
+// The decoder formats the messages as they would have been in a text log.
+//
+// This code does not depend on Windows, so that binary logs can be decoded
+// anywhere. Strings are UTF-16 in the log, and UTF-8 once decoded.
+//
+// A binary log is:
+//   magic:"OMBL" version:u8 record*
+//   record   := type:u8 varint(payload size) payload
+//   process  := varint(pid) string(process name)
+//   site     := varint(pid) varint(site id) string(format)
+//   message  := varint(pid) varint(tid) varint(time) varint(site id) arg*
+//   text     := string(text)
+//   string   := varint(length) (length UTF-16LE code units)
+//   arg      := tag:u8 value, with the type of the argument in the high nibble
+//               of the tag and its size in bytes in the low nibble.
+// The time is the local time, in 100ns since 1601, or 0 if the time is not
+// shown. Varints are unsigned LEB128, and signed varints are zigzag encoded.
+// A process record starts the call sites of its process over; a site record
+// maps the site id of a process to its format string. A text record holds a
+// message formatted by the process which logged it, prefix included.
+
+#ifndef OMAHA_BASE_BINARY_LOG_H_
+#define OMAHA_BASE_BINARY_LOG_H_
+
+#include <map>
+#include <string>
+
+#include "base/basictypes.h"
+
+namespace omaha {
+
+namespace binary_log {
+
+const char kMagic[] = "OMBL";
+const size_t kMagicSize = 4;
+const uint8 kVersion = 1;
+const size_t kHeaderSize = kMagicSize + 1;
+
+enum RecordType {
+  kProcessRecord = 1,
+  kSiteRecord = 2,
+  kMessageRecord = 3,
+  kTextRecord = 4,
+};
+
+enum ArgType {
+  kIntArg = 1,          // svarint(value)
+  kUintArg = 2,         // varint(value)
+  kDoubleArg = 3,       // 8 bytes, little endian
+  kPointerArg = 4,      // varint(value)
+  kStringArg = 5,       // string
+  kAnsiStringArg = 6,   // varint(length) bytes
+  kNullStringArg = 7,   // nothing
+};
+
+}  // namespace binary_log
+
+// Writes the fields of binary log records to a fixed size buffer. Once a field
+// does not fit, the encoder fails and writes nothing more.
+class BinaryLogEncoder {
+ public:
+  BinaryLogEncoder(uint8* buffer, size_t capacity);
+
+  void PutByte(uint8 value);
+  void PutVarint(uint64 value);
+  void PutSignedVarint(int64 value);
+  void PutBytes(const void* data, size_t size);
+  void PutString(const uint16* units, size_t length);
+
+  // Writes the type and the size of the payload of a record.
+  void PutRecordHeader(binary_log::RecordType type, size_t payload_size);
+
+  // Write the arguments of a message. |size| is the size of the argument in
+  // the call, which the decoder uses as printf would.
+  void PutIntArg(int64 value, size_t size);
+  void PutUintArg(uint64 value, size_t size);
+  void PutDoubleArg(double value);
+  void PutPointerArg(uint64 value, size_t size);
+  void PutStringArg(const uint16* units, size_t length);
+  void PutAnsiStringArg(const char* chars, size_t length);
+  void PutNullStringArg();
+
+  size_t size() const { return size_; }
+  bool failed() const { return failed_; }
+
+  static size_t VarintSize(uint64 value);
+  static size_t StringSize(size_t length);
+  static size_t RecordSize(size_t payload_size);
+
+ private:
+  void PutArgTag(binary_log::ArgType type, size_t size);
+
+  uint8* const buffer_;
+  const size_t capacity_;
+  size_t size_;
+  bool failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(BinaryLogEncoder);
+};
+
+// Turns binary logs back into text logs.
+class BinaryLogDecoder {
+ public:
+  BinaryLogDecoder();
+  ~BinaryLogDecoder();
+
+  // Decodes the |size| bytes of |data|, a binary log, and appends its lines to
+  // |text|. Returns false if the data is not a binary log or is malformed, in
+  // which case the lines before the error are still appended. Messages from
+  // unknown call sites, such as those whose site record was truncated from the
+  // log, are decoded as their site id followed by their arguments.
+  bool Decode(const uint8* data, size_t size, std::string* text);
+
+  // Formats the arguments in |args| according to the printf-style |format|,
+  // with the conventions of the wide Windows CRT functions, and appends the
+  // result to |text|. Returns false if the arguments are malformed.
+  static bool FormatArgs(const std::string& format,
+                         const uint8* args,
+                         size_t args_size,
+                         std::string* text);
+
+  static std::string Utf16ToUtf8(const uint16* units, size_t length);
+
+ private:
+  struct Process {
+    std::string name;
+    std::map<uint64, std::string> formats;
+  };
+
+  bool DecodeRecord(uint8 type,
+                    const uint8* payload,
+                    size_t size,
+                    std::string* text);
+
+  std::map<uint64, Process> processes_;
+
+  DISALLOW_COPY_AND_ASSIGN(BinaryLogDecoder);
+};
+
+}  // namespace omaha
+
+#endif  // OMAHA_BASE_BINARY_LOG_H_
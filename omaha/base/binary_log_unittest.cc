@@ -0,0 +1,299 @@
+// Copyright 2003-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/base/binary_log.h"
+
+#include <string.h>
+
+#include "omaha/testing/unit_test.h"
+
+namespace omaha {
+
+namespace {
+
+std::basic_string<uint16> Utf16(const char* ascii) {
+  return std::basic_string<uint16>(ascii, ascii + strlen(ascii));
+}
+
+void PutString(BinaryLogEncoder* encoder, const char* ascii) {
+  const std::basic_string<uint16> units(Utf16(ascii));
+  encoder->PutString(units.data(), units.size());
+}
+
+void PutStringArg(BinaryLogEncoder* encoder, const char* ascii) {
+  const std::basic_string<uint16> units(Utf16(ascii));
+  encoder->PutStringArg(units.data(), units.size());
+}
+
+// Writes a record whose payload is in |payload|.
+void PutRecord(BinaryLogEncoder* encoder,
+               binary_log::RecordType type,
+               const BinaryLogEncoder& payload,
+               const uint8* payload_data) {
+  encoder->PutRecordHeader(type, payload.size());
+  encoder->PutBytes(payload_data, payload.size());
+}
+
+class BinaryLogTest : public testing::Test {
+ protected:
+  BinaryLogTest() : log_(log_data_, sizeof(log_data_)) {}
+
+  virtual void SetUp() {
+    log_.PutBytes(binary_log::kMagic, binary_log::kMagicSize);
+    log_.PutByte(binary_log::kVersion);
+  }
+
+  void PutProcess(uint64 pid, const char* name) {
+    uint8 data[256] = {};
+    BinaryLogEncoder payload(data, sizeof(data));
+    payload.PutVarint(pid);
+    PutString(&payload, name);
+    PutRecord(&log_, binary_log::kProcessRecord, payload, data);
+  }
+
+  void PutSite(uint64 pid, uint64 site_id, const char* format) {
+    uint8 data[256] = {};
+    BinaryLogEncoder payload(data, sizeof(data));
+    payload.PutVarint(pid);
+    payload.PutVarint(site_id);
+    PutString(&payload, format);
+    PutRecord(&log_, binary_log::kSiteRecord, payload, data);
+  }
+
+  // Writes a message with the arguments in |args|.
+  void PutMessage(uint64 pid,
+                  uint64 tid,
+                  uint64 time,
+                  uint64 site_id,
+                  const BinaryLogEncoder& args,
+                  const uint8* args_data) {
+    uint8 data[256] = {};
+    BinaryLogEncoder payload(data, sizeof(data));
+    payload.PutVarint(pid);
+    payload.PutVarint(tid);
+    payload.PutVarint(time);
+    payload.PutVarint(site_id);
+    payload.PutBytes(args_data, args.size());
+    PutRecord(&log_, binary_log::kMessageRecord, payload, data);
+  }
+
+  bool Decode(std::string* text) {
+    EXPECT_FALSE(log_.failed());
+    BinaryLogDecoder decoder;
+    return decoder.Decode(log_data_, log_.size(), text);
+  }
+
+  uint8 log_data_[4096];
+  BinaryLogEncoder log_;
+};
+
+// Formats |format| with the arguments in |args|.
+std::string Format(const char* format, const BinaryLogEncoder& args,
+                   const uint8* args_data) {
+  std::string text;
+  EXPECT_TRUE(BinaryLogDecoder::FormatArgs(format, args_data, args.size(),
+                                           &text));
+  return text;
+}
+
+}  // namespace
+
+TEST(BinaryLogEncoderTest, Varint) {
+  uint8 data[32] = {};
+  BinaryLogEncoder encoder(data, sizeof(data));
+  encoder.PutVarint(0);
+  encoder.PutVarint(127);
+  encoder.PutVarint(300);
+  encoder.PutSignedVarint(-1);
+  encoder.PutSignedVarint(1);
+  ASSERT_EQ(6, encoder.size());
+  EXPECT_EQ(0x00, data[0]);
+  EXPECT_EQ(0x7f, data[1]);
+  EXPECT_EQ(0xac, data[2]);
+  EXPECT_EQ(0x02, data[3]);
+  EXPECT_EQ(0x01, data[4]);
+  EXPECT_EQ(0x02, data[5]);
+
+  EXPECT_EQ(1, BinaryLogEncoder::VarintSize(127));
+  EXPECT_EQ(2, BinaryLogEncoder::VarintSize(300));
+  EXPECT_EQ(10, BinaryLogEncoder::VarintSize(~0ULL));
+  EXPECT_EQ(7, BinaryLogEncoder::StringSize(3));
+  EXPECT_EQ(5, BinaryLogEncoder::RecordSize(3));
+}
+
+TEST(BinaryLogEncoderTest, Overflow) {
+  uint8 data[4] = {};
+  BinaryLogEncoder encoder(data, sizeof(data));
+  PutString(&encoder, "abc");
+  EXPECT_TRUE(encoder.failed());
+
+  // Nothing is written once the encoder has failed.
+  const size_t size = encoder.size();
+  encoder.PutByte(1);
+  EXPECT_EQ(size, encoder.size());
+}
+
+TEST(BinaryLogDecoderTest, Utf16ToUtf8) {
+  const uint16 units[] = {'a', 0xe9, 0x20ac, 0xd83d, 0xde00, 0xd800, 'b'};
+  EXPECT_EQ("a\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xef\xbf\xbd" "b",
+            BinaryLogDecoder::Utf16ToUtf8(units, arraysize(units)));
+}
+
+TEST(BinaryLogDecoderTest, FormatArgs_Integers) {
+  uint8 data[256] = {};
+  BinaryLogEncoder args(data, sizeof(data));
+  args.PutIntArg(-5, 4);
+  args.PutIntArg(-1, 4);
+  args.PutUintArg(0xffffffffffULL, 8);
+  args.PutIntArg(255, 4);
+  args.PutIntArg(-1, 8);
+  args.PutUintArg(7, 4);
+  args.PutIntArg(-2, 8);
+  EXPECT_EQ("[-5][4294967295][ffffffffff][  0ff][-1][0007][-2]",
+            Format("[%d][%u][%I64x][%5.3x][%lld][%04lu][%Id]", args, data));
+}
+
+TEST(BinaryLogDecoderTest, FormatArgs_HResult) {
+  uint8 data[256] = {};
+  BinaryLogEncoder args(data, sizeof(data));
+  args.PutIntArg(static_cast<int32>(0x80004005), 4);
+  EXPECT_EQ("[0x80004005]", Format("[%#08x]", args, data));
+}
+
+TEST(BinaryLogDecoderTest, FormatArgs_Strings) {
+  uint8 data[256] = {};
+  BinaryLogEncoder args(data, sizeof(data));
+  PutStringArg(&args, "wide");
+  args.PutAnsiStringArg("ansi", 4);
+  args.PutNullStringArg();
+  PutStringArg(&args, "abcdef");
+  PutStringArg(&args, "x");
+  args.PutUintArg('c', 2);
+  EXPECT_EQ("[wide][ansi][(null)][abc][x  ][c]",
+            Format("[%s][%S][%s][%.3s][%-3s][%c]", args, data));
+}
+
+TEST(BinaryLogDecoderTest, FormatArgs_Others) {
+  uint8 data[256] = {};
+  BinaryLogEncoder args(data, sizeof(data));
+  args.PutDoubleArg(1.5);
+  args.PutPointerArg(0x1234, 8);
+  args.PutPointerArg(0x5678, 8);
+  args.PutIntArg(6, 4);
+  args.PutIntArg(42, 4);
+  args.PutIntArg(0, 4);
+  EXPECT_EQ("[1.50][0000000000001234][    42][%]",
+            Format("[%.2f][%p%n][%*d][%%]", args, data));
+}
+
+// Missing arguments are left in the message, and mismatched ones are
+// formatted as best they can.
+TEST(BinaryLogDecoderTest, FormatArgs_Mismatched) {
+  uint8 data[256] = {};
+  BinaryLogEncoder args(data, sizeof(data));
+  PutStringArg(&args, "text");
+  args.PutIntArg(3, 4);
+  EXPECT_EQ("[text][3][%d][%s]", Format("[%d][%s][%d][%s]", args, data));
+}
+
+TEST(BinaryLogDecoderTest, FormatArgs_Malformed) {
+  const uint8 data[] = {0xf0, 0x01};
+  std::string text;
+  EXPECT_FALSE(BinaryLogDecoder::FormatArgs("%d", data, sizeof(data), &text));
+}
+
+TEST_F(BinaryLogTest, Decode) {
+  PutProcess(12, "GoogleUpdate.exe");
+  PutSite(12, 1, "[Worker::Install][%s][0x%08x]");
+
+  uint8 data[256] = {};
+  BinaryLogEncoder args(data, sizeof(data));
+  PutStringArg(&args, "{app}");
+  args.PutIntArg(static_cast<int32>(0x80004005), 4);
+
+  // 07/04/21 13:14:15.678, in 100ns since 1601.
+  const uint64 time = ((((153586ULL * 24 + 13) * 60 + 14) * 60 + 15) * 1000 +
+                       678) * 10000;
+  PutMessage(12, 34, time, 1, args, data);
+
+  uint8 text_data[64] = {};
+  BinaryLogEncoder text_record(text_data, sizeof(text_data));
+  PutString(&text_record, "LOG_SYSTEM: a text line");
+  PutRecord(&log_, binary_log::kTextRecord, text_record, text_data);
+
+  // The time is not shown.
+  PutMessage(12, 35, 0, 1, args, data);
+
+  std::string text;
+  ASSERT_TRUE(Decode(&text));
+  EXPECT_EQ("[07/04/21 13:14:15.678][GoogleUpdate.exe][12:34]"
+            "[Worker::Install][{app}][0x80004005]\r\n"
+            "LOG_SYSTEM: a text line\r\n"
+            "[GoogleUpdate.exe][12:35][Worker::Install][{app}][0x80004005]\r\n",
+            text);
+}
+
+// A process record starts its call sites over, such as when the process
+// starts logging to a truncated log again.
+TEST_F(BinaryLogTest, Decode_UnknownSite) {
+  PutProcess(12, "GoogleUpdate.exe");
+  PutSite(12, 1, "[%d]");
+  PutProcess(12, "GoogleUpdate.exe");
+
+  uint8 data[256] = {};
+  BinaryLogEncoder args(data, sizeof(data));
+  args.PutIntArg(-3, 4);
+  PutStringArg(&args, "s");
+  PutMessage(12, 34, 0, 1, args, data);
+
+  std::string text;
+  ASSERT_TRUE(Decode(&text));
+  EXPECT_EQ("[GoogleUpdate.exe][12:34][unknown call site 1] -3 s\r\n", text);
+}
+
+TEST_F(BinaryLogTest, Decode_UnknownRecordType) {
+  uint8 data[4] = {1, 2, 3, 4};
+  BinaryLogEncoder payload(data, sizeof(data));
+  payload.PutBytes(data, sizeof(data));
+  PutRecord(&log_, static_cast<binary_log::RecordType>(99), payload, data);
+
+  uint8 text_data[64] = {};
+  BinaryLogEncoder text_record(text_data, sizeof(text_data));
+  PutString(&text_record, "after");
+  PutRecord(&log_, binary_log::kTextRecord, text_record, text_data);
+
+  std::string text;
+  ASSERT_TRUE(Decode(&text));
+  EXPECT_EQ("after\r\n", text);
+}
+
+TEST_F(BinaryLogTest, Decode_Malformed) {
+  std::string text;
+  BinaryLogDecoder decoder;
+  const uint8 not_a_log[] = "OMBX\x01";
+  EXPECT_FALSE(decoder.Decode(not_a_log, sizeof(not_a_log) - 1, &text));
+
+  // The lines before a truncated record are still decoded.
+  uint8 text_data[64] = {};
+  BinaryLogEncoder text_record(text_data, sizeof(text_data));
+  PutString(&text_record, "complete");
+  PutRecord(&log_, binary_log::kTextRecord, text_record, text_data);
+  PutRecord(&log_, binary_log::kTextRecord, text_record, text_data);
+
+  EXPECT_FALSE(decoder.Decode(log_data_, log_.size() - 1, &text));
+  EXPECT_EQ("complete\r\n", text);
+}
+
+}  // namespace omaha
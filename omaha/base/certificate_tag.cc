@@ -0,0 +1,154 @@
+// Copyright 2005-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/base/certificate_tag.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace omaha {
+
+const char kCertificateTagMagic[] = "Gact2.0Omaha";
+
+namespace {
+
+// The offsets below are those of the PE/COFF specification. They are spelled
+// out instead of taken from the IMAGE_* structures of winnt.h, so that the
+// parser does not depend on the bitness of the code it is built into.
+const size_t kNewHeaderOffset = 60;              // IMAGE_DOS_HEADER.e_lfanew
+const size_t kFileHeaderLength = 20;             // IMAGE_FILE_HEADER
+const size_t kOptionalHeaderSizeOffset = 16;     // SizeOfOptionalHeader
+const uint16 kOptionalHeaderMagic32 = 0x10b;
+const uint16 kOptionalHeaderMagic64 = 0x20b;
+const size_t kDataDirectoriesOffset32 = 96;
+const size_t kDataDirectoriesOffset64 = 112;
+const size_t kDataDirectoryEntryLength = 8;
+const size_t kSecurityDirectoryIndex = 4;        // IMAGE_DIRECTORY_ENTRY_SECURITY
+const size_t kWinCertificateHeaderLength = 8;    // dwLength, wRevision, wType
+
+uint16 GetUint16(const uint8* p) {
+  return static_cast<uint16>(p[0] | (p[1] << 8));
+}
+
+uint32 GetUint32(const uint8* p) {
+  return static_cast<uint32>(p[0]) |
+         (static_cast<uint32>(p[1]) << 8) |
+         (static_cast<uint32>(p[2]) << 16) |
+         (static_cast<uint32>(p[3]) << 24);
+}
+
+// Returns where the certificate directory entry is, or 0 if |data| is not a
+// PE file.
+size_t FindCertificateDirectoryEntry(const uint8* data, size_t size) {
+  if (size < kNewHeaderOffset + sizeof(uint32) ||
+      data[0] != 'M' || data[1] != 'Z') {
+    return 0;
+  }
+  const size_t pe_header = GetUint32(data + kNewHeaderOffset);
+  const size_t optional_header = pe_header + 4 + kFileHeaderLength;
+  if (pe_header > size || size - pe_header < 4 + kFileHeaderLength + 2 ||
+      memcmp(data + pe_header, "PE\0\0", 4)) {
+    return 0;
+  }
+
+  size_t data_directories = 0;
+  switch (GetUint16(data + optional_header)) {
+    case kOptionalHeaderMagic32:
+      data_directories = kDataDirectoriesOffset32;
+      break;
+    case kOptionalHeaderMagic64:
+      data_directories = kDataDirectoriesOffset64;
+      break;
+    default:
+      return 0;
+  }
+
+  const size_t entry = kSecurityDirectoryIndex * kDataDirectoryEntryLength +
+                       data_directories;
+  const size_t optional_header_size =
+      GetUint16(data + pe_header + 4 + kOptionalHeaderSizeOffset);
+  if (entry + kDataDirectoryEntryLength > optional_header_size ||
+      size - optional_header < entry + kDataDirectoryEntryLength) {
+    return 0;
+  }
+  return optional_header + entry;
+}
+
+}  // namespace
+
+CertificateTag::CertificateTag()
+    : cert_dir_entry_offset(0),
+      cert_dir_offset(0),
+      cert_dir_length(0),
+      tag_region_offset(0),
+      tag_region_length(0),
+      tag(NULL),
+      tag_length(0) {
+}
+
+bool ParseCertificateTag(const void* data, size_t size, CertificateTag* tag) {
+  *tag = CertificateTag();
+  const uint8* bytes = static_cast<const uint8*>(data);
+  const size_t entry = FindCertificateDirectoryEntry(bytes, size);
+  if (!entry) {
+    return false;
+  }
+
+  const size_t cert_dir_offset = GetUint32(bytes + entry);
+  const size_t cert_dir_length = GetUint32(bytes + entry + 4);
+  if (!cert_dir_offset ||
+      cert_dir_offset > size ||
+      cert_dir_length > size - cert_dir_offset ||
+      cert_dir_length < kWinCertificateHeaderLength + 4) {
+    return false;
+  }
+  // The signature is a DER-encoded PKCS#7 SEQUENCE with a two byte length.
+  const uint8* cert_dir = bytes + cert_dir_offset;
+  if (cert_dir[kWinCertificateHeaderLength] != 0x30 ||
+      cert_dir[kWinCertificateHeaderLength + 1] != 0x82) {
+    return false;
+  }
+
+  tag->cert_dir_entry_offset = entry;
+  tag->cert_dir_offset = cert_dir_offset;
+  tag->cert_dir_length = cert_dir_length;
+
+  const uint8* cert_dir_end = cert_dir + cert_dir_length;
+  const uint8* magic = std::search(cert_dir,
+                                   cert_dir_end,
+                                   kCertificateTagMagic,
+                                   kCertificateTagMagic +
+                                       kCertificateTagMagicLength);
+  if (magic == cert_dir_end) {
+    return true;
+  }
+  tag->tag_region_offset = magic - bytes;
+  tag->tag_region_length = cert_dir_end - magic;
+
+  if (tag->tag_region_length < kCertificateTagHeaderLength) {
+    return true;
+  }
+  const uint8* length = magic + kCertificateTagMagicLength;
+  const size_t tag_length = (length[0] << 8) | length[1];
+  if (tag_length &&
+      tag_length <= tag->tag_region_length - kCertificateTagHeaderLength) {
+    tag->tag = reinterpret_cast<const char*>(magic +
+                                             kCertificateTagHeaderLength);
+    tag->tag_length = tag_length;
+  }
+  return true;
+}
+
+}  // namespace omaha
@@ -0,0 +1,79 @@
+// Copyright 2005-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Finds the certificate directory of a signed PE file and the Omaha tag in
+// it. This is the one parser behind TagExtractor and ApplyTag.
+//
+// The parser reads the bytes it is given and nothing else: it does not
+// allocate, and the tag it returns points into those bytes. It works the same
+// over a buffer or a view of a file mapping, and uses no Windows headers, so
+// that tag inspection tools can run it over many files on any platform.
+//
+// We're exploiting the empirical observation that Windows checks the
+// signature on a PE file but doesn't care if the certificate directory has
+// extra bytes after the signature. The tagged certificate directory looks like
+// this:
+//
+//   <WIN_CERTIFICATE><PKCS#7 signature><padding>
+//
+// where the padding holds the tag:
+//
+//   000000-00000B: 12-byte magic "Gact2.0Omaha"
+//   00000C-00000D: unsigned 16-bit tag length (big-endian)
+//   00000E-??????: ASCII tag, not null terminated
+
+#ifndef OMAHA_BASE_CERTIFICATE_TAG_H_
+#define OMAHA_BASE_CERTIFICATE_TAG_H_
+
+#include "base/basictypes.h"
+
+namespace omaha {
+
+extern const char kCertificateTagMagic[];
+const size_t kCertificateTagMagicLength = 12;
+
+// The size of the magic and of the tag length in front of a tag.
+const size_t kCertificateTagHeaderLength = kCertificateTagMagicLength + 2;
+
+struct CertificateTag {
+  CertificateTag();
+
+  // Where the PE file records the offset and the length of the certificate
+  // directory, as two little-endian 32-bit values.
+  size_t cert_dir_entry_offset;
+
+  // The certificate directory itself.
+  size_t cert_dir_offset;
+  size_t cert_dir_length;
+
+  // Where the tag magic starts, and the room from there to the end of the
+  // certificate directory. Both are 0 if there is no magic; such a file has
+  // no room for a tag.
+  size_t tag_region_offset;
+  size_t tag_region_length;
+
+  // The tag, pointing into the parsed bytes, or NULL if there is no tag.
+  const char* tag;
+  size_t tag_length;
+};
+
+// Parses the |size| bytes at |data|, which hold a whole PE file. Returns false
+// if they are not a PE file with a signature in its certificate directory.
+// Both 32-bit and 64-bit images are handled.
+bool ParseCertificateTag(const void* data, size_t size, CertificateTag* tag);
+
+}  // namespace omaha
+
+#endif  // OMAHA_BASE_CERTIFICATE_TAG_H_
@@ -0,0 +1,281 @@
+// Copyright 2005-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// The tests read the files in common/certificate_tag/testdata. They only need
+// the parser and gtest, so they also run on Linux. From the root of the
+// repository:
+//
+// $ CXXFLAGS="-I. -Iomaha/third_party/chrome/files/src"
+// $ g++ $CXXFLAGS omaha/base/certificate_tag.cc
+//       omaha/base/certificate_tag_unittest.cc
+//       -lgtest -lgtest_main -lpthread -o /tmp/certificate_tag_unittest
+// $ /tmp/certificate_tag_unittest
+
+#include "omaha/base/certificate_tag.h"
+
+#include <string.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include "omaha/base/app_util.h"
+#include "omaha/testing/unit_test.h"
+#else
+#include <gtest/gtest.h>
+#endif
+
+namespace omaha {
+
+namespace {
+
+const char kChromeSetup[] = "ChromeSetup.exe";
+
+// The certificate directory of ChromeSetup.exe, as dumpbin /headers shows it.
+const size_t kChromeSetupCertDirOffset = 813056;
+const size_t kChromeSetupCertDirLength = 6128;
+
+std::string GetTestDataPath(const char* name) {
+#if defined(_WIN32)
+  return std::string(CT2A(app_util::GetCurrentModuleDirectory())) +
+         "\\unittest_support\\certificate_tag\\" + name;
+#else
+  return std::string("common/certificate_tag/testdata/") + name;
+#endif
+}
+
+std::vector<uint8> ReadTestData(const char* name) {
+  std::ifstream file(GetTestDataPath(name).c_str(), std::ios::binary);
+  EXPECT_TRUE(file.good()) << name;
+  return std::vector<uint8>(std::istreambuf_iterator<char>(file),
+                            std::istreambuf_iterator<char>());
+}
+
+uint32 GetUint32(const std::vector<uint8>& data, size_t offset) {
+  return data[offset] | (data[offset + 1] << 8) | (data[offset + 2] << 16) |
+         (static_cast<uint32>(data[offset + 3]) << 24);
+}
+
+void PutUint32(uint32 value, size_t offset, std::vector<uint8>* data) {
+  for (int i = 0; i != 4; ++i) {
+    (*data)[offset + i] = static_cast<uint8>(value >> (i * 8));
+  }
+}
+
+// Grows the certificate directory of |exe| with the padding ApplyTag needs,
+// holding |tag|, the way the signing step of the build does it.
+void AddTagRegion(const std::string& tag,
+                  size_t padding,
+                  std::vector<uint8>* exe) {
+  CertificateTag parsed;
+  ASSERT_TRUE(ParseCertificateTag(&exe->front(), exe->size(), &parsed));
+  ASSERT_EQ(parsed.cert_dir_offset + parsed.cert_dir_length, exe->size());
+
+  exe->insert(exe->end(),
+              kCertificateTagMagic,
+              kCertificateTagMagic + kCertificateTagMagicLength);
+  exe->push_back(static_cast<uint8>(tag.size() >> 8));
+  exe->push_back(static_cast<uint8>(tag.size()));
+  exe->insert(exe->end(), tag.begin(), tag.end());
+  exe->resize(exe->size() + padding);
+  PutUint32(static_cast<uint32>(exe->size() - parsed.cert_dir_offset),
+            parsed.cert_dir_entry_offset + 4,
+            exe);
+}
+
+bool Parse(const std::vector<uint8>& data, CertificateTag* tag) {
+  return ParseCertificateTag(data.empty() ? NULL : &data.front(),
+                             data.size(),
+                             tag);
+}
+
+}  // namespace
+
+TEST(CertificateTagTest, UntaggedExe) {
+  const std::vector<uint8> exe(ReadTestData(kChromeSetup));
+  ASSERT_FALSE(exe.empty());
+
+  CertificateTag tag;
+  ASSERT_TRUE(Parse(exe, &tag));
+  EXPECT_EQ(kChromeSetupCertDirOffset, tag.cert_dir_offset);
+  EXPECT_EQ(kChromeSetupCertDirLength, tag.cert_dir_length);
+  EXPECT_EQ(tag.cert_dir_offset, GetUint32(exe, tag.cert_dir_entry_offset));
+  EXPECT_EQ(tag.cert_dir_length,
+            GetUint32(exe, tag.cert_dir_entry_offset + 4));
+
+  // The file carries a superfluous certificate tag, which is not the kind
+  // this parser reads, and has no padding for one.
+  EXPECT_EQ(0u, tag.tag_region_offset);
+  EXPECT_EQ(0u, tag.tag_region_length);
+  EXPECT_TRUE(tag.tag == NULL);
+  EXPECT_EQ(0u, tag.tag_length);
+}
+
+TEST(CertificateTagTest, TaggedExe) {
+  std::vector<uint8> exe(ReadTestData(kChromeSetup));
+  ASSERT_FALSE(exe.empty());
+  const size_t original_size = exe.size();
+  const std::string expected_tag("appguid={8A69D345-D564-463C-AFF1-"
+                                 "A69D9E530F96}&appname=Chrome&needsadmin=no");
+  AddTagRegion(expected_tag, 2048, &exe);
+
+  CertificateTag tag;
+  ASSERT_TRUE(Parse(exe, &tag));
+  EXPECT_EQ(kChromeSetupCertDirOffset, tag.cert_dir_offset);
+  EXPECT_EQ(exe.size() - kChromeSetupCertDirOffset, tag.cert_dir_length);
+  EXPECT_EQ(original_size, tag.tag_region_offset);
+  EXPECT_EQ(exe.size() - original_size, tag.tag_region_length);
+
+  // The tag is a view into the parsed bytes.
+  ASSERT_TRUE(tag.tag != NULL);
+  EXPECT_EQ(reinterpret_cast<const char*>(&exe.front()) + original_size +
+                kCertificateTagHeaderLength,
+            tag.tag);
+  EXPECT_EQ(expected_tag, std::string(tag.tag, tag.tag_length));
+}
+
+TEST(CertificateTagTest, EmptyTagRegion) {
+  std::vector<uint8> exe(ReadTestData(kChromeSetup));
+  ASSERT_FALSE(exe.empty());
+  AddTagRegion(std::string(), 8192, &exe);
+
+  CertificateTag tag;
+  ASSERT_TRUE(Parse(exe, &tag));
+  EXPECT_NE(0u, tag.tag_region_offset);
+  EXPECT_EQ(8192 + kCertificateTagHeaderLength, tag.tag_region_length);
+  EXPECT_TRUE(tag.tag == NULL);
+}
+
+TEST(CertificateTagTest, TagPastCertificateDirectory) {
+  std::vector<uint8> exe(ReadTestData(kChromeSetup));
+  ASSERT_FALSE(exe.empty());
+  AddTagRegion("abc", 0, &exe);
+
+  // The tag length runs one byte past the end of the directory.
+  exe[exe.size() - 4] = 4;
+
+  CertificateTag tag;
+  ASSERT_TRUE(Parse(exe, &tag));
+  EXPECT_NE(0u, tag.tag_region_offset);
+  EXPECT_TRUE(tag.tag == NULL);
+}
+
+TEST(CertificateTagTest, NotPeFiles) {
+  const char* const kFiles[] = {
+    "test7zSigned.msi",
+    "test7zSigned-smallcert.msi",
+  };
+  for (size_t i = 0; i != sizeof(kFiles) / sizeof(kFiles[0]); ++i) {
+    const std::vector<uint8> msi(ReadTestData(kFiles[i]));
+    ASSERT_FALSE(msi.empty());
+    CertificateTag tag;
+    EXPECT_FALSE(Parse(msi, &tag)) << kFiles[i];
+  }
+
+  CertificateTag tag;
+  EXPECT_FALSE(Parse(std::vector<uint8>(), &tag));
+  EXPECT_FALSE(Parse(std::vector<uint8>(4096, 0), &tag));
+}
+
+TEST(CertificateTagTest, Truncated) {
+  const std::vector<uint8> exe(ReadTestData(kChromeSetup));
+  ASSERT_FALSE(exe.empty());
+
+  // Every prefix that cuts into the headers or the certificate directory is
+  // rejected without reading past its end.
+  for (size_t size = 0; size < exe.size(); size += size < 1024 ? 1 : 4093) {
+    const std::vector<uint8> truncated(exe.begin(), exe.begin() + size);
+    CertificateTag tag;
+    EXPECT_FALSE(Parse(truncated, &tag)) << size;
+  }
+}
+
+TEST(CertificateTagTest, Corrupted) {
+  const std::vector<uint8> exe(ReadTestData(kChromeSetup));
+  ASSERT_FALSE(exe.empty());
+  CertificateTag tag;
+  ASSERT_TRUE(Parse(exe, &tag));
+  const size_t entry = tag.cert_dir_entry_offset;
+
+  std::vector<uint8> bad(exe);
+  bad[0] = 'X';
+  EXPECT_FALSE(Parse(bad, &tag));
+
+  bad = exe;
+  PutUint32(0xfffffff0, 60, &bad);
+  EXPECT_FALSE(Parse(bad, &tag));
+
+  bad = exe;
+  PutUint32(0, entry, &bad);
+  EXPECT_FALSE(Parse(bad, &tag));
+
+  bad = exe;
+  PutUint32(static_cast<uint32>(exe.size()), entry, &bad);
+  EXPECT_FALSE(Parse(bad, &tag));
+
+  bad = exe;
+  PutUint32(static_cast<uint32>(kChromeSetupCertDirLength + 1), entry + 4,
+            &bad);
+  EXPECT_FALSE(Parse(bad, &tag));
+
+  bad = exe;
+  PutUint32(0xffffffff, entry + 4, &bad);
+  EXPECT_FALSE(Parse(bad, &tag));
+
+  // Not a DER SEQUENCE.
+  bad = exe;
+  bad[kChromeSetupCertDirOffset + 8] = 0x31;
+  EXPECT_FALSE(Parse(bad, &tag));
+}
+
+TEST(CertificateTagTest, Image64) {
+  // A PE32+ image has larger optional header fields, which move the data
+  // directories by 16 bytes.
+  const size_t kPeHeader = 64;
+  const size_t kOptionalHeader = kPeHeader + 4 + 20;
+  const size_t kEntry = kOptionalHeader + 112 + 4 * 8;
+  const size_t kCertDir = 512;
+
+  std::vector<uint8> exe(kCertDir, 0);
+  exe[0] = 'M';
+  exe[1] = 'Z';
+  PutUint32(kPeHeader, 60, &exe);
+  memcpy(&exe[kPeHeader], "PE\0\0", 4);
+  exe[kPeHeader + 4 + 16] = 240;  // SizeOfOptionalHeader.
+  exe[kOptionalHeader] = 0x0b;
+  exe[kOptionalHeader + 1] = 0x02;
+
+  const uint8 kCertificate[] = { 16, 0, 0, 0, 0, 2, 2, 0,
+                                 0x30, 0x82, 0, 4, 1, 2, 3, 4 };
+  exe.insert(exe.end(), kCertificate, kCertificate + sizeof(kCertificate));
+  PutUint32(kCertDir, kEntry, &exe);
+  PutUint32(sizeof(kCertificate), kEntry + 4, &exe);
+  AddTagRegion("lang=en", 1, &exe);
+
+  CertificateTag tag;
+  ASSERT_TRUE(Parse(exe, &tag));
+  EXPECT_EQ(kEntry, tag.cert_dir_entry_offset);
+  EXPECT_EQ(kCertDir, tag.cert_dir_offset);
+  ASSERT_TRUE(tag.tag != NULL);
+  EXPECT_EQ("lang=en", std::string(tag.tag, tag.tag_length));
+
+  // The same bytes read as a PE32 image have no certificate directory.
+  exe[kOptionalHeader] = 0x0b;
+  exe[kOptionalHeader + 1] = 0x01;
+  EXPECT_FALSE(Parse(exe, &tag));
+}
+
+}  // namespace omaha
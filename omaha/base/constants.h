@@ -338,6 +338,16 @@ const TCHAR* const kRegValueNoCodeRedCheck     = _T("NoCrCheck");
 // Enables sending usage stats always if the value is present.
 const TCHAR* const kRegValueForceUsageStats    = _T("UsageStats");
 
+// Aggregates usage stats to a file instead of the registry if the value is 1.
+const TCHAR* const kRegValueUsageStatsFile     = _T("UsageStatsFile");
+
+// Uploads usage stats as text instead of binary if the value is 1.
+const TCHAR* const kRegValueUsageStatsText     = _T("UsageStatsText");
+
+// Serves a snapshot of the metrics of the long-running processes on a named
+// pipe if the value is 1.
+const TCHAR* const kRegValueMetricsEndpoint    = _T("MetricsEndpoint");
+
 // Override to allow/disallow the machine to appear as part of a domain:
 // * not present; domain membership is determined via ::NetGetJoinInformation.
 // * present and set to TRUE; the machine acts as it were part of a domain.
@@ -19,6 +19,19 @@
 
 namespace omaha {
 
+namespace {
+
+// The writer masks cached in the call sites of the log statements depend on
+// the enable flags and level of the trace session.
+void InvalidateLogCallSites() {
+  Logging* logging = GetLogging();
+  if (logging) {
+    logging->InvalidateCallSites();
+  }
+}
+
+}  // namespace
+
 // {9B18BFF9-915E-4cc1-9C3E-F4AC112CB36C}
 const GUID EtwLogWriter::kOmahaTraceGuid =
     { 0x9b18bff9, 0x915e, 0x4cc1,
@@ -62,6 +75,11 @@ bool EtwLogWriter::IsCatLevelEnabled(LogCategory category,
   return true;
 }
 
+// Messages are only formatted for the writer when a trace session wants them.
+bool EtwLogWriter::NeedsMessage(LogCategory category, LogLevel level) const {
+  return IsCatLevelEnabled(category, level);
+}
+
 void EtwLogWriter::OutputMessage(const OutputInfo* output_info) {
   if (!IsCatLevelEnabled(output_info->category, output_info->level))
     return;
@@ -95,10 +113,12 @@ void EtwLogWriter::OutputMessage(const OutputInfo* output_info) {
 }
 
 void EtwLogWriter::OnEventsEnabled() {
+  InvalidateLogCallSites();
   CORE_LOG(L2, (_T("ETW logging enabled")));
 }
 
 void EtwLogWriter::OnEventsDisabled() {
+  InvalidateLogCallSites();
   CORE_LOG(L2, (_T("ETW logging disabled")));
 }
 
@@ -47,6 +47,7 @@ class EtwLogWriter : public LogWriter, public EtwTraceProvider {
   virtual bool WantsToLogRegardless() const;
   virtual bool IsCatLevelEnabled(LogCategory category, LogLevel level) const;
   virtual void OutputMessage(const OutputInfo* output_info);
+  virtual bool NeedsMessage(LogCategory category, LogLevel level) const;
 
   // Factory for new instances.
   static EtwLogWriter* Create();
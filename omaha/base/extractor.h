@@ -72,6 +72,15 @@ class TagExtractor {
                     char* tag_buffer,
                     int* tag_buffer_len);
 
+    /**
+    * Returns the tag in the current file without copying it. |tag| points
+    * into the mapping of the file and is valid until the file is closed. The
+    * tag is not null terminated.
+    *
+    * @return true if the file has a tag.
+    */
+    bool GetTag(const char** tag, size_t* tag_length);
+
     int cert_dir_length() const { return cert_dir_length_; }
     const void* cert_dir_base() const { return cert_dir_base_; }
 
@@ -83,21 +92,16 @@ class TagExtractor {
   int cert_dir_length_;
   const void* cert_dir_base_;
 
-  bool ReadTag(const char* read_base,
-               char* tag_buffer,
-               int* tag_buffer_len) const;
-
-  const IMAGE_DATA_DIRECTORY* GetCertificateDirectory(const void* base) const;
-
-  const void* GetASN1SignaturePointer(const void* base) const;
-
-  int GetASN1SignatureLength(const void* base) const;
+  // Parses |file_buffer| and returns a view of its tag.
+  bool InternalGetTag(const char* file_buffer,
+                      size_t file_length,
+                      const char** tag,
+                      size_t* tag_length);
 
   bool InternalExtractTag(const char* file_buffer,
+                          size_t file_length,
                           char* tag_buffer,
                           int* tag_buffer_len);
-
-  bool InternalReadCertificate(const char* file_buffer);
 };
 
 }  // namespace omaha
@@ -22,9 +22,11 @@
 
 #include <shlobj.h>
 #include <memory>
+#include <vector>
 
 #include "omaha/base/app_util.h"
 #include "omaha/base/apply_tag.h"
+#include "omaha/base/file.h"
 #include "omaha/base/scope_guard.h"
 #include "omaha/base/utils.h"
 #include "omaha/testing/unit_test.h"
@@ -236,5 +238,109 @@ TEST(ApplyTagTest, InvalidCharsTest) {
                                   false));
 }
 
+TEST(ApplyTagBatchTest, EmbedExtract) {
+  CString signed_exe_file;
+  signed_exe_file.Format(_T("%s\\%s\\%s"),
+                         app_util::GetCurrentModuleDirectory(),
+                         kFilePath, kFileName);
+  CString temp_path = app_util::GetTempDir();
+  ASSERT_FALSE(temp_path.IsEmpty());
+
+  ApplyTagBatch batch;
+  ASSERT_SUCCEEDED(batch.Init(signed_exe_file, false));
+
+  const char* const kTags[] = { "appguid=a", kTagString, "", "bad tag",
+                                "appguid=b&lang=en" };
+  std::vector<ApplyTagBatch::Output> outputs(arraysize(kTags));
+  for (size_t i = 0; i != outputs.size(); ++i) {
+    outputs[i].tag_string = kTags[i];
+    outputs[i].tagged_file.Format(_T("%sbatch%Iu%s"), temp_path, i, kFileName);
+  }
+  EXPECT_EQ(E_INVALIDARG, batch.EmbedTagStrings(&outputs, 3));
+
+  for (size_t i = 0; i != outputs.size(); ++i) {
+    ON_SCOPE_EXIT(::DeleteFile, outputs[i].tagged_file);
+    if (i == 3) {
+      EXPECT_EQ(E_INVALIDARG, outputs[i].hr);
+      continue;
+    }
+    ASSERT_SUCCEEDED(outputs[i].hr);
+
+    // Each output is what ApplyTag writes for the same tag.
+    CString single_file;
+    single_file.Format(_T("%ssingle%Iu%s"), temp_path, i, kFileName);
+    omaha::ApplyTag tag;
+    ASSERT_SUCCEEDED(tag.Init(signed_exe_file,
+                              kTags[i],
+                              static_cast<int>(strlen(kTags[i])),
+                              single_file,
+                              false));
+    ASSERT_SUCCEEDED(tag.EmbedTagString());
+    ON_SCOPE_EXIT(::DeleteFile, single_file);
+    EXPECT_TRUE(File::AreFilesIdentical(single_file, outputs[i].tagged_file));
+
+    TagExtractor extractor;
+    ASSERT_TRUE(extractor.OpenFile(outputs[i].tagged_file));
+    int tag_buffer_size = 0;
+    if (!*kTags[i]) {
+      // An empty tag is accepted, as ApplyTag does, and reads back as no tag.
+      EXPECT_FALSE(extractor.ExtractTag(NULL, &tag_buffer_size));
+      extractor.CloseFile();
+      continue;
+    }
+    ASSERT_TRUE(extractor.ExtractTag(NULL, &tag_buffer_size));
+    std::unique_ptr<char[]> tag_buffer(new char[tag_buffer_size]);
+    ASSERT_TRUE(extractor.ExtractTag(tag_buffer.get(), &tag_buffer_size));
+    EXPECT_STREQ(kTags[i], tag_buffer.get());
+    extractor.CloseFile();
+  }
+}
+
+TEST(ApplyTagBatchTest, AlreadyTagged) {
+  CString signed_exe_file;
+  signed_exe_file.Format(_T("%s\\%s\\%s"),
+                         app_util::GetCurrentModuleDirectory(),
+                         kFilePath, kFileName);
+  CString temp_path = app_util::GetTempDir();
+  ASSERT_FALSE(temp_path.IsEmpty());
+
+  CString tagged_file;
+  tagged_file.Format(_T("%sbatch_tagged%s"), temp_path, kFileName);
+  ApplyTagBatch batch;
+  ASSERT_SUCCEEDED(batch.Init(signed_exe_file, false));
+  ASSERT_SUCCEEDED(batch.EmbedTagString(kTagString,
+                                        static_cast<int>(strlen(kTagString)),
+                                        tagged_file));
+  ON_SCOPE_EXIT(::DeleteFile, tagged_file);
+
+  ApplyTagBatch no_append;
+  EXPECT_EQ(APPLYTAG_E_ALREADY_TAGGED, no_append.Init(tagged_file, false));
+
+  ApplyTagBatch append;
+  ASSERT_SUCCEEDED(append.Init(tagged_file, true));
+  std::vector<ApplyTagBatch::Output> outputs(2);
+  for (size_t i = 0; i != outputs.size(); ++i) {
+    outputs[i].tag_string = kAppendTagString;
+    outputs[i].tagged_file.Format(_T("%sbatch_appended%Iu%s"),
+                                  temp_path, i, kFileName);
+  }
+  EXPECT_SUCCEEDED(append.EmbedTagStrings(&outputs, 0));
+
+  CStringA expected_tag_string(kTagString);
+  expected_tag_string += kAppendTagString;
+  for (size_t i = 0; i != outputs.size(); ++i) {
+    ON_SCOPE_EXIT(::DeleteFile, outputs[i].tagged_file);
+    EXPECT_SUCCEEDED(outputs[i].hr);
+
+    TagExtractor extractor;
+    ASSERT_TRUE(extractor.OpenFile(outputs[i].tagged_file));
+    char tag_buffer[256] = {0};
+    int tag_buffer_size = arraysize(tag_buffer);
+    ASSERT_TRUE(extractor.ExtractTag(tag_buffer, &tag_buffer_size));
+    EXPECT_STREQ(expected_tag_string, tag_buffer);
+    extractor.CloseFile();
+  }
+}
+
 }  // namespace omaha
 
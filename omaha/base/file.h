@@ -44,6 +44,9 @@ class File {
 
     HRESULT Close();
 
+    // Returns the name the file was opened with.
+    const CString& file_name() const { return file_name_; }
+
     static inline bool Exists(const TCHAR* file_name) {
       // The path must not be enclosed in quotes. This is the Windows standard.
       // ::GetFileAttributesEx() returns ERROR_INVALID_NAME for quoted paths.
@@ -0,0 +1,382 @@
+// Copyright 2003-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/base/file_pipeline.h"
+
+#include <string.h>
+
+#include "omaha/base/debug.h"
+#include "omaha/base/error.h"
+#include "omaha/base/logging.h"
+#include "omaha/base/path.h"
+#include "omaha/base/security/sha256.h"
+#include "omaha/base/utils.h"
+
+namespace omaha {
+
+AlignedBuffer::AlignedBuffer(size_t size)
+    : data_(static_cast<byte*>(::VirtualAlloc(NULL,
+                                              size,
+                                              MEM_COMMIT | MEM_RESERVE,
+                                              PAGE_READWRITE))),
+      size_(data_ ? size : 0) {
+}
+
+AlignedBuffer::~AlignedBuffer() {
+  if (data_) {
+    VERIFY1(::VirtualFree(data_, 0, MEM_RELEASE));
+  }
+}
+
+DoubleBufferedFileReader::DoubleBufferedFileReader()
+    : file_size_(0), offset_(0), current_(0), eof_(false) {
+  for (size_t i = 0; i != arraysize(pending_); ++i) {
+    pending_[i] = false;
+    memset(&overlapped_[i], 0, sizeof(overlapped_[i]));
+  }
+}
+
+DoubleBufferedFileReader::~DoubleBufferedFileReader() {
+  for (size_t i = 0; i != arraysize(pending_); ++i) {
+    if (pending_[i]) {
+      // The buffer must outlive the read.
+      ::CancelIo(get(file_));
+      DWORD bytes_read = 0;
+      ::GetOverlappedResult(get(file_), &overlapped_[i], &bytes_read, true);
+    }
+  }
+}
+
+HRESULT DoubleBufferedFileReader::Open(const CString& filepath,
+                                       DWORD buffer_size) {
+  reset(file_, ::CreateFile(filepath,
+                            FILE_READ_DATA,
+                            FILE_SHARE_READ,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN,
+                            NULL));
+  if (!file_) {
+    return HRESULTFromLastError();
+  }
+
+  LARGE_INTEGER file_size = {0};
+  if (!::GetFileSizeEx(get(file_), &file_size)) {
+    return HRESULTFromLastError();
+  }
+  file_size_ = file_size.QuadPart;
+
+  for (size_t i = 0; i != arraysize(buffers_); ++i) {
+    buffers_[i].reset(new AlignedBuffer(buffer_size));
+    reset(events_[i], ::CreateEvent(NULL, true, false, NULL));
+    if (!buffers_[i]->data() || !events_[i]) {
+      return E_OUTOFMEMORY;
+    }
+  }
+
+  return IssueRead(0);
+}
+
+HRESULT DoubleBufferedFileReader::Next(const byte** data, DWORD* len) {
+  ASSERT1(data);
+  ASSERT1(len);
+
+  *data = NULL;
+  *len = 0;
+  if (eof_) {
+    return S_OK;
+  }
+
+  const int index = current_;
+  DWORD bytes_read = 0;
+  HRESULT hr = CompleteRead(index, &bytes_read);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  if (!bytes_read) {
+    eof_ = true;
+    return S_OK;
+  }
+
+  // Start filling the other buffer before handing this one to the caller.
+  offset_ += bytes_read;
+  current_ = 1 - index;
+  hr = IssueRead(current_);
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  *data = buffers_[index]->data();
+  *len = bytes_read;
+  return S_OK;
+}
+
+HRESULT DoubleBufferedFileReader::IssueRead(int index) {
+  ASSERT1(!pending_[index]);
+
+  OVERLAPPED* overlapped = &overlapped_[index];
+  memset(overlapped, 0, sizeof(*overlapped));
+  overlapped->Offset = static_cast<DWORD>(offset_);
+  overlapped->OffsetHigh = static_cast<DWORD>(offset_ >> 32);
+  overlapped->hEvent = get(events_[index]);
+
+  if (!::ReadFile(get(file_),
+                  buffers_[index]->data(),
+                  static_cast<DWORD>(buffers_[index]->size()),
+                  NULL,
+                  overlapped)) {
+    const DWORD error = ::GetLastError();
+    if (error == ERROR_HANDLE_EOF) {
+      eof_ = true;
+      return S_OK;
+    }
+    if (error != ERROR_IO_PENDING) {
+      return HRESULT_FROM_WIN32(error);
+    }
+  }
+
+  pending_[index] = true;
+  return S_OK;
+}
+
+HRESULT DoubleBufferedFileReader::CompleteRead(int index, DWORD* bytes_read) {
+  *bytes_read = 0;
+  if (!pending_[index]) {
+    return S_OK;
+  }
+
+  pending_[index] = false;
+  if (!::GetOverlappedResult(get(file_),
+                             &overlapped_[index],
+                             bytes_read,
+                             true)) {
+    const DWORD error = ::GetLastError();
+    *bytes_read = 0;
+    return error == ERROR_HANDLE_EOF ? S_OK : HRESULT_FROM_WIN32(error);
+  }
+  return S_OK;
+}
+
+namespace {
+
+// Writes a file sequentially with overlapped I/O. A write runs while the
+// caller hashes the data and the reader fills its other buffer.
+class OverlappedFileWriter {
+ public:
+  OverlappedFileWriter() : offset_(0), expected_(0), pending_(false) {
+    memset(&overlapped_, 0, sizeof(overlapped_));
+  }
+
+  ~OverlappedFileWriter() {
+    if (pending_) {
+      ::CancelIo(get(file_));
+      DWORD bytes_written = 0;
+      ::GetOverlappedResult(get(file_), &overlapped_, &bytes_written, true);
+    }
+  }
+
+  // Creates |filepath| and extends it to |size| bytes, so that the file
+  // system can allocate the space in one go.
+  HRESULT Create(const CString& filepath, uint64 size) {
+    reset(file_, ::CreateFile(filepath,
+                              FILE_WRITE_DATA | FILE_WRITE_ATTRIBUTES,
+                              0,
+                              NULL,
+                              CREATE_ALWAYS,
+                              FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN,
+                              NULL));
+    if (!file_) {
+      return HRESULTFromLastError();
+    }
+
+    reset(event_, ::CreateEvent(NULL, true, false, NULL));
+    if (!event_) {
+      return HRESULTFromLastError();
+    }
+
+    return SetLength(size);
+  }
+
+  // Starts writing |len| bytes from |data|, which must stay valid until the
+  // next call to Wait().
+  HRESULT Write(const byte* data, DWORD len) {
+    ASSERT1(!pending_);
+
+    memset(&overlapped_, 0, sizeof(overlapped_));
+    overlapped_.Offset = static_cast<DWORD>(offset_);
+    overlapped_.OffsetHigh = static_cast<DWORD>(offset_ >> 32);
+    overlapped_.hEvent = get(event_);
+    offset_ += len;
+
+    if (!::WriteFile(get(file_), data, len, NULL, &overlapped_)) {
+      const DWORD error = ::GetLastError();
+      if (error != ERROR_IO_PENDING) {
+        return HRESULT_FROM_WIN32(error);
+      }
+    }
+
+    pending_ = true;
+    expected_ = len;
+    return S_OK;
+  }
+
+  // Waits for the outstanding write, if any.
+  HRESULT Wait() {
+    if (!pending_) {
+      return S_OK;
+    }
+
+    pending_ = false;
+    DWORD bytes_written = 0;
+    if (!::GetOverlappedResult(get(file_), &overlapped_, &bytes_written, true)) {
+      return HRESULTFromLastError();
+    }
+    return bytes_written == expected_ ? S_OK : E_UNEXPECTED;
+  }
+
+  // Trims the preallocated space to the bytes actually written and closes
+  // the file.
+  HRESULT Close() {
+    HRESULT hr = Wait();
+    if (FAILED(hr)) {
+      return hr;
+    }
+
+    hr = SetLength(offset_);
+    reset(file_);
+    return hr;
+  }
+
+ private:
+  HRESULT SetLength(uint64 size) {
+    LARGE_INTEGER distance = {0};
+    distance.QuadPart = size;
+    if (!::SetFilePointerEx(get(file_), distance, NULL, FILE_BEGIN) ||
+        !::SetEndOfFile(get(file_))) {
+      return HRESULTFromLastError();
+    }
+    return S_OK;
+  }
+
+  scoped_hfile file_;
+  scoped_event event_;
+  OVERLAPPED overlapped_;
+  uint64 offset_;  // The file offset of the next write.
+  DWORD expected_;
+  bool pending_;
+
+  DISALLOW_COPY_AND_ASSIGN(OverlappedFileWriter);
+};
+
+HRESULT StreamFile(DoubleBufferedFileReader* reader,
+                   const CString& destination,
+                   std::vector<byte>* hash) {
+  OverlappedFileWriter writer;
+  HRESULT hr = writer.Create(destination, reader->file_size());
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  LITE_SHA256_CTX ctx;
+  SHA256_init(&ctx);
+
+  for (;;) {
+    const byte* data = NULL;
+    DWORD len = 0;
+    hr = reader->Next(&data, &len);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    if (!len) {
+      break;
+    }
+
+    // The reader reuses |data| on the next call to Next(), so the write must
+    // be complete by then.
+    hr = writer.Write(data, len);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    SHA256_update(&ctx, data, len);
+    hr = writer.Wait();
+    if (FAILED(hr)) {
+      return hr;
+    }
+  }
+
+  hr = writer.Close();
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  const uint8_t* digest = SHA256_final(&ctx);
+  hash->assign(digest, digest + SHA256_DIGEST_SIZE);
+  return S_OK;
+}
+
+}  // namespace
+
+HRESULT CopyAndHashFile(const CString& source,
+                        const CString& destination,
+                        uint64 max_len,
+                        const std::vector<byte>& expected_hash,
+                        std::vector<byte>* hash_out) {
+  UTIL_LOG(L3, (_T("[CopyAndHashFile][%s][%s]"), source, destination));
+
+  DoubleBufferedFileReader reader;
+  HRESULT hr = reader.Open(source, kFilePipelineBufferSize);
+  if (FAILED(hr)) {
+    UTIL_LOG(LE, (_T("[failed to open source][%s][0x%08x]"), source, hr));
+    return hr;
+  }
+
+  if (max_len && reader.file_size() > max_len) {
+    return SIGS_E_FILE_SIZE_TOO_BIG;
+  }
+
+  // The temporary file lives next to the destination so that the final
+  // rename does not cross volumes.
+  const CString temp_file(
+      GetTempFilenameAt(GetDirectoryFromPath(destination), _T("cpy")));
+  if (temp_file.IsEmpty()) {
+    hr = HRESULTFromLastError();
+    UTIL_LOG(LE, (_T("[GetTempFilenameAt failed][0x%08x]"), hr));
+    return hr;
+  }
+
+  std::vector<byte> hash;
+  hr = StreamFile(&reader, temp_file, &hash);
+  if (SUCCEEDED(hr) && !expected_hash.empty() && hash != expected_hash) {
+    hr = SIGS_E_INVALID_SIGNATURE;
+  }
+
+  if (SUCCEEDED(hr) &&
+      !::MoveFileEx(temp_file, destination, MOVEFILE_REPLACE_EXISTING)) {
+    hr = HRESULTFromLastError();
+  }
+
+  if (FAILED(hr)) {
+    UTIL_LOG(LE, (_T("[CopyAndHashFile failed][%s][0x%08x]"), source, hr));
+    VERIFY1(::DeleteFile(temp_file));
+    return hr;
+  }
+
+  if (hash_out) {
+    hash_out->swap(hash);
+  }
+  return S_OK;
+}
+
+}  // namespace omaha
@@ -0,0 +1,102 @@
+// Copyright 2003-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Streaming file I/O with large, overlapped reads and writes. Used to hash
+// and copy files in a single pass over the data.
+
+#ifndef OMAHA_BASE_FILE_PIPELINE_H_
+#define OMAHA_BASE_FILE_PIPELINE_H_
+
+#include <windows.h>
+#include <atlstr.h>
+#include <memory>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "omaha/third_party/smartany/scoped_any.h"
+
+namespace omaha {
+
+// Size of each of the two buffers used by the pipeline.
+const DWORD kFilePipelineBufferSize = 4 * 1024 * 1024;  // 4MB.
+
+// A page-aligned buffer, suitable for unbuffered and overlapped I/O.
+class AlignedBuffer {
+ public:
+  explicit AlignedBuffer(size_t size);
+  ~AlignedBuffer();
+
+  byte* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  byte* const data_;
+  const size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(AlignedBuffer);
+};
+
+// Reads a file sequentially into two buffers. While the caller consumes one
+// buffer, an overlapped read fills the other one.
+class DoubleBufferedFileReader {
+ public:
+  DoubleBufferedFileReader();
+  ~DoubleBufferedFileReader();
+
+  // Opens |filepath| for reading, allowing other readers only.
+  HRESULT Open(const CString& filepath, DWORD buffer_size);
+
+  uint64 file_size() const { return file_size_; }
+
+  // Returns the next chunk of the file in |data| and |len|. |len| is zero at
+  // the end of the file. The chunk is valid until the next call.
+  HRESULT Next(const byte** data, DWORD* len);
+
+ private:
+  HRESULT IssueRead(int index);
+  HRESULT CompleteRead(int index, DWORD* bytes_read);
+
+  scoped_hfile file_;
+  uint64 file_size_;
+  std::unique_ptr<AlignedBuffer> buffers_[2];
+  scoped_event events_[2];
+  OVERLAPPED overlapped_[2];
+  bool pending_[2];
+  uint64 offset_;  // The file offset of the next read.
+  int current_;    // The buffer the next call to Next() returns.
+  bool eof_;
+
+  DISALLOW_COPY_AND_ASSIGN(DoubleBufferedFileReader);
+};
+
+// Copies |source| to |destination| in one pass, computing the SHA-256 digest
+// of the data on the way. The destination is preallocated and written under a
+// temporary name in the same directory, then renamed over |destination|. The
+// rename only happens if the copy completes and, when |expected_hash| is not
+// empty, if the digest matches it; otherwise the temporary file is deleted and
+// |destination| is left untouched.
+//
+// Returns SIGS_E_FILE_SIZE_TOO_BIG if |source| is larger than |max_len|, unless
+// |max_len| is 0, and SIGS_E_INVALID_SIGNATURE if the digest does not match.
+// |hash_out| may be NULL.
+HRESULT CopyAndHashFile(const CString& source,
+                        const CString& destination,
+                        uint64 max_len,
+                        const std::vector<byte>& expected_hash,
+                        std::vector<byte>* hash_out);
+
+}  // namespace omaha
+
+#endif  // OMAHA_BASE_FILE_PIPELINE_H_
@@ -0,0 +1,195 @@
+// Copyright 2003-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/base/file_pipeline.h"
+
+#include <vector>
+
+#include "omaha/base/error.h"
+#include "omaha/base/file.h"
+#include "omaha/base/path.h"
+#include "omaha/base/signatures.h"
+#include "omaha/base/utils.h"
+#include "omaha/testing/unit_test.h"
+
+namespace omaha {
+
+class FilePipelineTest : public testing::Test {
+ protected:
+  FilePipelineTest() : temp_dir_(GetUniqueTempDirectoryName()) {}
+
+  void SetUp() override {
+    ASSERT_FALSE(temp_dir_.IsEmpty());
+    ASSERT_SUCCEEDED(CreateDir(temp_dir_, NULL));
+    source_ = ConcatenatePath(temp_dir_, _T("source.bin"));
+    destination_ = ConcatenatePath(temp_dir_, _T("destination.bin"));
+  }
+
+  void TearDown() override {
+    EXPECT_SUCCEEDED(DeleteDirectory(temp_dir_));
+  }
+
+  // Writes |size| bytes of a pattern to |path|.
+  static void WriteTestFile(const CString& path, size_t size, byte seed) {
+    std::vector<byte> data(size);
+    for (size_t i = 0; i != size; ++i) {
+      data[i] = static_cast<byte>(seed + i * 7 + (i >> 12));
+    }
+
+    File file;
+    ASSERT_SUCCEEDED(file.Open(path, true, false));
+    if (size) {
+      uint32 bytes_written = 0;
+      ASSERT_SUCCEEDED(file.Write(&data.front(),
+                                  static_cast<uint32>(size),
+                                  &bytes_written));
+      ASSERT_EQ(size, bytes_written);
+    }
+  }
+
+  static std::vector<byte> HashFile(const CString& path) {
+    std::vector<byte> hash;
+    CryptoHash crypto;
+    EXPECT_SUCCEEDED(crypto.Compute(path, 0, &hash));
+    return hash;
+  }
+
+  // Returns the number of files in the temporary directory.
+  size_t CountFiles() const {
+    std::vector<CString> files;
+    FindFilesEx(temp_dir_, _T("*"), &files);
+    return files.size();
+  }
+
+  const CString temp_dir_;
+  CString source_;
+  CString destination_;
+};
+
+TEST_F(FilePipelineTest, DoubleBufferedFileReader_ReadsWholeFile) {
+  const size_t kSize = 3 * 64 * 1024 + 123;
+  WriteTestFile(source_, kSize, 1);
+
+  DoubleBufferedFileReader reader;
+  ASSERT_SUCCEEDED(reader.Open(source_, 64 * 1024));
+  EXPECT_EQ(kSize, reader.file_size());
+
+  std::vector<byte> contents;
+  for (;;) {
+    const byte* data = NULL;
+    DWORD len = 0;
+    ASSERT_SUCCEEDED(reader.Next(&data, &len));
+    if (!len) {
+      break;
+    }
+    contents.insert(contents.end(), data, data + len);
+  }
+
+  std::vector<byte> hash;
+  CryptoHash crypto;
+  ASSERT_SUCCEEDED(crypto.Compute(contents, &hash));
+  EXPECT_EQ(HashFile(source_), hash);
+}
+
+TEST_F(FilePipelineTest, CopyAndHashFile_SpansSeveralBuffers) {
+  WriteTestFile(source_, 2 * kFilePipelineBufferSize + 4097, 2);
+
+  std::vector<byte> hash;
+  EXPECT_SUCCEEDED(CopyAndHashFile(source_,
+                                   destination_,
+                                   0,
+                                   std::vector<byte>(),
+                                   &hash));
+  EXPECT_TRUE(File::AreFilesIdentical(source_, destination_));
+  EXPECT_EQ(HashFile(source_), hash);
+  EXPECT_EQ(2, CountFiles());
+}
+
+TEST_F(FilePipelineTest, CopyAndHashFile_EmptyFile) {
+  WriteTestFile(source_, 0, 0);
+
+  std::vector<byte> hash;
+  EXPECT_SUCCEEDED(CopyAndHashFile(source_,
+                                   destination_,
+                                   0,
+                                   std::vector<byte>(),
+                                   &hash));
+  EXPECT_TRUE(File::Exists(destination_));
+  EXPECT_TRUE(File::AreFilesIdentical(source_, destination_));
+  EXPECT_EQ(HashFile(source_), hash);
+}
+
+TEST_F(FilePipelineTest, CopyAndHashFile_ExpectedHashMatches) {
+  WriteTestFile(source_, 100000, 3);
+  WriteTestFile(destination_, 10, 4);
+
+  EXPECT_SUCCEEDED(CopyAndHashFile(source_,
+                                   destination_,
+                                   0,
+                                   HashFile(source_),
+                                   NULL));
+  EXPECT_TRUE(File::AreFilesIdentical(source_, destination_));
+  EXPECT_EQ(2, CountFiles());
+}
+
+TEST_F(FilePipelineTest, CopyAndHashFile_ExpectedHashMismatch) {
+  WriteTestFile(source_, 100000, 5);
+
+  std::vector<byte> bad_hash(HashFile(source_));
+  bad_hash[0] ^= 0x01;
+  EXPECT_EQ(SIGS_E_INVALID_SIGNATURE,
+            CopyAndHashFile(source_, destination_, 0, bad_hash, NULL));
+  EXPECT_FALSE(File::Exists(destination_));
+  EXPECT_EQ(1, CountFiles());
+
+  // An existing destination is left untouched.
+  WriteTestFile(destination_, 10, 6);
+  const std::vector<byte> old_hash(HashFile(destination_));
+  EXPECT_EQ(SIGS_E_INVALID_SIGNATURE,
+            CopyAndHashFile(source_, destination_, 0, bad_hash, NULL));
+  EXPECT_EQ(old_hash, HashFile(destination_));
+  EXPECT_EQ(2, CountFiles());
+}
+
+TEST_F(FilePipelineTest, CopyAndHashFile_MaxLen) {
+  WriteTestFile(source_, 1000, 7);
+
+  EXPECT_EQ(SIGS_E_FILE_SIZE_TOO_BIG,
+            CopyAndHashFile(source_,
+                            destination_,
+                            999,
+                            std::vector<byte>(),
+                            NULL));
+  EXPECT_FALSE(File::Exists(destination_));
+
+  EXPECT_SUCCEEDED(CopyAndHashFile(source_,
+                                   destination_,
+                                   1000,
+                                   std::vector<byte>(),
+                                   NULL));
+  EXPECT_TRUE(File::AreFilesIdentical(source_, destination_));
+}
+
+TEST_F(FilePipelineTest, CopyAndHashFile_SourceNotFound) {
+  EXPECT_EQ(HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND),
+            CopyAndHashFile(source_,
+                            destination_,
+                            0,
+                            std::vector<byte>(),
+                            NULL));
+  EXPECT_EQ(0, CountFiles());
+}
+
+}  // namespace omaha
@@ -0,0 +1,156 @@
+// Copyright 2003-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Each record starts with a header holding its state. A writer reserves the
+// record, writes its size and data, and commits it by setting its state to the
+// length of the record. A record which would wrap around the end of the buffer
+// is preceded by a padding record up to the end of the buffer, committed as
+// soon as it is reserved. The reader consumes the records in order, and zeroes
+// them as it does, so that the state of a record not committed yet reads 0.
+
+#include "omaha/base/log_ring_buffer.h"
+
+#include <string.h>
+
+namespace omaha {
+
+namespace {
+
+struct RecordHeader {
+  volatile LONG state;
+  LONG size;
+};
+
+RecordHeader* Header(uint8* record) {
+  return reinterpret_cast<RecordHeader*>(record);
+}
+
+const ULONG kMinCapacity = 4 * 1024;
+const ULONG kMaxCapacity = 256 * 1024 * 1024;
+
+// Marks the state of a padding record.
+const LONG kPaddingFlag = 0x40000000;
+
+ULONG RoundUpCapacity(size_t capacity) {
+  ULONG result = kMinCapacity;
+  while (result < capacity && result < kMaxCapacity) {
+    result *= 2;
+  }
+  return result;
+}
+
+// Records are 8 byte aligned, which keeps their headers aligned too.
+ULONG RecordLength(size_t size) {
+  const size_t length = sizeof(RecordHeader) + size;
+  return static_cast<ULONG>((length + 7) & ~static_cast<size_t>(7));
+}
+
+}  // namespace
+
+LogRingBuffer::LogRingBuffer(size_t capacity)
+    : head_(0),
+      tail_(0),
+      dropped_(0),
+      capacity_(RoundUpCapacity(capacity)),
+      max_record_size_(capacity_ / 4 - sizeof(RecordHeader)),
+      buffer_(new uint8[capacity_]) {
+  memset(buffer_, 0, capacity_);
+}
+
+LogRingBuffer::~LogRingBuffer() {
+  delete[] buffer_;
+}
+
+uint8* LogRingBuffer::RecordAt(ULONG position) const {
+  return buffer_ + (position & (capacity_ - 1));
+}
+
+uint8* LogRingBuffer::BeginWrite(size_t size) {
+  if (size > max_record_size_) {
+    ::InterlockedIncrement(&dropped_);
+    return NULL;
+  }
+
+  const ULONG length = RecordLength(size);
+  for (;;) {
+    // The tail is read before the head, so that the tail is never past the
+    // head. Volatile reads have acquire semantics with MSVC.
+    const ULONG tail = static_cast<ULONG>(tail_);
+    const ULONG head = static_cast<ULONG>(head_);
+    const ULONG offset = head & (capacity_ - 1);
+    const ULONG padding = offset + length > capacity_ ? capacity_ - offset : 0;
+    if (head - tail + padding + length > capacity_) {
+      ::InterlockedIncrement(&dropped_);
+      return NULL;
+    }
+
+    const LONG new_head = static_cast<LONG>(head + padding + length);
+    if (::InterlockedCompareExchange(&head_,
+                                     new_head,
+                                     static_cast<LONG>(head)) !=
+        static_cast<LONG>(head)) {
+      continue;
+    }
+
+    if (padding) {
+      ::InterlockedExchange(&Header(RecordAt(head))->state,
+                            static_cast<LONG>(padding) | kPaddingFlag);
+    }
+    RecordHeader* header = Header(RecordAt(head + padding));
+    header->size = static_cast<LONG>(size);
+    return reinterpret_cast<uint8*>(header + 1);
+  }
+}
+
+void LogRingBuffer::EndWrite(uint8* record) {
+  RecordHeader* header = reinterpret_cast<RecordHeader*>(record) - 1;
+  ::InterlockedExchange(&header->state,
+                        static_cast<LONG>(RecordLength(header->size)));
+}
+
+const uint8* LogRingBuffer::Peek(size_t* size) {
+  for (;;) {
+    const ULONG tail = static_cast<ULONG>(tail_);
+    RecordHeader* header = Header(RecordAt(tail));
+    const LONG state = header->state;
+    if (!state) {
+      return NULL;
+    }
+
+    if (state & kPaddingFlag) {
+      header->state = 0;
+      ::InterlockedExchange(&tail_,
+                            static_cast<LONG>(tail + (state & ~kPaddingFlag)));
+      continue;
+    }
+
+    *size = static_cast<size_t>(header->size);
+    return reinterpret_cast<const uint8*>(header + 1);
+  }
+}
+
+void LogRingBuffer::Pop() {
+  const ULONG tail = static_cast<ULONG>(tail_);
+  RecordHeader* header = Header(RecordAt(tail));
+  const ULONG length = static_cast<ULONG>(header->state);
+  memset(header, 0, length);
+  ::InterlockedExchange(&tail_, static_cast<LONG>(tail + length));
+}
+
+size_t LogRingBuffer::size() const {
+  return static_cast<ULONG>(head_) - static_cast<ULONG>(tail_);
+}
+
+}  // namespace omaha
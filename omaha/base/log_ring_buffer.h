@@ -0,0 +1,86 @@
+// Copyright 2003-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// A bounded ring buffer of variable size records, written by any number of
+// threads and read by a single one. Writers never block and never take a
+// lock: they reserve space with a compare-and-swap on the head of the ring,
+// copy their record in, and commit it. A record which does not fit in the
+// free space is dropped and counted, so the memory used by the log is bounded
+// no matter how far behind its reader falls.
+//
+// Like the rest of the logging system, this code must not log, assert, or
+// report.
+
+#ifndef OMAHA_BASE_LOG_RING_BUFFER_H_
+#define OMAHA_BASE_LOG_RING_BUFFER_H_
+
+#include <windows.h>
+
+#include "base/basictypes.h"
+
+namespace omaha {
+
+class LogRingBuffer {
+ public:
+  // |capacity| is rounded up to a power of two, of at least 4KB.
+  explicit LogRingBuffer(size_t capacity);
+  ~LogRingBuffer();
+
+  // Reserves a record of |size| bytes and returns where to write it, or NULL
+  // if the record is dropped because the ring is full or the record is larger
+  // than max_record_size(). The record is invisible to the reader until it is
+  // committed with EndWrite. Can be called by any thread.
+  uint8* BeginWrite(size_t size);
+
+  // Commits the record returned by BeginWrite.
+  void EndWrite(uint8* record);
+
+  // Returns the oldest record and sets |size| to its size, or returns NULL if
+  // the oldest record is not committed yet or the ring is empty. The record
+  // stays in the ring until Pop is called. Only called by the reader.
+  const uint8* Peek(size_t* size);
+
+  // Releases the record returned by the last call to Peek.
+  void Pop();
+
+  // Returns the bytes in use, including the records not committed yet.
+  size_t size() const;
+
+  size_t capacity() const { return capacity_; }
+  size_t max_record_size() const { return max_record_size_; }
+
+  // Returns the number of records dropped since the ring was created.
+  uint32 num_dropped() const { return static_cast<uint32>(dropped_); }
+
+ private:
+  // Returns where the record at |position| starts in the buffer.
+  uint8* RecordAt(ULONG position) const;
+
+  // The positions are offsets of a ring of 2^32 bytes, of which the buffer
+  // holds the last |capacity_| before |head_|.
+  volatile LONG head_;
+  volatile LONG tail_;
+  volatile LONG dropped_;
+
+  const ULONG capacity_;
+  const size_t max_record_size_;
+  uint8* const buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogRingBuffer);
+};
+
+}  // namespace omaha
+
+#endif  // OMAHA_BASE_LOG_RING_BUFFER_H_
@@ -0,0 +1,217 @@
+// Copyright 2003-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/base/log_ring_buffer.h"
+
+#include <string.h>
+#include <vector>
+
+#include "omaha/testing/unit_test.h"
+
+namespace omaha {
+
+namespace {
+
+const int kNumThreads = 8;
+const int kNumRecordsPerThread = 20000;
+
+// Writes |size| bytes of |value| as a record, and returns false if it was
+// dropped.
+bool Write(LogRingBuffer* ring, size_t size, uint8 value) {
+  uint8* record = ring->BeginWrite(size);
+  if (!record) {
+    return false;
+  }
+  memset(record, value, size);
+  ring->EndWrite(record);
+  return true;
+}
+
+// Reads a record into |data|, and returns false if there is none.
+bool Read(LogRingBuffer* ring, std::vector<uint8>* data) {
+  size_t size = 0;
+  const uint8* record = ring->Peek(&size);
+  if (!record) {
+    return false;
+  }
+  data->assign(record, record + size);
+  ring->Pop();
+  return true;
+}
+
+struct WriterParam {
+  LogRingBuffer* ring;
+  int thread;
+  volatile LONG* num_dropped;
+};
+
+// Writes kNumRecordsPerThread records of 4 bytes, holding the index of the
+// thread in the first byte and the sequence number in the others.
+DWORD WINAPI WriteRecords(void* param) {
+  WriterParam* writer = static_cast<WriterParam*>(param);
+  for (int i = 0; i < kNumRecordsPerThread; ++i) {
+    uint8* record = writer->ring->BeginWrite(4);
+    if (!record) {
+      ::InterlockedIncrement(writer->num_dropped);
+      continue;
+    }
+    record[0] = static_cast<uint8>(writer->thread);
+    record[1] = static_cast<uint8>(i >> 16);
+    record[2] = static_cast<uint8>(i >> 8);
+    record[3] = static_cast<uint8>(i);
+    writer->ring->EndWrite(record);
+  }
+  return 0;
+}
+
+}  // namespace
+
+TEST(LogRingBufferTest, Capacity) {
+  EXPECT_EQ(4096, LogRingBuffer(0).capacity());
+  EXPECT_EQ(4096, LogRingBuffer(4096).capacity());
+  EXPECT_EQ(8192, LogRingBuffer(4097).capacity());
+  EXPECT_EQ(1024 - 8, LogRingBuffer(4096).max_record_size());
+}
+
+TEST(LogRingBufferTest, WriteRead) {
+  LogRingBuffer ring(4096);
+  std::vector<uint8> data;
+  EXPECT_FALSE(Read(&ring, &data));
+  EXPECT_EQ(0, ring.size());
+
+  ASSERT_TRUE(Write(&ring, 3, 'a'));
+  ASSERT_TRUE(Write(&ring, 0, 'b'));
+  ASSERT_TRUE(Write(&ring, 10, 'c'));
+  EXPECT_EQ(16 + 8 + 24, ring.size());
+
+  ASSERT_TRUE(Read(&ring, &data));
+  EXPECT_EQ(std::vector<uint8>(3, 'a'), data);
+  ASSERT_TRUE(Read(&ring, &data));
+  EXPECT_TRUE(data.empty());
+  ASSERT_TRUE(Read(&ring, &data));
+  EXPECT_EQ(std::vector<uint8>(10, 'c'), data);
+  EXPECT_FALSE(Read(&ring, &data));
+  EXPECT_EQ(0, ring.size());
+  EXPECT_EQ(0, ring.num_dropped());
+}
+
+// A record is not read until it is committed, and neither are the records
+// after it.
+TEST(LogRingBufferTest, Uncommitted) {
+  LogRingBuffer ring(4096);
+  uint8* first = ring.BeginWrite(1);
+  ASSERT_TRUE(first != NULL);
+  ASSERT_TRUE(Write(&ring, 1, 'b'));
+
+  std::vector<uint8> data;
+  EXPECT_FALSE(Read(&ring, &data));
+
+  *first = 'a';
+  ring.EndWrite(first);
+  ASSERT_TRUE(Read(&ring, &data));
+  EXPECT_EQ(std::vector<uint8>(1, 'a'), data);
+  ASSERT_TRUE(Read(&ring, &data));
+  EXPECT_EQ(std::vector<uint8>(1, 'b'), data);
+}
+
+TEST(LogRingBufferTest, WrapAround) {
+  LogRingBuffer ring(4096);
+  std::vector<uint8> data;
+
+  // Records of 1000 bytes take 1008 bytes, so they wrap around at different
+  // offsets each time.
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(Write(&ring, 1000, static_cast<uint8>(i))) << i;
+    ASSERT_TRUE(Write(&ring, 1000, static_cast<uint8>(i + 1))) << i;
+    ASSERT_TRUE(Read(&ring, &data)) << i;
+    EXPECT_EQ(std::vector<uint8>(1000, static_cast<uint8>(i)), data);
+    ASSERT_TRUE(Read(&ring, &data)) << i;
+    EXPECT_EQ(std::vector<uint8>(1000, static_cast<uint8>(i + 1)), data);
+    EXPECT_EQ(0, ring.size());
+  }
+  EXPECT_EQ(0, ring.num_dropped());
+}
+
+TEST(LogRingBufferTest, Full_Drops) {
+  LogRingBuffer ring(4096);
+  std::vector<uint8> data;
+
+  // The ring holds four records of 1016 bytes, with their headers.
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(Write(&ring, 1016, static_cast<uint8>(i)));
+  }
+  EXPECT_EQ(4096, ring.size());
+  EXPECT_FALSE(Write(&ring, 0, 'x'));
+  EXPECT_EQ(1, ring.num_dropped());
+
+  // Records too large for the ring are always dropped.
+  ASSERT_TRUE(Read(&ring, &data));
+  EXPECT_FALSE(Write(&ring, ring.max_record_size() + 1, 'x'));
+  EXPECT_EQ(2, ring.num_dropped());
+
+  ASSERT_TRUE(Write(&ring, 1016, 4));
+  for (int i = 1; i < 5; ++i) {
+    ASSERT_TRUE(Read(&ring, &data));
+    EXPECT_EQ(std::vector<uint8>(1016, static_cast<uint8>(i)), data);
+  }
+  EXPECT_FALSE(Read(&ring, &data));
+}
+
+// Writes from many threads at once while reading. Every record is either
+// read once, in the order each thread wrote it, or counted as dropped.
+TEST(LogRingBufferTest, Concurrent) {
+  LogRingBuffer ring(16 * 1024);
+  volatile LONG num_dropped = 0;
+
+  WriterParam params[kNumThreads] = {};
+  HANDLE threads[kNumThreads] = {};
+  for (int i = 0; i < kNumThreads; ++i) {
+    params[i].ring = &ring;
+    params[i].thread = i;
+    params[i].num_dropped = &num_dropped;
+    threads[i] = ::CreateThread(NULL, 0, &WriteRecords, &params[i], 0, NULL);
+    ASSERT_TRUE(NULL != threads[i]);
+  }
+
+  int next[kNumThreads] = {};
+  int num_read = 0;
+  std::vector<uint8> data;
+  for (;;) {
+    const bool done = ::WaitForMultipleObjects(kNumThreads,
+                                               threads,
+                                               true,
+                                               0) == WAIT_OBJECT_0;
+    while (Read(&ring, &data)) {
+      ASSERT_EQ(4, data.size());
+      ASSERT_GT(kNumThreads, data[0]);
+      const int sequence = (data[1] << 16) | (data[2] << 8) | data[3];
+      EXPECT_LE(next[data[0]], sequence);
+      next[data[0]] = sequence + 1;
+      ++num_read;
+    }
+    if (done) {
+      break;
+    }
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    ::CloseHandle(threads[i]);
+  }
+
+  EXPECT_EQ(kNumThreads * kNumRecordsPerThread, num_read + num_dropped);
+  EXPECT_EQ(static_cast<uint32>(num_dropped), ring.num_dropped());
+  EXPECT_EQ(0, ring.size());
+}
+
+}  // namespace omaha
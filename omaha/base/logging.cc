@@ -65,6 +65,7 @@
 #include "omaha/base/safe_format.h"
 #include "omaha/base/string.h"
 #include "omaha/base/time.h"
+#include "omaha/base/tracing.h"
 #include "omaha/base/utils.h"
 
 namespace omaha {
@@ -202,6 +203,197 @@ static void FormatLinePrefix(bool show_time,
                           ::GetCurrentThreadId());
 }
 
+// Encodes |text| as a binary log text record.
+static void EncodeTextRecord(const CString& text,
+                             std::unique_ptr<uint8[]>* data,
+                             size_t* size) {
+  const size_t length = text.GetLength();
+  const size_t payload_size = BinaryLogEncoder::StringSize(length);
+  *size = BinaryLogEncoder::RecordSize(payload_size);
+  data->reset(new uint8[*size]);
+  BinaryLogEncoder encoder(data->get(), *size);
+  encoder.PutRecordHeader(binary_log::kTextRecord, payload_size);
+  encoder.PutString(reinterpret_cast<const uint16*>(text.GetString()), length);
+}
+
+// Writes the binary log header at the start of a new log file.
+static void WriteBinaryLogHeader(HANDLE log_file) {
+  uint8 header[binary_log::kHeaderSize] = {0};
+  memcpy(header, binary_log::kMagic, binary_log::kMagicSize);
+  header[binary_log::kMagicSize] = binary_log::kVersion;
+  DWORD num = 0;
+  ::WriteFile(log_file, header, sizeof(header), &num, NULL);
+}
+
+// Returns the local time, in 100ns intervals since 1601, as the line prefix
+// shows it.
+static uint64 GetLocalTimeAs100NS() {
+  SYSTEMTIME local_time = {0};
+  ::GetLocalTime(&local_time);
+  FILETIME file_time = {0};
+  ::SystemTimeToFileTime(&local_time, &file_time);
+  return static_cast<uint64>(FileTimeToInt64(file_time));
+}
+
+// Records the arguments of the printf-style |fmt|, with the conventions of
+// the wide CRT functions, so that BinaryLogDecoder formats them as
+// _vsnwprintf_s would. Returns false if the format has conversions which are
+// not supported, such as %n and %Z.
+static bool EncodeArgsVA(BinaryLogEncoder* encoder,
+                         const wchar_t* fmt,
+                         va_list args) {
+  for (const wchar_t* p = fmt; *p; ++p) {
+    if (*p != L'%') {
+      continue;
+    }
+    ++p;
+    if (*p == L'%') {
+      continue;
+    }
+
+    while (*p && wcschr(L"-+ #0", *p)) {
+      ++p;
+    }
+    if (*p == L'*') {
+      encoder->PutIntArg(va_arg(args, int), sizeof(int));
+      ++p;
+    }
+    while (iswdigit(*p)) {
+      ++p;
+    }
+
+    // Strings are read up to the precision, if any, since they need not be
+    // terminated then.
+    int precision = -1;
+    if (*p == L'.') {
+      ++p;
+      if (*p == L'*') {
+        precision = va_arg(args, int);
+        encoder->PutIntArg(precision, sizeof(int));
+        ++p;
+      } else {
+        precision = 0;
+        while (iswdigit(*p)) {
+          precision = precision * 10 + (*p++ - L'0');
+        }
+      }
+    }
+
+    // The size of the argument, or 0 if there is no size prefix. A 'h' or
+    // 'l' prefix also selects narrow or wide strings and characters.
+    size_t size = 0;
+    wchar_t prefix = 0;
+    if (p[0] == L'I' && p[1] == L'6' && p[2] == L'4') {
+      size = sizeof(int64);
+      p += 3;
+    } else if (p[0] == L'I' && p[1] == L'3' && p[2] == L'2') {
+      size = sizeof(int32);
+      p += 3;
+    } else if (p[0] == L'l' && p[1] == L'l') {
+      size = sizeof(int64);
+      p += 2;
+    } else if (p[0] == L'h' && p[1] == L'h') {
+      size = sizeof(char);
+      p += 2;
+    } else if (*p == L'h') {
+      size = sizeof(short);  // NOLINT
+      prefix = L'h';
+      ++p;
+    } else if (*p == L'l' || *p == L'w') {
+      size = sizeof(long);  // NOLINT
+      prefix = L'l';
+      ++p;
+    } else if (*p == L'I' || *p == L'z' || *p == L't') {
+      size = sizeof(size_t);
+      ++p;
+    } else if (*p == L'j') {
+      size = sizeof(int64);
+      ++p;
+    } else if (*p == L'L') {
+      ++p;
+    }
+
+    const bool is_wide = prefix == L'l' ||
+                         (prefix != L'h' && (*p == L'c' || *p == L's'));
+    switch (*p) {
+      case L'd':
+      case L'i':
+        encoder->PutIntArg(size == sizeof(int64) ? va_arg(args, int64) :
+                                                   va_arg(args, int),
+                           size ? size : sizeof(int));
+        break;
+      case L'u':
+      case L'o':
+      case L'x':
+      case L'X':
+        encoder->PutUintArg(size == sizeof(uint64) ? va_arg(args, uint64) :
+                                                     va_arg(args, uint32),
+                            size ? size : sizeof(uint32));
+        break;
+      case L'c':
+      case L'C': {
+        // Characters are promoted to int.
+        const int value = va_arg(args, int);
+        if (is_wide) {
+          encoder->PutUintArg(static_cast<uint16>(value), sizeof(wchar_t));
+        } else {
+          encoder->PutUintArg(static_cast<uint8>(value), sizeof(char));
+        }
+        break;
+      }
+      case L's':
+      case L'S':
+        if (is_wide) {
+          const wchar_t* str = va_arg(args, const wchar_t*);
+          if (!str) {
+            encoder->PutNullStringArg();
+          } else {
+            const size_t length =
+                precision >= 0 ? wcsnlen(str, static_cast<size_t>(precision)) :
+                                 wcslen(str);
+            encoder->PutStringArg(reinterpret_cast<const uint16*>(str),
+                                  length);
+          }
+        } else {
+          const char* str = va_arg(args, const char*);
+          if (!str) {
+            encoder->PutNullStringArg();
+          } else {
+            const size_t length =
+                precision >= 0 ? strnlen(str, static_cast<size_t>(precision)) :
+                                 strlen(str);
+            encoder->PutAnsiStringArg(str, length);
+          }
+        }
+        break;
+      case L'e':
+      case L'E':
+      case L'f':
+      case L'F':
+      case L'g':
+      case L'G':
+      case L'a':
+      case L'A':
+        encoder->PutDoubleArg(va_arg(args, double));
+        break;
+      case L'p': {
+        const void* pointer = va_arg(args, const void*);
+        encoder->PutPointerArg(reinterpret_cast<uintptr_t>(pointer),
+                               sizeof(pointer));
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return !encoder->failed();
+}
+
+// The generation of the binary log, which starts over when the log file is
+// truncated, and the last id assigned to a log statement.
+static volatile LONG g_binary_log_generation = 1;
+static volatile LONG g_last_call_site_id = 0;
+
 static bool g_logging_valid = false;
 static Logging g_logging;
 
@@ -230,10 +422,16 @@ Logging::Logging()
       log_to_file_(false),
       log_to_debug_out_(true),
       append_to_file_(true),
+      binary_log_to_file_(false),
+      trace_to_file_(false),
+      binary_log_enabled_(false),
       logging_shutdown_(false),
+      settings_check_tick_(0),
+      config_generation_(0),
       config_file_path_(GetConfigurationFilePath()),
       num_writers_(0),
       file_log_writer_(NULL),
+      file_log_writer_binary_(false),
       debug_out_writer_(NULL),
       etw_log_writer_(NULL) {
   g_last_category_check_time = 0;
@@ -295,11 +493,18 @@ void Logging::UpdateCatAndLevel(const wchar_t* cat_name, LogCategory cat) {
                                      kDefaultLogLevel,
                                      config_file);
   }
-  category_list_[cat].enabled = (log_level != 0);
-  category_list_[cat].log_level = static_cast<LogLevel>(log_level);
+  const bool enabled = (log_level != 0);
+  if (category_list_[cat].enabled != enabled ||
+      category_list_[cat].log_level != log_level) {
+    category_list_[cat].enabled = enabled;
+    category_list_[cat].log_level = static_cast<LogLevel>(log_level);
+    InvalidateCallSites();
+  }
 }
 
 void Logging::ReadLoggingSettings() {
+  const bool prev_logging_enabled = logging_enabled_;
+  const bool prev_trace_to_file = trace_to_file_;
   log_to_file_ = IsEnabledLogToFile();
 
   CString config_file = GetCurrentConfigurationFilePath();
@@ -327,11 +532,25 @@ void Logging::ReadLoggingSettings() {
         kConfigAttrAppendToFile,
         kDefaultAppendToFile,
         config_file) == 0 ? false : true;
+
+    binary_log_to_file_ = ::GetPrivateProfileInt(
+        kConfigSectionLoggingSettings,
+        kConfigAttrBinaryLogToFile,
+        kDefaultBinaryLogToFile,
+        config_file) == 0 ? false : true;
+
+    trace_to_file_ = ::GetPrivateProfileInt(
+        kConfigSectionLoggingSettings,
+        kConfigAttrTraceToFile,
+        kDefaultTraceToFile,
+        config_file) == 0 ? false : true;
   } else {
     logging_enabled_ = kDefaultLoggingEnabled;
     show_time_ = kDefaultShowTime;
     log_to_debug_out_ = kDefaultLogToOutputDebug;
     append_to_file_ = kDefaultAppendToFile;
+    binary_log_to_file_ = kDefaultBinaryLogToFile;
+    trace_to_file_ = kDefaultTraceToFile;
   }
 
   if (force_show_time_) {
@@ -348,7 +567,18 @@ void Logging::ReadLoggingSettings() {
                       LogCategoryNames[i].category);
   }
 
+  if (logging_enabled_ != prev_logging_enabled) {
+    InvalidateCallSites();
+  }
+
+  // Only changes to the setting start or stop tracing, so that tracing can
+  // also be enabled by the code which does not write the trace to a file.
+  if (trace_to_file_ != prev_trace_to_file) {
+    tracing::Enable(trace_to_file_);
+  }
+
   g_last_category_check_time = GetCurrent100NSTime();
+  settings_check_tick_ = ::GetTickCount();
 }
 
 CString Logging::GetDefaultLogDirectory() const {
@@ -381,6 +611,37 @@ CString Logging::GetLogFilePath() const {
   return path;
 }
 
+CString Logging::GetBinaryLogFilePath() const {
+  CString path = GetDefaultLogDirectory();
+  if (path.IsEmpty()) {
+    return CString();
+  }
+
+  if (!::PathAppend(CStrBuf(path, MAX_PATH), kDefaultBinaryLogFileName)) {
+    return CString();
+  }
+
+  return path;
+}
+
+CString Logging::GetTraceFilePath() const {
+  CString path = GetDefaultLogDirectory();
+  if (path.IsEmpty()) {
+    return CString();
+  }
+
+  CString file_name;
+  SafeCStringFormat(&file_name, _T("%s_%u%s"),
+                    MAIN_EXE_BASE_NAME,
+                    ::GetCurrentProcessId(),
+                    kDefaultTraceFileExtension);
+  if (!::PathAppend(CStrBuf(path, MAX_PATH), file_name)) {
+    return CString();
+  }
+
+  return path;
+}
+
 void Logging::ConfigureETWLogWriter() {
   // Always create the ETW log writer, as its log level is controlled
   // at runtime through Event Tracing for Windows.
@@ -403,9 +664,11 @@ void Logging::ConfigureFileLogWriter() {
     return;
   }
 
-  // Create the logging file.
+  // Create the logging file. The mode of the writer, text or binary, is that
+  // of the settings when it is created.
   if (file_log_writer_ == NULL) {
-    CString path = GetLogFilePath();
+    CString path = binary_log_to_file_ ? GetBinaryLogFilePath() :
+                                         GetLogFilePath();
     if (path.IsEmpty()) {
       return;
     }
@@ -417,7 +680,10 @@ void Logging::ConfigureFileLogWriter() {
         return;
       }
     }
-    file_log_writer_ = FileLogWriter::Create(path, append_to_file_);
+    file_log_writer_binary_ = binary_log_to_file_;
+    file_log_writer_ = file_log_writer_binary_ ?
+        FileLogWriter::CreateBinary(path, append_to_file_) :
+        FileLogWriter::Create(path, append_to_file_);
     if (file_log_writer_ == NULL) {
       OutputDebugString(SPRINTF(L"LOG_SYSTEM: [%s]: ERROR - "
                                 L"Cannot create log writer to %s",
@@ -426,7 +692,8 @@ void Logging::ConfigureFileLogWriter() {
   }
 
   if (file_log_writer_ != NULL) {
-    InternalRegisterWriter(file_log_writer_);
+    binary_log_enabled_ = InternalRegisterWriter(file_log_writer_) &&
+                          file_log_writer_binary_;
   }
 }
 
@@ -463,6 +730,7 @@ void Logging::UnconfigureLogging() {
     InternalUnregisterWriter(etw_log_writer_);
   }
   if (file_log_writer_ != NULL) {
+    binary_log_enabled_ = false;
     InternalUnregisterWriter(file_log_writer_);
   }
   if (debug_out_writer_ != NULL) {
@@ -545,6 +813,7 @@ void Logging::EnableLogging() {
     if (!logging_enabled_) {
       ConfigureLogging();
       logging_enabled_ = true;
+      InvalidateCallSites();
     }
   } __except(SehNoMinidump(GetExceptionCode(),
                            GetExceptionInformation(),
@@ -570,6 +839,7 @@ void Logging::DisableLogging() {
     if (logging_enabled_) {
       logging_enabled_ = false;
       UnconfigureLogging();
+      InvalidateCallSites();
     }
   } __except(SehNoMinidump(GetExceptionCode(),
              GetExceptionInformation(),
@@ -617,6 +887,21 @@ void Logging::ForceShowTimestamp(bool force_show_time) {
   force_show_time_ = show_time_ = force_show_time;
 }
 
+void Logging::Flush() {
+  for (int i = 0; i < num_writers_; ++i) {
+    __try {
+      writers_[i]->Flush();
+    }
+    __except(SehNoMinidump(GetExceptionCode(),
+                           GetExceptionInformation(),
+                           __FILE__,
+                           __LINE__,
+                           true)) {
+      // Same as for OutputMessage.
+    }
+  }
+}
+
 // Get category level
 LogLevel Logging::GetCatLevel(LogCategory category) const {
   if (!IsLoggingAlreadyEnabled()) {
@@ -659,12 +944,23 @@ DWORD Logging::IsCatLevelEnabled(LogCategory category, LogLevel level) {
   return mask;
 }
 
-// TODO(omaha): For now this is hard coded and there is no way to override
-// writing other log categories into the history. Add a store_in_history
-// boolean into the CategoryInfo struct that allows reading from the config
-// file. This will enable other log categories to get buffered in the history.
-bool Logging::IsCategoryEnabledForBuffering(LogCategory cat) {
-  return cat == LC_REPORT;
+// The generation is read before the mask is computed, so that a change of
+// configuration while it is computed leaves the call site stale rather than
+// caching a mask for the wrong configuration. Nothing is cached until logging
+// is initialized, since initializing it does not always register writers.
+// The writers past those of the mask do not exist, so trimming all_writers_mask
+// to the bits of the cache does not change which writers get the message.
+DWORD Logging::UpdateCallSite(LogCategory category,
+                              LogLevel level,
+                              LogCallSite* site) {
+  COMPILE_ASSERT(max_writers <= 15, writer_mask_does_not_fit_in_call_site);
+
+  const LONG generation = config_generation_;
+  const DWORD mask = IsCatLevelEnabled(category, level) & kCallSiteMaskBits;
+  if (logging_initialized_ && !logging_shutdown_) {
+    site->enabled = CallSiteTag(generation) | mask;
+  }
+  return mask;
 }
 
 void Logging::LogMessage(LogCategory cat, LogLevel level,
@@ -680,17 +976,15 @@ void Logging::LogMessageVA(LogCategory cat, LogLevel level,
   LogMessageMaskedVA(static_cast<DWORD>(all_writers_mask),
                      cat,
                      level,
+                     NULL,
                      fmt,
                      args);
 }
 
-void Logging::InternalLogMessageMaskedVA(DWORD writer_mask,
-                                         LogCategory cat,
-                                         LogLevel level,
-                                         CString* log_buffer,
-                                         CString* prefix,
-                                         const wchar_t* fmt,
-                                         va_list args) {
+bool Logging::InternalFormatMessageVA(CString* log_buffer,
+                                      CString* prefix,
+                                      const wchar_t* fmt,
+                                      va_list args) {
   __try {
     // Initial buffer size in characters.
     // It will adjust dynamically if the message is bigger.
@@ -698,7 +992,6 @@ void Logging::InternalLogMessageMaskedVA(DWORD writer_mask,
 
     // Count of chars / bytes written.
     int num_chars = 0;
-    bool result = false;
 
     // Write the message in the buffer.
     // Dynamically adjust the size to hold the entire message.
@@ -722,40 +1015,133 @@ void Logging::InternalLogMessageMaskedVA(DWORD writer_mask,
     log_buffer->ReleaseBuffer(num_chars);
 
     FormatLinePrefix(show_time_, proc_name_, *prefix);
+  } __except(SehSendMinidump(GetExceptionCode(),
+                             GetExceptionInformation(),
+                             kMinsTo100ns)) {
+    OutputDebugStringA("Unexpected exception in: " __FUNCTION__ "\r\n");
+    OutputDebugString(fmt);
+    OutputDebugString(L"\n\r");
+    return false;
+  }
 
-    // Log the message.
-    OutputInfo info(cat, level, *prefix, *log_buffer);
-    OutputMessage(writer_mask, &info);
+  return true;
+}
+
+void Logging::InternalOutputMessage(DWORD writer_mask,
+                                    const OutputInfo* output_info) {
+  __try {
+    OutputMessage(writer_mask, output_info);
+  } __except(SehSendMinidump(GetExceptionCode(),
+                             GetExceptionInformation(),
+                             kMinsTo100ns)) {
+    OutputDebugStringA("Unexpected exception in: " __FUNCTION__ "\r\n");
+    OutputDebugString(output_info->msg2);
+    OutputDebugString(L"\n\r");
+  }
+}
+
+bool Logging::InternalEncodeMessageVA(BinaryLogEncoder* encoder,
+                                      const wchar_t* fmt,
+                                      va_list args) {
+  __try {
+    return EncodeArgsVA(encoder, fmt, args);
   } __except(SehSendMinidump(GetExceptionCode(),
                              GetExceptionInformation(),
                              kMinsTo100ns)) {
     OutputDebugStringA("Unexpected exception in: " __FUNCTION__ "\r\n");
     OutputDebugString(fmt);
     OutputDebugString(L"\n\r");
+    return false;
+  }
+}
+
+// Like IsCatLevelEnabled, this does not take the lock. The writers handle
+// binary messages without it.
+DWORD Logging::OutputBinaryMessage(DWORD writer_mask,
+                                   const BinaryLogMessage* message) {
+  DWORD remaining_mask = 0;
+  for (int i = 0; i < num_writers_; ++i) {
+    const DWORD writer_bit = static_cast<DWORD>(1) << i;
+    if (!(writer_mask & writer_bit)) {
+      continue;
+    }
+
+    bool handled = true;
+    __try {
+      handled = !(logging_enabled_ || writers_[i]->WantsToLogRegardless()) ||
+                !writers_[i]->NeedsMessage(message->category,
+                                           message->level) ||
+                writers_[i]->OutputBinaryMessage(message);
+    }
+    __except(SehNoMinidump(GetExceptionCode(),
+                           GetExceptionInformation(),
+                           __FILE__,
+                           __LINE__,
+                           true)) {
+      // Same as for OutputMessage.
+    }
+    if (!handled) {
+      remaining_mask |= writer_bit;
+    }
   }
+  return remaining_mask;
 }
 
 void Logging::LogMessageMaskedVA(DWORD writer_mask,
                                  LogCategory cat,
                                  LogLevel level,
+                                 LogCallSite* site,
                                  const wchar_t* fmt,
                                  va_list args) {
   if (!fmt) {
     return;
   }
 
-  if (writer_mask == 0 && level > kMaxLevelToStoreInLogHistory) {
+  if (writer_mask == 0 && !IsStoredInHistory(cat, level)) {
     return;
   }
 
+  // In binary mode, the arguments are recorded as they are for the writers
+  // which handle binary messages, and the message is formatted only if other
+  // writers, or the history, need it.
+  if (site && writer_mask && binary_log_enabled_ && !logging_shutdown_) {
+    uint8 args_buffer[kMaxBinaryLogArgsSize];
+    BinaryLogEncoder encoder(args_buffer, sizeof(args_buffer));
+    va_list binary_args;
+    va_copy(binary_args, args);
+    const bool encoded = InternalEncodeMessageVA(&encoder, fmt, binary_args);
+    va_end(binary_args);
+
+    if (encoded) {
+      const BinaryLogMessage message = {
+        cat,
+        level,
+        site,
+        fmt,
+        show_time_ ? GetLocalTimeAs100NS() : 0,
+        args_buffer,
+        encoder.size()
+      };
+      writer_mask = OutputBinaryMessage(writer_mask, &message);
+      if (writer_mask == 0 && !IsStoredInHistory(cat, level)) {
+        return;
+      }
+    }
+  }
+
+  // Formatting only uses the buffers of this call, so it is done before
+  // taking the lock, which is then held only while the message is output.
   CString log_buffer;    // The buffer for formatted log messages.
   CString prefix;
+  if (!InternalFormatMessageVA(&log_buffer, &prefix, fmt, args)) {
+    return;
+  }
+  OutputInfo info(cat, level, prefix, log_buffer);
 
   int i = 0;
   while (++i <= kNumLockRetries) {
     if (lock_.Lock(0)) {
-      InternalLogMessageMaskedVA(writer_mask, cat, level, &log_buffer,
-                                 &prefix, fmt, args);
+      InternalOutputMessage(writer_mask, &info);
       lock_.Unlock();
       break;
     }
@@ -847,8 +1233,7 @@ CString Logging::GetHistory() {
 
 void Logging::OutputMessage(DWORD writer_mask,
                             const OutputInfo* output_info) {
-  if (output_info->level <= kMaxLevelToStoreInLogHistory &&
-      IsCategoryEnabledForBuffering(output_info->category)) {
+  if (IsStoredInHistory(output_info->category, output_info->level)) {
     StoreInHistory(output_info);
   }
 
@@ -879,6 +1264,7 @@ bool Logging::InternalRegisterWriter(LogWriter* log_writer) {
     return false;
   }
   writers_[num_writers_++] = log_writer;
+  InvalidateCallSites();
   return true;
 }
 
@@ -899,6 +1285,7 @@ bool Logging::InternalUnregisterWriter(LogWriter* log_writer) {
       // Replace this entry with last entry in array, then truncate.
       writers_[i] = writers_[--num_writers_];
       result = true;
+      InvalidateCallSites();
       break;
     }
   }
@@ -953,6 +1340,16 @@ bool LogWriter::IsCatLevelEnabled(LogCategory, LogLevel) const {
 
 void LogWriter::OutputMessage(const OutputInfo*) { }
 
+bool LogWriter::OutputBinaryMessage(const BinaryLogMessage*) {
+  return false;
+}
+
+bool LogWriter::NeedsMessage(LogCategory, LogLevel) const {
+  return true;
+}
+
+void LogWriter::Flush() { }
+
 bool LogWriter::Register() {
   Logging* logger = GetLogging();
   if (logger) {
@@ -977,6 +1374,14 @@ FileLogWriter* FileLogWriter::Create(const wchar_t* file_name, bool append) {
   return new FileLogWriter(file_name, append);
 }
 
+FileLogWriter* FileLogWriter::CreateBinary(const wchar_t* file_name,
+                                           bool append) {
+  FileLogWriter* writer = new FileLogWriter(file_name, append);
+  writer->binary_ = true;
+  writer->async_ = true;
+  return writer;
+}
+
 FileLogWriter::FileLogWriter(const wchar_t* file_name, bool append)
     : max_file_size_(kDefaultMaxLogFileSize),
       initialized_(false),
@@ -985,7 +1390,16 @@ FileLogWriter::FileLogWriter(const wchar_t* file_name, bool append)
       log_file_wide_(kDefaultLogFileWide),
       log_file_mutex_(NULL),
       file_name_(file_name),
-      log_file_(NULL) {
+      log_file_(NULL),
+      async_(kDefaultAsyncLogToFile),
+      writer_thread_(NULL),
+      writer_event_(NULL),
+      writer_stop_(0),
+      writing_thread_id_(0),
+      num_dropped_reported_(0),
+      binary_(false),
+      file_end_(0),
+      process_generation_(0) {
   Logging* logger = GetLogging();
   if (logger) {
     CString config_file_path = logger->GetCurrentConfigurationFilePath();
@@ -1000,9 +1414,15 @@ FileLogWriter::FileLogWriter(const wchar_t* file_name, bool append)
             kConfigAttrLogFileWide,
             kDefaultLogFileWide,
             config_file_path) == 0 ? false : true;
+        async_ = ::GetPrivateProfileInt(
+            kConfigSectionLoggingSettings,
+            kConfigAttrAsyncLogToFile,
+            kDefaultAsyncLogToFile,
+            config_file_path) == 0 ? false : true;
     } else {
       max_file_size_ = kDefaultMaxLogFileSize;
       log_file_wide_ = kDefaultLogFileWide;
+      async_ = kDefaultAsyncLogToFile;
     }
     proc_name_ = logger->proc_name();
   }
@@ -1057,6 +1477,7 @@ void FileLogWriter::Initialize() {
 }
 
 void FileLogWriter::Cleanup() {
+  StopWriterThread();
   if (log_file_) {
     ::CloseHandle(log_file_);
   }
@@ -1138,8 +1559,13 @@ bool FileLogWriter::CreateLoggingFile() {
     AtlSetDacl(file_name_, SE_FILE_OBJECT, dacl);
   }
 
-  // Insert a BOM in the newly created file.
-  if (GetLastError() != ERROR_ALREADY_EXISTS && log_file_wide_) {
+  // Insert a BOM in the newly created file, or the binary log header in an
+  // empty binary log.
+  if (binary_) {
+    if (::GetFileSize(log_file_, NULL) == 0) {
+      WriteBinaryLogHeader(log_file_);
+    }
+  } else if (GetLastError() != ERROR_ALREADY_EXISTS && log_file_wide_) {
     DWORD num = 0;
     ::WriteFile(log_file_, &kUnicodeBom, sizeof(kUnicodeBom), &num, NULL);
   }
@@ -1159,8 +1585,10 @@ bool FileLogWriter::TruncateLoggingFile() {
     return false;
   }
 
-  // Insert a BOM in the newly created file.
-  if (log_file_wide_) {
+  // Insert a BOM in the newly created file, or the binary log header.
+  if (binary_) {
+    WriteBinaryLogHeader(log_file);
+  } else if (log_file_wide_) {
     DWORD num = 0;
     ::WriteFile(log_file, &kUnicodeBom, sizeof(kUnicodeBom), &num, NULL);
   }
@@ -1270,23 +1698,83 @@ void FileLogWriter::OutputMessage(const OutputInfo* output_info) {
     return;
   }
 
-  // Acquire the mutex.
-  if (!GetMutex()) {
+  if (async_ && QueueMessage(output_info)) {
     return;
   }
 
-  // Move to end of file.
+  WriteMessage(output_info);
+}
+
+void FileLogWriter::Flush() {
+  if (!ring_.get()) {
+    return;
+  }
+
+  // The messages can't be written if the crash happened while this thread
+  // was writing them, for instance on the writer thread.
+  if (static_cast<DWORD>(writing_thread_id_) == ::GetCurrentThreadId()) {
+    return;
+  }
+
+  // Gives the writer thread, or the other thread or process holding the
+  // logging mutex, some time to finish its write. The mutex is only tried,
+  // so that the whole flush takes at most about kMaxMutexWaitTimeMs.
+  const int kNumRetries = 10;
+  for (int i = 0; i < kNumRetries && !WriteQueuedMessages(false); ++i) {
+    ::Sleep(kMaxMutexWaitTimeMs / kNumRetries);
+  }
+}
+
+bool FileLogWriter::SeekToEnd() {
   DWORD pos = ::SetFilePointer(log_file_, 0, NULL, FILE_END);
+
+  // The process and site records written to a binary log are lost when it is
+  // truncated, by this process or another one, so they are written again.
+  bool truncated = pos < file_end_;
   int64 stop_gap_file_size = kStopGapLogFileSizeFactor *
                              static_cast<int64>(max_file_size_);
   if (pos >= stop_gap_file_size) {
     if (!TruncateLoggingFile()) {
       // Logging stops until the log can be archived over since we do not
       // want to overfill the disk.
-      return;
+      return false;
     }
+    truncated = true;
+  }
+  if (binary_ && truncated) {
+    ::InterlockedIncrement(&g_binary_log_generation);
+  }
+  file_end_ = ::SetFilePointer(log_file_, 0, NULL, FILE_END);
+  return true;
+}
+
+void FileLogWriter::WriteToFile(const void* data, size_t size) {
+  DWORD written_size = 0;
+  ::WriteFile(log_file_, data, static_cast<DWORD>(size), &written_size, NULL);
+  file_end_ += written_size;
+}
+
+void FileLogWriter::WriteMessage(const OutputInfo* output_info) {
+  // Acquire the mutex.
+  if (!GetMutex()) {
+    return;
+  }
+
+  if (!SeekToEnd()) {
+    ReleaseMutex();
+    return;
+  }
+
+  if (binary_) {
+    std::unique_ptr<uint8[]> data;
+    size_t size = 0;
+    EncodeTextRecord(CString(output_info->msg1) + output_info->msg2,
+                     &data,
+                     &size);
+    WriteToFile(data.get(), size);
+    ReleaseMutex();
+    return;
   }
-  pos = ::SetFilePointer(log_file_, 0, NULL, FILE_END);
 
   // Write the date, followed by a CRLF
   DWORD written_size = 0;
@@ -1323,6 +1811,308 @@ void FileLogWriter::OutputMessage(const OutputInfo* output_info) {
   ReleaseMutex();
 }
 
+bool FileLogWriter::QueueMessage(const OutputInfo* output_info) {
+  if (!StartWriterThread()) {
+    return false;
+  }
+
+  if (binary_) {
+    std::unique_ptr<uint8[]> data;
+    size_t size = 0;
+    EncodeTextRecord(CString(output_info->msg1) + output_info->msg2,
+                     &data,
+                     &size);
+    QueueRecord(data.get(), size);
+    return true;
+  }
+
+  // The record holds the bytes written to the file: the two parts of the
+  // message, followed by a CRLF.
+  const wchar_t* msg1 = output_info->msg1 ? output_info->msg1 : L"";
+  const wchar_t* msg2 = output_info->msg2 ? output_info->msg2 : L"";
+  uint8* record = NULL;
+  if (log_file_wide_) {
+    const size_t size1 = wcslen(msg1) * sizeof(wchar_t);
+    const size_t size2 = wcslen(msg2) * sizeof(wchar_t);
+    record = ring_->BeginWrite(size1 + size2 + 2 * sizeof(wchar_t));
+    if (record) {
+      memcpy(record, msg1, size1);
+      memcpy(record + size1, msg2, size2);
+      memcpy(record + size1 + size2, L"\r\n", 2 * sizeof(wchar_t));
+    }
+  } else {
+    CStringA msg(WideToAnsiDirect(CString(msg1) + msg2));
+    msg += "\r\n";
+    record = ring_->BeginWrite(msg.GetLength());
+    if (record) {
+      memcpy(record, msg.GetString(), msg.GetLength());
+    }
+  }
+
+  if (record) {
+    ring_->EndWrite(record);
+  }
+  SignalWriterIfNeeded();
+  return true;
+}
+
+bool FileLogWriter::QueueRecord(const void* data, size_t size) {
+  uint8* record = ring_->BeginWrite(size);
+  if (record) {
+    memcpy(record, data, size);
+    ring_->EndWrite(record);
+  }
+  SignalWriterIfNeeded();
+  return record != NULL;
+}
+
+void FileLogWriter::SignalWriterIfNeeded() {
+  // The writer wakes up on its own every kLogFlushIntervalMs; it is only
+  // woken up early when the ring buffer starts filling up.
+  if (ring_->size() >= ring_->capacity() / 2) {
+    ::SetEvent(writer_event_);
+  }
+}
+
+bool FileLogWriter::OutputBinaryMessage(const BinaryLogMessage* message) {
+  // The first message is output as text, which opens the file and starts the
+  // writer thread.
+  if (!binary_ || !valid_ || !writer_thread_) {
+    return false;
+  }
+
+  if (!RegisterCallSite(message)) {
+    return false;
+  }
+
+  const uint64 pid = ::GetCurrentProcessId();
+  const uint64 tid = ::GetCurrentThreadId();
+  const uint64 site_id = static_cast<ULONG>(message->site->id);
+  const size_t payload_size = BinaryLogEncoder::VarintSize(pid) +
+                              BinaryLogEncoder::VarintSize(tid) +
+                              BinaryLogEncoder::VarintSize(message->time) +
+                              BinaryLogEncoder::VarintSize(site_id) +
+                              message->args_size;
+  const size_t record_size = BinaryLogEncoder::RecordSize(payload_size);
+
+  // The record is encoded in place. A message dropped from the ring buffer is
+  // counted as such, and not logged as text instead.
+  uint8* record = ring_->BeginWrite(record_size);
+  if (record) {
+    BinaryLogEncoder encoder(record, record_size);
+    encoder.PutRecordHeader(binary_log::kMessageRecord, payload_size);
+    encoder.PutVarint(pid);
+    encoder.PutVarint(tid);
+    encoder.PutVarint(message->time);
+    encoder.PutVarint(site_id);
+    encoder.PutBytes(message->args, message->args_size);
+    ring_->EndWrite(record);
+  }
+  SignalWriterIfNeeded();
+  return true;
+}
+
+bool FileLogWriter::RegisterCallSite(const BinaryLogMessage* message) {
+  LogCallSite* site = message->site;
+  const LONG generation = g_binary_log_generation;
+  if (process_generation_ == generation && site->generation == generation) {
+    return true;
+  }
+
+  // Registering is rare, and serialized so that the process record is queued
+  // before the site records which follow it.
+  __mutexScope(registration_lock_);
+
+  std::unique_ptr<uint8[]> data;
+  const uint64 pid = ::GetCurrentProcessId();
+  if (process_generation_ != generation) {
+    const size_t length = proc_name_.GetLength();
+    const size_t payload_size = BinaryLogEncoder::VarintSize(pid) +
+                                BinaryLogEncoder::StringSize(length);
+    const size_t size = BinaryLogEncoder::RecordSize(payload_size);
+    data.reset(new uint8[size]);
+    BinaryLogEncoder encoder(data.get(), size);
+    encoder.PutRecordHeader(binary_log::kProcessRecord, payload_size);
+    encoder.PutVarint(pid);
+    encoder.PutString(reinterpret_cast<const uint16*>(proc_name_.GetString()),
+                      length);
+    if (!QueueRecord(data.get(), size)) {
+      return false;
+    }
+    process_generation_ = generation;
+  }
+
+  if (!site->id) {
+    ::InterlockedCompareExchange(&site->id,
+                                 ::InterlockedIncrement(&g_last_call_site_id),
+                                 0);
+  }
+
+  if (site->generation != generation) {
+    const uint64 site_id = static_cast<ULONG>(site->id);
+    const size_t length = wcslen(message->format);
+    const size_t payload_size = BinaryLogEncoder::VarintSize(pid) +
+                                BinaryLogEncoder::VarintSize(site_id) +
+                                BinaryLogEncoder::StringSize(length);
+    const size_t size = BinaryLogEncoder::RecordSize(payload_size);
+    data.reset(new uint8[size]);
+    BinaryLogEncoder encoder(data.get(), size);
+    encoder.PutRecordHeader(binary_log::kSiteRecord, payload_size);
+    encoder.PutVarint(pid);
+    encoder.PutVarint(site_id);
+    encoder.PutString(reinterpret_cast<const uint16*>(message->format), length);
+    if (!QueueRecord(data.get(), size)) {
+      return false;
+    }
+    ::InterlockedExchange(&site->generation, generation);
+  }
+  return true;
+}
+
+bool FileLogWriter::HasQueuedMessages() {
+  size_t size = 0;
+  return ring_->num_dropped() != num_dropped_reported_ ||
+         ring_->Peek(&size) != NULL;
+}
+
+size_t FileLogWriter::FillBatch() {
+  size_t batch_size = 0;
+
+  // Report the messages dropped since the last batch in their place.
+  const uint32 num_dropped = ring_->num_dropped();
+  if (num_dropped != num_dropped_reported_) {
+    CString msg;
+    SafeCStringFormat(&msg, L"LOG_SYSTEM: [%s]: %u log messages dropped",
+                      proc_name_, num_dropped - num_dropped_reported_);
+    num_dropped_reported_ = num_dropped;
+    if (binary_) {
+      std::unique_ptr<uint8[]> data;
+      EncodeTextRecord(msg, &data, &batch_size);
+      memcpy(batch_.get(), data.get(), batch_size);
+    } else if (log_file_wide_) {
+      msg += L"\r\n";
+      batch_size = msg.GetLength() * sizeof(wchar_t);
+      memcpy(batch_.get(), msg.GetString(), batch_size);
+    } else {
+      msg += L"\r\n";
+      CStringA ansi_msg(WideToAnsiDirect(msg));
+      batch_size = ansi_msg.GetLength();
+      memcpy(batch_.get(), ansi_msg.GetString(), batch_size);
+    }
+  }
+
+  // The largest record fits in a batch on its own.
+  COMPILE_ASSERT(kLogBatchSize >= kLogRingBufferSize / 4,
+                 log_batch_smaller_than_largest_record);
+  size_t size = 0;
+  const uint8* record = NULL;
+  while ((record = ring_->Peek(&size)) != NULL &&
+         batch_size + size <= kLogBatchSize) {
+    memcpy(batch_.get() + batch_size, record, size);
+    batch_size += size;
+    ring_->Pop();
+  }
+  return batch_size;
+}
+
+bool FileLogWriter::WriteQueuedMessages(bool wait_for_mutex) {
+  if (::InterlockedCompareExchange(
+          &writing_thread_id_,
+          static_cast<LONG>(::GetCurrentThreadId()),
+          0)) {
+    return false;
+  }
+
+  // The mutex is taken before the batch is filled, so that the messages stay
+  // queued if it can't be had.
+  bool is_written = true;
+  while (valid_ && HasQueuedMessages()) {
+    if (wait_for_mutex ? !GetMutex() : !TryGetMutex()) {
+      is_written = false;
+      break;
+    }
+
+    const size_t batch_size = FillBatch();
+    if (SeekToEnd()) {
+      WriteToFile(batch_.get(), batch_size);
+    }
+    ReleaseMutex();
+  }
+
+  ::InterlockedExchange(&writing_thread_id_, 0);
+  return is_written;
+}
+
+bool FileLogWriter::StartWriterThread() {
+  if (writer_thread_) {
+    return true;
+  }
+
+  // Called with the logging lock held, so only one thread starts the writer.
+  if (!ring_.get()) {
+    ring_.reset(new LogRingBuffer(kLogRingBufferSize));
+    batch_.reset(new uint8[kLogBatchSize]);
+  }
+
+  writer_event_ = ::CreateEvent(NULL, false, false, NULL);
+  if (!writer_event_) {
+    async_ = false;
+    return false;
+  }
+  writer_thread_ = ::CreateThread(NULL, 0, &WriterThreadProc, this, 0, NULL);
+  if (!writer_thread_) {
+    ::OutputDebugString(SPRINTF(L"LOG_SYSTEM: [%s]: "
+                                L"Could not start the log writer thread %d\n",
+                                proc_name_, ::GetLastError()));
+    ::CloseHandle(writer_event_);
+    writer_event_ = NULL;
+    async_ = false;
+    return false;
+  }
+  return true;
+}
+
+void FileLogWriter::StopWriterThread() {
+  if (!writer_thread_) {
+    return;
+  }
+
+  ::InterlockedExchange(&writer_stop_, 1);
+  ::SetEvent(writer_event_);
+
+  // The thread can't exit while the loader lock is held, when the writer is
+  // destroyed as a DLL unloads. In that case, the thread and what it uses are
+  // leaked rather than freed from under it.
+  if (::WaitForSingleObject(writer_thread_, kMaxMutexWaitTimeMs) !=
+      WAIT_OBJECT_0) {
+    ::OutputDebugString(SPRINTF(L"LOG_SYSTEM: [%s]: "
+                                L"The log writer thread did not stop\n",
+                                proc_name_));
+    ring_.release();
+    batch_.release();
+    writer_thread_ = NULL;
+    writer_event_ = NULL;
+    return;
+  }
+
+  ::CloseHandle(writer_thread_);
+  ::CloseHandle(writer_event_);
+  writer_thread_ = NULL;
+  writer_event_ = NULL;
+
+  // Write out what was queued after the thread wrote its last batch.
+  WriteQueuedMessages(true);
+}
+
+DWORD WINAPI FileLogWriter::WriterThreadProc(void* param) {
+  FileLogWriter* writer = static_cast<FileLogWriter*>(param);
+  while (!writer->writer_stop_) {
+    ::WaitForSingleObject(writer->writer_event_, kLogFlushIntervalMs);
+    writer->WriteQueuedMessages(true);
+  }
+  return 0;
+}
+
 bool FileLogWriter::GetMutex() {
   if (!log_file_mutex_) {
     return false;
@@ -1340,6 +2130,17 @@ bool FileLogWriter::GetMutex() {
   return true;
 }
 
+bool FileLogWriter::TryGetMutex() {
+  if (!log_file_mutex_) {
+    return false;
+  }
+
+  // Unlike GetMutex, failing to get the mutex right away does not disable
+  // the writer, since the mutex may only be held for a short while.
+  DWORD res = ::WaitForSingleObject(log_file_mutex_, 0);
+  return res == WAIT_OBJECT_0 || res == WAIT_ABANDONED;
+}
+
 void FileLogWriter::ReleaseMutex() {
   if (log_file_mutex_) {
     ::ReleaseMutex(log_file_mutex_);
@@ -1414,6 +2215,22 @@ void OverrideConfigLogWriter::OutputMessage(const OutputInfo* output_info) {
   return;
 }
 
+bool OverrideConfigLogWriter::OutputBinaryMessage(
+    const BinaryLogMessage* message) {
+  return log_writer_ && log_writer_->OutputBinaryMessage(message);
+}
+
+bool OverrideConfigLogWriter::NeedsMessage(LogCategory category,
+                                           LogLevel level) const {
+  return log_writer_ && log_writer_->NeedsMessage(category, level);
+}
+
+void OverrideConfigLogWriter::Flush() {
+  if (log_writer_) {
+    log_writer_->Flush();
+  }
+}
+
 }  // namespace omaha
 
 #endif  // LOGGING
@@ -21,7 +21,11 @@
 #ifndef OMAHA_BASE_LOGGING_H_
 #define OMAHA_BASE_LOGGING_H_
 
+#include <memory>
+
+#include "omaha/base/binary_log.h"
 #include "omaha/base/constants.h"
+#include "omaha/base/log_ring_buffer.h"
 #include "omaha/base/synchronized.h"
 #include "omaha/base/time.h"
 
@@ -55,6 +59,11 @@ namespace omaha {
 #define kDefaultLogFileWide             1
 #define kDefaultShowTime                1
 #define kDefaultAppendToFile            1
+#define kDefaultAsyncLogToFile          0
+#define kDefaultBinaryLogToFile         0
+#define kDefaultBinaryLogFileName       MAIN_EXE_BASE_NAME _T(".binlog")
+#define kDefaultTraceToFile             0
+#define kDefaultTraceFileExtension      _T(".trace.json")
 
 #ifdef _DEBUG
 #define kDefaultMaxLogFileSize          0xFFFFFFFF  // 4GB
@@ -68,6 +77,17 @@ namespace omaha {
 #define kDefaultLogLevel                L1
 #endif
 
+// Log statements above this level are compiled out, arguments included.
+// Release builds only keep OPT_LOG and REPORT_LOG statements, and strip those
+// above L3, which are too verbose to be of use in the field.
+#ifndef LOGGING_MAX_LEVEL
+#ifdef _DEBUG
+#define LOGGING_MAX_LEVEL               LEVEL_ALL
+#else
+#define LOGGING_MAX_LEVEL               L3
+#endif
+#endif
+
 // Truncates the log file when the size of the log file is this many
 // times over the MaxLogFileSize to prevent disk overfill.
 #define kStopGapLogFileSizeFactor       10
@@ -84,6 +104,9 @@ namespace omaha {
 #define kConfigAttrLogToOutputDebug     L"LogToOutputDebug"
 #define kConfigAttrAppendToFile         L"AppendToFile"
 #define kConfigAttrMaxLogFileSize       L"MaxLogFileSize"
+#define kConfigAttrAsyncLogToFile       L"AsyncLogToFile"
+#define kConfigAttrBinaryLogToFile      L"BinaryLogToFile"
+#define kConfigAttrTraceToFile          L"TraceToFile"
 
 #define kLoggingMutexName               kLockPrefix L"logging_mutex"
 #define kMaxMutexWaitTimeMs             500
@@ -91,7 +114,23 @@ namespace omaha {
 // Does not allow messages bigger than 1 MB.
 #define kMaxLogMessageSize              (1024 * 1024)
 
+// When logging to the file asynchronously, the messages are queued in a ring
+// buffer of this many bytes, and written by a background thread in batches of
+// up to kLogBatchSize bytes every kLogFlushIntervalMs, or as soon as the ring
+// buffer is half full. The messages which do not fit in the ring buffer, or
+// are larger than a quarter of it, are dropped.
+#define kLogRingBufferSize              (1024 * 1024)
+#define kLogBatchSize                   (256 * 1024)
+#define kLogFlushIntervalMs             100
+
+// The arguments of a message logged in binary mode are recorded in a buffer
+// of this many bytes on the stack. Messages whose arguments do not fit are
+// formatted and logged as text.
+#define kMaxBinaryLogArgsSize           2048
+
 #define kLogSettingsCheckInterval       (5 * kSecsTo100ns)
+#define kLogSettingsCheckIntervalMs \
+    static_cast<DWORD>(kLogSettingsCheckInterval / kMillisecsTo100ns)
 
 #define kStartOfLogMessage \
     L"********************* NEW LOG *********************"
@@ -104,13 +143,25 @@ namespace omaha {
 
 #ifdef LOGGING
 
+// The arguments of a log statement are only evaluated if the message is
+// logged, or kept in the history. Whether it is logged is cached in the call
+// site of the statement, so that a disabled statement costs little more than
+// a couple of comparisons.
 #define LC_LOG(cat, level, msg) \
-  do {                                                     \
-    omaha::Logging* logger = omaha::GetLogging();          \
-    if (logger) {                                          \
-      omaha::LoggingHelper(logger, cat, level,             \
-        logger->IsCatLevelEnabled(cat, level)) msg;        \
-    }                                                      \
+  do {                                                                \
+    if ((level) <= LOGGING_MAX_LEVEL) {                               \
+      static omaha::LogCallSite log_call_site;                        \
+      omaha::Logging* logger = omaha::GetLogging();                   \
+      if (logger) {                                                   \
+        const DWORD log_writer_mask =                                 \
+            logger->IsCatLevelEnabled(cat, level, &log_call_site);    \
+        if (log_writer_mask ||                                        \
+            omaha::Logging::IsStoredInHistory(cat, level)) {          \
+          omaha::LoggingHelper(logger, cat, level, log_writer_mask,   \
+                               &log_call_site) msg;                   \
+        }                                                             \
+      }                                                               \
+    }                                                                 \
   } while (0)
 
 #define LC_LOG_OPT(cat, level, msg)   LC_LOG(cat, level, msg)
@@ -192,6 +243,32 @@ struct OutputInfo {
         msg2(m2) {}
 };
 
+// Identifies the log statement of a LC_LOG macro, so that binary logs can
+// record its format string once and refer to it by id afterwards. Static, so
+// zero-initialized: the id is assigned the first time the statement is logged
+// in binary mode, and the generation is that of the binary log the format
+// string was last written to. |enabled| caches the writer mask of the
+// statement, as Logging::IsCatLevelEnabled packs it.
+struct LogCallSite {
+  volatile LONG id;
+  volatile LONG generation;
+  volatile DWORD enabled;
+};
+
+// A message logged in binary mode: the format string of the log statement and
+// its arguments, recorded as a BinaryLogEncoder writes them, but not
+// formatted. |time| is the local time as a FILETIME, or 0 if the time is not
+// shown.
+struct BinaryLogMessage {
+  LogCategory category;
+  LogLevel level;
+  LogCallSite* site;
+  const wchar_t* format;
+  uint64 time;
+  const uint8* args;
+  size_t args_size;
+};
+
 // The LogWriter - can decide whether to process message or not, then
 // will process it.  Actually, the message is processed if either a) the
 // individual LogWriter wants to process it or b) it is marked as processable
@@ -228,6 +305,19 @@ class LogWriter {
 
   virtual void OutputMessage(const OutputInfo* output_info);
 
+  // Handles a message logged in binary mode, without it being formatted.
+  // Returns false if this LogWriter needs the formatted message instead.
+  virtual bool OutputBinaryMessage(const BinaryLogMessage* message);
+
+  // Returns false if OutputMessage would ignore messages of this category and
+  // level, so that they need not be formatted for this LogWriter.
+  virtual bool NeedsMessage(LogCategory category, LogLevel level) const;
+
+  // Writes out the messages this LogWriter has queued, if any. Called when
+  // the process crashes, so it must not wait for long nor take locks which
+  // the crashing thread may hold.
+  virtual void Flush();
+
   // Registers and unregisters this LogWriter with the Logging system.  When
   // registered, the Logging class assumes ownership.
   bool Register();
@@ -238,6 +328,18 @@ class LogWriter {
 };
 
 // A LogWriter that writes to a named file.
+//
+// In asynchronous mode, the messages are formatted into a ring buffer and
+// written by a background thread, which takes the cross-process logging mutex
+// once per batch of messages instead of once per message. The queued messages
+// are written out when the writer is destroyed or flushed. Messages which do
+// not fit in the ring buffer are dropped, and the number of messages dropped is
+// written to the file in their place.
+//
+// In binary mode, which is always asynchronous, the file is a binary log as
+// described in binary_log.h. Messages logged in binary mode are queued as the
+// id of their log statement and their arguments, and the other messages as
+// text records.
 class FileLogWriter : public LogWriter {
  protected:
   FileLogWriter(const wchar_t* file_name, bool append);
@@ -246,15 +348,65 @@ class FileLogWriter : public LogWriter {
 
  public:
   static FileLogWriter* Create(const wchar_t* file_name, bool append);
+  static FileLogWriter* CreateBinary(const wchar_t* file_name, bool append);
   virtual void OutputMessage(const OutputInfo* output_info);
+  virtual bool OutputBinaryMessage(const BinaryLogMessage* message);
+  virtual void Flush();
 
  private:
   void Initialize();
+
+  // Queues the process record, and the site record of |message|, unless they
+  // were already written to the current binary log. Returns false if they
+  // could not be queued.
+  bool RegisterCallSite(const BinaryLogMessage* message);
+
+  // Writes the message to the file, holding the logging mutex.
+  void WriteMessage(const OutputInfo* output_info);
+
+  // Queues the message for the background thread to write, starting the
+  // thread if needed. Returns false if the thread could not be started.
+  bool QueueMessage(const OutputInfo* output_info);
+
+  // Queues |size| bytes of |data| as a record. Returns false if the record
+  // was dropped.
+  bool QueueRecord(const void* data, size_t size);
+
+  // Wakes the background thread up if the ring buffer is filling up.
+  void SignalWriterIfNeeded();
+
+  // Writes the queued messages to the file in batches. Returns false if
+  // another thread is already writing them, or if the logging mutex is held
+  // and |wait_for_mutex| is false, in which case the messages left are kept
+  // queued.
+  bool WriteQueuedMessages(bool wait_for_mutex);
+
+  // Returns true if there are messages, or a count of dropped messages, to
+  // write. Called by the thread writing the queued messages.
+  bool HasQueuedMessages();
+
+  // Copies queued messages to |batch_| and returns the size of the batch.
+  // Called with the mutex held.
+  size_t FillBatch();
+
+  // Moves to the end of the file, and truncates it if it has grown too big.
+  // Returns false if the file can't be written to. Called with the mutex held.
+  bool SeekToEnd();
+
+  // Writes |size| bytes of |data| at the end of the file. Called with the
+  // mutex held, after SeekToEnd.
+  void WriteToFile(const void* data, size_t size);
+
+  bool StartWriterThread();
+  void StopWriterThread();
+  static DWORD WINAPI WriterThreadProc(void* param);
+
   bool CreateLoggingMutex();
   bool CreateLoggingFile();
   bool ArchiveLoggingFile();
   bool TruncateLoggingFile();
   bool GetMutex();
+  bool TryGetMutex();
   void ReleaseMutex();
 
   // Returns true if archiving of the log file is pending a computer restart.
@@ -277,6 +429,25 @@ class FileLogWriter : public LogWriter {
   HANDLE log_file_;
   CString proc_name_;
 
+  // Asynchronous mode.
+  bool async_;
+  std::unique_ptr<LogRingBuffer> ring_;
+  std::unique_ptr<uint8[]> batch_;
+  HANDLE volatile writer_thread_;
+  HANDLE writer_event_;
+  volatile LONG writer_stop_;
+  // The id of the thread writing the queued messages, or 0.
+  volatile LONG writing_thread_id_;
+  uint32 num_dropped_reported_;
+
+  // Binary mode. |file_end_| is the size of the file after the last write,
+  // which tells when another process truncated the file. The process record
+  // was last written to the binary log of generation |process_generation_|.
+  bool binary_;
+  DWORD file_end_;
+  volatile LONG process_generation_;
+  LLock registration_lock_;
+
   friend class FileLogWriterTest;
 
   DISALLOW_COPY_AND_ASSIGN(FileLogWriter);
@@ -307,6 +478,9 @@ class OverrideConfigLogWriter : public LogWriter {
   virtual bool WantsToLogRegardless() const;
   virtual bool IsCatLevelEnabled(LogCategory category, LogLevel level) const;
   virtual void OutputMessage(const OutputInfo* output_info);
+  virtual bool OutputBinaryMessage(const BinaryLogMessage* message);
+  virtual bool NeedsMessage(LogCategory category, LogLevel level) const;
+  virtual void Flush();
  private:
   LogCategory category_;
   LogLevel level_;
@@ -344,8 +518,34 @@ class Logging {
   // Overrides the config file settings for showing the time stamps.
   void ForceShowTimestamp(bool force_show_time);
 
+  // Writes out the messages queued by the log writers. Does not take the
+  // logging lock, so that it can be called when handling a crash.
+  void Flush();
+
   // Checks if logging is enabled for a given category and level.
   DWORD IsCatLevelEnabled(LogCategory category, LogLevel level);
+
+  // Same as above for the log statement of |site|, whose writer mask is
+  // cached until the logging configuration changes or is due to be read
+  // again. The mask is cached along with the low bits of the generation of
+  // the configuration, in a single DWORD so that it is read atomically.
+  DWORD IsCatLevelEnabled(LogCategory category,
+                          LogLevel level,
+                          LogCallSite* site) {
+    const DWORD enabled = site->enabled;
+    if ((enabled & ~static_cast<DWORD>(kCallSiteMaskBits)) ==
+            CallSiteTag(config_generation_) &&
+        ::GetTickCount() - settings_check_tick_ < kLogSettingsCheckIntervalMs) {
+      return enabled & kCallSiteMaskBits;
+    }
+    return UpdateCallSite(category, level, site);
+  }
+
+  // Invalidates the writer masks cached in the call sites. Called whenever
+  // the categories, levels, or writers which IsCatLevelEnabled depends on
+  // change.
+  void InvalidateCallSites() { ::InterlockedIncrement(&config_generation_); }
+
   LogLevel GetCatLevel(LogCategory category) const;
 
   // Logs a message.
@@ -359,6 +559,20 @@ class Logging {
   // Computes and returns the complete path of the log file.
   CString GetLogFilePath() const;
 
+  // Computes and returns the complete path of the binary log file.
+  CString GetBinaryLogFilePath() const;
+
+  // Returns true if messages are logged in binary mode.
+  bool IsBinaryLogEnabled() const { return binary_log_enabled_; }
+
+  // Computes and returns the complete path of the file the tracing spans of
+  // this process are written to. The path includes the id of the process,
+  // since each process writes its own trace.
+  CString GetTraceFilePath() const;
+
+  // Returns true if the tracing spans are written to a file at exit.
+  bool IsTraceToFileEnabled() const { return trace_to_file_; }
+
   // Retrieves in-memory history buffer.
   CString GetHistory();
 
@@ -367,21 +581,69 @@ class Logging {
 
   const CString& proc_name() const { return proc_name_; }
 
-  bool IsCategoryEnabledForBuffering(LogCategory cat);
+  // TODO(omaha): For now this is hard coded and there is no way to override
+  // writing other log categories into the history. Add a store_in_history
+  // boolean into the CategoryInfo struct that allows reading from the config
+  // file. This will enable other log categories to get buffered in the
+  // history.
+  static bool IsCategoryEnabledForBuffering(LogCategory cat) {
+    return cat == LC_REPORT;
+  }
+
+  // Returns true if the messages of the category and level are stored in the
+  // in-memory history, whether they are logged or not.
+  static bool IsStoredInHistory(LogCategory cat, LogLevel level) {
+    return level <= kMaxLevelToStoreInLogHistory &&
+           IsCategoryEnabledForBuffering(cat);
+  }
 
  private:
+  // The writer mask cached in a call site has a bit per writer, a bit which
+  // tells it apart from the zero of a call site which was never checked, and
+  // the low 16 bits of the generation of the configuration.
+  enum {
+    kCallSiteMaskBits = 0x7FFF,
+    kCallSiteCachedBit = 0x8000,
+  };
+
+  static DWORD CallSiteTag(LONG generation) {
+    return (static_cast<DWORD>(generation) << 16) | kCallSiteCachedBit;
+  }
+
+  // Checks if logging is enabled for the category and level of the log
+  // statement of |site|, and caches the result in |site|.
+  DWORD UpdateCallSite(LogCategory category,
+                       LogLevel level,
+                       LogCallSite* site);
+
   bool InternalInitialize();
-  void InternalLogMessageMaskedVA(DWORD writer_mask,
-                                  LogCategory cat,
-                                  LogLevel level,
-                                  CString* log_buffer,
-                                  CString* prefix,
-                                  const wchar_t* fmt,
-                                  va_list args);
+
+  // Formats the message and its prefix. Returns false if formatting raised
+  // an exception.
+  bool InternalFormatMessageVA(CString* log_buffer,
+                               CString* prefix,
+                               const wchar_t* fmt,
+                               va_list args);
+
+  // Broadcasts the message to the log writers. Called with the lock held.
+  void InternalOutputMessage(DWORD writer_mask, const OutputInfo* output_info);
+
+  // Records the arguments of the message without formatting them. Returns
+  // false if the format has conversions which binary logs do not support, or
+  // if the arguments do not fit in |encoder|.
+  bool InternalEncodeMessageVA(BinaryLogEncoder* encoder,
+                               const wchar_t* fmt,
+                               va_list args);
+
+  // Passes the message to the log writers in |writer_mask| which handle
+  // binary messages, and returns the mask of the writers which still need
+  // the formatted message.
+  DWORD OutputBinaryMessage(DWORD writer_mask,
+                            const BinaryLogMessage* message);
 
   friend class LoggingHelper;
   void LogMessageMaskedVA(DWORD writer_mask, LogCategory cat, LogLevel level,
-                          const wchar_t* fmt, va_list args);
+                          LogCallSite* site, const wchar_t* fmt, va_list args);
 
   // Stores log message in in-memory history buffer.
   void StoreInHistory(const OutputInfo* output_info);
@@ -443,6 +705,11 @@ class Logging {
   bool log_to_file_;
   bool log_to_debug_out_;
   bool append_to_file_;
+  bool binary_log_to_file_;
+  bool trace_to_file_;
+
+  // True while the file log writer is registered in binary mode.
+  bool binary_log_enabled_;
 
   // Signals the logging system is shutting down.
   bool logging_shutdown_;
@@ -450,6 +717,13 @@ class Logging {
   // Checkpoint time for dynamic category updates.
   time64 g_last_category_check_time;
 
+  // The same checkpoint, as a tick count, for the writer masks cached in the
+  // call sites.
+  volatile DWORD settings_check_tick_;
+
+  // Incremented when the writer masks cached in the call sites are stale.
+  volatile LONG config_generation_;
+
   // The file path of the optional ini file which defines the logging
   // configuration.
   CString config_file_path_;
@@ -469,6 +743,7 @@ class Logging {
   LogWriter* writers_[max_writers];
 
   LogWriter* file_log_writer_;
+  bool file_log_writer_binary_;
   LogWriter* debug_out_writer_;
   LogWriter* etw_log_writer_;
 
@@ -492,16 +767,18 @@ class Logging {
 class LoggingHelper {
  public:
   LoggingHelper(Logging* logger, LogCategory cat,
-                LogLevel level, DWORD writer_mask)
+                LogLevel level, DWORD writer_mask, LogCallSite* site)
       : logger_(logger),
         category_(cat),
         level_(level),
-        writer_mask_(writer_mask) {}
+        writer_mask_(writer_mask),
+        site_(site) {}
 
   void operator()(const wchar_t* fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    logger_->LogMessageMaskedVA(writer_mask_, category_, level_, fmt, args);
+    logger_->LogMessageMaskedVA(writer_mask_, category_, level_, site_, fmt,
+                                args);
     va_end(args);
   }
 
@@ -510,6 +787,7 @@ class LoggingHelper {
   LogCategory category_;
   LogLevel level_;
   DWORD writer_mask_;
+  LogCallSite* site_;
 
   DISALLOW_COPY_AND_ASSIGN(LoggingHelper);
 };
@@ -13,8 +13,16 @@
 // limitations under the License.
 // ========================================================================
 
+#include <string>
+#include <vector>
+
 #include "base/basictypes.h"
+#include "omaha/base/app_util.h"
+#include "omaha/base/binary_log.h"
 #include "omaha/base/logging.h"
+#include "omaha/base/path.h"
+#include "omaha/base/safe_format.h"
+#include "omaha/base/utils.h"
 #include "omaha/testing/unit_test.h"
 
 namespace omaha {
@@ -27,6 +35,43 @@ TEST(LoggingTest, Logging) {
 #endif
 }
 
+// The arguments of a log statement are not evaluated when it does not log.
+TEST(LoggingTest, Logging_LazyArguments) {
+  int evaluated = 0;
+  LC_LOG(LC_JS, LEVEL_ALL, (_T("[%d]"), ++evaluated));
+  EXPECT_EQ(0, evaluated);
+
+#ifndef _DEBUG
+  // Compiled out in optimized builds, whatever the configuration.
+  OPT_LOG(L4, (_T("[%d]"), ++evaluated));
+  EXPECT_EQ(0, evaluated);
+#endif
+}
+
+// The writer mask cached in a call site follows the writers.
+TEST(LoggingTest, IsCatLevelEnabled_CallSite) {
+  Logging* logging = GetLogging();
+  ASSERT_TRUE(logging);
+  if (!logging->IsLoggingEnabled()) {
+    return;
+  }
+
+  LogCallSite site = {};
+  const bool enabled = logging->IsCatLevelEnabled(LC_JS, L6) != 0;
+  EXPECT_EQ(enabled, logging->IsCatLevelEnabled(LC_JS, L6, &site) != 0);
+  EXPECT_NE(0u, site.enabled);
+  EXPECT_EQ(enabled, logging->IsCatLevelEnabled(LC_JS, L6, &site) != 0);
+
+  LogWriter* writer = OverrideConfigLogWriter::Create(LC_JS, L6, NULL, false);
+  ASSERT_TRUE(logging->RegisterWriter(writer));
+  EXPECT_NE(0u, logging->IsCatLevelEnabled(LC_JS, L6, &site));
+
+  EXPECT_TRUE(logging->UnregisterWriter(writer));
+  delete writer;
+  EXPECT_EQ(logging->IsCatLevelEnabled(LC_JS, L6) != 0,
+            logging->IsCatLevelEnabled(LC_JS, L6, &site) != 0);
+}
+
 class FileLogWriterTest : public testing::Test {
  public:
 
@@ -35,6 +80,85 @@ class FileLogWriterTest : public testing::Test {
                              const TCHAR* str) {
     return FileLogWriter::FindFirstInMultiString(multi_str, count, str);
   }
+
+ protected:
+  virtual void SetUp() {
+    file_name_ = ConcatenatePath(app_util::GetTempDir(),
+                                 _T("FileLogWriterTest.log"));
+    ::DeleteFile(file_name_);
+  }
+
+  virtual void TearDown() {
+    ::DeleteFile(file_name_);
+  }
+
+  FileLogWriter* CreateAsyncWriter() {
+    FileLogWriter* writer = FileLogWriter::Create(file_name_, false);
+    writer->async_ = true;
+    writer->log_file_wide_ = true;
+    return writer;
+  }
+
+  static void DeleteWriter(FileLogWriter* writer) {
+    delete writer;
+  }
+
+  // Makes the writer behave as if this thread were writing the queued
+  // messages, which is the case when the writer thread crashes.
+  static void BeginWritingQueuedMessages(FileLogWriter* writer) {
+    while (::InterlockedCompareExchange(
+               &writer->writing_thread_id_,
+               static_cast<LONG>(::GetCurrentThreadId()),
+               0)) {
+      ::Sleep(1);
+    }
+  }
+
+  static void EndWritingQueuedMessages(FileLogWriter* writer) {
+    ::InterlockedExchange(&writer->writing_thread_id_, 0);
+  }
+
+  static bool TryWriteQueuedMessages(FileLogWriter* writer) {
+    return writer->WriteQueuedMessages(false);
+  }
+
+  static HANDLE GetLogFileMutex(FileLogWriter* writer) {
+    return writer->log_file_mutex_;
+  }
+
+  static void OutputMessages(FileLogWriter* writer, int first, int count) {
+    for (int i = first; i < first + count; ++i) {
+      CString msg;
+      SafeCStringFormat(&msg, _T("message %d"), i);
+      OutputInfo info(LC_LOGGING, L1, _T("[prefix]"), msg);
+      writer->OutputMessage(&info);
+    }
+  }
+
+  // Returns the messages |first| to |first| + |count| - 1 as written to a
+  // wide log file, after its BOM.
+  static CString ExpectedMessages(int first, int count) {
+    CString expected;
+    for (int i = first; i < first + count; ++i) {
+      SafeCStringAppendFormat(&expected, _T("[prefix]message %d\r\n"), i);
+    }
+    return expected;
+  }
+
+  CString ReadLogFile() {
+    std::vector<byte> buffer;
+    EXPECT_SUCCEEDED(ReadEntireFileShareMode(file_name_,
+                                             0,
+                                             FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                             &buffer));
+    if (buffer.size() < sizeof(kUnicodeBom)) {
+      return CString();
+    }
+    return CString(reinterpret_cast<const wchar_t*>(&buffer[0]) + 1,
+                   static_cast<int>(buffer.size() / sizeof(wchar_t) - 1));
+  }
+
+  CString file_name_;
 };
 
 class HistoryTest : public testing::Test {
@@ -101,6 +225,153 @@ TEST_F(FileLogWriterTest, FindInMultiString) {
   EXPECT_EQ(FindFirstInMultiString(s11, arraysize(s11), _T("a")), -1);
 }
 
+TEST_F(FileLogWriterTest, Async_Flush) {
+  FileLogWriter* writer = CreateAsyncWriter();
+  OutputMessages(writer, 0, 1000);
+  writer->Flush();
+  EXPECT_STREQ(ExpectedMessages(0, 1000), ReadLogFile());
+
+  OutputMessages(writer, 1000, 10);
+  writer->Flush();
+  EXPECT_STREQ(ExpectedMessages(0, 1010), ReadLogFile());
+  DeleteWriter(writer);
+}
+
+// A flush from the thread which was writing the queued messages returns
+// without writing them.
+TEST_F(FileLogWriterTest, Async_Flush_WritingThread) {
+  FileLogWriter* writer = CreateAsyncWriter();
+  OutputMessages(writer, 0, 1);
+  writer->Flush();
+
+  BeginWritingQueuedMessages(writer);
+  OutputMessages(writer, 1, 10);
+  writer->Flush();
+  EXPECT_STREQ(ExpectedMessages(0, 1), ReadLogFile());
+  EndWritingQueuedMessages(writer);
+
+  writer->Flush();
+  EXPECT_STREQ(ExpectedMessages(0, 11), ReadLogFile());
+  DeleteWriter(writer);
+}
+
+namespace {
+
+struct MutexHolder {
+  HANDLE mutex;
+  HANDLE locked_event;
+  HANDLE release_event;
+};
+
+// Holds the mutex of |param|, a MutexHolder, until its release event is
+// signaled.
+DWORD WINAPI HoldMutex(void* param) {
+  MutexHolder* holder = static_cast<MutexHolder*>(param);
+  EXPECT_EQ(WAIT_OBJECT_0, ::WaitForSingleObject(holder->mutex, INFINITE));
+  EXPECT_TRUE(::SetEvent(holder->locked_event));
+  ::WaitForSingleObject(holder->release_event, INFINITE);
+  EXPECT_TRUE(::ReleaseMutex(holder->mutex));
+  return 0;
+}
+
+}  // namespace
+
+// The queued messages are kept when the logging mutex is held by another
+// thread, and written by the next flush.
+TEST_F(FileLogWriterTest, Async_Flush_MutexHeld) {
+  FileLogWriter* writer = CreateAsyncWriter();
+  OutputMessages(writer, 0, 1);
+  writer->Flush();
+
+  scoped_event locked_event(::CreateEvent(NULL, true, false, NULL));
+  scoped_event release_event(::CreateEvent(NULL, true, false, NULL));
+  ASSERT_TRUE(valid(locked_event));
+  ASSERT_TRUE(valid(release_event));
+  MutexHolder holder = {GetLogFileMutex(writer),
+                        get(locked_event),
+                        get(release_event)};
+  scoped_handle thread(::CreateThread(NULL, 0, &HoldMutex, &holder, 0, NULL));
+  ASSERT_TRUE(valid(thread));
+  EXPECT_EQ(WAIT_OBJECT_0, ::WaitForSingleObject(get(locked_event), INFINITE));
+
+  OutputMessages(writer, 1, 100);
+  EXPECT_FALSE(TryWriteQueuedMessages(writer));
+
+  EXPECT_TRUE(::SetEvent(get(release_event)));
+  EXPECT_EQ(WAIT_OBJECT_0, ::WaitForSingleObject(get(thread), INFINITE));
+
+  writer->Flush();
+  EXPECT_STREQ(ExpectedMessages(0, 101), ReadLogFile());
+  DeleteWriter(writer);
+}
+
+// The messages still queued are written when the writer is destroyed.
+TEST_F(FileLogWriterTest, Async_Destroy) {
+  FileLogWriter* writer = CreateAsyncWriter();
+  OutputMessages(writer, 0, 1000);
+  DeleteWriter(writer);
+  EXPECT_STREQ(ExpectedMessages(0, 1000), ReadLogFile());
+}
+
+// The messages which do not fit in the ring buffer are dropped, and counted
+// in the log.
+TEST_F(FileLogWriterTest, Async_Drop) {
+  FileLogWriter* writer = CreateAsyncWriter();
+
+  // A message larger than a quarter of the ring buffer is always dropped.
+  CString large_msg(_T('x'), kLogRingBufferSize / 4 / sizeof(wchar_t));
+  OutputInfo info(LC_LOGGING, L1, _T(""), large_msg);
+  writer->OutputMessage(&info);
+  OutputMessages(writer, 0, 1);
+  writer->Flush();
+
+  const CString log = ReadLogFile();
+  EXPECT_NE(-1, log.Find(_T("1 log messages dropped\r\n")));
+  EXPECT_EQ(0, log.Find(_T("LOG_SYSTEM")));
+  EXPECT_EQ(log.GetLength() - ExpectedMessages(0, 1).GetLength(),
+            log.Find(ExpectedMessages(0, 1)));
+  DeleteWriter(writer);
+}
+
+// In binary mode, the messages formatted by the process are written as text
+// records, and the binary messages as the id of their log statement and their
+// arguments, after the format string of the statement.
+TEST_F(FileLogWriterTest, Binary) {
+  FileLogWriter* writer = FileLogWriter::CreateBinary(file_name_, false);
+  OutputMessages(writer, 0, 1);
+
+  uint8 args[64] = {0};
+  BinaryLogEncoder encoder(args, sizeof(args));
+  encoder.PutIntArg(7, sizeof(int));
+  const wchar_t text[] = L"abc";
+  encoder.PutStringArg(reinterpret_cast<const uint16*>(text),
+                       arraysize(text) - 1);
+  LogCallSite site = {0};
+  const BinaryLogMessage message = {
+    LC_LOGGING, L1, &site, L"[value %d %s]", 0, args, encoder.size()
+  };
+  EXPECT_TRUE(writer->OutputBinaryMessage(&message));
+  EXPECT_TRUE(writer->OutputBinaryMessage(&message));
+  EXPECT_NE(0, site.id);
+  DeleteWriter(writer);
+
+  std::vector<byte> buffer;
+  ASSERT_SUCCEEDED(ReadEntireFileShareMode(file_name_,
+                                           0,
+                                           FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                           &buffer));
+  ASSERT_FALSE(buffer.empty());
+  std::string log;
+  BinaryLogDecoder decoder;
+  EXPECT_TRUE(decoder.Decode(&buffer[0], buffer.size(), &log));
+
+  const std::string message_line("[value 7 abc]\r\n");
+  const size_t first = log.find(message_line);
+  ASSERT_NE(std::string::npos, first);
+  EXPECT_NE(std::string::npos, log.find(message_line, first + 1));
+  EXPECT_EQ(0u, log.find("[prefix]message 0\r\n"));
+}
+
 TEST_F(HistoryTest, GetHistory) {
   EXPECT_TRUE(GetHistory().IsEmpty());
 
@@ -0,0 +1,119 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/base/payload_manifest.h"
+
+namespace omaha {
+
+namespace {
+
+const char kHexDigits[] = "0123456789abcdef";
+
+// Two hex digits per byte of the digest, then two spaces.
+const size_t kNameOffset = 2 * kPayloadManifestDigestSize + 2;
+
+int HexDigitValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+bool ParseDigest(const char* hex, uint8* digest) {
+  for (size_t i = 0; i != kPayloadManifestDigestSize; ++i) {
+    const int high = HexDigitValue(hex[2 * i]);
+    const int low = HexDigitValue(hex[2 * i + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    digest[i] = static_cast<uint8>((high << 4) | low);
+  }
+  return true;
+}
+
+}  // namespace
+
+PayloadManifest::PayloadManifest() {
+}
+
+PayloadManifest::~PayloadManifest() {
+}
+
+bool PayloadManifest::Parse(const char* data, size_t size) {
+  files_.RemoveAll();
+  if (!data || size > kMaxPayloadManifestSize) {
+    return false;
+  }
+
+  const char* const end = data + size;
+  for (const char* line = data; line != end;) {
+    const char* line_end = line;
+    while (line_end != end && *line_end != '\n') {
+      ++line_end;
+    }
+    const char* next_line = line_end == end ? end : line_end + 1;
+    if (line_end != line && line_end[-1] == '\r') {
+      --line_end;
+    }
+
+    const size_t length = static_cast<size_t>(line_end - line);
+    Entry entry = {};
+    if (length <= kNameOffset ||
+        !ParseDigest(line, entry.digest) ||
+        line[kNameOffset - 2] != ' ' ||
+        line[kNameOffset - 1] != ' ') {
+      files_.RemoveAll();
+      return false;
+    }
+    entry.name = CString(CStringA(line + kNameOffset,
+                                  static_cast<int>(length - kNameOffset)));
+    if (FindDigest(entry.name) || !files_.Add(entry)) {
+      files_.RemoveAll();
+      return false;
+    }
+
+    line = next_line;
+  }
+  return files_.GetSize() != 0;
+}
+
+const uint8* PayloadManifest::FindDigest(const TCHAR* name) const {
+  for (int i = 0; i != files_.GetSize(); ++i) {
+    if (!files_[i].name.CompareNoCase(name)) {
+      return files_[i].digest;
+    }
+  }
+  return NULL;
+}
+
+void PayloadManifest::AppendFile(const CString& name,
+                                 const uint8* digest,
+                                 CStringA* manifest) {
+  for (size_t i = 0; i != kPayloadManifestDigestSize; ++i) {
+    manifest->AppendChar(kHexDigits[digest[i] >> 4]);
+    manifest->AppendChar(kHexDigits[digest[i] & 0xf]);
+  }
+  manifest->Append("  ");
+  manifest->Append(CStringA(name));
+  manifest->AppendChar('\n');
+}
+
+}  // namespace omaha
@@ -0,0 +1,84 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// The SHA-256 digests of the files in the metainstaller payload.
+//
+// payload_packer.exe writes the manifest as the first member of the tarball.
+// The metainstaller checks each file against it as the file is extracted, and
+// leaves it next to the files, where setup reads it so that it does not have
+// to hash the files it copies once more. The manifest is in the format of
+// sha256sum, so it can be checked by hand:
+//
+//   <64 hex digits of the digest><two spaces><file name>\n
+//
+// The metainstaller builds this file too, so it only depends on ATL.
+
+#ifndef OMAHA_BASE_PAYLOAD_MANIFEST_H_
+#define OMAHA_BASE_PAYLOAD_MANIFEST_H_
+
+#include <windows.h>
+#include <atlsimpcoll.h>
+#include <atlstr.h>
+
+#pragma warning(push)
+// C4310: cast truncates constant value
+#pragma warning(disable : 4310)
+#include "base/basictypes.h"
+#pragma warning(pop)
+
+namespace omaha {
+
+const TCHAR* const kPayloadManifestFileName = _T("payload.sha256");
+
+const size_t kPayloadManifestDigestSize = 32;
+
+// Manifests larger than this are rejected. A line takes less than 200 bytes.
+const size_t kMaxPayloadManifestSize = 64 * 1024;
+
+class PayloadManifest {
+ public:
+  PayloadManifest();
+  ~PayloadManifest();
+
+  // Reads the manifest in the |size| bytes of |data|. Returns false if the
+  // manifest is empty or malformed, or lists a file twice, in which case the
+  // manifest is left empty.
+  bool Parse(const char* data, size_t size);
+
+  // Returns the digest of the file |name|, compared without case, or NULL if
+  // the file is not in the manifest.
+  const uint8* FindDigest(const TCHAR* name) const;
+
+  int num_files() const { return files_.GetSize(); }
+
+  // Appends the line for the file |name| with |digest| to |manifest|.
+  static void AppendFile(const CString& name,
+                         const uint8* digest,
+                         CStringA* manifest);
+
+ private:
+  struct Entry {
+    CString name;
+    uint8 digest[kPayloadManifestDigestSize];
+  };
+
+  CSimpleArray<Entry> files_;
+
+  DISALLOW_COPY_AND_ASSIGN(PayloadManifest);
+};
+
+}  // namespace omaha
+
+#endif  // OMAHA_BASE_PAYLOAD_MANIFEST_H_
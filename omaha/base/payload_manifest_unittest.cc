@@ -0,0 +1,143 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/base/payload_manifest.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "omaha/testing/unit_test.h"
+
+namespace omaha {
+
+namespace {
+
+const char kManifest[] =
+    "00070e151c232a31383f464d545b626970777e858c939aa1a8afb6bdc4cbd2d9"
+    "  GoogleUpdate.exe\n"
+    "FFFEFDFCFBFAF9F8F7F6F5F4F3F2F1F0EFEEEDECEBEAE9E8E7E6E5E4E3E2E1E0"
+    "  psuser.dll\n";
+
+bool Parse(const std::string& data, PayloadManifest* manifest) {
+  return manifest->Parse(data.data(), data.size());
+}
+
+}  // namespace
+
+TEST(PayloadManifestTest, Parse) {
+  PayloadManifest manifest;
+  ASSERT_TRUE(Parse(kManifest, &manifest));
+  EXPECT_EQ(2, manifest.num_files());
+
+  const uint8* digest = manifest.FindDigest(_T("googleupdate.EXE"));
+  ASSERT_TRUE(digest != NULL);
+  for (size_t i = 0; i != kPayloadManifestDigestSize; ++i) {
+    EXPECT_EQ(i * 7, digest[i]);
+  }
+
+  digest = manifest.FindDigest(_T("psuser.dll"));
+  ASSERT_TRUE(digest != NULL);
+  for (size_t i = 0; i != kPayloadManifestDigestSize; ++i) {
+    EXPECT_EQ(255 - i, digest[i]);
+  }
+
+  EXPECT_TRUE(manifest.FindDigest(_T("psmachine.dll")) == NULL);
+}
+
+TEST(PayloadManifestTest, Parse_LineEndings) {
+  std::string data(kManifest);
+  data.insert(data.find('\n'), "\r");
+  data.resize(data.size() - 1);
+
+  PayloadManifest manifest;
+  ASSERT_TRUE(Parse(data, &manifest));
+  EXPECT_EQ(2, manifest.num_files());
+  EXPECT_TRUE(manifest.FindDigest(_T("GoogleUpdate.exe")) != NULL);
+  EXPECT_TRUE(manifest.FindDigest(_T("psuser.dll")) != NULL);
+}
+
+TEST(PayloadManifestTest, Parse_Malformed) {
+  const std::string good(kManifest);
+  const size_t first_line_size = good.find('\n') + 1;
+
+  std::string bad_digit(good);
+  bad_digit[3] = 'g';
+  std::string one_space(good);
+  one_space[65] = 'x';
+
+  std::string too_large;
+  for (int i = 0; too_large.size() <= kMaxPayloadManifestSize; ++i) {
+    char name[32] = {};
+    sprintf_s(name, arraysize(name), "file%d.dat\n", i);
+    too_large += good.substr(0, 66) + name;
+  }
+
+  const std::string kBadManifests[] = {
+    std::string(),
+    "\n",
+    good + "\n",
+    good.substr(0, 66),
+    bad_digit,
+    one_space,
+    good + good.substr(0, first_line_size),
+    too_large,
+  };
+  for (size_t i = 0; i != arraysize(kBadManifests); ++i) {
+    PayloadManifest manifest;
+    EXPECT_FALSE(Parse(kBadManifests[i], &manifest)) << i;
+    EXPECT_EQ(0, manifest.num_files()) << i;
+  }
+
+  // A failed parse leaves the manifest empty.
+  PayloadManifest manifest;
+  ASSERT_TRUE(Parse(good, &manifest));
+  EXPECT_FALSE(Parse(bad_digit, &manifest));
+  EXPECT_EQ(0, manifest.num_files());
+  EXPECT_TRUE(manifest.FindDigest(_T("GoogleUpdate.exe")) == NULL);
+}
+
+TEST(PayloadManifestTest, AppendFile) {
+  uint8 first[kPayloadManifestDigestSize] = {};
+  uint8 second[kPayloadManifestDigestSize] = {};
+  for (size_t i = 0; i != kPayloadManifestDigestSize; ++i) {
+    first[i] = static_cast<uint8>(i * 7);
+    second[i] = static_cast<uint8>(255 - i);
+  }
+
+  CStringA data;
+  PayloadManifest::AppendFile(_T("GoogleUpdate.exe"), first, &data);
+  PayloadManifest::AppendFile(_T("psuser.dll"), second, &data);
+
+  // The digests are written in lower case.
+  std::string expected(kManifest);
+  for (size_t i = 0; i != expected.size(); ++i) {
+    if (expected[i] >= 'A' && expected[i] <= 'F') {
+      expected[i] = static_cast<char>(expected[i] - 'A' + 'a');
+    }
+  }
+  EXPECT_STREQ(expected.c_str(), data);
+
+  PayloadManifest manifest;
+  ASSERT_TRUE(manifest.Parse(data, data.GetLength()));
+  EXPECT_EQ(0, memcmp(first,
+                      manifest.FindDigest(_T("GoogleUpdate.exe")),
+                      sizeof(first)));
+  EXPECT_EQ(0, memcmp(second,
+                      manifest.FindDigest(_T("psuser.dll")),
+                      sizeof(second)));
+}
+
+}  // namespace omaha
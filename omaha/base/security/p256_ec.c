@@ -1278,3 +1278,166 @@ void p256_points_mul_vartime(
   from_montgomery(out_x, px);
   from_montgomery(out_y, py);
 }
+
+/* point_add_mixed_vartime sets {x_out,y_out,z_out} = {x1,y1,z1} + {x2,y2,1}.
+ *
+ * Unlike point_add_mixed, this function handles infinity+P, P+P and P+(-P).
+ * The point at infinity is any point with z == 0. The output may alias the
+ * first input. As indicated by the name, it operates in variable time. */
+static void point_add_mixed_vartime(felem x_out, felem y_out, felem z_out,
+                                    const felem x1, const felem y1,
+                                    const felem z1, const felem x2,
+                                    const felem y2) {
+  felem z1z1, z1z1z1, s2, u2, h, i, j, r, rr, v, tmp, y1j;
+
+  if (felem_is_zero_vartime(z1)) {
+    felem_assign(x_out, x2);
+    felem_assign(y_out, y2);
+    felem_assign(z_out, kOne);
+    return;
+  }
+
+  felem_square(z1z1, z1);
+  felem_sum(tmp, z1, z1);
+
+  felem_mul(u2, x2, z1z1);
+  felem_mul(z1z1z1, z1, z1z1);
+  felem_mul(s2, y2, z1z1z1);
+  felem_diff(h, u2, x1);
+  felem_diff(r, s2, y1);
+  if (felem_is_zero_vartime(h)) {
+    if (felem_is_zero_vartime(r)) {
+      point_double(x_out, y_out, z_out, x2, y2, kOne);
+    } else {
+      memset(x_out, 0, sizeof(felem));
+      memset(y_out, 0, sizeof(felem));
+      memset(z_out, 0, sizeof(felem));
+    }
+    return;
+  }
+  felem_sum(i, h, h);
+  felem_square(i, i);
+  felem_mul(j, h, i);
+  felem_sum(r, r, r);
+  felem_mul(v, x1, i);
+  felem_mul(y1j, y1, j);
+
+  felem_mul(z_out, tmp, h);
+  felem_square(rr, r);
+  felem_diff(x_out, rr, j);
+  felem_diff(x_out, x_out, v);
+  felem_diff(x_out, x_out, v);
+
+  felem_diff(tmp, v, x_out);
+  felem_mul(y_out, tmp, r);
+  felem_diff(y_out, y_out, y1j);
+  felem_diff(y_out, y_out, y1j);
+}
+
+/* p256_precomp must be able to hold a table laid out like kPrecomputed. */
+typedef char p256_precomp_size_check[
+    sizeof(((p256_precomp*)0)->limbs) == sizeof(kPrecomputed) ? 1 : -1];
+
+/* p256_precomp_init fills |precomp| with the same multiples of {in_x,in_y}
+ * that kPrecomputed holds for G. {in_x,in_y} must be a valid point; the
+ * table is public data, so this operates in variable time. */
+void p256_precomp_init(const p256_int* in_x, const p256_int* in_y,
+                       p256_precomp* precomp) {
+  /* {x[k],y[k],z[k]} = 2**(32k) * {in_x,in_y}. */
+  felem x[8], y[8], z[8];
+  felem sx, sy, sz;
+  limb* table = precomp->limbs;
+  int i, j, k, bit, is_infinity;
+
+  to_montgomery(x[0], in_x);
+  to_montgomery(y[0], in_y);
+  felem_assign(z[0], kOne);
+
+  for (k = 1; k < 8; k++) {
+    point_double(x[k], y[k], z[k], x[k - 1], y[k - 1], z[k - 1]);
+    for (i = 1; i < 32; i++) {
+      point_double(x[k], y[k], z[k], x[k], y[k], z[k]);
+    }
+  }
+
+  for (j = 0; j < 2; j++) {
+    for (i = 1; i < 16; i++) {
+      is_infinity = 1;
+      for (bit = 0; bit < 4; bit++) {
+        if (!(i & (1 << bit))) {
+          continue;
+        }
+        k = 2 * bit + j;
+        if (is_infinity) {
+          felem_assign(sx, x[k]);
+          felem_assign(sy, y[k]);
+          felem_assign(sz, z[k]);
+          is_infinity = 0;
+        } else {
+          point_add_or_double_vartime(sx, sy, sz, sx, sy, sz,
+                                      x[k], y[k], z[k]);
+        }
+      }
+
+      point_to_affine(table, table + NLIMBS, sx, sy, sz);
+      table += 2 * NLIMBS;
+    }
+  }
+}
+
+/* p256_points_mul_precomp_vartime sets {out_x,out_y} = n1*G + n2*P, where P
+ * is the point |precomp| was built for and n1 and n2 are < the order of the
+ * group.
+ *
+ * Both scalars are processed together by the comb method of scalar_base_mult,
+ * so the 31 doublings are shared and the table lookups are direct. It
+ * computes the same result as p256_points_mul_vartime in about half the time,
+ * and, like it, must only be used with public values. */
+void p256_points_mul_precomp_vartime(
+    const p256_int* n1, const p256_int* n2, const p256_precomp* precomp,
+    p256_int* out_x, p256_int* out_y) {
+  const limb* tables[2];
+  const p256_int* scalars[2];
+  felem nx, ny, nz, px, py;
+  int i, j, t, is_infinity = 1;
+
+  tables[0] = kPrecomputed;
+  tables[1] = precomp->limbs;
+  scalars[0] = n1;
+  scalars[1] = n2;
+
+  memset(nx, 0, sizeof(felem));
+  memset(ny, 0, sizeof(felem));
+  memset(nz, 0, sizeof(felem));
+
+  for (i = 0; i < 32; i++) {
+    if (!is_infinity) {
+      point_double(nx, ny, nz, nx, ny, nz);
+    }
+    for (j = 0; j <= 32; j += 32) {
+      for (t = 0; t < 2; t++) {
+        const p256_int* scalar = scalars[t];
+        limb index = p256_get_bit(scalar, 31 - i + j) |
+                     (p256_get_bit(scalar, 95 - i + j) << 1) |
+                     (p256_get_bit(scalar, 159 - i + j) << 2) |
+                     (p256_get_bit(scalar, 223 - i + j) << 3);
+        const limb* entry;
+
+        if (!index) {
+          continue;
+        }
+        entry = tables[t] + (j ? 15 * 2 * NLIMBS : 0) +
+                (index - 1) * 2 * NLIMBS;
+        point_add_mixed_vartime(nx, ny, nz, nx, ny, nz,
+                                entry, entry + NLIMBS);
+        is_infinity = 0;
+      }
+    }
+  }
+
+  /* A zero z, from both scalars being zero or from the two products
+   * cancelling, yields {0,0} here, as it does in p256_points_mul_vartime. */
+  point_to_affine(px, py, nx, ny, nz);
+  from_montgomery(out_x, px);
+  from_montgomery(out_y, py);
+}
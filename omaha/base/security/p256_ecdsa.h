@@ -43,6 +43,17 @@ int p256_ecdsa_verify(const p256_int* key_x,
                       const p256_int* message,
                       const p256_int* r, const p256_int* s);
 
+// Same as p256_ecdsa_verify() for a public key whose multiples were
+// precomputed with p256_precomp_init(). The key must have been checked with
+// p256_is_valid_point() before building the table.
+//
+// Verification only handles public data and runs in variable time. Signing
+// and key generation keep using the constant-time p256_base_point_mul() and
+// p256_modinv(); do not route secrets through the *_vartime functions.
+int p256_ecdsa_verify_precomp(const p256_precomp* key,
+                              const p256_int* message,
+                              const p256_int* r, const p256_int* s);
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,6 +23,7 @@
 #include "p256.h"
 #include "p256_ecdsa.h"
 #include "p256_prng.h"
+#include "omaha/base/highres_timer-win32.h"
 #include "omaha/testing/unit_test.h"
 
 
@@ -110,3 +111,162 @@ TEST(P256_ECDSA, InvalidSigsTest) {
   }
 }
 
+namespace {
+
+// Picks a well distributed random number 0 < a < n.
+void DrawScalar(P256_PRNG_CTX* prng, p256_int* a) {
+  uint8_t tmp[P256_PRNG_SIZE];
+  do {
+    p256_int p1, p2;
+    p256_prng_draw(prng, tmp);
+    p256_from_bin(tmp, &p1);
+    p256_prng_draw(prng, tmp);
+    p256_from_bin(tmp, &p2);
+    p256_modmul(&SECP256r1_n, &p1, 0, &p2, a);
+  } while (p256_is_zero(a));
+}
+
+void ExpectSamePoint(const p256_int& x1, const p256_int& y1,
+                     const p256_int& x2, const p256_int& y2) {
+  EXPECT_EQ(0, p256_cmp(&x1, &x2));
+  EXPECT_EQ(0, p256_cmp(&y1, &y2));
+}
+
+}  // namespace
+
+// The precomputed path must agree with p256_points_mul_vartime, including
+// when either scalar is zero.
+TEST(P256_ECDSA, PointsMulPrecompMatchesVartime) {
+  P256_PRNG_CTX prng;
+  uint32_t boot_count = static_cast<uint32_t>(time(NULL));
+
+  p256_prng_init(&prng, "points_mul_precomp_test", 23, boot_count);
+
+  for (int n = 0; n < 50; ++n) {
+    p256_int key, Gx, Gy, n1, n2;
+    p256_int x1, y1, x2, y2;
+    p256_precomp precomp;
+
+    DrawScalar(&prng, &key);
+    p256_base_point_mul(&key, &Gx, &Gy);
+    p256_precomp_init(&Gx, &Gy, &precomp);
+
+    DrawScalar(&prng, &n1);
+    DrawScalar(&prng, &n2);
+    if (n % 5 == 1) {
+      p256_init(&n1);
+    }
+    if (n % 5 == 2) {
+      p256_init(&n2);
+    }
+    if (n % 5 == 3) {
+      p256_init(&n1);
+      p256_init(&n2);
+    }
+
+    p256_points_mul_vartime(&n1, &n2, &Gx, &Gy, &x1, &y1);
+    p256_points_mul_precomp_vartime(&n1, &n2, &precomp, &x2, &y2);
+    ExpectSamePoint(x1, y1, x2, y2);
+  }
+}
+
+// With a table built for G itself, n1G + n1G needs a doubling and
+// n1G + (n - n1)G is the point at infinity.
+TEST(P256_ECDSA, PointsMulPrecompBasePoint) {
+  P256_PRNG_CTX prng;
+  uint32_t boot_count = static_cast<uint32_t>(time(NULL));
+  p256_int one = P256_ONE;
+  p256_int Gx, Gy, n1, n2;
+  p256_int x1, y1, x2, y2;
+  p256_precomp precomp;
+
+  p256_prng_init(&prng, "points_mul_precomp_base_test", 28, boot_count);
+
+  p256_base_point_mul(&one, &Gx, &Gy);
+  p256_precomp_init(&Gx, &Gy, &precomp);
+  DrawScalar(&prng, &n1);
+
+  p256_points_mul_vartime(&n1, &n1, &Gx, &Gy, &x1, &y1);
+  p256_points_mul_precomp_vartime(&n1, &n1, &precomp, &x2, &y2);
+  ExpectSamePoint(x1, y1, x2, y2);
+
+  p256_sub(&SECP256r1_n, &n1, &n2);
+  p256_points_mul_precomp_vartime(&n1, &n2, &precomp, &x2, &y2);
+  EXPECT_TRUE(p256_is_zero(&x2));
+  EXPECT_TRUE(p256_is_zero(&y2));
+}
+
+TEST(P256_ECDSA, VerifyPrecomp) {
+  P256_PRNG_CTX prng;
+  uint8_t tmp[P256_PRNG_SIZE];
+  uint32_t boot_count = static_cast<uint32_t>(time(NULL));
+
+  p256_prng_init(&prng, "verify_precomp_test", 19, boot_count);
+
+  for (int n = 0; n < 20; ++n) {
+    p256_int a, b, Gx, Gy;
+    p256_int r, s;
+    p256_int zero = P256_ZERO;
+    p256_precomp precomp;
+
+    DrawScalar(&prng, &a);
+    p256_base_point_mul(&a, &Gx, &Gy);
+    p256_precomp_init(&Gx, &Gy, &precomp);
+
+    p256_prng_draw(&prng, tmp);
+    p256_from_bin(tmp, &b);
+    p256_ecdsa_sign(&a, &b, &r, &s);
+
+    EXPECT_TRUE(p256_ecdsa_verify_precomp(&precomp, &b, &r, &s));
+    EXPECT_FALSE(p256_ecdsa_verify_precomp(&precomp, &b, &s, &r));
+    EXPECT_FALSE(p256_ecdsa_verify_precomp(&precomp, &b, &zero, &s));
+    EXPECT_FALSE(p256_ecdsa_verify_precomp(&precomp, &b, &r, &zero));
+
+    p256_add_d(&b, 1, &b);
+    EXPECT_FALSE(p256_ecdsa_verify_precomp(&precomp, &b, &r, &s));
+  }
+}
+
+// Reports verifications per second with and without a precomputed key table.
+TEST(P256_ECDSA, DISABLED_VerifyThroughput) {
+  const int kIterations = 1000;
+  P256_PRNG_CTX prng;
+  uint8_t tmp[P256_PRNG_SIZE];
+  p256_int a, b, Gx, Gy;
+  p256_int r, s;
+  p256_precomp precomp;
+
+  p256_prng_init(&prng, "verify_throughput", 17, 0);
+  DrawScalar(&prng, &a);
+  p256_base_point_mul(&a, &Gx, &Gy);
+  p256_prng_draw(&prng, tmp);
+  p256_from_bin(tmp, &b);
+  p256_ecdsa_sign(&a, &b, &r, &s);
+
+  const double frequency =
+      static_cast<double>(omaha::HighresTimer::GetTimerFrequency());
+
+  ULONGLONG start = omaha::HighresTimer::GetCurrentTicks();
+  for (int i = 0; i < kIterations; ++i) {
+    ASSERT_TRUE(p256_ecdsa_verify(&Gx, &Gy, &b, &r, &s));
+  }
+  const double plain_seconds =
+      (omaha::HighresTimer::GetCurrentTicks() - start) / frequency;
+
+  start = omaha::HighresTimer::GetCurrentTicks();
+  p256_precomp_init(&Gx, &Gy, &precomp);
+  const double init_seconds =
+      (omaha::HighresTimer::GetCurrentTicks() - start) / frequency;
+
+  start = omaha::HighresTimer::GetCurrentTicks();
+  for (int i = 0; i < kIterations; ++i) {
+    ASSERT_TRUE(p256_ecdsa_verify_precomp(&precomp, &b, &r, &s));
+  }
+  const double precomp_seconds =
+      (omaha::HighresTimer::GetCurrentTicks() - start) / frequency;
+
+  printf("p256_ecdsa_verify         %8.0f verifies/s\n",
+         kIterations / plain_seconds);
+  printf("p256_ecdsa_verify_precomp %8.0f verifies/s (table %.2f ms)\n",
+         kIterations / precomp_seconds, init_seconds * 1000);
+}
@@ -0,0 +1,80 @@
+// Copyright 2013 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Block functions shared by the SHA-256 implementations. Each function
+// consumes |num_blocks| consecutive 64-byte blocks from |data| and updates
+// |state| in place. The portable implementation is always available; the
+// accelerated ones are only compiled for the matching architecture and must
+// only be called after the corresponding CPU feature has been detected.
+
+#ifndef OMAHA_BASE_SECURITY_SHA256_INTERNAL_H_
+#define OMAHA_BASE_SECURITY_SHA256_INTERNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || \
+    defined(__i386__) || defined(__x86_64__)
+#define SHA256_ARCH_X86 1
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define SHA256_ARCH_ARM64 1
+#endif
+
+// MSVC allows the use of any intrinsic in any function. GCC and clang need
+// the instruction set to be enabled on each function which uses it.
+#if defined(__GNUC__) || defined(__clang__)
+#define SHA256_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SHA256_TARGET(isa)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+typedef void (*SHA256_BLOCKS_FN)(uint32_t state[8],
+                                 const uint8_t* data,
+                                 size_t num_blocks);
+
+// The round constants, in the order they are consumed.
+extern const uint32_t SHA256_K[64];
+
+void SHA256_blocks_generic(uint32_t state[8],
+                           const uint8_t* data,
+                           size_t num_blocks);
+
+#if defined(SHA256_ARCH_X86)
+void SHA256_blocks_ssse3(uint32_t state[8],
+                         const uint8_t* data,
+                         size_t num_blocks);
+void SHA256_blocks_avx2(uint32_t state[8],
+                        const uint8_t* data,
+                        size_t num_blocks);
+void SHA256_blocks_shani(uint32_t state[8],
+                         const uint8_t* data,
+                         size_t num_blocks);
+#endif  // SHA256_ARCH_X86
+
+#if defined(SHA256_ARCH_ARM64)
+void SHA256_blocks_armv8(uint32_t state[8],
+                         const uint8_t* data,
+                         size_t num_blocks);
+#endif  // SHA256_ARCH_ARM64
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#endif  // OMAHA_BASE_SECURITY_SHA256_INTERNAL_H_
@@ -13,17 +13,35 @@
 // limitations under the License.
 // ========================================================================
 //
-// Optimized for minimal code size.
+// The portable block function is optimized for minimal code size. Faster
+// block functions for CPUs with SIMD or SHA instructions are in sha256_x86.c
+// and sha256_armv8.c; the best one is picked at runtime.
 
 #include "sha256.h"
+#include "sha256-internal.h"
 
 #include <stdint.h>
 #include <string.h>
 
+#if defined(SHA256_ARCH_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(SHA256_ARCH_ARM64)
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
 #define ror(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
 #define shr(value, bits) ((value) >> (bits))
 
-static const uint32_t K[64] = {
+const uint32_t SHA256_K[64] = {
   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
   0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
   0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
@@ -41,61 +59,276 @@ static const uint32_t K[64] = {
   0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
   0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
 
-static void SHA256_Transform(LITE_SHA256_CTX* ctx) {
+void SHA256_blocks_generic(uint32_t state[8],
+                           const uint8_t* data,
+                           size_t num_blocks) {
   uint32_t W[64];
   uint32_t A, B, C, D, E, F, G, H;
-  uint8_t* p = ctx->buf;
+  const uint8_t* p = data;
   int t;
 
-  for(t = 0; t < 16; ++t) {
-    uint32_t tmp =  (uint32_t)*p++ << 24;
-    tmp |= (uint32_t)*p++ << 16;
-    tmp |= (uint32_t)*p++ << 8;
-    tmp |= (uint32_t)*p++;
-    W[t] = tmp;
-  }
-
-  for(; t < 64; t++) {
-    uint32_t s0 = ror(W[t-15], 7) ^ ror(W[t-15], 18) ^ shr(W[t-15], 3);
-    uint32_t s1 = ror(W[t-2], 17) ^ ror(W[t-2], 19) ^ shr(W[t-2], 10);
-    W[t] = W[t-16] + s0 + W[t-7] + s1;
-  }
-
-  A = ctx->state[0];
-  B = ctx->state[1];
-  C = ctx->state[2];
-  D = ctx->state[3];
-  E = ctx->state[4];
-  F = ctx->state[5];
-  G = ctx->state[6];
-  H = ctx->state[7];
-
-  for(t = 0; t < 64; t++) {
-    uint32_t s0 = ror(A, 2) ^ ror(A, 13) ^ ror(A, 22);
-    uint32_t maj = (A & B) ^ (A & C) ^ (B & C);
-    uint32_t t2 = s0 + maj;
-    uint32_t s1 = ror(E, 6) ^ ror(E, 11) ^ ror(E, 25);
-    uint32_t ch = (E & F) ^ ((~E) & G);
-    uint32_t t1 = H + s1 + ch + K[t] + W[t];
-
-    H = G;
-    G = F;
-    F = E;
-    E = D + t1;
-    D = C;
-    C = B;
-    B = A;
-    A = t1 + t2;
-  }
-
-  ctx->state[0] += A;
-  ctx->state[1] += B;
-  ctx->state[2] += C;
-  ctx->state[3] += D;
-  ctx->state[4] += E;
-  ctx->state[5] += F;
-  ctx->state[6] += G;
-  ctx->state[7] += H;
+  while (num_blocks--) {
+    for(t = 0; t < 16; ++t) {
+      uint32_t tmp =  (uint32_t)*p++ << 24;
+      tmp |= (uint32_t)*p++ << 16;
+      tmp |= (uint32_t)*p++ << 8;
+      tmp |= (uint32_t)*p++;
+      W[t] = tmp;
+    }
+
+    for(; t < 64; t++) {
+      uint32_t s0 = ror(W[t-15], 7) ^ ror(W[t-15], 18) ^ shr(W[t-15], 3);
+      uint32_t s1 = ror(W[t-2], 17) ^ ror(W[t-2], 19) ^ shr(W[t-2], 10);
+      W[t] = W[t-16] + s0 + W[t-7] + s1;
+    }
+
+    A = state[0];
+    B = state[1];
+    C = state[2];
+    D = state[3];
+    E = state[4];
+    F = state[5];
+    G = state[6];
+    H = state[7];
+
+    for(t = 0; t < 64; t++) {
+      uint32_t s0 = ror(A, 2) ^ ror(A, 13) ^ ror(A, 22);
+      uint32_t maj = (A & B) ^ (A & C) ^ (B & C);
+      uint32_t t2 = s0 + maj;
+      uint32_t s1 = ror(E, 6) ^ ror(E, 11) ^ ror(E, 25);
+      uint32_t ch = (E & F) ^ ((~E) & G);
+      uint32_t t1 = H + s1 + ch + SHA256_K[t] + W[t];
+
+      H = G;
+      G = F;
+      F = E;
+      E = D + t1;
+      D = C;
+      C = B;
+      B = A;
+      A = t1 + t2;
+    }
+
+    state[0] += A;
+    state[1] += B;
+    state[2] += C;
+    state[3] += D;
+    state[4] += E;
+    state[5] += F;
+    state[6] += G;
+    state[7] += H;
+  }
+}
+
+#if defined(SHA256_ARCH_X86)
+
+#define CPUID_1_ECX_SSSE3    (1u << 9)
+#define CPUID_1_ECX_SSE41    (1u << 19)
+#define CPUID_1_ECX_OSXSAVE  (1u << 27)
+#define CPUID_1_ECX_AVX      (1u << 28)
+#define CPUID_7_EBX_AVX2     (1u << 5)
+#define CPUID_7_EBX_SHA      (1u << 29)
+
+// Fills |regs| with eax, ebx, ecx, edx for the given leaf and subleaf.
+static void SHA256_cpuid(uint32_t regs[4], uint32_t leaf, uint32_t subleaf) {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuidex(info, (int)leaf, (int)subleaf);
+  regs[0] = (uint32_t)info[0];
+  regs[1] = (uint32_t)info[1];
+  regs[2] = (uint32_t)info[2];
+  regs[3] = (uint32_t)info[3];
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Returns whether the OS saves the XMM and YMM registers on context switches.
+static int SHA256_os_saves_ymm(void) {
+#if defined(_MSC_VER)
+  return (_xgetbv(0) & 6) == 6;
+#else
+  uint32_t eax, edx;
+  __asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+  return (eax & 6) == 6;
+#endif
+}
+
+static int SHA256_cpu_supports(SHA256_IMPL impl) {
+  uint32_t leaf0[4], leaf1[4], leaf7[4] = {0, 0, 0, 0};
+
+  SHA256_cpuid(leaf0, 0, 0);
+  if (leaf0[0] < 1) {
+    return 0;
+  }
+  SHA256_cpuid(leaf1, 1, 0);
+  if (leaf0[0] >= 7) {
+    SHA256_cpuid(leaf7, 7, 0);
+  }
+
+  switch (impl) {
+    case SHA256_IMPL_SSSE3:
+      return (leaf1[2] & CPUID_1_ECX_SSSE3) != 0;
+    case SHA256_IMPL_AVX2:
+      return (leaf1[2] & CPUID_1_ECX_SSSE3) &&
+             (leaf1[2] & CPUID_1_ECX_AVX) &&
+             (leaf1[2] & CPUID_1_ECX_OSXSAVE) &&
+             (leaf7[1] & CPUID_7_EBX_AVX2) &&
+             SHA256_os_saves_ymm();
+    case SHA256_IMPL_SHANI:
+      return (leaf1[2] & CPUID_1_ECX_SSSE3) &&
+             (leaf1[2] & CPUID_1_ECX_SSE41) &&
+             (leaf7[1] & CPUID_7_EBX_SHA);
+    default:
+      return 0;
+  }
+}
+
+#elif defined(SHA256_ARCH_ARM64)
+
+static int SHA256_cpu_supports(SHA256_IMPL impl) {
+  if (impl != SHA256_IMPL_ARMV8) {
+    return 0;
+  }
+#if defined(_WIN32)
+  return IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE) !=
+         0;
+#elif defined(__linux__)
+  return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#elif defined(__APPLE__)
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+#else
+
+static int SHA256_cpu_supports(SHA256_IMPL impl) {
+  (void)impl;
+  return 0;
+}
+
+#endif
+
+static SHA256_BLOCKS_FN SHA256_impl_blocks(SHA256_IMPL impl) {
+  switch (impl) {
+#if defined(SHA256_ARCH_X86)
+    case SHA256_IMPL_SSSE3:
+      return SHA256_blocks_ssse3;
+    case SHA256_IMPL_AVX2:
+      return SHA256_blocks_avx2;
+    case SHA256_IMPL_SHANI:
+      return SHA256_blocks_shani;
+#endif
+#if defined(SHA256_ARCH_ARM64)
+    case SHA256_IMPL_ARMV8:
+      return SHA256_blocks_armv8;
+#endif
+    default:
+      return SHA256_blocks_generic;
+  }
+}
+
+// The selected implementation. Concurrent first uses may both run the
+// detection, which is harmless since they store identical values.
+static SHA256_IMPL g_sha256_impl = SHA256_IMPL_AUTO;
+static SHA256_BLOCKS_FN g_sha256_blocks = NULL;
+
+// In order of preference.
+static const SHA256_IMPL kSha256ImplPreference[] = {
+  SHA256_IMPL_SHANI,
+  SHA256_IMPL_ARMV8,
+  SHA256_IMPL_AVX2,
+  SHA256_IMPL_SSSE3,
+};
+
+static SHA256_IMPL SHA256_detect_impl(void) {
+  size_t i;
+  for (i = 0;
+       i < sizeof(kSha256ImplPreference) / sizeof(kSha256ImplPreference[0]);
+       ++i) {
+    if (SHA256_cpu_supports(kSha256ImplPreference[i])) {
+      return kSha256ImplPreference[i];
+    }
+  }
+  return SHA256_IMPL_GENERIC;
+}
+
+static SHA256_BLOCKS_FN SHA256_get_blocks(void) {
+  SHA256_BLOCKS_FN blocks = g_sha256_blocks;
+  if (!blocks) {
+    SHA256_IMPL impl = SHA256_detect_impl();
+    blocks = SHA256_impl_blocks(impl);
+    g_sha256_impl = impl;
+    g_sha256_blocks = blocks;
+  }
+  return blocks;
+}
+
+int SHA256_impl_supported(SHA256_IMPL impl) {
+  switch (impl) {
+    case SHA256_IMPL_AUTO:
+    case SHA256_IMPL_GENERIC:
+      return 1;
+    default:
+      return impl < SHA256_IMPL_COUNT && SHA256_cpu_supports(impl);
+  }
+}
+
+SHA256_IMPL SHA256_get_impl(void) {
+  SHA256_get_blocks();
+  return g_sha256_impl;
+}
+
+int SHA256_set_impl(SHA256_IMPL impl) {
+  if (!SHA256_impl_supported(impl)) {
+    return 0;
+  }
+  if (impl == SHA256_IMPL_AUTO) {
+    impl = SHA256_detect_impl();
+  }
+  g_sha256_impl = impl;
+  g_sha256_blocks = SHA256_impl_blocks(impl);
+  return 1;
+}
+
+const char* SHA256_impl_name(SHA256_IMPL impl) {
+  switch (impl) {
+    case SHA256_IMPL_AUTO:
+      return "auto";
+    case SHA256_IMPL_GENERIC:
+      return "generic";
+    case SHA256_IMPL_SSSE3:
+      return "ssse3";
+    case SHA256_IMPL_AVX2:
+      return "avx2";
+    case SHA256_IMPL_SHANI:
+      return "shani";
+    case SHA256_IMPL_ARMV8:
+      return "armv8";
+    default:
+      return "unknown";
+  }
+}
+
+static void SHA256_process(LITE_SHA256_CTX* ctx,
+                           const uint8_t* data,
+                           size_t num_blocks) {
+#ifndef SHA512_SUPPORT
+  SHA256_get_blocks()(ctx->state, data, num_blocks);
+#else
+  // The context state is 64-bit wide when SHA-512 support is compiled in.
+  uint32_t state[8];
+  int i;
+  for (i = 0; i < 8; ++i) {
+    state[i] = (uint32_t)ctx->state[i];
+  }
+  SHA256_get_blocks()(state, data, num_blocks);
+  for (i = 0; i < 8; ++i) {
+    ctx->state[i] = state[i];
+  }
+#endif
 }
 
 static const HASH_VTAB SHA256_VTAB = {
@@ -121,35 +354,50 @@ void SHA256_init(LITE_SHA256_CTX* ctx) {
 
 
 void SHA256_update(LITE_SHA256_CTX* ctx, const void* data, size_t len) {
-  int i = (int) (ctx->count & 63);
+  size_t i = (size_t) (ctx->count & 63);
   const uint8_t* p = (const uint8_t*)data;
 
   ctx->count += len;
 
-  while (len--) {
-    ctx->buf[i++] = *p++;
-    if (i == 64) {
-      SHA256_Transform(ctx);
-      i = 0;
+  if (i) {
+    size_t fill = 64 - i;
+    if (len < fill) {
+      memcpy(ctx->buf + i, p, len);
+      return;
     }
+    memcpy(ctx->buf + i, p, fill);
+    SHA256_process(ctx, ctx->buf, 1);
+    p += fill;
+    len -= fill;
+  }
+
+  // Whole blocks are hashed straight from the caller's buffer.
+  if (len >= 64) {
+    SHA256_process(ctx, p, len / 64);
+    p += len & ~(size_t)63;
+    len &= 63;
+  }
+
+  if (len) {
+    memcpy(ctx->buf, p, len);
   }
 }
 
 
 const uint8_t* SHA256_final(LITE_SHA256_CTX* ctx) {
+  static const uint8_t kPadding[64] = { 0x80 };
   uint8_t *p = ctx->buf;
   uint64_t cnt = LITE_LShiftU64(ctx->count, 3);
+  uint8_t length[8];
+  size_t used = (size_t)(ctx->count & 63);
   int i;
 
-  SHA256_update(ctx, (uint8_t*)"\x80", 1);
-  while ((ctx->count & 63) != 56) {
-    SHA256_update(ctx, (uint8_t*)"\0", 1);
-  }
+  SHA256_update(ctx, kPadding, used < 56 ? 56 - used : 120 - used);
   for (i = 0; i < 8; ++i) {
-    uint8_t tmp = (uint8_t)LITE_RShiftU64(cnt, 56);
+    length[i] = (uint8_t)LITE_RShiftU64(cnt, 56);
     cnt = LITE_LShiftU64(cnt, 8);
-    SHA256_update(ctx, &tmp, 1);
   }
+  SHA256_update(ctx, length, sizeof(length));
 
   for (i = 0; i < 8; i++) {
     uint32_t tmp = ctx->state[i];
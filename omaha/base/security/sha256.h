@@ -35,6 +35,35 @@ const uint8_t* SHA256_hash(const void* data, size_t len, uint8_t* digest);
 
 #define SHA256_DIGEST_SIZE 32
 
+// The block function implementations. By default the fastest implementation
+// supported by the CPU is selected the first time a block is hashed. The
+// selection is not visible in the output, only in the throughput.
+typedef enum {
+  SHA256_IMPL_AUTO = 0,
+  SHA256_IMPL_GENERIC,  // Portable C, available everywhere.
+  SHA256_IMPL_SSSE3,    // x86 with an SSSE3 vectorized message schedule.
+  SHA256_IMPL_AVX2,     // x86 with an AVX2 two-block message schedule.
+  SHA256_IMPL_SHANI,    // x86 SHA extensions.
+  SHA256_IMPL_ARMV8,    // ARMv8 cryptography extensions.
+  SHA256_IMPL_COUNT
+} SHA256_IMPL;
+
+// Returns non-zero if |impl| can run on this CPU. SHA256_IMPL_AUTO is always
+// supported.
+int SHA256_impl_supported(SHA256_IMPL impl);
+
+// Returns the implementation in use, never SHA256_IMPL_AUTO.
+SHA256_IMPL SHA256_get_impl(void);
+
+// Forces the implementation used by all contexts. Meant for tests and
+// benchmarks. Passing SHA256_IMPL_AUTO restores the runtime selection.
+// Returns zero and leaves the selection unchanged if |impl| is unsupported.
+// Not safe to call while other threads are hashing.
+int SHA256_set_impl(SHA256_IMPL impl);
+
+// Returns a short, stable name for |impl|, for example "shani".
+const char* SHA256_impl_name(SHA256_IMPL impl);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
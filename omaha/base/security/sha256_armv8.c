@@ -0,0 +1,103 @@
+// Copyright 2013 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// SHA-256 block function for ARMv8 CPUs with the cryptography extensions.
+// Called through the dispatch in sha256.c, which checks that the CPU
+// supports the SHA-256 instructions.
+
+#include "sha256-internal.h"
+
+#if defined(SHA256_ARCH_ARM64)
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <arm64_neon.h>
+#else
+#include <arm_neon.h>
+#endif
+
+// Four rounds over the message words in |msg|.
+#define ARMV8_ROUNDS(msg, t) do {                                  \
+    uint32x4_t wk = vaddq_u32((msg), vld1q_u32(&SHA256_K[t]));     \
+    uint32x4_t abcd = abcd_state;                                  \
+    abcd_state = vsha256hq_u32(abcd_state, efgh_state, wk);        \
+    efgh_state = vsha256h2q_u32(efgh_state, abcd, wk);             \
+  } while (0)
+
+// Replaces W[t-16..t-13] in |m0| with W[t..t+3].
+#define ARMV8_SCHEDULE(m0, m1, m2, m3) \
+    (m0) = vsha256su1q_u32(vsha256su0q_u32((m0), (m1)), (m2), (m3))
+
+#define ARMV8_LOAD(p) \
+    vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p)))
+
+SHA256_TARGET("+crypto")
+void SHA256_blocks_armv8(uint32_t state[8],
+                         const uint8_t* data,
+                         size_t num_blocks) {
+  uint32x4_t abcd_state = vld1q_u32(&state[0]);
+  uint32x4_t efgh_state = vld1q_u32(&state[4]);
+  uint32x4_t abcd_save, efgh_save;
+  uint32x4_t m0, m1, m2, m3;
+
+  for (; num_blocks; --num_blocks, data += 64) {
+    abcd_save = abcd_state;
+    efgh_save = efgh_state;
+
+    m0 = ARMV8_LOAD(data + 0);
+    m1 = ARMV8_LOAD(data + 16);
+    m2 = ARMV8_LOAD(data + 32);
+    m3 = ARMV8_LOAD(data + 48);
+
+    ARMV8_ROUNDS(m0, 0);
+    ARMV8_SCHEDULE(m0, m1, m2, m3);
+    ARMV8_ROUNDS(m1, 4);
+    ARMV8_SCHEDULE(m1, m2, m3, m0);
+    ARMV8_ROUNDS(m2, 8);
+    ARMV8_SCHEDULE(m2, m3, m0, m1);
+    ARMV8_ROUNDS(m3, 12);
+    ARMV8_SCHEDULE(m3, m0, m1, m2);
+
+    ARMV8_ROUNDS(m0, 16);
+    ARMV8_SCHEDULE(m0, m1, m2, m3);
+    ARMV8_ROUNDS(m1, 20);
+    ARMV8_SCHEDULE(m1, m2, m3, m0);
+    ARMV8_ROUNDS(m2, 24);
+    ARMV8_SCHEDULE(m2, m3, m0, m1);
+    ARMV8_ROUNDS(m3, 28);
+    ARMV8_SCHEDULE(m3, m0, m1, m2);
+
+    ARMV8_ROUNDS(m0, 32);
+    ARMV8_SCHEDULE(m0, m1, m2, m3);
+    ARMV8_ROUNDS(m1, 36);
+    ARMV8_SCHEDULE(m1, m2, m3, m0);
+    ARMV8_ROUNDS(m2, 40);
+    ARMV8_SCHEDULE(m2, m3, m0, m1);
+    ARMV8_ROUNDS(m3, 44);
+    ARMV8_SCHEDULE(m3, m0, m1, m2);
+
+    ARMV8_ROUNDS(m0, 48);
+    ARMV8_ROUNDS(m1, 52);
+    ARMV8_ROUNDS(m2, 56);
+    ARMV8_ROUNDS(m3, 60);
+
+    abcd_state = vaddq_u32(abcd_state, abcd_save);
+    efgh_state = vaddq_u32(efgh_state, efgh_save);
+  }
+
+  vst1q_u32(&state[0], abcd_state);
+  vst1q_u32(&state[4], efgh_state);
+}
+
+#endif  // SHA256_ARCH_ARM64
@@ -14,8 +14,14 @@
 // ========================================================================
 
 #include "omaha/base/security/sha256.h"
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <vector>
+#include "base/cpu.h"
+#include "build/build_config.h"
+#include "omaha/base/highres_timer-win32.h"
+#include "omaha/base/string.h"
 #include "omaha/testing/unit_test.h"
 
 namespace omaha {
@@ -66,5 +72,177 @@ TEST(Security, Sha256) {
   }
 }
 
+namespace {
+
+// Selects an implementation for the lifetime of the object.
+class ScopedSha256Impl {
+ public:
+  explicit ScopedSha256Impl(SHA256_IMPL impl) {
+    EXPECT_TRUE(SHA256_set_impl(impl));
+  }
+  ~ScopedSha256Impl() {
+    SHA256_set_impl(SHA256_IMPL_AUTO);
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ScopedSha256Impl);
+};
+
+// Test vectors from FIPS 180-2, appendix B.
+const struct {
+  const char* message;
+  size_t repeat;
+  const TCHAR* hex_digest;
+} kNistVectors[] = {
+  { "abc", 1,
+    _T("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") },
+  { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+    _T("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1") },
+  { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+    "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 1,
+    _T("cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1") },
+  { "a", 1000000,
+    _T("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0") },
+};
+
+std::vector<uint8_t> PseudoRandomBytes(size_t size) {
+  std::vector<uint8_t> bytes(size);
+  uint32_t x = 0x12345678;
+  for (size_t i = 0; i != size; ++i) {
+    x = x * 1103515245 + 12345;
+    bytes[i] = static_cast<uint8_t>(x >> 24);
+  }
+  return bytes;
+}
+
+std::vector<SHA256_IMPL> SupportedImpls() {
+  std::vector<SHA256_IMPL> impls;
+  for (int i = SHA256_IMPL_GENERIC; i != SHA256_IMPL_COUNT; ++i) {
+    if (SHA256_impl_supported(static_cast<SHA256_IMPL>(i))) {
+      impls.push_back(static_cast<SHA256_IMPL>(i));
+    }
+  }
+  return impls;
+}
+
+}  // namespace
+
+TEST(Security, Sha256NistVectors) {
+  const std::vector<SHA256_IMPL> impls = SupportedImpls();
+  for (size_t i = 0; i != impls.size(); ++i) {
+    ScopedSha256Impl scoped_impl(impls[i]);
+    for (size_t j = 0; j != arraysize(kNistVectors); ++j) {
+      LITE_SHA256_CTX context = {0};
+      SHA256_init(&context);
+      for (size_t k = 0; k != kNistVectors[j].repeat; ++k) {
+        SHA256_update(&context,
+                      kNistVectors[j].message,
+                      strlen(kNistVectors[j].message));
+      }
+      EXPECT_STREQ(kNistVectors[j].hex_digest,
+                   BytesToHex(SHA256_final(&context), SHA256_DIGEST_SIZE))
+          << SHA256_impl_name(impls[i]);
+    }
+  }
+}
+
+// Hashes every length up to a few blocks, in one call and in uneven chunks,
+// and compares each accelerated implementation with the portable one.
+TEST(Security, Sha256ImplementationsMatchGeneric) {
+  const std::vector<uint8_t> data = PseudoRandomBytes(1024);
+  const std::vector<SHA256_IMPL> impls = SupportedImpls();
+
+  for (size_t len = 0; len <= data.size(); ++len) {
+    uint8_t expected[SHA256_DIGEST_SIZE] = {0};
+    {
+      ScopedSha256Impl scoped_impl(SHA256_IMPL_GENERIC);
+      SHA256_hash(&data.front(), len, expected);
+    }
+
+    for (size_t i = 0; i != impls.size(); ++i) {
+      ScopedSha256Impl scoped_impl(impls[i]);
+
+      uint8_t digest[SHA256_DIGEST_SIZE] = {0};
+      SHA256_hash(&data.front(), len, digest);
+      EXPECT_EQ(0, memcmp(expected, digest, SHA256_DIGEST_SIZE))
+          << SHA256_impl_name(impls[i]) << " " << len;
+
+      LITE_SHA256_CTX context = {0};
+      SHA256_init(&context);
+      size_t chunk = 1;
+      for (size_t offset = 0; offset < len; offset += chunk, chunk += 13) {
+        SHA256_update(&context, &data[offset], std::min(chunk, len - offset));
+      }
+      EXPECT_EQ(0, memcmp(expected, SHA256_final(&context), SHA256_DIGEST_SIZE))
+          << SHA256_impl_name(impls[i]) << " " << len;
+    }
+  }
+}
+
+TEST(Security, Sha256SetImpl) {
+  EXPECT_TRUE(SHA256_impl_supported(SHA256_IMPL_AUTO));
+  EXPECT_TRUE(SHA256_impl_supported(SHA256_IMPL_GENERIC));
+  EXPECT_FALSE(SHA256_impl_supported(SHA256_IMPL_COUNT));
+  EXPECT_FALSE(SHA256_set_impl(SHA256_IMPL_COUNT));
+
+  const SHA256_IMPL detected = SHA256_get_impl();
+  EXPECT_NE(SHA256_IMPL_AUTO, detected);
+
+  EXPECT_TRUE(SHA256_set_impl(SHA256_IMPL_GENERIC));
+  EXPECT_EQ(SHA256_IMPL_GENERIC, SHA256_get_impl());
+  EXPECT_TRUE(SHA256_set_impl(SHA256_IMPL_AUTO));
+  EXPECT_EQ(detected, SHA256_get_impl());
+}
+
+// The runtime selection must agree with the features reported by base::CPU.
+TEST(Security, Sha256ImplMatchesCpuFeatures) {
+#if defined(ARCH_CPU_X86_FAMILY)
+  CPU cpu;
+  EXPECT_EQ(cpu.has_ssse3(), !!SHA256_impl_supported(SHA256_IMPL_SSSE3));
+  EXPECT_EQ(cpu.has_avx2() && cpu.has_ssse3(),
+            !!SHA256_impl_supported(SHA256_IMPL_AVX2));
+  EXPECT_EQ(cpu.has_sha() && cpu.has_sse41() && cpu.has_ssse3(),
+            !!SHA256_impl_supported(SHA256_IMPL_SHANI));
+  EXPECT_FALSE(SHA256_impl_supported(SHA256_IMPL_ARMV8));
+
+  SHA256_IMPL expected = SHA256_IMPL_GENERIC;
+  if (cpu.has_sha() && cpu.has_sse41() && cpu.has_ssse3()) {
+    expected = SHA256_IMPL_SHANI;
+  } else if (cpu.has_avx2() && cpu.has_ssse3()) {
+    expected = SHA256_IMPL_AVX2;
+  } else if (cpu.has_ssse3()) {
+    expected = SHA256_IMPL_SSSE3;
+  }
+  EXPECT_EQ(expected, SHA256_get_impl());
+#endif
+}
+
+// Prints the throughput of each implementation. Run with
+// --gtest_also_run_disabled_tests --gtest_filter=*Sha256Throughput.
+TEST(Security, DISABLED_Sha256Throughput) {
+  const size_t kBufferSize = 1024 * 1024;
+  const int kIterations = 256;
+  const std::vector<uint8_t> data = PseudoRandomBytes(kBufferSize);
+  const std::vector<SHA256_IMPL> impls = SupportedImpls();
+
+  for (size_t i = 0; i != impls.size(); ++i) {
+    ScopedSha256Impl scoped_impl(impls[i]);
+    uint8_t digest[SHA256_DIGEST_SIZE] = {0};
+
+    const ULONGLONG start = HighresTimer::GetCurrentTicks();
+    for (int j = 0; j != kIterations; ++j) {
+      SHA256_hash(&data.front(), data.size(), digest);
+    }
+    const double seconds =
+        static_cast<double>(HighresTimer::GetCurrentTicks() - start) /
+        HighresTimer::GetTimerFrequency();
+
+    std::printf("sha256 %-8s %6.2f GB/s\n",
+                SHA256_impl_name(impls[i]),
+                kBufferSize * static_cast<double>(kIterations) /
+                    seconds / 1e9);
+  }
+}
+
 }  // namespace omaha
 
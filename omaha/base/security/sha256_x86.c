@@ -0,0 +1,309 @@
+// Copyright 2013 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// SHA-256 block functions for x86 and x64 CPUs:
+//   * SSSE3: the message schedule is computed four words at a time, the
+//     rounds are scalar and fully unrolled.
+//   * AVX2: like SSSE3, with the schedules of two blocks computed side by side
+//     in the two 128-bit lanes.
+//   * SHA-NI: the SHA extensions do both the schedule and the rounds.
+// The functions are called through the dispatch in sha256.c, which checks
+// that the CPU supports them.
+
+#include "sha256-internal.h"
+
+#if defined(SHA256_ARCH_X86)
+
+#include <immintrin.h>
+
+#define ror(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
+
+#define S0(x) (ror((x), 2) ^ ror((x), 13) ^ ror((x), 22))
+#define S1(x) (ror((x), 6) ^ ror((x), 11) ^ ror((x), 25))
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+
+#define ROUND(a, b, c, d, e, f, g, h, wk) do {      \
+    uint32_t t1 = (h) + S1(e) + CH(e, f, g) + (wk);  \
+    uint32_t t2 = S0(a) + MAJ(a, b, c);              \
+    (d) += t1;                                       \
+    (h) = t1 + t2;                                   \
+  } while (0)
+
+// Runs the 64 rounds over a precomputed W[t] + K[t] array.
+static void SHA256_rounds(uint32_t state[8], const uint32_t wk[64]) {
+  uint32_t a = state[0];
+  uint32_t b = state[1];
+  uint32_t c = state[2];
+  uint32_t d = state[3];
+  uint32_t e = state[4];
+  uint32_t f = state[5];
+  uint32_t g = state[6];
+  uint32_t h = state[7];
+  int t;
+
+  for (t = 0; t < 64; t += 8) {
+    ROUND(a, b, c, d, e, f, g, h, wk[t + 0]);
+    ROUND(h, a, b, c, d, e, f, g, wk[t + 1]);
+    ROUND(g, h, a, b, c, d, e, f, wk[t + 2]);
+    ROUND(f, g, h, a, b, c, d, e, wk[t + 3]);
+    ROUND(e, f, g, h, a, b, c, d, wk[t + 4]);
+    ROUND(d, e, f, g, h, a, b, c, wk[t + 5]);
+    ROUND(c, d, e, f, g, h, a, b, wk[t + 6]);
+    ROUND(b, c, d, e, f, g, h, a, wk[t + 7]);
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+//
+// SSSE3.
+//
+
+#define ROR128(x, n) \
+    _mm_or_si128(_mm_srli_epi32((x), (n)), _mm_slli_epi32((x), 32 - (n)))
+
+// sigma0(x) = ror(x, 7) ^ ror(x, 18) ^ shr(x, 3)
+#define SIGMA0_128(x) \
+    _mm_xor_si128(_mm_xor_si128(ROR128((x), 7), ROR128((x), 18)), \
+                  _mm_srli_epi32((x), 3))
+
+// sigma1(x) = ror(x, 17) ^ ror(x, 19) ^ shr(x, 10)
+#define SIGMA1_128(x) \
+    _mm_xor_si128(_mm_xor_si128(ROR128((x), 17), ROR128((x), 19)), \
+                  _mm_srli_epi32((x), 10))
+
+// Given W[t-16..t-1] in w0..w3, returns W[t..t+3]. The sigma1 terms depend on
+// W[t] and W[t+1], so the upper two words are completed in a second step.
+SHA256_TARGET("ssse3")
+static __m128i SHA256_schedule_ssse3(__m128i w0, __m128i w1,
+                                     __m128i w2, __m128i w3) {
+  __m128i w15 = _mm_alignr_epi8(w1, w0, 4);  // W[t-15..t-12]
+  __m128i w7 = _mm_alignr_epi8(w3, w2, 4);   // W[t-7..t-4]
+  __m128i x = _mm_add_epi32(_mm_add_epi32(w0, SIGMA0_128(w15)), w7);
+  x = _mm_add_epi32(x, SIGMA1_128(_mm_srli_si128(w3, 8)));
+  x = _mm_add_epi32(x, SIGMA1_128(_mm_slli_si128(x, 8)));
+  return x;
+}
+
+SHA256_TARGET("ssse3")
+void SHA256_blocks_ssse3(uint32_t state[8],
+                         const uint8_t* data,
+                         size_t num_blocks) {
+  const __m128i kByteSwap =
+      _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  uint32_t wk[64];
+  __m128i w0, w1, w2, w3, x;
+  int t;
+
+  for (; num_blocks; --num_blocks, data += 64) {
+    w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)),
+                          kByteSwap);
+    w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)),
+                          kByteSwap);
+    w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)),
+                          kByteSwap);
+    w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)),
+                          kByteSwap);
+
+    for (t = 0; t < 64; t += 4) {
+      _mm_storeu_si128((__m128i*)&wk[t],
+                       _mm_add_epi32(w0, _mm_loadu_si128(
+                           (const __m128i*)&SHA256_K[t])));
+      x = SHA256_schedule_ssse3(w0, w1, w2, w3);
+      w0 = w1;
+      w1 = w2;
+      w2 = w3;
+      w3 = x;
+    }
+
+    SHA256_rounds(state, wk);
+  }
+}
+
+//
+// AVX2. The low lane holds block n, the high lane block n + 1.
+//
+
+#define ROR256(x, n) \
+    _mm256_or_si256(_mm256_srli_epi32((x), (n)), \
+                    _mm256_slli_epi32((x), 32 - (n)))
+
+#define SIGMA0_256(x) \
+    _mm256_xor_si256(_mm256_xor_si256(ROR256((x), 7), ROR256((x), 18)), \
+                     _mm256_srli_epi32((x), 3))
+
+#define SIGMA1_256(x) \
+    _mm256_xor_si256(_mm256_xor_si256(ROR256((x), 17), ROR256((x), 19)), \
+                     _mm256_srli_epi32((x), 10))
+
+SHA256_TARGET("avx2")
+static __m256i SHA256_schedule_avx2(__m256i w0, __m256i w1,
+                                    __m256i w2, __m256i w3) {
+  // The byte shifts and alignr operate on each 128-bit lane independently.
+  __m256i w15 = _mm256_alignr_epi8(w1, w0, 4);
+  __m256i w7 = _mm256_alignr_epi8(w3, w2, 4);
+  __m256i x = _mm256_add_epi32(_mm256_add_epi32(w0, SIGMA0_256(w15)), w7);
+  x = _mm256_add_epi32(x, SIGMA1_256(_mm256_srli_si256(w3, 8)));
+  x = _mm256_add_epi32(x, SIGMA1_256(_mm256_slli_si256(x, 8)));
+  return x;
+}
+
+SHA256_TARGET("avx2")
+static __m256i SHA256_load_two_avx2(const uint8_t* data, __m256i byte_swap) {
+  __m256i x = _mm256_castsi128_si256(
+      _mm_loadu_si128((const __m128i*)data));
+  x = _mm256_inserti128_si256(
+      x, _mm_loadu_si128((const __m128i*)(data + 64)), 1);
+  return _mm256_shuffle_epi8(x, byte_swap);
+}
+
+SHA256_TARGET("avx2")
+void SHA256_blocks_avx2(uint32_t state[8],
+                        const uint8_t* data,
+                        size_t num_blocks) {
+  const __m256i kByteSwap =
+      _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                      12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  uint32_t wk[2][64];
+  __m256i w0, w1, w2, w3, x;
+  int t;
+
+  for (; num_blocks >= 2; num_blocks -= 2, data += 128) {
+    w0 = SHA256_load_two_avx2(data + 0, kByteSwap);
+    w1 = SHA256_load_two_avx2(data + 16, kByteSwap);
+    w2 = SHA256_load_two_avx2(data + 32, kByteSwap);
+    w3 = SHA256_load_two_avx2(data + 48, kByteSwap);
+
+    for (t = 0; t < 64; t += 4) {
+      x = _mm256_add_epi32(w0, _mm256_broadcastsi128_si256(
+          _mm_loadu_si128((const __m128i*)&SHA256_K[t])));
+      _mm_storeu_si128((__m128i*)&wk[0][t], _mm256_castsi256_si128(x));
+      _mm_storeu_si128((__m128i*)&wk[1][t], _mm256_extracti128_si256(x, 1));
+      x = SHA256_schedule_avx2(w0, w1, w2, w3);
+      w0 = w1;
+      w1 = w2;
+      w2 = w3;
+      w3 = x;
+    }
+
+    SHA256_rounds(state, wk[0]);
+    SHA256_rounds(state, wk[1]);
+  }
+
+  _mm256_zeroupper();
+
+  if (num_blocks) {
+    SHA256_blocks_ssse3(state, data, num_blocks);
+  }
+}
+
+//
+// SHA-NI. The state is kept as ABEF and CDGH, which is the layout the
+// sha256rnds2 instruction expects.
+//
+
+// Four rounds over the message words in |msg|.
+#define SHANI_ROUNDS(msg, t) do {                                          \
+    __m128i wk = _mm_add_epi32(                                            \
+        (msg), _mm_loadu_si128((const __m128i*)&SHA256_K[t]));             \
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);                          \
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0e)); \
+  } while (0)
+
+// Replaces W[t-16..t-13] in |m0| with W[t..t+3].
+#define SHANI_SCHEDULE(m0, m1, m2, m3)                                     \
+    (m0) = _mm_sha256msg2_epu32(                                           \
+        _mm_add_epi32(_mm_sha256msg1_epu32((m0), (m1)),                    \
+                      _mm_alignr_epi8((m3), (m2), 4)),                     \
+        (m3))
+
+SHA256_TARGET("sha,sse4.1,ssse3")
+void SHA256_blocks_shani(uint32_t state[8],
+                         const uint8_t* data,
+                         size_t num_blocks) {
+  const __m128i kByteSwap =
+      _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  __m128i abef, cdgh, abef_save, cdgh_save, tmp;
+  __m128i m0, m1, m2, m3;
+
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xb1);
+  cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1b);
+  abef = _mm_alignr_epi8(tmp, cdgh, 8);
+  cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);
+
+  for (; num_blocks; --num_blocks, data += 64) {
+    abef_save = abef;
+    cdgh_save = cdgh;
+
+    m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)),
+                          kByteSwap);
+    m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)),
+                          kByteSwap);
+    m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)),
+                          kByteSwap);
+    m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)),
+                          kByteSwap);
+
+    SHANI_ROUNDS(m0, 0);
+    SHANI_ROUNDS(m1, 4);
+    SHANI_ROUNDS(m2, 8);
+    SHANI_ROUNDS(m3, 12);
+
+    SHANI_SCHEDULE(m0, m1, m2, m3);
+    SHANI_ROUNDS(m0, 16);
+    SHANI_SCHEDULE(m1, m2, m3, m0);
+    SHANI_ROUNDS(m1, 20);
+    SHANI_SCHEDULE(m2, m3, m0, m1);
+    SHANI_ROUNDS(m2, 24);
+    SHANI_SCHEDULE(m3, m0, m1, m2);
+    SHANI_ROUNDS(m3, 28);
+
+    SHANI_SCHEDULE(m0, m1, m2, m3);
+    SHANI_ROUNDS(m0, 32);
+    SHANI_SCHEDULE(m1, m2, m3, m0);
+    SHANI_ROUNDS(m1, 36);
+    SHANI_SCHEDULE(m2, m3, m0, m1);
+    SHANI_ROUNDS(m2, 40);
+    SHANI_SCHEDULE(m3, m0, m1, m2);
+    SHANI_ROUNDS(m3, 44);
+
+    SHANI_SCHEDULE(m0, m1, m2, m3);
+    SHANI_ROUNDS(m0, 48);
+    SHANI_SCHEDULE(m1, m2, m3, m0);
+    SHANI_ROUNDS(m1, 52);
+    SHANI_SCHEDULE(m2, m3, m0, m1);
+    SHANI_ROUNDS(m2, 56);
+    SHANI_SCHEDULE(m3, m0, m1, m2);
+    SHANI_ROUNDS(m3, 60);
+
+    abef = _mm_add_epi32(abef, abef_save);
+    cdgh = _mm_add_epi32(cdgh, cdgh_save);
+  }
+
+  tmp = _mm_shuffle_epi32(abef, 0x1b);
+  cdgh = _mm_shuffle_epi32(cdgh, 0xb1);
+  _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, cdgh, 0xf0));
+  _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+#endif  // SHA256_ARCH_X86
@@ -20,12 +20,14 @@
 
 #include "omaha/base/signatures.h"
 #include <intsafe.h>
+#include <algorithm>
 #include <memory>
 #include <vector>
 
 #include "omaha/base/const_utils.h"
 #include "omaha/base/debug.h"
 #include "omaha/base/error.h"
+#include "omaha/base/file_pipeline.h"
 #include "omaha/base/logging.h"
 #include "omaha/base/string.h"
 #include "omaha/base/utils.h"
@@ -38,6 +40,14 @@ constexpr size_t kMaxFileSizeForAuthentication = 1024 * 1024 * 1024;  // 1GB.
 // Buffer size used to read files from disk.
 constexpr size_t kFileReadBufferSize = 1024 * 1024;  // 1MB.
 
+// Upper bound on the number of files hashed at the same time.
+constexpr int kMaxParallelHashThreads = 8;
+
+// When the combined hash of several files is computed, a worker can only
+// feed it once the files before its own are done. Until then the worker keeps
+// up to this many bytes in memory and then waits.
+constexpr size_t kMaxPendingCombinedBytes = 16 * 1024 * 1024;  // 16MB.
+
 namespace CryptDetails {
 
 class SHA256Hash : public HashInterface {
@@ -71,6 +81,285 @@ CryptDetails::HashInterface* CreateHasher() {
 
 }  // namespace CryptDetails
 
+namespace {
+
+// Hashes a list of files on a bounded number of threads, one file per thread
+// at a time. The calling thread is one of the workers.
+//
+// The combined hash must see the files in order. Each file has an event which
+// is set when all the files before it have been fed to the combined hash. A
+// worker feeds its data directly once the event is set, keeping a bounded
+// amount of data in memory until then. The worker holding the lowest file
+// index never waits, so the workers always make progress.
+class ParallelFileHasher {
+ public:
+  ParallelFileHasher(const std::vector<CString>& filepaths,
+                     uint64 max_len,
+                     bool compute_combined_hash)
+      : filepaths_(filepaths),
+        max_len_(max_len),
+        next_file_(0),
+        total_len_(0),
+        aborted_(0),
+        result_(S_OK),
+        file_hashes_(filepaths.size()) {
+    if (compute_combined_hash) {
+      combined_hasher_.reset(CryptDetails::CreateHasher());
+    }
+  }
+
+  HRESULT Run(std::vector<std::vector<byte>>* file_hashes_out,
+              std::vector<byte>* hash_out) {
+    ASSERT1(!filepaths_.empty());
+    ASSERT1(!hash_out || combined_hasher_.get());
+
+    if (combined_hasher_.get()) {
+      turn_events_.reset(new scoped_event[filepaths_.size()]);
+      for (size_t i = 0; i != filepaths_.size(); ++i) {
+        reset(turn_events_[i], ::CreateEvent(NULL, true, i == 0, NULL));
+        if (!turn_events_[i]) {
+          return HRESULTFromLastError();
+        }
+      }
+    }
+
+    SYSTEM_INFO system_info = {};
+    ::GetSystemInfo(&system_info);
+    const size_t num_workers = std::min<size_t>(
+        filepaths_.size(),
+        std::max<DWORD>(1, std::min<DWORD>(system_info.dwNumberOfProcessors,
+                                           kMaxParallelHashThreads)));
+
+    // If a thread cannot be created, the other workers pick up its files.
+    std::vector<HANDLE> threads;
+    for (size_t i = 1; i < num_workers; ++i) {
+      HANDLE thread = ::CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+      if (!thread) {
+        UTIL_LOG(LW, (_T("[CreateThread failed][%u]"), ::GetLastError()));
+        break;
+      }
+      threads.push_back(thread);
+    }
+
+    Work();
+
+    if (!threads.empty()) {
+      VERIFY1(::WaitForMultipleObjects(static_cast<DWORD>(threads.size()),
+                                       &threads.front(),
+                                       true,
+                                       INFINITE) != WAIT_FAILED);
+      for (size_t i = 0; i != threads.size(); ++i) {
+        VERIFY1(::CloseHandle(threads[i]));
+      }
+    }
+
+    UTIL_LOG(L3, (_T("[ParallelFileHasher::Run][%Iu files][%Iu threads]")
+                  _T("[%I64u bytes][0x%08x]"),
+                  filepaths_.size(), threads.size() + 1, total_len_, result_));
+    if (FAILED(result_)) {
+      return result_;
+    }
+
+    if (file_hashes_out) {
+      file_hashes_out->swap(file_hashes_);
+    }
+    if (hash_out) {
+      const size_t digest_size = combined_hasher_->hash_size();
+      hash_out->resize(digest_size);
+      memcpy(&hash_out->front(), combined_hasher_->final(), digest_size);
+    }
+    return S_OK;
+  }
+
+ private:
+  static DWORD WINAPI ThreadProc(void* param) {
+    static_cast<ParallelFileHasher*>(param)->Work();
+    return 0;
+  }
+
+  void Work() {
+    for (;;) {
+      const LONG index = ::InterlockedIncrement(&next_file_) - 1;
+      if (index >= static_cast<LONG>(filepaths_.size()) || aborted_) {
+        return;
+      }
+
+      HRESULT hr = HashFile(static_cast<size_t>(index));
+      if (FAILED(hr)) {
+        Abort(hr);
+        return;
+      }
+    }
+  }
+
+  // Adds |len| to the total number of bytes hashed and checks the result
+  // against |max_len_|.
+  HRESULT AddLength(uint64 len) {
+    const uint64 total_len = static_cast<uint64>(::InterlockedExchangeAdd64(
+        reinterpret_cast<volatile LONG64*>(&total_len_),
+        static_cast<LONG64>(len))) + len;
+    if (max_len_ && total_len > max_len_) {
+      UTIL_LOG(LE, (_T("[exceed max len][curr_len=%I64u][max_len=%I64u]"),
+                    total_len, max_len_));
+      return SIGS_E_FILE_SIZE_TOO_BIG;
+    }
+    return S_OK;
+  }
+
+  HRESULT HashFile(size_t index) {
+    DoubleBufferedFileReader reader;
+    HRESULT hr = reader.Open(filepaths_[index], kFilePipelineBufferSize);
+    if (FAILED(hr)) {
+      UTIL_LOG(LE, (_T("[failed to open][%s][0x%08x]"),
+                    filepaths_[index], hr));
+      return hr;
+    }
+
+    // Fails early if the files are too big, before reading anything.
+    uint64 accounted_len = reader.file_size();
+    hr = AddLength(accounted_len);
+    if (FAILED(hr)) {
+      return hr;
+    }
+
+    std::unique_ptr<CryptDetails::HashInterface> hasher(
+        CryptDetails::CreateHasher());
+
+    // Data waiting for the files before this one to be fed to the combined
+    // hash.
+    std::vector<std::vector<byte>> pending;
+    size_t pending_len = 0;
+    bool has_turn = false;
+
+    uint64 file_len = 0;
+    for (;;) {
+      const byte* data = NULL;
+      DWORD len = 0;
+      hr = reader.Next(&data, &len);
+      if (FAILED(hr)) {
+        return hr;
+      }
+      if (!len) {
+        break;
+      }
+
+      // The file may have grown since it was opened.
+      file_len += len;
+      if (file_len > accounted_len) {
+        hr = AddLength(file_len - accounted_len);
+        if (FAILED(hr)) {
+          return hr;
+        }
+        accounted_len = file_len;
+      }
+
+      hasher->update(data, len);
+
+      if (aborted_) {
+        return E_ABORT;
+      }
+      if (!combined_hasher_.get()) {
+        continue;
+      }
+
+      if (!has_turn) {
+        if (pending_len + len > kMaxPendingCombinedBytes) {
+          hr = WaitForTurn(index);
+          if (FAILED(hr)) {
+            return hr;
+          }
+          has_turn = true;
+        } else {
+          has_turn = HasTurn(index);
+        }
+      }
+
+      if (has_turn) {
+        FeedPending(&pending, &pending_len);
+        combined_hasher_->update(data, len);
+      } else {
+        pending.push_back(std::vector<byte>(data, data + len));
+        pending_len += len;
+      }
+    }
+
+    const size_t digest_size = hasher->hash_size();
+    file_hashes_[index].resize(digest_size);
+    memcpy(&file_hashes_[index].front(), hasher->final(), digest_size);
+
+    if (combined_hasher_.get()) {
+      if (!has_turn) {
+        hr = WaitForTurn(index);
+        if (FAILED(hr)) {
+          return hr;
+        }
+      }
+      FeedPending(&pending, &pending_len);
+      if (index + 1 < filepaths_.size()) {
+        VERIFY1(::SetEvent(get(turn_events_[index + 1])));
+      }
+    }
+
+    return S_OK;
+  }
+
+  // Returns true if the files before |index| have been fed to the combined
+  // hash. Returns false after a failure, so that the caller does not touch
+  // the combined hash.
+  bool HasTurn(size_t index) const {
+    return ::WaitForSingleObject(get(turn_events_[index]), 0) ==
+               WAIT_OBJECT_0 &&
+           !aborted_;
+  }
+
+  // Waits until the files before |index| have been fed to the combined hash.
+  HRESULT WaitForTurn(size_t index) {
+    if (::WaitForSingleObject(get(turn_events_[index]), INFINITE) !=
+        WAIT_OBJECT_0) {
+      return HRESULTFromLastError();
+    }
+    return aborted_ ? E_ABORT : S_OK;
+  }
+
+  void FeedPending(std::vector<std::vector<byte>>* pending,
+                   size_t* pending_len) {
+    for (size_t i = 0; i != pending->size(); ++i) {
+      combined_hasher_->update(&(*pending)[i].front(),
+                               static_cast<unsigned int>((*pending)[i].size()));
+    }
+    pending->clear();
+    *pending_len = 0;
+  }
+
+  // Records the first failure and wakes up the workers waiting for their turn.
+  void Abort(HRESULT hr) {
+    if (::InterlockedCompareExchange(&aborted_, 1, 0) == 0) {
+      result_ = hr;
+    }
+    if (combined_hasher_.get()) {
+      for (size_t i = 0; i != filepaths_.size(); ++i) {
+        ::SetEvent(get(turn_events_[i]));
+      }
+    }
+  }
+
+  const std::vector<CString>& filepaths_;
+  const uint64 max_len_;
+
+  volatile LONG next_file_;
+  volatile uint64 total_len_;
+  volatile LONG aborted_;
+  HRESULT result_;
+
+  std::vector<std::vector<byte>> file_hashes_;
+  std::unique_ptr<CryptDetails::HashInterface> combined_hasher_;
+  std::unique_ptr<scoped_event[]> turn_events_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelFileHasher);
+};
+
+}  // namespace
+
 HRESULT CryptoHash::Compute(const TCHAR* filepath,
                             uint64 max_len,
                             std::vector<byte>* hash_out) {
@@ -98,6 +387,23 @@ HRESULT CryptoHash::Compute(const std::vector<byte>& buffer_in,
   return ComputeOrValidate(buffer_in, NULL, hash_out);
 }
 
+HRESULT CryptoHash::ComputeParallel(
+    const std::vector<CString>& filepaths,
+    uint64 max_len,
+    std::vector<std::vector<byte>>* file_hashes_out,
+    std::vector<byte>* hash_out) {
+  ASSERT1(filepaths.size() > 0);
+  ASSERT1(file_hashes_out || hash_out);
+  UTIL_LOG(L1, (_T("[CryptoHash::ComputeParallel]")));
+
+  if (filepaths.empty()) {
+    return E_INVALIDARG;
+  }
+
+  ParallelFileHasher hasher(filepaths, max_len, hash_out != NULL);
+  return hasher.Run(file_hashes_out, hash_out);
+}
+
 HRESULT CryptoHash::Validate(const TCHAR* filepath,
                              uint64 max_len,
                              const std::vector<byte>& hash_in) {
@@ -125,6 +431,55 @@ HRESULT CryptoHash::Validate(const std::vector<byte>& buffer_in,
   return ComputeOrValidate(buffer_in, &hash_in, NULL);
 }
 
+HRESULT CryptoHash::ValidateParallel(const std::vector<CString>& filepaths,
+                                     uint64 max_len,
+                                     const std::vector<byte>& hash_in) {
+  ASSERT1(IsValidSize(hash_in.size()));
+
+  std::vector<byte> hash;
+  HRESULT hr = ComputeParallel(filepaths, max_len, NULL, &hash);
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  if (hash_in.size() != hash.size() ||
+      memcmp(&hash_in.front(), &hash.front(), hash.size())) {
+    CStringA base64_encoded_hash;
+    Base64Escape(reinterpret_cast<const char*>(&hash.front()),
+                 static_cast<int>(hash.size()),
+                 &base64_encoded_hash,
+                 true);
+    REPORT_LOG(L1, (_T("[actual hash=%S]"), base64_encoded_hash));
+    return SIGS_E_INVALID_SIGNATURE;
+  }
+  return S_OK;
+}
+
+HRESULT CryptoHash::ValidateEachParallel(
+    const std::vector<CString>& filepaths,
+    uint64 max_len,
+    const std::vector<std::vector<byte>>& file_hashes_in) {
+  ASSERT1(filepaths.size() == file_hashes_in.size());
+
+  if (filepaths.size() != file_hashes_in.size()) {
+    return E_INVALIDARG;
+  }
+
+  std::vector<std::vector<byte>> file_hashes;
+  HRESULT hr = ComputeParallel(filepaths, max_len, &file_hashes, NULL);
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  for (size_t i = 0; i != filepaths.size(); ++i) {
+    if (file_hashes_in[i] != file_hashes[i]) {
+      UTIL_LOG(LE, (_T("[hash mismatch][%s]"), filepaths[i]));
+      return SIGS_E_INVALID_SIGNATURE;
+    }
+  }
+  return S_OK;
+}
+
 HRESULT CryptoHash::ComputeOrValidate(const std::vector<CString>& filepaths,
                                       uint64 max_len,
                                       const std::vector<byte>* hash_in,
@@ -249,7 +604,28 @@ HRESULT VerifyFileHashSha256(const std::vector<CString>& files,
   if (!crypto.IsValidSize(hash_vector.size())) {
     return E_INVALIDARG;
   }
-  return crypto.Validate(files, kMaxFileSizeForAuthentication, hash_vector);
+  return crypto.ValidateParallel(files,
+                                 kMaxFileSizeForAuthentication,
+                                 hash_vector);
+}
+
+HRESULT CopyFileAndVerifyHashSha256(const CString& source,
+                                    const CString& destination,
+                                    const CString& expected_hash) {
+  std::vector<uint8> hash_vector;
+  if (!SafeHexStringToVector(expected_hash, &hash_vector)) {
+    return E_INVALIDARG;
+  }
+
+  CryptoHash crypto;
+  if (!crypto.IsValidSize(hash_vector.size())) {
+    return E_INVALIDARG;
+  }
+  return CopyAndHashFile(source,
+                         destination,
+                         kMaxFileSizeForAuthentication,
+                         hash_vector,
+                         NULL);
 }
 
 }  // namespace omaha
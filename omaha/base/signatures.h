@@ -69,6 +69,18 @@ class CryptoHash {
   HRESULT Compute(const std::vector<byte>& buffer_in,
                   std::vector<byte>* hash_out);
 
+  // Hash a list of files concurrently. Each file is hashed on its own worker
+  // thread, with large reads double-buffered against the hash computation.
+  // |file_hashes_out| receives the hash of each file, in the order of
+  // |filepaths|. |hash_out| receives the hash of the files taken together,
+  // which is the hash Compute() returns for the same list. Either output can
+  // be NULL, but not both. |max_len| limits the total size of the files, as
+  // it does for Compute().
+  HRESULT ComputeParallel(const std::vector<CString>& filepaths,
+                          uint64 max_len,
+                          std::vector<std::vector<byte>>* file_hashes_out,
+                          std::vector<byte>* hash_out);
+
   // Verify hash of a file
   HRESULT Validate(const TCHAR * filepath,
                    uint64 max_len,
@@ -83,6 +95,17 @@ class CryptoHash {
   HRESULT Validate(const std::vector<byte>& buffer_in,
                    const std::vector<byte>& hash_in);
 
+  // Verify hash of a list of files, hashing the files concurrently.
+  HRESULT ValidateParallel(const std::vector<CString>& filepaths,
+                           uint64 max_len,
+                           const std::vector<byte>& hash_in);
+
+  // Verify the hash of each file in a list, hashing the files concurrently.
+  HRESULT ValidateEachParallel(
+      const std::vector<CString>& filepaths,
+      uint64 max_len,
+      const std::vector<std::vector<byte>>& file_hashes_in);
+
   bool IsValidSize(size_t size) const {
     return size == hash_size();
   }
@@ -111,6 +134,13 @@ class CryptoHash {
 HRESULT VerifyFileHashSha256(const std::vector<CString>& files,
                              const CString& expected_hash);
 
+// Copies |source| to |destination| and verifies that the SHA256 hash of the
+// data is the hex-digit encoded expected_hash, reading the source only once.
+// |destination| is only created or replaced if the hash matches.
+HRESULT CopyFileAndVerifyHashSha256(const CString& source,
+                                    const CString& destination,
+                                    const CString& expected_hash);
+
 }  // namespace omaha
 
 #endif  // OMAHA_BASE_SIGNATURES_H_
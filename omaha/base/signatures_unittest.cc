@@ -25,6 +25,7 @@
 #include <vector>
 #include "omaha/base/app_util.h"
 #include "omaha/base/error.h"
+#include "omaha/base/file.h"
 #include "omaha/base/path.h"
 #include "omaha/base/signatures.h"
 #include "omaha/base/string.h"
@@ -128,5 +129,151 @@ TEST(SignaturesTest, VerifyFileHashSha256) {
   EXPECT_STREQ(hash_files, CString(actual_hash_files.c_str()));
 }
 
+class CryptoHashParallelTest : public testing::Test {
+ protected:
+  CryptoHashParallelTest()
+      : source_file1_(ConcatenatePath(
+            app_util::GetCurrentModuleDirectory(),
+            _T("unittest_support\\download_cache_test\\")
+            _T("{89640431-FE64-4da8-9860-1A1085A60E13}\\gears-win32-opt.msi"))),
+        source_file2_(ConcatenatePath(
+            app_util::GetCurrentModuleDirectory(),
+            _T("unittest_support\\download_cache_test\\")
+            _T("{7101D597-3481-4971-AD23-455542964072}\\livelysetup.exe"))) {
+    EXPECT_TRUE(SafeHexStringToVector(
+        _T("49b45f78865621b154fa65089f955182345a67f9746841e43e2d6daa288988d0"),
+        &hash_file1_));
+    EXPECT_TRUE(SafeHexStringToVector(
+        _T("d5e06b4436c5e33f2de88298b890f47815fc657b63b3050d2217c55a5d0730b0"),
+        &hash_files_));
+  }
+
+  const CString source_file1_;
+  const CString source_file2_;
+  std::vector<byte> hash_file1_;   // Hash of source_file1_.
+  std::vector<byte> hash_files_;   // Hash of source_file1_ + source_file2_.
+};
+
+TEST_F(CryptoHashParallelTest, ComputeParallel) {
+  std::vector<CString> files;
+  files.push_back(source_file1_);
+  files.push_back(source_file2_);
+
+  CryptoHash crypto;
+  std::vector<std::vector<byte>> file_hashes;
+  std::vector<byte> hash;
+  EXPECT_HRESULT_SUCCEEDED(
+      crypto.ComputeParallel(files, 0, &file_hashes, &hash));
+  EXPECT_EQ(hash_files_, hash);
+  ASSERT_EQ(2, file_hashes.size());
+  EXPECT_EQ(hash_file1_, file_hashes[0]);
+
+  std::vector<byte> hash_file2;
+  EXPECT_HRESULT_SUCCEEDED(crypto.Compute(source_file2_, 0, &hash_file2));
+  EXPECT_EQ(hash_file2, file_hashes[1]);
+
+  // Either output is optional.
+  file_hashes.clear();
+  EXPECT_HRESULT_SUCCEEDED(crypto.ComputeParallel(files, 0, &file_hashes, NULL));
+  EXPECT_EQ(2, file_hashes.size());
+  hash.clear();
+  EXPECT_HRESULT_SUCCEEDED(crypto.ComputeParallel(files, 0, NULL, &hash));
+  EXPECT_EQ(hash_files_, hash);
+}
+
+// Hashes more files than there are worker threads, so that workers have to
+// hold data back and wait before feeding the combined hash.
+TEST_F(CryptoHashParallelTest, ComputeParallel_ManyFiles) {
+  std::vector<CString> files;
+  for (int i = 0; i != 25; ++i) {
+    files.push_back(i % 3 ? source_file1_ : source_file2_);
+  }
+
+  CryptoHash crypto;
+  std::vector<byte> expected_hash;
+  EXPECT_HRESULT_SUCCEEDED(crypto.Compute(files, 0, &expected_hash));
+
+  std::vector<std::vector<byte>> file_hashes;
+  std::vector<byte> hash;
+  EXPECT_HRESULT_SUCCEEDED(
+      crypto.ComputeParallel(files, 0, &file_hashes, &hash));
+  EXPECT_EQ(expected_hash, hash);
+  ASSERT_EQ(files.size(), file_hashes.size());
+  for (size_t i = 0; i != files.size(); ++i) {
+    std::vector<byte> file_hash;
+    EXPECT_HRESULT_SUCCEEDED(crypto.Compute(files[i], 0, &file_hash));
+    EXPECT_EQ(file_hash, file_hashes[i]);
+  }
+}
+
+TEST_F(CryptoHashParallelTest, ValidateParallel) {
+  std::vector<CString> files;
+  files.push_back(source_file1_);
+
+  CryptoHash crypto;
+  EXPECT_HRESULT_SUCCEEDED(crypto.ValidateParallel(files, 0, hash_file1_));
+  EXPECT_EQ(SIGS_E_INVALID_SIGNATURE,
+            crypto.ValidateParallel(files, 0, hash_files_));
+
+  files.push_back(source_file2_);
+  EXPECT_HRESULT_SUCCEEDED(crypto.ValidateParallel(files, 0, hash_files_));
+  EXPECT_EQ(SIGS_E_INVALID_SIGNATURE,
+            crypto.ValidateParallel(files, 0, hash_file1_));
+}
+
+TEST_F(CryptoHashParallelTest, ValidateEachParallel) {
+  std::vector<CString> files;
+  files.push_back(source_file1_);
+  files.push_back(source_file1_);
+
+  std::vector<std::vector<byte>> file_hashes;
+  file_hashes.push_back(hash_file1_);
+  file_hashes.push_back(hash_file1_);
+
+  CryptoHash crypto;
+  EXPECT_HRESULT_SUCCEEDED(
+      crypto.ValidateEachParallel(files, 0, file_hashes));
+
+  file_hashes[1] = hash_files_;
+  EXPECT_EQ(SIGS_E_INVALID_SIGNATURE,
+            crypto.ValidateEachParallel(files, 0, file_hashes));
+}
+
+TEST_F(CryptoHashParallelTest, MaxLen) {
+  std::vector<CString> files;
+  files.push_back(source_file1_);
+  files.push_back(source_file2_);
+
+  uint32 size1 = 0;
+  uint32 size2 = 0;
+  ASSERT_HRESULT_SUCCEEDED(File::GetFileSizeUnopen(source_file1_, &size1));
+  ASSERT_HRESULT_SUCCEEDED(File::GetFileSizeUnopen(source_file2_, &size2));
+
+  CryptoHash crypto;
+  std::vector<byte> hash;
+  EXPECT_HRESULT_SUCCEEDED(
+      crypto.ComputeParallel(files, size1 + size2, NULL, &hash));
+  EXPECT_EQ(hash_files_, hash);
+  EXPECT_EQ(SIGS_E_FILE_SIZE_TOO_BIG,
+            crypto.ComputeParallel(files, size1 + size2 - 1, NULL, &hash));
+  EXPECT_EQ(SIGS_E_FILE_SIZE_TOO_BIG,
+            crypto.ValidateParallel(files, size1, hash_files_));
+}
+
+TEST_F(CryptoHashParallelTest, FileNotFound) {
+  std::vector<CString> files;
+  files.push_back(source_file1_);
+  files.push_back(source_file1_ + _T(".does_not_exist"));
+  files.push_back(source_file2_);
+
+  CryptoHash crypto;
+  std::vector<std::vector<byte>> file_hashes;
+  std::vector<byte> hash;
+  EXPECT_EQ(HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND),
+            crypto.ComputeParallel(files, 0, &file_hashes, &hash));
+  EXPECT_TRUE(file_hashes.empty());
+  EXPECT_TRUE(hash.empty());
+}
+
 }  // namespace omaha
 
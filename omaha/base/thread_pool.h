@@ -69,6 +69,11 @@ class ThreadPool {
     return work_item_count_ > 0;
   }
 
+  // Returns the number of work items queued or running.
+  int work_item_count() const {
+    return work_item_count_;
+  }
+
  private:
   class Context;
 
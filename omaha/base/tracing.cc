@@ -0,0 +1,309 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/base/tracing.h"
+
+#include "omaha/base/debug.h"
+#include "omaha/base/error.h"
+#include "omaha/base/highres_timer-win32.h"
+#include "omaha/base/safe_format.h"
+#include "omaha/base/string.h"
+#include "omaha/base/utils.h"
+#include "omaha/third_party/smartany/scoped_any.h"
+
+namespace omaha {
+
+namespace tracing {
+
+namespace internal {
+
+volatile LONG g_enabled = 0;
+
+}  // namespace internal
+
+namespace {
+
+struct Span {
+  const char* name;
+  uint64 id;           // The id of the object of an async span, or 0.
+  ULONGLONG begin;
+  ULONGLONG end;
+  GUID app_id;
+  GUID bundle_id;
+};
+
+// Only the thread which owns a chunk writes its spans. A span is published
+// by incrementing the count after it is written, which the volatile store
+// orders, so that the chunks can be read while they are written to.
+struct Chunk {
+  Span spans[kSpansPerChunk];
+  volatile LONG count;
+  Chunk* volatile next;
+};
+
+// The buffer of a thread. The buffers are kept in a list, and neither they
+// nor their chunks are freed, so that the spans of the threads which exited
+// are still exported.
+struct ThreadBuffer {
+  DWORD thread_id;
+  Chunk* first;
+  Chunk* last;
+  ThreadBuffer* next;
+};
+
+const LONG kMaxChunks = kMaxSpans / kSpansPerChunk;
+
+const DWORD g_tls_index = ::TlsAlloc();
+ThreadBuffer* volatile g_buffers = NULL;
+volatile LONG g_num_chunks = 0;
+volatile LONG g_num_dropped = 0;
+
+Chunk* NewChunk() {
+  if (::InterlockedIncrement(&g_num_chunks) > kMaxChunks) {
+    return NULL;
+  }
+  return new Chunk();
+}
+
+ThreadBuffer* GetThreadBuffer() {
+  if (g_tls_index == TLS_OUT_OF_INDEXES) {
+    return NULL;
+  }
+
+  ThreadBuffer* buffer =
+      static_cast<ThreadBuffer*>(::TlsGetValue(g_tls_index));
+  if (buffer) {
+    return buffer;
+  }
+
+  Chunk* chunk = NewChunk();
+  if (!chunk) {
+    return NULL;
+  }
+  buffer = new ThreadBuffer;
+  buffer->thread_id = ::GetCurrentThreadId();
+  buffer->first = chunk;
+  buffer->last = chunk;
+  if (!::TlsSetValue(g_tls_index, buffer)) {
+    delete chunk;
+    delete buffer;
+    return NULL;
+  }
+
+  // Pushes the buffer to the list, which is only ever pushed to.
+  ThreadBuffer* head = NULL;
+  do {
+    head = g_buffers;
+    buffer->next = head;
+  } while (::InterlockedCompareExchangePointer(
+               reinterpret_cast<void* volatile*>(&g_buffers),
+               buffer,
+               head) != head);
+  return buffer;
+}
+
+// Preserves the last error, which TlsGetValue resets, since spans often end
+// between a failed call and the code which looks at its error.
+void Record(const Span& span) {
+  const DWORD last_error = ::GetLastError();
+
+  ThreadBuffer* buffer = GetThreadBuffer();
+  Chunk* chunk = buffer ? buffer->last : NULL;
+  if (chunk && chunk->count == kSpansPerChunk) {
+    Chunk* next = NewChunk();
+    if (next) {
+      chunk->next = next;
+      buffer->last = next;
+    }
+    chunk = next;
+  }
+
+  if (chunk) {
+    chunk->spans[chunk->count] = span;
+    chunk->count = chunk->count + 1;
+  } else {
+    ::InterlockedIncrement(&g_num_dropped);
+  }
+
+  ::SetLastError(last_error);
+}
+
+void AppendJsonString(const CStringA& value, CStringA* json) {
+  json->AppendChar('"');
+  for (int i = 0; i < value.GetLength(); ++i) {
+    const char c = value[i];
+    if (c == '"' || c == '\\') {
+      json->AppendChar('\\');
+      json->AppendChar(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      SafeCStringAAppendFormat(json, "\\u%04x", c);
+    } else {
+      json->AppendChar(c);
+    }
+  }
+  json->AppendChar('"');
+}
+
+// Appends the fields which the events of a span have in common, after its
+// phase.
+void AppendEventFields(const Span& span,
+                       const char* phase,
+                       ULONGLONG ticks,
+                       DWORD process_id,
+                       DWORD thread_id,
+                       CStringA* json) {
+  const double us_per_tick = 1000000.0 / HighresTimer::GetTimerFrequency();
+
+  json->Append("{\"name\":");
+  AppendJsonString(span.name, json);
+  SafeCStringAAppendFormat(json,
+                           ",\"cat\":\"omaha\",\"ph\":\"%s\",\"ts\":%.3f,"
+                           "\"pid\":%u,\"tid\":%u",
+                           phase,
+                           ticks * us_per_tick,
+                           process_id,
+                           thread_id);
+  if (span.id) {
+    SafeCStringAAppendFormat(json, ",\"id\":\"0x%I64x\"", span.id);
+  }
+}
+
+void AppendArgs(const Span& span, CStringA* json) {
+  json->Append(",\"args\":{");
+  if (span.app_id != GUID_NULL) {
+    json->Append("\"app_id\":");
+    AppendJsonString(WideToUtf8(GuidToString(span.app_id)), json);
+  }
+  if (span.bundle_id != GUID_NULL) {
+    if (span.app_id != GUID_NULL) {
+      json->AppendChar(',');
+    }
+    json->Append("\"bundle_id\":");
+    AppendJsonString(WideToUtf8(GuidToString(span.bundle_id)), json);
+  }
+  json->AppendChar('}');
+}
+
+// A span of a thread is a complete event. An async span is a pair of begin
+// and end events, which Chrome shows on a track of their own per id.
+void AppendSpan(const Span& span,
+                DWORD process_id,
+                DWORD thread_id,
+                CStringA* json) {
+  const double us_per_tick = 1000000.0 / HighresTimer::GetTimerFrequency();
+
+  json->AppendChar(',');
+  if (!span.id) {
+    AppendEventFields(span, "X", span.begin, process_id, thread_id, json);
+    SafeCStringAAppendFormat(json, ",\"dur\":%.3f",
+                             (span.end - span.begin) * us_per_tick);
+    AppendArgs(span, json);
+    json->AppendChar('}');
+    return;
+  }
+
+  AppendEventFields(span, "b", span.begin, process_id, thread_id, json);
+  AppendArgs(span, json);
+  json->Append("},");
+  AppendEventFields(span, "e", span.end, process_id, thread_id, json);
+  json->AppendChar('}');
+}
+
+}  // namespace
+
+void Enable(bool enable) {
+  ::InterlockedExchange(&internal::g_enabled, enable ? 1 : 0);
+}
+
+ULONGLONG Now() {
+  return HighresTimer::GetCurrentTicks();
+}
+
+void RecordSpan(const char* name,
+                ULONGLONG begin,
+                const GUID& app_id,
+                const GUID& bundle_id) {
+  const Span span = { name, 0, begin, Now(), app_id, bundle_id };
+  Record(span);
+}
+
+void RecordAsyncSpan(const char* name,
+                     uint64 id,
+                     ULONGLONG begin,
+                     const GUID& app_id,
+                     const GUID& bundle_id) {
+  const Span span = { name, id, begin, Now(), app_id, bundle_id };
+  Record(span);
+}
+
+int GetNumDroppedSpans() {
+  return g_num_dropped;
+}
+
+void ExportChromeTrace(const CString& process_name, CStringA* json) {
+  ASSERT1(json);
+
+  const DWORD process_id = ::GetCurrentProcessId();
+  SafeCStringAAppendFormat(json,
+                           "{\"traceEvents\":[{\"name\":\"process_name\","
+                           "\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":",
+                           process_id);
+  AppendJsonString(WideToUtf8(process_name), json);
+  json->Append("}}");
+
+  for (ThreadBuffer* buffer = g_buffers; buffer; buffer = buffer->next) {
+    for (Chunk* chunk = buffer->first; chunk; chunk = chunk->next) {
+      const LONG count = chunk->count;
+      for (LONG i = 0; i < count; ++i) {
+        AppendSpan(chunk->spans[i], process_id, buffer->thread_id, json);
+      }
+    }
+  }
+
+  SafeCStringAAppendFormat(json,
+                           "],\"displayTimeUnit\":\"ms\","
+                           "\"otherData\":{\"dropped_spans\":%d}}",
+                           GetNumDroppedSpans());
+}
+
+HRESULT WriteChromeTrace(const CString& process_name, const CString& path) {
+  CStringA json;
+  ExportChromeTrace(process_name, &json);
+
+  scoped_hfile file(::CreateFile(path,
+                                 GENERIC_WRITE,
+                                 0,
+                                 NULL,
+                                 CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL,
+                                 NULL));
+  if (!file) {
+    return HRESULTFromLastError();
+  }
+
+  DWORD bytes_written = 0;
+  if (!::WriteFile(get(file),
+                   json.GetString(),
+                   static_cast<DWORD>(json.GetLength()),
+                   &bytes_written,
+                   NULL)) {
+    return HRESULTFromLastError();
+  }
+  return S_OK;
+}
+
+}  // namespace tracing
+
+}  // namespace omaha
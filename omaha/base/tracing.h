@@ -0,0 +1,135 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Tracing of the time spent in the operations of the update lifecycle.
+//
+// A span is the time a thread spends in an operation, such as an update check
+// or the install of an app, along with the ids of the app and of the app
+// bundle the operation is for. Spans are recorded when they end, into buffers
+// which belong to the thread which ends them, so that recording takes no lock.
+// The spans recorded by the threads of a process can then be exported as a
+// Chrome trace, which chrome://tracing and Perfetto display.
+//
+// Tracing is disabled by default. When it is, starting and ending a span only
+// reads a flag.
+
+#ifndef OMAHA_BASE_TRACING_H_
+#define OMAHA_BASE_TRACING_H_
+
+#include <windows.h>
+#include <atlstr.h>
+
+#include "base/basictypes.h"
+
+namespace omaha {
+
+namespace tracing {
+
+namespace internal {
+
+extern volatile LONG g_enabled;
+
+}  // namespace internal
+
+// The buffers of the threads grow in chunks of this many spans, up to this
+// many spans in all. The spans which do not fit are counted, and dropped.
+const int kSpansPerChunk = 128;
+const int kMaxSpans = 64 * 1024;
+
+// Returns true if spans are recorded.
+inline bool IsEnabled() {
+  return internal::g_enabled != 0;
+}
+
+// Starts or stops recording spans. The spans recorded so far are kept.
+void Enable(bool enable);
+
+// Returns the current time in the ticks of the high resolution timer, which
+// spans are timed with.
+ULONGLONG Now();
+
+// Records a span of the calling thread which started at |begin| and ends now.
+void RecordSpan(const char* name,
+                ULONGLONG begin,
+                const GUID& app_id,
+                const GUID& bundle_id);
+
+// Records a span which belongs to the object identified by |id| rather than
+// to the calling thread, such as a state of an app bundle, which may start and
+// end on different threads.
+void RecordAsyncSpan(const char* name,
+                     uint64 id,
+                     ULONGLONG begin,
+                     const GUID& app_id,
+                     const GUID& bundle_id);
+
+// Returns the number of spans which were dropped since the buffers were full.
+int GetNumDroppedSpans();
+
+// Appends the spans recorded so far by the threads of this process to |json|,
+// as a JSON object in the trace event format of Chrome.
+void ExportChromeTrace(const CString& process_name, CStringA* json);
+
+// Writes the spans recorded so far to the file at |path|, as a Chrome trace.
+HRESULT WriteChromeTrace(const CString& process_name, const CString& path);
+
+}  // namespace tracing
+
+// Records the scope it is declared in as a span, if tracing is enabled when
+// the span starts. |name| must be a string literal, since spans only record
+// a pointer to their name.
+//
+// The ids are optional. They are only worth setting when the span records:
+//   TraceSpan span("DownloadManager::DownloadApp");
+//   if (span.is_recording()) {
+//     span.set_app_id(app->app_guid());
+//   }
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name)
+      : name_(tracing::IsEnabled() ? name : NULL),
+        begin_(name_ ? tracing::Now() : 0),
+        app_id_(GUID_NULL),
+        bundle_id_(GUID_NULL) {}
+
+  ~TraceSpan() {
+    End();
+  }
+
+  bool is_recording() const { return name_ != NULL; }
+
+  void set_app_id(const GUID& app_id) { app_id_ = app_id; }
+  void set_bundle_id(const GUID& bundle_id) { bundle_id_ = bundle_id; }
+
+  // Ends the span before the end of its scope.
+  void End() {
+    if (name_) {
+      tracing::RecordSpan(name_, begin_, app_id_, bundle_id_);
+      name_ = NULL;
+    }
+  }
+
+ private:
+  const char* name_;
+  ULONGLONG begin_;
+  GUID app_id_;
+  GUID bundle_id_;
+
+  DISALLOW_COPY_AND_ASSIGN(TraceSpan);
+};
+
+}  // namespace omaha
+
+#endif  // OMAHA_BASE_TRACING_H_
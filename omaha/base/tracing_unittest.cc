@@ -0,0 +1,161 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/base/tracing.h"
+
+#include <vector>
+
+#include "omaha/base/app_util.h"
+#include "omaha/base/path.h"
+#include "omaha/base/safe_format.h"
+#include "omaha/base/utils.h"
+#include "omaha/testing/unit_test.h"
+
+namespace omaha {
+
+namespace {
+
+// {A1B2C3D4-0000-4000-8000-000000000001}
+const GUID kAppId = { 0xa1b2c3d4, 0x0000, 0x4000,
+                      { 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 } };
+
+DWORD WINAPI TraceOnThread(void*) {
+  TraceSpan span("TracingTest::OtherThread");
+  return 0;
+}
+
+}  // namespace
+
+class TracingTest : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    tracing::Enable(true);
+  }
+
+  virtual void TearDown() {
+    tracing::Enable(false);
+  }
+
+  static CStringA Export() {
+    CStringA json;
+    tracing::ExportChromeTrace(_T("TracingTest"), &json);
+    return json;
+  }
+};
+
+TEST_F(TracingTest, Disabled) {
+  tracing::Enable(false);
+  TraceSpan span("TracingTest::Disabled");
+  EXPECT_FALSE(span.is_recording());
+  span.End();
+  EXPECT_EQ(-1, Export().Find("TracingTest::Disabled"));
+}
+
+TEST_F(TracingTest, Span) {
+  {
+    TraceSpan span("TracingTest::Span");
+    ASSERT_TRUE(span.is_recording());
+    span.set_app_id(kAppId);
+  }
+
+  const CStringA json = Export();
+  EXPECT_EQ(0, json.Find("{\"traceEvents\":[{\"name\":\"process_name\","));
+  EXPECT_NE(-1, json.Find("\"args\":{\"name\":\"TracingTest\"}}"));
+
+  const int start = json.Find("{\"name\":\"TracingTest::Span\","
+                              "\"cat\":\"omaha\",\"ph\":\"X\",\"ts\":");
+  ASSERT_NE(-1, start);
+  const CStringA event = json.Mid(start, json.Find('}', start) - start);
+  CStringA expected;
+  SafeCStringAFormat(&expected, "\"pid\":%u,\"tid\":%u,\"dur\":",
+                     ::GetCurrentProcessId(), ::GetCurrentThreadId());
+  EXPECT_NE(-1, event.Find(expected));
+  EXPECT_NE(-1, event.Find(
+      "\"args\":{\"app_id\":\"{A1B2C3D4-0000-4000-8000-000000000001}\""));
+  EXPECT_EQ(-1, event.Find("bundle_id"));
+}
+
+// The spans of the threads which exited are kept.
+TEST_F(TracingTest, Span_OtherThread) {
+  DWORD thread_id = 0;
+  HANDLE thread = ::CreateThread(NULL, 0, &TraceOnThread, NULL, 0,
+                                 &thread_id);
+  ASSERT_TRUE(thread);
+  EXPECT_EQ(WAIT_OBJECT_0, ::WaitForSingleObject(thread, INFINITE));
+  ::CloseHandle(thread);
+
+  const CStringA json = Export();
+  const int start = json.Find("{\"name\":\"TracingTest::OtherThread\"");
+  ASSERT_NE(-1, start);
+  CStringA expected;
+  SafeCStringAFormat(&expected, "\"tid\":%u,", thread_id);
+  EXPECT_EQ(json.Find("\"tid\":", start), json.Find(expected, start));
+}
+
+TEST_F(TracingTest, AsyncSpan) {
+  tracing::RecordAsyncSpan("TracingTest::AsyncSpan", 0x1234,
+                           tracing::Now(), GUID_NULL, kAppId);
+
+  const CStringA json = Export();
+  const int begin = json.Find("{\"name\":\"TracingTest::AsyncSpan\","
+                              "\"cat\":\"omaha\",\"ph\":\"b\"");
+  ASSERT_NE(-1, begin);
+  const int end = json.Find("{\"name\":\"TracingTest::AsyncSpan\","
+                            "\"cat\":\"omaha\",\"ph\":\"e\"", begin);
+  ASSERT_NE(-1, end);
+  const int id = json.Find("\"id\":\"0x1234\"", begin);
+  EXPECT_NE(-1, id);
+  EXPECT_LT(id, end);
+  EXPECT_NE(-1, json.Find("\"id\":\"0x1234\"", end));
+  EXPECT_NE(-1, json.Find(
+      "\"args\":{\"bundle_id\":\"{A1B2C3D4-0000-4000-8000-000000000001}\"}",
+      begin));
+}
+
+TEST_F(TracingTest, ManySpans) {
+  for (int i = 0; i < 3 * tracing::kSpansPerChunk; ++i) {
+    TraceSpan span("TracingTest::ManySpans");
+  }
+
+  const CStringA json = Export();
+  int count = 0;
+  for (int pos = json.Find("TracingTest::ManySpans"); pos != -1;
+       pos = json.Find("TracingTest::ManySpans", pos + 1)) {
+    ++count;
+  }
+  EXPECT_EQ(3 * tracing::kSpansPerChunk, count);
+}
+
+TEST_F(TracingTest, WriteChromeTrace) {
+  TraceSpan span("TracingTest::WriteChromeTrace");
+  span.End();
+
+  const CString path = ConcatenatePath(app_util::GetTempDir(),
+                                       _T("TracingTest.trace.json"));
+  ASSERT_SUCCEEDED(tracing::WriteChromeTrace(_T("TracingTest"), path));
+
+  std::vector<byte> buffer;
+  EXPECT_SUCCEEDED(ReadEntireFile(path, 0, &buffer));
+  ::DeleteFile(path);
+  ASSERT_FALSE(buffer.empty());
+
+  const CStringA json(reinterpret_cast<const char*>(&buffer[0]),
+                      static_cast<int>(buffer.size()));
+  EXPECT_STREQ(Export(), json);
+  EXPECT_NE(-1, json.Find("TracingTest::WriteChromeTrace"));
+  EXPECT_EQ('}', json[json.GetLength() - 1]);
+}
+
+}  // namespace omaha
@@ -20,6 +20,7 @@
 #include "omaha/base/debug.h"
 #include "omaha/base/error.h"
 #include "omaha/base/file.h"
+#include "omaha/base/file_pipeline.h"
 #include "omaha/base/logging.h"
 #include "omaha/base/omaha_version.h"
 #include "omaha/base/path.h"
@@ -407,8 +408,14 @@ HRESULT CopyOfflineFilesForApp(const CString& app_id,
     CString new_file_path = ConcatenatePath(offline_app_dir, renamed_file_name);
     CORE_LOG(L4, (_T("[new_file_path][%s]"), new_file_path));
 
+    // The payloads can be large. Stream them with large overlapped I/O and
+    // only make a file visible in the offline directory once it is complete.
     CString source_file_path = ConcatenatePath(setup_temp_dir, file_name);
-    hr = File::Copy(source_file_path, new_file_path, true);
+    hr = CopyAndHashFile(source_file_path,
+                         new_file_path,
+                         0,
+                         std::vector<byte>(),
+                         NULL);
     if (FAILED(hr)) {
       CORE_LOG(LE, (_T("[Copy failed][%s][%s]"),
                     source_file_path, new_file_path));
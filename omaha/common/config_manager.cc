@@ -1793,6 +1793,22 @@ bool ConfigManager::AlwaysAllowCrashUploads() const {
   return always_allow_crash_uploads != 0;
 }
 
+bool ConfigManager::UseUsageStatsFile() const {
+  DWORD use_usage_stats_file = 0;
+  RegKey::GetValue(MACHINE_REG_UPDATE_DEV,
+                   kRegValueUsageStatsFile,
+                   &use_usage_stats_file);
+  return use_usage_stats_file != 0;
+}
+
+bool ConfigManager::UploadUsageStatsAsText() const {
+  DWORD upload_usage_stats_as_text = 0;
+  RegKey::GetValue(MACHINE_REG_UPDATE_DEV,
+                   kRegValueUsageStatsText,
+                   &upload_usage_stats_as_text);
+  return upload_usage_stats_as_text != 0;
+}
+
 bool ConfigManager::ShouldVerifyPayloadAuthenticodeSignature() const {
 #ifdef VERIFY_PAYLOAD_AUTHENTICODE_SIGNATURE
   DWORD disabled_in_registry = 0;
@@ -1820,6 +1836,21 @@ int ConfigManager::MaxCrashUploadsPerDay() const {
   return static_cast<int>(num_uploads);
 }
 
+int ConfigManager::GetOfflinePackageIngestionConcurrency() const {
+  DWORD concurrency = 0;
+  GetPolicyDword(kRegValueOfflinePackageIngestionConcurrency, &concurrency);
+  if (!concurrency) {
+    concurrency = kDefaultOfflinePackageIngestionConcurrency;
+  }
+  if (concurrency > kMaxOfflinePackageIngestionConcurrency) {
+    concurrency = kMaxOfflinePackageIngestionConcurrency;
+  }
+
+  OPT_LOG(L5, (_T("[GetOfflinePackageIngestionConcurrency][%u]"),
+               concurrency));
+  return static_cast<int>(concurrency);
+}
+
 CString ConfigManager::GetDownloadPreferenceGroupPolicy(
     IPolicyStatusValue** policy_status_value) const {
   PolicyValue<CString> v;
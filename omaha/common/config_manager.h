@@ -451,6 +451,13 @@ class ConfigManager {
   // build flavor or other configuration parameters.
   bool AlwaysAllowCrashUploads() const;
 
+  // Returns true if usage stats are aggregated to a file instead of the
+  // registry.
+  bool UseUsageStatsFile() const;
+
+  // Returns true if usage stats are uploaded as text instead of binary.
+  bool UploadUsageStatsAsText() const;
+
   // Returns whether the Authenticode signature of update payloads should be
   // verified.
   bool ShouldVerifyPayloadAuthenticodeSignature() const;
@@ -458,6 +465,11 @@ class ConfigManager {
   // Returns the number of crashes to upload per day.
   int MaxCrashUploadsPerDay() const;
 
+  // Returns how many offline installer packages are copied into the package
+  // cache at the same time, from the OfflinePackageIngestionConcurrency group
+  // policy. The value is between 1 and kMaxOfflinePackageIngestionConcurrency.
+  int GetOfflinePackageIngestionConcurrency() const;
+
   // Returns the value of the "DownloadPreference" group policy or an
   // empty string if the group policy does not exist, the policy is unknown, or
   // an error happened.
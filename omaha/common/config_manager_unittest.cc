@@ -2247,6 +2247,38 @@ TEST_P(ConfigManagerTest, AlwaysAllowCrashUploads) {
   EXPECT_FALSE(cm_->AlwaysAllowCrashUploads());
 }
 
+TEST_P(ConfigManagerTest, UseUsageStatsFile) {
+  EXPECT_FALSE(cm_->UseUsageStatsFile());
+
+  DWORD value = 1;
+  EXPECT_SUCCEEDED(RegKey::SetValue(MACHINE_REG_UPDATE_DEV,
+                                    kRegValueUsageStatsFile,
+                                    value));
+  EXPECT_TRUE(cm_->UseUsageStatsFile());
+
+  value = 0;
+  EXPECT_SUCCEEDED(RegKey::SetValue(MACHINE_REG_UPDATE_DEV,
+                                    kRegValueUsageStatsFile,
+                                    value));
+  EXPECT_FALSE(cm_->UseUsageStatsFile());
+}
+
+TEST_P(ConfigManagerTest, UploadUsageStatsAsText) {
+  EXPECT_FALSE(cm_->UploadUsageStatsAsText());
+
+  DWORD value = 1;
+  EXPECT_SUCCEEDED(RegKey::SetValue(MACHINE_REG_UPDATE_DEV,
+                                    kRegValueUsageStatsText,
+                                    value));
+  EXPECT_TRUE(cm_->UploadUsageStatsAsText());
+
+  value = 0;
+  EXPECT_SUCCEEDED(RegKey::SetValue(MACHINE_REG_UPDATE_DEV,
+                                    kRegValueUsageStatsText,
+                                    value));
+  EXPECT_FALSE(cm_->UploadUsageStatsAsText());
+}
+
 TEST_P(ConfigManagerTest, MaxCrashUploadsPerDay) {
   // Default is 5 for both debug and opt builds.
   const int kDefaultUploadsPerDay = 20;
@@ -2281,6 +2313,31 @@ TEST_P(ConfigManagerTest, MaxCrashUploadsPerDay) {
   EXPECT_EQ(kDefaultUploadsPerDay, cm_->MaxCrashUploadsPerDay());
 }
 
+TEST_P(ConfigManagerTest, GetOfflinePackageIngestionConcurrency) {
+  EXPECT_EQ(kDefaultOfflinePackageIngestionConcurrency,
+            cm_->GetOfflinePackageIngestionConcurrency());
+
+  EXPECT_SUCCEEDED(SetPolicy(kRegValueOfflinePackageIngestionConcurrency, 1));
+  EXPECT_EQ(1, cm_->GetOfflinePackageIngestionConcurrency());
+
+  EXPECT_SUCCEEDED(SetPolicy(kRegValueOfflinePackageIngestionConcurrency, 5));
+  EXPECT_EQ(5, cm_->GetOfflinePackageIngestionConcurrency());
+
+  // 0 means the default, and large values are capped.
+  EXPECT_SUCCEEDED(SetPolicy(kRegValueOfflinePackageIngestionConcurrency, 0));
+  EXPECT_EQ(kDefaultOfflinePackageIngestionConcurrency,
+            cm_->GetOfflinePackageIngestionConcurrency());
+
+  EXPECT_SUCCEEDED(SetPolicy(kRegValueOfflinePackageIngestionConcurrency,
+                             static_cast<DWORD>(-1)));
+  EXPECT_EQ(kMaxOfflinePackageIngestionConcurrency,
+            cm_->GetOfflinePackageIngestionConcurrency());
+
+  ClearGroupPolicies();
+  EXPECT_EQ(kDefaultOfflinePackageIngestionConcurrency,
+            cm_->GetOfflinePackageIngestionConcurrency());
+}
+
 // This test is slighly flaky due to the random nature of the jitter.
 TEST_P(ConfigManagerTest, GetAutoUpdateJitterMs) {
   // Test successive calls return different values.
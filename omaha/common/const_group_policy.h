@@ -59,6 +59,18 @@ const int kMaxAutoUpdateCheckPeriodMinutes = 43200;
 // The maximum value allowed for policy UpdatesSuppressedDurationMin.
 const int kMaxUpdatesSuppressedDurationMin = 960;
 
+// The number of offline installer packages copied into the package cache at
+// the same time. Each package is still read only once from the offline media;
+// a value of 1 reads the packages one after the other, which suits media that
+// seek slowly.
+const TCHAR* const kRegValueOfflinePackageIngestionConcurrency =
+    _T("OfflinePackageIngestionConcurrency");
+
+// The default and maximum values for policy
+// OfflinePackageIngestionConcurrency.
+const int kDefaultOfflinePackageIngestionConcurrency = 2;
+const int kMaxOfflinePackageIngestionConcurrency = 8;
+
 // This policy specifies what kind of download URLs could be returned to the
 // client in the update response and in which order of priority. The client
 // provides this information in the update request as a hint for the server.
@@ -175,6 +175,15 @@ bool OmahaExceptionHandler::StaticMinidumpCallback(const wchar_t* dump_path,
     thisptr->MinidumpCallback(dump_path, minidump_id);
   }
 
+#ifdef LOGGING
+  // Write out the queued log messages, since the logging system is not
+  // destroyed when the process is terminated.
+  Logging* logging = GetLogging();
+  if (logging) {
+    logging->Flush();
+  }
+#endif
+
   // There are two ways to stop execution of the current process: ExitProcess
   // and TerminateProcess. Calling ExitProcess results in calling the
   // destructors of the static objects before the process exits.
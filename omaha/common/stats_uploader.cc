@@ -25,6 +25,7 @@
 #include "omaha/base/error.h"
 #include "omaha/base/logging.h"
 #include "omaha/base/omaha_version.h"
+#include "omaha/base/path.h"
 #include "omaha/base/safe_format.h"
 #include "omaha/base/scoped_impersonation.h"
 #include "omaha/base/synchronized.h"
@@ -36,30 +37,44 @@
 #include "omaha/net/network_config.h"
 #include "omaha/net/network_request.h"
 #include "omaha/net/simple_request.h"
+#include "omaha/statsreport/aggregator-file.h"
 #include "omaha/statsreport/aggregator-win32.h"
+#include "omaha/statsreport/binary_formatter.h"
 #include "omaha/statsreport/const-win32.h"
 #include "omaha/statsreport/formatter.h"
 #include "omaha/statsreport/metrics.h"
+#include "omaha/statsreport/persistent_iterator-file.h"
 #include "omaha/statsreport/persistent_iterator-win32.h"
 
 using stats_report::g_global_metrics;
 
 using stats_report::kCountsKeyName;
 using stats_report::kTimingsKeyName;
+using stats_report::kHistogramsKeyName;
 using stats_report::kIntegersKeyName;
 using stats_report::kBooleansKeyName;
 using stats_report::kStatsKeyFormatString;
 using stats_report::kLastTransmissionTimeValueName;
 
+using stats_report::BinaryFormatter;
 using stats_report::Formatter;
+using stats_report::MetricsAggregatorFile;
 using stats_report::MetricsAggregatorWin32;
+using stats_report::PersistentMetricsIteratorFile;
 using stats_report::PersistentMetricsIteratorWin32;
 
 namespace omaha {
 
 namespace {
 
-HRESULT ResetPersistentMetrics(RegKey* key) {
+CString GetMetricsFilePath(bool is_machine) {
+  ConfigManager* cm = ConfigManager::Instance();
+  return ConcatenatePath(is_machine ? cm->GetMachineGoopdateInstallDir() :
+                                      cm->GetUserGoopdateInstallDir(),
+                         kMetricsFileName);
+}
+
+HRESULT ResetPersistentMetrics(RegKey* key, bool is_machine) {
   ASSERT1(key);
   HRESULT result = S_OK;
   DWORD now_sec = static_cast<DWORD>(time(NULL));
@@ -75,6 +90,10 @@ HRESULT ResetPersistentMetrics(RegKey* key) {
   if (FAILED(hr)) {
     result = hr;
   }
+  hr = key->DeleteSubKey(kHistogramsKeyName);
+  if (FAILED(hr)) {
+    result = hr;
+  }
   hr = key->DeleteSubKey(kIntegersKeyName);
   if (FAILED(hr)) {
     result = hr;
@@ -83,15 +102,22 @@ HRESULT ResetPersistentMetrics(RegKey* key) {
   if (FAILED(hr)) {
     result = hr;
   }
+
+  // The file is deleted whichever store is in use, so that metrics do not
+  // linger in it when the registry is used again.
+  const CString file_path(GetMetricsFilePath(is_machine));
+  if (!::DeleteFile(file_path) && ::GetLastError() != ERROR_FILE_NOT_FOUND) {
+    result = HRESULTFromLastError();
+  }
   return result;
 }
 
-// Returns S_OK without uploading in OEM mode.
+// Uploads |binary| if it is not empty, and |text| otherwise. The text is
+// logged either way. Returns S_OK without uploading in OEM mode.
 HRESULT UploadMetrics(bool is_machine,
                       const TCHAR* extra_url_data,
-                      const TCHAR* content) {
-  ASSERT1(content);
-
+                      const CString& text,
+                      const std::vector<uint8>& binary) {
   CString uid = goopdate_utils::GetUserIdLazyInit(is_machine);
 
   // Impersonate the user if the caller is machine, running as local system,
@@ -113,7 +139,8 @@ HRESULT UploadMetrics(bool is_machine,
   // There is no need to collect and report a different kind of usagestats.
   UNREFERENCED_PARAMETER(is_machine);
   UNREFERENCED_PARAMETER(extra_url_data);
-  UNREFERENCED_PARAMETER(content);
+  UNREFERENCED_PARAMETER(text);
+  UNREFERENCED_PARAMETER(binary);
   OPT_LOG(L3, (_T("[Stats not uploaded because the feature is deprecated.]")));
   return S_FALSE;
 #else
@@ -134,7 +161,13 @@ HRESULT UploadMetrics(bool is_machine,
       kMetricsServerUserId,         uid,
       extra_url_data);
 
-  CORE_LOG(L3, (_T("[upload usage stats][%s]"), content));
+  if (!binary.empty()) {
+    SafeCStringAppendFormat(&url, _T("&%s=%s"),
+        kMetricsServerParamFormat, kMetricsServerFormatBinary);
+  }
+
+  CORE_LOG(L3, (_T("[upload usage stats][%Iu binary bytes][%s]"),
+                binary.size(), text));
 
   NetworkConfig* network_config = NULL;
   NetworkConfigManager& network_manager = NetworkConfigManager::Instance();
@@ -149,21 +182,57 @@ HRESULT UploadMetrics(bool is_machine,
   network_request.AddHttpRequest(new SimpleRequest);
 
   std::vector<uint8> response_buffer;
-  return network_request.PostString(url, content, &response_buffer);
+  if (binary.empty()) {
+    return network_request.PostString(url, text, &response_buffer);
+  }
+  return network_request.Post(url,
+                              &binary.front(),
+                              binary.size(),
+                              &response_buffer);
 #endif  // GOOGLE_UPDATE_BUILD
 }
 
+template <typename Iterator>
+void FormatMetrics(Iterator* it,
+                   Formatter* formatter,
+                   BinaryFormatter* binary_formatter) {
+  ASSERT1(it);
+  ASSERT1(formatter);
+  ASSERT1(binary_formatter);
+  for (Iterator end; *it != end; ++*it) {
+    formatter->AddMetric(**it);
+    binary_formatter->AddMetric(**it);
+  }
+}
+
+// The metrics are uploaded in the binary encoding, deflated, unless the text
+// is asked for. The text is always formatted, for the log.
 HRESULT ReportMetrics(bool is_machine,
                       const TCHAR* extra_url_data,
                       DWORD interval) {
-  PersistentMetricsIteratorWin32 it(kMetricsProductName, is_machine), end;
   Formatter formatter(CT2A(kMetricsProductName), interval);
+  BinaryFormatter binary_formatter(interval);
+
+  ConfigManager* cm = ConfigManager::Instance();
+  if (cm->UseUsageStatsFile()) {
+    PersistentMetricsIteratorFile it(GetMetricsFilePath(is_machine));
+    FormatMetrics(&it, &formatter, &binary_formatter);
+  } else {
+    PersistentMetricsIteratorWin32 it(kMetricsProductName, is_machine);
+    FormatMetrics(&it, &formatter, &binary_formatter);
+  }
 
-  for (; it != end; ++it) {
-    formatter.AddMetric(*it);
+  std::vector<uint8> binary;
+  if (!cm->UploadUsageStatsAsText() &&
+      !binary_formatter.GetOutput(true, &binary)) {
+    CORE_LOG(LW, (_T("[Failed to deflate metrics, uploading text]")));
+    binary.clear();
   }
 
-  return UploadMetrics(is_machine, extra_url_data, CA2T(formatter.output()));
+  return UploadMetrics(is_machine,
+                       extra_url_data,
+                       CString(formatter.output()),
+                       binary);
 }
 
 HRESULT DoResetMetrics(bool is_machine) {
@@ -176,14 +245,22 @@ HRESULT DoResetMetrics(bool is_machine) {
     CORE_LOG(LE, (_T("[Unable to create metrics key][0x%08x]"), hr));
     return hr;
   }
-  return ResetPersistentMetrics(&key);
+  return ResetPersistentMetrics(&key, is_machine);
 }
 
 HRESULT DoAggregateMetrics(bool is_machine) {
-  MetricsAggregatorWin32 aggregator(g_global_metrics,
-                                    kMetricsProductName,
-                                    is_machine);
-  if (!aggregator.AggregateMetrics()) {
+  bool aggregated = false;
+  if (ConfigManager::Instance()->UseUsageStatsFile()) {
+    MetricsAggregatorFile aggregator(g_global_metrics,
+                                     GetMetricsFilePath(is_machine));
+    aggregated = aggregator.AggregateMetrics();
+  } else {
+    MetricsAggregatorWin32 aggregator(g_global_metrics,
+                                      kMetricsProductName,
+                                      is_machine);
+    aggregated = aggregator.AggregateMetrics();
+  }
+  if (!aggregated) {
     CORE_LOG(LW, (_T("[Metrics aggregation failed for unknown reasons]")));
     return GOOPDATE_E_METRICS_AGGREGATE_FAILED;
   }
@@ -210,7 +287,7 @@ HRESULT DoAggregateAndReportMetrics(bool is_machine, bool force_report) {
   if (FAILED(hr) || last_transmission_sec > now_sec) {
     CORE_LOG(LW, (_T("[hinky or missing last transmission time][%u][now: %u]"),
                   last_transmission_sec, now_sec));
-    ResetPersistentMetrics(&key);
+    ResetPersistentMetrics(&key, is_machine);
     return S_OK;
   }
 
@@ -235,25 +312,24 @@ HRESULT DoAggregateAndReportMetrics(bool is_machine, bool force_report) {
     return hr;
   }
 
-  VERIFY_SUCCEEDED(ResetPersistentMetrics(&key));
+  VERIFY_SUCCEEDED(ResetPersistentMetrics(&key, is_machine));
   CORE_LOG(L3, (_T("[Stats upload successful]")));
   return S_OK;
 }
 
-bool InitializeLock(GLock* lock, bool is_machine) {
+}  // namespace
+
+bool InitializeMetricsLock(GLock* lock, bool is_machine) {
   ASSERT1(lock);
   NamedObjectAttributes attributes;
   GetNamedObjectAttributes(kMetricsSerializer, is_machine, &attributes);
   return lock->InitializeWithSecAttr(attributes.name, &attributes.sa);
 }
 
-}  // namespace
-
-
 HRESULT ResetMetrics(bool is_machine) {
   CORE_LOG(L2, (_T("[ResetMetrics]")));
   GLock lock;
-  if (!InitializeLock(&lock, is_machine)) {
+  if (!InitializeMetricsLock(&lock, is_machine)) {
     return GOOPDATE_E_METRICS_LOCK_INIT_FAILED;
   }
   __mutexScope(lock);
@@ -268,7 +344,7 @@ HRESULT AggregateMetrics(bool is_machine) {
   }
 
   GLock lock;
-  if (!InitializeLock(&lock, is_machine)) {
+  if (!InitializeMetricsLock(&lock, is_machine)) {
     return GOOPDATE_E_METRICS_LOCK_INIT_FAILED;
   }
   __mutexScope(lock);
@@ -283,7 +359,7 @@ HRESULT AggregateAndReportMetrics(bool is_machine, bool force_report) {
   }
 
   GLock lock;
-  if (!InitializeLock(&lock, is_machine)) {
+  if (!InitializeMetricsLock(&lock, is_machine)) {
     return GOOPDATE_E_METRICS_LOCK_INIT_FAILED;
   }
   __mutexScope(lock);
@@ -23,6 +23,8 @@
 
 namespace omaha {
 
+class GLock;
+
 // The product name is chosen so that the stats are persisted under
 // the Google Update registry key for the machine or user, respectively.
 const TCHAR* const kMetricsProductName           = _T("Update");
@@ -32,14 +34,28 @@ const TCHAR* const kMetricsServerParamVersion    = _T("v");
 const TCHAR* const kMetricsServerParamIsMachine  = _T("ismachine");
 const TCHAR* const kMetricsServerTestSource      = _T("testsource");
 const TCHAR* const kMetricsServerUserId          = _T("ui");
+const TCHAR* const kMetricsServerParamFormat     = _T("format");
+
+// The value of the format parameter for reports in the encoding of
+// stats_report::BinaryFormatter. Text reports have no format parameter.
+const TCHAR* const kMetricsServerFormatBinary    = _T("binary");
+
+// The file the metrics are aggregated to, in the Google Update directory of
+// the machine or user, when the UsageStatsFile UpdateDev value is set.
+const TCHAR* const kMetricsFileName              = _T("UsageStats.dat");
 
 // Metrics are uploaded every 25 hours.
 const int kMetricsUploadIntervalSec              = 25 * 60 * 60;
 
+// Initializes |lock| as the lock which serializes the aggregation and the
+// reset of the metrics of the machine or user.
+bool InitializeMetricsLock(GLock* lock, bool is_machine);
+
 // Deletes existing metrics and initializes 'LastTransmission' to current time.
 HRESULT ResetMetrics(bool is_machine);
 
-// Aggregates metrics by saving them in registry.
+// Aggregates metrics by saving them in registry, or in the metrics file when
+// ConfigManager::UseUsageStatsFile() is true.
 HRESULT AggregateMetrics(bool is_machine);
 
 // Aggregates and reports the metrics if needed, as defined by the metrics
@@ -24,6 +24,7 @@
 #include "omaha/base/error.h"
 #include "omaha/base/logging.h"
 #include "omaha/base/synchronized.h"
+#include "omaha/base/tracing.h"
 #include "omaha/base/utils.h"
 #include "omaha/common/config_manager.h"
 #include "omaha/common/update_request.h"
@@ -109,6 +110,7 @@ HRESULT WebServicesClient::Send(bool is_foreground,
                                 const xml::UpdateRequest* update_request,
                                 xml::UpdateResponse* update_response) {
   CORE_LOG(L3, (_T("[WebServicesClient::Send]")));
+  TraceSpan span("WebServicesClient::Send");
   ASSERT1(update_request);
   ASSERT1(update_response);
 
@@ -147,6 +149,7 @@ HRESULT WebServicesClient::SendString(bool is_foreground,
                                       const CString* request_string,
                                       xml::UpdateResponse* update_response) {
   CORE_LOG(L3, (_T("[WebServicesClient::SendString]")));
+  TraceSpan span("WebServicesClient::SendString");
   ASSERT1(request_string);
   ASSERT1(update_response);
 
@@ -232,6 +235,7 @@ HRESULT WebServicesClient::SendStringInternal(
     const CStringA& utf8_request_string,
     xml::UpdateResponse* update_response) {
   CORE_LOG(L3, (_T("[actual_url is %s]"), actual_url));
+  TraceSpan span("WebServicesClient::SendStringInternal");
 
   // Each attempt to send a request is using its own network client.
   HRESULT hr = CreateRequest();
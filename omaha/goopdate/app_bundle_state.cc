@@ -17,6 +17,8 @@
 #include "omaha/base/debug.h"
 #include "omaha/base/error.h"
 #include "omaha/base/logging.h"
+#include "omaha/base/tracing.h"
+#include "omaha/base/utils.h"
 #include "omaha/common/web_services_client.h"
 #include "omaha/goopdate/app_bundle_state_busy.h"
 #include "omaha/goopdate/model.h"
@@ -25,6 +27,25 @@ namespace omaha {
 
 namespace fsm {
 
+namespace {
+
+// The names of the spans of the states, indexed by BundleState.
+const char* const kStateSpanNames[] = {
+  "AppBundle::Init",
+  "AppBundle::Initialized",
+  "AppBundle::Busy",
+  "AppBundle::Ready",
+  "AppBundle::Paused",
+  "AppBundle::Stopped",
+};
+
+}  // namespace
+
+AppBundleState::AppBundleState(BundleState state)
+    : state_(state),
+      entry_ticks_(tracing::IsEnabled() ? tracing::Now() : 0) {
+}
+
 HRESULT AppBundleState::put_altTokens(AppBundle* app_bundle,
                                       ULONG_PTR impersonation_token,
                                       ULONG_PTR primary_token,
@@ -177,6 +198,23 @@ void AppBundleState::ChangeState(AppBundle* app_bundle, AppBundleState* state) {
   CORE_LOG(L3, (_T("[AppBundleState::ChangeState][0x%p][from: %u][to: %u]"),
                 app_bundle, state_, state->state_));
 
+  // The states of a bundle are traced as async spans of the bundle, since
+  // the calls which change them are made on different threads.
+  COMPILE_ASSERT(arraysize(kStateSpanNames) == STATE_STOPPED + 1,
+                 state_span_names_mismatch);
+  if (entry_ticks_ && tracing::IsEnabled()) {
+    // The session id of a bundle may not be set yet.
+    GUID bundle_id = GUID_NULL;
+    if (FAILED(StringToGuidSafe(app_bundle->session_id(), &bundle_id))) {
+      bundle_id = GUID_NULL;
+    }
+    tracing::RecordAsyncSpan(kStateSpanNames[state_],
+                             reinterpret_cast<uint64>(app_bundle),
+                             entry_ticks_,
+                             GUID_NULL,
+                             bundle_id);
+  }
+
   app_bundle->ChangeState(state);
 }
 
@@ -80,7 +80,7 @@ class AppBundleState {
   };
 
 
-  explicit AppBundleState(BundleState state) : state_(state) {}
+  explicit AppBundleState(BundleState state);
 
   // These functions provide pass-through access to private AppBundle members.
   // TODO(omaha): remove asserts and implement inline.
@@ -103,6 +103,10 @@ class AppBundleState {
 
   BundleState state_;
 
+  // The time the bundle entered this state, if tracing was enabled then, so
+  // that the state is traced when the bundle leaves it.
+  ULONGLONG entry_ticks_;
+
   DISALLOW_COPY_AND_ASSIGN(AppBundleState);
 };
 
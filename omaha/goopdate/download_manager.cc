@@ -37,6 +37,7 @@
 #include "omaha/base/safe_format.h"
 #include "omaha/base/string.h"
 #include "omaha/base/synchronized.h"
+#include "omaha/base/tracing.h"
 #include "omaha/base/user_rights.h"
 #include "omaha/base/utils.h"
 #include "omaha/common/config_manager.h"
@@ -141,7 +142,7 @@ void AddDownloadMetricsPingEvents(
 }  // namespace
 
 DownloadManager::DownloadManager(bool is_machine)
-    : lock_(NULL), is_machine_(false) {
+    : lock_(NULL), is_machine_(false), is_purge_pending_(true) {
   CORE_LOG(L3, (_T("[DownloadManager::DownloadManager]")));
 
   omaha::interlocked_exchange_pointer(&lock_,
@@ -200,12 +201,20 @@ HRESULT DownloadManager::Initialize() {
     return hr;
   }
 
-  hr = package_cache()->PurgeOldPackagesIfNecessary();
+  return S_OK;
+}
+
+void DownloadManager::PurgeOldPackagesOnce() {
+  __mutexScope(purge_lock_);
+  if (!is_purge_pending_) {
+    return;
+  }
+  is_purge_pending_ = false;
+
+  HRESULT hr = package_cache()->PurgeOldPackagesIfNecessary();
   if (FAILED(hr)) {
     CORE_LOG(LW, (_T("[PurgeOldPackagesIfNecessary failed][0x%08x]"), hr));
   }
-
-  return S_OK;
 }
 
 CString DownloadManager::GetMessageForError(const ErrorContext& error_context,
@@ -243,6 +252,11 @@ HRESULT DownloadManager::DownloadApp(App* app) {
   CORE_LOG(L3, (_T("[DownloadManager::DownloadApp][0x%p]"), app));
   ASSERT1(app);
 
+  TraceSpan span("DownloadManager::DownloadApp");
+  worker_utils::SetTraceIds(*app, &span);
+
+  PurgeOldPackagesOnce();
+
   // TODO(omaha3): Maybe rename these to include "app_". Maybe add package
   // metrics too.
   ++metric_worker_download_total;
@@ -260,6 +274,7 @@ HRESULT DownloadManager::DownloadApp(App* app) {
     return hr;
   }
 
+  ++metric_worker_downloads_active;
   app->Downloading();
 
   CString message;
@@ -289,6 +304,7 @@ HRESULT DownloadManager::DownloadApp(App* app) {
   }
 
   VERIFY_SUCCEEDED(DeleteStateForApp(app));
+  --metric_worker_downloads_active;
 
   return hr;
 }
@@ -336,6 +352,8 @@ HRESULT DownloadManager::DoDownloadPackage(Package* package, State* state) {
   ASSERT1(state);
 
   App* app = package->app_version()->app();
+  TraceSpan span("DownloadManager::DoDownloadPackage");
+  worker_utils::SetTraceIds(*app, &span);
   const CString app_id(app->app_guid_string());
   const CString version(package->app_version()->version());
   const CString package_name(package->filename());
@@ -443,6 +461,7 @@ HRESULT DownloadManager::DoDownloadPackageFromUrl(const CString& url,
                                                   Package* package,
                                                   State* state) {
   OPT_LOG(L3, (_T("[starting download][from '%s'][to '%s']"), url, filename));
+  TraceSpan span("DownloadManager::DoDownloadPackageFromUrl");
 
   // Downloading a file is a blocking call. It assumes the model is not
   // locked by the calling thread, otherwise other threads won't be able to
@@ -477,13 +496,16 @@ HRESULT DownloadManager::DoDownloadPackageFromUrl(const CString& url,
 
   // We copy the file to the Package Cache unimpersonated, since the package
   // cache is in a privileged location.
-  hr = CallAsSelfAndImpersonate3(this,
-                                 &DownloadManager::CachePackage,
-                                 static_cast<const Package*>(package),
-                                 &source_file,
-                                 &filename);
+  int extra_code1 = 0;
+  {
+    scoped_revert_to_self revert_to_self;
+    hr = CachePackage(package, &source_file, &filename, &extra_code1);
+  }
   if (FAILED(hr)) {
     OPT_LOG(LE, (_T("[DownloadManager::CachePackage failed][%#x]"), hr));
+    if (hr == GOOPDATEDOWNLOAD_E_CACHING_FAILED) {
+      set_error_extra_code1(extra_code1);
+    }
   }
 
   return hr;
@@ -525,10 +547,13 @@ HRESULT DownloadManager::PurgeAppLowerVersions(const CString& app_id,
 
 HRESULT DownloadManager::CachePackage(const Package* package,
                                       File* source_file,
-                                      const CString* source_file_path) {
+                                      const CString* source_file_path,
+                                      int* extra_code1) {
   ASSERT1(package);
   ASSERT1(source_file);
 
+  PurgeOldPackagesOnce();
+
   const CString app_id(package->app_version()->app()->app_guid_string());
   const CString version(package->app_version()->version());
   const CString package_name(package->filename());
@@ -549,7 +574,9 @@ HRESULT DownloadManager::CachePackage(const Package* package,
       key, source_file, package->expected_hash());
   if (hr != SIGS_E_INVALID_SIGNATURE) {
     if (FAILED(hr)) {
-      set_error_extra_code1(static_cast<int>(hr));
+      if (extra_code1) {
+        *extra_code1 = static_cast<int>(hr);
+      }
       return GOOPDATEDOWNLOAD_E_CACHING_FAILED;
     }
     return hr;
@@ -568,6 +595,7 @@ HRESULT DownloadManager::CachePackage(const Package* package,
 }
 
 HRESULT DownloadManager::EnsureSignatureIsValid(const CString& file_path) {
+  TraceSpan span("DownloadManager::EnsureSignatureIsValid");
   const TCHAR* ext = ::PathFindExtension(file_path);
   ASSERT1(ext);
   if (*ext != _T('\0')) {
@@ -22,6 +22,7 @@
 #include <vector>
 
 #include "base/basictypes.h"
+#include "omaha/base/synchronized.h"
 
 namespace omaha {
 
@@ -39,11 +40,13 @@ class DownloadManagerInterface {
  public:
   virtual ~DownloadManagerInterface() {}
   virtual HRESULT Initialize() = 0;
+  virtual void PurgeOldPackagesOnce() = 0;
   virtual HRESULT PurgeAppLowerVersions(const CString& app_id,
                                         const CString& version) = 0;
   virtual HRESULT CachePackage(const Package* package,
                                File* source_file,
-                               const CString* source_file_path) = 0;
+                               const CString* source_file_path,
+                               int* extra_code1) = 0;
   virtual HRESULT DownloadApp(App* app) = 0;
   virtual HRESULT GetPackage(const Package* package,
                              const CString& dir) const = 0;
@@ -60,12 +63,25 @@ class DownloadManager : public DownloadManagerInterface {
 
   virtual HRESULT Initialize();
 
+  // Purges the old packages from the package cache, as the package cache
+  // policy requires, the first time it is called. The cache is not purged
+  // when the download manager is initialized, since the processes which only
+  // check for updates should not wait for the cache to be enumerated. It is
+  // purged after the update check instead, or before the first package is
+  // put in the cache, whichever comes first. Concurrent callers return once
+  // the purge is complete.
+  virtual void PurgeOldPackagesOnce();
+
   virtual HRESULT PurgeAppLowerVersions(const CString& app_id,
                                         const CString& version);
 
+  // Copies |source_file| into the package cache as |package|. When it
+  // returns GOOPDATEDOWNLOAD_E_CACHING_FAILED, sets |extra_code1|, if not
+  // NULL, to the error of the package cache. Can be called concurrently.
   virtual HRESULT CachePackage(const Package* package,
                                File* source_file,
-                               const CString* source_file_path);
+                               const CString* source_file_path,
+                               int* extra_code1);
 
   // Downloads the specified app and stores its packages in the package cache.
   //
@@ -152,6 +168,11 @@ class DownloadManager : public DownloadManagerInterface {
 
   bool is_machine_;
 
+  // True until the old packages are purged from the package cache. The purge
+  // lock is held while they are purged.
+  bool is_purge_pending_;
+  LLock purge_lock_;
+
   // The root of the package_cache.
   CString package_cache_root_;
 
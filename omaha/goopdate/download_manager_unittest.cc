@@ -152,7 +152,7 @@ class DownloadManagerTest : public AppTestBase {
                                          CString(hash.c_str())));
 
     Package* package = version->GetPackage(version->GetNumberOfPackages() - 1);
-    hr = download_manager_->CachePackage(package, &file, &file_path);
+    hr = download_manager_->CachePackage(package, &file, &file_path, NULL);
     EXPECT_EQ(expected_result, hr) << unittest_support_file_name;
   }
 
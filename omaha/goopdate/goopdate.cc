@@ -58,6 +58,7 @@
 #include "omaha/base/reg_key.h"
 #include "omaha/base/safe_format.h"
 #include "omaha/base/system_info.h"
+#include "omaha/base/tracing.h"
 #include "omaha/base/utils.h"
 #include "omaha/base/vistautil.h"
 #include "omaha/client/client_utils.h"
@@ -85,7 +86,9 @@
 #include "omaha/goopdate/google_update.h"
 #include "omaha/goopdate/goopdate_internal.h"
 #include "omaha/goopdate/goopdate_metrics.h"
+#include "omaha/goopdate/metrics_endpoint.h"
 #include "omaha/goopdate/resource_manager.h"
+#include "omaha/goopdate/startup_timeline.h"
 #include "omaha/service/service_main.h"
 #include "omaha/setup/setup_google_update.h"
 #include "omaha/setup/setup_service.h"
@@ -195,6 +198,31 @@ void LogErrorWithHResult(int event_id,
 
 #endif  // defined(HAS_DEVICE_MANAGEMENT)
 
+// Writes the tracing spans of this process next to the log, if the
+// TraceToFile logging setting is on.
+void WriteTraceFile(const TCHAR* cmd_line) {
+#ifdef LOGGING
+  Logging* logging = GetLogging();
+  if (!logging || !logging->IsTraceToFileEnabled()) {
+    return;
+  }
+
+  const CString path = logging->GetTraceFilePath();
+  if (path.IsEmpty()) {
+    return;
+  }
+
+  CString process_name;
+  SafeCStringFormat(&process_name, _T("%s %s"),
+                    MAIN_EXE_BASE_NAME, cmd_line ? cmd_line : _T(""));
+  HRESULT hr = tracing::WriteChromeTrace(process_name, path);
+  OPT_LOG(L2, (_T("[WriteTraceFile][%s][%d dropped][0x%x]"),
+               path, tracing::GetNumDroppedSpans(), hr));
+#else
+  UNREFERENCED_PARAMETER(cmd_line);
+#endif
+}
+
 }  // namespace
 
 namespace detail {
@@ -225,6 +253,10 @@ class GoopdateImpl {
   // Executes the mode determined by DoMain().
   HRESULT ExecuteMode(bool* has_ui_been_displayed);
 
+  // Serves the metrics of the long-running modes while they execute, if the
+  // metrics endpoint is enabled.
+  void StartMetricsEndpointIfEnabled(CommandLineMode mode);
+
   // Determines whether to use STA or MTA for the given mode.
   static COINIT GetComThreadingModelForMode(CommandLineMode mode);
 
@@ -325,6 +357,7 @@ class GoopdateImpl {
 
   std::unique_ptr<OmahaExceptionHandler> exception_handler_;
   std::unique_ptr<ThreadPool> thread_pool_;
+  std::unique_ptr<MetricsEndpoint> metrics_endpoint_;
 
   Goopdate* goopdate_;
 
@@ -476,10 +509,16 @@ void GoopdateImpl::HandleError(HRESULT hr, bool has_ui_been_displayed) {
 HRESULT GoopdateImpl::Main(HINSTANCE instance,
                            const TCHAR* cmd_line,
                            int cmd_show) {
+  startup_timeline::Mark(STARTUP_PHASE_MAIN);
   ++metric_goopdate_main;
 
   HRESULT hr = DoMain(instance, cmd_line, cmd_show);
+  metrics_endpoint_.reset();
   Worker::DeleteInstance();
+  WriteTraceFile(cmd_line);
+
+  // The timeline is sampled before the metrics are aggregated below.
+  startup_timeline::Report();
 
   CORE_LOG(L2, (_T("[has_uninstalled_ is %d]"), has_uninstalled_));
 
@@ -595,6 +634,7 @@ HRESULT GoopdateImpl::DoMain(HINSTANCE instance,
     args_.mode = COMMANDLINE_MODE_UNKNOWN;
     // Continue because we want to load the resources and display an error.
   }
+  startup_timeline::Mark(STARTUP_PHASE_COMMAND_LINE_PARSED);
 
 #if defined(HAS_DEVICE_MANAGEMENT)
   // Reference the DmStorage instance here so the singleton can be created
@@ -627,6 +667,7 @@ HRESULT GoopdateImpl::DoMain(HINSTANCE instance,
     }
     return hr;
   }
+  startup_timeline::Mark(STARTUP_PHASE_RESOURCES_LOADED);
 
   VERIFY_SUCCEEDED(CaptureUserMetrics());
 
@@ -659,6 +700,8 @@ HRESULT GoopdateImpl::DoMain(HINSTANCE instance,
     // TODO(omaha): I would like to pass the mode as an argument, but there
     // are so many uses for args_.mode and they could easily creep in. Consider
     // eliminating the args_ member.
+    startup_timeline::Mark(STARTUP_PHASE_MODE_STARTED);
+    StartMetricsEndpointIfEnabled(args_.mode);
     hr = ExecuteMode(&has_ui_been_displayed);
     if (FAILED(hr)) {
       CORE_LOG(LE, (_T("[ExecuteMode failed][0x%08x]"), hr));
@@ -744,6 +787,37 @@ COINIT GoopdateImpl::GetComThreadingModelForMode(CommandLineMode mode) {
   return COINIT_MULTITHREADED;
 }
 
+void GoopdateImpl::StartMetricsEndpointIfEnabled(CommandLineMode mode) {
+  switch (mode) {
+    case COMMANDLINE_MODE_CORE:
+    case COMMANDLINE_MODE_SERVICE:
+    case COMMANDLINE_MODE_MEDIUM_SERVICE:
+    case COMMANDLINE_MODE_COMSERVER:
+    case COMMANDLINE_MODE_ONDEMAND:
+      break;
+
+    default:
+      return;
+  }
+
+  DWORD is_enabled = 0;
+  if (FAILED(RegKey::GetValue(MACHINE_REG_UPDATE_DEV,
+                              kRegValueMetricsEndpoint,
+                              &is_enabled)) ||
+      !is_enabled) {
+    return;
+  }
+
+  std::unique_ptr<MetricsEndpoint> endpoint(
+      new MetricsEndpoint(is_machine_, thread_pool_.get()));
+  HRESULT hr = endpoint->Start();
+  if (FAILED(hr)) {
+    CORE_LOG(LE, (_T("[MetricsEndpoint::Start failed][0x%08x]"), hr));
+    return;
+  }
+  metrics_endpoint_ = std::move(endpoint);
+}
+
 // Assumes Goopdate is initialized and resources are loaded.
 // Inside this function, when creating ATL modules, we create them on the heap
 // and leak the ATL Modules. While this approach is not generally recommended,
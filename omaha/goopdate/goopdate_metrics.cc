@@ -54,4 +54,12 @@ DEFINE_METRIC_count(goopdate_main);
 DEFINE_METRIC_bool(is_system_install);
 DEFINE_METRIC_integer(omaha_version);
 
+DEFINE_METRIC_timing(startup_main_ms);
+DEFINE_METRIC_timing(startup_command_line_parsed_ms);
+DEFINE_METRIC_timing(startup_resources_loaded_ms);
+DEFINE_METRIC_timing(startup_mode_started_ms);
+DEFINE_METRIC_timing(startup_worker_initialized_ms);
+DEFINE_METRIC_timing(startup_update_check_sent_ms);
+DEFINE_METRIC_timing(startup_update_check_complete_ms);
+
 }  // namespace omaha
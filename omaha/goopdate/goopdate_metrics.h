@@ -79,6 +79,16 @@ DECLARE_METRIC_count(goopdate_main);
 DECLARE_METRIC_bool(is_system_install);
 DECLARE_METRIC_integer(omaha_version);
 
+// The time from the creation of the process to the phases of its startup.
+// See startup_timeline.h.
+DECLARE_METRIC_timing(startup_main_ms);
+DECLARE_METRIC_timing(startup_command_line_parsed_ms);
+DECLARE_METRIC_timing(startup_resources_loaded_ms);
+DECLARE_METRIC_timing(startup_mode_started_ms);
+DECLARE_METRIC_timing(startup_worker_initialized_ms);
+DECLARE_METRIC_timing(startup_update_check_sent_ms);
+DECLARE_METRIC_timing(startup_update_check_complete_ms);
+
 }  // namespace omaha
 
 #endif  // OMAHA_GOOPDATE_GOOPDATE_METRICS_H_
@@ -22,6 +22,7 @@
 #include "omaha/base/safe_format.h"
 #include "omaha/base/scope_guard.h"
 #include "omaha/base/synchronized.h"
+#include "omaha/base/tracing.h"
 #include "omaha/base/utils.h"
 #include "omaha/common/config_manager.h"
 #include "omaha/common/const_cmd_line.h"
@@ -31,6 +32,7 @@
 #include "omaha/goopdate/model.h"
 #include "omaha/goopdate/server_resource.h"
 #include "omaha/goopdate/string_formatter.h"
+#include "omaha/goopdate/worker_utils.h"
 
 namespace omaha {
 
@@ -96,6 +98,9 @@ void InstallManager::InstallApp(App* app,  const CString& dir) {
   CORE_LOG(L3, (_T("[InstallManager::InstallApp][0x%p]"), app));
   ASSERT1(app);
 
+  TraceSpan span("InstallManager::InstallApp");
+  worker_utils::SetTraceIds(*app, &span);
+
   const ConfigManager& cm = *ConfigManager::Instance();
   // TODO(omaha): Since we don't currently have is_manual, check the least
   // restrictive case of true. It would be nice if we had is_manual. We'll see.
@@ -32,6 +32,7 @@
 #include "omaha/base/string.h"
 #include "omaha/base/synchronized.h"
 #include "omaha/base/system_info.h"
+#include "omaha/base/tracing.h"
 #include "omaha/base/utils.h"
 #include "omaha/common/const_cmd_line.h"
 #include "omaha/common/const_goopdate.h"
@@ -167,6 +168,9 @@ HRESULT InstallerWrapper::InstallApp(HANDLE user_token,
                                      InstallerResultInfo* result_info) {
   ASSERT1(result_info);
 
+  TraceSpan span("InstallerWrapper::InstallApp");
+  span.set_app_id(app_guid);
+
   HRESULT hr = DoInstallApp(user_token,
                             app_guid,
                             installer_path,
@@ -352,6 +356,9 @@ HRESULT InstallerWrapper::ExecuteAndWaitForInstaller(
   ASSERT1(result_info);
   ASSERT1(num_tries_when_msi_busy_ >= 1);
 
+  TraceSpan span("InstallerWrapper::ExecuteAndWaitForInstaller");
+  span.set_app_id(app_guid);
+
   ++metric_worker_install_execute_total;
   if (MSI_INSTALLER == installer_type) {
     ++metric_worker_install_execute_msi_total;
@@ -0,0 +1,281 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/goopdate/metrics_endpoint.h"
+
+#include <atlsecurity.h>
+
+#include "omaha/base/constants.h"
+#include "omaha/base/debug.h"
+#include "omaha/base/error.h"
+#include "omaha/base/highres_timer-win32.h"
+#include "omaha/base/logging.h"
+#include "omaha/base/safe_format.h"
+#include "omaha/base/synchronized.h"
+#include "omaha/base/thread_pool.h"
+#include "omaha/base/utils.h"
+#include "omaha/common/stats_uploader.h"
+#include "omaha/goopdate/worker_metrics.h"
+#include "omaha/statsreport/metrics.h"
+#include "omaha/statsreport/prometheus_formatter.h"
+
+namespace omaha {
+
+namespace {
+
+const char kMetricPrefix[] = "omaha_";
+
+// The snapshots usually fit in the buffer of the pipe, so that writing them
+// does not wait for the clients to read them.
+const DWORD kPipeBufferSize = 64 * 1024;
+
+// How long a client may take to read its snapshot.
+const DWORD kClientTimeoutMs = 5000;
+
+// How long a snapshot waits for the metrics lock, which the process holding it
+// may keep while it uploads the metrics.
+const DWORD kMetricsLockTimeoutMs = 1000;
+
+// Creates an instance of the pipe which only writes to its clients. The
+// instances of the clients still reading their snapshots are kept until the
+// clients close them, so the number of instances is not limited.
+HANDLE CreatePipeInstance(const CString& pipe_name,
+                          bool is_first_instance,
+                          CSecurityAttributes* security_attributes) {
+  return ::CreateNamedPipe(pipe_name,
+                           PIPE_ACCESS_OUTBOUND |
+                           FILE_FLAG_OVERLAPPED |
+                           (is_first_instance ? FILE_FLAG_FIRST_PIPE_INSTANCE :
+                                                0),
+                           PIPE_TYPE_BYTE |
+                           PIPE_WAIT |
+                           PIPE_REJECT_REMOTE_CLIENTS,
+                           PIPE_UNLIMITED_INSTANCES,
+                           kPipeBufferSize,
+                           0,
+                           0,
+                           security_attributes);
+}
+
+}  // namespace
+
+MetricsEndpoint::MetricsEndpoint(bool is_machine, const ThreadPool* thread_pool)
+    : is_machine_(is_machine),
+      thread_pool_(thread_pool),
+      last_download_bytes_(metric_worker_download_bytes.value()),
+      last_snapshot_ticks_(HighresTimer::GetCurrentTicks()) {
+}
+
+MetricsEndpoint::~MetricsEndpoint() {
+  Stop();
+}
+
+CString MetricsEndpoint::GetPipeName(DWORD process_id) {
+  CString pipe_name;
+  SafeCStringFormat(&pipe_name,
+                    _T("\\\\.\\pipe\\") MAIN_EXE_BASE_NAME _T("Metrics.%u"),
+                    process_id);
+  return pipe_name;
+}
+
+HRESULT MetricsEndpoint::Start() {
+  ASSERT1(!thread_);
+
+  reset(stop_event_, ::CreateEvent(NULL, true, false, NULL));
+  if (!stop_event_) {
+    return HRESULTFromLastError();
+  }
+
+  reset(thread_, ::CreateThread(NULL, 0, &ThreadProc, this, 0, NULL));
+  if (!thread_) {
+    return HRESULTFromLastError();
+  }
+
+  return S_OK;
+}
+
+void MetricsEndpoint::Stop() {
+  if (!thread_) {
+    return;
+  }
+
+  VERIFY1(::SetEvent(get(stop_event_)));
+  VERIFY1(::WaitForSingleObject(get(thread_), INFINITE) == WAIT_OBJECT_0);
+  reset(thread_);
+}
+
+std::string MetricsEndpoint::GetSnapshot() {
+  // The metrics are not reset by an aggregation while the snapshot is taken,
+  // unless the lock can't be had in time.
+  GLock metrics_lock;
+  const bool is_locked =
+      InitializeMetricsLock(&metrics_lock, is_machine_) &&
+      metrics_lock.Lock(kMetricsLockTimeoutMs);
+  if (!is_locked) {
+    CORE_LOG(LW, (_T("[MetricsEndpoint::GetSnapshot][metrics not locked]")));
+  }
+
+  stats_report::PrometheusFormatter formatter(kMetricPrefix);
+
+  for (stats_report::MetricIterator it(stats_report::g_global_metrics), end;
+       it != end;
+       ++it) {
+    formatter.AddMetric(*it);
+  }
+
+  formatter.AddGauge("thread_pool_work_items",
+                     thread_pool_ ? thread_pool_->work_item_count() : 0);
+
+  // The count of the bytes starts over when the metrics are aggregated.
+  const int64 download_bytes = metric_worker_download_bytes.value();
+  const int64 received = download_bytes >= last_download_bytes_ ?
+                         download_bytes - last_download_bytes_ :
+                         download_bytes;
+  const ULONGLONG ticks = HighresTimer::GetCurrentTicks();
+  const ULONGLONG elapsed_ms = (ticks - last_snapshot_ticks_) * 1000 /
+                               HighresTimer::GetTimerFrequency();
+  formatter.AddGauge("download_bytes_per_second",
+                     elapsed_ms ? received * 1000 /
+                                  static_cast<int64>(elapsed_ms) : 0);
+  last_download_bytes_ = download_bytes;
+  last_snapshot_ticks_ = ticks;
+
+  if (is_locked) {
+    metrics_lock.Unlock();
+  }
+  return formatter.output();
+}
+
+DWORD WINAPI MetricsEndpoint::ThreadProc(void* param) {
+  ASSERT1(param);
+  static_cast<MetricsEndpoint*>(param)->Serve();
+  return 0;
+}
+
+void MetricsEndpoint::Serve() {
+  CSecurityAttributes security_attributes;
+  if (is_machine_) {
+    // The endpoint needs to create the instances after the first one.
+    GetAdminDaclSecurityAttributes(&security_attributes,
+                                   GENERIC_READ | FILE_CREATE_PIPE_INSTANCE);
+  } else if (!GetCurrentUserDefaultSecurityAttributes(&security_attributes)) {
+    CORE_LOG(LE, (_T("[GetCurrentUserDefaultSecurityAttributes failed]")));
+    return;
+  }
+
+  const CString pipe_name(GetPipeName(::GetCurrentProcessId()));
+  scoped_hfile pipe(CreatePipeInstance(pipe_name, true, &security_attributes));
+  if (!pipe) {
+    CORE_LOG(LE, (_T("[CreateNamedPipe failed][%s][0x%08x]"),
+                  pipe_name, HRESULTFromLastError()));
+    return;
+  }
+
+  scoped_event io_event(::CreateEvent(NULL, true, false, NULL));
+  if (!io_event) {
+    return;
+  }
+
+  CORE_LOG(L2, (_T("[MetricsEndpoint::Serve][%s]"), pipe_name));
+
+  for (;;) {
+    OVERLAPPED overlapped = {0};
+    overlapped.hEvent = get(io_event);
+    HRESULT hr = S_OK;
+    if (!::ConnectNamedPipe(get(pipe), &overlapped)) {
+      const DWORD error = ::GetLastError();
+      if (error == ERROR_IO_PENDING) {
+        hr = WaitForIo(get(pipe), &overlapped, INFINITE);
+      } else if (error != ERROR_PIPE_CONNECTED) {
+        hr = HRESULT_FROM_WIN32(error);
+      }
+    }
+    if (FAILED(hr)) {
+      if (hr != E_ABORT) {
+        CORE_LOG(LE, (_T("[ConnectNamedPipe failed][0x%08x]"), hr));
+      }
+      return;
+    }
+
+    // The next instance is created before the connected one is closed, so
+    // that the name of the pipe is never released.
+    scoped_hfile next_pipe(CreatePipeInstance(pipe_name,
+                                              false,
+                                              &security_attributes));
+    hr = WriteSnapshot(get(pipe), get(io_event));
+
+    // Closing the instance, rather than disconnecting it, lets the client
+    // read what is left of the snapshot before its reads fail.
+    reset(pipe, release(next_pipe));
+    if (hr == E_ABORT) {
+      return;
+    }
+    if (!pipe) {
+      CORE_LOG(LE, (_T("[CreateNamedPipe failed][%s]"), pipe_name));
+      return;
+    }
+  }
+}
+
+HRESULT MetricsEndpoint::WriteSnapshot(HANDLE pipe, HANDLE io_event) {
+  const std::string snapshot(GetSnapshot());
+
+  OVERLAPPED overlapped = {0};
+  overlapped.hEvent = io_event;
+  if (!::WriteFile(pipe,
+                   snapshot.c_str(),
+                   static_cast<DWORD>(snapshot.size()),
+                   NULL,
+                   &overlapped)) {
+    if (::GetLastError() != ERROR_IO_PENDING) {
+      return HRESULTFromLastError();
+    }
+    return WaitForIo(pipe, &overlapped, kClientTimeoutMs);
+  }
+  return S_OK;
+}
+
+HRESULT MetricsEndpoint::WaitForIo(HANDLE pipe,
+                                   OVERLAPPED* overlapped,
+                                   DWORD timeout_ms) {
+  ASSERT1(overlapped);
+
+  HANDLE handles[] = { overlapped->hEvent, get(stop_event_) };
+  const DWORD result = ::WaitForMultipleObjects(
+                           static_cast<DWORD>(arraysize(handles)),
+                           handles,
+                           false,
+                           timeout_ms);
+
+  HRESULT hr = S_OK;
+  if (result == WAIT_OBJECT_0 + 1) {
+    hr = E_ABORT;
+  } else if (result == WAIT_TIMEOUT) {
+    hr = HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+  } else if (result != WAIT_OBJECT_0) {
+    hr = HRESULTFromLastError();
+  }
+
+  if (FAILED(hr)) {
+    ::CancelIo(pipe);
+  }
+
+  // The I/O must be complete before |overlapped| goes out of scope.
+  DWORD bytes = 0;
+  ::GetOverlappedResult(pipe, overlapped, &bytes, true);
+  return hr;
+}
+
+}  // namespace omaha
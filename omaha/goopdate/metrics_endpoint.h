@@ -0,0 +1,98 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Serves a snapshot of the metrics of a live process, in the Prometheus text
+// format, to the local clients which connect to the named pipe
+// \\.\pipe\GoogleUpdateMetrics.<pid>. For instance:
+//   type \\.\pipe\GoogleUpdateMetrics.1234
+// The snapshot has the current values of all the metrics of the process, since
+// they were last aggregated, and the number of work items in the thread pool
+// and the download rate. The pipe is outbound only, so the clients can only
+// read it, and only the admins and the system can connect to the pipe of a
+// machine process.
+//
+// The snapshot is built from the values the metrics keep for themselves, so it
+// costs little more than the formatting of the text, and can be taken every
+// few seconds. It holds the metrics lock of the machine or user, so that the
+// process does not reset its metrics as they are aggregated in the middle of
+// a snapshot. If the lock is held for too long by another process, the
+// snapshot is taken without it, and is then only consistent per metric: some
+// of the metrics may have been reset and others not.
+
+#ifndef OMAHA_GOOPDATE_METRICS_ENDPOINT_H_
+#define OMAHA_GOOPDATE_METRICS_ENDPOINT_H_
+
+#include <windows.h>
+#include <atlstr.h>
+#include <string>
+
+#include "base/basictypes.h"
+#include "omaha/third_party/smartany/scoped_any.h"
+
+namespace omaha {
+
+class ThreadPool;
+
+class MetricsEndpoint {
+ public:
+  // |thread_pool| is not owned and may be NULL. It must outlive the endpoint.
+  MetricsEndpoint(bool is_machine, const ThreadPool* thread_pool);
+
+  // Stops the endpoint.
+  ~MetricsEndpoint();
+
+  // Starts serving the snapshots on a thread of the endpoint.
+  HRESULT Start();
+
+  // Stops serving the snapshots, and waits for the thread of the endpoint to
+  // exit. The client being served, if any, is disconnected.
+  void Stop();
+
+  // Returns the snapshot written to the clients. The download rate is
+  // averaged over the time since the previous snapshot. Waits for the
+  // aggregation of the metrics, if any, to complete.
+  std::string GetSnapshot();
+
+  static CString GetPipeName(DWORD process_id);
+
+ private:
+  static DWORD WINAPI ThreadProc(void* param);
+
+  void Serve();
+
+  // Waits up to |timeout_ms| for the I/O of |overlapped| on |pipe| to
+  // complete. Cancels the I/O and returns E_ABORT if the endpoint is stopped
+  // first, or the timeout error if it times out.
+  HRESULT WaitForIo(HANDLE pipe, OVERLAPPED* overlapped, DWORD timeout_ms);
+
+  // Writes a snapshot to the client connected to |pipe|.
+  HRESULT WriteSnapshot(HANDLE pipe, HANDLE io_event);
+
+  const bool is_machine_;
+  const ThreadPool* const thread_pool_;
+
+  scoped_event stop_event_;
+  scoped_handle thread_;
+
+  // The bytes downloaded, and the ticks, as of the previous snapshot.
+  int64 last_download_bytes_;
+  ULONGLONG last_snapshot_ticks_;
+
+  DISALLOW_COPY_AND_ASSIGN(MetricsEndpoint);
+};
+
+}  // namespace omaha
+
+#endif  // OMAHA_GOOPDATE_METRICS_ENDPOINT_H_
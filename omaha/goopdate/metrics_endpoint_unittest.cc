@@ -0,0 +1,191 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/goopdate/metrics_endpoint.h"
+
+#include <stdlib.h>
+#include <string>
+
+#include "omaha/base/constants.h"
+#include "omaha/base/synchronized.h"
+#include "omaha/common/stats_uploader.h"
+#include "omaha/goopdate/worker_metrics.h"
+#include "omaha/statsreport/metrics.h"
+#include "omaha/testing/unit_test.h"
+
+namespace omaha {
+
+namespace {
+
+const char kBytesPerSecond[] = "omaha_download_bytes_per_second ";
+
+int GetBytesPerSecond(const std::string& snapshot) {
+  const size_t pos = snapshot.find(kBytesPerSecond);
+  if (pos == std::string::npos) {
+    return -1;
+  }
+  return atoi(snapshot.c_str() + pos + arraysize(kBytesPerSecond) - 1);
+}
+
+// Connects to the endpoint of this process, and reads until the endpoint
+// closes the pipe.
+std::string ReadSnapshot() {
+  const CString pipe_name(
+      MetricsEndpoint::GetPipeName(::GetCurrentProcessId()));
+
+  scoped_hfile pipe;
+  for (int i = 0; i < 100 && !valid(pipe); ++i) {
+    reset(pipe, ::CreateFile(pipe_name,
+                             GENERIC_READ,
+                             0,
+                             NULL,
+                             OPEN_EXISTING,
+                             0,
+                             NULL));
+    if (!valid(pipe)) {
+      ::Sleep(10);
+    }
+  }
+  EXPECT_TRUE(valid(pipe));
+
+  std::string snapshot;
+  char buffer[1024] = {0};
+  DWORD bytes_read = 0;
+  while (::ReadFile(get(pipe), buffer, sizeof(buffer), &bytes_read, NULL) &&
+         bytes_read) {
+    snapshot.append(buffer, bytes_read);
+  }
+  EXPECT_EQ(static_cast<DWORD>(ERROR_BROKEN_PIPE), ::GetLastError());
+  return snapshot;
+}
+
+// Holds the metrics lock of the user until |param|, an event, is signaled.
+DWORD WINAPI HoldMetricsLock(void* param) {
+  GLock metrics_lock;
+  EXPECT_TRUE(InitializeMetricsLock(&metrics_lock, false));
+  EXPECT_TRUE(metrics_lock.Lock());
+  ::WaitForSingleObject(static_cast<HANDLE>(param), INFINITE);
+  EXPECT_TRUE(metrics_lock.Unlock());
+  return 0;
+}
+
+}  // namespace
+
+class MetricsEndpointTest : public testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    stats_report::g_global_metrics.Initialize();
+  }
+
+  static void TearDownTestCase() {
+    // The global metrics collection must be uninitialized before the metrics
+    // destructors are called.
+    stats_report::g_global_metrics.Uninitialize();
+  }
+};
+
+TEST_F(MetricsEndpointTest, GetPipeName) {
+  EXPECT_STREQ(_T("\\\\.\\pipe\\") MAIN_EXE_BASE_NAME _T("Metrics.1234"),
+               MetricsEndpoint::GetPipeName(1234));
+}
+
+TEST_F(MetricsEndpointTest, GetSnapshot) {
+  MetricsEndpoint endpoint(false, NULL);
+  const std::string snapshot(endpoint.GetSnapshot());
+
+  EXPECT_EQ(0u, snapshot.find("# TYPE omaha_"));
+  EXPECT_NE(std::string::npos,
+            snapshot.find("# TYPE omaha_worker_download_bytes counter\n"));
+  EXPECT_NE(std::string::npos,
+            snapshot.find("# TYPE omaha_worker_downloads_active gauge\n"));
+  EXPECT_NE(std::string::npos,
+            snapshot.find("# TYPE omaha_thread_pool_work_items gauge\n"
+                          "omaha_thread_pool_work_items 0\n"));
+  EXPECT_NE(-1, GetBytesPerSecond(snapshot));
+}
+
+// The rate is the bytes downloaded since the previous snapshot.
+TEST_F(MetricsEndpointTest, GetSnapshot_DownloadRate) {
+  MetricsEndpoint endpoint(false, NULL);
+
+  metric_worker_download_bytes += 1000;
+  ::Sleep(100);
+  const int bytes_per_second = GetBytesPerSecond(endpoint.GetSnapshot());
+  EXPECT_LT(0, bytes_per_second);
+  EXPECT_GE(10000, bytes_per_second);
+
+  EXPECT_EQ(0, GetBytesPerSecond(endpoint.GetSnapshot()));
+}
+
+// The count of the bytes is reset when the metrics are aggregated.
+TEST_F(MetricsEndpointTest, GetSnapshot_DownloadBytesReset) {
+  metric_worker_download_bytes += 1000;
+  MetricsEndpoint endpoint(false, NULL);
+
+  metric_worker_download_bytes.Reset();
+  metric_worker_download_bytes += 10;
+  ::Sleep(10);
+  const int bytes_per_second = GetBytesPerSecond(endpoint.GetSnapshot());
+  EXPECT_LT(0, bytes_per_second);
+  EXPECT_GE(1000, bytes_per_second);
+}
+
+// The snapshot is still taken when the metrics lock is held for too long.
+TEST_F(MetricsEndpointTest, GetSnapshot_MetricsLocked) {
+  scoped_event release_event(::CreateEvent(NULL, true, false, NULL));
+  ASSERT_TRUE(valid(release_event));
+  scoped_handle thread(::CreateThread(NULL,
+                                      0,
+                                      &HoldMetricsLock,
+                                      get(release_event),
+                                      0,
+                                      NULL));
+  ASSERT_TRUE(valid(thread));
+
+  // Waits for the thread to take the lock.
+  GLock metrics_lock;
+  ASSERT_TRUE(InitializeMetricsLock(&metrics_lock, false));
+  while (metrics_lock.Lock(0)) {
+    EXPECT_TRUE(metrics_lock.Unlock());
+    ::Sleep(10);
+  }
+
+  MetricsEndpoint endpoint(false, NULL);
+  EXPECT_NE(-1, GetBytesPerSecond(endpoint.GetSnapshot()));
+
+  EXPECT_TRUE(::SetEvent(get(release_event)));
+  EXPECT_EQ(WAIT_OBJECT_0, ::WaitForSingleObject(get(thread), INFINITE));
+}
+
+TEST_F(MetricsEndpointTest, Serve) {
+  MetricsEndpoint endpoint(false, NULL);
+  ASSERT_SUCCEEDED(endpoint.Start());
+
+  const std::string snapshot(ReadSnapshot());
+  EXPECT_EQ(0u, snapshot.find("# TYPE omaha_"));
+  EXPECT_NE(-1, GetBytesPerSecond(snapshot));
+
+  // The endpoint keeps serving after its first client.
+  EXPECT_NE(-1, GetBytesPerSecond(ReadSnapshot()));
+
+  endpoint.Stop();
+}
+
+TEST_F(MetricsEndpointTest, Stop_NotStarted) {
+  MetricsEndpoint endpoint(false, NULL);
+  endpoint.Stop();
+}
+
+}  // namespace omaha
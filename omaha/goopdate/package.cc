@@ -21,6 +21,7 @@
 #include "omaha/base/time.h"
 #include "omaha/base/utils.h"
 #include "omaha/goopdate/model.h"
+#include "omaha/goopdate/worker_metrics.h"
 
 namespace omaha {
 
@@ -100,6 +101,11 @@ void Package::OnProgress(int bytes,
   //         bytes_total == static_cast<int>(expected_size_));
   ASSERT1(bytes <= bytes_total);
 
+  // The progress of a request is the total of the bytes it received so far.
+  if (bytes > bytes_downloaded_) {
+    metric_worker_download_bytes += bytes - bytes_downloaded_;
+  }
+
   bytes_downloaded_ = bytes;
   bytes_total_ = bytes_total;
 
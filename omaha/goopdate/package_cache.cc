@@ -22,11 +22,14 @@
 #include "omaha/base/debug.h"
 #include "omaha/base/error.h"
 #include "omaha/base/file.h"
+#include "omaha/base/highres_timer-win32.h"
 #include "omaha/base/logging.h"
 #include "omaha/base/path.h"
 #include "omaha/base/string.h"
 #include "omaha/base/signatures.h"
 #include "omaha/base/signaturevalidator.h"
+#include "omaha/base/time.h"
+#include "omaha/base/tracing.h"
 #include "omaha/base/utils.h"
 #include "omaha/common/config_manager.h"
 #include "omaha/goopdate/package_cache_internal.h"
@@ -141,47 +144,44 @@ void SortPackageInfoByTime(std::vector<PackageInfo>* packages_info) {
             PackageSortByTimePredicate);
 }
 
-HRESULT FileCopy(File* source_file, const CString& destination) {
-  ASSERT1(source_file);
+}  // namespace internal
 
-  File destination_file;
-  HRESULT hr = destination_file.Open(destination, true, false);
-  if (FAILED(hr)) {
-    return hr;
+namespace {
+
+// The packages being put in the cache are staged as files in the cache root,
+// which is on the same volume as the cache entries but is not enumerated for
+// packages.
+const TCHAR kStagingFilePrefix[] = _T("put");
+
+void SetTraceAppId(const PackageCache::Key& key, TraceSpan* span) {
+  GUID app_id = GUID_NULL;
+  if (span->is_recording() &&
+      SUCCEEDED(StringToGuidSafe(key.app_id(), &app_id))) {
+    span->set_app_id(app_id);
   }
+}
 
-  hr = source_file->SeekToBegin();
-  if (FAILED(hr)) {
-    return hr;
+// Deletes the files staged in |cache_root| more than a day ago, which were
+// left behind by processes which did not complete their Put.
+void DeleteStaleStagingFiles(const CString& cache_root) {
+  WIN32_FIND_DATA find_data = {0};
+  scoped_hfind hfind(::FindFirstFile(
+      ConcatenatePath(cache_root, kStagingFilePrefix) + _T("*.tmp"),
+      &find_data));
+  if (!hfind) {
+    return;
   }
 
-  byte buffer[4096] = {};
-  uint32 bytes_read = 0;
+  const time64 now = GetCurrent100NSTime();
   do {
-    hr = source_file->Read(arraysize(buffer), buffer, &bytes_read);
-    if (FAILED(hr)) {
-      return hr;
-    }
-
-    if (!bytes_read) {
-      return S_OK;
+    if (internal::IsFileFindData(find_data) &&
+        FileTimeToTime64(find_data.ftCreationTime) + kDaysTo100ns < now) {
+      ::DeleteFile(ConcatenatePath(cache_root, find_data.cFileName));
     }
-
-    uint32 bytes_written(0);
-    hr = destination_file.Write(buffer, bytes_read, &bytes_written);
-    if (FAILED(hr)) {
-      return hr;
-    }
-
-    if (bytes_written != bytes_read) {
-      return E_UNEXPECTED;
-    }
-  } while (bytes_read > 0);
-
-  return S_OK;
+  } while (::FindNextFile(get(hfind), &find_data));
 }
 
-}  // namespace internal
+}  // namespace
 
 PackageCache::PackageCache() {
   cache_time_limit_days_ =
@@ -237,8 +237,8 @@ HRESULT PackageCache::Put(const Key& key,
   ++metric_worker_package_cache_put_total;
   CORE_LOG(L3, (_T("[PackageCache::Put][key '%s'][hash %s]"),
                 key.ToString(), hash));
-
-  __mutexScope(cache_lock_);
+  TraceSpan span("PackageCache::Put");
+  SetTraceAppId(key, &span);
 
   if (key.app_id().IsEmpty() || key.version().IsEmpty() ||
       key.package_name().IsEmpty() ) {
@@ -246,35 +246,62 @@ HRESULT PackageCache::Put(const Key& key,
   }
 
   CString destination_file;
-  HRESULT hr = BuildCacheFileNameForKey(key, &destination_file);
-  CORE_LOG(L3, (_T("[destination file '%s']"), destination_file));
-  if (FAILED(hr)) {
-    return hr;
-  }
+  CString staging_file;
+  HRESULT hr = E_FAIL;
+  {
+    __mutexScope(cache_lock_);
 
-  hr = CreateDir(GetDirectoryFromPath(destination_file), NULL);
-  if (FAILED(hr)) {
-    CORE_LOG(LE, (_T("[failed to create cache directory][0x%08x][%s]"),
-                  hr, destination_file));
-    return hr;
+    hr = BuildCacheFileNameForKey(key, &destination_file);
+    CORE_LOG(L3, (_T("[destination file '%s']"), destination_file));
+    if (FAILED(hr)) {
+      return hr;
+    }
+
+    staging_file = GetTempFilenameAt(cache_root_, kStagingFilePrefix);
+    if (staging_file.IsEmpty()) {
+      hr = HRESULTFromLastError();
+      CORE_LOG(LE, (_T("[GetTempFilenameAt failed][0x%08x]"), hr));
+      return hr;
+    }
   }
 
   // TODO(omaha): consider not overwriting the file if the file is
   // in the cache and it is valid.
 
-  hr = internal::FileCopy(source_file, destination_file);
+  // The copy is hashed as it is written, and staged outside of the cache
+  // entries, where the purge does not see it. So it runs without the cache
+  // lock, and several packages can be put at the same time. Only a copy
+  // whose hash matches is moved into the cache, so a bad package never
+  // replaces a cached one.
+  HighresTimer copy_timer;
+  hr = CopyFileAndVerifyHashSha256(source_file->file_name(),
+                                   staging_file,
+                                   hash);
+  CORE_LOG(L3, (_T("[copied and verified][0x%08x][%d ms]"),
+                hr, copy_timer.GetElapsedMs()));
   if (FAILED(hr)) {
-    CORE_LOG(LE, (_T("[failed to copy file to cache][0x%08x][%s]"),
-                  hr, destination_file));
+    CORE_LOG(LE, (_T("[failed to copy file to cache][0x%08x][%s]")
+                  _T("[expected hash %s]"), hr, destination_file, hash));
+    ::DeleteFile(staging_file);
     return hr;
   }
 
-  hr = VerifyHash(destination_file, hash);
+  {
+    __mutexScope(cache_lock_);
+
+    // The directory is created under the lock, since the directories of the
+    // versions can be purged while the package is copied.
+    hr = CreateDir(GetDirectoryFromPath(destination_file), NULL);
+    if (SUCCEEDED(hr) && !::MoveFileEx(staging_file,
+                                       destination_file,
+                                       MOVEFILE_REPLACE_EXISTING)) {
+      hr = HRESULTFromLastError();
+    }
+  }
   if (FAILED(hr)) {
-    CORE_LOG(LE,
-        (_T("[failed to verify hash for file '%s'][expected hash %s]"),
-        destination_file, hash));
-    VERIFY1(::DeleteFile(destination_file));
+    CORE_LOG(LE, (_T("[failed to move file to cache][0x%08x][%s]"),
+                  hr, destination_file));
+    ::DeleteFile(staging_file);
     return hr;
   }
 
@@ -287,6 +314,8 @@ HRESULT PackageCache::Get(const Key& key,
                           const CString& hash) const {
   CORE_LOG(L3, (_T("[PackageCache::Get][key '%s'][dest file '%s'][hash '%s']"),
       key.ToString(), destination_file, hash));
+  TraceSpan span("PackageCache::Get");
+  SetTraceAppId(key, &span);
 
   __mutexScope(cache_lock_);
 
@@ -430,6 +459,8 @@ FILETIME PackageCache::GetCacheExpirationTime() const {
 HRESULT PackageCache::PurgeOldPackagesIfNecessary() const {
   __mutexScope(cache_lock_);
 
+  DeleteStaleStagingFiles(cache_root_);
+
   std::vector<internal::PackageInfo> packages_info;
   HRESULT hr = internal::FindAllPackagesInfo(cache_root_, &packages_info);
 
@@ -19,6 +19,7 @@
 #include "omaha/base/path.h"
 #include "omaha/base/safe_format.h"
 #include "omaha/base/string.h"
+#include "omaha/base/time.h"
 #include "omaha/base/utils.h"
 #include "omaha/goopdate/package_cache.h"
 #include "omaha/testing/unit_test.h"
@@ -528,6 +529,52 @@ TEST_F(PackageCacheTest, PurgeExpiredCacheFiles) {
   EXPECT_FALSE(package_cache_.IsCached(key2, hash_file2_));
 }
 
+// The packages are staged in the cache root while they are put, where the
+// purge does not count them as packages. The staged files left behind for
+// more than a day are deleted by the purge.
+TEST_F(PackageCacheTest, PurgeOldPackagesWithStagingFiles) {
+  EXPECT_HRESULT_SUCCEEDED(package_cache_.PurgeAll());
+  SetCacheSizeLimitMB(1);
+
+  Key key1(_T("app1"), _T("version1"), _T("package1"));
+  EXPECT_HRESULT_SUCCEEDED(package_cache_.Put(key1,
+                                              &source_file1_file_,
+                                              hash_file1_));
+  EXPECT_EQ(size_file1_, package_cache_.Size());
+
+  const CString staging_file(ConcatenatePath(cache_root_, _T("put1.tmp")));
+  const CString stale_staging_file(ConcatenatePath(cache_root_,
+                                                   _T("put2.tmp")));
+  EXPECT_HRESULT_SUCCEEDED(File::Copy(source_file1_, staging_file, true));
+  EXPECT_HRESULT_SUCCEEDED(File::Copy(source_file2_, stale_staging_file, true));
+
+  FILETIME stale_time = {0};
+  Time64ToFileTime(GetCurrent100NSTime() - 2 * kDaysTo100ns, &stale_time);
+  EXPECT_HRESULT_SUCCEEDED(File::SetFileTime(stale_staging_file,
+                                             &stale_time,
+                                             &stale_time,
+                                             &stale_time));
+
+  package_cache_.PurgeOldPackagesIfNecessary();
+
+  EXPECT_TRUE(package_cache_.IsCached(key1, hash_file1_));
+  EXPECT_TRUE(File::Exists(staging_file));
+  EXPECT_FALSE(File::Exists(stale_staging_file));
+}
+
+// A failed put leaves nothing behind in the cache.
+TEST_F(PackageCacheTest, PutBadHash_NoStagingFile) {
+  EXPECT_HRESULT_SUCCEEDED(package_cache_.PurgeAll());
+
+  Key key1(_T("app1"), _T("ver1"), _T("package1"));
+  CString bad_hash =
+      _T("0000bad0000364f6c33161d781b49d840ed792b8b10668c4180b9e6e128d0bc9");
+  EXPECT_EQ(SIGS_E_INVALID_SIGNATURE, package_cache_.Put(key1,
+                                                         &source_file1_file_,
+                                                         bad_hash));
+  EXPECT_EQ(0, package_cache_.Size());
+}
+
 TEST_F(PackageCacheTest, VerifyHash) {
   EXPECT_HRESULT_SUCCEEDED(PackageCache::VerifyHash(source_file1_,
                                                     hash_file1_));
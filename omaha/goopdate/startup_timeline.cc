@@ -0,0 +1,152 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/goopdate/startup_timeline.h"
+
+#include "omaha/base/debug.h"
+#include "omaha/base/highres_timer-win32.h"
+#include "omaha/base/logging.h"
+#include "omaha/base/safe_format.h"
+#include "omaha/base/time.h"
+#include "omaha/goopdate/goopdate_metrics.h"
+
+namespace omaha {
+
+namespace {
+
+const TCHAR* const kPhaseNames[] = {
+  _T("main"),
+  _T("command line parsed"),
+  _T("resources loaded"),
+  _T("mode started"),
+  _T("worker initialized"),
+  _T("update check sent"),
+  _T("update check complete"),
+};
+
+COMPILE_ASSERT(arraysize(kPhaseNames) == STARTUP_PHASE_MAX,
+               phase_names_mismatch);
+
+stats_report::TimingMetric* const kPhaseMetrics[] = {
+  &metric_startup_main_ms,
+  &metric_startup_command_line_parsed_ms,
+  &metric_startup_resources_loaded_ms,
+  &metric_startup_mode_started_ms,
+  &metric_startup_worker_initialized_ms,
+  &metric_startup_update_check_sent_ms,
+  &metric_startup_update_check_complete_ms,
+};
+
+COMPILE_ASSERT(arraysize(kPhaseMetrics) == STARTUP_PHASE_MAX,
+               phase_metrics_mismatch);
+
+// The timeline of this process. It is constructed when the module is loaded,
+// which is before any phase is reached.
+StartupTimeline process_timeline;
+
+volatile LONG is_reported = 0;
+
+}  // namespace
+
+StartupTimeline::StartupTimeline() {
+  const ULONGLONG now_ticks = HighresTimer::GetCurrentTicks();
+  process_start_ticks_ = now_ticks;
+
+  // The creation time of the process is only available as a system time, so
+  // the time the process has run so far is measured against the system time,
+  // once, and the phases are timed from there with the high resolution timer.
+  FILETIME creation_time = {0};
+  FILETIME exit_time = {0};
+  FILETIME kernel_time = {0};
+  FILETIME user_time = {0};
+  if (::GetProcessTimes(::GetCurrentProcess(),
+                        &creation_time,
+                        &exit_time,
+                        &kernel_time,
+                        &user_time)) {
+    const time64 created = FileTimeToTime64(creation_time);
+    const time64 now = GetCurrent100NSTime();
+    if (now > created) {
+      const ULONGLONG run_ticks = (now - created) / kMillisecsTo100ns *
+                                  HighresTimer::GetTimerFrequency() / 1000;
+      if (run_ticks < now_ticks) {
+        process_start_ticks_ = now_ticks - run_ticks;
+      }
+    }
+  }
+
+  for (int i = 0; i != STARTUP_PHASE_MAX; ++i) {
+    phase_ms_[i] = -1;
+  }
+}
+
+void StartupTimeline::Mark(StartupPhase phase) {
+  ASSERT1(phase >= 0 && phase < STARTUP_PHASE_MAX);
+
+  const ULONGLONG ticks =
+      HighresTimer::GetCurrentTicks() - process_start_ticks_;
+  const ULONGLONG ms = ticks * 1000 / HighresTimer::GetTimerFrequency();
+  ::InterlockedCompareExchange(&phase_ms_[phase],
+                               static_cast<LONG>(ms),
+                               -1);
+}
+
+int StartupTimeline::GetPhaseMs(StartupPhase phase) const {
+  ASSERT1(phase >= 0 && phase < STARTUP_PHASE_MAX);
+  return phase_ms_[phase];
+}
+
+CString StartupTimeline::ToString() const {
+  CString timeline;
+  for (int i = 0; i != STARTUP_PHASE_MAX; ++i) {
+    const StartupPhase phase = static_cast<StartupPhase>(i);
+    const int ms = GetPhaseMs(phase);
+    if (ms >= 0) {
+      SafeCStringAppendFormat(&timeline, _T("[%s %d ms]"),
+                              GetPhaseName(phase), ms);
+    }
+  }
+  return timeline;
+}
+
+const TCHAR* StartupTimeline::GetPhaseName(StartupPhase phase) {
+  ASSERT1(phase >= 0 && phase < STARTUP_PHASE_MAX);
+  return kPhaseNames[phase];
+}
+
+namespace startup_timeline {
+
+void Mark(StartupPhase phase) {
+  process_timeline.Mark(phase);
+}
+
+void Report() {
+  if (::InterlockedExchange(&is_reported, 1)) {
+    return;
+  }
+
+  OPT_LOG(L1, (_T("[Startup timeline]%s"), process_timeline.ToString()));
+
+  for (int i = 0; i != STARTUP_PHASE_MAX; ++i) {
+    const int ms = process_timeline.GetPhaseMs(static_cast<StartupPhase>(i));
+    if (ms >= 0) {
+      kPhaseMetrics[i]->AddSample(ms);
+    }
+  }
+}
+
+}  // namespace startup_timeline
+
+}  // namespace omaha
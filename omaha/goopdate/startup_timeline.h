@@ -0,0 +1,85 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Records when a goopdate process reaches the phases of its startup, up to
+// its first update check, so that the time the processes take to start can
+// be measured in the field. The time of a phase is the time it is first
+// reached, in milliseconds since the process was created. The times are
+// taken from the high resolution timer, so they are not affected by changes
+// to the system time.
+
+#ifndef OMAHA_GOOPDATE_STARTUP_TIMELINE_H_
+#define OMAHA_GOOPDATE_STARTUP_TIMELINE_H_
+
+#include <windows.h>
+#include <atlstr.h>
+
+#include "base/basictypes.h"
+
+namespace omaha {
+
+enum StartupPhase {
+  STARTUP_PHASE_MAIN = 0,               // GoopdateImpl::Main is called.
+  STARTUP_PHASE_COMMAND_LINE_PARSED,
+  STARTUP_PHASE_RESOURCES_LOADED,
+  STARTUP_PHASE_MODE_STARTED,           // The mode is about to be executed.
+  STARTUP_PHASE_WORKER_INITIALIZED,
+  STARTUP_PHASE_UPDATE_CHECK_SENT,      // The update check is being sent.
+  STARTUP_PHASE_UPDATE_CHECK_COMPLETE,
+
+  STARTUP_PHASE_MAX,
+};
+
+class StartupTimeline {
+ public:
+  StartupTimeline();
+
+  // Records the time |phase| is reached, unless it was reached before. Can
+  // be called from any thread.
+  void Mark(StartupPhase phase);
+
+  // Returns the time |phase| was reached, in milliseconds since the process
+  // was created, or -1 if the phase was not reached.
+  int GetPhaseMs(StartupPhase phase) const;
+
+  // Returns the phases reached, as "[name ms]" for each, in order.
+  CString ToString() const;
+
+  static const TCHAR* GetPhaseName(StartupPhase phase);
+
+ private:
+  // The ticks of the high resolution timer when the process was created.
+  ULONGLONG process_start_ticks_;
+
+  volatile LONG phase_ms_[STARTUP_PHASE_MAX];
+
+  DISALLOW_COPY_AND_ASSIGN(StartupTimeline);
+};
+
+namespace startup_timeline {
+
+// Records the time |phase| is reached in the timeline of this process.
+void Mark(StartupPhase phase);
+
+// Writes the timeline of this process to the log, and adds the time of each
+// phase reached to its metric. Does nothing after the first call, so that
+// the metrics of a process are only sampled once.
+void Report();
+
+}  // namespace startup_timeline
+
+}  // namespace omaha
+
+#endif  // OMAHA_GOOPDATE_STARTUP_TIMELINE_H_
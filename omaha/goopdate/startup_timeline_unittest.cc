@@ -0,0 +1,71 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/goopdate/startup_timeline.h"
+#include "omaha/base/safe_format.h"
+#include "omaha/testing/unit_test.h"
+
+namespace omaha {
+
+TEST(StartupTimelineTest, NotReached) {
+  StartupTimeline timeline;
+  for (int i = 0; i != STARTUP_PHASE_MAX; ++i) {
+    EXPECT_EQ(-1, timeline.GetPhaseMs(static_cast<StartupPhase>(i)));
+  }
+  EXPECT_STREQ(_T(""), timeline.ToString());
+}
+
+TEST(StartupTimelineTest, Mark) {
+  StartupTimeline timeline;
+
+  timeline.Mark(STARTUP_PHASE_MAIN);
+  const int main_ms = timeline.GetPhaseMs(STARTUP_PHASE_MAIN);
+  EXPECT_LE(0, main_ms);
+
+  ::Sleep(20);
+  timeline.Mark(STARTUP_PHASE_RESOURCES_LOADED);
+  const int resources_loaded_ms =
+      timeline.GetPhaseMs(STARTUP_PHASE_RESOURCES_LOADED);
+  EXPECT_LE(main_ms + 10, resources_loaded_ms);
+
+  EXPECT_EQ(-1, timeline.GetPhaseMs(STARTUP_PHASE_COMMAND_LINE_PARSED));
+
+  CString expected;
+  SafeCStringFormat(&expected, _T("[main %d ms][resources loaded %d ms]"),
+                    main_ms, resources_loaded_ms);
+  EXPECT_STREQ(expected, timeline.ToString());
+}
+
+// Only the first time a phase is reached is recorded.
+TEST(StartupTimelineTest, Mark_Again) {
+  StartupTimeline timeline;
+
+  timeline.Mark(STARTUP_PHASE_UPDATE_CHECK_SENT);
+  const int ms = timeline.GetPhaseMs(STARTUP_PHASE_UPDATE_CHECK_SENT);
+
+  ::Sleep(20);
+  timeline.Mark(STARTUP_PHASE_UPDATE_CHECK_SENT);
+  EXPECT_EQ(ms, timeline.GetPhaseMs(STARTUP_PHASE_UPDATE_CHECK_SENT));
+}
+
+// The phases are timed from the creation of the process, which the test
+// process was created well before.
+TEST(StartupTimelineTest, TimedFromProcessCreation) {
+  StartupTimeline timeline;
+  timeline.Mark(STARTUP_PHASE_MAIN);
+  EXPECT_LT(0, timeline.GetPhaseMs(STARTUP_PHASE_MAIN));
+}
+
+}  // namespace omaha
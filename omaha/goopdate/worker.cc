@@ -19,6 +19,8 @@
 #include <atlbase.h>
 #include <atlstr.h>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include "omaha/base/app_util.h"
 #include "omaha/base/const_object_names.h"
@@ -35,6 +37,7 @@
 #include "omaha/base/system.h"
 #include "omaha/base/utils.h"
 #include "omaha/base/thread_pool_callback.h"
+#include "omaha/base/tracing.h"
 #include "omaha/base/vistautil.h"
 #include "omaha/common/app_registry_utils.h"
 #include "omaha/common/config_manager.h"
@@ -52,6 +55,7 @@
 #include "omaha/goopdate/model.h"
 #include "omaha/goopdate/offline_utils.h"
 #include "omaha/goopdate/server_resource.h"
+#include "omaha/goopdate/startup_timeline.h"
 #include "omaha/goopdate/string_formatter.h"
 #include "omaha/goopdate/update_request_utils.h"
 #include "omaha/goopdate/update_response_utils.h"
@@ -231,6 +235,155 @@ void SendCupFailurePing(bool is_machine,
   }
 }
 
+namespace {
+
+// Copies offline packages into the package cache on a few threads. Each thread
+// takes the next package left, so that a large package does not hold up the
+// others. No package is started once one has failed.
+class OfflinePackageCacher {
+ public:
+  OfflinePackageCacher(DownloadManagerInterface* download_manager,
+                       std::vector<OfflinePackage>* packages)
+      : download_manager_(download_manager),
+        packages_(packages),
+        next_(0),
+        failed_(0) {
+    ASSERT1(download_manager_);
+    ASSERT1(packages_);
+  }
+
+  // Returns the number of threads used, the calling thread included.
+  int Run(int num_threads) {
+    std::vector<HANDLE> threads;
+    for (int i = 1; i < num_threads; ++i) {
+      HANDLE thread = ::CreateThread(NULL, 0, &ThreadProc, this, 0, NULL);
+      if (!thread) {
+        CORE_LOG(LW, (_T("[CreateThread failed][%u]"), ::GetLastError()));
+        break;
+      }
+      threads.push_back(thread);
+    }
+
+    CachePackages();
+
+    for (size_t i = 0; i != threads.size(); ++i) {
+      ::WaitForSingleObject(threads[i], INFINITE);
+      ::CloseHandle(threads[i]);
+    }
+    return static_cast<int>(threads.size()) + 1;
+  }
+
+ private:
+  static DWORD WINAPI ThreadProc(void* param) {
+    static_cast<OfflinePackageCacher*>(param)->CachePackages();
+    return 0;
+  }
+
+  void CachePackages() {
+    for (;;) {
+      const LONG i = ::InterlockedIncrement(&next_) - 1;
+      if (failed_ || i >= static_cast<LONG>(packages_->size())) {
+        return;
+      }
+      OfflinePackage* offline_package = &(*packages_)[i];
+      offline_package->hr = CachePackage(offline_package);
+      if (FAILED(offline_package->hr)) {
+        ::InterlockedExchange(&failed_, 1);
+      }
+    }
+  }
+
+  HRESULT CachePackage(OfflinePackage* offline_package) {
+    HighresTimer timer;
+
+    File file;
+    HRESULT hr = file.OpenShareMode(offline_package->path,
+                                    false,
+                                    false,
+                                    FILE_SHARE_READ);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    uint32 size = 0;
+    if (SUCCEEDED(file.GetLength(&size))) {
+      offline_package->size = size;
+    }
+
+    hr = download_manager_->CachePackage(offline_package->package,
+                                         &file,
+                                         &offline_package->path,
+                                         &offline_package->extra_code1);
+    offline_package->elapsed_ms = timer.GetElapsedMs();
+    CORE_LOG(L3, (_T("[Cached offline package][%s][%I64u bytes][%I64u ms]")
+                  _T("[0x%x]"),
+                  offline_package->path, offline_package->size,
+                  offline_package->elapsed_ms, hr));
+    return hr;
+  }
+
+  DownloadManagerInterface* const download_manager_;
+  std::vector<OfflinePackage>* const packages_;
+  volatile LONG next_;
+  volatile LONG failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(OfflinePackageCacher);
+};
+
+}  // namespace
+
+HRESULT CacheOfflinePackages(DownloadManagerInterface* download_manager,
+                             std::vector<OfflinePackage>* packages,
+                             int max_concurrency) {
+  ASSERT1(download_manager);
+  ASSERT1(packages);
+
+  if (packages->empty()) {
+    return S_OK;
+  }
+
+  int num_threads = max_concurrency;
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+  if (static_cast<size_t>(num_threads) > packages->size()) {
+    num_threads = static_cast<int>(packages->size());
+  }
+
+  // The cache is purged before the packages are put in it, rather than by the
+  // first of the threads while the others put their packages.
+  download_manager->PurgeOldPackagesOnce();
+
+  HighresTimer timer;
+  OfflinePackageCacher cacher(download_manager, packages);
+  num_threads = cacher.Run(num_threads);
+  const ULONGLONG elapsed_ms = timer.GetElapsedMs();
+
+  uint64 total_size = 0;
+  HRESULT hr = S_OK;
+  for (size_t i = 0; i != packages->size(); ++i) {
+    total_size += (*packages)[i].size;
+    if (SUCCEEDED(hr) && FAILED((*packages)[i].hr)) {
+      hr = (*packages)[i].hr;
+      CORE_LOG(LE, (_T("[CachePackage failed][%s][0x%x][0x%x][%Iu]"),
+                    (*packages)[i].path, hr, (*packages)[i].extra_code1, i));
+      if (hr == GOOPDATEDOWNLOAD_E_CACHING_FAILED) {
+        set_error_extra_code1((*packages)[i].extra_code1);
+      }
+    }
+  }
+
+  const uint64 kbytes_per_sec = total_size / 1024 * 1000 /
+                                (elapsed_ms ? elapsed_ms : 1);
+  CORE_LOG(L2, (_T("[Cached offline packages][%Iu packages][%I64u bytes]")
+                _T("[%I64u ms][%I64u KB/s][%d threads][0x%x]"),
+                packages->size(), total_size, elapsed_ms, kbytes_per_sec,
+                num_threads, hr));
+  metric_worker_offline_packages_cache_ms.AddSample(elapsed_ms);
+  metric_worker_offline_packages_cache_kbytes_per_sec = kbytes_per_sec;
+
+  return hr;
+}
+
 }  // namespace internal
 
 Worker::Worker()
@@ -335,12 +488,7 @@ HRESULT Worker::Initialize(bool is_machine) {
     return hr;
   }
 
-  install_manager_.reset(new InstallManager(&model_->lock(), is_machine_));
-  hr = install_manager_->Initialize();
-  if (FAILED(hr)) {
-    return hr;
-  }
-
+  startup_timeline::Mark(STARTUP_PHASE_WORKER_INITIALIZED);
   return S_OK;
 }
 
@@ -436,6 +584,9 @@ void Worker::CheckForUpdate(std::shared_ptr<AppBundle> app_bundle) {
   CORE_LOG(L3, (_T("[Worker::CheckForUpdate][0x%p]"), app_bundle.get()));
   ASSERT1(app_bundle.get());
 
+  TraceSpan span("Worker::CheckForUpdate");
+  worker_utils::SetTraceIds(*app_bundle, &span);
+
   bool is_check_successful = false;
   CheckForUpdateHelper(app_bundle.get(), &is_check_successful);
 
@@ -492,6 +643,7 @@ void Worker::CheckForUpdateHelper(AppBundle* app_bundle,
                             app_bundle,
                             hr,
                             update_response.get());
+  QueuePurgeOldPackages();
   if (IsCupError(hr)) {
     CORE_LOG(L3, (_T("[CUP failed][%#08x]"), hr));
     // Only send the CUP debug ping when there is no "retry after" in effect.
@@ -545,6 +697,9 @@ void Worker::Download(std::shared_ptr<AppBundle> app_bundle) {
   CORE_LOG(L3, (_T("[Worker::Download][0x%p]"), app_bundle.get()));
   ASSERT1(app_bundle.get());
 
+  TraceSpan span("Worker::Download");
+  worker_utils::SetTraceIds(*app_bundle, &span);
+
   scoped_impersonation impersonate_user(app_bundle->impersonation_token());
   HRESULT hr = impersonate_user.result();
   if (FAILED(hr)) {
@@ -604,6 +759,9 @@ void Worker::DownloadAndInstall(std::shared_ptr<AppBundle> app_bundle) {
   CORE_LOG(L3, (_T("[Worker::DownloadAndInstall][0x%p]"), app_bundle.get()));
   ASSERT1(app_bundle.get());
 
+  TraceSpan span("Worker::DownloadAndInstall");
+  worker_utils::SetTraceIds(*app_bundle, &span);
+
   // If any applications have been uninstalled and /ua hasn't run yet, queue
   // their uninstall pings now, and clear out their ClientState.  This ensures
   // that they'll have a clean slate in the case of a uninstall+reinstall.
@@ -649,11 +807,24 @@ void Worker::DownloadAndInstallHelper(AppBundle* app_bundle) {
 
     app->QueueInstall();
 
+    InstallManagerInterface* install_manager = NULL;
+    hr = GetInstallManager(&install_manager);
+    if (FAILED(hr)) {
+      __mutexScope(model_->lock());
+      if (app->state() == STATE_WAITING_TO_INSTALL) {
+        CString message;
+        StringFormatter formatter(app_bundle->display_language());
+        VERIFY_SUCCEEDED(formatter.LoadString(IDS_INSTALL_FAILED, &message));
+        app->Error(ErrorContext(hr), message);
+      }
+      continue;
+    }
+
     // This is a blocking call on the app installer.
     CallAsSelfAndImpersonate1(
         app,
         &App::Install,
-        install_manager_.get());
+        install_manager);
 
     ASSERT1(app->state() == STATE_INSTALL_COMPLETE ||
             app->state() == STATE_NO_UPDATE ||
@@ -693,6 +864,9 @@ void Worker::UpdateAllApps(std::shared_ptr<AppBundle> app_bundle) {
   CORE_LOG(L3, (_T("[Worker::UpdateAllApps][0x%p]"), app_bundle.get()));
   ASSERT1(app_bundle.get());
 
+  TraceSpan span("Worker::UpdateAllApps");
+  worker_utils::SetTraceIds(*app_bundle, &span);
+
   bool is_check_successful = false;
   CheckForUpdateHelper(app_bundle.get(), &is_check_successful);
 
@@ -839,6 +1013,7 @@ HRESULT Worker::CacheOfflinePackages(AppBundle* app_bundle) {
   CORE_LOG(L3, (_T("[Worker::CacheOfflinePackages]")));
   ASSERT1(app_bundle);
 
+  std::vector<internal::OfflinePackage> packages;
   for (size_t i = 0; i != app_bundle->GetNumberOfApps(); ++i) {
     App* app = app_bundle->GetApp(i);
     AppVersion* app_version = app->working_version();
@@ -863,27 +1038,20 @@ HRESULT Worker::CacheOfflinePackages(AppBundle* app_bundle) {
         }
       }
 
-      File offline_package_file;
-      HRESULT hr = offline_package_file.OpenShareMode(offline_package_path,
-                                                      false,
-                                                      false,
-                                                      FILE_SHARE_READ);
-      if (FAILED(hr)) {
-        return hr;
-      }
-
-      hr = download_manager_->CachePackage(package,
-                                           &offline_package_file,
-                                           &offline_package_path);
-      if (FAILED(hr)) {
-        CORE_LOG(LE, (_T("[CachePackage failed][%s][%s][0x%x][%Iu]"),
-                      app->app_guid_string(), offline_package_path, hr, j));
-        return hr;
-      }
+      internal::OfflinePackage offline_package;
+      offline_package.package = package;
+      offline_package.path = offline_package_path;
+      packages.push_back(offline_package);
     }
   }
 
-  return S_OK;
+  // Each package is hashed while it is copied, so reading the packages from
+  // the offline media concurrently overlaps the hashing of one with the I/O
+  // of the others.
+  return internal::CacheOfflinePackages(
+      download_manager_.get(),
+      &packages,
+      ConfigManager::Instance()->GetOfflinePackageIngestionConcurrency());
 }
 
 HRESULT Worker::PurgeAppLowerVersions(const CString& app_id,
@@ -969,9 +1137,11 @@ HRESULT Worker::DoUpdateCheck(AppBundle* app_bundle,
 
   // This is a blocking call on the network.
   const bool is_foreground = app_bundle->priority() == INSTALL_PRIORITY_HIGH;
+  startup_timeline::Mark(STARTUP_PHASE_UPDATE_CHECK_SENT);
   HRESULT hr = app_bundle->update_check_client()->Send(is_foreground,
                                                        update_request,
                                                        update_response);
+  startup_timeline::Mark(STARTUP_PHASE_UPDATE_CHECK_COMPLETE);
 
   CORE_LOG(L3, (_T("[Update check HTTP trace][%s]"),
       app_bundle->update_check_client()->http_trace()));
@@ -1031,6 +1201,44 @@ void Worker::DoPostUpdateCheck(AppBundle* app_bundle,
   }
 }
 
+void Worker::QueuePurgeOldPackages() {
+  auto callback = std::make_unique<ThreadPoolCallBack0<Worker>>(
+      this,
+      &Worker::PurgeOldPackages);
+  HRESULT hr = Goopdate::Instance().QueueUserWorkItem(std::move(callback),
+                                                      COINIT_MULTITHREADED,
+                                                      WT_EXECUTELONGFUNCTION);
+  if (FAILED(hr)) {
+    // The cache is still purged before the first package is put in it.
+    CORE_LOG(LW, (_T("[QueueUserWorkItem failed][0x%08x]"), hr));
+  }
+}
+
+void Worker::PurgeOldPackages() {
+  download_manager_->PurgeOldPackagesOnce();
+}
+
+HRESULT Worker::GetInstallManager(InstallManagerInterface** install_manager) {
+  ASSERT1(install_manager);
+  ASSERT1(!model_->IsLockedByCaller());
+
+  __mutexScope(install_manager_lock_);
+
+  if (!install_manager_.get()) {
+    std::unique_ptr<InstallManager> manager(
+        new InstallManager(&model_->lock(), is_machine_));
+    HRESULT hr = manager->Initialize();
+    if (FAILED(hr)) {
+      CORE_LOG(LE, (_T("[InstallManager::Initialize failed][0x%08x]"), hr));
+      return hr;
+    }
+    install_manager_ = std::move(manager);
+  }
+
+  *install_manager = install_manager_.get();
+  return S_OK;
+}
+
 void Worker::PersistRetryAfter(int retry_after_sec) const {
   CORE_LOG(L6, (_T("[Worker::PersistRetryAfter][%d]"), retry_after_sec));
 
@@ -24,6 +24,7 @@
 #include "omaha/base/program_instance.h"
 #include "omaha/base/shutdown_callback.h"
 #include "omaha/base/shutdown_handler.h"
+#include "omaha/base/synchronized.h"
 #include "omaha/base/wtl_atlapp_wrapper.h"
 
 namespace omaha {
@@ -163,6 +164,16 @@ class Worker : public WorkerModelInterface, public ShutdownCallback {
 
   void PersistRetryAfter(int retry_after_sec) const;
 
+  // Queues the purge of the package cache on the thread pool, so that the
+  // update check does not wait for it.
+  void QueuePurgeOldPackages();
+  void PurgeOldPackages();
+
+  // Returns the install manager, which is created the first time it is
+  // needed, since most of the processes which initialize the worker never
+  // install anything.
+  HRESULT GetInstallManager(InstallManagerInterface** install_manager);
+
   HRESULT QueueDeferredFunctionCall0(
       std::shared_ptr<AppBundle> app_bundle,
       void (Worker::*deferred_function)(std::shared_ptr<AppBundle>));
@@ -187,6 +198,7 @@ class Worker : public WorkerModelInterface, public ShutdownCallback {
   std::unique_ptr<Model>           model_;
   std::unique_ptr<DownloadManagerInterface> download_manager_;
   std::unique_ptr<InstallManagerInterface> install_manager_;
+  LLock install_manager_lock_;
 
   CMessageLoop message_loop_;
 
@@ -17,6 +17,10 @@
 #define OMAHA_GOOPDATE_WORKER_INTERNAL_H_
 
 #include <windows.h>
+#include <atlstr.h>
+#include <vector>
+
+#include "base/basictypes.h"
 
 namespace omaha {
 
@@ -26,6 +30,9 @@ class UpdateRequest;
 
 }  // namespace xml
 
+class DownloadManagerInterface;
+class Package;
+
 namespace internal {
 
 void RecordUpdateAvailableUsageStats();
@@ -35,6 +42,27 @@ void RecordUpdateAvailableUsageStats();
 // is destroyed.
 HRESULT AddUninstalledAppsPings(AppBundle* app_bundle);
 
+// A package of an offline install, found at |path| in the offline directory.
+// CacheOfflinePackages fills in the other members.
+struct OfflinePackage {
+  OfflinePackage()
+      : package(NULL), hr(S_FALSE), extra_code1(0), size(0), elapsed_ms(0) {}
+
+  const Package* package;
+  CString path;
+  HRESULT hr;             // S_FALSE if the package has not been cached.
+  int extra_code1;        // The error of the package cache, if any.
+  uint64 size;
+  ULONGLONG elapsed_ms;
+};
+
+// Copies |packages| into the package cache of |download_manager|, with up to
+// |max_concurrency| of them in flight, after the cache is purged. Returns the
+// error of the first package that failed, in the order of |packages|, or S_OK.
+HRESULT CacheOfflinePackages(DownloadManagerInterface* download_manager,
+                             std::vector<OfflinePackage>* packages,
+                             int max_concurrency);
+
 }  // namespace internal
 
 }  // namespace omaha
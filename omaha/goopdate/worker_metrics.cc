@@ -21,6 +21,9 @@ namespace omaha {
 DEFINE_METRIC_count(worker_download_total);
 DEFINE_METRIC_count(worker_download_succeeded);
 
+DEFINE_METRIC_count(worker_download_bytes);
+DEFINE_METRIC_integer(worker_downloads_active);
+
 DEFINE_METRIC_count(worker_download_skipped_bits_machine);
 
 DEFINE_METRIC_count(worker_package_cache_put_total);
@@ -77,4 +80,7 @@ DEFINE_METRIC_timing(ping_succeeded_ms);
 DEFINE_METRIC_timing(updatecheck_failed_ms);
 DEFINE_METRIC_timing(updatecheck_succeeded_ms);
 
+DEFINE_METRIC_timing(worker_offline_packages_cache_ms);
+DEFINE_METRIC_integer(worker_offline_packages_cache_kbytes_per_sec);
+
 }  // namespace omaha
@@ -27,6 +27,11 @@ DECLARE_METRIC_count(worker_download_total);
 // How many times the download manager successfully downloaded a file.
 DECLARE_METRIC_count(worker_download_succeeded);
 
+// How many bytes the packages being downloaded have received.
+DECLARE_METRIC_count(worker_download_bytes);
+// How many apps are being downloaded.
+DECLARE_METRIC_integer(worker_downloads_active);
+
 // How many times the download manager skipped BITS due to machine install.
 DECLARE_METRIC_count(worker_download_skipped_bits_machine);
 
@@ -141,6 +146,12 @@ DECLARE_METRIC_timing(updatecheck_failed_ms);
 // Time (ms) spent in DoUpdateCheck() when an update check succeeds.
 DECLARE_METRIC_timing(updatecheck_succeeded_ms);
 
+// Time (ms) spent copying the packages of an offline install into the package
+// cache.
+DECLARE_METRIC_timing(worker_offline_packages_cache_ms);
+// The throughput (KB/s) of the last copy of offline packages into the cache.
+DECLARE_METRIC_integer(worker_offline_packages_cache_kbytes_per_sec);
+
 }  // namespace omaha
 
 #endif  // OMAHA_GOOPDATE_WORKER_METRICS_H__
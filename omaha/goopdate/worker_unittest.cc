@@ -20,6 +20,9 @@
 
 #include "omaha/base/app_util.h"
 #include "omaha/base/const_addresses.h"
+#include "omaha/base/error.h"
+#include "omaha/base/file.h"
+#include "omaha/base/utils.h"
 #include "omaha/common/config_manager.h"
 #include "omaha/common/update_response.h"
 #include "omaha/common/web_services_client.h"
@@ -41,7 +44,10 @@ namespace omaha {
 
 using ::testing::_;
 using ::testing::AnyNumber;
+using ::testing::DoAll;
+using ::testing::Pointee;
 using ::testing::Return;
+using ::testing::SetArgPointee;
 
 namespace {
 
@@ -149,10 +155,12 @@ class MockDownloadManager : public DownloadManagerInterface {
  public:
   MOCK_METHOD0(Initialize,
       HRESULT());
+  MOCK_METHOD0(PurgeOldPackagesOnce,
+      void());
   MOCK_METHOD2(PurgeAppLowerVersions,
       HRESULT(const CString&, const CString&));
-  MOCK_METHOD3(CachePackage,
-      HRESULT(const Package*, File*, const CString*));
+  MOCK_METHOD4(CachePackage,
+      HRESULT(const Package*, File*, const CString*, int*));
   MOCK_METHOD1(DownloadApp,
       HRESULT(App* app));
   MOCK_METHOD1(DownloadPackage,
@@ -394,6 +402,10 @@ TEST_F(WorkerMockedManagersTest, CheckForUpdateAsync) {
   EXPECT_CALL(*mock_web_services_client_, retry_after_sec())
       .Times(1);
 
+  // The package cache is purged after the update check, on another work item.
+  EXPECT_CALL(*mock_download_manager_, PurgeOldPackagesOnce())
+      .Times(1);
+
   __mutexBlock(worker_->model()->lock()) {
     EXPECT_SUCCEEDED(worker_->CheckForUpdateAsync(app_bundle_.get()));
 
@@ -948,4 +960,102 @@ TEST_F(RecordUpdateAvailableUsageStatsTest, OmahaAndSeveralApps) {
             metric_worker_app_max_update_responses_ms_since_first.value());
 }
 
+class CacheOfflinePackagesTest : public testing::Test {
+ protected:
+  static const int kNumPackages = 4;
+
+  virtual void SetUp() {
+    for (int i = 0; i != kNumPackages; ++i) {
+      internal::OfflinePackage package;
+      package.path = GetTempFilename(_T("opk"));
+      ASSERT_FALSE(package.path.IsEmpty());
+
+      const std::vector<byte> data((i + 1) * 4096, static_cast<byte>(i));
+      File file;
+      ASSERT_SUCCEEDED(file.Open(package.path, true, false));
+      ASSERT_SUCCEEDED(file.Write(&data.front(),
+                                  static_cast<uint32>(data.size()),
+                                  NULL));
+      ASSERT_SUCCEEDED(file.Close());
+      packages_.push_back(package);
+    }
+  }
+
+  virtual void TearDown() {
+    for (size_t i = 0; i != packages_.size(); ++i) {
+      EXPECT_SUCCEEDED(File::Remove(packages_[i].path));
+    }
+  }
+
+  MockDownloadManager download_manager_;
+  std::vector<internal::OfflinePackage> packages_;
+};
+
+TEST_F(CacheOfflinePackagesTest, Empty) {
+  std::vector<internal::OfflinePackage> packages;
+  EXPECT_EQ(S_OK,
+            internal::CacheOfflinePackages(&download_manager_, &packages, 2));
+}
+
+TEST_F(CacheOfflinePackagesTest, AllPackagesCached) {
+  const int kConcurrency[] = {0, 1, 2, kNumPackages + 1};
+  for (size_t i = 0; i != arraysize(kConcurrency); ++i) {
+    std::vector<internal::OfflinePackage> packages(packages_);
+    EXPECT_CALL(download_manager_, PurgeOldPackagesOnce()).Times(1);
+    for (size_t j = 0; j != packages.size(); ++j) {
+      EXPECT_CALL(download_manager_,
+                  CachePackage(_, _, Pointee(packages[j].path), _))
+          .WillOnce(Return(S_OK));
+    }
+
+    EXPECT_EQ(S_OK, internal::CacheOfflinePackages(&download_manager_,
+                                                   &packages,
+                                                   kConcurrency[i]));
+    for (size_t j = 0; j != packages.size(); ++j) {
+      EXPECT_EQ(S_OK, packages[j].hr) << kConcurrency[i];
+      EXPECT_EQ((j + 1) * 4096, packages[j].size);
+    }
+  }
+}
+
+TEST_F(CacheOfflinePackagesTest, StopsAtFirstFailure) {
+  set_error_extra_code1(0);
+  EXPECT_CALL(download_manager_, PurgeOldPackagesOnce()).Times(1);
+  EXPECT_CALL(download_manager_,
+              CachePackage(_, _, Pointee(packages_[0].path), _))
+      .WillOnce(Return(S_OK));
+  EXPECT_CALL(download_manager_,
+              CachePackage(_, _, Pointee(packages_[1].path), _))
+      .WillOnce(DoAll(SetArgPointee<3>(static_cast<int>(E_ACCESSDENIED)),
+                      Return(GOOPDATEDOWNLOAD_E_CACHING_FAILED)));
+  EXPECT_CALL(download_manager_,
+              CachePackage(_, _, Pointee(packages_[2].path), _))
+      .Times(0);
+  EXPECT_CALL(download_manager_,
+              CachePackage(_, _, Pointee(packages_[3].path), _))
+      .Times(0);
+
+  EXPECT_EQ(GOOPDATEDOWNLOAD_E_CACHING_FAILED,
+            internal::CacheOfflinePackages(&download_manager_, &packages_, 1));
+  EXPECT_EQ(S_OK, packages_[0].hr);
+  EXPECT_EQ(GOOPDATEDOWNLOAD_E_CACHING_FAILED, packages_[1].hr);
+  EXPECT_EQ(static_cast<int>(E_ACCESSDENIED), packages_[1].extra_code1);
+  EXPECT_EQ(S_FALSE, packages_[2].hr);
+  EXPECT_EQ(S_FALSE, packages_[3].hr);
+
+  // The error of the package cache is only reported once the threads are done.
+  EXPECT_EQ(static_cast<int>(E_ACCESSDENIED), error_extra_code1());
+  set_error_extra_code1(0);
+}
+
+TEST_F(CacheOfflinePackagesTest, MissingFile) {
+  std::vector<internal::OfflinePackage> packages(1);
+  packages[0].path = packages_[0].path + _T(".missing");
+  EXPECT_CALL(download_manager_, PurgeOldPackagesOnce()).Times(1);
+
+  EXPECT_EQ(HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND),
+            internal::CacheOfflinePackages(&download_manager_, &packages, 2));
+  EXPECT_EQ(HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND), packages[0].hr);
+}
+
 }  // namespace omaha
@@ -21,8 +21,11 @@
 #include "omaha/base/logging.h"
 #include "omaha/base/safe_format.h"
 #include "omaha/base/signatures.h"
+#include "omaha/base/tracing.h"
+#include "omaha/base/utils.h"
 #include "omaha/common/const_goopdate.h"
 #include "omaha/common/event_logger.h"
+#include "omaha/goopdate/model.h"
 #include "omaha/goopdate/server_resource.h"
 #include "omaha/goopdate/string_formatter.h"
 #include "omaha/net/network_request.h"
@@ -107,6 +110,28 @@ bool GetInstallActionForEvent(
   return false;
 }
 
+void SetTraceIds(const App& app, TraceSpan* span) {
+  ASSERT1(span);
+  if (!span->is_recording()) {
+    return;
+  }
+
+  span->set_app_id(app.app_guid());
+  SetTraceIds(*app.app_bundle(), span);
+}
+
+void SetTraceIds(const AppBundle& app_bundle, TraceSpan* span) {
+  ASSERT1(span);
+  if (!span->is_recording()) {
+    return;
+  }
+
+  GUID bundle_id = GUID_NULL;
+  if (SUCCEEDED(StringToGuidSafe(app_bundle.session_id(), &bundle_id))) {
+    span->set_bundle_id(bundle_id);
+  }
+}
+
 }  // namespace worker_utils
 
 }  // namespace omaha
@@ -23,7 +23,10 @@
 
 namespace omaha {
 
+class App;
+class AppBundle;
 class NetworkRequest;
+class TraceSpan;
 
 namespace worker_utils {
 
@@ -46,6 +49,12 @@ bool GetInstallActionForEvent(
     xml::InstallAction::InstallEvent install_event,
     const xml::InstallAction** action);
 
+// Sets the ids of |span| to the ids of |app| and of its bundle, or to the id
+// of |app_bundle|. Does nothing if the span does not record, since reading
+// the ids takes the model lock.
+void SetTraceIds(const App& app, TraceSpan* span);
+void SetTraceIds(const AppBundle& app_bundle, TraceSpan* span);
+
 }  // namespace worker_utils
 
 }  // namespace omaha
@@ -38,9 +38,9 @@ def BuildMetaInstaller(
     additional_payload_contents_dependencies=None,
     output_dir='$STAGING_DIR',
     installers_sources_path='$MAIN_DIR/installers',
-    lzma_path='$THIRD_PARTY/lzma/files/lzma.exe',
     resmerge_path='$MAIN_DIR/tools/resmerge.exe',
-    bcj2_path='$OBJ_ROOT/mi_exe_stub/x86_encoder/bcj2.exe'):
+    payload_packer_path=(
+        '$OBJ_ROOT/mi_exe_stub/payload_packer/payload_packer.exe')):
   """Build a meta-installer.
 
     Builds a full meta-installer, which is a meta-installer containing a full
@@ -63,9 +63,8 @@ def BuildMetaInstaller(
     output_dir: path to the directory that will contain the metainstaller
     installers_sources_path: path to the directory containing the source files
         for building the metainstaller
-    lzma_path: path to lzma.exe
     resmerge_path: path to resmerge.exe
-    bcj2_path: path to bcj2.exe
+    payload_packer_path: path to payload_packer.exe
 
   Returns:
     Target nodes.
@@ -74,9 +73,8 @@ def BuildMetaInstaller(
     Nothing.
   """
 
-  # Payload .tar.lzma
-  tarball_filename = '%spayload%s.tar' % (prefix, suffix)
-  payload_filename = tarball_filename + '.lzma'
+  # Payload, in the chunked format read by the metainstaller.
+  payload_filename = '%spayload%s.tar.lzma2' % (prefix, suffix)
 
   # Collect a list of all the files to include in the payload
   payload_file_names = omaha_version_info.GetMetainstallerPayloadFilenames()
@@ -86,38 +84,18 @@ def BuildMetaInstaller(
   if additional_payload_contents:
     payload_contents += additional_payload_contents
 
-  # Create the tarball
-  tarball_output = env.Command(
-      target=tarball_filename,    # Archive filename
-      source=payload_contents,    # List of files to include in tarball
-      action='python.exe "%s" -o $TARGET $SOURCES' % (
-          env.File(installers_sources_path + '/generate_tarball.py').abspath),
+  # Tar the files, encode the tarball with BCJ2 to increase its
+  # compressibility, and compress it, in independent blocks.
+  payload_output = env.Command(
+      target=payload_filename,
+      source=payload_contents,
+      action='"%s" -o $TARGET $SOURCES' % payload_packer_path,
   )
+  env.Depends(payload_output, payload_packer_path)
 
   # Add potentially hidden dependencies
   if additional_payload_contents_dependencies:
-    env.Depends(tarball_output, additional_payload_contents_dependencies)
-
-  # Preprocess the tarball to increase compressibility
-  bcj_filename = '%spayload%s.tar.bcj' % (prefix, suffix)
-  # TODO(omaha): Add the bcj2 path as an optional parameter.
-  bcj_output = env.Command(
-      target=bcj_filename,
-      source=tarball_output,
-      action='"%s" "$SOURCES" "$TARGET"' % bcj2_path,
-  )
-  env.Depends(bcj_output, bcj2_path)
-
-  # Compress the tarball
-  lzma_env = env.Clone()
-  lzma_env.Append(
-      LZMAFLAGS=[],
-  )
-  lzma_output = lzma_env.Command(
-      target=payload_filename,
-      source=bcj_output,
-      action='"%s" e $SOURCES $TARGET $LZMAFLAGS' % lzma_path,
-  )
+    env.Depends(payload_output, additional_payload_contents_dependencies)
 
   # Construct the resource generation script
   manifest_path = installers_sources_path + '/installers.manifest'
@@ -132,7 +110,7 @@ def BuildMetaInstaller(
   # Generate the .rc file
   rc_output = env.Command(
       target='%sresource%s.rc' % (prefix, suffix),
-      source=lzma_output,
+      source=payload_output,
       action=res_command,
   )
 
@@ -142,7 +120,7 @@ def BuildMetaInstaller(
   # For some reason, RES() does not cause the .res file to depend on .rc input.
   # It also does not detect the dependencies in the .rc file.
   # This does not cause a rebuild for rarely changing files in res_command.
-  env.Depends(res_file, [rc_output, manifest_path, lzma_output])
+  env.Depends(res_file, [rc_output, manifest_path, payload_output])
 
   # Resource DLL
   dll_env = env.Clone(COMPONENT_STATIC=False)
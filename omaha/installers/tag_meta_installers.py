@@ -188,29 +188,20 @@ def BuildTagStringForBundle(bundle):
   args += '\"'
   return args
 
-def TagOneFile(file, app, applytag_exe_name):
-  """Tags one file with the information contained inside the application.
+def WriteTagsFile(apps, tags_file_name):
+  """Writes the tags file that ApplyTag -batch reads.
   Args:
-    file: The input file to be stamped.
-    app: Contains all the application data.
-    applytag_exe_name: The full path of applytag.exe.
+    apps: Dictionary of key=lang, value=[Application].
+    tags_file_name: The file to write.
   """
-  tag_string = BuildTagStringForBundle(app)
-
-  out_path = app.output_file_name
-  if not os.path.exists(file):
-    print 'Could not find file %s required for creating %s' % (file, out_path)
-    return False
-
-  arguments = [applytag_exe_name,
-               file,
-               output_path,
-               tag_string,
-               'append'
-              ]
-  print 'Building %s with tag %s' % (output_path, tag_string)
-  os.spawnv(os.P_WAIT, applytag_exe_name, arguments)
-  return True
+  tags_file = open(tags_file_name, 'w')
+  for apps_lang in apps:
+    for app in apps[apps_lang]:
+      # The quotes are only needed on a command line.
+      tag_string = BuildTagStringForBundle(app).strip('"')
+      print 'Building %s with tag %s' % (app.output_file_name, tag_string)
+      tags_file.write('%s %s\n' % (tag_string, app.output_file_name))
+  tags_file.close()
 
 def GetAllSetupExeInDirectory(dir):
   """Creates a number of application specific binaries for the
@@ -233,7 +224,8 @@ def GetAllSetupExeInDirectory(dir):
 
 def TagBinary(apps, file, applytag_exe_name):
   """Creates a number of application specific binaries for the
-     passed in binary.
+     passed in binary. ApplyTag reads the binary once and writes all the
+     tagged copies in one run.
   Args:
     apps: Dictionary of key=lang, value=[Application].
     file: The input file to be stamped.
@@ -241,9 +233,20 @@ def TagBinary(apps, file, applytag_exe_name):
   """
   if not apps:
     return
-  for apps_lang in apps:
-    for app in apps[apps_lang]:
-      TagOneFile(file, app, applytag_exe_name)
+  if not os.path.exists(file):
+    print 'Could not find file %s required for tagging' % file
+    return
+
+  tags_file_name = file + '.tags.txt'
+  WriteTagsFile(apps, tags_file_name)
+  arguments = [applytag_exe_name,
+               '-batch',
+               file,
+               tags_file_name,
+               'append'
+              ]
+  os.spawnv(os.P_WAIT, applytag_exe_name, arguments)
+  os.remove(tags_file_name)
 
 def PrintUsage():
   print ''
@@ -20,18 +20,34 @@ import re
 from installers import tag_meta_installers
 
 
-def TagOneBundle(env, bundle, untagged_binary_path, output_dir):
-  tag_str = tag_meta_installers.BuildTagStringForBundle(bundle)
-
+def _GetTaggedTarget(bundle, output_dir):
   # Need to find relative path to output file under source dir, to allow
   # it to be redirected under the output directory.
   indx = bundle.output_file_name.find('installers')
   relative_filepath = bundle.output_file_name[indx+len('installers')+1:]
+  return '%s/%s' % (output_dir, relative_filepath)
+
 
-  return env.OmahaTagExe(
-      target='%s/%s' % (output_dir, relative_filepath),
+def TagBundles(env, bundles, untagged_binary_path, output_dir):
+  """Tags one copy of untagged_binary_path per bundle. All the copies are
+     written by a single run of ApplyTag, which reads the binary once.
+  Returns:
+    The list of tagged files.
+  """
+  targets = []
+  tags = []
+  for bundles_lang in bundles.itervalues():
+    for bundle in bundles_lang:
+      targets.append(_GetTaggedTarget(bundle, output_dir))
+      tags.append(tag_meta_installers.BuildTagStringForBundle(bundle))
+  if not targets:
+    return []
+
+  return env.OmahaTagExes(
+      targets=targets,
       source=untagged_binary_path,
-      tag=tag_str)
+      tags=tags,
+  )
 
 
 def _ReadAllBundleInstallerFiles(installers_txt_files_path):
@@ -74,12 +90,10 @@ def CreateTaggedInstallers(env, installers_txt_files_path, product_name,
   untagged_binary = '%s%sSetup.exe' % (prefix, product_name)
 
   tag_meta_installers.SetOutputFileNames(untagged_binary, bundles, '')
-  for bundles_lang in bundles.itervalues():
-    for bundle in bundles_lang:
-      TagOneBundle(
-          env=env,
-          bundle=bundle,
-          untagged_binary_path='$STAGING_DIR/%s' % (untagged_binary),
-          output_dir='$TARGET_ROOT/Tagged_Installers',
-      )
+  TagBundles(
+      env=env,
+      bundles=bundles,
+      untagged_binary_path='$STAGING_DIR/%s' % (untagged_binary),
+      output_dir='$TARGET_ROOT/Tagged_Installers',
+  )
 
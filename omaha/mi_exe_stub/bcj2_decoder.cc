@@ -0,0 +1,320 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// The decoding loop follows Bcj2_Decode in the LZMA SDK, with its state kept
+// between calls.
+
+#include "omaha/mi_exe_stub/bcj2_decoder.h"
+
+#include <string.h>
+
+namespace omaha {
+
+namespace {
+
+// Size of the buffer the decoded data is collected in before it is passed to
+// the callback.
+const size_t kWindowSize = 1024 * 1024;
+
+// The side streams are only a small fraction of the data. Anything bigger
+// than this is treated as corrupt rather than allocated.
+const uint64 kMaxSideStreamsSize = 256 * 1024 * 1024;
+
+const int kNumTopBits = 24;
+const uint32 kTopValue = static_cast<uint32>(1) << kNumTopBits;
+const int kNumBitModelTotalBits = 11;
+const uint32 kBitModelTotal = 1 << kNumBitModelTotalBits;
+const int kNumMoveBits = 5;
+
+// Number of bytes the range decoder reads when it starts.
+const size_t kRangeDecoderInitSize = 5;
+
+bool IsJcc(uint8 b0, uint8 b1) {
+  return b0 == 0x0F && (b1 & 0xF0) == 0x80;
+}
+
+bool IsJ(uint8 b0, uint8 b1) {
+  return (b1 & 0xFE) == 0xE8 || IsJcc(b0, b1);
+}
+
+}  // namespace
+
+Bcj2Decoder::Bcj2Decoder(OutputCallback callback, void* callback_context)
+    : callback_(callback),
+      callback_context_(callback_context),
+      state_(STATE_HEADER),
+      header_bytes_(0),
+      side_streams_size_(0),
+      side_streams_bytes_(0),
+      call_(NULL),
+      call_end_(NULL),
+      jump_(NULL),
+      jump_end_(NULL),
+      rc_(NULL),
+      rc_end_(NULL),
+      main_remaining_(0),
+      range_(0),
+      code_(0),
+      previous_byte_(0),
+      window_bytes_(0),
+      output_size_(0) {
+  memset(&header_, 0, sizeof(header_));
+  for (size_t i = 0; i != arraysize(probs_); ++i) {
+    probs_[i] = static_cast<uint16>(kBitModelTotal >> 1);
+  }
+}
+
+Bcj2Decoder::~Bcj2Decoder() {
+}
+
+bool Bcj2Decoder::Write(const uint8* data, size_t size) {
+  while (size) {
+    size_t bytes_used = 0;
+    switch (state_) {
+      case STATE_HEADER: {
+        bytes_used = sizeof(header_) - header_bytes_;
+        if (bytes_used > size) {
+          bytes_used = size;
+        }
+        memcpy(reinterpret_cast<uint8*>(&header_) + header_bytes_,
+               data,
+               bytes_used);
+        header_bytes_ += bytes_used;
+        if (header_bytes_ == sizeof(header_) && !OnHeader()) {
+          state_ = STATE_ERROR;
+        }
+        break;
+      }
+
+      case STATE_SIDE_STREAMS: {
+        bytes_used = side_streams_size_ - side_streams_bytes_;
+        if (bytes_used > size) {
+          bytes_used = size;
+        }
+        memcpy(side_streams_.get() + side_streams_bytes_, data, bytes_used);
+        side_streams_bytes_ += bytes_used;
+        if (side_streams_bytes_ == side_streams_size_ && !OnSideStreams()) {
+          state_ = STATE_ERROR;
+        }
+        break;
+      }
+
+      case STATE_MAIN_STREAM: {
+        bytes_used = size;
+        if (bytes_used > main_remaining_) {
+          bytes_used = static_cast<size_t>(main_remaining_);
+        }
+        if (!DecodeMain(data, bytes_used)) {
+          state_ = STATE_ERROR;
+          break;
+        }
+        main_remaining_ -= bytes_used;
+        if (!main_remaining_) {
+          state_ = STATE_DONE;
+        }
+        break;
+      }
+
+      case STATE_DONE:
+      case STATE_ERROR:
+      default:
+        // Data past the end of the main stream is an error too.
+        state_ = STATE_ERROR;
+        return false;
+    }
+
+    data += bytes_used;
+    size -= bytes_used;
+  }
+
+  return state_ != STATE_ERROR;
+}
+
+bool Bcj2Decoder::Finish() {
+  if (state_ != STATE_DONE) {
+    return false;
+  }
+  return Flush() && output_size_ == header_.unpacked_size;
+}
+
+bool Bcj2Decoder::OnHeader() {
+  const uint64 side_streams_size =
+      header_.call_size + header_.jump_size + header_.rc_size;
+  if (header_.call_size > kMaxSideStreamsSize ||
+      header_.jump_size > kMaxSideStreamsSize ||
+      header_.rc_size > kMaxSideStreamsSize ||
+      side_streams_size > kMaxSideStreamsSize ||
+      header_.rc_size < kRangeDecoderInitSize ||
+      header_.main_size > header_.unpacked_size) {
+    return false;
+  }
+
+  side_streams_size_ = static_cast<size_t>(side_streams_size);
+  side_streams_.reset(new uint8[side_streams_size_]);
+  window_.reset(new uint8[kWindowSize]);
+  if (!side_streams_.get() || !window_.get()) {
+    return false;
+  }
+
+  state_ = STATE_SIDE_STREAMS;
+  return true;
+}
+
+bool Bcj2Decoder::OnSideStreams() {
+  call_ = side_streams_.get();
+  call_end_ = call_ + static_cast<size_t>(header_.call_size);
+  jump_ = call_end_;
+  jump_end_ = jump_ + static_cast<size_t>(header_.jump_size);
+  rc_ = jump_end_;
+  rc_end_ = rc_ + static_cast<size_t>(header_.rc_size);
+
+  range_ = 0xFFFFFFFF;
+  code_ = 0;
+  for (size_t i = 0; i != kRangeDecoderInitSize; ++i) {
+    code_ = (code_ << 8) | *rc_++;
+  }
+
+  main_remaining_ = header_.main_size;
+  state_ = main_remaining_ ? STATE_MAIN_STREAM : STATE_DONE;
+  return true;
+}
+
+bool Bcj2Decoder::DecodeMain(const uint8* data, size_t size) {
+  const uint8* const end = data + size;
+  while (data != end) {
+    // Pass through everything up to and including the next branch opcode.
+    const uint8* const run = data;
+    bool is_branch = false;
+    uint8 byte = 0;
+    uint8 previous_byte = previous_byte_;
+    while (data != end) {
+      byte = *data++;
+      if (IsJ(previous_byte, byte)) {
+        is_branch = true;
+        break;
+      }
+      previous_byte = byte;
+    }
+    if (!Output(run, data - run)) {
+      return false;
+    }
+    if (!is_branch) {
+      previous_byte_ = previous_byte;
+      break;
+    }
+
+    uint16* prob = byte == 0xE8 ? &probs_[previous_byte] :
+                   byte == 0xE9 ? &probs_[256] :
+                                  &probs_[257];
+    bool is_converted = false;
+    if (!DecodeBit(prob, &is_converted)) {
+      return false;
+    }
+    if (!is_converted) {
+      previous_byte_ = byte;
+      continue;
+    }
+
+    // The branch target is stored as an absolute big-endian address in the
+    // call or jump stream. Turn it back into a relative one.
+    const uint8** stream = byte == 0xE8 ? &call_ : &jump_;
+    const uint8* stream_end = byte == 0xE8 ? call_end_ : jump_end_;
+    if (stream_end - *stream < 4) {
+      return false;
+    }
+    const uint8* v = *stream;
+    *stream += 4;
+    const uint32 dest = ((static_cast<uint32>(v[0]) << 24) |
+                         (static_cast<uint32>(v[1]) << 16) |
+                         (static_cast<uint32>(v[2]) << 8) |
+                         static_cast<uint32>(v[3])) -
+                        static_cast<uint32>(output_size_ + 4);
+    const uint8 address[4] = {
+      static_cast<uint8>(dest),
+      static_cast<uint8>(dest >> 8),
+      static_cast<uint8>(dest >> 16),
+      static_cast<uint8>(dest >> 24),
+    };
+    if (!Output(address, sizeof(address))) {
+      return false;
+    }
+    previous_byte_ = address[3];
+  }
+
+  return true;
+}
+
+bool Bcj2Decoder::DecodeBit(uint16* prob, bool* bit) {
+  const uint32 bound = (range_ >> kNumBitModelTotalBits) * *prob;
+  if (code_ < bound) {
+    range_ = bound;
+    *prob = static_cast<uint16>(*prob + ((kBitModelTotal - *prob) >>
+                                         kNumMoveBits));
+    *bit = false;
+  } else {
+    range_ -= bound;
+    code_ -= bound;
+    *prob = static_cast<uint16>(*prob - (*prob >> kNumMoveBits));
+    *bit = true;
+  }
+
+  if (range_ < kTopValue) {
+    if (rc_ == rc_end_) {
+      return false;
+    }
+    range_ <<= 8;
+    code_ = (code_ << 8) | *rc_++;
+  }
+  return true;
+}
+
+bool Bcj2Decoder::Output(const uint8* data, size_t size) {
+  if (size > header_.unpacked_size - output_size_) {
+    return false;
+  }
+  output_size_ += size;
+
+  // Large runs skip the window when it is empty.
+  if (!window_bytes_ && size >= kWindowSize) {
+    return callback_(callback_context_, data, size);
+  }
+
+  while (size) {
+    size_t bytes_to_copy = kWindowSize - window_bytes_;
+    if (bytes_to_copy > size) {
+      bytes_to_copy = size;
+    }
+    memcpy(window_.get() + window_bytes_, data, bytes_to_copy);
+    window_bytes_ += bytes_to_copy;
+    data += bytes_to_copy;
+    size -= bytes_to_copy;
+
+    if (window_bytes_ == kWindowSize && !Flush()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Bcj2Decoder::Flush() {
+  if (!window_bytes_) {
+    return true;
+  }
+  const size_t bytes = window_bytes_;
+  window_bytes_ = 0;
+  return callback_(callback_context_, window_.get(), bytes);
+}
+
+}  // namespace omaha
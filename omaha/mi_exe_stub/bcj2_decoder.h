@@ -0,0 +1,116 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Incremental decoder for the BCJ2 files written by x86_encoder/bcj2.exe.
+//
+// A BCJ2 file starts with a Bcj2Header, followed by the call, jump and range
+// coder streams, followed by the main stream. The three side streams only hold
+// the converted branch targets and are small, so they are buffered in memory.
+// The main stream is about the size of the original data and is decoded as it
+// arrives, without ever being held in memory in its entirety.
+
+#ifndef OMAHA_MI_EXE_STUB_BCJ2_DECODER_H_
+#define OMAHA_MI_EXE_STUB_BCJ2_DECODER_H_
+
+#include <windows.h>
+#include <memory>
+
+#pragma warning(push)
+// C4310: cast truncates constant value
+#pragma warning(disable : 4310)
+#include "base/basictypes.h"
+#pragma warning(pop)
+
+namespace omaha {
+
+// All the fields are little-endian.
+struct Bcj2Header {
+  uint64 unpacked_size;
+  uint64 main_size;
+  uint64 call_size;
+  uint64 jump_size;
+  uint64 rc_size;
+};
+
+class Bcj2Decoder {
+ public:
+  // Receives the decoded data, in order. |data| is only valid for the duration
+  // of the call. Returns false to stop the decoding.
+  typedef bool (*OutputCallback)(void* context, const uint8* data, size_t size);
+
+  Bcj2Decoder(OutputCallback callback, void* callback_context);
+  ~Bcj2Decoder();
+
+  // Decodes the next |size| bytes of the BCJ2 file. Returns false if the data
+  // is malformed, memory can't be allocated, or the callback fails.
+  bool Write(const uint8* data, size_t size);
+
+  // Passes any buffered output to the callback. Returns true if the whole file
+  // has been decoded.
+  bool Finish();
+
+ private:
+  enum State {
+    STATE_HEADER,
+    STATE_SIDE_STREAMS,
+    STATE_MAIN_STREAM,
+    STATE_DONE,
+    STATE_ERROR,
+  };
+
+  bool OnHeader();
+  bool OnSideStreams();
+  bool DecodeMain(const uint8* data, size_t size);
+  bool DecodeBit(uint16* prob, bool* bit);
+  bool Output(const uint8* data, size_t size);
+  bool Flush();
+
+  OutputCallback callback_;
+  void* callback_context_;
+  State state_;
+
+  Bcj2Header header_;
+  size_t header_bytes_;
+
+  // The call, jump and range coder streams, back to back.
+  std::unique_ptr<uint8[]> side_streams_;
+  size_t side_streams_size_;
+  size_t side_streams_bytes_;
+  const uint8* call_;
+  const uint8* call_end_;
+  const uint8* jump_;
+  const uint8* jump_end_;
+  const uint8* rc_;
+  const uint8* rc_end_;
+
+  uint64 main_remaining_;
+
+  // Range decoder state.
+  uint32 range_;
+  uint32 code_;
+  uint16 probs_[256 + 2];
+  uint8 previous_byte_;
+
+  // Decoded data waiting to be passed to the callback.
+  std::unique_ptr<uint8[]> window_;
+  size_t window_bytes_;
+  uint64 output_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(Bcj2Decoder);
+};
+
+}  // namespace omaha
+
+#endif  // OMAHA_MI_EXE_STUB_BCJ2_DECODER_H_
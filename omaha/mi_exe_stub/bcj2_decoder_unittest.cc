@@ -0,0 +1,137 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/mi_exe_stub/bcj2_decoder.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "omaha/base/app_util.h"
+#include "omaha/base/utils.h"
+#include "omaha/mi_exe_stub/x86_encoder/bcj2_encoder.h"
+#include "omaha/testing/unit_test.h"
+
+namespace omaha {
+
+namespace {
+
+bool AppendToString(void* context, const uint8* data, size_t size) {
+  std::string* output = static_cast<std::string*>(context);
+  output->append(reinterpret_cast<const char*>(data), size);
+  return true;
+}
+
+// Encodes |input| into the file layout written by bcj2.exe.
+std::string EncodeBcj2File(const std::string& input) {
+  std::string main_stream;
+  std::string call_stream;
+  std::string jump_stream;
+  std::string rc_stream;
+  EXPECT_TRUE(Bcj2Encode(input,
+                         &main_stream,
+                         &call_stream,
+                         &jump_stream,
+                         &rc_stream));
+
+  Bcj2Header header = {};
+  header.unpacked_size = input.size();
+  header.main_size = main_stream.size();
+  header.call_size = call_stream.size();
+  header.jump_size = jump_stream.size();
+  header.rc_size = rc_stream.size();
+
+  std::string file(reinterpret_cast<const char*>(&header), sizeof(header));
+  file += call_stream;
+  file += jump_stream;
+  file += rc_stream;
+  file += main_stream;
+  return file;
+}
+
+}  // namespace
+
+class Bcj2DecoderTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    // The victim program is the unit test itself.
+    CString module_path = app_util::GetModulePath(NULL);
+    ASSERT_FALSE(module_path.IsEmpty());
+
+    std::vector<byte> raw_file;
+    ASSERT_HRESULT_SUCCEEDED(
+        ReadEntireFileShareMode(module_path, 0, FILE_SHARE_READ, &raw_file));
+    input_.assign(reinterpret_cast<char*>(&raw_file[0]), raw_file.size());
+    file_ = EncodeBcj2File(input_);
+  }
+
+  // Decodes |file_| in chunks of |chunk_size| bytes.
+  bool Decode(size_t chunk_size, std::string* output) {
+    Bcj2Decoder decoder(&AppendToString, output);
+    for (size_t offset = 0; offset < file_.size(); offset += chunk_size) {
+      const size_t size = std::min(chunk_size, file_.size() - offset);
+      if (!decoder.Write(reinterpret_cast<const uint8*>(&file_[offset]),
+                         size)) {
+        return false;
+      }
+    }
+    return decoder.Finish();
+  }
+
+  std::string input_;
+  std::string file_;
+};
+
+TEST_F(Bcj2DecoderTest, EmptyInput) {
+  file_ = EncodeBcj2File(std::string());
+  std::string output;
+  ASSERT_TRUE(Decode(file_.size(), &output));
+  EXPECT_TRUE(output.empty());
+}
+
+TEST_F(Bcj2DecoderTest, SingleWrite) {
+  std::string output;
+  ASSERT_TRUE(Decode(file_.size(), &output));
+  EXPECT_EQ(input_, output);
+}
+
+// The chunk boundaries must not affect the output.
+TEST_F(Bcj2DecoderTest, ChunkedWrites) {
+  const size_t kChunkSizes[] = { 1, 7, 4096, 1024 * 1024 + 3 };
+  for (size_t i = 0; i != arraysize(kChunkSizes); ++i) {
+    std::string output;
+    ASSERT_TRUE(Decode(kChunkSizes[i], &output)) << kChunkSizes[i];
+    EXPECT_EQ(input_, output) << kChunkSizes[i];
+  }
+}
+
+TEST_F(Bcj2DecoderTest, Truncated) {
+  file_.resize(file_.size() - 1);
+  std::string output;
+  EXPECT_FALSE(Decode(file_.size(), &output));
+}
+
+TEST_F(Bcj2DecoderTest, TrailingData) {
+  file_ += '\0';
+  std::string output;
+  EXPECT_FALSE(Decode(file_.size(), &output));
+}
+
+TEST_F(Bcj2DecoderTest, BadHeader) {
+  Bcj2Header* header = reinterpret_cast<Bcj2Header*>(&file_[0]);
+  header->call_size = static_cast<uint64>(-1);
+  std::string output;
+  EXPECT_FALSE(Decode(file_.size(), &output));
+}
+
+}  // namespace omaha
@@ -0,0 +1,87 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Layout of the chunked metainstaller payload, written by payload_packer.exe.
+//
+// The tarball is cut into blocks of a fixed size, and each block is filtered
+// and compressed on its own, so that the blocks can be decoded in parallel.
+// The payload is laid out as:
+//
+//   ChunkedPayloadHeader
+//   ChunkedPayloadBlock[block_count]   (the block index)
+//   the packed blocks, back to back
+//
+// A packed block is a raw LZMA2 stream. When the BCJ2 filter is used, the
+// LZMA2 stream decodes to a BCJ2 file (see bcj2_decoder.h), which in turn
+// decodes to the block of the tarball.
+//
+// The first byte of the magic can't start an LZMA header, which is how the
+// metainstaller tells this format from the older single LZMA stream. All the
+// fields are little-endian.
+
+#ifndef OMAHA_MI_EXE_STUB_CHUNKED_PAYLOAD_H_
+#define OMAHA_MI_EXE_STUB_CHUNKED_PAYLOAD_H_
+
+#include <windows.h>
+
+#pragma warning(push)
+// C4310: cast truncates constant value
+#pragma warning(disable : 4310)
+#include "base/basictypes.h"
+#pragma warning(pop)
+
+namespace omaha {
+
+const uint8 kChunkedPayloadMagic[8] = {
+  0xFF, 'G', 'U', 'P', 'L', 'D', '\r', '\n'
+};
+const uint32 kChunkedPayloadVersion = 1;
+
+// Default unpacked size of a block. Larger blocks compress better; smaller
+// ones use less memory and spread over more threads.
+const uint32 kDefaultChunkedPayloadBlockSize = 8 * 1024 * 1024;
+
+// Blocks larger than this are rejected by the metainstaller.
+const uint32 kMaxChunkedPayloadBlockSize = 64 * 1024 * 1024;
+
+enum ChunkedPayloadFilter {
+  CHUNKED_PAYLOAD_FILTER_NONE = 0,
+  CHUNKED_PAYLOAD_FILTER_BCJ2 = 1,
+};
+
+struct ChunkedPayloadHeader {
+  uint8 magic[8];
+  uint32 version;
+  uint32 header_size;    // sizeof(ChunkedPayloadHeader).
+  uint64 unpacked_size;  // Size of the tarball.
+  uint32 block_size;     // Unpacked size of all the blocks but the last one.
+  uint32 block_count;
+  uint8 filter;          // ChunkedPayloadFilter.
+  uint8 lzma2_props;     // The LZMA2 properties byte, shared by all blocks.
+  uint8 reserved[6];
+};
+
+struct ChunkedPayloadBlock {
+  uint64 packed_offset;  // From the start of the payload.
+  uint32 packed_size;
+  uint32 filtered_size;  // Size of the LZMA2 output.
+  uint32 unpacked_size;  // Size of the block of the tarball.
+  uint32 reserved;
+  uint8 sha256[32];      // SHA-256 of the block of the tarball.
+};
+
+}  // namespace omaha
+
+#endif  // OMAHA_MI_EXE_STUB_CHUNKED_PAYLOAD_H_
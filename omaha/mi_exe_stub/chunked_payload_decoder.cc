@@ -0,0 +1,360 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Block i is decoded by worker i % number_of_workers. Each worker has one
+// output buffer; the calling thread waits for the blocks in order, writes them
+// to the tarball, and hands the buffer back to the worker for its next block.
+
+#include "omaha/mi_exe_stub/chunked_payload_decoder.h"
+
+#include <string.h>
+#include <memory>
+
+#include "omaha/mi_exe_stub/bcj2_decoder.h"
+#include "omaha/mi_exe_stub/chunked_payload.h"
+#include "omaha/mi_exe_stub/tar.h"
+#include "omaha/third_party/smartany/scoped_any.h"
+extern "C" {
+#include "third_party/lzma/files/C/Lzma2Dec.h"
+#include "third_party/lzma/files/C/Sha256.h"
+}
+
+namespace omaha {
+
+namespace {
+
+// Decoding is usually limited by the disk beyond this.
+const DWORD kMaxWorkers = 4;
+
+// The BCJ2 output of a block is its unpacked size plus the range coder stream
+// and the header, which are a small fraction of it.
+const uint64 kMaxFilteredBlockSize = 2ULL * kMaxChunkedPayloadBlockSize;
+
+void* LzmaAlloc(void* p, size_t size) {
+  UNREFERENCED_PARAMETER(p);
+  return new uint8[size];
+}
+
+void LzmaFree(void* p, void* address) {
+  UNREFERENCED_PARAMETER(p);
+  delete[] static_cast<uint8*>(address);
+}
+
+// Collects the output of the BCJ2 decoder in a buffer of a known size.
+struct BufferWriter {
+  uint8* buffer;
+  size_t capacity;
+  size_t size;
+};
+
+bool WriteToBuffer(void* context, const uint8* data, size_t size) {
+  BufferWriter* writer = static_cast<BufferWriter*>(context);
+  if (size > writer->capacity - writer->size) {
+    return false;
+  }
+  memcpy(writer->buffer + writer->size, data, size);
+  writer->size += size;
+  return true;
+}
+
+class ChunkedPayloadDecoder {
+ public:
+  ChunkedPayloadDecoder(const uint8* payload, size_t payload_size)
+      : payload_(payload),
+        payload_size_(payload_size),
+        header_(NULL),
+        blocks_(NULL),
+        num_workers_(0),
+        abort_(0) {
+  }
+
+  ~ChunkedPayloadDecoder() {
+    Stop();
+  }
+
+  bool Extract(Tar* tar);
+
+ private:
+  struct Worker {
+    Worker() : decoder(NULL), first_block(0), stride(0), succeeded(false) {}
+
+    ChunkedPayloadDecoder* decoder;
+    uint32 first_block;
+    uint32 stride;
+    std::unique_ptr<uint8[]> output;
+    std::unique_ptr<uint8[]> filtered;
+    bool succeeded;
+
+    // Signaled by the worker when its current block is in |output|.
+    scoped_event ready;
+    // Signaled by the calling thread when |output| can be reused.
+    scoped_event consumed;
+    scoped_handle thread;
+  };
+
+  bool ValidateIndex();
+  bool StartWorkers();
+  void Stop();
+
+  static DWORD WINAPI WorkerProc(void* param);
+  void DecodeBlocks(Worker* worker);
+  bool DecodeBlock(const ChunkedPayloadBlock& block, Worker* worker);
+
+  const uint8* payload_;
+  size_t payload_size_;
+  const ChunkedPayloadHeader* header_;
+  const ChunkedPayloadBlock* blocks_;
+
+  Worker workers_[kMaxWorkers];
+  DWORD num_workers_;
+  volatile LONG abort_;
+
+  DISALLOW_COPY_AND_ASSIGN(ChunkedPayloadDecoder);
+};
+
+bool ChunkedPayloadDecoder::Extract(Tar* tar) {
+  if (!ValidateIndex() || !StartWorkers()) {
+    return false;
+  }
+
+  for (uint32 i = 0; i != header_->block_count; ++i) {
+    Worker* worker = &workers_[i % num_workers_];
+    if (::WaitForSingleObject(get(worker->ready), INFINITE) != WAIT_OBJECT_0 ||
+        !worker->succeeded ||
+        !tar->Write(worker->output.get(), blocks_[i].unpacked_size)) {
+      return false;
+    }
+    ::SetEvent(get(worker->consumed));
+  }
+
+  return tar->done();
+}
+
+bool ChunkedPayloadDecoder::ValidateIndex() {
+  if (payload_size_ < sizeof(ChunkedPayloadHeader)) {
+    return false;
+  }
+  const ChunkedPayloadHeader* header =
+      reinterpret_cast<const ChunkedPayloadHeader*>(payload_);
+  if (header->version != kChunkedPayloadVersion ||
+      header->header_size != sizeof(*header) ||
+      !header->block_size ||
+      header->block_size > kMaxChunkedPayloadBlockSize ||
+      !header->block_count ||
+      header->block_count - 1 != (header->unpacked_size - 1) /
+                                 header->block_size ||
+      header->block_count > (payload_size_ - sizeof(*header)) /
+                            sizeof(ChunkedPayloadBlock)) {
+    return false;
+  }
+  if (header->filter != CHUNKED_PAYLOAD_FILTER_NONE &&
+      header->filter != CHUNKED_PAYLOAD_FILTER_BCJ2) {
+    return false;
+  }
+
+  const ChunkedPayloadBlock* blocks =
+      reinterpret_cast<const ChunkedPayloadBlock*>(header + 1);
+  const uint64 index_end =
+      sizeof(*header) + header->block_count * sizeof(*blocks);
+  for (uint32 i = 0; i != header->block_count; ++i) {
+    const ChunkedPayloadBlock& block = blocks[i];
+    const uint64 unpacked_size =
+        i + 1 != header->block_count ?
+            header->block_size :
+            header->unpacked_size - static_cast<uint64>(i) * header->block_size;
+    if (block.unpacked_size != unpacked_size ||
+        block.packed_offset < index_end ||
+        block.packed_offset > payload_size_ ||
+        block.packed_size > payload_size_ - block.packed_offset ||
+        !block.filtered_size) {
+      return false;
+    }
+    if (header->filter == CHUNKED_PAYLOAD_FILTER_NONE ?
+            block.filtered_size != block.unpacked_size :
+            block.filtered_size > kMaxFilteredBlockSize) {
+      return false;
+    }
+  }
+
+  header_ = header;
+  blocks_ = blocks;
+  return true;
+}
+
+bool ChunkedPayloadDecoder::StartWorkers() {
+  SYSTEM_INFO system_info = {};
+  ::GetSystemInfo(&system_info);
+  DWORD num_workers = system_info.dwNumberOfProcessors;
+  if (num_workers > kMaxWorkers) {
+    num_workers = kMaxWorkers;
+  }
+  if (num_workers > header_->block_count) {
+    num_workers = header_->block_count;
+  }
+  if (!num_workers) {
+    num_workers = 1;
+  }
+
+  for (DWORD i = 0; i != num_workers; ++i) {
+    Worker* worker = &workers_[i];
+    worker->decoder = this;
+    worker->first_block = i;
+    worker->stride = num_workers;
+
+    uint32 max_filtered_size = 0;
+    for (uint32 j = i; j < header_->block_count; j += num_workers) {
+      if (blocks_[j].filtered_size > max_filtered_size) {
+        max_filtered_size = blocks_[j].filtered_size;
+      }
+    }
+
+    worker->output.reset(new uint8[header_->block_size]);
+    if (header_->filter == CHUNKED_PAYLOAD_FILTER_BCJ2) {
+      worker->filtered.reset(new uint8[max_filtered_size]);
+      if (!worker->filtered.get()) {
+        return false;
+      }
+    }
+    reset(worker->ready, ::CreateEvent(NULL, false, false, NULL));
+    reset(worker->consumed, ::CreateEvent(NULL, false, true, NULL));
+    if (!worker->output.get() || !valid(worker->ready) ||
+        !valid(worker->consumed)) {
+      return false;
+    }
+  }
+
+  for (DWORD i = 0; i != num_workers; ++i) {
+    reset(workers_[i].thread,
+          ::CreateThread(NULL, 0, &WorkerProc, &workers_[i], 0, NULL));
+    if (!valid(workers_[i].thread)) {
+      return false;
+    }
+    num_workers_ = i + 1;
+  }
+  return true;
+}
+
+// Stops the workers, whether they are done or not.
+void ChunkedPayloadDecoder::Stop() {
+  ::InterlockedExchange(&abort_, 1);
+  HANDLE threads[kMaxWorkers] = {};
+  DWORD num_threads = 0;
+  for (DWORD i = 0; i != num_workers_; ++i) {
+    ::SetEvent(get(workers_[i].consumed));
+    if (valid(workers_[i].thread)) {
+      threads[num_threads++] = get(workers_[i].thread);
+    }
+  }
+  if (num_threads) {
+    ::WaitForMultipleObjects(num_threads, threads, true, INFINITE);
+  }
+  num_workers_ = 0;
+}
+
+DWORD WINAPI ChunkedPayloadDecoder::WorkerProc(void* param) {
+  Worker* worker = static_cast<Worker*>(param);
+  worker->decoder->DecodeBlocks(worker);
+  return 0;
+}
+
+void ChunkedPayloadDecoder::DecodeBlocks(Worker* worker) {
+  for (uint32 i = worker->first_block;
+       i < header_->block_count;
+       i += worker->stride) {
+    ::WaitForSingleObject(get(worker->consumed), INFINITE);
+    if (abort_) {
+      return;
+    }
+    worker->succeeded = DecodeBlock(blocks_[i], worker);
+    ::SetEvent(get(worker->ready));
+    if (!worker->succeeded) {
+      return;
+    }
+  }
+}
+
+bool ChunkedPayloadDecoder::DecodeBlock(const ChunkedPayloadBlock& block,
+                                        Worker* worker) {
+  const bool is_filtered = header_->filter == CHUNKED_PAYLOAD_FILTER_BCJ2;
+  uint8* const filtered = is_filtered ? worker->filtered.get() :
+                                        worker->output.get();
+
+  // The output buffer is the dictionary. Lzma2Decode() in the LZMA SDK would
+  // do the same, but it does not initialize the decoder state.
+  ISzAlloc allocators = { &LzmaAlloc, &LzmaFree };
+  CLzma2Dec lzma2_state;
+  Lzma2Dec_Construct(&lzma2_state);
+  if (SZ_OK != Lzma2Dec_AllocateProbs(&lzma2_state,
+                                      header_->lzma2_props,
+                                      &allocators)) {
+    return false;
+  }
+  lzma2_state.decoder.dic = filtered;
+  lzma2_state.decoder.dicBufSize = block.filtered_size;
+  Lzma2Dec_Init(&lzma2_state);
+
+  SizeT packed_size = block.packed_size;
+  ELzmaStatus status = LZMA_STATUS_NOT_SPECIFIED;
+  const SRes result = Lzma2Dec_DecodeToDic(&lzma2_state,
+                                           block.filtered_size,
+                                           payload_ + block.packed_offset,
+                                           &packed_size,
+                                           LZMA_FINISH_END,
+                                           &status);
+  const SizeT filtered_size = lzma2_state.decoder.dicPos;
+  Lzma2Dec_FreeProbs(&lzma2_state, &allocators);
+  if (result != SZ_OK ||
+      status != LZMA_STATUS_FINISHED_WITH_MARK ||
+      filtered_size != block.filtered_size ||
+      packed_size != block.packed_size) {
+    return false;
+  }
+
+  if (is_filtered) {
+    BufferWriter writer = { worker->output.get(), block.unpacked_size, 0 };
+    Bcj2Decoder bcj2(&WriteToBuffer, &writer);
+    if (!bcj2.Write(filtered, filtered_size) ||
+        !bcj2.Finish() ||
+        writer.size != block.unpacked_size) {
+      return false;
+    }
+  }
+
+  CSha256 sha256;
+  Sha256_Init(&sha256);
+  Sha256_Update(&sha256, worker->output.get(), block.unpacked_size);
+  uint8 digest[SHA256_DIGEST_SIZE] = {};
+  Sha256_Final(&sha256, digest);
+  return !memcmp(digest, block.sha256, sizeof(digest));
+}
+
+}  // namespace
+
+bool IsChunkedPayload(const uint8* payload, size_t payload_size) {
+  return payload_size >= sizeof(kChunkedPayloadMagic) &&
+         !memcmp(payload, kChunkedPayloadMagic, sizeof(kChunkedPayloadMagic));
+}
+
+bool ExtractChunkedPayload(const uint8* payload,
+                           size_t payload_size,
+                           Tar* tar) {
+  if (!IsChunkedPayload(payload, payload_size)) {
+    return false;
+  }
+  ChunkedPayloadDecoder decoder(payload, payload_size);
+  return decoder.Extract(tar);
+}
+
+}  // namespace omaha
@@ -0,0 +1,48 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Decoding of the chunked metainstaller payload described in
+// chunked_payload.h.
+
+#ifndef OMAHA_MI_EXE_STUB_CHUNKED_PAYLOAD_DECODER_H_
+#define OMAHA_MI_EXE_STUB_CHUNKED_PAYLOAD_DECODER_H_
+
+#include <windows.h>
+
+#pragma warning(push)
+// C4310: cast truncates constant value
+#pragma warning(disable : 4310)
+#include "base/basictypes.h"
+#pragma warning(pop)
+
+namespace omaha {
+
+class Tar;
+
+// Returns true if |payload| starts with the magic of a chunked payload.
+bool IsChunkedPayload(const uint8* payload, size_t payload_size);
+
+// Decodes the blocks of the chunked payload on up to one thread per processor
+// and passes them to |tar| in order, on the calling thread. Each block is
+// checked against the SHA-256 in the index before it is passed on. Memory use
+// is about two blocks per thread. Returns true if the whole tarball was
+// extracted.
+bool ExtractChunkedPayload(const uint8* payload,
+                           size_t payload_size,
+                           Tar* tar);
+
+}  // namespace omaha
+
+#endif  // OMAHA_MI_EXE_STUB_CHUNKED_PAYLOAD_DECODER_H_
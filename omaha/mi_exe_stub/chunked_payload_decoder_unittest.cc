@@ -0,0 +1,268 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/mi_exe_stub/chunked_payload_decoder.h"
+#include <string>
+#include <vector>
+#include "omaha/base/file.h"
+#include "omaha/base/path.h"
+#include "omaha/base/utils.h"
+#include "omaha/mi_exe_stub/chunked_payload.h"
+#include "omaha/mi_exe_stub/payload.h"
+#include "omaha/mi_exe_stub/payload_packer/chunked_payload_writer.h"
+#include "omaha/mi_exe_stub/tar.h"
+#include "omaha/mi_exe_stub/x86_encoder/bcj2_encoder.h"
+#include "omaha/testing/unit_test.h"
+extern "C" {
+#include "third_party/lzma/files/C/LzmaEnc.h"
+}
+
+namespace omaha {
+
+namespace {
+
+// Returns data with a good share of x86 call and jump opcodes, so that the
+// BCJ2 filter has something to convert.
+std::string MakeCode(size_t size, unsigned int seed) {
+  std::string code(size, '\0');
+  for (size_t i = 0; i != size; ++i) {
+    seed = seed * 1103515245 + 12345;
+    const uint8 value = static_cast<uint8>(seed >> 16);
+    code[i] = static_cast<char>(value % 5 ? value : 0xE8);
+  }
+  return code;
+}
+
+void* LzmaAlloc(void* p, size_t size) {
+  UNREFERENCED_PARAMETER(p);
+  return new uint8[size];
+}
+
+void LzmaFree(void* p, void* address) {
+  UNREFERENCED_PARAMETER(p);
+  delete[] static_cast<uint8*>(address);
+}
+
+void AppendUint32(size_t value, std::string* output) {
+  const uint32 value_32 = static_cast<uint32>(value);
+  output->append(reinterpret_cast<const char*>(&value_32), sizeof(value_32));
+}
+
+// Builds a payload in the single stream format that predates the chunked one:
+// a BCJ2 file with a header of five uint32 sizes, followed by the main, call,
+// jump and range coder streams, compressed with LZMA.
+std::string MakeSingleStreamPayload(const std::string& tarball) {
+  std::string main_stream, call_stream, jump_stream, rc_stream;
+  EXPECT_TRUE(Bcj2Encode(tarball,
+                         &main_stream,
+                         &call_stream,
+                         &jump_stream,
+                         &rc_stream));
+
+  std::string legacy;
+  AppendUint32(tarball.size(), &legacy);
+  AppendUint32(main_stream.size(), &legacy);
+  AppendUint32(call_stream.size(), &legacy);
+  AppendUint32(jump_stream.size(), &legacy);
+  AppendUint32(rc_stream.size(), &legacy);
+  legacy += main_stream;
+  legacy += call_stream;
+  legacy += jump_stream;
+  legacy += rc_stream;
+
+  CLzmaEncProps props;
+  LzmaEncProps_Init(&props);
+  std::string payload(LZMA_PROPS_SIZE + sizeof(uint64) + legacy.size() * 2 +
+                      1024, '\0');
+  SizeT props_size = LZMA_PROPS_SIZE;
+  SizeT packed_size = payload.size() - LZMA_PROPS_SIZE - sizeof(uint64);
+  ISzAlloc allocators = { &LzmaAlloc, &LzmaFree };
+  EXPECT_EQ(SZ_OK, LzmaEncode(
+      reinterpret_cast<Byte*>(&payload[LZMA_PROPS_SIZE + sizeof(uint64)]),
+      &packed_size,
+      reinterpret_cast<const Byte*>(legacy.data()),
+      legacy.size(),
+      &props,
+      reinterpret_cast<Byte*>(&payload[0]),
+      &props_size,
+      0,
+      NULL,
+      &allocators,
+      &allocators));
+  const uint64 unpacked_size = legacy.size();
+  memcpy(&payload[LZMA_PROPS_SIZE], &unpacked_size, sizeof(unpacked_size));
+  payload.resize(LZMA_PROPS_SIZE + sizeof(uint64) + packed_size);
+  return payload;
+}
+
+void RecordFile(void* context, const TCHAR* filename) {
+  static_cast<std::vector<CString>*>(context)->push_back(filename);
+}
+
+}  // namespace
+
+class ChunkedPayloadTest : public testing::Test {
+ protected:
+  ChunkedPayloadTest() : temp_dir_(GetUniqueTempDirectoryName()) {}
+
+  void SetUp() override {
+    ASSERT_SUCCEEDED(CreateDir(temp_dir_, NULL));
+
+    files_.push_back(MakeCode(100000, 1));
+    files_.push_back(std::string());
+    files_.push_back(MakeCode(7777, 2));
+    files_.push_back(std::string(30000, 'a'));
+
+    TarballWriter writer;
+    for (size_t i = 0; i != files_.size(); ++i) {
+      CString name;
+      name.Format(_T("file%Iu.dll"), i);
+      ASSERT_SUCCEEDED(writer.AddFile(name, files_[i]));
+    }
+    tarball_ = writer.Finish();
+  }
+
+  void TearDown() override {
+    EXPECT_SUCCEEDED(DeleteDirectory(temp_dir_));
+  }
+
+  // Extracts |payload| and checks that the files in it are the ones in the
+  // tarball.
+  void ExpectExtracts(const std::string& payload) {
+    std::vector<CString> extracted;
+    Tar tar(temp_dir_, true);
+    tar.SetCallback(&RecordFile, &extracted);
+    ASSERT_TRUE(ExtractPayload(reinterpret_cast<const uint8*>(payload.data()),
+                               payload.size(),
+                               &tar));
+
+    ASSERT_EQ(files_.size(), extracted.size());
+    for (size_t i = 0; i != files_.size(); ++i) {
+      CString name;
+      name.Format(_T("file%Iu.dll"), i);
+      EXPECT_EQ(ConcatenatePath(temp_dir_, name), extracted[i]);
+
+      std::vector<byte> contents;
+      EXPECT_SUCCEEDED(ReadEntireFileShareMode(extracted[i], 0,
+                                               FILE_SHARE_READ, &contents));
+      EXPECT_TRUE(files_[i] ==
+                  std::string(contents.begin(), contents.end()));
+    }
+  }
+
+  bool Extracts(const std::string& payload) {
+    Tar tar(temp_dir_, true);
+    return ExtractPayload(reinterpret_cast<const uint8*>(payload.data()),
+                          payload.size(),
+                          &tar);
+  }
+
+  const CString temp_dir_;
+  std::vector<std::string> files_;
+  std::string tarball_;
+};
+
+TEST_F(ChunkedPayloadTest, RoundTrip) {
+  const uint32 kBlockSizes[] = { 4096, 10000, 1024 * 1024 };
+  for (size_t i = 0; i != arraysize(kBlockSizes); ++i) {
+    for (int use_bcj2 = 0; use_bcj2 != 2; ++use_bcj2) {
+      ChunkedPayloadOptions options;
+      options.block_size = kBlockSizes[i];
+      options.use_bcj2 = !!use_bcj2;
+      options.compression_level = 5;
+
+      std::string payload;
+      ASSERT_SUCCEEDED(WriteChunkedPayload(tarball_, options, &payload));
+      EXPECT_TRUE(IsChunkedPayload(
+          reinterpret_cast<const uint8*>(payload.data()), payload.size()));
+      ExpectExtracts(payload);
+    }
+  }
+}
+
+TEST_F(ChunkedPayloadTest, IsDeterministic) {
+  ChunkedPayloadOptions options;
+  options.block_size = 16384;
+  options.num_threads = 1;
+  std::string single_thread;
+  ASSERT_SUCCEEDED(WriteChunkedPayload(tarball_, options, &single_thread));
+
+  const int kNumThreads[] = { 1, 2, 3, 8, 0 };
+  for (size_t i = 0; i != arraysize(kNumThreads); ++i) {
+    options.num_threads = kNumThreads[i];
+    std::string payload;
+    ASSERT_SUCCEEDED(WriteChunkedPayload(tarball_, options, &payload));
+    EXPECT_TRUE(single_thread == payload) << kNumThreads[i];
+  }
+  ExpectExtracts(single_thread);
+}
+
+TEST_F(ChunkedPayloadTest, SingleStreamPayload) {
+  const std::string payload(MakeSingleStreamPayload(tarball_));
+  EXPECT_FALSE(IsChunkedPayload(
+      reinterpret_cast<const uint8*>(payload.data()), payload.size()));
+  ExpectExtracts(payload);
+
+  EXPECT_FALSE(Extracts(payload.substr(0, payload.size() / 2)));
+  EXPECT_FALSE(Extracts(payload.substr(0, LZMA_PROPS_SIZE)));
+}
+
+TEST_F(ChunkedPayloadTest, CorruptBlock) {
+  ChunkedPayloadOptions options;
+  options.block_size = 4096;
+  std::string payload;
+  ASSERT_SUCCEEDED(WriteChunkedPayload(tarball_, options, &payload));
+  ASSERT_TRUE(Extracts(payload));
+
+  // A bad hash in the index.
+  std::string bad_hash(payload);
+  ChunkedPayloadBlock* blocks = reinterpret_cast<ChunkedPayloadBlock*>(
+      &bad_hash[sizeof(ChunkedPayloadHeader)]);
+  blocks[3].sha256[0] ^= 1;
+  EXPECT_FALSE(Extracts(bad_hash));
+
+  // Bad packed data in the last block.
+  std::string bad_data(payload);
+  bad_data[bad_data.size() - 10] ^= 0x55;
+  EXPECT_FALSE(Extracts(bad_data));
+
+  // A block that points past the end of the payload.
+  std::string bad_offset(payload);
+  blocks = reinterpret_cast<ChunkedPayloadBlock*>(
+      &bad_offset[sizeof(ChunkedPayloadHeader)]);
+  blocks[1].packed_offset = bad_offset.size();
+  EXPECT_FALSE(Extracts(bad_offset));
+
+  // A truncated index.
+  EXPECT_FALSE(Extracts(payload.substr(0, sizeof(ChunkedPayloadHeader) + 8)));
+
+  // A payload without the magic, which is then taken for a single stream one.
+  EXPECT_FALSE(Extracts(payload.substr(1)));
+}
+
+TEST(ChunkedPayloadWriterTest, GetPayloadMemberName) {
+  EXPECT_STREQ(_T("GoogleUpdate.exe"),
+               GetPayloadMemberName(_T("c:\\out\\GoogleUpdate.exe")));
+  EXPECT_STREQ(_T("Offline Manifest.gup"),
+               GetPayloadMemberName(_T("c:\\out\\Offline%20Manifest.gup")));
+  EXPECT_STREQ(_T("goopdate.dll"),
+               GetPayloadMemberName(_T("c:\\out\\TEST_goopdate.dll")));
+  EXPECT_STREQ(_T("goopdate.dll"),
+               GetPayloadMemberName(_T("TEST2_goopdate.dll")));
+  EXPECT_STREQ(_T("MY_TEST_goopdate.dll"),
+               GetPayloadMemberName(_T("MY_TEST_goopdate.dll")));
+}
+
+}  // namespace omaha
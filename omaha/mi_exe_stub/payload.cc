@@ -0,0 +1,146 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/mi_exe_stub/payload.h"
+
+#include <string.h>
+#include <memory>
+#include <new>
+
+#include "omaha/mi_exe_stub/bcj2_decoder.h"
+#include "omaha/mi_exe_stub/chunked_payload_decoder.h"
+#include "omaha/mi_exe_stub/tar.h"
+extern "C" {
+#include "third_party/lzma/files/C/LzmaDec.h"
+}
+
+namespace omaha {
+
+namespace {
+
+// The header of the BCJ2 file in a single stream payload: the size of the
+// original data, followed by the sizes of the main, call, jump and range coder
+// streams, which follow the header in that order.
+const size_t kLegacyBcj2HeaderSize = 5 * sizeof(uint32);  // NOLINT
+
+// TODO(omaha): reimplement the relevant files in the LZMA SDK to optimize
+// for size. We'll have to release the modifications (LZMA SDK is CDDL/CDL),
+// which shouldn't be a problem.
+void* LzmaAlloc(void* p, size_t size) {
+  UNREFERENCED_PARAMETER(p);
+  return new uint8[size];
+}
+
+void LzmaFree(void* p, void* address) {
+  UNREFERENCED_PARAMETER(p);
+  delete[] static_cast<uint8*>(address);
+}
+
+bool WriteToTar(void* context, const uint8* data, size_t size) {
+  return static_cast<Tar*>(context)->Write(data, size);
+}
+
+uint32 ReadUint32(const uint8* p) {
+  uint32 value = 0;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// Decodes the single LZMA stream payload of the metainstallers built before
+// the chunked format. Its BCJ2 file puts the main stream before the side
+// streams, so it is decompressed into memory and passed to Bcj2Decoder in the
+// order it expects, behind a Bcj2Header.
+bool ExtractSingleStreamPayload(const uint8* packed_buffer,
+                                size_t packed_size,
+                                Tar* tar) {
+  // need header and len minimally
+  if (packed_size < LZMA_PROPS_SIZE + sizeof(uint64)) {
+    return false;
+  }
+  const uint8* props = packed_buffer;
+  packed_buffer += LZMA_PROPS_SIZE;
+  packed_size -= LZMA_PROPS_SIZE;
+
+  // TODO(omaha): make this independent of endianness.
+  uint64 unpacked_size_64 = 0;
+  memcpy(&unpacked_size_64, packed_buffer, sizeof(unpacked_size_64));
+  packed_buffer += sizeof(unpacked_size_64);
+  packed_size -= sizeof(unpacked_size_64);
+  if (unpacked_size_64 < kLegacyBcj2HeaderSize ||
+      unpacked_size_64 > static_cast<size_t>(-1)) {
+    return false;
+  }
+
+  SizeT unpacked_size = static_cast<SizeT>(unpacked_size_64);
+  // The size comes from the payload, so a corrupt one must not throw.
+  std::unique_ptr<uint8[]> unpacked_buffer(
+      new (std::nothrow) uint8[unpacked_size]);
+  if (!unpacked_buffer.get()) {
+    return false;
+  }
+
+  ISzAlloc allocators = { &LzmaAlloc, &LzmaFree };
+  ELzmaStatus status = LZMA_STATUS_NOT_SPECIFIED;
+  SizeT in_processed = packed_size;
+  if (SZ_OK != LzmaDecode(unpacked_buffer.get(),
+                          &unpacked_size,
+                          packed_buffer,
+                          &in_processed,
+                          props,
+                          LZMA_PROPS_SIZE,
+                          LZMA_FINISH_END,
+                          &status,
+                          &allocators) ||
+      unpacked_size != unpacked_size_64) {
+    return false;
+  }
+
+  const uint8* p = unpacked_buffer.get();
+  Bcj2Header header = {};
+  header.unpacked_size = ReadUint32(p);
+  header.main_size = ReadUint32(p + sizeof(uint32));       // NOLINT
+  header.call_size = ReadUint32(p + 2 * sizeof(uint32));   // NOLINT
+  header.jump_size = ReadUint32(p + 3 * sizeof(uint32));   // NOLINT
+  header.rc_size = ReadUint32(p + 4 * sizeof(uint32));     // NOLINT
+  p += kLegacyBcj2HeaderSize;
+
+  if (header.main_size + header.call_size + header.jump_size + header.rc_size >
+      unpacked_size - kLegacyBcj2HeaderSize) {
+    return false;
+  }
+  const uint8* main_stream = p;
+  const uint8* side_streams =
+      main_stream + static_cast<size_t>(header.main_size);
+  const size_t side_streams_size =
+      static_cast<size_t>(header.call_size + header.jump_size + header.rc_size);
+
+  Bcj2Decoder bcj2(&WriteToTar, tar);
+  return bcj2.Write(reinterpret_cast<const uint8*>(&header), sizeof(header)) &&
+         bcj2.Write(side_streams, side_streams_size) &&
+         bcj2.Write(main_stream, static_cast<size_t>(header.main_size)) &&
+         bcj2.Finish() &&
+         tar->done();
+}
+
+}  // namespace
+
+bool ExtractPayload(const uint8* packed_buffer, size_t packed_size, Tar* tar) {
+  if (IsChunkedPayload(packed_buffer, packed_size)) {
+    return ExtractChunkedPayload(packed_buffer, packed_size, tar);
+  }
+  return ExtractSingleStreamPayload(packed_buffer, packed_size, tar);
+}
+
+}  // namespace omaha
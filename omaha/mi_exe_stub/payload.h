@@ -0,0 +1,46 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Decoding of the metainstaller payload, which is a tarball either in the
+// chunked format written by payload_packer.exe (see chunked_payload.h), or, for
+// metainstallers built before it, encoded with BCJ2 and compressed with LZMA as
+// a single stream.
+
+#ifndef OMAHA_MI_EXE_STUB_PAYLOAD_H_
+#define OMAHA_MI_EXE_STUB_PAYLOAD_H_
+
+#include <windows.h>
+
+#pragma warning(push)
+// C4310: cast truncates constant value
+#pragma warning(disable : 4310)
+#include "base/basictypes.h"
+#pragma warning(pop)
+
+namespace omaha {
+
+class Tar;
+
+// Decompresses the payload in |packed_buffer| and extracts its files with
+// |tar|. Chunked payloads are decoded by ExtractChunkedPayload(), without ever
+// holding the decompressed tarball in memory. Single stream payloads are
+// decompressed into memory first, as the metainstaller always did for them.
+// Returns true if the whole tarball was extracted, and false if the payload is
+// corrupt.
+bool ExtractPayload(const uint8* packed_buffer, size_t packed_size, Tar* tar);
+
+}  // namespace omaha
+
+#endif  // OMAHA_MI_EXE_STUB_PAYLOAD_H_
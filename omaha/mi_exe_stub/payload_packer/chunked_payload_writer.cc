@@ -0,0 +1,413 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/mi_exe_stub/payload_packer/chunked_payload_writer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "omaha/base/debug.h"
+#include "omaha/base/path.h"
+#include "omaha/base/string.h"
+#include "omaha/mi_exe_stub/chunked_payload.h"
+#include "omaha/mi_exe_stub/tar.h"
+#include "omaha/mi_exe_stub/x86_encoder/bcj2_encoder.h"
+extern "C" {
+#include "third_party/lzma/files/C/Lzma2Enc.h"
+#include "third_party/lzma/files/C/Sha256.h"
+}
+
+namespace omaha {
+
+namespace {
+
+const TCHAR* const kTestPrefixes[] = { _T("TEST_"), _T("TEST2_") };
+
+const size_t kTarBlockSize = sizeof(USTARHeader);
+
+// The smallest dictionary the LZMA encoder accepts.
+const uint32 kMinDictionarySize = 1 << 12;
+
+void* LzmaAlloc(void* p, size_t size) {
+  UNREFERENCED_PARAMETER(p);
+  return new uint8[size];
+}
+
+void LzmaFree(void* p, void* address) {
+  UNREFERENCED_PARAMETER(p);
+  delete[] static_cast<uint8*>(address);
+}
+
+// Adapters between the LZMA SDK streams and memory. The SDK interface must be
+// the first member.
+struct MemoryInStream {
+  ISeqInStream stream;
+  const uint8* data;
+  size_t size;
+};
+
+SRes ReadMemory(void* p, void* buf, size_t* size) {
+  MemoryInStream* in = static_cast<MemoryInStream*>(p);
+  if (*size > in->size) {
+    *size = in->size;
+  }
+  memcpy(buf, in->data, *size);
+  in->data += *size;
+  in->size -= *size;
+  return SZ_OK;
+}
+
+struct StringOutStream {
+  ISeqOutStream stream;
+  std::string* output;
+};
+
+size_t WriteString(void* p, const void* buf, size_t size) {
+  static_cast<StringOutStream*>(p)->output->append(
+      static_cast<const char*>(buf), size);
+  return size;
+}
+
+HRESULT SResToHResult(SRes result) {
+  switch (result) {
+    case SZ_OK:
+      return S_OK;
+    case SZ_ERROR_MEM:
+      return E_OUTOFMEMORY;
+    case SZ_ERROR_PARAM:
+      return E_INVALIDARG;
+    default:
+      return E_FAIL;
+  }
+}
+
+HRESULT Lzma2Encode(const CLzma2EncProps& props,
+                    const std::string& input,
+                    std::string* output) {
+  ISzAlloc allocators = { &LzmaAlloc, &LzmaFree };
+  CLzma2EncHandle encoder = Lzma2Enc_Create(&allocators, &allocators);
+  if (!encoder) {
+    return E_OUTOFMEMORY;
+  }
+
+  MemoryInStream in = { { &ReadMemory },
+                        reinterpret_cast<const uint8*>(input.data()),
+                        input.size() };
+  StringOutStream out = { { &WriteString }, output };
+  output->clear();
+
+  SRes result = Lzma2Enc_SetProps(encoder, &props);
+  if (result == SZ_OK) {
+    result = Lzma2Enc_Encode(encoder, &out.stream, &in.stream, NULL);
+  }
+  Lzma2Enc_Destroy(encoder);
+  return SResToHResult(result);
+}
+
+HRESULT GetLzma2PropsByte(const CLzma2EncProps& props, uint8* props_byte) {
+  ISzAlloc allocators = { &LzmaAlloc, &LzmaFree };
+  CLzma2EncHandle encoder = Lzma2Enc_Create(&allocators, &allocators);
+  if (!encoder) {
+    return E_OUTOFMEMORY;
+  }
+  const SRes result = Lzma2Enc_SetProps(encoder, &props);
+  if (result == SZ_OK) {
+    *props_byte = Lzma2Enc_WriteProperties(encoder);
+  }
+  Lzma2Enc_Destroy(encoder);
+  return SResToHResult(result);
+}
+
+// The blocks of the tarball, shared by the threads that encode them. Each
+// thread takes the next block that nobody has taken yet, so the blocks are
+// encoded in about the order they are written, and the output is the same
+// whatever the number of threads.
+class BlockEncoder {
+ public:
+  BlockEncoder(const std::string& tarball,
+               const ChunkedPayloadOptions& options,
+               const CLzma2EncProps& props,
+               uint32 block_count)
+      : tarball_(tarball),
+        options_(options),
+        props_(props),
+        block_count_(block_count),
+        next_block_(0),
+        failed_(0),
+        index_(block_count),
+        packed_(block_count),
+        results_(block_count, S_OK) {
+  }
+
+  // Encodes all the blocks on up to |num_threads| threads, including the
+  // calling one.
+  HRESULT Run(int num_threads);
+
+  const std::vector<ChunkedPayloadBlock>& index() const { return index_; }
+  const std::vector<std::string>& packed() const { return packed_; }
+
+ private:
+  static DWORD WINAPI ThreadProc(void* param);
+  void EncodeBlocks();
+  HRESULT EncodeBlock(uint32 i);
+
+  const std::string& tarball_;
+  const ChunkedPayloadOptions& options_;
+  const CLzma2EncProps& props_;
+  const uint32 block_count_;
+  volatile LONG next_block_;
+  volatile LONG failed_;
+
+  std::vector<ChunkedPayloadBlock> index_;
+  std::vector<std::string> packed_;
+  std::vector<HRESULT> results_;
+
+  DISALLOW_COPY_AND_ASSIGN(BlockEncoder);
+};
+
+HRESULT BlockEncoder::Run(int num_threads) {
+  if (num_threads <= 0) {
+    SYSTEM_INFO system_info = {};
+    ::GetSystemInfo(&system_info);
+    num_threads = static_cast<int>(system_info.dwNumberOfProcessors);
+  }
+  if (static_cast<uint32>(num_threads) > block_count_) {
+    num_threads = static_cast<int>(block_count_);
+  }
+
+  std::vector<HANDLE> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    HANDLE thread = ::CreateThread(NULL, 0, &ThreadProc, this, 0, NULL);
+    if (!thread) {
+      break;
+    }
+    threads.push_back(thread);
+  }
+
+  EncodeBlocks();
+
+  for (size_t i = 0; i != threads.size(); ++i) {
+    ::WaitForSingleObject(threads[i], INFINITE);
+    ::CloseHandle(threads[i]);
+  }
+
+  for (uint32 i = 0; i != block_count_; ++i) {
+    if (FAILED(results_[i])) {
+      return results_[i];
+    }
+  }
+  return S_OK;
+}
+
+DWORD WINAPI BlockEncoder::ThreadProc(void* param) {
+  static_cast<BlockEncoder*>(param)->EncodeBlocks();
+  return 0;
+}
+
+void BlockEncoder::EncodeBlocks() {
+  while (!failed_) {
+    const LONG i = ::InterlockedIncrement(&next_block_) - 1;
+    if (static_cast<uint32>(i) >= block_count_) {
+      return;
+    }
+    results_[i] = EncodeBlock(static_cast<uint32>(i));
+    if (FAILED(results_[i])) {
+      ::InterlockedExchange(&failed_, 1);
+    }
+  }
+}
+
+HRESULT BlockEncoder::EncodeBlock(uint32 i) {
+  const size_t offset = static_cast<size_t>(i) * options_.block_size;
+  const size_t size = std::min<size_t>(options_.block_size,
+                                       tarball_.size() - offset);
+  const std::string block(tarball_, offset, size);
+
+  std::string filtered;
+  if (options_.use_bcj2) {
+    if (!Bcj2EncodeFile(block, &filtered)) {
+      return E_FAIL;
+    }
+  } else {
+    filtered = block;
+  }
+
+  HRESULT hr = Lzma2Encode(props_, filtered, &packed_[i]);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  if (filtered.size() > UINT_MAX || packed_[i].size() > UINT_MAX) {
+    return E_FAIL;
+  }
+
+  ChunkedPayloadBlock& index_entry = index_[i];
+  memset(&index_entry, 0, sizeof(index_entry));
+  index_entry.packed_size = static_cast<uint32>(packed_[i].size());
+  index_entry.filtered_size = static_cast<uint32>(filtered.size());
+  index_entry.unpacked_size = static_cast<uint32>(size);
+
+  CSha256 sha256;
+  Sha256_Init(&sha256);
+  Sha256_Update(&sha256, reinterpret_cast<const Byte*>(block.data()), size);
+  Sha256_Final(&sha256, index_entry.sha256);
+  return S_OK;
+}
+
+}  // namespace
+
+CString GetPayloadMemberName(const CString& path) {
+  CString name(GetFileFromPath(path));
+  CString unescaped_name;
+  if (SUCCEEDED(StringUnescape(name, &unescaped_name))) {
+    name = unescaped_name;
+  }
+  for (size_t i = 0; i != arraysize(kTestPrefixes); ++i) {
+    if (String_StartsWith(name, kTestPrefixes[i], false)) {
+      name = name.Mid(name.Find(_T('_')) + 1);
+      break;
+    }
+  }
+  return name;
+}
+
+TarballWriter::TarballWriter() {
+}
+
+TarballWriter::~TarballWriter() {
+}
+
+HRESULT TarballWriter::AddFile(const CString& name,
+                               const std::string& contents) {
+  const CStringA ansi_name(name);
+  USTARHeader header = {};
+  if (ansi_name.IsEmpty() ||
+      static_cast<size_t>(ansi_name.GetLength()) > sizeof(header.name)) {
+    return HRESULT_FROM_WIN32(ERROR_FILENAME_EXCED_RANGE);
+  }
+
+  memcpy(header.name, ansi_name.GetString(), ansi_name.GetLength());
+  sprintf_s(header.mode, "%07o", 0644);
+  sprintf_s(header.uid, "%07o", 0);
+  sprintf_s(header.gid, "%07o", 0);
+  sprintf_s(header.size, "%011I64o", static_cast<uint64>(contents.size()));
+  sprintf_s(header.mtime, "%011o", 0);
+  header.typeflag = '0';
+  memcpy(header.magic, "ustar", sizeof(header.magic));
+  memcpy(header.version, "00", sizeof(header.version));
+
+  // The checksum is computed with the checksum field set to spaces.
+  memset(header.chksum, ' ', sizeof(header.chksum));
+  unsigned int checksum = 0;
+  for (size_t i = 0; i != sizeof(header); ++i) {
+    checksum += reinterpret_cast<const uint8*>(&header)[i];
+  }
+  sprintf_s(header.chksum, "%06o", checksum);
+  header.chksum[7] = ' ';
+
+  tarball_.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  tarball_.append(contents);
+  tarball_.append((kTarBlockSize - contents.size() % kTarBlockSize) %
+                      kTarBlockSize,
+                  '\0');
+  return S_OK;
+}
+
+const std::string& TarballWriter::Finish() {
+  tarball_.append(2 * kTarBlockSize, '\0');
+  return tarball_;
+}
+
+ChunkedPayloadOptions::ChunkedPayloadOptions()
+    : block_size(kDefaultChunkedPayloadBlockSize),
+      use_bcj2(true),
+      compression_level(9),
+      num_threads(0) {
+}
+
+HRESULT WriteChunkedPayload(const std::string& tarball,
+                            const ChunkedPayloadOptions& options,
+                            std::string* payload) {
+  ASSERT1(payload);
+
+  if (!options.block_size ||
+      options.block_size > kMaxChunkedPayloadBlockSize ||
+      options.compression_level < 0 ||
+      options.compression_level > 9 ||
+      tarball.empty()) {
+    return E_INVALIDARG;
+  }
+
+  const uint64 block_count =
+      (tarball.size() + options.block_size - 1) / options.block_size;
+  if (block_count > UINT_MAX / sizeof(ChunkedPayloadBlock)) {
+    return E_INVALIDARG;
+  }
+
+  CLzma2EncProps props;
+  Lzma2EncProps_Init(&props);
+  props.lzmaProps.level = options.compression_level;
+  // The dictionary never needs to be larger than a block.
+  props.lzmaProps.dictSize = std::max<uint32>(options.block_size,
+                                              kMinDictionarySize);
+  // The blocks are encoded in parallel instead. The LZMA2 encoder would cut
+  // each block into smaller ones to spread it over threads.
+  props.numTotalThreads = 1;
+  Lzma2EncProps_Normalize(&props);
+
+  ChunkedPayloadHeader header = {};
+  HRESULT hr = GetLzma2PropsByte(props, &header.lzma2_props);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  memcpy(header.magic, kChunkedPayloadMagic, sizeof(header.magic));
+  header.version = kChunkedPayloadVersion;
+  header.header_size = sizeof(header);
+  header.unpacked_size = tarball.size();
+  header.block_size = options.block_size;
+  header.block_count = static_cast<uint32>(block_count);
+  header.filter = static_cast<uint8>(options.use_bcj2 ?
+                                     CHUNKED_PAYLOAD_FILTER_BCJ2 :
+                                     CHUNKED_PAYLOAD_FILTER_NONE);
+
+  BlockEncoder encoder(tarball, options, props, header.block_count);
+  hr = encoder.Run(options.num_threads);
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  std::vector<ChunkedPayloadBlock> blocks(encoder.index());
+  const std::vector<std::string>& packed = encoder.packed();
+  uint64 packed_offset = sizeof(header) + blocks.size() * sizeof(blocks[0]);
+  for (size_t i = 0; i != blocks.size(); ++i) {
+    blocks[i].packed_offset = packed_offset;
+    packed_offset += blocks[i].packed_size;
+  }
+  if (packed_offset > SIZE_MAX) {
+    return E_OUTOFMEMORY;
+  }
+
+  payload->reserve(static_cast<size_t>(packed_offset));
+  payload->assign(reinterpret_cast<const char*>(&header), sizeof(header));
+  payload->append(reinterpret_cast<const char*>(&blocks[0]),
+                  blocks.size() * sizeof(blocks[0]));
+  for (size_t i = 0; i != packed.size(); ++i) {
+    payload->append(packed[i]);
+  }
+  return S_OK;
+}
+
+}  // namespace omaha
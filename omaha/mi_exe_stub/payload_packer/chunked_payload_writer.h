@@ -0,0 +1,78 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Builds the chunked metainstaller payload described in
+// mi_exe_stub/chunked_payload.h. Everything is done in memory; the payloads
+// are at most a few hundred megabytes.
+
+#ifndef OMAHA_MI_EXE_STUB_PAYLOAD_PACKER_CHUNKED_PAYLOAD_WRITER_H_
+#define OMAHA_MI_EXE_STUB_PAYLOAD_PACKER_CHUNKED_PAYLOAD_WRITER_H_
+
+#include <windows.h>
+#include <atlstr.h>
+#include <string>
+
+#include "base/basictypes.h"
+
+namespace omaha {
+
+// Returns the name of the tarball member for the file at |path|. The build
+// urlencodes the spaces in file names, and test files carry a "TEST_" or
+// "TEST2_" prefix; both are undone here.
+CString GetPayloadMemberName(const CString& path);
+
+// Writes a USTAR tarball in memory, in the subset of the format mi_exe_stub's
+// Tar class reads. The headers do not record the time or the owner of the
+// files, so that the same files always give the same tarball.
+class TarballWriter {
+ public:
+  TarballWriter();
+  ~TarballWriter();
+
+  HRESULT AddFile(const CString& name, const std::string& contents);
+
+  // Writes the end-of-archive marker. Returns the tarball.
+  const std::string& Finish();
+
+ private:
+  std::string tarball_;
+
+  DISALLOW_COPY_AND_ASSIGN(TarballWriter);
+};
+
+struct ChunkedPayloadOptions {
+  ChunkedPayloadOptions();
+
+  uint32 block_size;
+  bool use_bcj2;
+
+  // The LZMA compression level, from 0 to 9.
+  int compression_level;
+
+  // The number of blocks compressed at the same time. 0 means one per
+  // processor. This does not change the output.
+  int num_threads;
+};
+
+// Cuts |tarball| into blocks and compresses each one of them on its own into
+// |payload|, on several threads. The output only depends on the input and the
+// options other than |num_threads|.
+HRESULT WriteChunkedPayload(const std::string& tarball,
+                            const ChunkedPayloadOptions& options,
+                            std::string* payload);
+
+}  // namespace omaha
+
+#endif  // OMAHA_MI_EXE_STUB_PAYLOAD_PACKER_CHUNKED_PAYLOAD_WRITER_H_
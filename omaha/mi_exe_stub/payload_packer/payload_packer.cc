@@ -0,0 +1,192 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Packs files into a chunked metainstaller payload. This replaces the
+// generate_tarball.py, bcj2.exe and lzma.exe steps of the metainstaller build.
+//
+// Usage: payload_packer [-block_size <bytes>] [-no_bcj2] [-threads <n>]
+//                       -o <payload> <file>...
+//
+// The blocks of the payload are compressed on one thread per processor unless
+// -threads says otherwise. The payload is the same either way.
+//
+// The first member of the tarball is the manifest of the SHA-256 digests of
+// the other files (see base/payload_manifest.h).
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "omaha/base/payload_manifest.h"
+#include "omaha/mi_exe_stub/payload_packer/chunked_payload_writer.h"
+#include "third_party/lzma/files/C/Sha256.h"
+#include "third_party/smartany/scoped_any.h"
+
+namespace omaha {
+
+namespace {
+
+bool ReadEntireFile(const WCHAR* path, std::string* contents) {
+  scoped_hfile file(::CreateFile(path,
+                                 GENERIC_READ,
+                                 FILE_SHARE_READ,
+                                 NULL,
+                                 OPEN_EXISTING,
+                                 FILE_FLAG_SEQUENTIAL_SCAN,
+                                 NULL));
+  LARGE_INTEGER file_size = {};
+  if (!valid(file) ||
+      !::GetFileSizeEx(get(file), &file_size) ||
+      static_cast<uint64>(file_size.QuadPart) > SIZE_MAX) {
+    return false;
+  }
+
+  contents->resize(static_cast<size_t>(file_size.QuadPart));
+  for (size_t offset = 0; offset != contents->size();) {
+    const DWORD bytes_to_read =
+        static_cast<DWORD>(std::min<size_t>(contents->size() - offset,
+                                            0x40000000));
+    DWORD bytes_read = 0;
+    if (!::ReadFile(get(file), &(*contents)[offset], bytes_to_read,
+                    &bytes_read, NULL) ||
+        bytes_read != bytes_to_read) {
+      return false;
+    }
+    offset += bytes_read;
+  }
+  return true;
+}
+
+bool WriteEntireFile(const WCHAR* path, const std::string& contents) {
+  scoped_hfile file(::CreateFile(path,
+                                 GENERIC_WRITE,
+                                 0,
+                                 NULL,
+                                 CREATE_ALWAYS,
+                                 0,
+                                 NULL));
+  if (!valid(file)) {
+    return false;
+  }
+
+  for (size_t offset = 0; offset != contents.size();) {
+    const DWORD bytes_to_write =
+        static_cast<DWORD>(std::min<size_t>(contents.size() - offset,
+                                            0x40000000));
+    DWORD bytes_written = 0;
+    if (!::WriteFile(get(file), contents.data() + offset, bytes_to_write,
+                     &bytes_written, NULL) ||
+        bytes_written != bytes_to_write) {
+      return false;
+    }
+    offset += bytes_written;
+  }
+  return true;
+}
+
+int PrintUsage() {
+  fwprintf(stderr,
+           L"Usage: payload_packer [-block_size <bytes>] [-no_bcj2] "
+           L"[-threads <n>] -o <payload> <file>...\n");
+  return 1;
+}
+
+}  // namespace
+
+int PackPayload(int argc, WCHAR* argv[]) {
+  ChunkedPayloadOptions options;
+  const WCHAR* output_path = NULL;
+
+  int i = 1;
+  for (; i < argc && argv[i][0] == L'-'; ++i) {
+    if (!wcscmp(argv[i], L"-o") && i + 1 < argc) {
+      output_path = argv[++i];
+    } else if (!wcscmp(argv[i], L"-block_size") && i + 1 < argc) {
+      options.block_size = wcstoul(argv[++i], NULL, 10);
+    } else if (!wcscmp(argv[i], L"-threads") && i + 1 < argc) {
+      options.num_threads = _wtoi(argv[++i]);
+    } else if (!wcscmp(argv[i], L"-no_bcj2")) {
+      options.use_bcj2 = false;
+    } else {
+      return PrintUsage();
+    }
+  }
+  if (!output_path || i == argc) {
+    return PrintUsage();
+  }
+
+  // The files are all read first, since the manifest goes ahead of them.
+  std::vector<std::string> files(argc - i);
+  CStringA manifest;
+  for (int j = i; j < argc; ++j) {
+    std::string& contents = files[j - i];
+    if (!ReadEntireFile(argv[j], &contents)) {
+      fwprintf(stderr, L"Cannot read %s\n", argv[j]);
+      return 2;
+    }
+
+    CSha256 sha256;
+    Sha256_Init(&sha256);
+    Sha256_Update(&sha256,
+                  reinterpret_cast<const Byte*>(contents.data()),
+                  contents.size());
+    uint8 digest[SHA256_DIGEST_SIZE] = {};
+    Sha256_Final(&sha256, digest);
+    PayloadManifest::AppendFile(GetPayloadMemberName(argv[j]),
+                                digest,
+                                &manifest);
+  }
+
+  TarballWriter tarball;
+  HRESULT hr = tarball.AddFile(
+      kPayloadManifestFileName,
+      std::string(manifest.GetString(), manifest.GetLength()));
+  if (FAILED(hr)) {
+    fwprintf(stderr, L"Cannot add the manifest [0x%08x]\n", hr);
+    return 3;
+  }
+  for (int j = i; j < argc; ++j) {
+    hr = tarball.AddFile(GetPayloadMemberName(argv[j]), files[j - i]);
+    if (FAILED(hr)) {
+      fwprintf(stderr, L"Cannot add %s [0x%08x]\n", argv[j], hr);
+      return 3;
+    }
+    std::string().swap(files[j - i]);
+  }
+
+  std::string payload;
+  hr = WriteChunkedPayload(tarball.Finish(), options, &payload);
+  if (FAILED(hr)) {
+    fwprintf(stderr, L"Cannot pack the payload [0x%08x]\n", hr);
+    return 4;
+  }
+
+  if (!WriteEntireFile(output_path, payload)) {
+    fwprintf(stderr, L"Cannot write %s\n", output_path);
+    return 5;
+  }
+  return 0;
+}
+
+}  // namespace omaha
+
+int wmain(int argc, WCHAR* argv[], WCHAR* env[]) {
+  UNREFERENCED_PARAMETER(env);
+  return omaha::PackPayload(argc, argv);
+}
@@ -16,6 +16,8 @@
 
 #include "omaha/mi_exe_stub/tar.h"
 #include <windows.h>
+#include <stdlib.h>
+#include <string.h>
 #pragma warning(push)
 // C4310: cast truncates constant value
 #pragma warning(disable : 4310)
@@ -29,102 +31,430 @@ namespace {
 const char kUstarMagic[] = "ustar";
 const char kUstarDone[5] = { '\0', '\0', '\0', '\0', '\0' };
 
+// Large enough that a typical file of the payload is written with one call,
+// and that a large one is written with few.
+const size_t kBlockSize = 1024 * 1024;
+
+// Sets the size of |file| up front, so that the file system can allocate it in
+// one piece instead of extending it with every write.
+bool PreallocateFile(HANDLE file, uint64 size) {
+  LARGE_INTEGER end = {};
+  end.QuadPart = static_cast<LONGLONG>(size);
+  return ::SetFilePointerEx(file, end, NULL, FILE_BEGIN) &&
+         ::SetEndOfFile(file);
+}
+
+// Writes |size| bytes at |offset| in |file|. The blocks of a file may be
+// written by different threads, so the offset is explicit.
+bool WriteAt(HANDLE file, uint64 offset, const uint8* data, size_t size) {
+  if (!size) {
+    return true;
+  }
+  OVERLAPPED overlapped = {};
+  overlapped.Offset = static_cast<DWORD>(offset);
+  overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  DWORD bytes_written = 0;
+  return ::WriteFile(file,
+                     data,
+                     static_cast<DWORD>(size),
+                     &bytes_written,
+                     &overlapped) &&
+         bytes_written == size;
+}
+
 }  // namespace
 
-Tar::Tar(const CString& target_dir, HANDLE file_handle, bool delete_when_done)
+Tar::Tar(const CString& target_dir, bool delete_when_done)
     : target_directory_name_(target_dir),
-      file_handle_(file_handle),
       delete_when_done_(delete_when_done),
       callback_(NULL),
-      callback_context_(NULL) {}
+      callback_context_(NULL),
+      state_(STATE_HEADER),
+      header_bytes_(0),
+      remaining_(0),
+      padding_(0),
+      num_reported_(0),
+      entry_(NULL),
+      offset_(0),
+      block_(NULL),
+      is_manifest_(false),
+      expected_digest_(NULL),
+      num_queued_(0),
+      num_taken_(0),
+      num_writers_(0),
+      stop_(0) {
+  memset(&header_, 0, sizeof(header_));
+}
 
 Tar::~Tar() {
-  for (int i = 0; i != files_to_delete_.GetSize(); ++i) {
-    DeleteFile(files_to_delete_[i]);
+  StopWriters();
+
+  // A file still open here was not extracted completely.
+  for (int i = 0; i != entries_.GetSize(); ++i) {
+    Entry* entry = entries_[i];
+    if (entry->file != INVALID_HANDLE_VALUE) {
+      ::CloseHandle(entry->file);
+    }
+    if (delete_when_done_ || !entry->closed || entry->failed) {
+      ::DeleteFile(entry->name);
+    }
+    delete entry;
   }
 }
 
-bool Tar::ExtractToDir() {
-  bool done = false;
-  do {
-    if (!ExtractOneFile(&done)) {
+bool Tar::Write(const uint8* data, size_t size) {
+  while (size) {
+    size_t bytes_used = 0;
+    switch (state_) {
+      case STATE_HEADER:
+        bytes_used = sizeof(header_) - header_bytes_;
+        if (bytes_used > size) {
+          bytes_used = size;
+        }
+        memcpy(reinterpret_cast<uint8*>(&header_) + header_bytes_,
+               data,
+               bytes_used);
+        header_bytes_ += bytes_used;
+        if (header_bytes_ == sizeof(header_)) {
+          header_bytes_ = 0;
+          if (!OnHeader()) {
+            return false;
+          }
+        }
+        break;
+
+      case STATE_FILE_DATA:
+        bytes_used = size;
+        if (bytes_used > remaining_) {
+          bytes_used = static_cast<size_t>(remaining_);
+        }
+        if (!BufferFileData(data, bytes_used)) {
+          return false;
+        }
+        UpdateCheck(data, bytes_used);
+        remaining_ -= bytes_used;
+        if (!remaining_) {
+          if (!FinishCheck() || !QueueBlock(true)) {
+            return false;
+          }
+          remaining_ = padding_;
+          state_ = remaining_ ? STATE_PADDING : STATE_HEADER;
+        }
+        break;
+
+      case STATE_PADDING:
+        bytes_used = size;
+        if (bytes_used > remaining_) {
+          bytes_used = static_cast<size_t>(remaining_);
+        }
+        remaining_ -= bytes_used;
+        if (!remaining_) {
+          state_ = STATE_HEADER;
+        }
+        break;
+
+      case STATE_DONE:
+      default:
+        // Whatever follows the end of the archive is padding.
+        return true;
+    }
+
+    data += bytes_used;
+    size -= bytes_used;
+  }
+  return ReportClosedFiles(false);
+}
+
+bool Tar::OnHeader() {
+  if (0 == memcmp(header_.magic, kUstarDone, arraysize(kUstarDone) - 1)) {
+    // We're probably done, since we read the final block of all zeroes. The
+    // archive is only extracted once the writers are done with it.
+    if (!ReportClosedFiles(true)) {
       return false;
     }
-  } while (!done);
+    state_ = STATE_DONE;
+    return true;
+  }
+  if (0 != memcmp(header_.magic, kUstarMagic, arraysize(kUstarMagic) - 1)) {
+    return false;
+  }
+
+  // The name and size fields are not always terminated.
+  char name[kNameSize + 1] = {};
+  memcpy(name, header_.name, sizeof(header_.name));
+  char size[sizeof(header_.size) + 1] = {};
+  memcpy(size, header_.size, sizeof(header_.size));
+
+  // We don't check for conversion errors because the input data is fixed at
+  // build time, so it'll either always work or never work, and we won't ship
+  // one that never works.
+  remaining_ = _strtoui64(size, NULL, 8);
+  padding_ = (512 - remaining_) & 0x1ff;
+
+  if (!StartCheck(CString(name), remaining_)) {
+    return false;
+  }
+
+  CString file_name(target_directory_name_);
+  file_name += "\\";
+  file_name += name;
+  if (!CreateEntry(file_name, remaining_)) {
+    return false;
+  }
+  if (remaining_) {
+    state_ = STATE_FILE_DATA;
+    return true;
+  }
+
+  // An empty file is closed by a writer like any other.
+  if (!FinishCheck() || !GetBlock() || !QueueBlock(true)) {
+    return false;
+  }
+  remaining_ = padding_;
+  state_ = STATE_HEADER;
   return true;
 }
 
-bool Tar::ExtractOneFile(bool *done) {
-  USTARHeader header;
-  DWORD bytes_handled;
-  bool result = true;
-  BOOL file_result;
+bool Tar::CreateEntry(const CString& file_name, uint64 file_size) {
+  if (!num_writers_ && !StartWriters()) {
+    return false;
+  }
 
-  file_result = ::ReadFile(file_handle_, &header, sizeof(USTARHeader),
-      &bytes_handled, NULL);
-  if (!file_result || bytes_handled != sizeof(USTARHeader)) {
+  std::unique_ptr<Entry> entry(new Entry);
+  if (!entry.get()) {
+    return false;
+  }
+  entry->name = file_name;
+  entry->file = ::CreateFile(file_name, GENERIC_WRITE, 0, NULL,
+      CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL);
+  if (entry->file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  if (!entries_.Add(entry.get())) {
+    ::CloseHandle(entry->file);
     return false;
   }
-  if (0 == memcmp(header.magic, kUstarDone, arraysize(kUstarDone) - 1)) {
-    // We're probably done, since we read the final block of all zeroes.
-    *done = true;
+  entry_ = entry.release();
+  offset_ = 0;
+  return !file_size || PreallocateFile(entry_->file, file_size);
+}
+
+bool Tar::BufferFileData(const uint8* data, size_t size) {
+  while (size) {
+    if (block_ && block_->size == kBlockSize && !QueueBlock(false)) {
+      return false;
+    }
+    if (!block_ && !GetBlock()) {
+      return false;
+    }
+    size_t bytes_to_copy = kBlockSize - block_->size;
+    if (bytes_to_copy > size) {
+      bytes_to_copy = size;
+    }
+    memcpy(block_->data.get() + block_->size, data, bytes_to_copy);
+    block_->size += bytes_to_copy;
+    data += bytes_to_copy;
+    size -= bytes_to_copy;
+  }
+  return true;
+}
+
+bool Tar::StartCheck(const CString& name, uint64 file_size) {
+  // Only the first file of the archive can be the manifest.
+  if (!entries_.GetSize() && !name.CompareNoCase(kPayloadManifestFileName)) {
+    if (file_size > kMaxPayloadManifestSize) {
+      return false;
+    }
+    is_manifest_ = true;
+    manifest_data_.Empty();
+    return true;
+  }
+
+  if (!manifest_.num_files()) {
     return true;
   }
-  if (0 != memcmp(header.magic, kUstarMagic, arraysize(kUstarMagic) - 1)) {
+  expected_digest_ = manifest_.FindDigest(name);
+  if (!expected_digest_) {
     return false;
   }
-  CString new_filename(target_directory_name_);
-  new_filename += "\\";
-  new_filename += header.name;
-  HANDLE new_file = ::CreateFile(new_filename, GENERIC_WRITE, 0, NULL,
-      CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL);
-  if (new_file == INVALID_HANDLE_VALUE) {
+  Sha256_Init(&sha256_);
+  return true;
+}
+
+// The data is hashed on the calling thread, right after it has been copied
+// into its block, while it is still in the processor cache.
+void Tar::UpdateCheck(const uint8* data, size_t size) {
+  if (is_manifest_) {
+    manifest_data_.Append(reinterpret_cast<const char*>(data),
+                          static_cast<int>(size));
+  } else if (expected_digest_) {
+    Sha256_Update(&sha256_, data, size);
+  }
+}
+
+bool Tar::FinishCheck() {
+  if (is_manifest_) {
+    is_manifest_ = false;
+    return manifest_.Parse(manifest_data_.GetString(),
+                           manifest_data_.GetLength());
+  }
+
+  if (!expected_digest_) {
+    return true;
+  }
+  uint8 digest[SHA256_DIGEST_SIZE] = {};
+  Sha256_Final(&sha256_, digest);
+  const bool matches = !memcmp(digest, expected_digest_, sizeof(digest));
+  expected_digest_ = NULL;
+  return matches;
+}
+
+// Waits until the writers are done with the next block in the ring, and makes
+// it the block being filled.
+bool Tar::GetBlock() {
+  Block* block = &blocks_[num_queued_ % kNumBlocks];
+  if (::WaitForSingleObject(get(block->free), INFINITE) != WAIT_OBJECT_0) {
     return false;
   }
-  // We don't check for conversion errors because the input data is fixed at
-  // build time, so it'll either always work or never work, and we won't ship
-  // one that never works.
-  DWORD tar_file_size = strtol(header.size, NULL, 8);  // NOLINT
-  DWORD next_offset = ::SetFilePointer(file_handle_, 0, NULL, FILE_CURRENT) +
-      tar_file_size + (512 - tar_file_size & 0x1ff);
-  while (tar_file_size > 0) {
-    const int kCopyBufferSize = 256 * 1024;
-    char copy_buffer[kCopyBufferSize];
-    DWORD bytes_to_handle = kCopyBufferSize;
-    if (bytes_to_handle > tar_file_size) {
-      bytes_to_handle = tar_file_size;
-    }
-    file_result = ::ReadFile(file_handle_, copy_buffer, bytes_to_handle,
-        &bytes_handled, NULL);
-    if (!file_result) {
-      result = false;
-      break;
-    } else {
-      file_result = ::WriteFile(new_file, copy_buffer, bytes_to_handle,
-          &bytes_handled, NULL);
-      if (!file_result) {
-        result = false;
-        break;
-      } else {
-        tar_file_size -= bytes_to_handle;
-      }
+  if (!block->data.get()) {
+    block->data.reset(new uint8[kBlockSize]);
+    if (!block->data.get()) {
+      ::SetEvent(get(block->free));
+      return false;
     }
   }
-  CloseHandle(new_file);
-  if (result) {
-    if (delete_when_done_) {
-      files_to_delete_.Add(new_filename);
+  block->entry = entry_;
+  block->offset = offset_;
+  block->size = 0;
+  block_ = block;
+  return true;
+}
+
+// Hands the block being filled to the writers. The last block of a file takes
+// over the reference of the calling thread, so the writer that finishes the
+// file last closes it.
+bool Tar::QueueBlock(bool is_last) {
+  if (!is_last) {
+    ::InterlockedIncrement(&entry_->pending_blocks);
+  }
+  offset_ += block_->size;
+  block_ = NULL;
+  ++num_queued_;
+  if (is_last) {
+    entry_ = NULL;
+  }
+  return !!::ReleaseSemaphore(get(queued_), 1, NULL);
+}
+
+bool Tar::ReportClosedFiles(bool wait) {
+  while (num_reported_ != entries_.GetSize()) {
+    Entry* entry = entries_[num_reported_];
+    if (!entry->closed) {
+      if (!wait) {
+        return true;
+      }
+      if (::WaitForSingleObject(get(file_closed_), INFINITE) !=
+          WAIT_OBJECT_0) {
+        return false;
+      }
+      continue;
+    }
+    if (entry->failed) {
+      return false;
     }
+    ++num_reported_;
     if (callback_ != NULL) {
-      callback_(callback_context_, new_filename);
+      callback_(callback_context_, entry->name);
+    }
+  }
+  return true;
+}
+
+bool Tar::StartWriters() {
+  for (int i = 0; i != kNumBlocks; ++i) {
+    reset(blocks_[i].free, ::CreateEvent(NULL, false, true, NULL));
+    if (!valid(blocks_[i].free)) {
+      return false;
+    }
+  }
+  // StopWriters() releases one more count per writer.
+  reset(queued_,
+        ::CreateSemaphore(NULL, 0, kNumBlocks + kMaxWriters, NULL));
+  reset(file_closed_, ::CreateEvent(NULL, false, false, NULL));
+  if (!valid(queued_) || !valid(file_closed_)) {
+    return false;
+  }
+
+  // Closing a file is what takes time, and it does not load the processor, so
+  // there is no point in more writers than processors.
+  SYSTEM_INFO system_info = {};
+  ::GetSystemInfo(&system_info);
+  int num_writers = static_cast<int>(system_info.dwNumberOfProcessors);
+  if (num_writers > kMaxWriters) {
+    num_writers = kMaxWriters;
+  }
+  if (num_writers < 1) {
+    num_writers = 1;
+  }
+  for (int i = 0; i != num_writers; ++i) {
+    reset(writers_[i], ::CreateThread(NULL, 0, &WriterProc, this, 0, NULL));
+    if (!valid(writers_[i])) {
+      return false;
     }
+    num_writers_ = i + 1;
   }
+  return true;
+}
 
-  if (INVALID_SET_FILE_POINTER != next_offset) {
-    SetFilePointer(file_handle_, next_offset, NULL, FILE_BEGIN);
+// Stops the writers, whether they are done or not. Blocks that were queued and
+// not taken yet are dropped.
+void Tar::StopWriters() {
+  if (!num_writers_) {
+    return;
   }
+  ::InterlockedExchange(&stop_, 1);
+  ::ReleaseSemaphore(get(queued_), num_writers_, NULL);
+  HANDLE threads[kMaxWriters] = {};
+  for (int i = 0; i != num_writers_; ++i) {
+    threads[i] = get(writers_[i]);
+  }
+  ::WaitForMultipleObjects(static_cast<DWORD>(num_writers_),
+                           threads,
+                           true,
+                           INFINITE);
+  num_writers_ = 0;
+}
+
+DWORD WINAPI Tar::WriterProc(void* param) {
+  static_cast<Tar*>(param)->WriteBlocks();
+  return 0;
+}
 
-  return result;
+void Tar::WriteBlocks() {
+  for (;;) {
+    ::WaitForSingleObject(get(queued_), INFINITE);
+    if (stop_) {
+      return;
+    }
+
+    // The blocks are taken in the order they were queued in.
+    const LONG index = ::InterlockedIncrement(&num_taken_) - 1;
+    Block* block = &blocks_[index % kNumBlocks];
+    Entry* entry = block->entry;
+    if (!WriteAt(entry->file, block->offset, block->data.get(), block->size)) {
+      ::InterlockedExchange(&entry->failed, 1);
+    }
+    ::SetEvent(get(block->free));
+
+    if (!::InterlockedDecrement(&entry->pending_blocks)) {
+      if (!::CloseHandle(entry->file)) {
+        ::InterlockedExchange(&entry->failed, 1);
+      }
+      entry->file = INVALID_HANDLE_VALUE;
+      ::InterlockedExchange(&entry->closed, 1);
+      ::SetEvent(get(file_closed_));
+    }
+  }
 }
 
 }  // namespace omaha
@@ -22,6 +22,16 @@
 #include <atlsimpcoll.h>
 #include <atlstr.h>
 
+#pragma warning(push)
+// C4310: cast truncates constant value
+#pragma warning(disable : 4310)
+#include "base/basictypes.h"
+#pragma warning(pop)
+#include <memory>
+#include "omaha/base/payload_manifest.h"
+#include "omaha/third_party/smartany/scoped_any.h"
+#include "third_party/lzma/files/C/Sha256.h"
+
 namespace omaha {
 
 static const int kNameSize = 100;
@@ -48,9 +58,23 @@ typedef struct {
 
 // Supports untarring of files from a tar-format archive. Pretty minimal;
 // doesn't work with everything in the USTAR format.
+//
+// The archive is pushed through Write() in chunks of any size, and each file
+// is written to the target directory as its data arrives, so the archive
+// itself never needs to be stored.
+//
+// The calling thread only parses the archive, creates the files, and copies
+// their data into large blocks. The blocks are written, and the files closed,
+// by a few writer threads, so that a payload of many small files is not
+// limited by the cost of closing each of them in turn. The callback is still
+// called on the calling thread, in archive order, once a file is closed.
+//
+// If the first file of the archive is the payload manifest (see
+// base/payload_manifest.h), every other file must be listed in it, and is
+// hashed as its data is buffered and rejected if its digest does not match.
 class Tar {
  public:
-  Tar(const CString& target_dir, HANDLE file_handle, bool delete_when_done);
+  Tar(const CString& target_dir, bool delete_when_done);
   ~Tar();
 
   typedef void (*TarFileCallback)(void* context, const TCHAR* filename);
@@ -60,19 +84,115 @@ class Tar {
     callback_context_ = callback_context;
   }
 
-  // Extracts all files in archive to directory specified in constructor.
-  // Directory must exist. Returns true if successful.
-  bool ExtractToDir();
+  // Extracts the next |size| bytes of the archive to the directory specified
+  // in the constructor. Directory must exist. Returns true if successful.
+  // Files may still be written in the background when this returns.
+  bool Write(const uint8* data, size_t size);
+
+  // Returns true once the end of the archive has been reached and all the
+  // files in it have been written and closed.
+  bool done() const { return state_ == STATE_DONE; }
 
  private:
+  enum State {
+    STATE_HEADER,
+    STATE_FILE_DATA,
+    STATE_PADDING,
+    STATE_DONE,
+  };
+
+  // The writers write the blocks queued ahead of them, at most this many at
+  // once, so the calling thread can fill the others in the meantime.
+  static const int kMaxWriters = 4;
+  static const int kNumBlocks = 2 * kMaxWriters;
+
+  // A file of the archive. The calling thread creates it, and the writer
+  // that writes its last block closes it.
+  struct Entry {
+    Entry()
+        : file(INVALID_HANDLE_VALUE),
+          pending_blocks(1),
+          closed(0),
+          failed(0) {
+    }
+
+    CString name;
+    HANDLE file;
+    // The blocks queued and not written yet, plus one until the last block is
+    // queued.
+    volatile LONG pending_blocks;
+    volatile LONG closed;
+    volatile LONG failed;
+  };
+
+  // Data of one file, to be written at |offset| in it.
+  struct Block {
+    Block() : entry(NULL), offset(0), size(0) {}
+
+    Entry* entry;
+    uint64 offset;
+    size_t size;
+    std::unique_ptr<uint8[]> data;
+    // Signaled by the writer when |data| can be filled again.
+    scoped_event free;
+  };
+
+  bool OnHeader();
+  bool CreateEntry(const CString& file_name, uint64 file_size);
+  bool BufferFileData(const uint8* data, size_t size);
+
+  // Start, feed, and finish the checks of the file being extracted against
+  // the manifest, or the reading of the manifest itself.
+  bool StartCheck(const CString& name, uint64 file_size);
+  void UpdateCheck(const uint8* data, size_t size);
+  bool FinishCheck();
+
+  bool GetBlock();
+  bool QueueBlock(bool is_last);
+
+  // Calls the callback for the files closed so far, in archive order. With
+  // |wait|, waits for all the files to be closed first. Returns false if any
+  // of them failed to be written.
+  bool ReportClosedFiles(bool wait);
+
+  bool StartWriters();
+  void StopWriters();
+  static DWORD WINAPI WriterProc(void* param);
+  void WriteBlocks();
+
   CString target_directory_name_;
-  HANDLE file_handle_;
   bool delete_when_done_;
-  CSimpleArray<CString> files_to_delete_;
   TarFileCallback callback_;
   void* callback_context_;
 
-  bool ExtractOneFile(bool* done);
+  State state_;
+  USTARHeader header_;
+  size_t header_bytes_;
+  uint64 remaining_;  // Bytes of file data or padding left in this entry.
+  uint64 padding_;
+
+  CSimpleArray<Entry*> entries_;
+  int num_reported_;
+  Entry* entry_;       // The file being extracted, if any.
+  uint64 offset_;      // Where the data in |block_| goes in that file.
+  Block* block_;       // The block being filled, if any.
+
+  PayloadManifest manifest_;
+  bool is_manifest_;            // The file being extracted is the manifest.
+  CStringA manifest_data_;
+  const uint8* expected_digest_;  // Of the file being extracted, if any.
+  CSha256 sha256_;
+
+  Block blocks_[kNumBlocks];
+  LONG num_queued_;                 // Blocks queued by the calling thread.
+  volatile LONG num_taken_;         // Blocks taken by the writers.
+  scoped_handle queued_;            // Semaphore counting the queued blocks.
+  scoped_event file_closed_;
+  scoped_handle writers_[kMaxWriters];
+  int num_writers_;
+  volatile LONG stop_;
+
+  DISALLOW_COPY_AND_ASSIGN(Tar);
 };
 
 }  // namespace omaha
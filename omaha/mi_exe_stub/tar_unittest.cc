@@ -0,0 +1,287 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "omaha/mi_exe_stub/tar.h"
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "omaha/base/file.h"
+#include "omaha/base/path.h"
+#include "omaha/base/payload_manifest.h"
+#include "omaha/base/utils.h"
+#include "omaha/testing/unit_test.h"
+#include "third_party/lzma/files/C/Sha256.h"
+
+namespace omaha {
+
+namespace {
+
+// Appends a ustar entry for a file named |name| holding |contents|.
+void AppendEntry(const char* name, const std::string& contents,
+                 std::string* archive) {
+  USTARHeader header = {};
+  strcpy_s(header.name, arraysize(header.name), name);
+  sprintf_s(header.size, arraysize(header.size), "%011o",
+            static_cast<unsigned int>(contents.size()));
+  memcpy(header.magic, "ustar", 6);
+  archive->append(reinterpret_cast<const char*>(&header), sizeof(header));
+  *archive += contents;
+  archive->append((512 - contents.size()) & 0x1ff, '\0');
+}
+
+// Appends the line for a file named |name| holding |contents| to |manifest|.
+void AppendManifestLine(const char* name, const std::string& contents,
+                        CStringA* manifest) {
+  CSha256 sha256;
+  Sha256_Init(&sha256);
+  Sha256_Update(&sha256, reinterpret_cast<const Byte*>(contents.data()),
+                contents.size());
+  uint8 digest[SHA256_DIGEST_SIZE] = {};
+  Sha256_Final(&sha256, digest);
+  PayloadManifest::AppendFile(CString(name), digest, manifest);
+}
+
+void AppendEnd(std::string* archive) {
+  archive->append(2 * sizeof(USTARHeader), '\0');
+}
+
+void RecordFile(void* context, const TCHAR* filename) {
+  static_cast<std::vector<CString>*>(context)->push_back(filename);
+}
+
+// Reads the file as the callback sees it, which is once it has been closed.
+void ReadFileInCallback(void* context, const TCHAR* filename) {
+  std::vector<byte> contents;
+  EXPECT_SUCCEEDED(ReadEntireFileShareMode(filename, 0, 0, &contents));
+  static_cast<std::vector<std::string>*>(context)->push_back(
+      std::string(contents.begin(), contents.end()));
+}
+
+}  // namespace
+
+class TarTest : public testing::Test {
+ protected:
+  TarTest() : temp_dir_(GetUniqueTempDirectoryName()) {}
+
+  void SetUp() override {
+    ASSERT_SUCCEEDED(CreateDir(temp_dir_, NULL));
+  }
+
+  void TearDown() override {
+    EXPECT_SUCCEEDED(DeleteDirectory(temp_dir_));
+  }
+
+  static bool WriteInChunks(Tar* tar, const std::string& archive,
+                            size_t chunk_size) {
+    for (size_t offset = 0; offset < archive.size(); offset += chunk_size) {
+      const size_t size = std::min(chunk_size, archive.size() - offset);
+      if (!tar->Write(reinterpret_cast<const uint8*>(&archive[offset]),
+                      size)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::string ReadContents(const CString& path) {
+    std::vector<byte> contents;
+    EXPECT_SUCCEEDED(ReadEntireFileShareMode(path, 0, FILE_SHARE_READ,
+                                             &contents));
+    return contents.empty() ? std::string() :
+        std::string(reinterpret_cast<const char*>(&contents[0]),
+                    contents.size());
+  }
+
+  const CString temp_dir_;
+};
+
+TEST_F(TarTest, ExtractsFilesInChunks) {
+  const std::string kFirst(1000, 'a');
+  const std::string kSecond(512, 'b');
+  std::string archive;
+  AppendEntry("first.exe", kFirst, &archive);
+  AppendEntry("empty.txt", std::string(), &archive);
+  AppendEntry("second.dat", kSecond, &archive);
+  AppendEnd(&archive);
+
+  const size_t kChunkSizes[] = { 1, 100, 511, 512, archive.size() };
+  for (size_t i = 0; i != arraysize(kChunkSizes); ++i) {
+    std::vector<CString> files;
+    {
+      Tar tar(temp_dir_, true);
+      tar.SetCallback(&RecordFile, &files);
+      ASSERT_TRUE(WriteInChunks(&tar, archive, kChunkSizes[i]));
+      EXPECT_TRUE(tar.done());
+
+      ASSERT_EQ(3, files.size());
+      EXPECT_EQ(ConcatenatePath(temp_dir_, _T("first.exe")), files[0]);
+      EXPECT_EQ(kFirst, ReadContents(files[0]));
+      EXPECT_EQ(std::string(), ReadContents(files[1]));
+      EXPECT_EQ(kSecond, ReadContents(files[2]));
+    }
+
+    // The files are deleted with the Tar object.
+    for (size_t j = 0; j != files.size(); ++j) {
+      EXPECT_FALSE(File::Exists(files[j]));
+    }
+  }
+}
+
+// Many small files, and a few larger than the blocks the writers are handed,
+// come out in archive order and complete.
+TEST_F(TarTest, ExtractsManyFiles) {
+  std::vector<std::string> contents;
+  for (int i = 0; i != 300; ++i) {
+    contents.push_back(std::string(i * 37 % 5000,
+                                   static_cast<char>('a' + i % 26)));
+  }
+  contents.push_back(std::string(3 * 1024 * 1024 + 17, 'x'));
+  contents.push_back(std::string(1024 * 1024, 'y'));
+  contents.push_back(std::string());
+
+  std::string archive;
+  for (size_t i = 0; i != contents.size(); ++i) {
+    char name[32] = {};
+    sprintf_s(name, arraysize(name), "file%Iu.dat", i);
+    AppendEntry(name, contents[i], &archive);
+  }
+  AppendEnd(&archive);
+
+  const size_t kChunkSizes[] = { 4096, 1024 * 1024 + 3, archive.size() };
+  for (size_t i = 0; i != arraysize(kChunkSizes); ++i) {
+    std::vector<std::string> files;
+    Tar tar(temp_dir_, true);
+    tar.SetCallback(&ReadFileInCallback, &files);
+    ASSERT_TRUE(WriteInChunks(&tar, archive, kChunkSizes[i]));
+    EXPECT_TRUE(tar.done());
+    ASSERT_EQ(contents.size(), files.size());
+    for (size_t j = 0; j != contents.size(); ++j) {
+      EXPECT_TRUE(contents[j] == files[j]) << j;
+    }
+  }
+}
+
+TEST_F(TarTest, BadMagic) {
+  std::string archive;
+  AppendEntry("first.exe", "abc", &archive);
+  archive[offsetof(USTARHeader, magic)] = 'x';
+
+  Tar tar(temp_dir_, true);
+  EXPECT_FALSE(WriteInChunks(&tar, archive, archive.size()));
+  EXPECT_FALSE(tar.done());
+}
+
+TEST_F(TarTest, IncompleteFileIsDeleted) {
+  std::string archive;
+  AppendEntry("first.exe", std::string(2048, 'a'), &archive);
+  archive.resize(1024);
+
+  {
+    Tar tar(temp_dir_, false);
+    ASSERT_TRUE(WriteInChunks(&tar, archive, archive.size()));
+    EXPECT_FALSE(tar.done());
+    EXPECT_TRUE(File::Exists(ConcatenatePath(temp_dir_, _T("first.exe"))));
+  }
+  EXPECT_FALSE(File::Exists(ConcatenatePath(temp_dir_, _T("first.exe"))));
+}
+
+class TarManifestTest : public TarTest {
+ protected:
+  TarManifestTest() : kFirst(1000, 'a'), kSecond(3 * 1024 * 1024, 'b') {}
+
+  // Builds an archive of two files, led by a manifest of them.
+  std::string BuildArchive(const CStringA& manifest) {
+    std::string archive;
+    AppendEntry("payload.sha256",
+                std::string(manifest.GetString(), manifest.GetLength()),
+                &archive);
+    AppendEntry("first.exe", kFirst, &archive);
+    AppendEntry("empty.txt", std::string(), &archive);
+    AppendEntry("second.dat", kSecond, &archive);
+    AppendEnd(&archive);
+    return archive;
+  }
+
+  CStringA BuildManifest() {
+    CStringA manifest;
+    AppendManifestLine("first.exe", kFirst, &manifest);
+    AppendManifestLine("empty.txt", std::string(), &manifest);
+    AppendManifestLine("second.dat", kSecond, &manifest);
+    return manifest;
+  }
+
+  const std::string kFirst;
+  const std::string kSecond;
+};
+
+TEST_F(TarManifestTest, FilesMatch) {
+  const CStringA manifest(BuildManifest());
+  const std::string archive(BuildArchive(manifest));
+
+  const size_t kChunkSizes[] = { 100, 4096, archive.size() };
+  for (size_t i = 0; i != arraysize(kChunkSizes); ++i) {
+    std::vector<CString> files;
+    Tar tar(temp_dir_, true);
+    tar.SetCallback(&RecordFile, &files);
+    ASSERT_TRUE(WriteInChunks(&tar, archive, kChunkSizes[i]));
+    EXPECT_TRUE(tar.done());
+
+    // The manifest is extracted too, for setup to read.
+    ASSERT_EQ(4, files.size());
+    EXPECT_EQ(ConcatenatePath(temp_dir_, kPayloadManifestFileName), files[0]);
+    EXPECT_STREQ(manifest, ReadContents(files[0]).c_str());
+    EXPECT_EQ(kFirst, ReadContents(files[1]));
+    EXPECT_EQ(kSecond, ReadContents(files[3]));
+  }
+}
+
+TEST_F(TarManifestTest, FileDoesNotMatch) {
+  std::string archive(BuildArchive(BuildManifest()));
+  archive[archive.size() - 2048] ^= 1;
+
+  Tar tar(temp_dir_, false);
+  EXPECT_FALSE(WriteInChunks(&tar, archive, 4096));
+  EXPECT_FALSE(tar.done());
+}
+
+TEST_F(TarManifestTest, EmptyFileDoesNotMatch) {
+  CStringA manifest;
+  AppendManifestLine("first.exe", kFirst, &manifest);
+  AppendManifestLine("empty.txt", "x", &manifest);
+  AppendManifestLine("second.dat", kSecond, &manifest);
+
+  Tar tar(temp_dir_, false);
+  EXPECT_FALSE(WriteInChunks(&tar, BuildArchive(manifest), 4096));
+  EXPECT_FALSE(tar.done());
+}
+
+TEST_F(TarManifestTest, FileNotInManifest) {
+  CStringA manifest;
+  AppendManifestLine("first.exe", kFirst, &manifest);
+  AppendManifestLine("second.dat", kSecond, &manifest);
+
+  Tar tar(temp_dir_, false);
+  EXPECT_FALSE(WriteInChunks(&tar, BuildArchive(manifest), 4096));
+  EXPECT_FALSE(tar.done());
+}
+
+TEST_F(TarManifestTest, MalformedManifest) {
+  Tar tar(temp_dir_, false);
+  EXPECT_FALSE(WriteInChunks(&tar, BuildArchive("not a manifest\n"), 4096));
+  EXPECT_FALSE(tar.done());
+}
+
+}  // namespace omaha
@@ -15,6 +15,7 @@
 //
 // BCJ encodes a file to increase its compressibility.
 
+#include <algorithm>
 #include <string>
 #include <windows.h>
 #include <intsafe.h>
@@ -48,78 +49,53 @@ int wmain(int argc, WCHAR* argv[], WCHAR* env[]) {
     return 3;
   }
 
-  DWORD file_size = static_cast<DWORD>(file_size_data.QuadPart);
-  DWORD bytes_read = 0;
-
-  std::string out1;
-  std::string out2;
-  std::string out3;
-  std::string out4;
+  const uint64 file_size = file_size_data.QuadPart;
+  if (file_size > SIZE_MAX) {
+    return 3;
+  }
 
+  std::string output;
   {
-    std::string buffer(file_size, '\0');
-    if (!::ReadFile(get(file), buffer.data(), file_size, &bytes_read, NULL) ||
-        bytes_read != file_size) {
-      return 4;
+    std::string buffer(static_cast<size_t>(file_size), '\0');
+    for (size_t offset = 0; offset != buffer.size();) {
+      const DWORD bytes_to_read =
+          static_cast<DWORD>(std::min<size_t>(buffer.size() - offset,
+                                              0x40000000));
+      DWORD bytes_read = 0;
+      if (!::ReadFile(get(file), &buffer[offset], bytes_to_read, &bytes_read,
+                      NULL) ||
+          bytes_read != bytes_to_read) {
+        return 4;
+      }
+      offset += bytes_read;
     }
 
-    if (!omaha::Bcj2Encode(buffer, &out1, &out2, &out3, &out4)) {
+    // The format of the BCJ2 file is very primitive. See Bcj2Header.
+    if (!omaha::Bcj2EncodeFile(buffer, &output)) {
       return 5;
     }
   }
 
-  // The format of BCJ2 file is very primitive.
-  // Header is 5 32-bit ints, with the following information:
-  //   unpacked size
-  //   size of stream 1
-  //   size of stream 2
-  //   size of stream 3
-  //   size of stream 4
-  const size_t output_buffer_header[] = {
-    bytes_read,
-    out1.size(),
-    out2.size(),
-    out3.size(),
-    out4.size(),
-  };
-
-  std::string out0(sizeof(output_buffer_header), '\0');
-  if (0 != memcpy_s(out0.data(),
-                    out0.size(),
-                    &output_buffer_header[0],
-                    sizeof(output_buffer_header))) {
-    return 6;
-  }
-
-  if ((out0.size() + out1.size() + out2.size() + out3.size() + out4.size()) >
-      DWORD_MAX) {
-    return 7;
-  }
-
   reset(file,
         ::CreateFile(argv[2], GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL));
   if (!valid(file)) {
     return 8;
   }
 
-  for (const auto& out : { std::move(out0),
-                           std::move(out1),
-                           std::move(out2),
-                           std::move(out3),
-                           std::move(out4) }) {
-    if (out.empty()) {
-      continue;
-    }
-
+  for (size_t offset = 0; offset != output.size();) {
+    const DWORD bytes_to_write =
+        static_cast<DWORD>(std::min<size_t>(output.size() - offset,
+                                            0x40000000));
     DWORD bytes_written = 0;
     if (!::WriteFile(get(file),
-                     out.data(),
-                     out.size(),
+                     output.data() + offset,
+                     bytes_to_write,
                      &bytes_written,
                      NULL) ||
-        bytes_written != out.size()) {
+        bytes_written != bytes_to_write) {
       return 9;
     }
+    offset += bytes_written;
   }
 
   return 0;
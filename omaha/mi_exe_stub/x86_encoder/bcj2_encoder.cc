@@ -67,6 +67,7 @@
 #include "omaha/mi_exe_stub/x86_encoder/bcj2_encoder.h"
 
 #include "base/basictypes.h"
+#include "omaha/mi_exe_stub/bcj2_decoder.h"
 #include "omaha/mi_exe_stub/x86_encoder/range_encoder.h"
 
 namespace omaha {
@@ -169,4 +170,37 @@ bool Bcj2Encode(const std::string& input,
   }
 }
 
+bool Bcj2EncodeFile(const std::string& input, std::string* output) {
+  if (!output) {
+    return false;
+  }
+
+  std::string main_output;
+  std::string call_output;
+  std::string jump_output;
+  std::string misc_output;
+  if (!Bcj2Encode(input, &main_output, &call_output, &jump_output,
+                  &misc_output)) {
+    return false;
+  }
+
+  // The main stream comes last so that the metainstaller can decode it as it
+  // is decompressed, once it has the small side streams.
+  Bcj2Header header = {};
+  header.unpacked_size = input.size();
+  header.main_size = main_output.size();
+  header.call_size = call_output.size();
+  header.jump_size = jump_output.size();
+  header.rc_size = misc_output.size();
+
+  output->assign(reinterpret_cast<const char*>(&header), sizeof(header));
+  output->reserve(sizeof(header) + call_output.size() + jump_output.size() +
+                  misc_output.size() + main_output.size());
+  output->append(call_output);
+  output->append(jump_output);
+  output->append(misc_output);
+  output->append(main_output);
+  return true;
+}
+
 }  // namespace omaha
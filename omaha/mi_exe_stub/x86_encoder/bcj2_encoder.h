@@ -36,6 +36,11 @@ bool Bcj2Encode(const std::string& input,
                 std::string* jump_output,
                 std::string* misc_output);
 
+// Encodes |input| into a BCJ2 file as read by the metainstaller: a Bcj2Header,
+// followed by the call, jump and range coder streams, followed by the main
+// stream. See mi_exe_stub/bcj2_decoder.h.
+bool Bcj2EncodeFile(const std::string& input, std::string* output);
+
 }  // namespace omaha
 
 #endif  // OMAHA_MI_EXE_STUB_X86_ENCODER_BCJ2_ENCODER_H_
@@ -20,6 +20,7 @@
 #include "omaha/base/debug.h"
 #include "omaha/base/error.h"
 #include "omaha/base/logging.h"
+#include "omaha/base/synchronized.h"
 #include "omaha/base/security/p256.h"
 #include "omaha/base/security/p256_ecdsa.h"
 #include "omaha/base/security/sha256.h"
@@ -28,6 +29,50 @@ namespace omaha {
 
 namespace internal {
 
+namespace {
+
+// CUP pins one server key per build, plus the test key, so only a couple of
+// tables are ever built. They live for the lifetime of the process, which
+// lets every CupEcdsaRequestImpl share them.
+const int kMaxPrecomputedPublicKeys = 4;
+
+struct PrecomputedPublicKey {
+  p256_int gx;
+  p256_int gy;
+  p256_precomp table;
+};
+
+LLock precomputed_public_keys_lock;
+PrecomputedPublicKey precomputed_public_keys[kMaxPrecomputedPublicKeys];
+int num_precomputed_public_keys = 0;
+
+// Returns the table for |public_key|, building it on first use, or NULL if
+// the cache is full. The key must be a valid point.
+const p256_precomp* GetPrecomputedPublicKey(const EcdsaPublicKey& public_key) {
+  __mutexScope(precomputed_public_keys_lock);
+
+  for (int i = 0; i < num_precomputed_public_keys; ++i) {
+    const PrecomputedPublicKey& entry = precomputed_public_keys[i];
+    if (p256_cmp(&entry.gx, public_key.gx()) == 0 &&
+        p256_cmp(&entry.gy, public_key.gy()) == 0) {
+      return &entry.table;
+    }
+  }
+
+  if (num_precomputed_public_keys == kMaxPrecomputedPublicKeys) {
+    return NULL;
+  }
+
+  PrecomputedPublicKey& entry =
+      precomputed_public_keys[num_precomputed_public_keys++];
+  entry.gx = *public_key.gx();
+  entry.gy = *public_key.gy();
+  p256_precomp_init(&entry.gx, &entry.gy, &entry.table);
+  return &entry.table;
+}
+
+}  // namespace
+
 bool SafeSHA256Hash(const void* data, size_t len,
                     std::vector<uint8>* hash_out) {
   const size_t kMaxLen = static_cast<size_t>(std::numeric_limits<int>::max());
@@ -380,6 +425,17 @@ bool VerifyEcdsaSignature(const EcdsaPublicKey& public_key,
   p256_int digest_as_int;
   p256_from_bin(&digest.front(), &digest_as_int);
 
+  // The multiples of the public key are computed once per process, which
+  // makes each subsequent verification about twice as fast.
+  if (p256_is_valid_point(public_key.gx(), public_key.gy())) {
+    const p256_precomp* precomp = GetPrecomputedPublicKey(public_key);
+    if (precomp) {
+      return p256_ecdsa_verify_precomp(precomp,
+                                       &digest_as_int,
+                                       signature.r(), signature.s()) != 0;
+    }
+  }
+
   return p256_ecdsa_verify(public_key.gx(), public_key.gy(),
                            &digest_as_int,
                            signature.r(), signature.s()) != 0;
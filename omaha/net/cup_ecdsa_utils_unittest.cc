@@ -17,6 +17,7 @@
 
 #include "omaha/base/string.h"
 #include "omaha/base/security/p256.h"
+#include "omaha/base/security/p256_ecdsa.h"
 #include "omaha/net/cup_ecdsa_utils.h"
 #include "omaha/testing/unit_test.h"
 
@@ -623,6 +624,69 @@ TEST(EcdsaPublicKey, DecodeSubjectPublicKeyInfo_UnsupportedEncoding) {
   EXPECT_FALSE(key.DecodeSubjectPublicKeyInfo(spki));
 }
 
+// Appends |value| to |der| as a DER INTEGER.
+void AppendDerInt256(const p256_int& value, std::vector<uint8>* der) {
+  uint8 bin[P256_NBYTES] = {};
+  p256_to_bin(&value, bin);
+
+  size_t first = 0;
+  while (first < P256_NBYTES - 1 && !bin[first]) {
+    ++first;
+  }
+  const bool needs_pad = (bin[first] & 0x80) != 0;
+
+  der->push_back(0x02);
+  der->push_back(static_cast<uint8>(P256_NBYTES - first + needs_pad));
+  if (needs_pad) {
+    der->push_back(0x00);
+  }
+  der->insert(der->end(), bin + first, bin + P256_NBYTES);
+}
+
+// Signs and verifies the same buffer repeatedly, so that the second and later
+// verifications use the table cached for the public key.
+TEST(VerifyEcdsaSignature, SyntheticKey) {
+  p256_int private_key = P256_ONE;
+  p256_add_d(&private_key, 0x1234567, &private_key);
+
+  p256_int gx, gy;
+  p256_base_point_mul(&private_key, &gx, &gy);
+
+  uint8 encoded_key[2 + 2 * P256_NBYTES] = {0x01, 0x04};
+  p256_to_bin(&gx, &encoded_key[2]);
+  p256_to_bin(&gy, &encoded_key[2 + P256_NBYTES]);
+
+  EcdsaPublicKey key;
+  key.DecodeFromBuffer(encoded_key);
+
+  const uint8 kMessage[] = "CUP-ECDSA signature test message";
+  std::vector<uint8> buffer(kMessage, kMessage + arraysize(kMessage));
+  std::vector<uint8> digest;
+  ASSERT_TRUE(SafeSHA256Hash(buffer, &digest));
+
+  p256_int digest_as_int, r, s;
+  p256_from_bin(&digest.front(), &digest_as_int);
+  p256_ecdsa_sign(&private_key, &digest_as_int, &r, &s);
+
+  std::vector<uint8> ints;
+  AppendDerInt256(r, &ints);
+  AppendDerInt256(s, &ints);
+  std::vector<uint8> der;
+  der.push_back(0x30);
+  der.push_back(static_cast<uint8>(ints.size()));
+  der.insert(der.end(), ints.begin(), ints.end());
+
+  EcdsaSignature signature;
+  ASSERT_TRUE(signature.DecodeFromBuffer(der));
+
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(VerifyEcdsaSignature(key, buffer, signature));
+  }
+
+  buffer[0] ^= 0x01;
+  EXPECT_FALSE(VerifyEcdsaSignature(key, buffer, signature));
+}
+
 }  // namespace internal
 
 }  // namespace omaha
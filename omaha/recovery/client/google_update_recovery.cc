@@ -573,21 +573,38 @@ HRESULT ValidateAndUnpackCRX(const CPath& from_crx_path,
                              CPath* unpacked_exe) {
   ASSERT1(unpacked_exe);
 
+  // The CRX is read once: it is unzipped while its signatures are checked,
+  // and the files are only moved under |unpack_under_path| once it verifies.
+  CPath unpacked_dir = unpack_under_path;
   std::string public_key;
-  if (crx_file::Verify(std::string(CT2A(from_crx_path)),
-                       crx_format,
-                       {crx_hash},
-                       {},
-                       &public_key,
-                       NULL) != crx_file::VerifierResult::OK_FULL) {
-    return CRYPT_E_NO_MATCH;
-  }
-
-  if (!crx_file::Crx3Unzip(from_crx_path, unpack_under_path)) {
-    return E_UNEXPECTED;
+  switch (crx_file::VerifyAndUnzip(from_crx_path,
+                                   crx_format,
+                                   {crx_hash},
+                                   {},
+                                   unpack_under_path,
+                                   &public_key,
+                                   NULL)) {
+    case crx_file::VerifierResult::OK_FULL:
+      break;
+    case crx_file::VerifierResult::ERROR_UNPACK_FAILED: {
+      // The CRX verified, but its archive could not be unzipped from its
+      // local headers alone, for instance because it has stored entries with
+      // data descriptors. It is unzipped from its central directory instead,
+      // into a directory of its own.
+      HRESULT hr = CreateUniqueTempDir(unpack_under_path, &unpacked_dir);
+      if (FAILED(hr)) {
+        return hr;
+      }
+      if (!crx_file::Crx3Unzip(from_crx_path, unpacked_dir)) {
+        return E_UNEXPECTED;
+      }
+      break;
+    }
+    default:
+      return CRYPT_E_NO_MATCH;
   }
 
-  CPath exe = unpack_under_path;
+  CPath exe = unpacked_dir;
   exe += MAIN_EXE_BASE_NAME _T("Setup.exe");
   if (!exe.FileExists()) {
     return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
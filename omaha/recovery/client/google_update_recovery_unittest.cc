@@ -22,6 +22,8 @@
 
 #include <windows.h>
 #include <atlstr.h>
+#include <vector>
+#include "components/crx_file/crx_verifier.h"
 #include "gtest/gtest.h"
 #include "omaha/base/app_util.h"
 #include "omaha/base/const_addresses.h"
@@ -39,6 +41,7 @@
 #include "omaha/net/network_request.h"
 #include "omaha/net/simple_request.h"
 #include "omaha/recovery/client/google_update_recovery.h"
+#include "omaha/testing/unit_test.h"
 
 // TODO(omaha): Replicate some of these tests in signaturevalidator_unittest.cc.
 
@@ -137,6 +140,11 @@ CString MakeTestFilepath(const CString& relpath) {
 
 HRESULT VerifyFileSignature(const CString& filename);
 HRESULT VerifyRepairFileMarkup(const CString& filename);
+HRESULT ValidateAndUnpackCRX(const CPath& from_crx_path,
+                             const crx_file::VerifierFormat& crx_format,
+                             const std::vector<uint8_t>& crx_hash,
+                             const CPath& unpack_under_path,
+                             CPath* unpacked_exe);
 
 class GoogleUpdateRecoveryTest : public testing::Test {
  public:
@@ -839,6 +847,49 @@ TEST_F(GoogleUpdateRecoveryTest, VerifyRepairFileMarkup_BadFilenames) {
 //
 // TODO(omaha): Unit test VerifyIsValidRepairFile.
 
+//
+// ValidateAndUnpackCRX Tests
+//
+// The CRX is signed with a test key, and has a stored entry followed by a data
+// descriptor, which can't be unzipped from its local header alone. It is
+// unzipped from its central directory instead.
+TEST_F(GoogleUpdateRecoveryTest, ValidateAndUnpackCRX_StoredDataDescriptor) {
+  // The SHA-256 of the public key the test CRX is signed with.
+  const uint8_t kTestKeyHash[] = {
+    0xa6, 0x24, 0xda, 0x1e, 0xa2, 0x73, 0x2c, 0x04,
+    0x59, 0xda, 0xc5, 0xeb, 0x6e, 0x29, 0xe0, 0x63,
+    0x08, 0x29, 0x97, 0x90, 0x81, 0x48, 0xdd, 0xe8,
+    0x6d, 0xe6, 0x95, 0xce, 0xad, 0x41, 0x28, 0x94,
+  };
+  const CPath unpack_under_path(GetUniqueTempDirectoryName());
+  ASSERT_HRESULT_SUCCEEDED(CreateDir(unpack_under_path, NULL));
+
+  CPath unpacked_exe;
+  EXPECT_HRESULT_SUCCEEDED(ValidateAndUnpackCRX(
+      CPath(MakeTestFilepath(
+          _T("unittest_support\\stored_data_descriptor.crx3"))),
+      crx_file::VerifierFormat::CRX3,
+      std::vector<uint8_t>(kTestKeyHash,
+                           kTestKeyHash + arraysize(kTestKeyHash)),
+      unpack_under_path,
+      &unpacked_exe));
+  EXPECT_TRUE(File::Exists(unpacked_exe));
+  EXPECT_STREQ(MAIN_EXE_BASE_NAME _T("Setup.exe"),
+               GetFileFromPath(CString(unpacked_exe)));
+
+  // A key hash the CRX is not signed with.
+  CPath not_unpacked_exe;
+  EXPECT_EQ(CRYPT_E_NO_MATCH, ValidateAndUnpackCRX(
+      CPath(MakeTestFilepath(
+          _T("unittest_support\\stored_data_descriptor.crx3"))),
+      crx_file::VerifierFormat::CRX3,
+      std::vector<uint8_t>(arraysize(kTestKeyHash)),
+      unpack_under_path,
+      &not_unpacked_exe));
+
+  EXPECT_HRESULT_SUCCEEDED(DeleteDirectory(unpack_under_path));
+}
+
 //
 // Production Server Response Tests Tests
 //
@@ -22,10 +22,12 @@
 #include "omaha/base/debug.h"
 #include "omaha/base/error.h"
 #include "omaha/base/file.h"
+#include "omaha/base/file_pipeline.h"
 #include "omaha/base/highres_timer-win32.h"
 #include "omaha/base/logging.h"
 #include "omaha/base/omaha_version.h"
 #include "omaha/base/path.h"
+#include "omaha/base/payload_manifest.h"
 #include "omaha/base/reg_key.h"
 #include "omaha/base/scoped_current_directory.h"
 #include "omaha/base/signatures.h"
@@ -41,6 +43,32 @@
 
 namespace omaha {
 
+namespace {
+
+// Reads the manifest the metainstaller leaves next to the files it extracts.
+// The manifest is left empty if there is none, as when setup does not run
+// from the metainstaller.
+void ReadPayloadManifest(const TCHAR* dir, PayloadManifest* manifest) {
+  const CString path(ConcatenatePath(dir, kPayloadManifestFileName));
+  if (!File::Exists(path)) {
+    return;
+  }
+
+  std::vector<byte> contents;
+  HRESULT hr = ReadEntireFileShareMode(path,
+                                       kMaxPayloadManifestSize,
+                                       FILE_SHARE_READ,
+                                       &contents);
+  if (FAILED(hr) ||
+      contents.empty() ||
+      !manifest->Parse(reinterpret_cast<const char*>(&contents.front()),
+                       contents.size())) {
+    SETUP_LOG(LW, (_T("[Cannot read the payload manifest][0x%08x]"), hr));
+  }
+}
+
+}  // namespace
+
 SetupFiles::SetupFiles(bool is_machine)
 : is_machine_(is_machine) {
   SETUP_LOG(L2, (_T("[SetupFiles::SetupFiles]")));
@@ -357,9 +385,20 @@ HRESULT SetupFiles::CopyInstallFiles(const std::vector<CString>& file_names,
                                                   prefix_match);
   VERIFY1(SUCCEEDED(hr) || !vista_util::IsUserAdmin());
 
+  PayloadManifest manifest;
+  ReadPayloadManifest(source_dir, &manifest);
+
   std::vector<CString> source_file_paths;
   std::vector<CString> destination_file_paths;
+  std::vector<std::vector<byte>> expected_hashes;
   for (size_t i = 0; i < file_names.size(); ++i) {
+    std::vector<byte> expected_hash;
+    const uint8* digest = manifest.FindDigest(file_names[i]);
+    if (digest) {
+      expected_hash.assign(digest, digest + kPayloadManifestDigestSize);
+    }
+    expected_hashes.push_back(expected_hash);
+
     CPath file_from(source_dir);
     if (!file_from.Append(file_names[i])) {
       return GOOPDATE_E_PATH_APPEND_FAILED;
@@ -375,6 +414,7 @@ HRESULT SetupFiles::CopyInstallFiles(const std::vector<CString>& file_names,
 
   hr = CopyAndValidateFiles(source_file_paths,
                             destination_file_paths,
+                            expected_hashes,
                             overwrite);
 
   SETUP_LOG(L2, (_T("[SetupFiles::CopyInstallFiles][Done]")));
@@ -384,10 +424,12 @@ HRESULT SetupFiles::CopyInstallFiles(const std::vector<CString>& file_names,
 HRESULT SetupFiles::CopyAndValidateFiles(
     const std::vector<CString>& source_file_paths,
     const std::vector<CString>& destination_file_paths,
+    const std::vector<std::vector<byte>>& expected_hashes,
     bool overwrite) {
   ASSERT1(!source_file_paths.empty());
   ASSERT1(!destination_file_paths.empty());
   ASSERT1(source_file_paths.size() == destination_file_paths.size());
+  ASSERT1(source_file_paths.size() == expected_hashes.size());
 
   if (overwrite) {
     // Best effort attempt to delete the current set of files:
@@ -427,21 +469,34 @@ HRESULT SetupFiles::CopyAndValidateFiles(
 
     // TODO(omaha): Reevaluate the value -- or at least, the naming -- of the
     // overwrite flag.  As it stands, it's largely a debugging tool to force
-    // calls to File::Copy when it's not technically needed.
+    // calls to CopyAndHashFile when it's not technically needed.
+    HRESULT hr = S_OK;
     if (overwrite ||
         !File::Exists(destination_file) ||
         !File::AreFilesIdentical(source_file, destination_file)) {
-      HRESULT hr = File::Copy(source_file, destination_file, true);
-      if (FAILED(hr)) {
+      // The source is hashed while it is copied. The copy of a file the
+      // metainstaller has a hash for is only renamed into place if it
+      // matches; any other copy is verified by reading it back once instead
+      // of comparing both files again.
+      std::vector<byte> source_hash;
+      hr = CopyAndHashFile(source_file,
+                           destination_file,
+                           0,
+                           expected_hashes[i],
+                           &source_hash);
+      if (hr == SIGS_E_INVALID_SIGNATURE) {
+        hr = GOOPDATE_E_POST_COPY_VERIFICATION_FAILED;
+      } else if (FAILED(hr)) {
         OPT_LOG(LE, (_T("[copy failed][from=%s][to=%s][0x%08x]"),
                      source_file, destination_file, hr));
         return hr;
+      } else if (expected_hashes[i].empty()) {
+        CryptoHash crypto;
+        hr = SUCCEEDED(crypto.Validate(destination_file, 0, source_hash)) ?
+                 S_OK : GOOPDATE_E_POST_COPY_VERIFICATION_FAILED;
       }
     }
 
-    HRESULT hr = File::AreFilesIdentical(source_file, destination_file) ?
-                     S_OK : GOOPDATE_E_POST_COPY_VERIFICATION_FAILED;
-
     if (FAILED(hr)) {
       OPT_LOG(LE, (_T("[postcopy verification failed][from=%s][to=%s][0x%x]"),
                    source_file, destination_file, hr));
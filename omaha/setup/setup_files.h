@@ -69,10 +69,13 @@ class SetupFiles {
 
   // Copies each file from the source path to corresponding destination path.
   // If overwrite is true, files are moved to .old and scheduled for delete
-  // after reboot, which only works for elevated admins.
+  // after reboot, which only works for elevated admins. A file with an
+  // expected SHA-256 hash is checked against it as it is copied; any other
+  // file is read back once copied.
   HRESULT CopyAndValidateFiles(
       const std::vector<CString>& source_file_paths,
       const std::vector<CString>& destination_file_paths,
+      const std::vector<std::vector<byte>>& expected_hashes,
       bool overwrite);
 
   // Returns whether an older shell version is compatible.
@@ -26,6 +26,7 @@ import os.path
 import struct
 import SCons.Action
 import SCons.Builder
+import SCons.Defaults
 import SCons.Tool
 from subprocess import PIPE,Popen
 
@@ -134,6 +135,44 @@ def OmahaTagExe(env, target, source, tag):
 
   return tag_cmd
 
+def OmahaTagExes(env, targets, source, tags):
+  """Tags several copies of an EXE in one run of ApplyTag.
+
+  ApplyTag reads and parses the EXE once, and writes the tagged copies in
+  parallel.
+
+  Args:
+    env: The environment.
+    targets: Names of the tagged files.
+    source: Name of the file to be tagged.
+    tags: Tags to be applied, one per target.
+
+  Returns:
+    Output node list from env.Command().
+  """
+
+  def WriteTagsFile(target, source, env):
+    tags_file = open(target[0].abspath + '.tags.txt', 'w')
+    for (node, tag) in zip(target, tags):
+      # The quotes are only needed on a command line.
+      tags_file.write('%s %s\n' % (tag.strip('"'), node.abspath))
+    tags_file.close()
+
+  tag_exe = '$MAIN_DIR/internal/tools/ApplyTag.exe'
+  tag_cmd = env.Command(
+      target=targets,
+      source=source,
+      action=[
+          WriteTagsFile,
+          '"%s" -batch $SOURCE ${TARGET}.tags.txt append' % tag_exe,
+          SCons.Defaults.Delete('${TARGET}.tags.txt'),
+      ],
+  )
+  # The tags are not part of the command line, so they are made a dependency.
+  env.Depends(tag_cmd, env.Value(repr(tags)))
+
+  return tag_cmd
+
 def OmahaBuildTestExe(env, version, major, minor, build, patch):
   """Builds e.g. test_foo_v1_0_101_1.exe
 
@@ -573,6 +612,7 @@ def generate(env):  # pylint: disable=C6409
   env.AddMethod(OmahaCertificateTag)
   env.AddMethod(OmahaCertificateTagForTesting)
   env.AddMethod(OmahaTagExe)
+  env.AddMethod(OmahaTagExes)
   env.AddMethod(OmahaBuildTestExe)
   env.AddMethod(OmahaBuildTestMsi)
   env.AddMethod(IsBuildingModule)
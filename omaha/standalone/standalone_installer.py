@@ -162,7 +162,6 @@ def BuildOfflineInstaller(
     is_official=False,
     installers_sources_path='$MAIN_DIR/installers',
     enterprise_installers_sources_path='$MAIN_DIR/enterprise/installer',
-    lzma_path='$THIRD_PARTY/lzma/files/lzma.exe',
     resmerge_path='$MAIN_DIR/tools/resmerge'):
   """Builds the standalone installers specified by offline_installer.
 
@@ -182,7 +181,6 @@ def BuildOfflineInstaller(
         for building the metainstaller
     enterprise_installers_sources_path: path to the directory containing the
         source files for building enterprise installers
-    lzma_path: path to lzma.exe
     resmerge_path: path to resmerge.exe
 
   Returns:
@@ -252,9 +250,10 @@ def BuildOfflineInstaller(
       INSTALLER_VERSIONS=version_list
       )
 
-  # Use the BCJ2 tool from the official build we're using to generate this
-  # metainstaller, not the current build directory.
-  bcj2_path = omaha_files_path + '/bcj2.exe'
+  # Use the payload packer from the official build we're using to generate this
+  # metainstaller, not the current build directory, so that the payload is in
+  # a format the metainstaller of that build reads.
+  payload_packer_path = omaha_files_path + '/payload_packer.exe'
 
   additional_payload_contents.append(manifest_file_path)
 
@@ -283,9 +282,8 @@ def BuildOfflineInstaller(
       additional_payload_contents_dependencies=offline_installers_file_path,
       output_dir=output_dir,
       installers_sources_path=installers_sources_path,
-      lzma_path=lzma_path,
       resmerge_path=resmerge_path,
-      bcj2_path=bcj2_path
+      payload_packer_path=payload_packer_path
   )
 
   standalone_installer_path = '%s/%s' % (output_dir, target_name)
@@ -351,13 +349,11 @@ def BuildOfflineInstaller(
         bundles[key] = new_bundles_list
 
     tag_meta_installers.SetOutputFileNames(target_name, bundles, '')
-    for bundles_lang in bundles.itervalues():
-      for bundle in bundles_lang:
-        results += tagged_installer.TagOneBundle(
-            env=env,
-            bundle=bundle,
-            untagged_binary_path=standalone_installer_path,
-            output_dir='$TARGET_ROOT/Tagged_Offline_Installers',
-        )
+    results += tagged_installer.TagBundles(
+        env=env,
+        bundles=bundles,
+        untagged_binary_path=standalone_installer_path,
+        output_dir='$TARGET_ROOT/Tagged_Offline_Installers',
+    )
 
   return results
@@ -0,0 +1,176 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Implementation of the file metrics aggregator.
+#include "omaha/statsreport/aggregator-file.h"
+
+namespace stats_report {
+
+namespace {
+
+// Files larger than this are not read; 500 metrics take less than 100KB.
+const LONGLONG kMaxFileSize = 16 * 1024 * 1024;
+
+}  // namespace
+
+bool ReadMetricsFile(const wchar_t *file_path, MetricsFile *file) {
+  DCHECK(file_path);
+  DCHECK(file);
+
+  file->Clear();
+  HANDLE handle = ::CreateFile(file_path,
+                               GENERIC_READ,
+                               FILE_SHARE_READ | FILE_SHARE_DELETE,
+                               NULL,
+                               OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL,
+                               NULL);
+  if (INVALID_HANDLE_VALUE == handle) {
+    const DWORD error = ::GetLastError();
+    return ERROR_FILE_NOT_FOUND == error || ERROR_PATH_NOT_FOUND == error;
+  }
+
+  bool ret = false;
+  LARGE_INTEGER size = {};
+  if (::GetFileSizeEx(handle, &size) &&
+      size.QuadPart > 0 &&
+      size.QuadPart <= kMaxFileSize) {
+    HANDLE mapping = ::CreateFileMapping(handle, NULL, PAGE_READONLY,
+                                         0, 0, NULL);
+    if (mapping) {
+      const void *view = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      if (view) {
+        ret = file->Parse(static_cast<const uint8*>(view),
+                          static_cast<size_t>(size.QuadPart));
+        ::UnmapViewOfFile(view);
+      }
+      ::CloseHandle(mapping);
+    }
+  }
+
+  ::CloseHandle(handle);
+  return ret;
+}
+
+bool WriteMetricsFile(const wchar_t *file_path, const MetricsFile &file) {
+  DCHECK(file_path);
+
+  CString temp_path(file_path);
+  temp_path += L".tmp";
+
+  HANDLE handle = ::CreateFile(temp_path,
+                               GENERIC_READ | GENERIC_WRITE,
+                               0,
+                               NULL,
+                               CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL,
+                               NULL);
+  if (INVALID_HANDLE_VALUE == handle)
+    return false;
+
+  // The file is written through a mapping of its final size, which saves
+  // copying it to an intermediate buffer.
+  bool written = false;
+  const size_t size = file.SerializedSize();
+  HANDLE mapping = ::CreateFileMapping(handle, NULL, PAGE_READWRITE,
+                                       0, static_cast<DWORD>(size), NULL);
+  if (mapping) {
+    void *view = ::MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+    if (view) {
+      file.Serialize(static_cast<uint8*>(view));
+      written = !!::FlushViewOfFile(view, 0);
+      ::UnmapViewOfFile(view);
+    }
+    ::CloseHandle(mapping);
+  }
+  written = written && ::FlushFileBuffers(handle);
+  ::CloseHandle(handle);
+
+  if (!written ||
+      !::MoveFileEx(temp_path,
+                    file_path,
+                    MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    ::DeleteFile(temp_path);
+    return false;
+  }
+  return true;
+}
+
+MetricsAggregatorFile::MetricsAggregatorFile(MetricCollection &coll,  // NOLINT
+                                             const wchar_t *file_path)
+    : MetricsAggregator(coll),
+      file_path_(file_path) {
+  DCHECK(NULL != file_path);
+}
+
+MetricsAggregatorFile::~MetricsAggregatorFile() {
+}
+
+bool MetricsAggregatorFile::StartAggregation() {
+  // A malformed file is started over, as the registry aggregator does with a
+  // malformed value.
+  ReadMetricsFile(file_path_, &file_);
+  return true;
+}
+
+void MetricsAggregatorFile::EndAggregation() {
+  WriteMetricsFile(file_path_, file_);
+  file_.Clear();
+}
+
+void MetricsAggregatorFile::Aggregate(CountMetric &metric) {  // NOLINT
+  // do as little as possible if no value
+  int64 value = metric.Reset();
+  if (0 == value)
+    return;
+
+  file_.AddCount(metric.name(), value);
+}
+
+void MetricsAggregatorFile::Aggregate(TimingMetric &metric) {  // NOLINT
+  // do as little as possible if no value
+  TimingMetric::Histogram histogram;
+  TimingMetric::TimingData value = metric.Reset(&histogram);
+  if (0 == value.count)
+    return;
+
+  file_.AddTiming(metric.name(),
+                  value.count,
+                  value.sum,
+                  value.minimum,
+                  value.maximum,
+                  histogram.counts,
+                  TimingMetric::kNumBuckets);
+}
+
+void MetricsAggregatorFile::Aggregate(IntegerMetric &metric) {  // NOLINT
+  // do as little as possible if no value
+  int64 value = metric.value();
+  if (0 == value)
+    return;
+
+  file_.SetInteger(metric.name(), value);
+}
+
+void MetricsAggregatorFile::Aggregate(BoolMetric &metric) {  // NOLINT
+  // do as little as possible if no value
+  BoolMetric::TristateBoolValue value = metric.Reset();
+  if (BoolMetric::kBoolUnset == value)
+    return;
+
+  file_.SetBool(metric.name(), BoolMetric::kBoolTrue == value);
+}
+
+}  // namespace stats_report
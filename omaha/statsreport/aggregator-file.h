@@ -0,0 +1,72 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// File aggregator, which aggregates metrics to a file in the format of
+// MetricsFile. The file is read through a mapping and written as a whole to a
+// temporary file, which then replaces it, so that it always holds a complete
+// aggregation, even if the process dies while aggregating.
+//
+// The aggregator does no locking of its own; callers serialize aggregations
+// to the same file, as the stats uploader does.
+#ifndef OMAHA_STATSREPORT_AGGREGATOR_FILE_H__
+#define OMAHA_STATSREPORT_AGGREGATOR_FILE_H__
+
+#include <atlbase.h>
+#include <atlstr.h>
+
+#include "omaha/statsreport/aggregator.h"
+#include "omaha/statsreport/metrics_file.h"
+
+namespace stats_report {
+
+/// Reads the metrics file at |file_path| into |file|. A file that does not
+/// exist reads as an empty one.
+/// @return false if the file can't be read or is malformed.
+bool ReadMetricsFile(const wchar_t *file_path, MetricsFile *file);
+
+/// Replaces the metrics file at |file_path| with |file|.
+/// @return false on failure, in which case the file is left as it was.
+bool WriteMetricsFile(const wchar_t *file_path, const MetricsFile &file);
+
+class MetricsAggregatorFile: public MetricsAggregator {
+public:
+  /// @param coll the metrics collection to aggregate, most usually this
+  ///           is g_global_metrics.
+  /// @param file_path the file we aggregate to.
+  MetricsAggregatorFile(MetricCollection &coll, const wchar_t *file_path);
+  virtual ~MetricsAggregatorFile();
+
+protected:
+  virtual bool StartAggregation();
+  virtual void EndAggregation();
+
+  virtual void Aggregate(CountMetric &metric);
+  virtual void Aggregate(TimingMetric &metric);
+  virtual void Aggregate(IntegerMetric &metric);
+  virtual void Aggregate(BoolMetric &metric);
+
+private:
+  CString file_path_;
+
+  /// The metrics in the file, which the aggregation merges into, and which
+  /// replace the file when the aggregation ends.
+  MetricsFile file_;
+
+  DISALLOW_COPY_AND_ASSIGN(MetricsAggregatorFile);
+};
+
+} // namespace stats_report
+
+#endif  // OMAHA_STATSREPORT_AGGREGATOR_FILE_H__
@@ -0,0 +1,185 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include <map>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "omaha/statsreport/aggregator-file.h"
+#include "omaha/statsreport/aggregator_unittest.h"
+#include "omaha/statsreport/persistent_iterator-file.h"
+
+using namespace stats_report;
+
+namespace {
+
+class MetricsAggregatorFileTest: public MetricsAggregatorTest {
+public:
+  virtual void SetUp() {
+    wchar_t temp_dir[MAX_PATH] = {};
+    ASSERT_NE(0, ::GetTempPath(MAX_PATH, temp_dir));
+    file_path_ = temp_dir;
+    file_path_ += L"aggregator-file_unittest.dat";
+    ::DeleteFile(file_path_);
+    MetricsAggregatorTest::SetUp();
+  }
+  virtual void TearDown() {
+    MetricsAggregatorTest::TearDown();
+    ::DeleteFile(file_path_);
+  }
+
+  void AddStats() {
+    ++c1_;
+    ++c2_;
+    ++c2_;
+
+    t1_.AddSample(1000);
+    t1_.AddSample(500);
+
+    t2_.AddSample(2000);
+    t2_.AddSample(30);
+
+    i1_ = 1;
+    i2_ = 2;
+
+    b1_ = true;
+    b2_ = false;
+  }
+
+  CString file_path_;
+};
+
+}  // namespace
+
+TEST_F(MetricsAggregatorFileTest, AggregateFile) {
+  MetricsAggregatorFile agg(coll_, file_path_);
+
+  EXPECT_TRUE(agg.AggregateMetrics());
+  AddStats();
+  EXPECT_TRUE(agg.AggregateMetrics());
+  AddStats();
+  EXPECT_TRUE(agg.AggregateMetrics());
+
+  // The temporary file has replaced the file.
+  EXPECT_EQ(INVALID_FILE_ATTRIBUTES,
+            ::GetFileAttributes(file_path_ + L".tmp"));
+
+  MetricsFile file;
+  ASSERT_TRUE(ReadMetricsFile(file_path_, &file));
+  EXPECT_EQ(8, file.size());
+
+  EXPECT_EQ(2, file.Find(MetricsFile::kCountRecord, "c1")->value);
+  EXPECT_EQ(4, file.Find(MetricsFile::kCountRecord, "c2")->value);
+
+  const MetricsFile::Record *t1 = file.Find(MetricsFile::kTimingRecord, "t1");
+  ASSERT_TRUE(t1 != NULL);
+  EXPECT_EQ(4, t1->count);
+  EXPECT_EQ(3000, t1->sum);
+  EXPECT_EQ(500, t1->minimum);
+  EXPECT_EQ(1000, t1->maximum);
+  ASSERT_EQ(TimingMetric::kNumBuckets, t1->buckets.size());
+  EXPECT_EQ(2, t1->buckets[TimingMetric::BucketForTime(500)]);
+  EXPECT_EQ(2, t1->buckets[TimingMetric::BucketForTime(1000)]);
+
+  const MetricsFile::Record *t2 = file.Find(MetricsFile::kTimingRecord, "t2");
+  ASSERT_TRUE(t2 != NULL);
+  EXPECT_EQ(4, t2->count);
+  EXPECT_EQ(4060, t2->sum);
+  EXPECT_EQ(30, t2->minimum);
+  EXPECT_EQ(2000, t2->maximum);
+
+  EXPECT_EQ(1, file.Find(MetricsFile::kIntegerRecord, "i1")->value);
+  EXPECT_EQ(2, file.Find(MetricsFile::kIntegerRecord, "i2")->value);
+  EXPECT_EQ(1, file.Find(MetricsFile::kBoolRecord, "b1")->value);
+  EXPECT_EQ(0, file.Find(MetricsFile::kBoolRecord, "b2")->value);
+}
+
+TEST_F(MetricsAggregatorFileTest, AggregateFile_Malformed) {
+  // A malformed file is started over.
+  FILE *garbage = NULL;
+  ASSERT_EQ(0, _wfopen_s(&garbage, file_path_, L"wb"));
+  fputs("garbage", garbage);
+  fclose(garbage);
+
+  MetricsFile file;
+  EXPECT_FALSE(ReadMetricsFile(file_path_, &file));
+
+  MetricsAggregatorFile agg(coll_, file_path_);
+  AddStats();
+  EXPECT_TRUE(agg.AggregateMetrics());
+
+  ASSERT_TRUE(ReadMetricsFile(file_path_, &file));
+  EXPECT_EQ(8, file.size());
+  EXPECT_EQ(2, file.Find(MetricsFile::kCountRecord, "c2")->value);
+}
+
+TEST_F(MetricsAggregatorFileTest, Iterate) {
+  // There is nothing to iterate before the first aggregation.
+  PersistentMetricsIteratorFile none(file_path_), end;
+  EXPECT_TRUE(none == end);
+
+  MetricsAggregatorFile agg(coll_, file_path_);
+  AddStats();
+  EXPECT_TRUE(agg.AggregateMetrics());
+
+  // Reset the stats, we should now have the same stats in our collection as
+  // in the file.
+  AddStats();
+
+  std::map<std::string, MetricBase*> metrics;
+  for (MetricIterator it(coll_), coll_end; it != coll_end; ++it)
+    metrics[it->name()] = *it;
+
+  int count = 0;
+  for (PersistentMetricsIteratorFile it(file_path_); it != end; ++it) {
+    ASSERT_TRUE(metrics.count(it->name()));
+    MetricBase *metric = metrics[it->name()];
+    ASSERT_EQ(metric->type(), it->type());
+
+    switch (metric->type()) {
+     case kCountType:
+      EXPECT_EQ(metric->AsCount().value(), it->AsCount().value());
+      break;
+     case kTimingType: {
+      TimingMetric &expected = metric->AsTiming();
+      TimingMetric &actual = it->AsTiming();
+      EXPECT_EQ(expected.count(), actual.count());
+      EXPECT_EQ(expected.sum(), actual.sum());
+      EXPECT_EQ(expected.minimum(), actual.minimum());
+      EXPECT_EQ(expected.maximum(), actual.maximum());
+
+      TimingMetric::Histogram expected_histogram, actual_histogram;
+      expected.GetHistogram(&expected_histogram);
+      actual.GetHistogram(&actual_histogram);
+      EXPECT_EQ(0, memcmp(&expected_histogram,
+                          &actual_histogram,
+                          sizeof(expected_histogram)));
+      break;
+     }
+     case kIntegerType:
+      EXPECT_EQ(metric->AsInteger().value(), it->AsInteger().value());
+      break;
+     case kBoolType:
+      EXPECT_EQ(metric->AsBool().value(), it->AsBool().value());
+      break;
+     default:
+      ADD_FAILURE() << "Impossible metric type";
+      break;
+    }
+    ++count;
+  }
+
+  EXPECT_EQ(metrics.size(), count);
+}
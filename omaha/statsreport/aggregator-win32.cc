@@ -60,6 +60,7 @@ bool MetricsAggregatorWin32::StartAggregation() {
 void MetricsAggregatorWin32::EndAggregation() {
   count_key_.Close();
   timing_key_.Close();
+  histogram_key_.Close();
   integer_key_.Close();
   bool_key_.Close();
 
@@ -101,7 +102,8 @@ void MetricsAggregatorWin32::Aggregate(CountMetric &metric) {  // NOLINT
 
 void MetricsAggregatorWin32::Aggregate(TimingMetric &metric) {  // NOLINT
   // do as little as possible if no value
-  TimingMetric::TimingData value = metric.Reset();
+  TimingMetric::Histogram histogram;
+  TimingMetric::TimingData value = metric.Reset(&histogram);
   if (0 == value.count)
     return;
 
@@ -120,6 +122,23 @@ void MetricsAggregatorWin32::Aggregate(TimingMetric &metric) {  // NOLINT
   }
 
   LONG err = timing_key_.SetBinaryValue(name, &reg_value, sizeof(reg_value));
+
+  // The histograms are kept under a key of their own, so that the timings
+  // keep the format older versions read.
+  if (!EnsureKey(kHistogramsKeyName, &histogram_key_))
+    return;
+
+  TimingMetric::Histogram reg_histogram;
+  if (!GetData(histogram_key_, name, &reg_histogram)) {
+    memcpy(&reg_histogram, &histogram, sizeof(histogram));
+  } else {
+    for (int i = 0; i < TimingMetric::kNumBuckets; ++i)
+      reg_histogram.counts[i] += histogram.counts[i];
+  }
+
+  err = histogram_key_.SetBinaryValue(name,
+                                      &reg_histogram,
+                                      sizeof(reg_histogram));
 }
 
 void MetricsAggregatorWin32::Aggregate(IntegerMetric &metric) {  // NOLINT
@@ -71,6 +71,7 @@ private:
   /// @{
   CRegKey count_key_;
   CRegKey timing_key_;
+  CRegKey histogram_key_;
   CRegKey integer_key_;
   CRegKey bool_key_;
   /// @}
@@ -32,6 +32,8 @@ const wchar_t MetricsAggregatorWin32Test::kCountsKeyName[] =
                                                       KEY_STRING L"\\Counts";
 const wchar_t MetricsAggregatorWin32Test::kTimingsKeyName[] =
                                                       KEY_STRING L"\\Timings";
+const wchar_t MetricsAggregatorWin32Test::kHistogramsKeyName[] =
+                                                   KEY_STRING L"\\Histograms";
 const wchar_t MetricsAggregatorWin32Test::kIntegersKeyName[] =
                                                       KEY_STRING L"\\Integers";
 const wchar_t MetricsAggregatorWin32Test::kBoolsKeyName[] =
@@ -65,6 +67,11 @@ TEST_F(MetricsAggregatorWin32Test, AggregateWin32) {
     EXPECT_REGVAL_EQ(data1, kTimingsKeyName, L"t1");
     EXPECT_REGVAL_EQ(data2, kTimingsKeyName, L"t2");
 
+    TimingMetric::Histogram histogram1 = {};
+    histogram1.counts[TimingMetric::BucketForTime(500)] = 1;
+    histogram1.counts[TimingMetric::BucketForTime(1000)] = 1;
+    EXPECT_REGVAL_EQ(histogram1, kHistogramsKeyName, L"t1");
+
     EXPECT_REGVAL_EQ(one, kIntegersKeyName, L"i1");
     EXPECT_REGVAL_EQ(two, kIntegersKeyName, L"i2");
 
@@ -86,6 +93,12 @@ TEST_F(MetricsAggregatorWin32Test, AggregateWin32) {
     EXPECT_REGVAL_EQ(data1, kTimingsKeyName, L"t1");
     EXPECT_REGVAL_EQ(data2, kTimingsKeyName, L"t2");
 
+    // The histograms are merged too.
+    TimingMetric::Histogram histogram1 = {};
+    histogram1.counts[TimingMetric::BucketForTime(500)] = 2;
+    histogram1.counts[TimingMetric::BucketForTime(1000)] = 2;
+    EXPECT_REGVAL_EQ(histogram1, kHistogramsKeyName, L"t1");
+
     int64 one = 1;
     EXPECT_REGVAL_EQ(one, kIntegersKeyName, L"i1");
     EXPECT_REGVAL_EQ(two, kIntegersKeyName, L"i2");
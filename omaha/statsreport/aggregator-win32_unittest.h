@@ -54,6 +54,7 @@ public:
   static const wchar_t kRootKeyName[];
   static const wchar_t kCountsKeyName[];
   static const wchar_t kTimingsKeyName[];
+  static const wchar_t kHistogramsKeyName[];
   static const wchar_t kIntegersKeyName[];
   static const wchar_t kBoolsKeyName[];
 };
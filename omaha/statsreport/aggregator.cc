@@ -23,11 +23,14 @@ bool MetricsAggregator::AggregateMetrics() {
   if (!StartAggregation())
     return false;
   
-  MetricIterator it(coll_), end;
-  for (; it != end; ++it) {
-    MetricBase *metric = *it;
-    DCHECK(NULL != metric);
-    
+  // Only the metrics changed since the last aggregation are visited.
+  MetricBase *metric = coll_.TakeDirtyMetrics();
+  while (NULL != metric) {
+    // A change from here on chains the metric for the next aggregation,
+    // which overwrites its next_dirty().
+    MetricBase *next = metric->next_dirty();
+    metric->ClearDirty();
+
     switch (metric->type()) {
      case kCountType:
       Aggregate(metric->AsCount());
@@ -35,8 +38,14 @@ bool MetricsAggregator::AggregateMetrics() {
      case kTimingType:
       Aggregate(metric->AsTiming());
       break;
-     case kIntegerType:
-      Aggregate(metric->AsInteger());
+     case kIntegerType: {
+      IntegerMetric &integer = metric->AsInteger();
+      Aggregate(integer);
+      // Integer metrics are sampled rather than reset, so they are
+      // aggregated each time until they go back to zero.
+      if (0 != integer.value())
+        integer.MarkDirty();
+     }
       break;
      case kBoolType:
       Aggregate(metric->AsBool());
@@ -45,6 +54,8 @@ bool MetricsAggregator::AggregateMetrics() {
       DCHECK(false && "Impossible metric type");
       break;
     }
+
+    metric = next;
   }
   
   // done, close up
@@ -57,7 +68,7 @@ MetricsAggregator::MetricsAggregator() : coll_(g_global_metrics) {
   DCHECK(coll_.initialized());
 }
 
-MetricsAggregator::MetricsAggregator(const MetricCollection &coll) 
+MetricsAggregator::MetricsAggregator(MetricCollection &coll)  // NOLINT
     : coll_(coll) {
   DCHECK(coll_.initialized());
 }
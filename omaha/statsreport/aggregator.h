@@ -28,13 +28,14 @@ namespace stats_report {
 /// metrics persistence methods
 class MetricsAggregator {
 public:
-  /// Aggregate all metrics in the associated collection
+  /// Aggregate the metrics of the associated collection which changed since
+  /// the last aggregation. Integer metrics count as changed while non-zero.
   /// @returns true iff aggregation started successfully, false otherwise.
   bool AggregateMetrics();
 
 protected:
   MetricsAggregator();
-  MetricsAggregator(const MetricCollection &coll);
+  MetricsAggregator(MetricCollection &coll);  // NOLINT
   virtual ~MetricsAggregator();
 
   /// Start aggregation. Override this to grab locks, open files, whatever
@@ -52,7 +53,7 @@ protected:
 private:
   DISALLOW_COPY_AND_ASSIGN(MetricsAggregator);
 
-  const MetricCollection &coll_;
+  MetricCollection &coll_;
 };
 
 } // namespace stats_report
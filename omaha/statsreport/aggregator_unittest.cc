@@ -85,6 +85,15 @@ private:
 TEST_F(MetricsAggregatorTest, Aggregate) {
   TestMetricsAggregator agg(coll_);
 
+  ++c1_;
+  ++c2_;
+  t1_.AddSample(10);
+  t2_.AddSample(20);
+  i1_ = 1;
+  i2_ = 2;
+  b1_ = true;
+  b2_ = false;
+
   EXPECT_FALSE(agg.aggregating());
   EXPECT_EQ(0, agg.counts());
   EXPECT_EQ(0, agg.timings());
@@ -100,6 +109,46 @@ TEST_F(MetricsAggregatorTest, Aggregate) {
   EXPECT_TRUE(kNumBools == agg.bools());
 }
 
+TEST_F(MetricsAggregatorTest, AggregateChanged) {
+  TestMetricsAggregator agg(coll_);
+
+  // Nothing changed.
+  EXPECT_TRUE(agg.AggregateMetrics());
+  EXPECT_EQ(0, agg.counts());
+  EXPECT_EQ(0, agg.timings());
+  EXPECT_EQ(0, agg.integers());
+  EXPECT_EQ(0, agg.bools());
+
+  // Metrics changed several times are aggregated once.
+  ++c1_;
+  ++c1_;
+  t2_.AddSample(20);
+  i1_ = 1;
+  b2_ = true;
+  b2_ = false;
+  EXPECT_TRUE(c1_.dirty());
+  EXPECT_FALSE(c2_.dirty());
+  EXPECT_TRUE(agg.AggregateMetrics());
+  EXPECT_EQ(1, agg.counts());
+  EXPECT_EQ(1, agg.timings());
+  EXPECT_EQ(1, agg.integers());
+  EXPECT_EQ(1, agg.bools());
+  EXPECT_FALSE(c1_.dirty());
+
+  // Non-zero integers are aggregated again, the other metrics are not.
+  EXPECT_TRUE(agg.AggregateMetrics());
+  EXPECT_EQ(0, agg.counts());
+  EXPECT_EQ(0, agg.timings());
+  EXPECT_EQ(1, agg.integers());
+  EXPECT_EQ(0, agg.bools());
+
+  i1_ = 0;
+  EXPECT_TRUE(agg.AggregateMetrics());
+  EXPECT_EQ(1, agg.integers());
+  EXPECT_TRUE(agg.AggregateMetrics());
+  EXPECT_EQ(0, agg.integers());
+}
+
 class FailureTestMetricsAggregator: public TestMetricsAggregator {
 public:
   FailureTestMetricsAggregator(MetricCollection &coll) :
@@ -115,5 +164,11 @@ protected:
 TEST_F(MetricsAggregatorTest, AggregateFailure) {
   FailureTestMetricsAggregator agg(coll_);
 
+  ++c1_;
   EXPECT_FALSE(agg.AggregateMetrics());
+
+  // The changes are kept for the next aggregation.
+  TestMetricsAggregator retry_agg(coll_);
+  EXPECT_TRUE(retry_agg.AggregateMetrics());
+  EXPECT_EQ(1, retry_agg.counts());
 }
@@ -0,0 +1,354 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+//
+#include "binary_formatter.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "zlib.h"
+
+namespace stats_report {
+
+namespace {
+
+/// Reports which inflate to more than this are rejected.
+const size_t kMaxPayloadSize = 16 * 1024 * 1024;
+
+void AppendVarint(uint64 value, std::string *output) {
+  while (value >= 0x80) {
+    output->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  output->push_back(static_cast<char>(value));
+}
+
+void AppendSignedVarint(int64 value, std::string *output) {
+  const uint64 bits = static_cast<uint64>(value);
+  AppendVarint((bits << 1) ^ (value < 0 ? ~0ULL : 0ULL), output);
+}
+
+/// Reads the fields of a payload, and fails for good on the first field
+/// which runs past its end.
+class Reader {
+public:
+  Reader(const uint8 *data, size_t size)
+      : data_(data), end_(data + size), failed_(false) {
+  }
+
+  bool at_end() const { return data_ == end_; }
+  bool failed() const { return failed_; }
+
+  uint8 ReadByte() {
+    if (data_ == end_) {
+      failed_ = true;
+      return 0;
+    }
+    return *data_++;
+  }
+
+  uint64 ReadVarint() {
+    uint64 value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      const uint8 byte = ReadByte();
+      value |= static_cast<uint64>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return value;
+    }
+    failed_ = true;
+    return 0;
+  }
+
+  int64 ReadSignedVarint() {
+    const uint64 value = ReadVarint();
+    return static_cast<int64>(value >> 1) ^ -static_cast<int64>(value & 1);
+  }
+
+private:
+  const uint8 *data_;
+  const uint8 *const end_;
+  bool failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(Reader);
+};
+
+bool Inflate(const uint8 *data, size_t size, std::vector<uint8> *output) {
+  z_stream stream = {};
+  if (Z_OK != inflateInit(&stream))
+    return false;
+
+  stream.next_in = const_cast<Bytef*>(data);
+  stream.avail_in = static_cast<uInt>(size);
+
+  int result = Z_OK;
+  while (Z_OK == result) {
+    const size_t used = output->size();
+    if (used >= kMaxPayloadSize)
+      break;
+    output->resize(used + std::max(size * 4, static_cast<size_t>(4096)));
+    stream.next_out = &(*output)[used];
+    stream.avail_out = static_cast<uInt>(output->size() - used);
+    result = inflate(&stream, Z_NO_FLUSH);
+    output->resize(output->size() - stream.avail_out);
+  }
+  inflateEnd(&stream);
+
+  return Z_STREAM_END == result && 0 == stream.avail_in;
+}
+
+bool DecodeTiming(Reader *reader, BinaryReport::Record *record) {
+  record->value = reader->ReadSignedVarint();
+  record->sum = reader->ReadSignedVarint();
+  record->minimum = reader->ReadSignedVarint();
+  record->maximum = record->minimum + reader->ReadSignedVarint();
+
+  const uint64 num_buckets = reader->ReadVarint();
+  if (num_buckets > static_cast<uint64>(TimingMetric::kNumBuckets))
+    return false;
+
+  uint64 index = 0;
+  for (uint64 i = 0; i < num_buckets; ++i) {
+    index += reader->ReadVarint();
+    const uint64 count = reader->ReadVarint();
+    if (index >= static_cast<uint64>(TimingMetric::kNumBuckets) ||
+        count > 0xffffffffULL)
+      return false;
+    record->histogram.counts[index] = static_cast<uint32>(count);
+  }
+  return true;
+}
+
+bool DecodeRecords(Reader *reader, std::vector<BinaryReport::Record> *records) {
+  uint64 id = 0;
+  while (!reader->failed() && !reader->at_end()) {
+    BinaryReport::Record record;
+    memset(&record, 0, sizeof(record));
+
+    id += reader->ReadVarint();
+    if (id > 0xffffffffULL)
+      return false;
+    record.id = static_cast<uint32>(id);
+    record.type = static_cast<MetricType>(reader->ReadByte());
+
+    switch (record.type) {
+     case kCountType:
+     case kIntegerType:
+      record.value = reader->ReadSignedVarint();
+      break;
+     case kTimingType:
+      if (!DecodeTiming(reader, &record))
+        return false;
+      break;
+     case kBoolType:
+      record.value = reader->ReadByte();
+      if (record.value > 1)
+        return false;
+      break;
+     default:
+      return false;
+    }
+
+    records->push_back(record);
+  }
+  return !reader->failed();
+}
+
+bool IdLess(const std::pair<uint32, std::string> &a,
+            const std::pair<uint32, std::string> &b) {
+  return a.first < b.first;
+}
+
+}  // namespace
+
+BinaryFormatter::BinaryFormatter(uint32 measurement_secs)
+    : measurement_secs_(measurement_secs) {
+}
+
+BinaryFormatter::~BinaryFormatter() {
+}
+
+uint32 BinaryFormatter::MetricId(const char *name) {
+  uint32 hash = 2166136261U;
+  for (; *name; ++name) {
+    hash ^= static_cast<uint8>(*name);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+void BinaryFormatter::AddRecord(const char *name,
+                                MetricType type,
+                                const std::string &value) {
+  std::string record(1, static_cast<char>(type));
+  record += value;
+  records_.push_back(std::make_pair(MetricId(name), record));
+}
+
+void BinaryFormatter::AddCount(const char *name, int64 value) {
+  std::string encoded;
+  AppendSignedVarint(value, &encoded);
+  AddRecord(name, kCountType, encoded);
+}
+
+void BinaryFormatter::AddTiming(const char *name,
+                                int64 count,
+                                int64 sum,
+                                int64 min,
+                                int64 max,
+                                const TimingMetric::Histogram &histogram) {
+  std::string encoded;
+  AppendSignedVarint(count, &encoded);
+  AppendSignedVarint(sum, &encoded);
+  AppendSignedVarint(min, &encoded);
+  AppendSignedVarint(max - min, &encoded);
+
+  int num_buckets = 0;
+  for (int i = 0; i < TimingMetric::kNumBuckets; ++i) {
+    if (histogram.counts[i])
+      ++num_buckets;
+  }
+  AppendVarint(static_cast<uint64>(num_buckets), &encoded);
+
+  int previous = 0;
+  for (int i = 0; i < TimingMetric::kNumBuckets; ++i) {
+    if (0 == histogram.counts[i])
+      continue;
+
+    AppendVarint(static_cast<uint64>(i - previous), &encoded);
+    AppendVarint(histogram.counts[i], &encoded);
+    previous = i;
+  }
+
+  AddRecord(name, kTimingType, encoded);
+}
+
+void BinaryFormatter::AddInteger(const char *name, int64 value) {
+  std::string encoded;
+  AppendSignedVarint(value, &encoded);
+  AddRecord(name, kIntegerType, encoded);
+}
+
+void BinaryFormatter::AddBoolean(const char *name, bool value) {
+  AddRecord(name, kBoolType, std::string(1, value ? '\1' : '\0'));
+}
+
+void BinaryFormatter::AddMetric(MetricBase *metric) {
+  switch (metric->type()) {
+    case kCountType: {
+      CountMetric &count = metric->AsCount();
+      AddCount(count.name(), count.value());
+    }
+    break;
+
+    case kTimingType: {
+      TimingMetric &timing = metric->AsTiming();
+      TimingMetric::Histogram histogram;
+      timing.GetHistogram(&histogram);
+      AddTiming(timing.name(), timing.count(), timing.sum(),
+                timing.minimum(), timing.maximum(), histogram);
+    }
+    break;
+
+    case kIntegerType: {
+      IntegerMetric &integer = metric->AsInteger();
+      AddInteger(integer.name(), integer.value());
+    }
+    break;
+
+    case kBoolType: {
+      BoolMetric &boolean = metric->AsBool();
+      DCHECK_NE(boolean.value(), BoolMetric::kBoolUnset);
+      AddBoolean(boolean.name(), boolean.value() != BoolMetric::kBoolFalse);
+    }
+    break;
+
+    default:
+      DCHECK(false && "Impossible metric type");
+  }
+}
+
+bool BinaryFormatter::GetOutput(bool deflate,
+                                std::vector<uint8> *output) const {
+  DCHECK(NULL != output);
+
+  std::vector<std::pair<uint32, std::string> > records(records_);
+  std::stable_sort(records.begin(), records.end(), &IdLess);
+
+  std::string payload;
+  AppendVarint(measurement_secs_, &payload);
+  uint32 previous = 0;
+  for (size_t i = 0; i < records.size(); ++i) {
+    AppendVarint(records[i].first - previous, &payload);
+    payload += records[i].second;
+    previous = records[i].first;
+  }
+
+  output->clear();
+  output->push_back(static_cast<uint8>(kVersion));
+  output->push_back(static_cast<uint8>(deflate ? kDeflated : 0));
+  if (!deflate) {
+    output->insert(output->end(), payload.begin(), payload.end());
+    return true;
+  }
+
+  uLongf deflated_size = compressBound(static_cast<uLong>(payload.size()));
+  output->resize(2 + deflated_size);
+  if (Z_OK != compress2(&(*output)[2],
+                        &deflated_size,
+                        reinterpret_cast<const Bytef*>(payload.data()),
+                        static_cast<uLong>(payload.size()),
+                        Z_BEST_COMPRESSION)) {
+    output->clear();
+    return false;
+  }
+  output->resize(2 + deflated_size);
+  return true;
+}
+
+bool DecodeBinaryReport(const uint8 *data, size_t size, BinaryReport *report) {
+  DCHECK(NULL != report);
+  report->measurement_secs = 0;
+  report->records.clear();
+
+  if (size < 2 ||
+      BinaryFormatter::kVersion != data[0] ||
+      (data[1] & ~BinaryFormatter::kDeflated))
+    return false;
+
+  std::vector<uint8> inflated;
+  const uint8 *payload = data + 2;
+  size_t payload_size = size - 2;
+  if (data[1] & BinaryFormatter::kDeflated) {
+    if (!Inflate(payload, payload_size, &inflated))
+      return false;
+    payload = inflated.empty() ? NULL : &inflated[0];
+    payload_size = inflated.size();
+  }
+
+  Reader reader(payload, payload_size);
+  const uint64 measurement_secs = reader.ReadVarint();
+  if (reader.failed() || measurement_secs > 0xffffffffULL)
+    return false;
+
+  if (!DecodeRecords(&reader, &report->records)) {
+    report->records.clear();
+    return false;
+  }
+  report->measurement_secs = static_cast<uint32>(measurement_secs);
+  return true;
+}
+
+} // namespace stats_report
@@ -0,0 +1,129 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Utility class to format metrics to a compact binary report, the
+// counterpart of Formatter's text, which stays the format to read when
+// debugging.
+//
+// A report is:
+//   version:u8 flags:u8 payload
+// where the payload is deflated, in the zlib format, if flags has kDeflated:
+//   varint(measurement_secs) record*
+//   record  := varint(id delta) type:u8 value
+//   count   := svarint(value)
+//   timing  := svarint(count) svarint(sum) svarint(min) svarint(max - min)
+//              varint(buckets) (varint(index delta) varint(count))*
+//   integer := svarint(value)
+//   boolean := u8(0 or 1)
+// Varints are unsigned LEB128, svarints are zigzag encoded varints. Metrics
+// are identified by MetricId() of their name rather than by the name; the
+// records are sorted by id, and each id is written as its delta from the
+// previous one. The buckets of a histogram are its non-empty ones, each index
+// written as its delta from the previous one.
+#ifndef OMAHA_STATSREPORT_BINARY_FORMATTER_H__
+#define OMAHA_STATSREPORT_BINARY_FORMATTER_H__
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "metrics.h"
+
+namespace stats_report {
+
+/// A utility class that knows how to turn metrics into a binary report.
+class BinaryFormatter {
+public:
+  enum {
+    kVersion = 1,
+  };
+
+  enum Flags {
+    kDeflated = 1,
+  };
+
+  explicit BinaryFormatter(uint32 measurement_secs);
+  ~BinaryFormatter();
+
+  /// Returns the id which stands for the metric |name| in reports, the 32
+  /// bit FNV-1a hash of the name. The ids are stable across versions, so the
+  /// table of ids to names can be generated from the names of the metrics.
+  /// The unit tests check that no two global metrics have the same id; a new
+  /// metric whose id collides must be renamed.
+  static uint32 MetricId(const char *name);
+
+  /// Add metric to the report
+  void AddMetric(MetricBase *metric);
+
+  /// Add typed metrics to the report
+  /// @{
+  void AddCount(const char *name, int64 value);
+  void AddTiming(const char *name,
+                 int64 count,
+                 int64 sum,
+                 int64 min,
+                 int64 max,
+                 const TimingMetric::Histogram &histogram);
+  void AddInteger(const char *name, int64 value);
+  void AddBoolean(const char *name, bool value);
+  /// @}
+
+  /// Writes the report to |output|, deflated if |deflate| is true.
+  /// @return false if the report could not be deflated.
+  bool GetOutput(bool deflate, std::vector<uint8> *output) const;
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(BinaryFormatter);
+
+  /// Adds the record of the metric |name| of |type|, with |value| encoded.
+  void AddRecord(const char *name, MetricType type, const std::string &value);
+
+  const uint32 measurement_secs_;
+
+  /// The records by id, each with its type byte and value encoded.
+  std::vector<std::pair<uint32, std::string> > records_;
+};
+
+/// A binary report, as decoded by DecodeBinaryReport.
+struct BinaryReport {
+  struct Record {
+    uint32 id;
+    MetricType type;
+
+    /// The value of a count, integer or boolean, or the count of a timing.
+    int64 value;
+
+    /// @name Timing values
+    /// @{
+    int64 sum;
+    int64 minimum;
+    int64 maximum;
+    TimingMetric::Histogram histogram;
+    /// @}
+  };
+
+  uint32 measurement_secs;
+  std::vector<Record> records;
+};
+
+/// Decodes the |size| bytes of |data|, written by BinaryFormatter, into
+/// |report|.
+/// @return false if the report is malformed.
+bool DecodeBinaryReport(const uint8 *data, size_t size, BinaryReport *report);
+
+} // namespace stats_report
+
+#endif  // OMAHA_STATSREPORT_BINARY_FORMATTER_H__
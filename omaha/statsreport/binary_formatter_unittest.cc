@@ -0,0 +1,223 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "omaha/statsreport/binary_formatter.h"
+#include "omaha/statsreport/formatter.h"
+
+using stats_report::BinaryFormatter;
+using stats_report::BinaryReport;
+using stats_report::DecodeBinaryReport;
+using stats_report::Formatter;
+using stats_report::MetricIterator;
+using stats_report::TimingMetric;
+
+namespace {
+
+bool Decode(const std::vector<uint8> &output, BinaryReport *report) {
+  return DecodeBinaryReport(&output[0], output.size(), report);
+}
+
+void AddMetrics(int num_metrics, BinaryFormatter *formatter) {
+  for (int i = 0; i < num_metrics; ++i) {
+    char name[32] = {};
+    sprintf_s(name, sizeof(name), "metric_%d", i);
+    formatter->AddCount(name, i);
+  }
+}
+
+}  // namespace
+
+TEST(BinaryFormatter, MetricId) {
+  EXPECT_EQ(0x811c9dc5, BinaryFormatter::MetricId(""));
+  EXPECT_EQ(0xe40c292c, BinaryFormatter::MetricId("a"));
+  EXPECT_EQ(0xe70c2de5, BinaryFormatter::MetricId("b"));
+}
+
+// Reports carry ids instead of names, so two metrics whose names hash to the
+// same id could not be told apart.
+TEST(BinaryFormatter, MetricId_GlobalMetricsAreUnique) {
+  stats_report::g_global_metrics.Initialize();
+
+  std::map<uint32, std::string> names;
+  for (MetricIterator it(stats_report::g_global_metrics), end;
+       it != end;
+       ++it) {
+    const uint32 id = BinaryFormatter::MetricId(it->name());
+    const std::pair<std::map<uint32, std::string>::iterator, bool> inserted =
+        names.insert(std::make_pair(id, std::string(it->name())));
+    EXPECT_TRUE(inserted.second || inserted.first->second == it->name())
+        << it->name() << " and " << inserted.first->second
+        << " have the same id " << id;
+  }
+  EXPECT_FALSE(names.empty());
+
+  // The global metrics collection must be uninitialized before the metrics
+  // destructors are called.
+  stats_report::g_global_metrics.Uninitialize();
+}
+
+TEST(BinaryFormatter, Format) {
+  BinaryFormatter formatter(86400);
+  formatter.AddBoolean("b", true);
+  formatter.AddCount("a", 10);
+
+  // The records are sorted by id, each written as its delta from the one
+  // before.
+  const uint8 kExpected[] = {
+    0x01, 0x00,                          // Version 1, not deflated.
+    0x80, 0xa3, 0x05,                    // 86400 s.
+    0xac, 0xd2, 0xb0, 0xa0, 0x0e,        // Id of "a".
+    0x01, 0x14,                          // Count of 10.
+    0xb9, 0x89, 0x80, 0x18,              // Id of "b" minus id of "a".
+    0x04, 0x01,                          // Boolean true.
+  };
+  std::vector<uint8> output;
+  ASSERT_TRUE(formatter.GetOutput(false, &output));
+  ASSERT_EQ(sizeof(kExpected), output.size());
+  EXPECT_EQ(0, memcmp(kExpected, &output[0], sizeof(kExpected)));
+}
+
+TEST(BinaryFormatter, Roundtrip) {
+  TimingMetric timing("timing1", TimingMetric::TimingData());
+  timing.AddSample(50);
+  timing.AddSample(100);
+  timing.AddSample(100);
+  TimingMetric::Histogram histogram;
+  timing.GetHistogram(&histogram);
+
+  BinaryFormatter formatter(86400);
+  formatter.AddCount("count1", 10);
+  formatter.AddTiming("timing1", 3, 250, 50, 100, histogram);
+  formatter.AddInteger("integer1", -3000);
+  formatter.AddBoolean("boolean1", false);
+
+  for (int deflate = 0; deflate < 2; ++deflate) {
+    std::vector<uint8> output;
+    ASSERT_TRUE(formatter.GetOutput(!!deflate, &output));
+    EXPECT_EQ(deflate ? BinaryFormatter::kDeflated : 0, output[1]);
+
+    BinaryReport report;
+    ASSERT_TRUE(Decode(output, &report));
+    EXPECT_EQ(86400, report.measurement_secs);
+    ASSERT_EQ(4, report.records.size());
+
+    for (size_t i = 0; i < report.records.size(); ++i) {
+      const BinaryReport::Record &record = report.records[i];
+      if (i > 0)
+        EXPECT_LT(report.records[i - 1].id, record.id);
+
+      if (record.id == BinaryFormatter::MetricId("count1")) {
+        EXPECT_EQ(stats_report::kCountType, record.type);
+        EXPECT_EQ(10, record.value);
+      } else if (record.id == BinaryFormatter::MetricId("timing1")) {
+        EXPECT_EQ(stats_report::kTimingType, record.type);
+        EXPECT_EQ(3, record.value);
+        EXPECT_EQ(250, record.sum);
+        EXPECT_EQ(50, record.minimum);
+        EXPECT_EQ(100, record.maximum);
+        EXPECT_EQ(0, memcmp(&histogram,
+                            &record.histogram,
+                            sizeof(histogram)));
+      } else if (record.id == BinaryFormatter::MetricId("integer1")) {
+        EXPECT_EQ(stats_report::kIntegerType, record.type);
+        EXPECT_EQ(-3000, record.value);
+      } else {
+        EXPECT_EQ(BinaryFormatter::MetricId("boolean1"), record.id);
+        EXPECT_EQ(stats_report::kBoolType, record.type);
+        EXPECT_EQ(0, record.value);
+      }
+    }
+  }
+}
+
+// The binary report of a few hundred metrics is a fraction of their text.
+TEST(BinaryFormatter, Size) {
+  const int kNumMetrics = 300;
+
+  Formatter text_formatter("test_application", 86400);
+  for (int i = 0; i < kNumMetrics; ++i) {
+    char name[32] = {};
+    sprintf_s(name, sizeof(name), "metric_%d", i);
+    text_formatter.AddCount(name, i);
+  }
+  const size_t text_size = strlen(text_formatter.output());
+
+  BinaryFormatter formatter(86400);
+  AddMetrics(kNumMetrics, &formatter);
+  std::vector<uint8> plain;
+  std::vector<uint8> deflated;
+  ASSERT_TRUE(formatter.GetOutput(false, &plain));
+  ASSERT_TRUE(formatter.GetOutput(true, &deflated));
+
+  EXPECT_LT(plain.size() * 2, text_size);
+  EXPECT_LT(deflated.size(), text_size);
+
+  BinaryReport report;
+  ASSERT_TRUE(Decode(deflated, &report));
+  EXPECT_EQ(kNumMetrics, report.records.size());
+}
+
+TEST(BinaryFormatter, Decode_Malformed) {
+  BinaryFormatter formatter(86400);
+  formatter.AddCount("count1", 1000);
+  TimingMetric::Histogram histogram = {};
+  histogram.counts[10] = 2;
+  formatter.AddTiming("timing1", 2, 20, 10, 10, histogram);
+
+  std::vector<uint8> good;
+  ASSERT_TRUE(formatter.GetOutput(false, &good));
+  std::vector<uint8> deflated;
+  ASSERT_TRUE(formatter.GetOutput(true, &deflated));
+
+  std::vector<uint8> bad_version(good);
+  bad_version[0] = 2;
+  std::vector<uint8> bad_flags(good);
+  bad_flags[1] = 2;
+  std::vector<uint8> bad_deflate(deflated);
+  bad_deflate[bad_deflate.size() / 2] ^= 0xff;
+  // A record of id 0 and of an unknown type.
+  const uint8 kBadType[] = { 0x01, 0x00, 0x01, 0x00, 0x09 };
+  const std::vector<uint8> bad_type(kBadType, kBadType + sizeof(kBadType));
+  std::vector<uint8> trailing_deflate(deflated);
+  trailing_deflate.push_back(0);
+
+  const std::vector<uint8> kBadReports[] = {
+    std::vector<uint8>(good.begin(), good.begin() + 1),
+    bad_version,
+    bad_flags,
+    bad_deflate,
+    bad_type,
+    trailing_deflate,
+  };
+  for (size_t i = 0; i < arraysize(kBadReports); ++i) {
+    BinaryReport report;
+    EXPECT_FALSE(Decode(kBadReports[i], &report)) << i;
+    EXPECT_TRUE(report.records.empty()) << i;
+  }
+
+  // A truncated report is malformed, unless it ends between records.
+  for (size_t size = 2; size < good.size(); ++size) {
+    BinaryReport report;
+    if (DecodeBinaryReport(&good[0], size, &report))
+      EXPECT_GT(2, report.records.size()) << size;
+  }
+}
@@ -21,6 +21,7 @@
 namespace stats_report {
 
 const wchar_t kTimingsKeyName[] = L"Timings";
+const wchar_t kHistogramsKeyName[] = L"Histograms";
 const wchar_t kCountsKeyName[] = L"Counts";
 const wchar_t kIntegersKeyName[] = L"Integers";
 const wchar_t kBooleansKeyName[] = L"Booleans";
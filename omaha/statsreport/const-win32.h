@@ -21,6 +21,7 @@ namespace stats_report {
 
 extern const wchar_t kCountsKeyName[];
 extern const wchar_t kTimingsKeyName[];
+extern const wchar_t kHistogramsKeyName[];
 extern const wchar_t kIntegersKeyName[];
 extern const wchar_t kBooleansKeyName[];
 extern const wchar_t kStatsKeyFormatString[];
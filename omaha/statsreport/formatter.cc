@@ -18,6 +18,18 @@
 
 namespace stats_report {
 
+namespace {
+
+bool IsEmpty(const TimingMetric::Histogram &histogram) {
+  for (int i = 0; i < TimingMetric::kNumBuckets; ++i) {
+    if (histogram.counts[i])
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
 Formatter::Formatter(const char *name, uint32 measurement_secs) {
   output_ << name << "&" << measurement_secs;
 }
@@ -35,6 +47,38 @@ void Formatter::AddTiming(const char *name, int64 num, int64 avg,
                                   << avg << ";" << min << ";" << max;
 }
 
+// A histogram is written as its 50th, 90th, 99th and 99.9th percentiles,
+// followed by its non-empty buckets as <index delta>.<count> pairs, where the
+// index delta is from the previous non-empty bucket, or from bucket 0:
+//   name:h=p50;p90;p99;p999;d1.c1,d2.c2,...
+// The percentiles are capped at the maximum of the timing. Nothing is written
+// for an empty histogram, such as one persisted before histograms were kept.
+void Formatter::AddHistogram(const char *name,
+                             const TimingMetric::Histogram &histogram,
+                             int64 max) {
+  static const int kPerMille[] = { 500, 900, 990, 999 };
+
+  if (IsEmpty(histogram))
+    return;
+
+  output_ << "&" << name << ":h=";
+  for (size_t i = 0; i < arraysize(kPerMille); ++i) {
+    const int64 percentile = TimingMetric::Percentile(histogram, kPerMille[i]);
+    output_ << (percentile < max ? percentile : max) << ";";
+  }
+
+  int previous = 0;
+  const char *separator = "";
+  for (int i = 0; i < TimingMetric::kNumBuckets; ++i) {
+    if (0 == histogram.counts[i])
+      continue;
+
+    output_ << separator << i - previous << "." << histogram.counts[i];
+    separator = ",";
+    previous = i;
+  }
+}
+
 void Formatter::AddInteger(const char *name, int64 value) {
   output_ << "&" << name << ":i=" << value;
 }
@@ -55,6 +99,10 @@ void Formatter::AddMetric(MetricBase *metric) {
       TimingMetric &timing = metric->AsTiming();
       AddTiming(timing.name(), timing.count(), timing.average(),
                 timing.minimum(), timing.maximum());
+
+      TimingMetric::Histogram histogram;
+      timing.GetHistogram(&histogram);
+      AddHistogram(timing.name(), histogram, timing.maximum());
     }
     break;
 
@@ -41,6 +41,9 @@ public:
   void AddCount(const char *name, int64 value);
   void AddTiming(const char *name, int64 num, int64 avg, int64 min,
                  int64 max);
+  void AddHistogram(const char *name,
+                    const TimingMetric::Histogram &histogram,
+                    int64 max);
   void AddInteger(const char *name, int64 value);
   void AddBoolean(const char *name, bool value);
   /// @}
@@ -17,6 +17,7 @@
 #include "omaha/statsreport/formatter.h"
 
 using stats_report::Formatter;
+using stats_report::TimingMetric;
 
 TEST(Formatter, Format) {
   Formatter formatter("test_application", 86400);
@@ -34,4 +35,42 @@ TEST(Formatter, Format) {
                "&boolean1:b=t"
                "&boolean2:b=f",
                formatter.output());
-}
\ No newline at end of file
+}
+TEST(Formatter, FormatHistogram) {
+  TimingMetric timing("timing1", TimingMetric::TimingData());
+  timing.AddSample(50);
+  timing.AddSample(100);
+  TimingMetric::Histogram histogram;
+  timing.GetHistogram(&histogram);
+
+  Formatter formatter("test_application", 86400);
+  formatter.AddHistogram("timing1", histogram, 100);
+
+  // 50 ms is in bucket 28, which goes up to 51 ms, and 100 ms in bucket 36.
+  EXPECT_STREQ("test_application&86400"
+               "&timing1:h=51;100;100;100;28.1,8.1",
+               formatter.output());
+}
+
+TEST(Formatter, FormatEmptyHistogram) {
+  TimingMetric::Histogram histogram = {};
+
+  Formatter formatter("test_application", 86400);
+  formatter.AddHistogram("timing1", histogram, 0);
+
+  EXPECT_STREQ("test_application&86400", formatter.output());
+}
+
+TEST(Formatter, AddTimingMetric) {
+  TimingMetric timing("timing1", TimingMetric::TimingData());
+  timing.AddSample(500);
+  timing.AddSample(1000);
+
+  Formatter formatter("test_application", 86400);
+  formatter.AddMetric(&timing);
+
+  EXPECT_STREQ("test_application&86400"
+               "&timing1:t=2;750;500;1000"
+               "&timing1:h=511;1000;1000;1000;55.1,8.1",
+               formatter.output());
+}
@@ -16,63 +16,29 @@
 // Implements metrics and metrics collections
 #include "omaha/statsreport/metrics.h"
 #include <stdint.h>
+#include <intrin.h>
 #include <limits>
-#include "omaha/base/synchronized.h"
 
 namespace stats_report {
 // Make sure global stats collection is placed in zeroed storage so as to avoid
 // initialization order snafus.
-MetricCollectionBase g_global_metric_storage = { 0, 0 };
+MetricCollectionBase g_global_metric_storage = { 0, 0, 0 };
 MetricCollection &g_global_metrics =
                   *static_cast<MetricCollection*>(&g_global_metric_storage);
 
-#pragma warning(push)
-// C4073: initializers put in library initialization area.
-#pragma warning(disable : 4073)
-
-// Serialize all metric manipulation and access under this lock.
-//
-// Initializes g_lock before other global objects of user defined types.
-// It assumes the program is single threaded while executing CRT startup and
-// exit code.
-#pragma init_seg(lib)
-omaha::LLock g_lock;
-#pragma warning(pop)
-
-class MetricBase::ObjectLock {
-public:
-  ObjectLock(const MetricBase *metric) : metric_(metric) {
-    metric_->Lock();
-  }
-
-  ~ObjectLock() {
-    metric_->Unlock();
-  }
-
-private:
-  MetricBase const *const metric_;
-  DISALLOW_COPY_AND_ASSIGN(MetricBase::ObjectLock);
-};
-
-void MetricBase::Lock() const {
-  g_lock.Lock();
-}
-
-void MetricBase::Unlock() const {
-  g_lock.Unlock();
-}
-
 MetricBase::MetricBase(const char *name,
                        MetricType type,
                        MetricCollectionBase *coll)
-    : name_(name), type_(type), next_(coll->first_), coll_(coll) {
+    : name_(name), type_(type), next_(coll->first_), coll_(coll), dirty_(0),
+      next_dirty_(NULL) {
   DCHECK_NE(static_cast<MetricCollectionBase*>(NULL), coll_);
   DCHECK_EQ(false, coll_->initialized_);
   coll->first_ = this;
 }
 
 MetricBase::MetricBase(const char *name, MetricType type)
-    : name_(name), type_(type), next_(NULL), coll_(NULL) {
+    : name_(name), type_(type), next_(NULL), coll_(NULL), dirty_(0),
+      next_dirty_(NULL) {
 }
 
 MetricBase::~MetricBase() {
@@ -87,141 +53,313 @@ MetricBase::~MetricBase() {
   }
 }
 
+void MetricBase::ChainDirty() {
+  // Metrics outside of a collection, such as the ones read back from
+  // persistent storage, are not tracked.
+  if (NULL == coll_ || 0 != ::InterlockedCompareExchange(&dirty_, 1, 0))
+    return;
+
+  // The list is only ever taken whole, so pushing with a compare-exchange of
+  // its head is safe from the ABA problem.
+  PVOID volatile *head = reinterpret_cast<PVOID volatile *>(&coll_->dirty_);
+  PVOID current = *head;
+  for (;;) {
+    next_dirty_ = static_cast<MetricBase*>(current);
+    const PVOID previous =
+        ::InterlockedCompareExchangePointer(head, this, current);
+    if (previous == current)
+      return;
+    current = previous;
+  }
+}
+
+void MetricBase::ClearDirty() {
+  ::InterlockedExchange(&dirty_, 0);
+}
+
+namespace {
+
+// Reads a 64 bit value atomically, which a plain read is not on x86.
+int64 ReadCell(const volatile LONGLONG *value) {
+  return ::InterlockedCompareExchange64(const_cast<volatile LONGLONG*>(value),
+                                        0,
+                                        0);
+}
+
+// What the minimum and maximum of a timing metric hold until the first
+// sample, so that the first sample replaces them.
+const int64 kNoMinimum = std::numeric_limits<int64>::max();
+const int64 kNoMaximum = std::numeric_limits<int64>::min();
+
+}  // namespace
+
+IntegerMetricBase::IntegerMetricBase(const char *name,
+                                     MetricType type,
+                                     MetricCollectionBase *coll,
+                                     Cell *cells,
+                                     int num_cells)
+    : MetricBase(name, type, coll), cells_(cells), num_cells_(num_cells) {
+  DCHECK_LT(0, num_cells_);
+  memset(cells_, 0, static_cast<size_t>(num_cells_) * sizeof(cells_[0]));
+}
+
+IntegerMetricBase::IntegerMetricBase(const char *name,
+                                     MetricType type,
+                                     int64 value,
+                                     Cell *cells,
+                                     int num_cells)
+    : MetricBase(name, type), cells_(cells), num_cells_(num_cells) {
+  DCHECK_LT(0, num_cells_);
+  memset(cells_, 0, static_cast<size_t>(num_cells_) * sizeof(cells_[0]));
+  cells_[0].value = value;
+}
+
+IntegerMetricBase::Cell &IntegerMetricBase::CurrentCell() {
+  if (num_cells_ == 1)
+    return cells_[0];
+
+  // Threads on the same processor rarely update a metric at the same time,
+  // and when they do, the interlocked operation still keeps the count right.
+  const DWORD processor = ::GetCurrentProcessorNumber();
+  return cells_[processor % static_cast<DWORD>(num_cells_)];
+}
+
 void IntegerMetricBase::Set(int64 value) {
-  ObjectLock lock(this);
-  value_ = value;
+  for (int i = 1; i < num_cells_; ++i)
+    ::InterlockedExchange64(&cells_[i].value, 0);
+  ::InterlockedExchange64(&cells_[0].value, value);
+  MarkDirty();
 }
 
 int64 IntegerMetricBase::value() const {
-  ObjectLock lock(this);
-  int64 ret = value_;
+  int64 ret = 0;
+  for (int i = 0; i < num_cells_; ++i)
+    ret += ReadCell(&cells_[i].value);
   return ret;
 }
 
 void IntegerMetricBase::Increment() {
-  ObjectLock lock(this);
-  ++value_;
+  ::InterlockedIncrement64(&CurrentCell().value);
+  MarkDirty();
 }
 
 void IntegerMetricBase::Decrement() {
-  ObjectLock lock(this);
-  --value_;
+  ::InterlockedDecrement64(&CurrentCell().value);
+  MarkDirty();
 }
 
 void IntegerMetricBase::Add(int64 value){
-  ObjectLock lock(this);
-  value_ += value;
+  ::InterlockedExchangeAdd64(&CurrentCell().value, value);
+  MarkDirty();
 }
 
 void IntegerMetricBase::Subtract(int64 value) {
-  ObjectLock lock(this);
-  if (value_ < value)
-    value_ = 0;
-  else
-    value_ -= value;
+  // The value does not go below zero, which only an integer metric, with its
+  // single cell, can ensure.
+  DCHECK_EQ(1, num_cells_);
+  volatile LONGLONG *cell = &cells_[0].value;
+  for (;;) {
+    const int64 current = ReadCell(cell);
+    const int64 result = current < value ? 0 : current - value;
+    if (::InterlockedCompareExchange64(cell, result, current) == current)
+      break;
+  }
+  MarkDirty();
 }
 
-int64 CountMetric::Reset() {
-  ObjectLock lock(this);
-  int64 ret = value_;
-  value_ = 0;
+int64 IntegerMetricBase::Exchange() {
+  int64 ret = 0;
+  for (int i = 0; i < num_cells_; ++i)
+    ret += ::InterlockedExchange64(&cells_[i].value, 0);
   return ret;
 }
 
-TimingMetric::TimingData TimingMetric::Reset() {
-  ObjectLock lock(this);
-  TimingData ret = data_;
+int64 CountMetric::Reset() {
+  return Exchange();
+}
+
+TimingMetric::TimingMetric(const char *name, const TimingData &value)
+    : MetricBase(name, kTimingType) {
+  Clear();
+  Set(value);
+}
+
+TimingMetric::TimingMetric(const char *name,
+                           const TimingData &value,
+                           const Histogram &histogram)
+    : MetricBase(name, kTimingType) {
   Clear();
+  Set(value);
+  for (int i = 0; i < kNumBuckets; ++i)
+    buckets_[i] = static_cast<LONG>(histogram.counts[i]);
+}
+
+TimingMetric::TimingData TimingMetric::Reset() {
+  return Reset(NULL);
+}
+
+TimingMetric::TimingData TimingMetric::Reset(Histogram *histogram) {
+  // The count goes first, since it is updated last by Record.
+  TimingData ret = {};
+  ret.count = static_cast<uint32>(::InterlockedExchange(&count_, 0));
+  ret.sum = ::InterlockedExchange64(&sum_, 0);
+  ret.minimum = ::InterlockedExchange64(&minimum_, kNoMinimum);
+  ret.maximum = ::InterlockedExchange64(&maximum_, kNoMaximum);
+  if (ret.minimum == kNoMinimum)
+    ret.minimum = 0;
+  if (ret.maximum == kNoMaximum)
+    ret.maximum = 0;
+
+  for (int i = 0; i < kNumBuckets; ++i) {
+    const LONG bucket_count = ::InterlockedExchange(&buckets_[i], 0);
+    if (histogram)
+      histogram->counts[i] = static_cast<uint32>(bucket_count);
+  }
   return ret;
 }
 
 uint32 TimingMetric::count() const {
-  ObjectLock lock(this);
-  uint32 ret = data_.count;
-  return ret;
+  return static_cast<uint32>(count_);
 }
 
 int64 TimingMetric::sum() const {
-  ObjectLock lock(this);
-  int64 ret = data_.sum;
-  return ret;
+  return ReadCell(&sum_);
 }
 
 int64 TimingMetric::minimum() const {
-  ObjectLock lock(this);
-  int64 ret = data_.minimum;
-  return ret;
+  const int64 ret = ReadCell(&minimum_);
+  return ret == kNoMinimum ? 0 : ret;
 }
 
 int64 TimingMetric::maximum() const {
-  ObjectLock lock(this);
-  int64 ret = data_.maximum;
-  return ret;
+  const int64 ret = ReadCell(&maximum_);
+  return ret == kNoMaximum ? 0 : ret;
 }
 
 int64 TimingMetric::average() const {
-  ObjectLock lock(this);
+  const uint32 samples = count();
+  return samples ? sum() / samples : 0;
+}
 
-  int64 ret = 0;
-  if (0 == data_.count) {
-    DCHECK_EQ(0, data_.sum);
-  } else {
-    ret = data_.sum / data_.count;
-  }
-  return ret;
+void TimingMetric::GetHistogram(Histogram *histogram) const {
+  DCHECK(histogram);
+  for (int i = 0; i < kNumBuckets; ++i)
+    histogram->counts[i] = static_cast<uint32>(buckets_[i]);
 }
 
 void TimingMetric::AddSample(int64 time_ms) {
-  ObjectLock lock(this);
-  if (0 == data_.count) {
-    data_.minimum = time_ms;
-    data_.maximum = time_ms;
-  } else {
-    if (data_.minimum > time_ms)
-      data_.minimum = time_ms;
-    if (data_.maximum < time_ms)
-      data_.maximum = time_ms;
-  }
-  data_.count++;
-  data_.sum += time_ms;
+  Record(1, time_ms, time_ms);
 }
 
 void TimingMetric::AddSamples(int64 count, int64 total_time_ms) {
   if (0 == count)
     return;
 
-  int64 time_ms = total_time_ms / count;
+  DCHECK_LE(count, std::numeric_limits<uint32_t>::max());
+  Record(static_cast<uint32>(count), total_time_ms, total_time_ms / count);
+}
 
-  ObjectLock lock(this);
-  if (0 == data_.count) {
-    data_.minimum = time_ms;
-    data_.maximum = time_ms;
-  } else {
-    if (data_.minimum > time_ms)
-      data_.minimum = time_ms;
-    if (data_.maximum < time_ms)
-      data_.maximum = time_ms;
+void TimingMetric::Record(uint32 count, int64 sum, int64 time_ms) {
+  ::InterlockedExchangeAdd(&buckets_[BucketForTime(time_ms)],
+                           static_cast<LONG>(count));
+
+  int64 current = ReadCell(&minimum_);
+  while (time_ms < current) {
+    const int64 previous =
+        ::InterlockedCompareExchange64(&minimum_, time_ms, current);
+    if (previous == current)
+      break;
+    current = previous;
   }
 
-  DCHECK_LE(count, std::numeric_limits<uint32_t>::max());
-  data_.count += static_cast<uint32>(count);
-  data_.sum += total_time_ms;
+  current = ReadCell(&maximum_);
+  while (time_ms > current) {
+    const int64 previous =
+        ::InterlockedCompareExchange64(&maximum_, time_ms, current);
+    if (previous == current)
+      break;
+    current = previous;
+  }
+
+  ::InterlockedExchangeAdd64(&sum_, sum);
+  ::InterlockedExchangeAdd(&count_, static_cast<LONG>(count));
+  MarkDirty();
+}
+
+int TimingMetric::BucketForTime(int64 time_ms) {
+  if (time_ms < kSubBuckets)
+    return time_ms < 0 ? 0 : static_cast<int>(time_ms);
+  if (time_ms >= kMaxTrackedMs)
+    return kNumBuckets - 1;
+
+  // The power of two the time is in picks the group of buckets, and the bits
+  // that follow the highest one pick the bucket in the group.
+  unsigned long highest_bit = 0;
+  _BitScanReverse(&highest_bit, static_cast<unsigned long>(time_ms));
+  const int shift = static_cast<int>(highest_bit) - kSubBucketBits;
+  return (shift + 1) * kSubBuckets +
+         static_cast<int>(time_ms >> shift) - kSubBuckets;
+}
+
+int64 TimingMetric::BucketMaximum(int bucket) {
+  DCHECK(bucket >= 0 && bucket < kNumBuckets);
+  if (bucket < kSubBuckets)
+    return bucket;
+
+  const int shift = bucket / kSubBuckets - 1;
+  const int64 sub_bucket = bucket % kSubBuckets + kSubBuckets;
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+int64 TimingMetric::Percentile(const Histogram &histogram, int per_mille) {
+  DCHECK_LE(0, per_mille);
+  DCHECK_GE(1000, per_mille);
+
+  uint64 total = 0;
+  for (int i = 0; i < kNumBuckets; ++i)
+    total += histogram.counts[i];
+  if (0 == total)
+    return 0;
+
+  // The rank of the sample the percentile falls on, from 1.
+  uint64 rank = (total * static_cast<uint64>(per_mille) + 999) / 1000;
+  if (0 == rank)
+    rank = 1;
+
+  uint64 seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += histogram.counts[i];
+    if (seen >= rank)
+      return BucketMaximum(i);
+  }
+  return BucketMaximum(kNumBuckets - 1);
 }
 
 void TimingMetric::Clear() {
-  memset(&data_, 0, sizeof(data_));
+  count_ = 0;
+  sum_ = 0;
+  minimum_ = kNoMinimum;
+  maximum_ = kNoMaximum;
+  memset(const_cast<LONG*>(buckets_), 0, sizeof(buckets_));
+}
+
+void TimingMetric::Set(const TimingData &value) {
+  count_ = static_cast<LONG>(value.count);
+  sum_ = value.sum;
+  if (value.count) {
+    minimum_ = value.minimum;
+    maximum_ = value.maximum;
+  }
 }
 
 void BoolMetric::Set(bool value) {
-  ObjectLock lock(this);
-  value_ = value ? kBoolTrue : kBoolFalse;
+  ::InterlockedExchange(&value_, value ? kBoolTrue : kBoolFalse);
+  MarkDirty();
 }
 
 BoolMetric::TristateBoolValue BoolMetric::Reset() {
-  ObjectLock lock(this);
-  TristateBoolValue ret = value_;
-  value_ = kBoolUnset;
-  return ret;
+  return static_cast<TristateBoolValue>(
+      ::InterlockedExchange(&value_, kBoolUnset));
 }
 
 void MetricCollection::Initialize() {
@@ -232,6 +370,19 @@ void MetricCollection::Initialize() {
 void MetricCollection::Uninitialize() {
   DCHECK(initialized());
   initialized_ = false;
+
+  // The metrics may be destroyed from now on, so none may be left chained.
+  MetricBase *metric = TakeDirtyMetrics();
+  while (NULL != metric) {
+    MetricBase *next = metric->next_dirty();
+    metric->ClearDirty();
+    metric = next;
+  }
+}
+
+MetricBase *MetricCollection::TakeDirtyMetrics() {
+  return static_cast<MetricBase*>(::InterlockedExchangePointer(
+      reinterpret_cast<PVOID volatile *>(&dirty_), NULL));
 }
 
 
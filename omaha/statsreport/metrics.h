@@ -41,7 +41,8 @@
 
 /// Use timing metrics to report on the performance of important things.
 /// A timing metric will report the count of occurrences, as well as the
-/// average, min and max times.
+/// average, min and max times, and the distribution of the times, from which
+/// percentiles are reported.
 /// Samples are measured in milliseconds if you use the TIME_SCOPE macro
 /// or the HighResTimer class to collect samples.
 #define DECLARE_METRIC_timing(name)  DECLARE_METRIC(TimingMetric, name)
@@ -112,6 +113,10 @@ class BoolMetric;
 /// Stats instances are chained together against a MetricCollection to
 /// allow enumerating stats.
 ///
+/// The first change to a stats instance after it was aggregated also chains
+/// it to the collection's list of changed metrics, so that aggregation only
+/// visits the metrics that changed since the last one.
+///
 /// MetricCollection is factored into a class to make it easier to unittest
 /// the implementation.
 class MetricBase {
@@ -136,14 +141,27 @@ public:
   const char *name() const { return name_; }
   /// @}
 
+  /// @name Change tracking
+  /// @{
+  bool dirty() const { return 0 != dirty_; }
+  MetricBase *next_dirty() const { return next_dirty_; }
+
+  /// Marks the metric as changed, and chains it to the changed metrics of its
+  /// collection if it was not already.
+  void MarkDirty() {
+    if (!dirty_)
+      ChainDirty();
+  }
+
+  /// Marks the metric as unchanged. A change after this chains the metric
+  /// again, so read next_dirty() before.
+  void ClearDirty();
+  /// @}
+
   // TODO(omaha): does this need to be virtual?
   virtual ~MetricBase() = 0;
 
 protected:
-  class ObjectLock;
-  void Lock() const;
-  void Unlock() const;
-
   /// Constructs a MetricBase and adds to the provided MetricCollection.
   /// @note Metrics can only be constructed up to the point where the
   ///     MetricCollection is initialized, and there's no locking performed.
@@ -169,12 +187,23 @@ protected:
 
 private:
   DISALLOW_COPY_AND_ASSIGN(MetricBase);
+
+  void ChainDirty();
+
+  /// Non-zero while the metric is on the changed metrics of its collection.
+  volatile LONG dirty_;
+
+  /// chains to the next changed stat instance
+  MetricBase *next_dirty_;
 };
 
 /// Must be a POD
 struct MetricCollectionBase {
   bool initialized_;
   MetricBase *first_;
+
+  /// The metrics changed since they were last taken, most recent first.
+  MetricBase *volatile dirty_;
 };
 
 /// Inherit from base, which is a POD and can be initialized at link time.
@@ -187,6 +216,7 @@ public:
   MetricCollection() {
     initialized_ = false;
     first_ = NULL;
+    dirty_ = NULL;
   }
   ~MetricCollection() {
     DCHECK(NULL == first_);
@@ -210,9 +240,15 @@ public:
   MetricBase *first() const { return first_; }
   bool initialized() const { return initialized_; }
 
+  /// Takes the metrics changed since the last call, chained through
+  /// MetricBase::next_dirty(). They stay marked as changed, so that they are
+  /// not chained again, until MetricBase::ClearDirty() is called on them.
+  MetricBase *TakeDirtyMetrics();
+
 private:
   using MetricCollectionBase::initialized_;
   using MetricCollectionBase::first_;
+  using MetricCollectionBase::dirty_;
 
   DISALLOW_COPY_AND_ASSIGN(MetricCollection);
 
@@ -273,10 +309,17 @@ extern MetricCollectionBase g_global_metric_storage;
 /// And more conveniently accessed through here
 extern MetricCollection &g_global_metrics;
 
-/// Base class for integer metrics
+/// Base class for integer metrics.
+/// The value is kept in one or more cells, which are updated with interlocked
+/// operations and without a lock. Count metrics spread their value over
+/// several cells, one per group of processors, so that threads counting the
+/// same event on different processors do not contend for the same cache line;
+/// the cells are summed when the value is read.
 class IntegerMetricBase: public MetricBase {
 public:
   /// Sets the current value
+  /// @note for a count metric, increments made while the value is being set
+  ///     may be lost.
   void Set(int64 value);
 
   /// Retrieves the current value
@@ -287,35 +330,59 @@ public:
   void operator += (int64 addend) { Add(addend); }
 
 protected:
+  /// A cell takes a cache line of its own: it starts on a cache line and fills
+  /// it, so that it shares its line neither with the other cells nor with the
+  /// members of this or any other metric.
+  struct __declspec(align(64)) Cell {
+    volatile LONGLONG value;
+    char padding[64 - sizeof(LONGLONG)];
+  };
+
   IntegerMetricBase(const char *name,
                     MetricType type,
-                    MetricCollectionBase *coll)
-      : MetricBase(name, type, coll), value_(0) {
-  }
-  IntegerMetricBase(const char *name, MetricType type, int64 value)
-      : MetricBase(name, type), value_(value) {
-  }
+                    MetricCollectionBase *coll,
+                    Cell *cells,
+                    int num_cells);
+  IntegerMetricBase(const char *name,
+                    MetricType type,
+                    int64 value,
+                    Cell *cells,
+                    int num_cells);
 
   void Increment();
   void Decrement();
   void Add(int64 value);
   void Subtract(int64 value);
 
-  int64 value_;
+  /// Sets all the cells to zero, and returns the value they held.
+  int64 Exchange();
 
 private:
   DISALLOW_COPY_AND_ASSIGN(IntegerMetricBase);
+
+  /// The cell the calling thread updates.
+  Cell &CurrentCell();
+
+  Cell *const cells_;
+  const int num_cells_;
 };
 
+#pragma warning(push)
+// C4324: structure was padded due to alignment specifier
+#pragma warning(disable : 4324)
+
 /// A count metric is a cumulative counter of events.
 class CountMetric: public IntegerMetricBase {
 public:
+  /// Number of cells a count is spread over.
+  static const int kNumCells = 8;
+
   CountMetric(const char *name, MetricCollectionBase *coll)
-      : IntegerMetricBase(name, kCountType, coll) {
+      : IntegerMetricBase(name, kCountType, coll, cells_, kNumCells) {
   }
 
   CountMetric(const char *name, int64 value)
-      : IntegerMetricBase(name, kCountType, value) {
+      : IntegerMetricBase(name, kCountType, value, cells_, kNumCells) {
   }
 
   /// Nulls the metric and returns the current values.
@@ -323,8 +390,22 @@ public:
 
 private:
   DISALLOW_COPY_AND_ASSIGN(CountMetric);
+
+  Cell cells_[kNumCells];
 };
 
+#pragma warning(pop)
+
+/// A timing metric keeps the count, sum, minimum and maximum of its samples,
+/// and a histogram of them, from which percentiles are computed.
+/// The histogram is log-scaled, the way HdrHistogram is: times under
+/// kSubBuckets ms have a bucket each, and every power of two above that is
+/// split into kSubBuckets buckets, so that a time is known to within 1/8th
+/// of its value whatever its magnitude. Times of kMaxTrackedMs or more share
+/// the last bucket.
+/// Samples are recorded with interlocked operations and without a lock. A
+/// sample recorded while the metric is being reset may be split between the
+/// two periods.
 class TimingMetric: public MetricBase {
 public:
   struct TimingData {
@@ -336,14 +417,30 @@ public:
     int64 maximum; // ms
   };
 
+  enum {
+    kSubBucketBits = 3,
+    kSubBuckets = 1 << kSubBucketBits,
+    /// Enough buckets for times under kMaxTrackedMs.
+    kNumBuckets = (32 - kSubBucketBits + 1) * kSubBuckets,
+  };
+
+  /// Times of this many ms or more all go in the last bucket.
+  static const int64 kMaxTrackedMs = 0x100000000LL;
+
+  /// Must be a POD, it is persisted as is.
+  struct Histogram {
+    uint32 counts[kNumBuckets];
+  };
+
   TimingMetric(const char *name, MetricCollectionBase *coll)
       : MetricBase(name, kTimingType, coll) {
     Clear();
   }
 
-  TimingMetric(const char *name, const TimingData &value)
-      : MetricBase(name, kTimingType), data_(value) {
-  }
+  TimingMetric(const char *name, const TimingData &value);
+  TimingMetric(const char *name,
+               const TimingData &value,
+               const Histogram &histogram);
 
   uint32 count() const;
   int64 sum() const;
@@ -351,6 +448,9 @@ public:
   int64 maximum() const;
   int64 average() const;
 
+  /// Copies the histogram of the samples to |histogram|.
+  void GetHistogram(Histogram *histogram) const;
+
   /// Adds a single sample to the metric
   /// @param time_ms time (in milliseconds) for this sample
   void AddSample(int64 time_ms);
@@ -369,12 +469,38 @@ public:
   /// Nulls the metric and returns the current values.
   TimingData Reset();
 
+  /// Nulls the metric and returns the current values, and the histogram in
+  /// |histogram| if it is not NULL.
+  TimingData Reset(Histogram *histogram);
+
+  /// Returns the bucket |time_ms| is counted in.
+  static int BucketForTime(int64 time_ms);
+
+  /// Returns the highest time counted in |bucket|.
+  static int64 BucketMaximum(int bucket);
+
+  /// Returns the time under which |per_mille| thousandths of the samples in
+  /// |histogram| fall, rounded up to the highest time of its bucket, or 0 if
+  /// the histogram is empty.
+  static int64 Percentile(const Histogram &histogram, int per_mille);
+
 private:
   DISALLOW_COPY_AND_ASSIGN(TimingMetric);
 
   void Clear();
+  void Set(const TimingData &value);
+
+  /// Records |count| samples of |time_ms| each, which add up to |sum|.
+  void Record(uint32 count, int64 sum, int64 time_ms);
+
+  volatile LONG count_;
+  volatile LONGLONG sum_;
 
-  TimingData data_;
+  /// Hold kNoMinimum and kNoMaximum while there are no samples.
+  volatile LONGLONG minimum_;
+  volatile LONGLONG maximum_;
+
+  volatile LONG buckets_[kNumBuckets];
 };
 
 /// A convenience class to sample the time from construction to destruction
@@ -425,16 +551,20 @@ private:
   DISALLOW_COPY_AND_ASSIGN(TimingSample);
 };
 
+#pragma warning(push)
+// C4324: structure was padded due to alignment specifier
+#pragma warning(disable : 4324)
+
 /// An integer metric is used to sample values that vary over time.
 /// On aggregation the instantaneous value of the integer metric is captured.
 class IntegerMetric: public IntegerMetricBase {
 public:
   IntegerMetric(const char *name, MetricCollectionBase *coll)
-      : IntegerMetricBase(name, kIntegerType, coll) {
+      : IntegerMetricBase(name, kIntegerType, coll, &cell_, 1) {
   }
 
   IntegerMetric(const char *name, int64 value)
-      : IntegerMetricBase(name, kIntegerType, value) {
+      : IntegerMetricBase(name, kIntegerType, value, &cell_, 1) {
   }
 
   void operator = (int64 value)   { Set(value); }
@@ -445,8 +575,12 @@ public:
 
 private:
   DISALLOW_COPY_AND_ASSIGN(IntegerMetric);
+
+  Cell cell_;
 };
 
+#pragma warning(pop)
+
 /// A bool metric is tri-state, and can be:
 ///    - unset,
 ///    - true or
@@ -471,7 +605,7 @@ public:
     switch (value) {
      case kBoolFalse:
      case kBoolTrue:
-      value_ = static_cast<TristateBoolValue>(value);
+      value_ = static_cast<LONG>(value);
       break;
 
      default:
@@ -490,13 +624,16 @@ public:
   /// Nulls the metric and returns the current values.
   TristateBoolValue Reset();
 
-  /// Returns the current value - not threadsafe
-  TristateBoolValue value() const { return value_; };
+  /// Returns the current value
+  TristateBoolValue value() const {
+    return static_cast<TristateBoolValue>(value_);
+  };
 
 private:
   DISALLOW_COPY_AND_ASSIGN(BoolMetric);
 
-  TristateBoolValue value_;
+  /// A TristateBoolValue, set with interlocked operations.
+  volatile LONG value_;
 };
 
 inline CountMetric &MetricBase::AsCount() {
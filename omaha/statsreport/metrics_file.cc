@@ -0,0 +1,390 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Reads and writes the file MetricsAggregatorFile aggregates to.
+#include "omaha/statsreport/metrics_file.h"
+
+#include <string.h>
+
+namespace stats_report {
+
+namespace {
+
+const uint8 kMagic[] = { 'O', 'M', 'S', 'F' };
+const uint32 kVersion = 1;
+
+// Reads little-endian integers from a buffer, failing once it runs out.
+class Reader {
+public:
+  Reader(const uint8 *data, size_t size) : data_(data), left_(size) {}
+
+  bool ReadBytes(void *value, size_t size) {
+    if (left_ < size)
+      return false;
+    memcpy(value, data_, size);
+    data_ += size;
+    left_ -= size;
+    return true;
+  }
+
+  bool ReadUint(size_t size, uint64 *value) {
+    if (left_ < size)
+      return false;
+    *value = 0;
+    for (size_t i = 0; i != size; ++i)
+      *value |= static_cast<uint64>(data_[i]) << (8 * i);
+    data_ += size;
+    left_ -= size;
+    return true;
+  }
+
+  bool Read8(uint8 *value) {
+    uint64 v = 0;
+    if (!ReadUint(sizeof(*value), &v))
+      return false;
+    *value = static_cast<uint8>(v);
+    return true;
+  }
+  bool Read16(uint16 *value) {
+    uint64 v = 0;
+    if (!ReadUint(sizeof(*value), &v))
+      return false;
+    *value = static_cast<uint16>(v);
+    return true;
+  }
+  bool Read32(uint32 *value) {
+    uint64 v = 0;
+    if (!ReadUint(sizeof(*value), &v))
+      return false;
+    *value = static_cast<uint32>(v);
+    return true;
+  }
+  bool Read64(int64 *value) {
+    uint64 v = 0;
+    if (!ReadUint(sizeof(*value), &v))
+      return false;
+    *value = static_cast<int64>(v);
+    return true;
+  }
+
+  bool at_end() const { return 0 == left_; }
+
+private:
+  const uint8 *data_;
+  size_t left_;
+
+  DISALLOW_COPY_AND_ASSIGN(Reader);
+};
+
+// Writes little-endian integers to a buffer known to be large enough.
+class Writer {
+public:
+  explicit Writer(uint8 *buffer) : next_(buffer) {}
+
+  void WriteBytes(const void *value, size_t size) {
+    memcpy(next_, value, size);
+    next_ += size;
+  }
+
+  void WriteUint(size_t size, uint64 value) {
+    for (size_t i = 0; i != size; ++i)
+      *next_++ = static_cast<uint8>(value >> (8 * i));
+  }
+
+  void Write8(uint8 value) { WriteUint(sizeof(value), value); }
+  void Write16(uint16 value) { WriteUint(sizeof(value), value); }
+  void Write32(uint32 value) { WriteUint(sizeof(value), value); }
+  void Write64(int64 value) {
+    WriteUint(sizeof(value), static_cast<uint64>(value));
+  }
+
+private:
+  uint8 *next_;
+
+  DISALLOW_COPY_AND_ASSIGN(Writer);
+};
+
+size_t NumNonEmptyBuckets(const std::vector<uint32> &buckets) {
+  size_t ret = 0;
+  for (size_t i = 0; i != buckets.size(); ++i) {
+    if (buckets[i])
+      ++ret;
+  }
+  return ret;
+}
+
+bool IsValidType(uint8 type) {
+  return type >= MetricsFile::kCountRecord && type <= MetricsFile::kBoolRecord;
+}
+
+bool ReadTiming(Reader *reader, MetricsFile::Record *record) {
+  uint16 num_buckets = 0;
+  uint16 num_non_empty = 0;
+  if (!reader->Read32(&record->count) ||
+      !reader->Read64(&record->sum) ||
+      !reader->Read64(&record->minimum) ||
+      !reader->Read64(&record->maximum) ||
+      !reader->Read16(&num_buckets) ||
+      !reader->Read16(&num_non_empty) ||
+      num_non_empty > num_buckets) {
+    return false;
+  }
+
+  record->buckets.assign(num_buckets, 0);
+  int previous = -1;
+  for (uint16 i = 0; i != num_non_empty; ++i) {
+    uint16 index = 0;
+    uint32 count = 0;
+    if (!reader->Read16(&index) ||
+        !reader->Read32(&count) ||
+        index >= num_buckets ||
+        index <= previous ||
+        0 == count) {
+      return false;
+    }
+    record->buckets[index] = count;
+    previous = index;
+  }
+  return true;
+}
+
+}  // namespace
+
+MetricsFile::Record::Record()
+    : type(kCountRecord),
+      value(0),
+      count(0),
+      sum(0),
+      minimum(0),
+      maximum(0) {
+}
+
+MetricsFile::MetricsFile() {
+}
+
+MetricsFile::~MetricsFile() {
+}
+
+bool MetricsFile::Parse(const uint8 *data, size_t size) {
+  Clear();
+
+  Reader reader(data, size);
+  uint8 magic[sizeof(kMagic)] = {};
+  uint32 version = 0;
+  uint32 num_records = 0;
+  if (!reader.ReadBytes(magic, sizeof(magic)) ||
+      0 != memcmp(magic, kMagic, sizeof(kMagic)) ||
+      !reader.Read32(&version) ||
+      version != kVersion ||
+      !reader.Read32(&num_records)) {
+    return false;
+  }
+
+  for (uint32 i = 0; i != num_records; ++i) {
+    uint8 type = 0;
+    uint8 name_length = 0;
+    Record record;
+    if (!reader.Read8(&type) ||
+        !IsValidType(type) ||
+        !reader.Read8(&name_length) ||
+        0 == name_length) {
+      Clear();
+      return false;
+    }
+    record.type = static_cast<RecordType>(type);
+    record.name.resize(name_length);
+    if (!reader.ReadBytes(&record.name[0], name_length)) {
+      Clear();
+      return false;
+    }
+
+    bool succeeded = false;
+    switch (record.type) {
+     case kCountRecord:
+     case kIntegerRecord:
+      succeeded = reader.Read64(&record.value);
+      break;
+     case kTimingRecord:
+      succeeded = ReadTiming(&reader, &record);
+      break;
+     case kBoolRecord: {
+      uint8 value = 0;
+      succeeded = reader.Read8(&value) && value <= 1;
+      record.value = value;
+      break;
+     }
+    }
+
+    const Records::key_type key(record.type, record.name);
+    if (!succeeded || records_.count(key)) {
+      Clear();
+      return false;
+    }
+    records_[key] = record;
+  }
+
+  if (!reader.at_end()) {
+    Clear();
+    return false;
+  }
+  return true;
+}
+
+size_t MetricsFile::SerializedSize() const {
+  size_t size = sizeof(kMagic) + 2 * sizeof(uint32);
+  for (const_iterator it = begin(); it != end(); ++it) {
+    const Record &record = it->second;
+    size += 2 * sizeof(uint8) + record.name.size();
+    switch (record.type) {
+     case kCountRecord:
+     case kIntegerRecord:
+      size += sizeof(int64);
+      break;
+     case kTimingRecord:
+      size += sizeof(uint32) + 3 * sizeof(int64) + 2 * sizeof(uint16) +
+              NumNonEmptyBuckets(record.buckets) *
+                  (sizeof(uint16) + sizeof(uint32));
+      break;
+     case kBoolRecord:
+      size += sizeof(uint8);
+      break;
+    }
+  }
+  return size;
+}
+
+void MetricsFile::Serialize(uint8 *buffer) const {
+  Writer writer(buffer);
+  writer.WriteBytes(kMagic, sizeof(kMagic));
+  writer.Write32(kVersion);
+  writer.Write32(static_cast<uint32>(records_.size()));
+
+  for (const_iterator it = begin(); it != end(); ++it) {
+    const Record &record = it->second;
+    writer.Write8(static_cast<uint8>(record.type));
+    writer.Write8(static_cast<uint8>(record.name.size()));
+    writer.WriteBytes(record.name.data(), record.name.size());
+
+    switch (record.type) {
+     case kCountRecord:
+     case kIntegerRecord:
+      writer.Write64(record.value);
+      break;
+     case kTimingRecord:
+      writer.Write32(record.count);
+      writer.Write64(record.sum);
+      writer.Write64(record.minimum);
+      writer.Write64(record.maximum);
+      writer.Write16(static_cast<uint16>(record.buckets.size()));
+      writer.Write16(
+          static_cast<uint16>(NumNonEmptyBuckets(record.buckets)));
+      for (size_t i = 0; i != record.buckets.size(); ++i) {
+        if (!record.buckets[i])
+          continue;
+        writer.Write16(static_cast<uint16>(i));
+        writer.Write32(record.buckets[i]);
+      }
+      break;
+     case kBoolRecord:
+      writer.Write8(record.value ? 1 : 0);
+      break;
+    }
+  }
+}
+
+bool MetricsFile::AddCount(const std::string &name, int64 value) {
+  Record *record = GetRecord(kCountRecord, name);
+  if (!record)
+    return false;
+  record->value += value;
+  return true;
+}
+
+bool MetricsFile::AddTiming(const std::string &name,
+                            uint32 count,
+                            int64 sum,
+                            int64 minimum,
+                            int64 maximum,
+                            const uint32 *buckets,
+                            size_t num_buckets) {
+  if (num_buckets > 0xFFFF)
+    return false;
+
+  const Record *existing = Find(kTimingRecord, name);
+  if (existing && !existing->buckets.empty() && num_buckets &&
+      existing->buckets.size() != num_buckets) {
+    return false;
+  }
+
+  Record *record = GetRecord(kTimingRecord, name);
+  if (!record)
+    return false;
+
+  if (0 == record->count) {
+    record->minimum = minimum;
+    record->maximum = maximum;
+  } else {
+    if (record->minimum > minimum)
+      record->minimum = minimum;
+    if (record->maximum < maximum)
+      record->maximum = maximum;
+  }
+  record->count += count;
+  record->sum += sum;
+
+  if (num_buckets) {
+    record->buckets.resize(num_buckets, 0);
+    for (size_t i = 0; i != num_buckets; ++i)
+      record->buckets[i] += buckets[i];
+  }
+  return true;
+}
+
+bool MetricsFile::SetInteger(const std::string &name, int64 value) {
+  Record *record = GetRecord(kIntegerRecord, name);
+  if (!record)
+    return false;
+  record->value = value;
+  return true;
+}
+
+bool MetricsFile::SetBool(const std::string &name, bool value) {
+  Record *record = GetRecord(kBoolRecord, name);
+  if (!record)
+    return false;
+  record->value = value ? 1 : 0;
+  return true;
+}
+
+const MetricsFile::Record *MetricsFile::Find(RecordType type,
+                                             const std::string &name) const {
+  const_iterator it = records_.find(Records::key_type(type, name));
+  return it == records_.end() ? NULL : &it->second;
+}
+
+MetricsFile::Record *MetricsFile::GetRecord(RecordType type,
+                                            const std::string &name) {
+  if (name.empty() || name.size() > kMaxNameLength)
+    return NULL;
+
+  Record &record = records_[Records::key_type(type, name)];
+  if (record.name.empty()) {
+    record.type = type;
+    record.name = name;
+  }
+  return &record;
+}
+
+} // namespace stats_report
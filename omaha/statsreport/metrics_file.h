@@ -0,0 +1,132 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// The file format of MetricsAggregatorFile. It is kept apart from the
+// aggregator, and only depends on the C++ library, so that the format can be
+// built and tested on any platform.
+//
+// The file is a header followed by one record per metric. All integers are
+// little-endian.
+//   header   "OMSF", uint32 version, uint32 number of records
+//   record   uint8 type, uint8 length of the name, the name, then the value:
+//     count    int64
+//     timing   uint32 count, int64 sum, int64 minimum, int64 maximum,
+//              uint16 number of buckets, uint16 number of non-empty buckets,
+//              then uint16 index and uint32 count per non-empty bucket
+//     integer  int64
+//     bool     uint8, 0 or 1
+// The records are sorted by type, in the order of stats_report::MetricType,
+// and then by name.
+#ifndef OMAHA_STATSREPORT_METRICS_FILE_H__
+#define OMAHA_STATSREPORT_METRICS_FILE_H__
+
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/basictypes.h"
+
+namespace stats_report {
+
+class MetricsFile {
+public:
+  /// The record types, which have the values of stats_report::MetricType.
+  enum RecordType {
+    kCountRecord = 1,
+    kTimingRecord,
+    kIntegerRecord,
+    kBoolRecord,
+  };
+
+  struct Record {
+    Record();
+
+    RecordType type;
+    std::string name;
+
+    /// The value of a count, integer or bool record.
+    int64 value;
+
+    /// The value of a timing record. The buckets are empty if the timing
+    /// has no histogram.
+    /// @{
+    uint32 count;
+    int64 sum;
+    int64 minimum;
+    int64 maximum;
+    std::vector<uint32> buckets;
+    /// @}
+  };
+
+  typedef std::map<std::pair<int, std::string>, Record> Records;
+  typedef Records::const_iterator const_iterator;
+
+  /// Names are at most this long.
+  static const size_t kMaxNameLength = 255;
+
+  MetricsFile();
+  ~MetricsFile();
+
+  /// Reads the |size| bytes at |data|. Returns false if they are malformed,
+  /// in which case the file is left empty.
+  bool Parse(const uint8 *data, size_t size);
+
+  /// Returns the size of the file, as Serialize writes it.
+  size_t SerializedSize() const;
+
+  /// Writes the file to |buffer|, which holds SerializedSize() bytes.
+  void Serialize(uint8 *buffer) const;
+
+  /// Merge a metric into the file, the way MetricsAggregatorWin32 does into
+  /// the registry: counts and timings are added up, integers and bools are
+  /// replaced. They return false if the name is empty or too long, or the
+  /// buckets of a timing do not match those already in the file.
+  /// @{
+  bool AddCount(const std::string &name, int64 value);
+  bool AddTiming(const std::string &name,
+                 uint32 count,
+                 int64 sum,
+                 int64 minimum,
+                 int64 maximum,
+                 const uint32 *buckets,
+                 size_t num_buckets);
+  bool SetInteger(const std::string &name, int64 value);
+  bool SetBool(const std::string &name, bool value);
+  /// @}
+
+  /// Returns the record of type |type| named |name|, or NULL.
+  const Record *Find(RecordType type, const std::string &name) const;
+
+  void Clear() { records_.clear(); }
+
+  size_t size() const { return records_.size(); }
+  const_iterator begin() const { return records_.begin(); }
+  const_iterator end() const { return records_.end(); }
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(MetricsFile);
+
+  /// Returns the record of type |type| named |name|, which is created if it
+  /// does not exist, or NULL if the name is not valid.
+  Record *GetRecord(RecordType type, const std::string &name);
+
+  Records records_;
+};
+
+} // namespace stats_report
+
+#endif  // OMAHA_STATSREPORT_METRICS_FILE_H__
@@ -0,0 +1,200 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// This test only depends on the C++ library and gtest, like the file format.
+
+#include "omaha/statsreport/metrics_file.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace stats_report {
+
+namespace {
+
+void Roundtrip(const MetricsFile &file, MetricsFile *copy) {
+  std::vector<uint8> buffer(file.SerializedSize());
+  file.Serialize(&buffer[0]);
+  ASSERT_TRUE(copy->Parse(&buffer[0], buffer.size()));
+}
+
+std::vector<uint8> Serialize(const MetricsFile &file) {
+  std::vector<uint8> buffer(file.SerializedSize());
+  file.Serialize(&buffer[0]);
+  return buffer;
+}
+
+}  // namespace
+
+TEST(MetricsFileTest, Empty) {
+  MetricsFile file;
+  const std::vector<uint8> buffer(Serialize(file));
+  EXPECT_EQ(12, buffer.size());
+
+  MetricsFile copy;
+  EXPECT_TRUE(copy.Parse(&buffer[0], buffer.size()));
+  EXPECT_EQ(0, copy.size());
+}
+
+TEST(MetricsFileTest, Merge) {
+  MetricsFile file;
+  const uint32 buckets1[] = { 0, 2, 0, 1 };
+  const uint32 buckets2[] = { 1, 0, 0, 1 };
+
+  EXPECT_TRUE(file.AddCount("c", 1));
+  EXPECT_TRUE(file.AddCount("c", 2));
+  EXPECT_TRUE(file.AddTiming("t", 3, 30, 5, 15, buckets1, 4));
+  EXPECT_TRUE(file.AddTiming("t", 2, 10, 1, 9, buckets2, 4));
+  EXPECT_TRUE(file.SetInteger("i", 7));
+  EXPECT_TRUE(file.SetInteger("i", 3));
+  EXPECT_TRUE(file.SetBool("b", true));
+  EXPECT_TRUE(file.SetBool("b", false));
+  EXPECT_EQ(4, file.size());
+
+  const MetricsFile::Record *count = file.Find(MetricsFile::kCountRecord, "c");
+  ASSERT_TRUE(count != NULL);
+  EXPECT_EQ(3, count->value);
+
+  const MetricsFile::Record *timing =
+      file.Find(MetricsFile::kTimingRecord, "t");
+  ASSERT_TRUE(timing != NULL);
+  EXPECT_EQ(5, timing->count);
+  EXPECT_EQ(40, timing->sum);
+  EXPECT_EQ(1, timing->minimum);
+  EXPECT_EQ(15, timing->maximum);
+  const uint32 expected_buckets[] = { 1, 2, 0, 2 };
+  EXPECT_EQ(std::vector<uint32>(expected_buckets, expected_buckets + 4),
+            timing->buckets);
+
+  EXPECT_EQ(3, file.Find(MetricsFile::kIntegerRecord, "i")->value);
+  EXPECT_EQ(0, file.Find(MetricsFile::kBoolRecord, "b")->value);
+
+  // The same name can be used for metrics of different types.
+  EXPECT_TRUE(file.SetInteger("c", 4));
+  EXPECT_EQ(3, file.Find(MetricsFile::kCountRecord, "c")->value);
+  EXPECT_EQ(4, file.Find(MetricsFile::kIntegerRecord, "c")->value);
+}
+
+TEST(MetricsFileTest, Merge_Invalid) {
+  MetricsFile file;
+  const uint32 buckets[] = { 1, 1, 1, 1 };
+
+  EXPECT_FALSE(file.AddCount("", 1));
+  EXPECT_FALSE(file.SetInteger(std::string(256, 'a'), 1));
+  EXPECT_TRUE(file.SetInteger(std::string(255, 'a'), 1));
+
+  EXPECT_TRUE(file.AddTiming("t", 1, 10, 10, 10, buckets, 4));
+  EXPECT_FALSE(file.AddTiming("t", 1, 10, 10, 10, buckets, 3));
+  EXPECT_EQ(1, file.Find(MetricsFile::kTimingRecord, "t")->count);
+
+  // A timing without buckets merges with one that has them.
+  EXPECT_TRUE(file.AddTiming("t", 1, 20, 20, 20, NULL, 0));
+  EXPECT_EQ(2, file.Find(MetricsFile::kTimingRecord, "t")->count);
+  EXPECT_EQ(4, file.Find(MetricsFile::kTimingRecord, "t")->buckets.size());
+}
+
+TEST(MetricsFileTest, Roundtrip) {
+  MetricsFile file;
+  std::vector<uint32> buckets(240, 0);
+  buckets[3] = 1;
+  buckets[200] = 70000;
+
+  file.AddCount("count", -5);
+  file.AddCount("count2", 0x123456789LL);
+  file.AddTiming("timing", 70001, 1234567, 3, 99999, &buckets[0], 240);
+  file.AddTiming("timing_without_histogram", 1, 2, 2, 2, NULL, 0);
+  file.SetInteger("integer", -1);
+  file.SetBool("bool", true);
+
+  MetricsFile copy;
+  Roundtrip(file, &copy);
+  ASSERT_EQ(file.size(), copy.size());
+  EXPECT_EQ(Serialize(file), Serialize(copy));
+
+  // The records come by type, then by name.
+  MetricsFile::const_iterator it = copy.begin();
+  EXPECT_EQ("count", it->second.name);
+  EXPECT_EQ(-5, it->second.value);
+  ++it;
+  EXPECT_EQ("count2", it->second.name);
+  EXPECT_EQ(0x123456789LL, it->second.value);
+  ++it;
+  EXPECT_EQ(MetricsFile::kTimingRecord, it->second.type);
+  EXPECT_EQ(70001, it->second.count);
+  EXPECT_EQ(1234567, it->second.sum);
+  EXPECT_EQ(3, it->second.minimum);
+  EXPECT_EQ(99999, it->second.maximum);
+  EXPECT_EQ(buckets, it->second.buckets);
+  ++it;
+  EXPECT_TRUE(it->second.buckets.empty());
+  ++it;
+  EXPECT_EQ(MetricsFile::kIntegerRecord, it->second.type);
+  EXPECT_EQ(-1, it->second.value);
+  ++it;
+  EXPECT_EQ(MetricsFile::kBoolRecord, it->second.type);
+  EXPECT_EQ(1, it->second.value);
+  ++it;
+  EXPECT_TRUE(it == copy.end());
+}
+
+TEST(MetricsFileTest, Parse_Malformed) {
+  MetricsFile file;
+  const uint32 buckets[] = { 0, 2, 0, 1 };
+  file.AddCount("c", 1);
+  file.AddTiming("t", 3, 30, 5, 15, buckets, 4);
+  file.SetBool("b", true);
+  const std::vector<uint8> good(Serialize(file));
+
+  MetricsFile copy;
+  ASSERT_TRUE(copy.Parse(&good[0], good.size()));
+
+  // Every truncation fails, and so does trailing data.
+  for (size_t size = 0; size != good.size(); ++size) {
+    EXPECT_FALSE(copy.Parse(&good[0], size)) << size;
+    EXPECT_EQ(0, copy.size()) << size;
+  }
+  std::vector<uint8> longer(good);
+  longer.push_back(0);
+  EXPECT_FALSE(copy.Parse(&longer[0], longer.size()));
+
+  // The magic, the version and the record type are checked.
+  for (size_t offset = 0; offset != 5; ++offset) {
+    std::vector<uint8> bad(good);
+    ++bad[offset];
+    EXPECT_FALSE(copy.Parse(&bad[0], bad.size())) << offset;
+  }
+  std::vector<uint8> bad_type(good);
+  bad_type[12] = 5;
+  EXPECT_FALSE(copy.Parse(&bad_type[0], bad_type.size()));
+
+  // A bool is 0 or 1.
+  std::vector<uint8> bad_bool(good);
+  bad_bool.back() = 2;
+  EXPECT_FALSE(copy.Parse(&bad_bool[0], bad_bool.size()));
+
+  // The same record twice.
+  MetricsFile twice;
+  twice.AddCount("c", 1);
+  std::vector<uint8> duplicate(Serialize(twice));
+  duplicate[8] = 2;
+  duplicate.insert(duplicate.end(), duplicate.begin() + 12, duplicate.end());
+  EXPECT_FALSE(copy.Parse(&duplicate[0], duplicate.size()));
+  duplicate[8] = 1;
+  duplicate.resize(duplicate.size() / 2 + 6);
+  EXPECT_TRUE(copy.Parse(&duplicate[0], duplicate.size()));
+}
+
+}  // namespace stats_report
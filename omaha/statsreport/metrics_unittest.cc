@@ -14,6 +14,7 @@
 // ========================================================================
 
 #include <algorithm>
+#include <memory>
 #include <new>
 #include <ostream>
 
@@ -46,6 +47,48 @@ protected:
   MetricCollection coll_;
 };
 
+const int kNumThreads = 8;
+const int kNumIncrements = 100000;
+
+DWORD WINAPI IncrementCount(void *param) {
+  CountMetric &count = *static_cast<CountMetric*>(param);
+  for (int i = 0; i < kNumIncrements; ++i) {
+    ++count;
+    count += 2;
+  }
+  return 0;
+}
+
+DWORD WINAPI IncrementAndDecrementInteger(void *param) {
+  IntegerMetric &integer = *static_cast<IntegerMetric*>(param);
+  for (int i = 0; i < kNumIncrements; ++i) {
+    integer += 3;
+    --integer;
+  }
+  return 0;
+}
+
+// Adds the samples 0 to 999 ms, over and over.
+DWORD WINAPI AddTimingSamples(void *param) {
+  TimingMetric &timing = *static_cast<TimingMetric*>(param);
+  for (int i = 0; i < kNumIncrements; ++i)
+    timing.AddSample(i % 1000);
+  return 0;
+}
+
+// Runs |proc| with |param| on kNumThreads threads at once.
+void RunOnThreads(LPTHREAD_START_ROUTINE proc, void *param) {
+  HANDLE threads[kNumThreads] = {};
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads[i] = ::CreateThread(NULL, 0, proc, param, 0, NULL);
+    ASSERT_TRUE(NULL != threads[i]);
+  }
+  EXPECT_EQ(WAIT_OBJECT_0,
+            ::WaitForMultipleObjects(kNumThreads, threads, true, INFINITE));
+  for (int i = 0; i < kNumThreads; ++i)
+    ::CloseHandle(threads[i]);
+}
+
 class MetricsEnumTest: public MetricsTest {
 public:
   virtual void SetUp() {
@@ -123,6 +166,35 @@ TEST_F(MetricsTest, Count) {
   EXPECT_EQ(102, foo.value());
 }
 
+// The cells of a count start on a cache line, whether the count is static, on
+// the stack or on the heap.
+TEST_F(MetricsTest, CountAlignment) {
+  EXPECT_EQ(64u, __alignof(CountMetric));
+  EXPECT_EQ(0u, sizeof(CountMetric) % 64);
+
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(&metric_count) % 64);
+  CountMetric foo("foo", &coll_);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(&foo) % 64);
+  std::unique_ptr<CountMetric> bar(new CountMetric("bar", &coll_));
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(bar.get()) % 64);
+}
+
+TEST_F(MetricsTest, CountConcurrent) {
+  CountMetric foo("foo", &coll_);
+
+  RunOnThreads(&IncrementCount, &foo);
+  EXPECT_EQ(3 * kNumThreads * kNumIncrements, foo.value());
+
+  // The value is spread over the cells of the metric, and all of them are
+  // reset.
+  EXPECT_EQ(3 * kNumThreads * kNumIncrements, foo.Reset());
+  EXPECT_EQ(0, foo.value());
+
+  foo += 5;
+  foo.Set(10);
+  EXPECT_EQ(10, foo.value());
+}
+
 TEST_F(MetricsTest, Timing) {
   TimingMetric foo("foo", &coll_);
 
@@ -214,6 +286,118 @@ TEST_F(MetricsTest, TimingSample) {
   EXPECT_EQ(0, data.count);
 }
 
+TEST_F(MetricsTest, TimingBuckets) {
+  // Each time under 8 ms has a bucket of its own.
+  for (int64 time_ms = 0; time_ms < 8; ++time_ms) {
+    EXPECT_EQ(time_ms, TimingMetric::BucketForTime(time_ms));
+    EXPECT_EQ(time_ms, TimingMetric::BucketMaximum(static_cast<int>(time_ms)));
+  }
+  EXPECT_EQ(0, TimingMetric::BucketForTime(-5));
+
+  // Then each power of two is split in 8 buckets.
+  EXPECT_EQ(8, TimingMetric::BucketForTime(8));
+  EXPECT_EQ(15, TimingMetric::BucketForTime(15));
+  EXPECT_EQ(16, TimingMetric::BucketForTime(16));
+  EXPECT_EQ(16, TimingMetric::BucketForTime(17));
+  EXPECT_EQ(17, TimingMetric::BucketForTime(18));
+  EXPECT_EQ(19, TimingMetric::BucketMaximum(17));
+  EXPECT_EQ(36, TimingMetric::BucketForTime(100));
+  EXPECT_EQ(103, TimingMetric::BucketMaximum(36));
+
+  // Every time fits in its bucket, and a bucket is no wider than 1/8th of
+  // the times it holds.
+  for (int bucket = 1; bucket < TimingMetric::kNumBuckets; ++bucket) {
+    const int64 lowest = TimingMetric::BucketMaximum(bucket - 1) + 1;
+    const int64 highest = TimingMetric::BucketMaximum(bucket);
+    EXPECT_EQ(bucket, TimingMetric::BucketForTime(lowest));
+    EXPECT_EQ(bucket, TimingMetric::BucketForTime(highest));
+    EXPECT_LE((highest - lowest) * 8, lowest);
+  }
+
+  EXPECT_EQ(TimingMetric::kNumBuckets - 1,
+            TimingMetric::BucketForTime(TimingMetric::kMaxTrackedMs - 1));
+  EXPECT_EQ(TimingMetric::kNumBuckets - 1,
+            TimingMetric::BucketForTime(TimingMetric::kMaxTrackedMs * 10));
+}
+
+TEST_F(MetricsTest, TimingPercentiles) {
+  TimingMetric foo("foo", &coll_);
+  TimingMetric::Histogram histogram;
+
+  foo.GetHistogram(&histogram);
+  EXPECT_EQ(0, TimingMetric::Percentile(histogram, 500));
+
+  // 1 to 1000 ms.
+  for (int64 time_ms = 1; time_ms <= 1000; ++time_ms)
+    foo.AddSample(time_ms);
+
+  foo.GetHistogram(&histogram);
+  EXPECT_EQ(1, TimingMetric::Percentile(histogram, 0));
+  EXPECT_EQ(511, TimingMetric::Percentile(histogram, 500));
+  EXPECT_EQ(959, TimingMetric::Percentile(histogram, 900));
+  EXPECT_EQ(1023, TimingMetric::Percentile(histogram, 990));
+  EXPECT_EQ(1023, TimingMetric::Percentile(histogram, 1000));
+
+  // A slow sample only shows in the highest percentiles.
+  foo.AddSample(60000);
+  foo.GetHistogram(&histogram);
+  EXPECT_EQ(1023, TimingMetric::Percentile(histogram, 990));
+  EXPECT_EQ(61439, TimingMetric::Percentile(histogram, 1000));
+
+  // Counted samples go in the bucket of their average.
+  TimingMetric::TimingData data = foo.Reset(&histogram);
+  EXPECT_EQ(1001, data.count);
+  EXPECT_EQ(1, histogram.counts[TimingMetric::BucketForTime(60000)]);
+
+  foo.GetHistogram(&histogram);
+  EXPECT_EQ(0, TimingMetric::Percentile(histogram, 1000));
+
+  foo.AddSamples(10, 1000);
+  foo.GetHistogram(&histogram);
+  EXPECT_EQ(10, histogram.counts[TimingMetric::BucketForTime(100)]);
+  EXPECT_EQ(103, TimingMetric::Percentile(histogram, 500));
+}
+
+TEST_F(MetricsTest, TimingConcurrent) {
+  TimingMetric foo("foo", &coll_);
+
+  RunOnThreads(&AddTimingSamples, &foo);
+
+  const int64 num_samples = kNumThreads * kNumIncrements;
+  EXPECT_EQ(num_samples, foo.count());
+  EXPECT_EQ(num_samples / 1000 * (999 * 1000 / 2), foo.sum());
+  EXPECT_EQ(0, foo.minimum());
+  EXPECT_EQ(999, foo.maximum());
+
+  TimingMetric::Histogram histogram;
+  TimingMetric::TimingData data = foo.Reset(&histogram);
+  EXPECT_EQ(num_samples, data.count);
+
+  int64 histogram_count = 0;
+  for (int i = 0; i < TimingMetric::kNumBuckets; ++i)
+    histogram_count += histogram.counts[i];
+  EXPECT_EQ(num_samples, histogram_count);
+}
+
+TEST_F(MetricsTest, TimingFromHistogram) {
+  TimingMetric foo("foo", &coll_);
+  foo.AddSample(5);
+  foo.AddSample(300);
+
+  TimingMetric::Histogram histogram;
+  const TimingMetric::TimingData data = foo.Reset(&histogram);
+  const TimingMetric bar("bar", data, histogram);
+
+  EXPECT_EQ(2, bar.count());
+  EXPECT_EQ(305, bar.sum());
+  EXPECT_EQ(5, bar.minimum());
+  EXPECT_EQ(300, bar.maximum());
+
+  TimingMetric::Histogram bar_histogram;
+  bar.GetHistogram(&bar_histogram);
+  EXPECT_EQ(0, memcmp(&histogram, &bar_histogram, sizeof(histogram)));
+}
+
 TEST_F(MetricsTest, Integer) {
   IntegerMetric foo("foo", &coll_);
 
@@ -244,6 +428,17 @@ TEST_F(MetricsTest, Integer) {
   EXPECT_EQ(0, foo.value());
 }
 
+TEST_F(MetricsTest, IntegerConcurrent) {
+  IntegerMetric foo("foo", &coll_);
+
+  RunOnThreads(&IncrementAndDecrementInteger, &foo);
+  EXPECT_EQ(2 * kNumThreads * kNumIncrements, foo.value());
+
+  // Subtracting does not go below zero.
+  foo -= 3 * kNumThreads * kNumIncrements;
+  EXPECT_EQ(0, foo.value());
+}
+
 TEST_F(MetricsTest, Bool) {
   BoolMetric foo("foo", &coll_);
 
@@ -317,6 +512,54 @@ TEST_F(MetricsEnumTest, Iterator) {
   }
 }
 
+TEST_F(MetricsEnumTest, Dirty) {
+  EXPECT_TRUE(NULL == coll_.TakeDirtyMetrics());
+
+  ++count_;
+  bool_ = true;
+  ++count_;
+  EXPECT_TRUE(count_.dirty());
+  EXPECT_FALSE(timing_.dirty());
+  EXPECT_FALSE(integer_.dirty());
+  EXPECT_TRUE(bool_.dirty());
+
+  // Most recently changed first, and each metric once.
+  MetricBase *metric = coll_.TakeDirtyMetrics();
+  EXPECT_EQ(&bool_, metric);
+  metric = metric->next_dirty();
+  EXPECT_EQ(&count_, metric);
+  EXPECT_TRUE(NULL == metric->next_dirty());
+  EXPECT_TRUE(NULL == coll_.TakeDirtyMetrics());
+
+  // A metric is not chained again until it is cleared.
+  count_ += 2;
+  EXPECT_TRUE(NULL == coll_.TakeDirtyMetrics());
+  count_.ClearDirty();
+  bool_.ClearDirty();
+  timing_.AddSample(10);
+  integer_ = 0;
+  count_ += 2;
+  metric = coll_.TakeDirtyMetrics();
+  EXPECT_EQ(&count_, metric);
+  EXPECT_EQ(&integer_, metric->next_dirty());
+  EXPECT_EQ(&timing_, metric->next_dirty()->next_dirty());
+
+  // Metrics outside of a collection are not tracked.
+  IntegerMetric loose("loose", 0);
+  ++loose;
+  EXPECT_FALSE(loose.dirty());
+}
+
+TEST_F(MetricsEnumTest, DirtyConcurrent) {
+  RunOnThreads(&IncrementCount, &count_);
+  RunOnThreads(&AddTimingSamples, &timing_);
+
+  MetricBase *metric = coll_.TakeDirtyMetrics();
+  EXPECT_EQ(&timing_, metric);
+  EXPECT_EQ(&count_, metric->next_dirty());
+  EXPECT_TRUE(NULL == metric->next_dirty()->next_dirty());
+}
+
 TEST_F(MetricsTest, SimpleConstruction) {
   const CountMetric c("c", 100);
 
@@ -0,0 +1,76 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Iterator over metrics persisted to a file
+#include "omaha/statsreport/persistent_iterator-file.h"
+
+#include "omaha/statsreport/aggregator-file.h"
+
+namespace stats_report {
+
+PersistentMetricsIteratorFile::PersistentMetricsIteratorFile(
+    const wchar_t *file_path) {
+  // A malformed file reads as an empty one.
+  ReadMetricsFile(file_path, &file_);
+  record_ = file_.begin();
+  Next();
+}
+
+void PersistentMetricsIteratorFile::Next() {
+  current_value_.reset();
+
+  if (record_ == file_.end())
+    return;
+
+  const MetricsFile::Record &record = record_->second;
+  const char *name = record.name.c_str();
+  switch (record.type) {
+   case MetricsFile::kCountRecord:
+    current_value_.reset(new CountMetric(name, record.value));
+    break;
+   case MetricsFile::kTimingRecord: {
+    TimingMetric::TimingData data = {};
+    data.count = record.count;
+    data.sum = record.sum;
+    data.minimum = record.minimum;
+    data.maximum = record.maximum;
+
+    // timings aggregated by a version with different buckets have none
+    TimingMetric::Histogram histogram = {};
+    if (record.buckets.size() ==
+            static_cast<size_t>(TimingMetric::kNumBuckets)) {
+      for (int i = 0; i < TimingMetric::kNumBuckets; ++i)
+        histogram.counts[i] = record.buckets[i];
+    }
+    current_value_.reset(new TimingMetric(name, data, histogram));
+    break;
+   }
+   case MetricsFile::kIntegerRecord:
+    current_value_.reset(new IntegerMetric(name, record.value));
+    break;
+   case MetricsFile::kBoolRecord:
+    current_value_.reset(new BoolMetric(name,
+        static_cast<uint32>(record.value ? BoolMetric::kBoolTrue :
+                                           BoolMetric::kBoolFalse)));
+    break;
+   default:
+    DCHECK(false && "Impossible record type");
+    break;
+  }
+
+  ++record_;
+}
+
+} // namespace stats_report
@@ -0,0 +1,98 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Iterator over metrics persisted by MetricsAggregatorFile
+#ifndef OMAHA_STATSREPORT_PERSISTENT_ITERATOR_FILE_H__
+#define OMAHA_STATSREPORT_PERSISTENT_ITERATOR_FILE_H__
+
+#include <iterator>
+#include <memory>
+
+#include "omaha/statsreport/metrics.h"
+#include "omaha/statsreport/metrics_file.h"
+
+namespace stats_report {
+
+/// Forward iterator for metrics persisted to a file. The file is read as a
+/// whole when the iterator is constructed.
+class PersistentMetricsIteratorFile
+    : public std::iterator<std::forward_iterator_tag, const MetricBase *> {
+ public:
+  /// @param file_path see MetricsAggregatorFile
+  explicit PersistentMetricsIteratorFile(const wchar_t *file_path);
+
+  /// Constructs the at-end iterator
+  PersistentMetricsIteratorFile() {
+  }
+
+  MetricBase *operator* () {
+    return Current();
+  }
+  MetricBase *operator-> () {
+    return Current();
+  }
+
+  /// Preincrement, we don't implement postincrement because we don't
+  /// want to deal with making iterators copyable, comparable etc.
+  PersistentMetricsIteratorFile &operator++() {
+    Next();
+
+    return (*this);
+  }
+
+  /// Compare for equality with o.
+  bool equals(const PersistentMetricsIteratorFile &o) const {
+    // compare equal to self, and end iterators compare equal
+    if ((this == &o) || (NULL == current_value_.get() &&
+                         NULL == o.current_value_.get()))
+      return true;
+
+    return false;
+  }
+
+ private:
+  MetricBase *Current() {
+    DCHECK(current_value_.get());
+    return current_value_.get();
+  }
+
+  /// Walk to the next record
+  void Next();
+
+  /// The metrics read from the file
+  MetricsFile file_;
+
+  /// The record under the iterator
+  MetricsFile::const_iterator record_;
+
+  /// The metric under the iterator, which is named after the record
+  std::unique_ptr<MetricBase> current_value_;
+
+  DISALLOW_COPY_AND_ASSIGN(PersistentMetricsIteratorFile);
+};
+
+inline bool operator == (const PersistentMetricsIteratorFile &a,
+                         const PersistentMetricsIteratorFile &b) {
+  return a.equals(b);
+}
+
+inline bool operator != (const PersistentMetricsIteratorFile &a,
+                         const PersistentMetricsIteratorFile &b) {
+  return !a.equals(b);
+}
+
+}  // namespace stats_report
+
+#endif  // OMAHA_STATSREPORT_PERSISTENT_ITERATOR_FILE_H__
@@ -15,6 +15,7 @@
 //
 // Iterator over persisted metrics
 #include "persistent_iterator-win32.h"
+#include "util-win32.h"
 
 namespace stats_report {
 
@@ -41,8 +42,11 @@ void PersistentMetricsIteratorWin32::Next() {
        case kCounts:
         state_ = kTimings;
         subkey_name = kTimingsKeyName;
+        // timings persisted before histograms were kept have none
+        histogram_key_.Open(key_, kHistogramsKeyName, KEY_READ);
         break;
        case kTimings:
+        histogram_key_.Close();
         state_ = kIntegers;
         subkey_name = kIntegersKeyName;
         break;
@@ -105,12 +109,19 @@ void PersistentMetricsIteratorWin32::Next() {
           current_value_.reset(new CountMetric(current_value_name_ .GetString(),
                                           *reinterpret_cast<int64*>(&buf[0])));
           break;
-         case kTimings:
+         case kTimings: {
           if (value_len != sizeof(TimingMetric::TimingData))
             continue;
+          TimingMetric::Histogram histogram;
+          if (NULL == histogram_key_.m_hKey ||
+              !GetData(histogram_key_, wide_value_name, &histogram)) {
+            memset(&histogram, 0, sizeof(histogram));
+          }
           current_value_.reset(new TimingMetric(current_value_name_.GetString(),
-                        *reinterpret_cast<TimingMetric::TimingData*>(&buf[0])));
+                        *reinterpret_cast<TimingMetric::TimingData*>(&buf[0]),
+                        histogram));
           break;
+         }
          case kIntegers:
           if (value_len != sizeof(int64))
             continue;
@@ -108,6 +108,9 @@ class PersistentMetricsIteratorWin32
   /// The subkey we're currently enumerating over
   CRegKey sub_key_;
 
+  /// The histograms of the timings, open while we enumerate the timings
+  CRegKey histogram_key_;
+
   /// Current value we're indexing over
   DWORD value_index_;
 
@@ -69,10 +69,15 @@ bool equals(MetricBase *a, MetricBase *b) {
       TimingMetric &at = a->AsTiming();
       TimingMetric &bt = b->AsTiming();
 
+      TimingMetric::Histogram ah, bh;
+      at.GetHistogram(&ah);
+      bt.GetHistogram(&bh);
+
       return at.count() == bt.count() &&
              at.sum() == bt.sum() &&
              at.minimum() == bt.minimum() &&
-             at.maximum() == bt.maximum();
+             at.maximum() == bt.maximum() &&
+             0 == memcmp(&ah, &bh, sizeof(ah));
     }
     break;
    case kIntegerType:
@@ -0,0 +1,125 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+//
+#include "prometheus_formatter.h"
+
+#include <stdio.h>
+
+namespace stats_report {
+
+PrometheusFormatter::PrometheusFormatter(const char *prefix)
+    : prefix_(prefix) {
+}
+
+PrometheusFormatter::~PrometheusFormatter() {
+}
+
+void PrometheusFormatter::AddType(const char *name, const char *type) {
+  output_ += "# TYPE ";
+  output_ += prefix_;
+  output_ += name;
+  output_ += " ";
+  output_ += type;
+  output_ += "\n";
+}
+
+void PrometheusFormatter::AddSample(const char *name,
+                                    const char *suffix,
+                                    const char *labels,
+                                    int64 value) {
+  char buffer[32] = {};
+  sprintf_s(buffer, sizeof(buffer), " %I64d\n", value);
+
+  output_ += prefix_;
+  output_ += name;
+  output_ += suffix;
+  output_ += labels;
+  output_ += buffer;
+}
+
+void PrometheusFormatter::AddCounter(const char *name, int64 value) {
+  AddType(name, "counter");
+  AddSample(name, "", "", value);
+}
+
+void PrometheusFormatter::AddGauge(const char *name, int64 value) {
+  AddType(name, "gauge");
+  AddSample(name, "", "", value);
+}
+
+// The last bucket counts all the times of kMaxTrackedMs or more, so it is
+// only written as the +Inf bucket.
+void PrometheusFormatter::AddHistogram(
+    const char *name,
+    int64 sum,
+    const TimingMetric::Histogram &histogram) {
+  AddType(name, "histogram");
+
+  int64 count = 0;
+  for (int i = 0; i < TimingMetric::kNumBuckets; ++i) {
+    if (0 == histogram.counts[i])
+      continue;
+
+    count += histogram.counts[i];
+    if (i == TimingMetric::kNumBuckets - 1)
+      break;
+
+    char labels[32] = {};
+    sprintf_s(labels, sizeof(labels), "{le=\"%I64d\"}",
+              TimingMetric::BucketMaximum(i));
+    AddSample(name, "_bucket", labels, count);
+  }
+
+  AddSample(name, "_bucket", "{le=\"+Inf\"}", count);
+  AddSample(name, "_sum", "", sum);
+  AddSample(name, "_count", "", count);
+}
+
+void PrometheusFormatter::AddMetric(const MetricBase *metric) {
+  switch (metric->type()) {
+    case kCountType: {
+      const CountMetric &count = metric->AsCount();
+      AddCounter(count.name(), count.value());
+    }
+    break;
+
+    case kTimingType: {
+      const TimingMetric &timing = metric->AsTiming();
+      TimingMetric::Histogram histogram;
+      timing.GetHistogram(&histogram);
+      AddHistogram(timing.name(), timing.sum(), histogram);
+    }
+    break;
+
+    case kIntegerType: {
+      const IntegerMetric &integer = metric->AsInteger();
+      AddGauge(integer.name(), integer.value());
+    }
+    break;
+
+    case kBoolType: {
+      const BoolMetric &boolean = metric->AsBool();
+      if (boolean.value() != BoolMetric::kBoolUnset)
+        AddGauge(boolean.name(), boolean.value() == BoolMetric::kBoolTrue);
+    }
+    break;
+
+    default:
+      DCHECK(false && "Impossible metric type");
+  }
+}
+
+} // namespace stats_report
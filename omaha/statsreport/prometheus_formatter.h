@@ -0,0 +1,77 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Utility class to format the live values of metrics in the Prometheus text
+// exposition format, for local scrapers:
+//   # TYPE prefix_name counter|gauge|histogram
+//   prefix_name value
+// Count metrics are counters, integer and bool metrics are gauges, and timing
+// metrics are histograms of milliseconds. The buckets of a histogram are its
+// non-empty ones, each with the cumulative count of the samples up to the
+// highest time it counts, followed by the +Inf bucket, the sum and the count.
+// Bool metrics which are unset are left out.
+#ifndef OMAHA_STATSREPORT_PROMETHEUS_FORMATTER_H__
+#define OMAHA_STATSREPORT_PROMETHEUS_FORMATTER_H__
+
+#include <string>
+
+#include "base/basictypes.h"
+#include "metrics.h"
+
+namespace stats_report {
+
+/// A utility class that knows how to turn metrics into Prometheus text.
+class PrometheusFormatter {
+public:
+  /// @param prefix is prepended to the names of the metrics, e.g. "omaha_"
+  explicit PrometheusFormatter(const char *prefix);
+  ~PrometheusFormatter();
+
+  /// Add the current value of metric to the output. The metric is read
+  /// without a lock, and a timing metric is counted from its histogram, so
+  /// that its count always matches its buckets.
+  void AddMetric(const MetricBase *metric);
+
+  /// Add typed values to the output
+  /// @{
+  void AddCounter(const char *name, int64 value);
+  void AddGauge(const char *name, int64 value);
+  void AddHistogram(const char *name,
+                    int64 sum,
+                    const TimingMetric::Histogram &histogram);
+  /// @}
+
+  const std::string &output() const { return output_; }
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(PrometheusFormatter);
+
+  /// Appends the TYPE line of the metric |name|.
+  void AddType(const char *name, const char *type);
+
+  /// Appends a sample line of the metric |name|, with its |suffix| and
+  /// |labels|, which may be empty.
+  void AddSample(const char *name,
+                 const char *suffix,
+                 const char *labels,
+                 int64 value);
+
+  const std::string prefix_;
+  std::string output_;
+};
+
+} // namespace stats_report
+
+#endif  // OMAHA_STATSREPORT_PROMETHEUS_FORMATTER_H__
@@ -0,0 +1,118 @@
+// Copyright 2006-2009 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "gtest/gtest.h"
+#include "omaha/statsreport/prometheus_formatter.h"
+
+using stats_report::BoolMetric;
+using stats_report::CountMetric;
+using stats_report::IntegerMetric;
+using stats_report::PrometheusFormatter;
+using stats_report::TimingMetric;
+
+TEST(PrometheusFormatter, Format) {
+  PrometheusFormatter formatter("test_");
+
+  formatter.AddCounter("count1", 10);
+  formatter.AddGauge("integer1", -3000);
+
+  EXPECT_STREQ("# TYPE test_count1 counter\n"
+               "test_count1 10\n"
+               "# TYPE test_integer1 gauge\n"
+               "test_integer1 -3000\n",
+               formatter.output().c_str());
+}
+
+TEST(PrometheusFormatter, FormatHistogram) {
+  TimingMetric timing("timing1", TimingMetric::TimingData());
+  timing.AddSample(50);
+  timing.AddSample(50);
+  timing.AddSample(100);
+
+  PrometheusFormatter formatter("test_");
+  formatter.AddMetric(&timing);
+
+  // 50 ms is in bucket 28, which goes up to 51 ms, and 100 ms in bucket 36.
+  EXPECT_STREQ("# TYPE test_timing1 histogram\n"
+               "test_timing1_bucket{le=\"51\"} 2\n"
+               "test_timing1_bucket{le=\"103\"} 3\n"
+               "test_timing1_bucket{le=\"+Inf\"} 3\n"
+               "test_timing1_sum 200\n"
+               "test_timing1_count 3\n",
+               formatter.output().c_str());
+}
+
+TEST(PrometheusFormatter, FormatEmptyHistogram) {
+  TimingMetric::Histogram histogram = {};
+
+  PrometheusFormatter formatter("test_");
+  formatter.AddHistogram("timing1", 0, histogram);
+
+  EXPECT_STREQ("# TYPE test_timing1 histogram\n"
+               "test_timing1_bucket{le=\"+Inf\"} 0\n"
+               "test_timing1_sum 0\n"
+               "test_timing1_count 0\n",
+               formatter.output().c_str());
+}
+
+// The times of kMaxTrackedMs or more are only counted in the +Inf bucket.
+TEST(PrometheusFormatter, FormatHistogram_Untracked) {
+  TimingMetric timing("timing1", TimingMetric::TimingData());
+  timing.AddSample(1);
+  timing.AddSample(TimingMetric::kMaxTrackedMs);
+
+  PrometheusFormatter formatter("test_");
+  formatter.AddMetric(&timing);
+
+  EXPECT_STREQ("# TYPE test_timing1 histogram\n"
+               "test_timing1_bucket{le=\"1\"} 1\n"
+               "test_timing1_bucket{le=\"+Inf\"} 2\n"
+               "test_timing1_sum 4294967297\n"
+               "test_timing1_count 2\n",
+               formatter.output().c_str());
+}
+
+TEST(PrometheusFormatter, AddMetric) {
+  CountMetric count("count1", 10);
+  IntegerMetric integer("integer1", 3000);
+  BoolMetric boolean_true("boolean1", BoolMetric::kBoolTrue);
+  BoolMetric boolean_false("boolean2", BoolMetric::kBoolFalse);
+
+  PrometheusFormatter formatter("omaha_");
+  formatter.AddMetric(&count);
+  formatter.AddMetric(&integer);
+  formatter.AddMetric(&boolean_true);
+  formatter.AddMetric(&boolean_false);
+
+  EXPECT_STREQ("# TYPE omaha_count1 counter\n"
+               "omaha_count1 10\n"
+               "# TYPE omaha_integer1 gauge\n"
+               "omaha_integer1 3000\n"
+               "# TYPE omaha_boolean1 gauge\n"
+               "omaha_boolean1 1\n"
+               "# TYPE omaha_boolean2 gauge\n"
+               "omaha_boolean2 0\n",
+               formatter.output().c_str());
+}
+
+TEST(PrometheusFormatter, AddMetric_UnsetBool) {
+  BoolMetric boolean("boolean1", BoolMetric::kBoolTrue);
+  boolean.Reset();
+
+  PrometheusFormatter formatter("omaha_");
+  formatter.AddMetric(&boolean);
+
+  EXPECT_STREQ("", formatter.output().c_str());
+}
@@ -37,7 +37,9 @@ CPU::CPU()
     has_sse42_(false),
     has_avx_(false),
     has_avx_hardware_(false),
+    has_avx2_(false),
     has_aesni_(false),
+    has_sha_(false),
     has_non_stop_time_stamp_counter_(false),
     cpu_vendor_("unknown") {
   Initialize();
@@ -72,6 +74,21 @@ void __cpuid(int cpu_info[4], int info_type) {
 
 #endif
 
+void __cpuidex(int cpu_info[4], int info_type, int info_index) {
+  __asm__ volatile (
+#if defined(__pic__) && defined(__i386__)
+    "mov %%ebx, %%edi\n"
+    "cpuid\n"
+    "xchg %%edi, %%ebx\n"
+    : "=a"(cpu_info[0]), "=D"(cpu_info[1]), "=c"(cpu_info[2]), "=d"(cpu_info[3])
+#else
+    "cpuid \n\t"
+    : "=a"(cpu_info[0]), "=b"(cpu_info[1]), "=c"(cpu_info[2]), "=d"(cpu_info[3])
+#endif
+    : "a"(info_type), "c"(info_index)
+  );
+}
+
 // _xgetbv returns the value of an Intel Extended Control Register (XCR).
 // Currently only XCR0 is defined by Intel so |xcr| should always be zero.
 uint64 _xgetbv(uint32 xcr) {
@@ -135,6 +152,15 @@ void CPU::Initialize() {
     has_aesni_ = (cpu_info[2] & 0x02000000) != 0;
   }
 
+  // Structured extended feature flags are enumerated by leaf 7, subleaf 0.
+  // AVX2 additionally needs the OS support for the YMM state checked above.
+  if (num_ids >= 7) {
+    int cpu_info7[4] = {0};
+    __cpuidex(cpu_info7, 7, 0);
+    has_avx2_ = has_avx_ && (cpu_info7[1] & 0x00000020) != 0;
+    has_sha_ = (cpu_info7[1] & 0x20000000) != 0;
+  }
+
   // Get the brand string of the cpu.
   __cpuid(cpu_info, 0x80000000);
   const int parameter_end = 0x80000004;
@@ -50,7 +50,10 @@ class CPU {
   // Note: you should never need to call this function. It was added in order
   // to workaround a bug in NSS but |has_avx()| is what you want.
   bool has_avx_hardware() const { return has_avx_hardware_; }
+  bool has_avx2() const { return has_avx2_; }
   bool has_aesni() const { return has_aesni_; }
+  // has_sha returns true when the Intel SHA extensions (SHA-NI) are present.
+  bool has_sha() const { return has_sha_; }
   bool has_non_stop_time_stamp_counter() const {
     return has_non_stop_time_stamp_counter_;
   }
@@ -77,7 +80,9 @@ class CPU {
   bool has_sse42_;
   bool has_avx_;
   bool has_avx_hardware_;
+  bool has_avx2_;
   bool has_aesni_;
+  bool has_sha_;
   bool has_non_stop_time_stamp_counter_;
   std::string cpu_vendor_;
   std::string cpu_brand_;
@@ -26,16 +26,20 @@
 #include <utility>
 
 #include "components/crx_file/id_util.h"
+#include "components/crx_file/zip_parallel_extractor.h"
+#include "components/crx_file/zip_stream_extractor.h"
 #include "crypto/secure_util.h"
 #include "crypto/signature_verifier.h"
 #include "omaha/base/debug.h"
 #include "omaha/base/file.h"
+#include "omaha/base/path.h"
 #include "omaha/base/scope_guard.h"
 #include "omaha/base/security/sha256.h"
 #include "omaha/base/signatures.h"
 #include "omaha/base/string.h"
 #include "omaha/base/utils.h"
 #include "omaha/net/cup_ecdsa_utils.h"
+#include "omaha/third_party/smartany/scoped_any.h"
 #include "third_party/chrome/files/src/components/crx_file/crx3.pb.h"
 #include "third_party/libzip/lib/zip.h"
 
@@ -46,6 +50,9 @@ namespace {
 // The maximum size the Crx3 parser will tolerate for a header.
 const uint32_t kMaxHeaderSize = 1 << 18;
 
+// The archive is read in chunks of this size when it is verified.
+const int kArchiveReadSize = 1 << 16;
+
 // The context for Crx3 signing, encoded in UTF8.
 const unsigned char kSignatureContext[] = "CRX3 SignedData";
 
@@ -84,20 +91,27 @@ uint32_t ReadAndHashLittleEndianUInt32(
   if (ReadAndHashBuffer(buffer, 4, file, hash) != 4) {
     return UINT32_MAX;
   }
-  return buffer[3] << 24 | buffer[2] << 16 | buffer[1] << 8 | buffer[0];
+  return GetLittleEndianUInt32(buffer);
 }
 
-// Read to the end of the file, updating the hash and all verifiers.
+// Read to the end of the file, updating the hash and all verifiers, and
+// passing the archive to |extractor| if it is not null. The extractor keeps
+// track of its own errors; they do not stop the verification.
 bool ReadHashAndVerifyArchive(omaha::File* file,
                               omaha::CryptDetails::HashInterface* hash,
-                              const Verifiers& verifiers) {
-  uint8_t buffer[1 << 12] = {};
-  size_t len = 0;
-  while ((len = ReadAndHashBuffer(buffer, arraysize(buffer), file, hash)) > 0) {
+                              const Verifiers& verifiers,
+                              ZipStreamExtractor* extractor) {
+  std::vector<uint8_t> buffer(kArchiveReadSize);
+  int len = 0;
+  while ((len = ReadAndHashBuffer(buffer.data(), kArchiveReadSize, file,
+                                  hash)) > 0) {
     for (Verifiers::const_iterator verifier = verifiers.begin();
          verifier != verifiers.end();
          ++verifier) {
-      (*verifier)->VerifyUpdate(buffer, len);
+      (*verifier)->VerifyUpdate(buffer.data(), len);
+    }
+    if (extractor) {
+      extractor->Write(buffer.data(), len);
     }
   }
 
@@ -122,7 +136,8 @@ VerifierResult VerifyCrx3(
     const std::vector<std::vector<uint8_t>>& required_key_hashes,
     std::string* public_key,
     std::string* crx_id,
-    bool require_publisher_key) {
+    bool require_publisher_key,
+    ZipStreamExtractor* extractor) {
   // Parse [header-size] and [header].
   const uint32_t header_size = ReadAndHashLittleEndianUInt32(file, hash);
   if (header_size > kMaxHeaderSize) {
@@ -234,7 +249,7 @@ VerifierResult VerifyCrx3(
   }
 
   // Update and finalize the verifiers with [archive].
-  if (!ReadHashAndVerifyArchive(file, hash, verifiers)) {
+  if (!ReadHashAndVerifyArchive(file, hash, verifiers, extractor)) {
     return VerifierResult::ERROR_SIGNATURE_VERIFICATION_FAILED;
   }
 
@@ -259,12 +274,16 @@ int ReadBuffer(uint8_t* buffer, int length, omaha::File* file) {
   return bytes_read;
 }
 
+uint32_t GetLittleEndianUInt32(const uint8_t* p) {
+  return p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
 uint32_t ReadLittleEndianUInt32(omaha::File* file) {
   uint8_t buffer[4] = {};
   if (ReadBuffer(buffer, 4, file) != 4) {
     return UINT32_MAX;
   }
-  return buffer[3] << 24 | buffer[2] << 16 | buffer[1] << 8 | buffer[0];
+  return GetLittleEndianUInt32(buffer);
 }
 
 HRESULT ReadArchiveAndWrite(omaha::File* file, const CPath& write_to) {
@@ -407,23 +426,24 @@ bool Unzip(const CPath& zip_file_path, const CPath& to_dir) {
   return true;
 }
 
-}  // namespace
-
-VerifierResult Verify(
-    const std::string& crx_path,
+// Verifies the file at |crx_path|, passing its archive to |extractor| if it is
+// not null.
+VerifierResult VerifyFile(
+    const CString& crx_path,
     const VerifierFormat& format,
     const std::vector<std::vector<uint8_t>>& required_key_hashes,
     const std::vector<uint8_t>& required_file_hash,
+    ZipStreamExtractor* extractor,
     std::string* public_key,
     std::string* crx_id) {
   std::string public_key_local;
   std::string crx_id_local;
-  if (!omaha::File::Exists(CString(crx_path.c_str()))) {
+  if (!omaha::File::Exists(crx_path)) {
     return VerifierResult::ERROR_FILE_NOT_READABLE;
   }
 
   omaha::File file;
-  HRESULT hr = file.Open(CString(crx_path.c_str()), false, false);
+  HRESULT hr = file.Open(crx_path, false, false);
   if (FAILED(hr)) {
     return VerifierResult::ERROR_FILE_NOT_READABLE;
   }
@@ -459,7 +479,8 @@ VerifierResult Verify(
                required_key_hashes,
                &public_key_local,
                &crx_id_local,
-               format == VerifierFormat::CRX3_WITH_PUBLISHER_PROOF) :
+               format == VerifierFormat::CRX3_WITH_PUBLISHER_PROOF,
+               extractor) :
     VerifierResult::ERROR_HEADER_INVALID;
   if (result != VerifierResult::OK_FULL) {
     return result;
@@ -486,6 +507,57 @@ VerifierResult Verify(
   return diff ? VerifierResult::OK_DELTA : VerifierResult::OK_FULL;
 }
 
+// Moves the |names| at the top of |staging_dir| into |to_dir|. A directory
+// can't be renamed over an existing one, so nothing is moved if any of the
+// names is in |to_dir| already. If a rename still fails, the names already
+// moved are moved back, and |to_dir| is left as it was.
+bool CommitEntries(const CString& staging_dir,
+                   const CString& to_dir,
+                   const std::set<CString>& names) {
+  for (std::set<CString>::const_iterator name = names.begin();
+       name != names.end();
+       ++name) {
+    if (omaha::File::Exists(omaha::ConcatenatePath(to_dir, *name))) {
+      return false;
+    }
+  }
+
+  for (std::set<CString>::const_iterator name = names.begin();
+       name != names.end();
+       ++name) {
+    if (!::MoveFileEx(omaha::ConcatenatePath(staging_dir, *name),
+                      omaha::ConcatenatePath(to_dir, *name),
+                      0)) {
+      while (name != names.begin()) {
+        --name;
+        ::MoveFileEx(omaha::ConcatenatePath(to_dir, *name),
+                     omaha::ConcatenatePath(staging_dir, *name),
+                     0);
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+VerifierResult Verify(
+    const std::string& crx_path,
+    const VerifierFormat& format,
+    const std::vector<std::vector<uint8_t>>& required_key_hashes,
+    const std::vector<uint8_t>& required_file_hash,
+    std::string* public_key,
+    std::string* crx_id) {
+  return VerifyFile(CString(crx_path.c_str()),
+                    format,
+                    required_key_hashes,
+                    required_file_hash,
+                    NULL,
+                    public_key,
+                    crx_id);
+}
+
 bool Crx3Unzip(const CPath& crx_path, const CPath& to_dir) {
   HRESULT hr = omaha::CreateDir(to_dir, NULL);
   if (FAILED(hr)) {
@@ -501,5 +573,128 @@ bool Crx3Unzip(const CPath& crx_path, const CPath& to_dir) {
   return Crx3ToZip(crx_path, zip_path) ? Unzip(zip_path, to_dir) : false;
 }
 
-}  // namespace crx_file
+bool Crx3UnzipParallel(const CPath& crx_path,
+                       const CPath& to_dir,
+                       int max_threads) {
+  scoped_hfile file(::CreateFile(crx_path,
+                                 GENERIC_READ,
+                                 FILE_SHARE_READ,
+                                 NULL,
+                                 OPEN_EXISTING,
+                                 FILE_ATTRIBUTE_NORMAL,
+                                 NULL));
+  if (!valid(file)) {
+    return false;
+  }
+  LARGE_INTEGER file_size = {};
+  if (!::GetFileSizeEx(get(file), &file_size) ||
+      static_cast<uint64_t>(file_size.QuadPart) > SIZE_MAX) {
+    return false;
+  }
+  const size_t size = static_cast<size_t>(file_size.QuadPart);
+  if (size < 12) {
+    return false;
+  }
+
+  scoped_file_mapping mapping(::CreateFileMapping(get(file),
+                                                  NULL,
+                                                  PAGE_READONLY,
+                                                  0,
+                                                  0,
+                                                  NULL));
+  if (!valid(mapping)) {
+    return false;
+  }
+  scoped_file_view view(::MapViewOfFile(get(mapping), FILE_MAP_READ, 0, 0, 0));
+  if (!valid(view)) {
+    return false;
+  }
+  const uint8_t* crx = static_cast<const uint8_t*>(get(view));
+
+  // The archive follows the crx header, as in Crx3ToZip:
+  //   [crx-magic] + [version] + [header-size] + [header].
+  if (strncmp(reinterpret_cast<const char*>(crx),
+              kCrxDiffFileHeaderMagic,
+              kCrx2FileHeaderMagicSize) &&
+      strncmp(reinterpret_cast<const char*>(crx),
+              kCrx2FileHeaderMagic,
+              kCrx2FileHeaderMagicSize)) {
+    return false;
+  }
+  const uint32_t version = GetLittleEndianUInt32(crx + 4);
+  const uint32_t header_size = GetLittleEndianUInt32(crx + 8);
+  if (version != 3 ||
+      header_size > kMaxHeaderSize ||
+      header_size > size - 12) {
+    return false;
+  }
+
+  ZipParallelExtractor extractor(crx + 12 + header_size,
+                                 size - 12 - header_size);
+  return extractor.Init() &&
+         extractor.Extract(CString(to_dir), max_threads);
+}
+
+VerifierResult VerifyAndUnzip(
+    const CPath& crx_path,
+    const VerifierFormat& format,
+    const std::vector<std::vector<uint8_t>>& required_key_hashes,
+    const std::vector<uint8_t>& required_file_hash,
+    const CPath& to_dir,
+    std::string* public_key,
+    std::string* crx_id) {
+  // The staging directory is next to the files it is committed to, so that
+  // committing them is a rename. If it can't be created, the file is still
+  // verified, so that ERROR_UNPACK_FAILED is only returned for files that
+  // verify.
+  CString staging_dir;
+  if (SUCCEEDED(omaha::CreateDir(to_dir, NULL))) {
+    staging_dir = omaha::GetTempFilenameAt(to_dir, _T("C3S"));
+    if (!staging_dir.IsEmpty() &&
+        (!::DeleteFile(staging_dir) ||
+         FAILED(omaha::CreateDir(staging_dir, NULL)))) {
+      staging_dir.Empty();
+    }
+  }
+  omaha::ScopeGuard staging_dir_guard =
+      omaha::MakeGuard(omaha::DeleteDirectory, staging_dir);
+  if (staging_dir.IsEmpty()) {
+    staging_dir_guard.Dismiss();
+  }
+
+  std::unique_ptr<ZipStreamExtractor> extractor;
+  if (!staging_dir.IsEmpty()) {
+    extractor.reset(new ZipStreamExtractor(staging_dir));
+  }
+
+  std::string public_key_local;
+  std::string crx_id_local;
+  const VerifierResult result = VerifyFile(CString(crx_path),
+                                           format,
+                                           required_key_hashes,
+                                           required_file_hash,
+                                           extractor.get(),
+                                           &public_key_local,
+                                           &crx_id_local);
+  if (result != VerifierResult::OK_FULL &&
+      result != VerifierResult::OK_DELTA) {
+    return result;
+  }
+  if (!extractor ||
+      !extractor->Finish() ||
+      !CommitEntries(staging_dir,
+                     CString(to_dir),
+                     extractor->top_level_names())) {
+    return VerifierResult::ERROR_UNPACK_FAILED;
+  }
+
+  if (public_key) {
+    *public_key = public_key_local;
+  }
+  if (crx_id) {
+    *crx_id = crx_id_local;
+  }
+  return result;
+}
 
+}  // namespace crx_file
@@ -52,6 +52,7 @@ enum class VerifierResult {
   ERROR_SIGNATURE_INITIALIZATION_FAILED,  // A signature or key is malformed.
   ERROR_SIGNATURE_VERIFICATION_FAILED,    // A signature doesn't match.
   ERROR_REQUIRED_PROOF_MISSING,           // RequireKeyProof was unsatisfied.
+  ERROR_UNPACK_FAILED,  // The file verifies, but its archive can't be unpacked.
 };
 
 // Verify the file at |crx_path| as a valid Crx of |format|. The Crx must be
@@ -72,6 +73,34 @@ VerifierResult Verify(
 // Unzips the given crx file |crx_path| into the directory |to_dir|.
 bool Crx3Unzip(const CPath& crx_path, const CPath& to_dir);
 
+// Unzips the given crx file |crx_path| into the directory |to_dir| like
+// Crx3Unzip, reading the archive from a mapping of the file instead of a copy
+// of it, and inflating its entries on up to |max_threads| threads, 0 meaning
+// one per processor. The files written are the same whatever the number of
+// threads. Meant for CRX files with many or large entries.
+bool Crx3UnzipParallel(const CPath& crx_path,
+                       const CPath& to_dir,
+                       int max_threads);
+
+// Verifies the file at |crx_path| as Verify() does, and unzips it into the
+// directory |to_dir| in the same pass over the file. The entries are extracted
+// into a staging directory under |to_dir| as they are read, and are only moved
+// into |to_dir| once the whole file has verified; otherwise, nothing is left
+// behind. |to_dir| must not already contain any of the files or directories
+// at the top level of the archive. Returns ERROR_UNPACK_FAILED if the file
+// verifies but cannot be unzipped this way, for instance if an entry is stored
+// with a data descriptor, or if one of these names is already in |to_dir|.
+// Crx3Unzip() can still unzip such a file, since it reads the central
+// directory of the archive.
+VerifierResult VerifyAndUnzip(
+    const CPath& crx_path,
+    const VerifierFormat& format,
+    const std::vector<std::vector<uint8_t>>& required_key_hashes,
+    const std::vector<uint8_t>& required_file_hash,
+    const CPath& to_dir,
+    std::string* public_key,
+    std::string* crx_id);
+
 }  // namespace crx_file
 
 #endif  // OMAHA_THIRD_PARTY_CHROME_FILES_SRC_COMPONENTS_CRX_FILE_CRX_VERIFIER_H_
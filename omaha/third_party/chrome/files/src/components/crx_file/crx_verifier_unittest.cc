@@ -22,12 +22,15 @@
 #include <atlconv.h>
 #include <atlpath.h>
 
+#include "components/crx_file/zip_parallel_extractor.h"
+#include "components/crx_file/zip_stream_extractor.h"
 #include "omaha/base/app_util.h"
 #include "omaha/base/file.h"
 #include "omaha/base/path.h"
 #include "omaha/base/string.h"
 #include "omaha/base/utils.h"
 #include "omaha/testing/unit_test.h"
+#include "zlib.h"
 
 namespace {
 
@@ -44,6 +47,62 @@ std::string TestFile(const std::string& file) {
   return std::string(CT2A(TestFileCPath(CString(file.c_str()))));
 }
 
+// Returns true if VerifyAndUnzip left its staging directory in |dir|.
+bool HasStagingDirectory(const CString& dir) {
+  WIN32_FIND_DATA find_data = {};
+  const HANDLE find =
+      ::FindFirstFile(ConcatenatePath(dir, _T("C3S*")), &find_data);
+  if (find == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  ::FindClose(find);
+  return true;
+}
+
+void AppendUInt16(uint16_t value, std::string* zip) {
+  zip->push_back(static_cast<char>(value & 0xff));
+  zip->push_back(static_cast<char>(value >> 8));
+}
+
+void AppendUInt32(uint32_t value, std::string* zip) {
+  AppendUInt16(static_cast<uint16_t>(value & 0xffff), zip);
+  AppendUInt16(static_cast<uint16_t>(value >> 16), zip);
+}
+
+// Appends a local file header for a stored entry, followed by its data.
+void AppendStoredEntry(const std::string& name,
+                       const std::string& data,
+                       std::string* zip) {
+  const uint32_t crc = crc32(crc32(0, NULL, 0),
+                             reinterpret_cast<const Bytef*>(data.data()),
+                             static_cast<uInt>(data.size()));
+  AppendUInt32(0x04034b50, zip);  // Signature.
+  AppendUInt16(20, zip);          // Version needed to extract.
+  AppendUInt16(0, zip);           // Flags.
+  AppendUInt16(0, zip);           // Method.
+  AppendUInt32(0, zip);           // Time and date.
+  AppendUInt32(crc, zip);
+  AppendUInt32(static_cast<uint32_t>(data.size()), zip);
+  AppendUInt32(static_cast<uint32_t>(data.size()), zip);
+  AppendUInt16(static_cast<uint16_t>(name.size()), zip);
+  AppendUInt16(0, zip);           // Extra field length.
+  *zip += name;
+  *zip += data;
+}
+
+std::string ReadFileToString(const CString& path) {
+  std::vector<byte> contents;
+  EXPECT_SUCCEEDED(omaha::ReadEntireFile(path, 0, &contents));
+  return std::string(contents.begin(), contents.end());
+}
+
+bool ExtractZip(const std::string& zip, const CString& to_dir) {
+  crx_file::ZipStreamExtractor extractor(to_dir);
+  return extractor.Write(reinterpret_cast<const uint8_t*>(zip.data()),
+                         zip.size()) &&
+         extractor.Finish();
+}
+
 const char kOjjHash[] = "ojjgnpkioondelmggbekfhllhdaimnho";
 const char kOjjKey[] =
     "MIIBIjANBgkqhkiG9w0BAQEFAAOCAQ8AMIIBCgKCAQEA230uN7vYDEhdDlb4/"
@@ -221,4 +280,215 @@ TEST(CrxVerifierTest, Crx3Unzip) {
   EXPECT_SUCCEEDED(omaha::DeleteDirectory(to_dir));
 }
 
+TEST(CrxVerifierTest, Crx3UnzipParallel) {
+  const CPath expected_dir(omaha::GetUniqueTempDirectoryName());
+  EXPECT_TRUE(Crx3Unzip(TestFileCPath(_T("CodeRed.crx3")), expected_dir));
+  const CString expected_exe(
+      ConcatenatePath(expected_dir, _T("GoogleUpdateSetup.exe")));
+
+  // The files are the same whatever the number of threads.
+  const int kThreads[] = {0, 1, 2, ZipParallelExtractor::kMaxThreads + 1};
+  for (size_t i = 0; i != arraysize(kThreads); ++i) {
+    const CPath to_dir(omaha::GetUniqueTempDirectoryName());
+    EXPECT_TRUE(Crx3UnzipParallel(TestFileCPath(_T("CodeRed.crx3")),
+                                  to_dir,
+                                  kThreads[i]));
+    EXPECT_TRUE(omaha::File::AreFilesIdentical(
+        expected_exe,
+        ConcatenatePath(to_dir, _T("GoogleUpdateSetup.exe"))));
+    EXPECT_SUCCEEDED(omaha::DeleteDirectory(to_dir));
+  }
+
+  const CPath to_dir(omaha::GetUniqueTempDirectoryName());
+  EXPECT_TRUE(Crx3UnzipParallel(TestFileCPath(_T("valid_publisher.crx3")),
+                                to_dir,
+                                0));
+  EXPECT_TRUE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("manifest.json"))));
+  EXPECT_TRUE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("_metadata\\verified_contents.json"))));
+  EXPECT_TRUE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("_platform_specific\\all\\sths\\0301")
+      _T("9df3fd85a69a8ebd1facc6da9ba73e469774fe77f579fc5a08b8328c1d6b.sth"))));
+
+  EXPECT_SUCCEEDED(omaha::DeleteDirectory(to_dir));
+  EXPECT_SUCCEEDED(omaha::DeleteDirectory(expected_dir));
+}
+
+TEST(CrxVerifierTest, Crx3UnzipParallel_NotACrx) {
+  const CPath to_dir(omaha::GetUniqueTempDirectoryName());
+  EXPECT_FALSE(Crx3UnzipParallel(TestFileCPath(_T("valid.crx2")), to_dir, 0));
+  EXPECT_FALSE(Crx3UnzipParallel(TestFileCPath(_T("no_such_file.crx3")),
+                                 to_dir,
+                                 0));
+  omaha::DeleteDirectory(to_dir);
+}
+
+TEST(CrxVerifierTest, VerifyAndUnzip) {
+  const std::vector<uint8_t> hash;
+  const std::vector<std::vector<uint8_t>> keys;
+  const CPath to_dir(omaha::GetUniqueTempDirectoryName());
+  std::string public_key = "UNSET";
+  std::string crx_id = "UNSET";
+  EXPECT_EQ(VerifierResult::OK_FULL,
+            VerifyAndUnzip(TestFileCPath(_T("valid_publisher.crx3")),
+                           VerifierFormat::CRX3_WITH_PUBLISHER_PROOF, keys,
+                           hash, to_dir, &public_key, &crx_id));
+  EXPECT_EQ(std::string(kOjjHash), crx_id);
+  EXPECT_EQ(std::string(kOjjKey), public_key);
+
+  EXPECT_TRUE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("manifest.json"))));
+  EXPECT_TRUE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("_metadata\\verified_contents.json"))));
+  EXPECT_TRUE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("_platform_specific\\all\\sths\\0301")
+      _T("9df3fd85a69a8ebd1facc6da9ba73e469774fe77f579fc5a08b8328c1d6b.sth"))));
+  EXPECT_FALSE(HasStagingDirectory(to_dir));
+
+  EXPECT_SUCCEEDED(omaha::DeleteDirectory(to_dir));
+}
+
+TEST(CrxVerifierTest, VerifyAndUnzip_Unsigned) {
+  const std::vector<uint8_t> hash;
+  const std::vector<std::vector<uint8_t>> keys;
+  const CPath to_dir(omaha::GetUniqueTempDirectoryName());
+  std::string public_key = "UNSET";
+  std::string crx_id = "UNSET";
+  EXPECT_EQ(VerifierResult::ERROR_REQUIRED_PROOF_MISSING,
+            VerifyAndUnzip(TestFileCPath(_T("unsigned.crx3")),
+                           VerifierFormat::CRX2_OR_CRX3, keys, hash, to_dir,
+                           &public_key, &crx_id));
+  EXPECT_EQ("UNSET", crx_id);
+  EXPECT_EQ("UNSET", public_key);
+
+  EXPECT_FALSE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("manifest.json"))));
+  EXPECT_FALSE(HasStagingDirectory(to_dir));
+
+  EXPECT_SUCCEEDED(omaha::DeleteDirectory(to_dir));
+}
+
+// The archive has a stored entry followed by a data descriptor, which can't be
+// unzipped from its local header alone. The file still verifies, and
+// Crx3Unzip reads the entry from the central directory.
+TEST(CrxVerifierTest, VerifyAndUnzip_StoredDataDescriptor) {
+  const CPath crx_path(TestFileCPath(_T("stored_data_descriptor.crx3")));
+  const std::vector<uint8_t> hash;
+  const std::vector<std::vector<uint8_t>> keys;
+  const CPath to_dir(omaha::GetUniqueTempDirectoryName());
+  std::string crx_id = "UNSET";
+  EXPECT_EQ(VerifierResult::ERROR_UNPACK_FAILED,
+            VerifyAndUnzip(crx_path, VerifierFormat::CRX3, keys, hash, to_dir,
+                           nullptr, &crx_id));
+  EXPECT_EQ("UNSET", crx_id);
+  EXPECT_FALSE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("GoogleUpdateSetup.exe"))));
+  EXPECT_FALSE(HasStagingDirectory(to_dir));
+
+  EXPECT_TRUE(Crx3Unzip(crx_path, to_dir));
+  EXPECT_TRUE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("GoogleUpdateSetup.exe"))));
+  EXPECT_TRUE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("manifest.json"))));
+
+  EXPECT_SUCCEEDED(omaha::DeleteDirectory(to_dir));
+}
+
+// Nothing is committed if one of the top level names is already in the
+// directory.
+TEST(CrxVerifierTest, VerifyAndUnzip_ExistingDirectory) {
+  const std::vector<uint8_t> hash;
+  const std::vector<std::vector<uint8_t>> keys;
+  const CPath to_dir(omaha::GetUniqueTempDirectoryName());
+  ASSERT_SUCCEEDED(omaha::CreateDir(ConcatenatePath(to_dir, _T("_metadata")),
+                                    NULL));
+  EXPECT_EQ(VerifierResult::ERROR_UNPACK_FAILED,
+            VerifyAndUnzip(TestFileCPath(_T("valid_publisher.crx3")),
+                           VerifierFormat::CRX3_WITH_PUBLISHER_PROOF, keys,
+                           hash, to_dir, nullptr, nullptr));
+
+  EXPECT_FALSE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("manifest.json"))));
+  EXPECT_FALSE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("_metadata\\verified_contents.json"))));
+  EXPECT_FALSE(HasStagingDirectory(to_dir));
+
+  EXPECT_SUCCEEDED(omaha::DeleteDirectory(to_dir));
+}
+
+TEST(CrxVerifierTest, VerifyAndUnzip_Tampered) {
+  std::vector<byte> crx;
+  ASSERT_SUCCEEDED(omaha::ReadEntireFile(
+      TestFileCPath(_T("valid_publisher.crx3")), 0, &crx));
+  ASSERT_FALSE(crx.empty());
+
+  // The last byte belongs to the end of central directory record. Every entry
+  // is extracted before it is read, and the signature check then fails.
+  crx.back() ^= 0x01;
+  const CString tampered_crx(
+      ConcatenatePath(omaha::app_util::GetTempDir(), _T("tampered.crx3")));
+  ASSERT_SUCCEEDED(omaha::WriteEntireFile(tampered_crx, crx));
+
+  const std::vector<uint8_t> hash;
+  const std::vector<std::vector<uint8_t>> keys;
+  const CPath to_dir(omaha::GetUniqueTempDirectoryName());
+  EXPECT_EQ(VerifierResult::ERROR_SIGNATURE_VERIFICATION_FAILED,
+            VerifyAndUnzip(CPath(tampered_crx),
+                           VerifierFormat::CRX3_WITH_PUBLISHER_PROOF, keys,
+                           hash, to_dir, nullptr, nullptr));
+
+  EXPECT_FALSE(omaha::File::Exists(
+      ConcatenatePath(to_dir, _T("manifest.json"))));
+  EXPECT_FALSE(HasStagingDirectory(to_dir));
+
+  EXPECT_SUCCEEDED(omaha::DeleteDirectory(to_dir));
+  EXPECT_TRUE(::DeleteFile(tampered_crx));
+}
+
+TEST(ZipStreamExtractorTest, OverwritesExistingFile) {
+  const CString to_dir(omaha::GetUniqueTempDirectoryName());
+  ASSERT_SUCCEEDED(omaha::CreateDir(to_dir, NULL));
+  const CString path(ConcatenatePath(to_dir, _T("a.txt")));
+  const std::vector<byte> existing(100, 'x');
+  ASSERT_SUCCEEDED(omaha::WriteEntireFile(path, existing));
+
+  std::string zip;
+  AppendStoredEntry("a.txt", "short", &zip);
+  AppendUInt32(0x06054b50, &zip);
+  EXPECT_TRUE(ExtractZip(zip, to_dir));
+  EXPECT_EQ("short", ReadFileToString(path));
+
+  EXPECT_SUCCEEDED(omaha::DeleteDirectory(to_dir));
+}
+
+TEST(ZipStreamExtractorTest, RejectsDuplicateEntries) {
+  const CString to_dir(omaha::GetUniqueTempDirectoryName());
+  ASSERT_SUCCEEDED(omaha::CreateDir(to_dir, NULL));
+
+  std::string zip;
+  AppendStoredEntry("dir/a.txt", "first", &zip);
+  AppendStoredEntry("dir/b.txt", "second", &zip);
+  std::string end;
+  AppendUInt32(0x06054b50, &end);
+  EXPECT_TRUE(ExtractZip(zip + end, to_dir));
+
+  std::string duplicate(zip);
+  AppendStoredEntry("dir/a.txt", "third", &duplicate);
+  EXPECT_FALSE(ExtractZip(duplicate + end, to_dir));
+
+  std::string case_duplicate(zip);
+  AppendStoredEntry("DIR/A.TXT", "third", &case_duplicate);
+  EXPECT_FALSE(ExtractZip(case_duplicate + end, to_dir));
+
+  std::string directory_duplicate(zip);
+  AppendStoredEntry("dir/b.txt/", "", &directory_duplicate);
+  EXPECT_FALSE(ExtractZip(directory_duplicate + end, to_dir));
+
+  EXPECT_EQ("first",
+            ReadFileToString(ConcatenatePath(to_dir, _T("dir\\a.txt"))));
+
+  EXPECT_SUCCEEDED(omaha::DeleteDirectory(to_dir));
+}
+
 }  // namespace crx_file
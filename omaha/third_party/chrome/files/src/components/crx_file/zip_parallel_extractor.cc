@@ -0,0 +1,501 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "components/crx_file/zip_parallel_extractor.h"
+
+#include <algorithm>
+#include <memory>
+#include <set>
+
+#include "components/crx_file/zip_stream_extractor.h"
+#include "omaha/base/debug.h"
+#include "omaha/base/path.h"
+#include "omaha/base/utils.h"
+#include "omaha/third_party/smartany/scoped_any.h"
+#include "zlib.h"
+
+namespace crx_file {
+
+namespace {
+
+const uint32_t kLocalHeaderSignature = 0x04034b50;
+const uint32_t kCentralHeaderSignature = 0x02014b50;
+const uint32_t kEndOfCentralDirectorySignature = 0x06054b50;
+const uint32_t kZip64EndOfCentralDirectorySignature = 0x06064b50;
+const uint32_t kZip64EndOfCentralDirectoryLocatorSignature = 0x07064b50;
+
+// The sizes of the fixed parts of the records, signatures included.
+const size_t kLocalHeaderSize = 30;
+const size_t kCentralHeaderSize = 46;
+const size_t kEndOfCentralDirectorySize = 22;
+const size_t kZip64EndOfCentralDirectorySize = 56;
+const size_t kZip64EndOfCentralDirectoryLocatorSize = 20;
+const size_t kMaxCommentSize = 0xffff;
+
+const uint16_t kFlagEncrypted = 1 << 0;
+const uint16_t kFlagUtf8 = 1 << 11;
+
+const uint16_t kMethodStored = 0;
+const uint16_t kMethodDeflated = 8;
+
+const uint16_t kZip64ExtraFieldId = 0x0001;
+const uint16_t kZip64Marker16 = 0xffff;
+const uint32_t kZip64Marker32 = 0xffffffff;
+
+// Each thread inflates into a buffer this size, and stored data is written in
+// pieces of at most this size.
+const size_t kBufferSize = 1 << 16;
+
+// zlib takes its input in pieces which have their size in a uInt.
+const uint64_t kMaxInflateInput = 1 << 30;
+
+uint16_t GetUInt16(const uint8_t* p) {
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t GetUInt32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) |
+         (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint64_t GetUInt64(const uint8_t* p) {
+  return GetUInt32(p) | (static_cast<uint64_t>(GetUInt32(p + 4)) << 32);
+}
+
+// Replaces the |value| of a field marked as being in the zip64 extra field
+// |*field| with the next value there. Returns false if the extra field is too
+// short.
+bool ReadZip64Field(uint64_t* value,
+                    const uint8_t** field,
+                    const uint8_t* field_end) {
+  if (*value != kZip64Marker32) {
+    return true;
+  }
+  if (static_cast<size_t>(field_end - *field) < sizeof(uint64_t)) {
+    return false;
+  }
+  *value = GetUInt64(*field);
+  *field += sizeof(uint64_t);
+  return true;
+}
+
+bool PreallocateFile(HANDLE file, uint64_t size) {
+  LARGE_INTEGER position = {};
+  position.QuadPart = static_cast<LONGLONG>(size);
+  if (!::SetFilePointerEx(file, position, NULL, FILE_BEGIN) ||
+      !::SetEndOfFile(file)) {
+    return false;
+  }
+  position.QuadPart = 0;
+  return !!::SetFilePointerEx(file, position, NULL, FILE_BEGIN);
+}
+
+bool WriteData(HANDLE file, const uint8_t* data, size_t size) {
+  DWORD bytes_written = 0;
+  return !size ||
+         (::WriteFile(file,
+                      data,
+                      static_cast<DWORD>(size),
+                      &bytes_written,
+                      NULL) &&
+          bytes_written == size);
+}
+
+}  // namespace
+
+ZipParallelExtractor::Entry::Entry()
+    : is_directory(false),
+      method(0),
+      crc(0),
+      compressed_size(0),
+      size(0),
+      local_header_offset(0),
+      data(NULL) {
+}
+
+ZipParallelExtractor::ZipParallelExtractor(const uint8_t* archive, size_t size)
+    : archive_(archive),
+      size_(size),
+      next_file_(0),
+      failed_(false) {
+}
+
+ZipParallelExtractor::~ZipParallelExtractor() {
+}
+
+bool ZipParallelExtractor::Init() {
+  uint64_t offset = 0;
+  uint64_t size = 0;
+  uint64_t num_entries = 0;
+  if (!FindCentralDirectory(&offset, &size, &num_entries) ||
+      !ReadCentralDirectory(offset, size, num_entries)) {
+    return false;
+  }
+
+  // Two entries with the same path would make the result depend on which
+  // thread finishes last. The file system is not case sensitive.
+  std::set<CString> paths;
+  for (size_t i = 0; i != entries_.size(); ++i) {
+    if (!FindEntryData(&entries_[i])) {
+      return false;
+    }
+    CString path(entries_[i].path);
+    path.TrimRight(_T('\\'));
+    path.MakeLower();
+    if (!paths.insert(path).second) {
+      return false;
+    }
+    if (!entries_[i].is_directory) {
+      files_.push_back(i);
+    }
+  }
+
+  std::stable_sort(files_.begin(),
+                   files_.end(),
+                   [this](size_t a, size_t b) {
+                     return entries_[a].compressed_size >
+                            entries_[b].compressed_size;
+                   });
+  return true;
+}
+
+bool ZipParallelExtractor::FindCentralDirectory(uint64_t* offset,
+                                                uint64_t* size,
+                                                uint64_t* num_entries) const {
+  ASSERT1(offset);
+  ASSERT1(size);
+  ASSERT1(num_entries);
+  if (size_ < kEndOfCentralDirectorySize) {
+    return false;
+  }
+
+  // The end of central directory record is followed by a comment of up to
+  // 64 KB, so it is looked for backwards from the end of the archive.
+  const uint8_t* const lowest = archive_ + size_ -
+      std::min(size_, kEndOfCentralDirectorySize + kMaxCommentSize);
+  const uint8_t* end = archive_ + size_ - kEndOfCentralDirectorySize;
+  while (GetUInt32(end) != kEndOfCentralDirectorySignature ||
+         end + kEndOfCentralDirectorySize + GetUInt16(end + 20) !=
+             archive_ + size_) {
+    if (end == lowest) {
+      return false;
+    }
+    --end;
+  }
+
+  // Archives that span several disks are not supported.
+  if (GetUInt16(end + 4) || GetUInt16(end + 6)) {
+    return false;
+  }
+  *num_entries = GetUInt16(end + 10);
+  *size = GetUInt32(end + 12);
+  *offset = GetUInt32(end + 16);
+  if (*num_entries != kZip64Marker16 &&
+      *size != kZip64Marker32 &&
+      *offset != kZip64Marker32) {
+    return *offset <= size_ && *size <= size_ - *offset;
+  }
+
+  // The zip64 end of central directory record is found through the locator
+  // in front of the end of central directory record.
+  const size_t end_offset = end - archive_;
+  if (end_offset < kZip64EndOfCentralDirectoryLocatorSize) {
+    return false;
+  }
+  const uint8_t* locator = end - kZip64EndOfCentralDirectoryLocatorSize;
+  if (GetUInt32(locator) != kZip64EndOfCentralDirectoryLocatorSignature) {
+    return false;
+  }
+  const uint64_t zip64_end_offset = GetUInt64(locator + 8);
+  if (zip64_end_offset > size_ ||
+      size_ - zip64_end_offset < kZip64EndOfCentralDirectorySize) {
+    return false;
+  }
+  const uint8_t* zip64_end = archive_ + zip64_end_offset;
+  if (GetUInt32(zip64_end) != kZip64EndOfCentralDirectorySignature ||
+      GetUInt32(zip64_end + 16) || GetUInt32(zip64_end + 20)) {
+    return false;
+  }
+  *num_entries = GetUInt64(zip64_end + 32);
+  *size = GetUInt64(zip64_end + 40);
+  *offset = GetUInt64(zip64_end + 48);
+  return *offset <= size_ && *size <= size_ - *offset;
+}
+
+bool ZipParallelExtractor::ReadCentralDirectory(uint64_t offset,
+                                                uint64_t size,
+                                                uint64_t num_entries) {
+  if (num_entries > size / kCentralHeaderSize) {
+    return false;
+  }
+  entries_.resize(static_cast<size_t>(num_entries));
+
+  const uint8_t* header = archive_ + offset;
+  const uint8_t* const end = header + size;
+  for (size_t i = 0; i != entries_.size(); ++i) {
+    if (static_cast<size_t>(end - header) < kCentralHeaderSize ||
+        GetUInt32(header) != kCentralHeaderSignature) {
+      return false;
+    }
+    const uint16_t flags = GetUInt16(header + 8);
+    const size_t name_length = GetUInt16(header + 28);
+    const size_t extra_length = GetUInt16(header + 30);
+    const size_t comment_length = GetUInt16(header + 32);
+    const size_t header_size =
+        kCentralHeaderSize + name_length + extra_length + comment_length;
+    if (static_cast<size_t>(end - header) < header_size) {
+      return false;
+    }
+
+    Entry& entry = entries_[i];
+    entry.method = GetUInt16(header + 10);
+    entry.crc = GetUInt32(header + 16);
+    entry.compressed_size = GetUInt32(header + 20);
+    entry.size = GetUInt32(header + 24);
+    entry.local_header_offset = GetUInt32(header + 42);
+    if ((flags & kFlagEncrypted) ||
+        (entry.method != kMethodStored && entry.method != kMethodDeflated)) {
+      return false;
+    }
+
+    const CStringA name(reinterpret_cast<const char*>(header) +
+                            kCentralHeaderSize,
+                        static_cast<int>(name_length));
+    if (!ToSafeEntryPath(name, !!(flags & kFlagUtf8), &entry.path)) {
+      return false;
+    }
+    entry.is_directory =
+        entry.path[entry.path.GetLength() - 1] == _T('\\');
+
+    // The sizes and offset too large for their fields are in the zip64
+    // extra field, in this order.
+    const uint8_t* extra = header + kCentralHeaderSize + name_length;
+    const uint8_t* const extra_end = extra + extra_length;
+    while (extra_end - extra >= 4) {
+      const uint16_t id = GetUInt16(extra);
+      const size_t length = GetUInt16(extra + 2);
+      extra += 4;
+      if (static_cast<size_t>(extra_end - extra) < length) {
+        return false;
+      }
+      if (id == kZip64ExtraFieldId) {
+        const uint8_t* field = extra;
+        if (!ReadZip64Field(&entry.size, &field, extra + length) ||
+            !ReadZip64Field(&entry.compressed_size, &field, extra + length) ||
+            !ReadZip64Field(&entry.local_header_offset,
+                            &field,
+                            extra + length)) {
+          return false;
+        }
+      }
+      extra += length;
+    }
+
+    header += header_size;
+  }
+  return true;
+}
+
+bool ZipParallelExtractor::FindEntryData(Entry* entry) const {
+  ASSERT1(entry);
+  const uint64_t offset = entry->local_header_offset;
+  if (offset > size_ || size_ - offset < kLocalHeaderSize) {
+    return false;
+  }
+  const uint8_t* header = archive_ + offset;
+  if (GetUInt32(header) != kLocalHeaderSignature) {
+    return false;
+  }
+  const uint64_t data_offset =
+      offset + kLocalHeaderSize + GetUInt16(header + 26) +
+      GetUInt16(header + 28);
+  if (data_offset > size_ || size_ - data_offset < entry->compressed_size) {
+    return false;
+  }
+  if (entry->method == kMethodStored &&
+      entry->compressed_size != entry->size) {
+    return false;
+  }
+  entry->data = archive_ + data_offset;
+  return true;
+}
+
+bool ZipParallelExtractor::Extract(const CString& to_dir, int max_threads) {
+  to_dir_ = to_dir;
+  next_file_ = 0;
+  failed_ = false;
+
+  // The directories are all created first, in the order of the archive, so
+  // that the threads only ever create files.
+  std::set<CString> directories;
+  directories.insert(to_dir_);
+  if (FAILED(omaha::CreateDir(to_dir_, NULL))) {
+    return false;
+  }
+  for (size_t i = 0; i != entries_.size(); ++i) {
+    CString path(entries_[i].path);
+    path.TrimRight(_T('\\'));
+    path = omaha::ConcatenatePath(to_dir_, path);
+    if (path.IsEmpty()) {
+      return false;
+    }
+    const CString directory(entries_[i].is_directory ?
+                            path :
+                            omaha::GetDirectoryFromPath(path));
+    if (directories.insert(directory).second &&
+        FAILED(omaha::CreateDir(directory, NULL))) {
+      return false;
+    }
+  }
+
+  int num_threads = max_threads;
+  if (num_threads <= 0) {
+    SYSTEM_INFO system_info = {};
+    ::GetSystemInfo(&system_info);
+    num_threads = static_cast<int>(system_info.dwNumberOfProcessors);
+  }
+  if (num_threads > kMaxThreads) {
+    num_threads = kMaxThreads;
+  }
+  if (static_cast<size_t>(num_threads) > files_.size()) {
+    num_threads = static_cast<int>(files_.size());
+  }
+
+  std::vector<HANDLE> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    HANDLE thread = ::CreateThread(NULL, 0, &ThreadProc, this, 0, NULL);
+    if (!thread) {
+      break;
+    }
+    threads.push_back(thread);
+  }
+
+  ExtractEntries();
+
+  for (size_t i = 0; i != threads.size(); ++i) {
+    ::WaitForSingleObject(threads[i], INFINITE);
+    ::CloseHandle(threads[i]);
+  }
+  return !failed_;
+}
+
+DWORD WINAPI ZipParallelExtractor::ThreadProc(void* param) {
+  static_cast<ZipParallelExtractor*>(param)->ExtractEntries();
+  return 0;
+}
+
+void ZipParallelExtractor::ExtractEntries() {
+  z_stream stream = {};
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+    ::InterlockedExchange(&failed_, true);
+    return;
+  }
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[kBufferSize]);
+
+  while (!failed_) {
+    const LONG i = ::InterlockedIncrement(&next_file_) - 1;
+    if (static_cast<size_t>(i) >= files_.size()) {
+      break;
+    }
+    const Entry& entry = entries_[files_[i]];
+    if (!ExtractEntry(entry,
+                      omaha::ConcatenatePath(to_dir_, entry.path),
+                      &stream,
+                      buffer.get())) {
+      ::InterlockedExchange(&failed_, true);
+    }
+  }
+
+  inflateEnd(&stream);
+}
+
+bool ZipParallelExtractor::ExtractEntry(const Entry& entry,
+                                        const CString& path,
+                                        z_stream_s* stream,
+                                        uint8_t* buffer) const {
+  ASSERT1(stream);
+  ASSERT1(buffer);
+  scoped_hfile file(::CreateFile(path,
+                                 GENERIC_WRITE,
+                                 0,
+                                 NULL,
+                                 CREATE_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL,
+                                 NULL));
+  if (!valid(file)) {
+    return false;
+  }
+  if (entry.size && !PreallocateFile(get(file), entry.size)) {
+    return false;
+  }
+
+  uLong crc = crc32(0, NULL, 0);
+  if (entry.method == kMethodStored) {
+    for (uint64_t offset = 0; offset != entry.size;) {
+      const size_t size = static_cast<size_t>(
+          std::min<uint64_t>(entry.size - offset, kBufferSize));
+      crc = crc32(crc, entry.data + offset, static_cast<uInt>(size));
+      if (!WriteData(get(file), entry.data + offset, size)) {
+        return false;
+      }
+      offset += size;
+    }
+    return crc == entry.crc;
+  }
+
+  if (inflateReset(stream) != Z_OK) {
+    return false;
+  }
+  const uint8_t* input = entry.data;
+  uint64_t input_left = entry.compressed_size;
+  uint64_t size = 0;
+  int result = Z_OK;
+  while (result != Z_STREAM_END) {
+    if (!stream->avail_in && input_left) {
+      const uint64_t input_size = std::min(input_left, kMaxInflateInput);
+      stream->next_in = const_cast<Bytef*>(input);
+      stream->avail_in = static_cast<uInt>(input_size);
+      input += input_size;
+      input_left -= input_size;
+    }
+    stream->next_out = buffer;
+    stream->avail_out = static_cast<uInt>(kBufferSize);
+
+    // With no input left and no output pending, Z_BUF_ERROR means that the
+    // deflate stream is truncated.
+    result = inflate(stream, Z_NO_FLUSH);
+    if (result != Z_OK && result != Z_STREAM_END) {
+      return false;
+    }
+    const size_t inflated_size = kBufferSize - stream->avail_out;
+    if (inflated_size > entry.size - size) {
+      return false;
+    }
+    crc = crc32(crc, buffer, static_cast<uInt>(inflated_size));
+    if (!WriteData(get(file), buffer, inflated_size)) {
+      return false;
+    }
+    size += inflated_size;
+  }
+
+  return !input_left &&
+         !stream->avail_in &&
+         size == entry.size &&
+         crc == entry.crc;
+}
+
+}  // namespace crx_file
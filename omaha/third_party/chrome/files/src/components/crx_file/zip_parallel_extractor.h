@@ -0,0 +1,108 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Extracts a ZIP archive held in memory, usually a mapped file, inflating its
+// entries on several threads. The central directory is read once, up front;
+// the entries are independent of each other, so each thread takes the next
+// one that is left and inflates it with its own zlib stream.
+//
+// The same kind of archives as ZipStreamExtractor supports are supported:
+// stored or deflated entries and no encryption. Since the sizes come from the
+// central directory, data descriptors are not an issue here.
+
+#ifndef OMAHA_THIRD_PARTY_CHROME_FILES_SRC_COMPONENTS_CRX_FILE_ZIP_PARALLEL_EXTRACTOR_H_
+#define OMAHA_THIRD_PARTY_CHROME_FILES_SRC_COMPONENTS_CRX_FILE_ZIP_PARALLEL_EXTRACTOR_H_
+
+#include <windows.h>
+#include <atlstr.h>
+#include <stdint.h>
+#include <vector>
+
+#include "base/basictypes.h"
+
+struct z_stream_s;
+
+namespace crx_file {
+
+class ZipParallelExtractor {
+ public:
+  // No more threads than this are used, whatever the number of processors.
+  static const int kMaxThreads = 8;
+
+  // |archive| holds the |size| bytes of the archive, and must stay valid for
+  // the lifetime of the extractor.
+  ZipParallelExtractor(const uint8_t* archive, size_t size);
+  ~ZipParallelExtractor();
+
+  // Reads the central directory. Returns false if the archive is malformed,
+  // uses a feature that is not supported, or has an entry which would be
+  // written outside of the directory it is extracted to, or twice.
+  bool Init();
+
+  // Extracts the archive under |to_dir| on up to |max_threads| threads, 0
+  // meaning one per processor. Each file is preallocated to its size and has
+  // its CRC-32 checked. The files written do not depend on the number of
+  // threads. Returns false if any entry fails; the files extracted so far
+  // are left in place.
+  bool Extract(const CString& to_dir, int max_threads);
+
+ private:
+  struct Entry {
+    Entry();
+
+    CString path;
+    bool is_directory;
+    uint16_t method;
+    uint32_t crc;
+    uint64_t compressed_size;
+    uint64_t size;
+    uint64_t local_header_offset;
+    const uint8_t* data;
+  };
+
+  bool FindCentralDirectory(uint64_t* offset,
+                            uint64_t* size,
+                            uint64_t* num_entries) const;
+  bool ReadCentralDirectory(uint64_t offset,
+                            uint64_t size,
+                            uint64_t num_entries);
+  bool FindEntryData(Entry* entry) const;
+
+  static DWORD WINAPI ThreadProc(void* param);
+  void ExtractEntries();
+  bool ExtractEntry(const Entry& entry,
+                    const CString& path,
+                    z_stream_s* stream,
+                    uint8_t* buffer) const;
+
+  const uint8_t* const archive_;
+  const size_t size_;
+
+  std::vector<Entry> entries_;
+
+  // The files to extract, largest first, so that a large file found late does
+  // not leave the other threads idle at the end.
+  std::vector<size_t> files_;
+
+  CString to_dir_;
+  volatile LONG next_file_;
+  volatile LONG failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(ZipParallelExtractor);
+};
+
+}  // namespace crx_file
+
+#endif  // OMAHA_THIRD_PARTY_CHROME_FILES_SRC_COMPONENTS_CRX_FILE_ZIP_PARALLEL_EXTRACTOR_H_
@@ -0,0 +1,456 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+
+#include "components/crx_file/zip_stream_extractor.h"
+
+#include <string.h>
+
+#include "omaha/base/debug.h"
+#include "omaha/base/path.h"
+#include "omaha/base/string.h"
+#include "omaha/base/utils.h"
+#include "zlib.h"
+
+namespace crx_file {
+
+namespace {
+
+const uint32_t kLocalHeaderSignature = 0x04034b50;
+const uint32_t kCentralHeaderSignature = 0x02014b50;
+const uint32_t kEndOfCentralDirectorySignature = 0x06054b50;
+const uint32_t kDataDescriptorSignature = 0x08074b50;
+
+// The local file header, after its signature.
+const size_t kLocalHeaderSize = 26;
+
+const uint16_t kFlagEncrypted = 1 << 0;
+const uint16_t kFlagDataDescriptor = 1 << 3;
+const uint16_t kFlagUtf8 = 1 << 11;
+
+const uint16_t kMethodStored = 0;
+const uint16_t kMethodDeflated = 8;
+
+const uint16_t kZip64ExtraFieldId = 0x0001;
+const uint32_t kZip64SizeMarker = 0xffffffff;
+
+const size_t kInflatedBufferSize = 1 << 16;
+
+uint16_t GetUInt16(const uint8_t* p) {
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t GetUInt32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) |
+         (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint64_t GetUInt64(const uint8_t* p) {
+  return GetUInt32(p) | (static_cast<uint64_t>(GetUInt32(p + 4)) << 32);
+}
+
+// Returns true if |name| stays under the directory it is extracted to: it is
+// relative, has no drive or stream, and no "." or ".." component.
+bool IsSafeEntryName(const CString& name) {
+  if (name.IsEmpty() || name[0] == _T('\\') || name.Find(_T(':')) != -1) {
+    return false;
+  }
+  int start = 0;
+  while (start < name.GetLength()) {
+    int end = name.Find(_T('\\'), start);
+    if (end == -1) {
+      end = name.GetLength();
+    }
+    const CString component(name.Mid(start, end - start));
+    if (component.IsEmpty() ||
+        component == _T(".") ||
+        component == _T("..")) {
+      return false;
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool ToSafeEntryPath(const CStringA& name, bool is_utf8, CString* path) {
+  ASSERT1(path);
+  CString entry_path(is_utf8 ?
+      omaha::Utf8ToWideChar(name, static_cast<uint32>(name.GetLength())) :
+      CString(name));
+  entry_path.Replace(_T('/'), _T('\\'));
+  if (!IsSafeEntryName(entry_path)) {
+    return false;
+  }
+  *path = entry_path;
+  return true;
+}
+
+ZipStreamExtractor::ZipStreamExtractor(const CString& to_dir)
+    : to_dir_(to_dir),
+      state_(STATE_SIGNATURE),
+      field_size_(sizeof(uint32_t)),
+      flags_(0),
+      method_(0),
+      name_length_(0),
+      expected_crc_(0),
+      expected_compressed_size_(0),
+      expected_size_(0),
+      is_zip64_(false),
+      crc_(0),
+      compressed_size_(0),
+      size_(0),
+      is_directory_(false) {
+}
+
+ZipStreamExtractor::~ZipStreamExtractor() {
+  if (zstream_.get()) {
+    inflateEnd(zstream_.get());
+  }
+}
+
+bool ZipStreamExtractor::Write(const uint8_t* data, size_t size) {
+  while (size && state_ != STATE_ERROR) {
+    size_t used = 0;
+    bool succeeded = true;
+    switch (state_) {
+      case STATE_SIGNATURE:
+      case STATE_LOCAL_HEADER:
+      case STATE_NAME_AND_EXTRA:
+      case STATE_DESCRIPTOR_START:
+      case STATE_DESCRIPTOR:
+        used = FillField(data, size);
+        if (field_.size() == field_size_) {
+          switch (state_) {
+            case STATE_SIGNATURE:
+              succeeded = OnSignature();
+              break;
+            case STATE_LOCAL_HEADER:
+              succeeded = OnLocalHeader();
+              break;
+            case STATE_NAME_AND_EXTRA:
+              succeeded = OnNameAndExtra();
+              break;
+            case STATE_DESCRIPTOR_START:
+              succeeded = OnDescriptorStart();
+              break;
+            default:
+              succeeded = OnDescriptor();
+              break;
+          }
+        }
+        break;
+
+      case STATE_STORED_DATA:
+        used = size;
+        if (used > expected_size_ - size_) {
+          used = static_cast<size_t>(expected_size_ - size_);
+        }
+        compressed_size_ += used;
+        succeeded = WriteEntryData(data, used);
+        if (succeeded && size_ == expected_size_) {
+          succeeded = CloseEntry(expected_crc_,
+                                 expected_compressed_size_,
+                                 expected_size_);
+        }
+        break;
+
+      case STATE_DEFLATED_DATA:
+        succeeded = InflateEntryData(data, size, &used);
+        break;
+
+      case STATE_CENTRAL_DIRECTORY:
+        // The central directory repeats what the local headers said.
+        return true;
+
+      default:
+        succeeded = false;
+        break;
+    }
+
+    if (!succeeded) {
+      state_ = STATE_ERROR;
+      break;
+    }
+    data += used;
+    size -= used;
+  }
+  return state_ != STATE_ERROR;
+}
+
+bool ZipStreamExtractor::Finish() {
+  return state_ == STATE_CENTRAL_DIRECTORY;
+}
+
+size_t ZipStreamExtractor::FillField(const uint8_t* data, size_t size) {
+  size_t used = field_size_ - field_.size();
+  if (used > size) {
+    used = size;
+  }
+  field_.insert(field_.end(), data, data + used);
+  return used;
+}
+
+void ZipStreamExtractor::ExpectField(State state, size_t field_size) {
+  state_ = state;
+  field_.clear();
+  field_size_ = field_size;
+}
+
+bool ZipStreamExtractor::OnSignature() {
+  const uint32_t signature = GetUInt32(&field_[0]);
+  if (signature == kCentralHeaderSignature ||
+      signature == kEndOfCentralDirectorySignature) {
+    state_ = STATE_CENTRAL_DIRECTORY;
+    return true;
+  }
+  if (signature != kLocalHeaderSignature) {
+    return false;
+  }
+  ExpectField(STATE_LOCAL_HEADER, kLocalHeaderSize);
+  return true;
+}
+
+bool ZipStreamExtractor::OnLocalHeader() {
+  const uint8_t* header = &field_[0];
+  flags_ = GetUInt16(header + 2);
+  method_ = GetUInt16(header + 4);
+  expected_crc_ = GetUInt32(header + 10);
+  expected_compressed_size_ = GetUInt32(header + 14);
+  expected_size_ = GetUInt32(header + 18);
+  is_zip64_ = false;
+  name_length_ = GetUInt16(header + 22);
+  const size_t extra_length = GetUInt16(header + 24);
+
+  if ((flags_ & kFlagEncrypted) ||
+      (method_ != kMethodStored && method_ != kMethodDeflated) ||
+      (method_ == kMethodStored && (flags_ & kFlagDataDescriptor)) ||
+      !name_length_) {
+    return false;
+  }
+  ExpectField(STATE_NAME_AND_EXTRA, name_length_ + extra_length);
+  return true;
+}
+
+bool ZipStreamExtractor::OnNameAndExtra() {
+  const CStringA name(reinterpret_cast<const char*>(&field_[0]),
+                      static_cast<int>(name_length_));
+
+  // A zip64 extra field holds the sizes that do not fit the local header.
+  const uint8_t* extra = &field_[0] + name_length_;
+  const uint8_t* extra_end = &field_[0] + field_size_;
+  while (extra_end - extra >= 4) {
+    const uint16_t id = GetUInt16(extra);
+    const size_t length = GetUInt16(extra + 2);
+    extra += 4;
+    if (length > static_cast<size_t>(extra_end - extra)) {
+      return false;
+    }
+    if (id == kZip64ExtraFieldId) {
+      is_zip64_ = true;
+      const uint8_t* value = extra;
+      const uint8_t* value_end = extra + length;
+      if (expected_size_ == kZip64SizeMarker) {
+        if (value_end - value < 8) {
+          return false;
+        }
+        expected_size_ = GetUInt64(value);
+        value += 8;
+      }
+      if (expected_compressed_size_ == kZip64SizeMarker) {
+        if (value_end - value < 8) {
+          return false;
+        }
+        expected_compressed_size_ = GetUInt64(value);
+      }
+    }
+    extra += length;
+  }
+
+  if (!OpenEntry(name, !!(flags_ & kFlagUtf8))) {
+    return false;
+  }
+
+  crc_ = crc32(0, Z_NULL, 0);
+  compressed_size_ = 0;
+  size_ = 0;
+  field_.clear();
+  if (method_ == kMethodStored) {
+    if (expected_size_ != expected_compressed_size_) {
+      return false;
+    }
+    if (!expected_size_) {
+      return CloseEntry(expected_crc_, 0, 0);
+    }
+    state_ = STATE_STORED_DATA;
+    return true;
+  }
+
+  if (!zstream_.get()) {
+    zstream_.reset(new z_stream);
+    memset(zstream_.get(), 0, sizeof(*zstream_));
+    if (inflateInit2(zstream_.get(), -MAX_WBITS) != Z_OK) {
+      zstream_.reset();
+      return false;
+    }
+    inflated_.reset(new uint8_t[kInflatedBufferSize]);
+  } else if (inflateReset(zstream_.get()) != Z_OK) {
+    return false;
+  }
+  state_ = STATE_DEFLATED_DATA;
+  return true;
+}
+
+bool ZipStreamExtractor::OnDescriptorStart() {
+  // The signature of the data descriptor is optional. Without it, the bytes
+  // read so far are the CRC-32.
+  const size_t sizes_length = is_zip64_ ? 16 : 8;
+  if (GetUInt32(&field_[0]) == kDataDescriptorSignature) {
+    ExpectField(STATE_DESCRIPTOR, sizeof(uint32_t) + sizes_length);
+  } else {
+    state_ = STATE_DESCRIPTOR;
+    field_size_ += sizes_length;
+  }
+  return true;
+}
+
+bool ZipStreamExtractor::OnDescriptor() {
+  const uint8_t* descriptor = &field_[0];
+  const uint32_t crc = GetUInt32(descriptor);
+  const uint64_t compressed_size =
+      is_zip64_ ? GetUInt64(descriptor + 4) : GetUInt32(descriptor + 4);
+  const uint64_t size =
+      is_zip64_ ? GetUInt64(descriptor + 12) : GetUInt32(descriptor + 8);
+  return CloseEntry(crc, compressed_size, size);
+}
+
+bool ZipStreamExtractor::OpenEntry(const CStringA& name, bool is_utf8) {
+  CString entry_name;
+  if (!ToSafeEntryPath(name, is_utf8, &entry_name)) {
+    return false;
+  }
+
+  // A second entry with the same path would overwrite the first one, as
+  // ZipParallelExtractor::Init() rejects it. The file system is not case
+  // sensitive.
+  CString lower_path(entry_name);
+  lower_path.TrimRight(_T('\\'));
+  lower_path.MakeLower();
+  if (!paths_.insert(lower_path).second) {
+    return false;
+  }
+
+  const int first_separator = entry_name.Find(_T('\\'));
+  top_level_names_.insert(first_separator == -1 ?
+                          entry_name :
+                          entry_name.Left(first_separator));
+
+  const CString path(omaha::ConcatenatePath(to_dir_, entry_name));
+  if (path.IsEmpty()) {
+    return false;
+  }
+  is_directory_ = entry_name[entry_name.GetLength() - 1] == _T('\\');
+  if (is_directory_) {
+    return SUCCEEDED(omaha::CreateDir(path, NULL));
+  }
+
+  const CString parent_dir(omaha::GetDirectoryFromPath(path));
+  if (FAILED(omaha::CreateDir(parent_dir, NULL))) {
+    return false;
+  }
+  reset(file_, ::CreateFile(path,
+                            GENERIC_WRITE,
+                            0,
+                            NULL,
+                            CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL,
+                            NULL));
+  return valid(file_);
+}
+
+bool ZipStreamExtractor::WriteEntryData(const uint8_t* data, size_t size) {
+  if (!size) {
+    return true;
+  }
+  if (is_directory_) {
+    return false;
+  }
+  crc_ = crc32(crc_, data, static_cast<uInt>(size));
+  size_ += size;
+  DWORD bytes_written = 0;
+  return ::WriteFile(get(file_),
+                     data,
+                     static_cast<DWORD>(size),
+                     &bytes_written,
+                     NULL) &&
+         bytes_written == size;
+}
+
+bool ZipStreamExtractor::InflateEntryData(const uint8_t* data,
+                                          size_t size,
+                                          size_t* used) {
+  ASSERT1(used);
+  z_stream* stream = zstream_.get();
+  stream->next_in = const_cast<Bytef*>(data);
+  stream->avail_in = static_cast<uInt>(size);
+
+  // Inflates until the input runs out or the entry ends. A full output buffer
+  // may leave more output pending in the stream even with no input left.
+  int result = Z_OK;
+  do {
+    stream->next_out = inflated_.get();
+    stream->avail_out = kInflatedBufferSize;
+    result = inflate(stream, Z_NO_FLUSH);
+    if (result == Z_BUF_ERROR) {
+      // No progress was possible, which is not an error.
+      result = Z_OK;
+    } else if (result != Z_OK && result != Z_STREAM_END) {
+      return false;
+    }
+    if (!WriteEntryData(inflated_.get(),
+                        kInflatedBufferSize - stream->avail_out)) {
+      return false;
+    }
+  } while (result != Z_STREAM_END && !stream->avail_out);
+
+  *used = size - stream->avail_in;
+  compressed_size_ += *used;
+  if (result != Z_STREAM_END) {
+    // Input that does not move the stream forward is garbage.
+    return *used != 0;
+  }
+  if (flags_ & kFlagDataDescriptor) {
+    ExpectField(STATE_DESCRIPTOR_START, sizeof(uint32_t));
+    return true;
+  }
+  return CloseEntry(expected_crc_, expected_compressed_size_, expected_size_);
+}
+
+bool ZipStreamExtractor::CloseEntry(uint32_t crc,
+                                    uint64_t compressed_size,
+                                    uint64_t size) {
+  if (!is_directory_ && !::CloseHandle(release(file_))) {
+    return false;
+  }
+  if (crc != crc_ || compressed_size != compressed_size_ || size != size_) {
+    return false;
+  }
+  ExpectField(STATE_SIGNATURE, sizeof(uint32_t));
+  return true;
+}
+
+}  // namespace crx_file
@@ -0,0 +1,130 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Extracts a ZIP archive while it is being read, from its local file headers,
+// without seeking to the central directory at its end. This lets a CRX be
+// verified and unpacked in a single pass over the file.
+//
+// Only the kind of archives the CRX tools write are supported: stored or
+// deflated entries, with or without data descriptors, and no encryption.
+// Stored entries must have their sizes in the local header, since there is
+// no other way to find where they end.
+
+#ifndef OMAHA_THIRD_PARTY_CHROME_FILES_SRC_COMPONENTS_CRX_FILE_ZIP_STREAM_EXTRACTOR_H_
+#define OMAHA_THIRD_PARTY_CHROME_FILES_SRC_COMPONENTS_CRX_FILE_ZIP_STREAM_EXTRACTOR_H_
+
+#include <atlstr.h>
+#include <stdint.h>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "omaha/third_party/smartany/scoped_any.h"
+
+struct z_stream_s;
+
+namespace crx_file {
+
+// Converts the |name| of a ZIP entry, which is UTF-8 if |is_utf8| is set, to a
+// path relative to the directory the entry is extracted to. Returns false if
+// the path would not stay under that directory. The path of a directory entry
+// ends with a backslash.
+bool ToSafeEntryPath(const CStringA& name, bool is_utf8, CString* path);
+
+class ZipStreamExtractor {
+ public:
+  // The entries are extracted under |to_dir|, which must exist.
+  explicit ZipStreamExtractor(const CString& to_dir);
+  ~ZipStreamExtractor();
+
+  // Extracts the next |size| bytes of the archive. Returns false if the
+  // archive is malformed, uses a feature that is not supported, or if an
+  // entry cannot be written. Once it has returned false, it keeps doing so.
+  bool Write(const uint8_t* data, size_t size);
+
+  // Returns true if all the entries of the archive have been extracted and
+  // have the CRC-32 and sizes recorded for them, and the central directory
+  // has been reached.
+  bool Finish();
+
+  // The first path component of each entry extracted, such as "manifest.json"
+  // or "_metadata".
+  const std::set<CString>& top_level_names() const {
+    return top_level_names_;
+  }
+
+ private:
+  enum State {
+    STATE_SIGNATURE,
+    STATE_LOCAL_HEADER,
+    STATE_NAME_AND_EXTRA,
+    STATE_STORED_DATA,
+    STATE_DEFLATED_DATA,
+    STATE_DESCRIPTOR_START,
+    STATE_DESCRIPTOR,
+    STATE_CENTRAL_DIRECTORY,
+    STATE_ERROR,
+  };
+
+  // Collects up to |field_size_| bytes of a header in |field_|. Returns the
+  // number of bytes used.
+  size_t FillField(const uint8_t* data, size_t size);
+  void ExpectField(State state, size_t field_size);
+
+  bool OnSignature();
+  bool OnLocalHeader();
+  bool OnNameAndExtra();
+  bool OnDescriptorStart();
+  bool OnDescriptor();
+
+  bool OpenEntry(const CStringA& name, bool is_utf8);
+  bool WriteEntryData(const uint8_t* data, size_t size);
+  bool InflateEntryData(const uint8_t* data, size_t size, size_t* used);
+  bool CloseEntry(uint32_t crc, uint64_t compressed_size, uint64_t size);
+
+  const CString to_dir_;
+  std::set<CString> top_level_names_;
+
+  // The lowercase paths of the entries extracted so far.
+  std::set<CString> paths_;
+
+  State state_;
+  std::vector<uint8_t> field_;
+  size_t field_size_;
+
+  // The entry being extracted.
+  uint16_t flags_;
+  uint16_t method_;
+  size_t name_length_;
+  uint32_t expected_crc_;
+  uint64_t expected_compressed_size_;
+  uint64_t expected_size_;
+  bool is_zip64_;
+  uint32_t crc_;
+  uint64_t compressed_size_;
+  uint64_t size_;
+  bool is_directory_;
+  scoped_hfile file_;
+
+  std::unique_ptr<z_stream_s> zstream_;
+  std::unique_ptr<uint8_t[]> inflated_;
+
+  DISALLOW_COPY_AND_ASSIGN(ZipStreamExtractor);
+};
+
+}  // namespace crx_file
+
+#endif  // OMAHA_THIRD_PARTY_CHROME_FILES_SRC_COMPONENTS_CRX_FILE_ZIP_STREAM_EXTRACTOR_H_
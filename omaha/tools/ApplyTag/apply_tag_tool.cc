@@ -14,24 +14,167 @@
 // ========================================================================
 //
 // The main file for a simple tool to apply a tag to a signed file.
+//
+// With -batch, the tool writes many tagged copies of the same file. Each line
+// of <tags_file> holds a tag and the output file for it, separated by a space:
+//
+//   appguid=...&appname=Foo&needsadmin=False out\Foo\en\FooSetup_en.exe
+//
+// The signed file is read once, and the outputs are written on one thread per
+// processor unless -threads says otherwise.
 #include <Windows.h>
 #include <TCHAR.h>
+#include <stdlib.h>
+#include <vector>
 #include "omaha/base/apply_tag.h"
 #include "omaha/base/file.h"
+#include "omaha/base/highres_timer-win32.h"
 #include "omaha/base/path.h"
 #include "omaha/base/utils.h"
 
+using omaha::ApplyTagBatch;
 using omaha::CreateDir;
 using omaha::ConcatenatePath;
 using omaha::File;
 using omaha::GetCurrentDir;
 using omaha::GetDirectoryFromPath;
 using omaha::GetFileFromPath;
+using omaha::HighresTimer;
+
+namespace {
+
+void PrintUsage() {
+  _tprintf(_T("Usage: ApplyTag <signed_file> <outputfile> <tag> [append]\n"));
+  _tprintf(_T("       ApplyTag -batch <signed_file> <tags_file> [append] ")
+           _T("[-threads <n>]\n"));
+}
+
+// Returns the absolute path of |file|, creating its directory if needed.
+HRESULT PrepareOutputPath(const TCHAR* file, CString* out_path) {
+  CString dir = GetDirectoryFromPath(file);
+  CString path = ConcatenatePath(GetCurrentDir(), dir);
+  ASSERT1(!path.IsEmpty());
+  if (!File::Exists(path)) {
+    HRESULT hr = CreateDir(path, NULL);
+    if (FAILED(hr)) {
+      _tprintf(_T("Could not create dir %s\n"),
+               static_cast<const TCHAR*>(path));
+      return hr;
+    }
+  }
+
+  *out_path = ConcatenatePath(path, GetFileFromPath(file));
+  ASSERT1(!out_path->IsEmpty());
+  return S_OK;
+}
+
+HRESULT ReadTagsFile(const TCHAR* tags_file,
+                     std::vector<ApplyTagBatch::Output>* outputs) {
+  std::vector<byte> contents;
+  HRESULT hr = omaha::ReadEntireFileShareMode(tags_file,
+                                              0,
+                                              FILE_SHARE_READ,
+                                              &contents);
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  if (contents.empty()) {
+    return S_OK;
+  }
+
+  CString text(CStringA(reinterpret_cast<const char*>(&contents.front()),
+                        static_cast<int>(contents.size())));
+  int pos = 0;
+  for (CString line = text.Tokenize(_T("\r\n"), pos);
+       pos != -1;
+       line = text.Tokenize(_T("\r\n"), pos)) {
+    line.Trim();
+    if (line.IsEmpty() || line[0] == _T('#')) {
+      continue;
+    }
+    const int space = line.Find(_T(' '));
+    if (space <= 0) {
+      _tprintf(_T("Bad line in %s: %s\n"),
+               tags_file, static_cast<const TCHAR*>(line));
+      return E_INVALIDARG;
+    }
+
+    ApplyTagBatch::Output output;
+    output.tag_string = CT2CA(line.Left(space));
+    hr = PrepareOutputPath(line.Mid(space + 1).Trim(), &output.tagged_file);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    outputs->push_back(output);
+  }
+  return S_OK;
+}
+
+int ApplyTagsInBatch(int argc, TCHAR* argv[]) {
+  bool append = false;
+  int num_threads = 0;
+  for (int i = 4; i < argc; ++i) {
+    if (_tcsicmp(argv[i], _T("append")) == 0) {
+      append = true;
+    } else if (_tcscmp(argv[i], _T("-threads")) == 0 && i + 1 < argc) {
+      num_threads = _ttoi(argv[++i]);
+    } else {
+      PrintUsage();
+      return -1;
+    }
+  }
+
+  std::vector<ApplyTagBatch::Output> outputs;
+  HRESULT hr = ReadTagsFile(argv[3], &outputs);
+  if (FAILED(hr)) {
+    _tprintf(_T("Could not read %s hr = %x\n"), argv[3], hr);
+    return hr;
+  }
+
+  const ULONGLONG start = HighresTimer::GetCurrentTicks();
+  ApplyTagBatch batch;
+  hr = batch.Init(argv[2], append);
+  if (hr == APPLYTAG_E_ALREADY_TAGGED) {
+    _tprintf(_T("The binary %s is already tagged."), argv[2]);
+    _tprintf(_T(" In order to append the tag string, use the append flag.\n"));
+    return hr;
+  }
+  if (FAILED(hr)) {
+    _tprintf(_T("Tag.Init Failed hr = %x\n"), hr);
+    return hr;
+  }
+
+  hr = batch.EmbedTagStrings(&outputs, num_threads);
+  const double seconds =
+      static_cast<double>(HighresTimer::GetCurrentTicks() - start) /
+      HighresTimer::GetTimerFrequency();
+
+  for (size_t i = 0; i != outputs.size(); ++i) {
+    if (FAILED(outputs[i].hr)) {
+      _tprintf(_T("Could not tag %s with %S hr = %x\n"),
+               static_cast<const TCHAR*>(outputs[i].tagged_file),
+               static_cast<const char*>(outputs[i].tag_string),
+               outputs[i].hr);
+    }
+  }
+  _tprintf(_T("Tagged %Iu files in %.2f s (%.1f tags/sec)\n"),
+           outputs.size(),
+           seconds,
+           seconds > 0 ? outputs.size() / seconds : 0.0);
+  return hr;
+}
+
+}  // namespace
 
 int _tmain(int argc, TCHAR* argv[]) {
+  if (argc >= 4 && _tcscmp(argv[1], _T("-batch")) == 0) {
+    return ApplyTagsInBatch(argc, argv);
+  }
+
   if (argc != 4 && argc != 5) {
     _tprintf(_T("Incorrect number of arguments!\n"));
-    _tprintf(_T("Usage: ApplyTag <signed_file> <outputfile> <tag> [append]\n"));
+    PrintUsage();
     return -1;
   }
 
@@ -46,28 +189,18 @@ int _tmain(int argc, TCHAR* argv[]) {
     append = true;
   }
 
-  CString dir = GetDirectoryFromPath(argv[2]);
-  CString path = ConcatenatePath(GetCurrentDir(), dir);
-  ASSERT1(!path.IsEmpty());
-  if (!File::Exists(path)) {
-    HRESULT hr = CreateDir(path, NULL);
-    if (FAILED(hr)) {
-      _tprintf(_T("Could not create dir %s\n"),
-               static_cast<const TCHAR*>(path));
-      return hr;
-    }
+  CString out_path;
+  HRESULT hr = PrepareOutputPath(argv[2], &out_path);
+  if (FAILED(hr)) {
+    return hr;
   }
 
-  CString file_name = GetFileFromPath(argv[2]);
-  CString out_path = ConcatenatePath(path, file_name);
-  ASSERT1(!out_path.IsEmpty());
-  ASSERT1(File::Exists(path));
   omaha::ApplyTag tag;
-  HRESULT hr = tag.Init(argv[1],
-                        CT2CA(argv[3]),
-                        lstrlenA(CT2CA(argv[3])),
-                        out_path,
-                        append);
+  hr = tag.Init(argv[1],
+                CT2CA(argv[3]),
+                lstrlenA(CT2CA(argv[3])),
+                out_path,
+                append);
   if (hr == E_INVALIDARG) {
     _tprintf(_T("The tag_string %s contains invalid characters."), argv[3]);
     _tprintf(_T("%s"),
@@ -0,0 +1,195 @@
+// Copyright 2013 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Measures how fast tagged installers are written. The signed file is first
+// grown to <size_mb> by padding it in front of its certificate directory, which
+// is all the tagging code looks at; the signature no longer verifies, but the
+// copies are written the same way as those of a real installer that size.
+//
+// <tags> copies are then tagged one ApplyTag at a time, the way the build used
+// to do it, and with ApplyTagBatch on 1, 2, 4... threads up to the number of
+// processors. One CSV row is printed per run:
+//
+//   mode,threads,file_mb,tags,seconds,tags_per_sec,mb_per_sec
+//
+// Usage: ApplyTagBenchmark <signed_file> <out_dir> [<size_mb> [<tags>]]
+//
+// The defaults are a 100 MB installer and 64 tags.
+
+#include <windows.h>
+#include <stdio.h>
+#include <tchar.h>
+#include <algorithm>
+#include <vector>
+
+#include "omaha/base/apply_tag.h"
+#include "omaha/base/certificate_tag.h"
+#include "omaha/base/file.h"
+#include "omaha/base/highres_timer-win32.h"
+#include "omaha/base/path.h"
+#include "omaha/base/utils.h"
+
+namespace omaha {
+
+namespace {
+
+const int kMegabyte = 1024 * 1024;
+
+// Pads |binary| with zeros in front of its certificate directory until it is
+// at least |size| bytes long.
+bool GrowSignedFile(size_t size, std::vector<byte>* binary) {
+  CertificateTag tag;
+  if (binary->empty() ||
+      !ParseCertificateTag(&binary->front(), binary->size(), &tag)) {
+    return false;
+  }
+  if (binary->size() >= size) {
+    return true;
+  }
+
+  // The certificate table stays 8-byte aligned.
+  const size_t padding = (size - binary->size() + 7) & ~static_cast<size_t>(7);
+  if (tag.cert_dir_offset + padding > UINT_MAX) {
+    return false;
+  }
+  const uint32 new_cert_dir_offset =
+      static_cast<uint32>(tag.cert_dir_offset + padding);
+  memcpy(&binary->front() + tag.cert_dir_entry_offset,
+         &new_cert_dir_offset,
+         sizeof(new_cert_dir_offset));
+  binary->insert(binary->begin() + tag.cert_dir_offset, padding, 0);
+  return true;
+}
+
+void DeleteOutputs(const std::vector<ApplyTagBatch::Output>& outputs) {
+  for (size_t i = 0; i != outputs.size(); ++i) {
+    ::DeleteFile(outputs[i].tagged_file);
+  }
+}
+
+void PrintRow(const TCHAR* mode,
+              int threads,
+              size_t file_size,
+              size_t tags,
+              double seconds) {
+  _tprintf(_T("%s,%d,%.1f,%Iu,%.3f,%.1f,%.1f\n"),
+           mode,
+           threads,
+           static_cast<double>(file_size) / kMegabyte,
+           tags,
+           seconds,
+           tags / seconds,
+           static_cast<double>(file_size) * tags / kMegabyte / seconds);
+  fflush(stdout);
+}
+
+int Run(const CString& signed_file,
+        const CString& out_dir,
+        int size_mb,
+        int num_tags) {
+  std::vector<byte> binary;
+  if (FAILED(ReadEntireFileShareMode(signed_file,
+                                     0,
+                                     FILE_SHARE_READ,
+                                     &binary)) ||
+      !GrowSignedFile(static_cast<size_t>(size_mb) * kMegabyte, &binary)) {
+    _tprintf(_T("Cannot read a signed file from %s\n"), signed_file);
+    return 1;
+  }
+  const CString input_file(ConcatenatePath(out_dir,
+                                           _T("ApplyTagBenchmark.exe")));
+  if (FAILED(CreateDir(out_dir, NULL)) ||
+      FAILED(WriteEntireFile(input_file, binary))) {
+    _tprintf(_T("Cannot write %s\n"), input_file);
+    return 1;
+  }
+  const size_t file_size = binary.size();
+  binary.clear();
+
+  std::vector<ApplyTagBatch::Output> outputs(num_tags);
+  for (int i = 0; i != num_tags; ++i) {
+    outputs[i].tag_string.Format(
+        "appguid={8A69D345-D564-463C-AFF1-A69D9E530F96}&appname=App%d"
+        "&needsadmin=False&lang=en", i);
+    CString name;
+    name.Format(_T("Tagged%d.exe"), i);
+    outputs[i].tagged_file = ConcatenatePath(out_dir, name);
+  }
+
+  _tprintf(_T("mode,threads,file_mb,tags,seconds,tags_per_sec,mb_per_sec\n"));
+
+  // One ApplyTag per output reads the whole input every time.
+  ULONGLONG start = HighresTimer::GetCurrentTicks();
+  for (size_t i = 0; i != outputs.size(); ++i) {
+    ApplyTag tag;
+    if (FAILED(tag.Init(input_file,
+                        outputs[i].tag_string,
+                        outputs[i].tag_string.GetLength(),
+                        outputs[i].tagged_file,
+                        false)) ||
+        FAILED(tag.EmbedTagString())) {
+      _tprintf(_T("ApplyTag failed for %s\n"), outputs[i].tagged_file);
+      return 1;
+    }
+  }
+  PrintRow(_T("single"), 1, file_size, outputs.size(),
+           static_cast<double>(HighresTimer::GetCurrentTicks() - start) /
+           HighresTimer::GetTimerFrequency());
+  DeleteOutputs(outputs);
+
+  SYSTEM_INFO system_info = {};
+  ::GetSystemInfo(&system_info);
+  const int max_threads = static_cast<int>(system_info.dwNumberOfProcessors);
+
+  for (int threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+    start = HighresTimer::GetCurrentTicks();
+    ApplyTagBatch batch;
+    if (FAILED(batch.Init(input_file, false)) ||
+        FAILED(batch.EmbedTagStrings(&outputs, threads))) {
+      _tprintf(_T("ApplyTagBatch failed with %d threads\n"), threads);
+      return 1;
+    }
+    PrintRow(_T("batch"), threads, file_size, outputs.size(),
+             static_cast<double>(HighresTimer::GetCurrentTicks() - start) /
+             HighresTimer::GetTimerFrequency());
+    DeleteOutputs(outputs);
+    if (threads >= max_threads) {
+      break;
+    }
+  }
+
+  ::DeleteFile(input_file);
+  return 0;
+}
+
+}  // namespace
+
+}  // namespace omaha
+
+int _tmain(int argc, TCHAR* argv[]) {
+  if (argc < 3 || argc > 5) {
+    _tprintf(_T("Usage: ApplyTagBenchmark <signed_file> <out_dir> ")
+             _T("[<size_mb> [<tags>]]\n"));
+    return -1;
+  }
+
+  const int size_mb = argc > 3 ? _ttoi(argv[3]) : 100;
+  const int num_tags = argc > 4 ? _ttoi(argv[4]) : 64;
+  if (size_mb <= 0 || num_tags <= 0) {
+    _tprintf(_T("<size_mb> and <tags> must be positive\n"));
+    return -1;
+  }
+  return omaha::Run(argv[1], argv[2], size_mb, num_tags);
+}
@@ -0,0 +1,324 @@
+// Copyright 2013 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Micro-benchmarks for the base/security primitives and for the CUP-ECDSA
+// request path. Each benchmark is repeated until it has run for at least the
+// minimum time, and one CSV row is printed per benchmark:
+//
+//   benchmark,variant,bytes,iterations,seconds,ns_per_op,ops_per_sec,mb_per_sec
+//
+// Usage: CryptoBenchmark [-filter <substring>] [-min_time <seconds>]
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <atlstr.h>
+#include <memory>
+#include <vector>
+
+#include "omaha/base/constants.h"
+#include "omaha/base/error.h"
+#include "omaha/base/highres_timer-win32.h"
+#include "omaha/base/security/hmac.h"
+#include "omaha/base/security/p256.h"
+#include "omaha/base/security/p256_ecdsa.h"
+#include "omaha/base/security/p256_prng.h"
+#include "omaha/base/security/sha256.h"
+#include "omaha/base/string.h"
+#include "omaha/net/cup_ecdsa_request.h"
+#include "omaha/net/http_request.h"
+
+namespace omaha {
+
+namespace {
+
+const double kDefaultMinSeconds = 0.5;
+
+// A syntactically valid DER-encoded ECDSA signature. It was not produced by
+// the pinned CUP key, so the benchmarked requests fail the final signature
+// check, after doing all the work an accepted response would need.
+const char kCannedSignature[] =
+    "30450221008eb3780a5f2f30201c63b9dd94dbe461baaaae05"
+    "739fd30496be3c0e7c2979c4022073241ee9b311b69e2974c5"
+    "29753ae8d363cdc89aebfae378773bc13d1e427bfe";
+
+const char kCannedRequest[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<request protocol=\"3.0\" version=\"1.3.99.0\" ismachine=\"1\">"
+    "<os platform=\"win\" version=\"10.0\" arch=\"x64\"/>"
+    "<app appid=\"{430FD4D0-B729-4F61-AA34-91526481799D}\" version=\"1.0.0.0\">"
+    "<updatecheck/></app></request>";
+
+const char kCannedResponse[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<response protocol=\"3.0\" server=\"prod\">"
+    "<daystart elapsed_seconds=\"3600\" elapsed_days=\"5000\"/>"
+    "<app appid=\"{430FD4D0-B729-4F61-AA34-91526481799D}\" status=\"ok\">"
+    "<updatecheck status=\"noupdate\"/></app></response>";
+
+// Serves kCannedResponse to every request, with an ETag that carries
+// kCannedSignature and the hash of the request body as sent.
+class CannedHttpRequest : public HttpRequestInterface {
+ public:
+  CannedHttpRequest() : request_buffer_(NULL), request_buffer_length_(0) {}
+
+  virtual HRESULT Close() { return S_OK; }
+  virtual HRESULT Send() {
+    uint8_t digest[SHA256_DIGEST_SIZE] = {};
+    SHA256_hash(request_buffer_, request_buffer_length_, digest);
+    etag_ = CString(kCannedSignature) + _T(":") +
+            BytesToHex(digest, arraysize(digest));
+    return S_OK;
+  }
+  virtual HRESULT Cancel() { return S_OK; }
+  virtual HRESULT Pause() { return S_OK; }
+  virtual HRESULT Resume() { return S_OK; }
+  virtual std::vector<uint8> GetResponse() const {
+    return std::vector<uint8>(kCannedResponse,
+                              kCannedResponse + arraysize(kCannedResponse) - 1);
+  }
+  virtual int GetHttpStatusCode() const { return HTTP_STATUS_OK; }
+  virtual HRESULT QueryHeadersString(uint32 info_level,
+                                     const TCHAR* name,
+                                     CString* value) const {
+    UNREFERENCED_PARAMETER(info_level);
+    UNREFERENCED_PARAMETER(name);
+    *value = etag_;
+    return S_OK;
+  }
+  virtual CString GetResponseHeaders() const { return CString(); }
+  virtual CString ToString() const { return _T("canned"); }
+  virtual void set_session_handle(HINTERNET) {}
+  virtual void set_url(const CString&) {}
+  virtual void set_request_buffer(const void* buffer, size_t buffer_length) {
+    request_buffer_ = buffer;
+    request_buffer_length_ = buffer_length;
+  }
+  virtual void set_proxy_configuration(const ProxyConfig&) {}
+  virtual void set_filename(const CString&) {}
+  virtual void set_low_priority(bool) {}
+  virtual void set_callback(NetworkRequestCallback*) {}
+  virtual void set_additional_headers(const CString&) {}
+  virtual CString user_agent() const { return user_agent_; }
+  virtual void set_user_agent(const CString& user_agent) {
+    user_agent_ = user_agent;
+  }
+  virtual void set_proxy_auth_config(const ProxyAuthConfig&) {}
+  virtual bool download_metrics(DownloadMetrics*) const { return false; }
+
+ private:
+  const void* request_buffer_;
+  size_t request_buffer_length_;
+  CString etag_;
+  CString user_agent_;
+
+  DISALLOW_COPY_AND_ASSIGN(CannedHttpRequest);
+};
+
+class BenchmarkRunner {
+ public:
+  BenchmarkRunner(const char* filter, double min_seconds)
+      : filter_(filter), min_seconds_(min_seconds) {
+    printf("benchmark,variant,bytes,iterations,seconds,ns_per_op,"
+           "ops_per_sec,mb_per_sec\n");
+  }
+
+  // Runs |op| in batches of growing size until a batch takes at least the
+  // minimum time, then reports that batch. |bytes| is the amount of data
+  // processed by each call, or 0.
+  template <typename Op>
+  void Run(const char* benchmark, const char* variant, size_t bytes, Op op) {
+    CStringA name;
+    name.Format("%s/%s", benchmark, variant);
+    if (filter_ && !strstr(name, filter_)) {
+      return;
+    }
+
+    const double frequency =
+        static_cast<double>(HighresTimer::GetTimerFrequency());
+    uint64 iterations = 1;
+    double seconds = 0;
+    for (;;) {
+      const ULONGLONG start = HighresTimer::GetCurrentTicks();
+      for (uint64 i = 0; i < iterations; ++i) {
+        op();
+      }
+      seconds = (HighresTimer::GetCurrentTicks() - start) / frequency;
+      if (seconds >= min_seconds_) {
+        break;
+      }
+      iterations *= 2;
+    }
+
+    const double ops_per_sec = iterations / seconds;
+    printf("%s,%s,%Iu,%I64u,%.6f,%.1f,%.1f,%.2f\n",
+           benchmark, variant, bytes, iterations, seconds,
+           1e9 / ops_per_sec, ops_per_sec,
+           bytes * ops_per_sec / (1024 * 1024));
+    fflush(stdout);
+  }
+
+ private:
+  const char* filter_;
+  double min_seconds_;
+
+  DISALLOW_COPY_AND_ASSIGN(BenchmarkRunner);
+};
+
+// Results are written here so that the compiler cannot drop the work.
+volatile uint8_t g_sink;
+
+const size_t kMessageSizes[] = { 64, 1024, 16 * 1024, 1024 * 1024 };
+
+void DrawScalar(P256_PRNG_CTX* prng, p256_int* a) {
+  uint8_t tmp[P256_PRNG_SIZE];
+  do {
+    p256_int p1, p2;
+    p256_prng_draw(prng, tmp);
+    p256_from_bin(tmp, &p1);
+    p256_prng_draw(prng, tmp);
+    p256_from_bin(tmp, &p2);
+    p256_modmul(&SECP256r1_n, &p1, 0, &p2, a);
+  } while (p256_is_zero(a));
+}
+
+void RunHashBenchmarks(BenchmarkRunner* runner) {
+  std::vector<uint8_t> data(kMessageSizes[arraysize(kMessageSizes) - 1], 0xa5);
+  char variant[32] = {};
+
+  for (int impl = SHA256_IMPL_GENERIC; impl < SHA256_IMPL_COUNT; ++impl) {
+    if (!SHA256_set_impl(static_cast<SHA256_IMPL>(impl))) {
+      continue;
+    }
+    for (size_t i = 0; i < arraysize(kMessageSizes); ++i) {
+      const size_t size = kMessageSizes[i];
+      sprintf_s(variant, "%s/%Iu",
+                SHA256_impl_name(static_cast<SHA256_IMPL>(impl)), size);
+      runner->Run("sha256", variant, size, [&data, size]() {
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        SHA256_hash(&data.front(), size, digest);
+        g_sink = digest[0];
+      });
+    }
+  }
+  SHA256_set_impl(SHA256_IMPL_AUTO);
+
+  const uint8_t key[32] = { 1 };
+  for (size_t i = 0; i < arraysize(kMessageSizes); ++i) {
+    const size_t size = kMessageSizes[i];
+    sprintf_s(variant, "%Iu", size);
+    runner->Run("hmac_sha256", variant, size, [&data, &key, size]() {
+      LITE_HMAC_CTX hmac;
+      HMAC_SHA256_init(&hmac, key, sizeof(key));
+      HMAC_update(&hmac, &data.front(), size);
+      g_sink = HMAC_final(&hmac)[0];
+    });
+  }
+
+  P256_PRNG_CTX prng;
+  p256_prng_init(&prng, "crypto_benchmark", 16, 0);
+  runner->Run("p256_prng_draw", "32", P256_PRNG_SIZE, [&prng]() {
+    uint8_t out[P256_PRNG_SIZE];
+    p256_prng_draw(&prng, out);
+    g_sink = out[0];
+  });
+}
+
+void RunEcBenchmarks(BenchmarkRunner* runner) {
+  P256_PRNG_CTX prng;
+  p256_prng_init(&prng, "crypto_benchmark_ec", 19, 0);
+
+  p256_int key, key_x, key_y, message, r, s, out_x, out_y;
+  DrawScalar(&prng, &key);
+  DrawScalar(&prng, &message);
+  p256_base_point_mul(&key, &key_x, &key_y);
+  p256_ecdsa_sign(&key, &message, &r, &s);
+
+  runner->Run("p256_base_point_mul", "", 0, [&]() {
+    p256_base_point_mul(&message, &out_x, &out_y);
+  });
+  runner->Run("p256_point_mul", "", 0, [&]() {
+    p256_point_mul(&message, &key_x, &key_y, &out_x, &out_y);
+  });
+  runner->Run("p256_modinv", "", 0, [&]() {
+    p256_modinv(&SECP256r1_n, &message, &out_x);
+  });
+  runner->Run("p256_modinv_vartime", "", 0, [&]() {
+    p256_modinv_vartime(&SECP256r1_n, &message, &out_x);
+  });
+  runner->Run("p256_ecdsa_sign", "", 0, [&]() {
+    p256_ecdsa_sign(&key, &message, &out_x, &out_y);
+  });
+  runner->Run("p256_ecdsa_verify", "", 0, [&]() {
+    g_sink = static_cast<uint8_t>(
+        p256_ecdsa_verify(&key_x, &key_y, &message, &r, &s));
+  });
+
+  p256_precomp precomp;
+  runner->Run("p256_precomp_init", "", 0, [&]() {
+    p256_precomp_init(&key_x, &key_y, &precomp);
+  });
+  runner->Run("p256_ecdsa_verify_precomp", "", 0, [&]() {
+    g_sink = static_cast<uint8_t>(
+        p256_ecdsa_verify_precomp(&precomp, &message, &r, &s));
+  });
+}
+
+// Sends the canned request through CupEcdsaRequest: request hashing and URL
+// building, response hashing, ETag parsing and signature verification.
+void RunCupBenchmarks(BenchmarkRunner* runner) {
+  CupEcdsaRequest request(new CannedHttpRequest);
+  request.set_url(_T("https://update.example.com/service/update2"));
+  request.set_request_buffer(kCannedRequest, arraysize(kCannedRequest) - 1);
+
+  const HRESULT hr = request.Send();
+  if (hr != OMAHA_NET_E_CUP_ECDSA_NOT_TRUSTED_SIGNATURE) {
+    fprintf(stderr, "Unexpected CUP-ECDSA result 0x%08x; skipping.\n", hr);
+    return;
+  }
+
+  runner->Run("cup_ecdsa_send", "canned", arraysize(kCannedResponse) - 1,
+              [&request]() {
+    g_sink = static_cast<uint8_t>(request.Send());
+  });
+}
+
+}  // namespace
+
+}  // namespace omaha
+
+int _tmain(int argc, TCHAR* argv[]) {
+  CStringA filter;
+  double min_seconds = omaha::kDefaultMinSeconds;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!_tcscmp(argv[i], _T("-filter")) && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (!_tcscmp(argv[i], _T("-min_time")) && i + 1 < argc) {
+      min_seconds = _tcstod(argv[++i], NULL);
+    } else {
+      _tprintf(_T("Usage: CryptoBenchmark [-filter <substring>] ")
+               _T("[-min_time <seconds>]\n"));
+      return -1;
+    }
+  }
+
+  omaha::BenchmarkRunner runner(filter.IsEmpty() ? NULL : filter.GetString(),
+                                min_seconds);
+  omaha::RunHashBenchmarks(&runner);
+  omaha::RunEcBenchmarks(&runner);
+  omaha::RunCupBenchmarks(&runner);
+  return 0;
+}
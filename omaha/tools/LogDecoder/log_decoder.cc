@@ -0,0 +1,88 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Decodes a binary log, written when BinaryLogToFile=1 is set in the
+// [LoggingSettings] of GoogleUpdate.ini, into the lines of a text log, and
+// writes them to stdout as UTF-8.
+//
+// Usage: LogDecoder <binary log file>
+//
+// This tool does not depend on Windows. To build it elsewhere, run this
+// command, on one line, from the directory above omaha:
+//
+//   g++ -std=c++11 -O2 -I. -Iomaha/third_party/chrome/files/src
+//       omaha/tools/LogDecoder/log_decoder.cc omaha/base/binary_log.cc
+//       -o log_decoder
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "omaha/base/binary_log.h"
+
+namespace {
+
+bool ReadFile(const char* file_name, std::vector<uint8>* data) {
+  FILE* file = fopen(file_name, "rb");
+  if (!file) {
+    return false;
+  }
+
+  uint8 buffer[64 * 1024];
+  size_t size = 0;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) != 0) {
+    data->insert(data->end(), buffer, buffer + size);
+  }
+  const bool succeeded = !ferror(file);
+  fclose(file);
+  return succeeded;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <binary log file>\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<uint8> data;
+  if (!ReadFile(argv[1], &data)) {
+    fprintf(stderr, "Cannot read %s\n", argv[1]);
+    return 1;
+  }
+
+  // The lines end with CRLF, as in text logs.
+#ifdef _WIN32
+  _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+  std::string text;
+  omaha::BinaryLogDecoder decoder;
+  const bool succeeded = data.empty() ? false :
+                         decoder.Decode(&data[0], data.size(), &text);
+  fwrite(text.data(), 1, text.size(), stdout);
+  if (!succeeded) {
+    // A log being written to may end with a partial record.
+    fprintf(stderr, "%s is not a binary log, or is truncated\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,142 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Measures the cost of log statements which do not log. The statements have
+// an argument formatted into a string, as many do. The modes are:
+//
+//   cached        LC_LOG at L3, which checks the writer mask cached in its
+//                 call site, and only evaluates its arguments if it logs.
+//   uncached      what LC_LOG at L3 used to expand to: the category and level
+//                 are checked, and the arguments evaluated, every time.
+//   compiled_out  LC_LOG at L6, above LOGGING_MAX_LEVEL in optimized builds.
+//
+// Whether the statements log depends on the [LoggingLevel] of LC_JS in
+// GoogleUpdate.ini. By default, they do not in optimized builds, which this
+// benchmark is meant for. One CSV row is printed per mode:
+//
+//   mode,logs,statements,evaluations,seconds,ns_per_statement
+//
+// Usage: LoggingBenchmark [<statements>]
+//
+// The default is 10000000 statements.
+
+#include <windows.h>
+#include <stdio.h>
+#include <tchar.h>
+
+#include "omaha/base/highres_timer-win32.h"
+#include "omaha/base/logging.h"
+#include "omaha/base/safe_format.h"
+
+namespace omaha {
+
+namespace {
+
+const LogCategory kCategory = LC_JS;
+
+// The number of times the arguments of the statements were evaluated.
+int evaluations = 0;
+
+CString Describe(int i) {
+  ++evaluations;
+  CString description;
+  SafeCStringFormat(&description, _T("statement %d"), i);
+  return description;
+}
+
+void LogCached(int statements) {
+  for (int i = 0; i != statements; ++i) {
+    LC_LOG(kCategory, L3, (_T("[%s]"), Describe(i).GetString()));
+  }
+}
+
+void LogUncached(int statements) {
+  Logging* logging = GetLogging();
+  for (int i = 0; i != statements; ++i) {
+    LoggingHelper(logging, kCategory, L3,
+                  logging->IsCatLevelEnabled(kCategory, L3),
+                  NULL)(_T("[%s]"), Describe(i).GetString());
+  }
+}
+
+void LogCompiledOut(int statements) {
+  for (int i = 0; i != statements; ++i) {
+    LC_LOG(kCategory, L6, (_T("[%s]"), Describe(i).GetString()));
+  }
+}
+
+struct Mode {
+  const TCHAR* name;
+  LogLevel level;
+  void (*log)(int statements);
+};
+
+const Mode kModes[] = {
+  { _T("cached"), L3, &LogCached },
+  { _T("uncached"), L3, &LogUncached },
+  { _T("compiled_out"), L6, &LogCompiledOut },
+};
+
+int Run(int statements) {
+  Logging* logging = GetLogging();
+  if (!logging) {
+    _tprintf(_T("Logging is not available\n"));
+    return 1;
+  }
+
+  _tprintf(_T("mode,logs,statements,evaluations,seconds,ns_per_statement\n"));
+
+  for (size_t i = 0; i != arraysize(kModes); ++i) {
+    const Mode& mode = kModes[i];
+    const bool logs = mode.level <= LOGGING_MAX_LEVEL &&
+                      logging->IsCatLevelEnabled(kCategory, mode.level) != 0;
+
+    evaluations = 0;
+    const ULONGLONG start = HighresTimer::GetCurrentTicks();
+    mode.log(statements);
+    const ULONGLONG ticks = HighresTimer::GetCurrentTicks() - start;
+    const double seconds =
+        static_cast<double>(ticks) / HighresTimer::GetTimerFrequency();
+
+    _tprintf(_T("%s,%d,%d,%d,%.3f,%.2f\n"),
+             mode.name,
+             logs,
+             statements,
+             evaluations,
+             seconds,
+             seconds * 1000000000 / statements);
+    fflush(stdout);
+  }
+
+  return 0;
+}
+
+}  // namespace
+
+}  // namespace omaha
+
+int _tmain(int argc, TCHAR* argv[]) {
+  if (argc > 2) {
+    _tprintf(_T("Usage: LoggingBenchmark [<statements>]\n"));
+    return -1;
+  }
+
+  const int statements = argc > 1 ? _ttoi(argv[1]) : 10000000;
+  if (statements <= 0) {
+    _tprintf(_T("<statements> must be positive\n"));
+    return -1;
+  }
+  return omaha::Run(statements);
+}
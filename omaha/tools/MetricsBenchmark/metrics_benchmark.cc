@@ -0,0 +1,184 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Measures how fast a metric is incremented by several threads at once. Each
+// thread increments the same metric the given number of times, for 1, 2, 4,
+// ... threads up to the given maximum. The modes are a count metric, spread
+// over several cells, an integer metric, held in a single cell, and a counter
+// updated under one lock, the way all the metrics used to be. One CSV row is
+// printed per mode and number of threads:
+//
+//   mode,threads,increments,seconds,mops_per_sec
+//
+// Usage: MetricsBenchmark [<max_threads> [<increments_per_thread>]]
+//
+// The defaults are 8 threads and 1000000 increments per thread.
+
+#include <windows.h>
+#include <stdio.h>
+#include <tchar.h>
+#include <vector>
+
+#include "omaha/base/highres_timer-win32.h"
+#include "omaha/base/synchronized.h"
+#include "omaha/statsreport/metrics.h"
+#include "omaha/third_party/smartany/scoped_any.h"
+
+namespace omaha {
+
+namespace {
+
+// A counter updated under a lock, as the metrics were before they used
+// interlocked operations.
+class LockedCounter {
+ public:
+  LockedCounter() : value_(0) {}
+
+  void Increment() {
+    __mutexScope(lock_);
+    ++value_;
+  }
+
+  int64 value() const {
+    __mutexScope(lock_);
+    return value_;
+  }
+
+ private:
+  LLock lock_;
+  int64 value_;
+
+  DISALLOW_COPY_AND_ASSIGN(LockedCounter);
+};
+
+stats_report::CountMetric count_metric("benchmark_count", 0);
+stats_report::IntegerMetric integer_metric("benchmark_integer", 0);
+LockedCounter locked_counter;
+
+struct Mode {
+  const TCHAR* name;
+  void (*increment)();
+  int64 (*value)();
+};
+
+void IncrementCount() { ++count_metric; }
+int64 CountValue() { return count_metric.value(); }
+
+void IncrementInteger() { ++integer_metric; }
+int64 IntegerValue() { return integer_metric.value(); }
+
+void IncrementLocked() { locked_counter.Increment(); }
+int64 LockedValue() { return locked_counter.value(); }
+
+const Mode kModes[] = {
+  { _T("count_metric"), &IncrementCount, &CountValue },
+  { _T("integer_metric"), &IncrementInteger, &IntegerValue },
+  { _T("locked_counter"), &IncrementLocked, &LockedValue },
+};
+
+struct ThreadParam {
+  const Mode* mode;
+  int increments;
+  HANDLE start_event;
+};
+
+DWORD WINAPI ThreadProc(void* param) {
+  const ThreadParam* thread_param = static_cast<const ThreadParam*>(param);
+  ::WaitForSingleObject(thread_param->start_event, INFINITE);
+  for (int i = 0; i != thread_param->increments; ++i) {
+    thread_param->mode->increment();
+  }
+  return 0;
+}
+
+// Returns the seconds it took |num_threads| threads to each increment the
+// metric of |mode| |increments| times, or a negative value on failure.
+double RunThreads(const Mode& mode, int num_threads, int increments) {
+  scoped_event start_event(::CreateEvent(NULL, true, false, NULL));
+  if (!start_event) {
+    return -1;
+  }
+
+  ThreadParam param = { &mode, increments, get(start_event) };
+  std::vector<HANDLE> threads;
+  for (int i = 0; i != num_threads; ++i) {
+    HANDLE thread = ::CreateThread(NULL, 0, &ThreadProc, &param, 0, NULL);
+    if (!thread) {
+      break;
+    }
+    threads.push_back(thread);
+  }
+
+  const ULONGLONG start = HighresTimer::GetCurrentTicks();
+  ::SetEvent(get(start_event));
+  for (size_t i = 0; i != threads.size(); ++i) {
+    ::WaitForSingleObject(threads[i], INFINITE);
+    ::CloseHandle(threads[i]);
+  }
+  const ULONGLONG ticks = HighresTimer::GetCurrentTicks() - start;
+
+  if (threads.size() != static_cast<size_t>(num_threads)) {
+    return -1;
+  }
+  return static_cast<double>(ticks) / HighresTimer::GetTimerFrequency();
+}
+
+int Run(int max_threads, int increments) {
+  _tprintf(_T("mode,threads,increments,seconds,mops_per_sec\n"));
+
+  for (size_t i = 0; i != arraysize(kModes); ++i) {
+    for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+      const int64 value_before = kModes[i].value();
+      const double seconds = RunThreads(kModes[i], num_threads, increments);
+      const int64 total = static_cast<int64>(num_threads) * increments;
+      if (seconds < 0 || kModes[i].value() - value_before != total) {
+        _tprintf(_T("%s failed with %d threads\n"),
+                 kModes[i].name, num_threads);
+        return 1;
+      }
+
+      _tprintf(_T("%s,%d,%I64d,%.3f,%.1f\n"),
+               kModes[i].name,
+               num_threads,
+               total,
+               seconds,
+               static_cast<double>(total) / 1000000 / seconds);
+      fflush(stdout);
+    }
+  }
+
+  return 0;
+}
+
+}  // namespace
+
+}  // namespace omaha
+
+int _tmain(int argc, TCHAR* argv[]) {
+  if (argc > 3) {
+    _tprintf(_T("Usage: MetricsBenchmark [<max_threads> ")
+             _T("[<increments_per_thread>]]\n"));
+    return -1;
+  }
+
+  const int max_threads = argc > 1 ? _ttoi(argv[1]) : 8;
+  const int increments = argc > 2 ? _ttoi(argv[2]) : 1000000;
+  if (max_threads <= 0 || increments <= 0) {
+    _tprintf(_T("<max_threads> and <increments_per_thread> must be ")
+             _T("positive\n"));
+    return -1;
+  }
+  return omaha::Run(max_threads, increments);
+}
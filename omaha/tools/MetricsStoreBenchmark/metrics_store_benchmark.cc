@@ -0,0 +1,248 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Measures how long it takes to aggregate metrics into the registry, with
+// MetricsAggregatorWin32, and into a file, with MetricsAggregatorFile. The
+// collection holds the given number of metrics, a quarter of each type, and
+// every metric has a value to aggregate each time. One CSV row is printed per
+// store:
+//
+//   store,metrics,iterations,seconds,ms_per_aggregation,calls_per_aggregation
+//
+// The calls are the registry or file system calls made by one aggregation,
+// as counted from the code of the aggregators rather than measured.
+//
+// Usage: MetricsStoreBenchmark [<metrics> [<iterations>]]
+//
+// The defaults are 500 metrics and 100 iterations. The stats are written
+// under HKCU and to the temporary directory, and deleted at the end.
+
+#include <windows.h>
+#include <shlwapi.h>
+#include <stdio.h>
+#include <tchar.h>
+#include <string>
+#include <vector>
+
+#include "omaha/base/highres_timer-win32.h"
+#include "omaha/statsreport/aggregator-file.h"
+#include "omaha/statsreport/aggregator-win32.h"
+#include "omaha/statsreport/const-win32.h"
+#include "omaha/statsreport/metrics.h"
+
+namespace omaha {
+
+namespace {
+
+using stats_report::BoolMetric;
+using stats_report::CountMetric;
+using stats_report::IntegerMetric;
+using stats_report::MetricCollection;
+using stats_report::MetricsAggregator;
+using stats_report::MetricsAggregatorFile;
+using stats_report::MetricsAggregatorWin32;
+using stats_report::TimingMetric;
+
+const TCHAR kAppName[] = _T("MetricsStoreBenchmark");
+
+// The stats key and its five subkeys are created and closed once each.
+const int kRegistryFixedCalls = 12;
+
+// The file is read through a mapping, with seven calls, and written through
+// another one with nine, the last of which moves it in place.
+const int kFileFixedCalls = 16;
+
+// The metrics of the benchmark, a quarter of each type. The names must live
+// as long as the metrics.
+class Metrics {
+ public:
+  explicit Metrics(int num_metrics) {
+    names_.reserve(num_metrics);
+    for (int i = 0; i != num_metrics; ++i) {
+      char name[32] = {};
+      sprintf_s(name, arraysize(name), "benchmark_metric_%d", i);
+      names_.push_back(name);
+    }
+    for (int i = 0; i != num_metrics; ++i) {
+      const char* name = names_[i].c_str();
+      switch (i % 4) {
+        case 0:
+          counts_.push_back(new CountMetric(name, &collection_));
+          break;
+        case 1:
+          timings_.push_back(new TimingMetric(name, &collection_));
+          break;
+        case 2:
+          integers_.push_back(new IntegerMetric(name, &collection_));
+          break;
+        default:
+          bools_.push_back(new BoolMetric(name, &collection_));
+          break;
+      }
+    }
+    collection_.Initialize();
+  }
+
+  ~Metrics() {
+    collection_.Uninitialize();
+    Delete(&counts_);
+    Delete(&timings_);
+    Delete(&integers_);
+    Delete(&bools_);
+  }
+
+  // Gives every metric a value, which the next aggregation picks up.
+  void Update(int iteration) {
+    for (size_t i = 0; i != counts_.size(); ++i) {
+      ++*counts_[i];
+    }
+    for (size_t i = 0; i != timings_.size(); ++i) {
+      timings_[i]->AddSample(iteration + static_cast<int64>(i));
+    }
+    for (size_t i = 0; i != integers_.size(); ++i) {
+      *integers_[i] = iteration + 1;
+    }
+    for (size_t i = 0; i != bools_.size(); ++i) {
+      *bools_[i] = (iteration & 1) != 0;
+    }
+  }
+
+  // Returns the registry calls one aggregation of the metrics makes: a query
+  // and a set per count, two of each per timing, one for its timing data and
+  // one for its histogram, and a set per integer and boolean.
+  int RegistryCalls() const {
+    return kRegistryFixedCalls +
+           static_cast<int>(2 * counts_.size() +
+                            4 * timings_.size() +
+                            integers_.size() +
+                            bools_.size());
+  }
+
+  MetricCollection& collection() { return collection_; }
+
+ private:
+  template <typename T>
+  static void Delete(std::vector<T*>* metrics) {
+    for (size_t i = 0; i != metrics->size(); ++i) {
+      delete (*metrics)[i];
+    }
+    metrics->clear();
+  }
+
+  std::vector<std::string> names_;
+  MetricCollection collection_;
+  std::vector<CountMetric*> counts_;
+  std::vector<TimingMetric*> timings_;
+  std::vector<IntegerMetric*> integers_;
+  std::vector<BoolMetric*> bools_;
+
+  DISALLOW_COPY_AND_ASSIGN(Metrics);
+};
+
+// Returns the seconds it took to update and aggregate the metrics
+// |iterations| times with |aggregator|, or a negative value on failure.
+double RunAggregations(Metrics* metrics,
+                       MetricsAggregator* aggregator,
+                       int iterations) {
+  ULONGLONG ticks = 0;
+  for (int i = 0; i != iterations; ++i) {
+    metrics->Update(i);
+
+    const ULONGLONG start = HighresTimer::GetCurrentTicks();
+    const bool aggregated = aggregator->AggregateMetrics();
+    ticks += HighresTimer::GetCurrentTicks() - start;
+    if (!aggregated) {
+      return -1;
+    }
+  }
+  return static_cast<double>(ticks) / HighresTimer::GetTimerFrequency();
+}
+
+void PrintRow(const TCHAR* store,
+              int num_metrics,
+              int iterations,
+              double seconds,
+              int calls) {
+  _tprintf(_T("%s,%d,%d,%.3f,%.3f,%d\n"),
+           store,
+           num_metrics,
+           iterations,
+           seconds,
+           seconds * 1000 / iterations,
+           calls);
+  fflush(stdout);
+}
+
+int Run(int num_metrics, int iterations) {
+  TCHAR file_path[MAX_PATH] = {};
+  if (!::GetTempPath(arraysize(file_path), file_path) ||
+      !::PathAppend(file_path, _T("MetricsStoreBenchmark.dat"))) {
+    _tprintf(_T("Failed to get the temporary directory\n"));
+    return 1;
+  }
+  CString key_name;
+  key_name.Format(stats_report::kStatsKeyFormatString, kAppName);
+
+  _tprintf(_T("store,metrics,iterations,seconds,ms_per_aggregation,")
+           _T("calls_per_aggregation\n"));
+
+  int result = 0;
+  {
+    Metrics metrics(num_metrics);
+    MetricsAggregatorWin32 aggregator(metrics.collection(), kAppName);
+    const double seconds = RunAggregations(&metrics, &aggregator, iterations);
+    if (seconds < 0) {
+      _tprintf(_T("registry failed\n"));
+      result = 1;
+    } else {
+      PrintRow(_T("registry"), num_metrics, iterations, seconds,
+               metrics.RegistryCalls());
+    }
+  }
+  {
+    Metrics metrics(num_metrics);
+    MetricsAggregatorFile aggregator(metrics.collection(), file_path);
+    const double seconds = RunAggregations(&metrics, &aggregator, iterations);
+    if (seconds < 0) {
+      _tprintf(_T("file failed\n"));
+      result = 1;
+    } else {
+      PrintRow(_T("file"), num_metrics, iterations, seconds, kFileFixedCalls);
+    }
+  }
+
+  ::SHDeleteKey(HKEY_CURRENT_USER, key_name);
+  ::DeleteFile(file_path);
+  return result;
+}
+
+}  // namespace
+
+}  // namespace omaha
+
+int _tmain(int argc, TCHAR* argv[]) {
+  if (argc > 3) {
+    _tprintf(_T("Usage: MetricsStoreBenchmark [<metrics> [<iterations>]]\n"));
+    return -1;
+  }
+
+  const int num_metrics = argc > 1 ? _ttoi(argv[1]) : 500;
+  const int iterations = argc > 2 ? _ttoi(argv[2]) : 100;
+  if (num_metrics <= 0 || iterations <= 0) {
+    _tprintf(_T("<metrics> and <iterations> must be positive\n"));
+    return -1;
+  }
+  return omaha::Run(num_metrics, iterations);
+}
@@ -0,0 +1,394 @@
+// Copyright 2013 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Measures the extraction of metainstaller payloads. Each payload is extracted
+// in a child process, so that the peak memory reported is that of a single
+// extraction, and one CSV row is printed per payload:
+//
+//   payload,packed_bytes,unpacked_bytes,seconds,mb_per_sec,
+//   peak_working_set_mb,peak_private_mb
+//
+// Payloads are built the same way the metainstaller build does it:
+//
+//   MiPayloadBenchmark -make_tar 2048 payload.tar
+//   payload_packer.exe -o payload.tar.lzma2 payload.tar
+//   MiPayloadBenchmark payload.tar.lzma2
+//
+// payload_packer.exe wraps payload.tar in a tarball of its own, which is
+// extracted as a single file. Single stream payloads taken from older
+// metainstallers are accepted as well.
+//
+// -pack measures payload_packer instead. It compresses the tarball with 1, 2,
+// 4... threads up to the number of processors, and prints one CSV row per run:
+//
+//   threads,tarball_bytes,packed_bytes,seconds,mb_per_sec,same_as_1_thread
+//
+// -make_tar fills the tarball with the DLLs in the system directory, which
+// compress and convert like real payloads. The payload is mapped in the same
+// way the metainstaller resource is, so the peak working set includes the
+// pages of the payload that have been read; the peak private bytes do not.
+//
+// Usage: MiPayloadBenchmark <payload>...
+//        MiPayloadBenchmark -make_tar <size_mb> <tarball>
+//        MiPayloadBenchmark -pack <tarball>
+
+#include <windows.h>
+#include <psapi.h>
+#include <stdio.h>
+#include <string.h>
+#include <atlstr.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "omaha/base/highres_timer-win32.h"
+#include "omaha/base/path.h"
+#include "omaha/base/utils.h"
+#include "omaha/mi_exe_stub/payload.h"
+#include "omaha/mi_exe_stub/payload_packer/chunked_payload_writer.h"
+#include "omaha/mi_exe_stub/tar.h"
+#include "omaha/third_party/smartany/scoped_any.h"
+
+namespace omaha {
+
+namespace {
+
+const int kMegabyte = 1024 * 1024;
+
+// Sums the bytes that were extracted.
+struct ExtractStats {
+  uint64 unpacked_bytes;
+};
+
+void CountExtractedFile(void* context, const TCHAR* filename) {
+  WIN32_FILE_ATTRIBUTE_DATA data = {};
+  if (::GetFileAttributesEx(filename, GetFileExInfoStandard, &data)) {
+    static_cast<ExtractStats*>(context)->unpacked_bytes +=
+        (static_cast<uint64>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+  }
+}
+
+// Runs in the child process. Extracts |payload_path| to a temporary directory
+// and prints the CSV row.
+int ExtractOne(const CString& payload_path) {
+  scoped_hfile file(::CreateFile(payload_path,
+                                 GENERIC_READ,
+                                 FILE_SHARE_READ,
+                                 NULL,
+                                 OPEN_EXISTING,
+                                 0,
+                                 NULL));
+  if (!valid(file)) {
+    _tprintf(_T("Cannot open %s\n"), payload_path);
+    return 1;
+  }
+
+  LARGE_INTEGER packed_size = {};
+  if (!::GetFileSizeEx(get(file), &packed_size) ||
+      static_cast<uint64>(packed_size.QuadPart) > SIZE_MAX) {
+    return 1;
+  }
+
+  scoped_file_mapping mapping(::CreateFileMapping(get(file),
+                                                  NULL,
+                                                  PAGE_READONLY,
+                                                  0,
+                                                  0,
+                                                  NULL));
+  if (!valid(mapping)) {
+    return 1;
+  }
+  scoped_file_view view(::MapViewOfFile(get(mapping), FILE_MAP_READ, 0, 0, 0));
+  if (!valid(view)) {
+    return 1;
+  }
+
+  const CString temp_dir(GetTempFilename(_T("mpb")));
+  if (temp_dir.IsEmpty() || !::DeleteFile(temp_dir) ||
+      !::CreateDirectory(temp_dir, NULL)) {
+    return 1;
+  }
+
+  ExtractStats stats = {};
+  bool result = false;
+  const ULONGLONG start = HighresTimer::GetCurrentTicks();
+  {
+    Tar tar(temp_dir, true);
+    tar.SetCallback(&CountExtractedFile, &stats);
+    result = ExtractPayload(static_cast<const uint8*>(get(view)),
+                            static_cast<size_t>(packed_size.QuadPart),
+                            &tar);
+  }
+  const double seconds =
+      static_cast<double>(HighresTimer::GetCurrentTicks() - start) /
+      HighresTimer::GetTimerFrequency();
+  ::RemoveDirectory(temp_dir);
+
+  if (!result) {
+    _tprintf(_T("Cannot extract %s\n"), payload_path);
+    return 1;
+  }
+
+  PROCESS_MEMORY_COUNTERS counters = {};
+  counters.cb = sizeof(counters);
+  if (!::GetProcessMemoryInfo(::GetCurrentProcess(),
+                              &counters,
+                              sizeof(counters))) {
+    return 1;
+  }
+
+  _tprintf(_T("%s,%I64u,%I64u,%.3f,%.1f,%.1f,%.1f\n"),
+           GetFileFromPath(payload_path),
+           static_cast<uint64>(packed_size.QuadPart),
+           stats.unpacked_bytes,
+           seconds,
+           stats.unpacked_bytes / seconds / kMegabyte,
+           static_cast<double>(counters.PeakWorkingSetSize) / kMegabyte,
+           static_cast<double>(counters.PeakPagefileUsage) / kMegabyte);
+  return 0;
+}
+
+// Runs ExtractOne() for |payload_path| in a child process, which prints to
+// the same console.
+int RunChild(const CString& payload_path) {
+  CString module_path;
+  if (!::GetModuleFileName(NULL, CStrBuf(module_path, MAX_PATH), MAX_PATH)) {
+    return 1;
+  }
+
+  CString command_line;
+  command_line.Format(_T("\"%s\" -extract \"%s\""), module_path, payload_path);
+
+  STARTUPINFO si = { sizeof(si) };
+  PROCESS_INFORMATION pi = {};
+  if (!::CreateProcess(NULL,
+                       command_line.GetBuffer(),
+                       NULL,
+                       NULL,
+                       false,
+                       0,
+                       NULL,
+                       NULL,
+                       &si,
+                       &pi)) {
+    return 1;
+  }
+  ::CloseHandle(pi.hThread);
+  ::WaitForSingleObject(pi.hProcess, INFINITE);
+  DWORD exit_code = 1;
+  ::GetExitCodeProcess(pi.hProcess, &exit_code);
+  ::CloseHandle(pi.hProcess);
+  return static_cast<int>(exit_code);
+}
+
+bool WriteAll(HANDLE file, const void* data, DWORD size) {
+  DWORD bytes_written = 0;
+  return ::WriteFile(file, data, size, &bytes_written, NULL) &&
+         bytes_written == size;
+}
+
+// Appends |source| to the tarball as |name|, truncated to |max_size| bytes.
+bool AppendTarEntry(HANDLE tarball,
+                    const CString& source,
+                    const CStringA& name,
+                    uint64 max_size,
+                    uint64* entry_size) {
+  scoped_hfile file(::CreateFile(source,
+                                 GENERIC_READ,
+                                 FILE_SHARE_READ,
+                                 NULL,
+                                 OPEN_EXISTING,
+                                 FILE_FLAG_SEQUENTIAL_SCAN,
+                                 NULL));
+  LARGE_INTEGER file_size = {};
+  if (!valid(file) || !::GetFileSizeEx(get(file), &file_size)) {
+    *entry_size = 0;
+    return true;
+  }
+  uint64 size = file_size.QuadPart;
+  if (size > max_size) {
+    size = max_size;
+  }
+
+  USTARHeader header = {};
+  memset(&header, 0, sizeof(header));
+  strncpy_s(header.name, name, _TRUNCATE);
+  sprintf_s(header.mode, "%07o", 0644);
+  sprintf_s(header.uid, "%07o", 0);
+  sprintf_s(header.gid, "%07o", 0);
+  sprintf_s(header.size, "%011I64o", size);
+  sprintf_s(header.mtime, "%011o", 0);
+  header.typeflag = '0';
+  memcpy(header.magic, "ustar", sizeof(header.magic));
+  memcpy(header.version, "00", sizeof(header.version));
+  memset(header.chksum, ' ', sizeof(header.chksum));
+  unsigned int checksum = 0;
+  for (size_t i = 0; i != sizeof(header); ++i) {
+    checksum += reinterpret_cast<const uint8*>(&header)[i];
+  }
+  sprintf_s(header.chksum, "%06o", checksum);
+  header.chksum[7] = ' ';
+  if (!WriteAll(tarball, &header, sizeof(header))) {
+    return false;
+  }
+
+  std::vector<uint8> buffer(kMegabyte);
+  for (uint64 remaining = size; remaining;) {
+    const DWORD bytes_to_read = static_cast<DWORD>(
+        remaining < buffer.size() ? remaining : buffer.size());
+    DWORD bytes_read = 0;
+    if (!::ReadFile(get(file), &buffer[0], bytes_to_read, &bytes_read, NULL) ||
+        bytes_read != bytes_to_read ||
+        !WriteAll(tarball, &buffer[0], bytes_read)) {
+      return false;
+    }
+    remaining -= bytes_read;
+  }
+
+  const uint8 padding[512] = {};
+  if (!WriteAll(tarball, padding, static_cast<DWORD>((512 - size) & 0x1ff))) {
+    return false;
+  }
+
+  *entry_size = size;
+  return true;
+}
+
+// Writes a tarball of about |size_mb| megabytes made of the DLLs in the system
+// directory, cycling through them as many times as needed.
+int MakeTar(uint64 size_mb, const CString& tarball_path) {
+  TCHAR system_dir[MAX_PATH] = {};
+  if (!::GetSystemDirectory(system_dir, arraysize(system_dir))) {
+    return 1;
+  }
+  std::vector<CString> dlls;
+  if (FAILED(FindFiles(system_dir, _T("*.dll"), &dlls)) || dlls.empty()) {
+    return 1;
+  }
+
+  scoped_hfile tarball(::CreateFile(tarball_path,
+                                    GENERIC_WRITE,
+                                    0,
+                                    NULL,
+                                    CREATE_ALWAYS,
+                                    FILE_FLAG_SEQUENTIAL_SCAN,
+                                    NULL));
+  if (!valid(tarball)) {
+    return 1;
+  }
+
+  const uint64 target_size = size_mb * kMegabyte;
+  uint64 total_size = 0;
+  for (size_t i = 0; total_size < target_size; ++i) {
+    CStringA name;
+    name.Format("%06Iu_%S", i, GetFileFromPath(dlls[i % dlls.size()]));
+    uint64 entry_size = 0;
+    if (!AppendTarEntry(get(tarball),
+                        ConcatenatePath(system_dir, dlls[i % dlls.size()]),
+                        name,
+                        target_size - total_size,
+                        &entry_size)) {
+      return 1;
+    }
+    total_size += entry_size;
+  }
+
+  const uint8 end_of_archive[2 * sizeof(USTARHeader)] = {};
+  return WriteAll(get(tarball), end_of_archive, sizeof(end_of_archive)) ? 0 : 1;
+}
+
+// Packs the tarball at |tarball_path| with an increasing number of threads.
+int Pack(const CString& tarball_path) {
+  std::vector<byte> contents;
+  if (FAILED(ReadEntireFileShareMode(tarball_path,
+                                     0,
+                                     FILE_SHARE_READ,
+                                     &contents)) ||
+      contents.empty()) {
+    _tprintf(_T("Cannot read %s\n"), tarball_path);
+    return 1;
+  }
+  const std::string tarball(contents.begin(), contents.end());
+  contents.clear();
+
+  SYSTEM_INFO system_info = {};
+  ::GetSystemInfo(&system_info);
+  const int max_threads = static_cast<int>(system_info.dwNumberOfProcessors);
+
+  _tprintf(_T("threads,tarball_bytes,packed_bytes,seconds,mb_per_sec,")
+           _T("same_as_1_thread\n"));
+  std::string single_thread_payload;
+  for (int threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+    ChunkedPayloadOptions options;
+    options.num_threads = threads;
+    std::string payload;
+    const ULONGLONG start = HighresTimer::GetCurrentTicks();
+    if (FAILED(WriteChunkedPayload(tarball, options, &payload))) {
+      return 1;
+    }
+    const double seconds =
+        static_cast<double>(HighresTimer::GetCurrentTicks() - start) /
+        HighresTimer::GetTimerFrequency();
+    if (threads == 1) {
+      single_thread_payload = payload;
+    }
+
+    _tprintf(_T("%d,%Iu,%Iu,%.3f,%.1f,%d\n"),
+             threads,
+             tarball.size(),
+             payload.size(),
+             seconds,
+             tarball.size() / seconds / kMegabyte,
+             payload == single_thread_payload);
+    fflush(stdout);
+    if (threads >= max_threads) {
+      break;
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+}  // namespace omaha
+
+int _tmain(int argc, TCHAR* argv[]) {
+  if (argc == 3 && !_tcscmp(argv[1], _T("-extract"))) {
+    return omaha::ExtractOne(argv[2]);
+  }
+  if (argc == 4 && !_tcscmp(argv[1], _T("-make_tar"))) {
+    return omaha::MakeTar(_tcstoui64(argv[2], NULL, 10), argv[3]);
+  }
+  if (argc == 3 && !_tcscmp(argv[1], _T("-pack"))) {
+    return omaha::Pack(argv[2]);
+  }
+  if (argc < 2 || argv[1][0] == _T('-')) {
+    _tprintf(_T("Usage: MiPayloadBenchmark <payload>...\n")
+             _T("       MiPayloadBenchmark -make_tar <size_mb> <tarball>\n")
+             _T("       MiPayloadBenchmark -pack <tarball>\n"));
+    return -1;
+  }
+
+  _tprintf(_T("payload,packed_bytes,unpacked_bytes,seconds,mb_per_sec,")
+           _T("peak_working_set_mb,peak_private_mb\n"));
+  fflush(stdout);
+  int result = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (omaha::RunChild(argv[i])) {
+      result = 1;
+    }
+  }
+  return result;
+}
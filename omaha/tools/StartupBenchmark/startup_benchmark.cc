@@ -0,0 +1,286 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// ========================================================================
+//
+// Measures the time to first network byte of an installed GoogleUpdate.exe:
+// how long it takes from the creation of the process to the first byte of its
+// update check. The update check and ping urls are pointed at a server on
+// 127.0.0.1 which this tool runs, and which answers every request with a 503,
+// so that no update is ever installed. The last checked time is deleted before
+// each run, so that /ua always checks, and the update jitter is turned off.
+// The UpdateDev values are restored when the tool exits.
+//
+// One CSV row is printed per run:
+//
+//   run,first_byte_ms,exit_ms,exit_code,requests
+//
+// first_byte_ms is -1 if no request was received before the process exited.
+//
+// Usage: StartupBenchmark <GoogleUpdate.exe> [<runs> [<args>]]
+//
+// The defaults are 10 runs of "/ua /installsource benchmark". The tool writes
+// to HKLM, so it must be run elevated. Running it against two builds gives the
+// before and after numbers of a change to the startup of the processes.
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <tchar.h>
+
+#include "base/basictypes.h"
+#include "omaha/base/constants.h"
+#include "omaha/base/highres_timer-win32.h"
+#include "omaha/base/reg_key.h"
+#include "omaha/base/safe_format.h"
+#include "omaha/common/const_goopdate.h"
+#include "omaha/third_party/smartany/scoped_any.h"
+
+namespace omaha {
+
+namespace {
+
+// How long a run may take before the process is given up on.
+const int kRunTimeoutMs = 5 * 60 * 1000;
+
+// How long a connection may take to send its request.
+const int kReceiveTimeoutMs = 10 * 1000;
+
+const char kResponse[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                         "Content-Length: 0\r\n"
+                         "Connection: close\r\n"
+                         "\r\n";
+
+// Overrides a value under MACHINE_REG_UPDATE_DEV and restores it, or deletes
+// it if it did not exist, when it goes out of scope.
+template <typename T>
+class ScopedDevOverride {
+ public:
+  ScopedDevOverride(const TCHAR* value_name, const T& value)
+      : value_name_(value_name),
+        had_value_(RegKey::HasValue(MACHINE_REG_UPDATE_DEV, value_name)),
+        saved_value_() {
+    if (had_value_) {
+      RegKey::GetValue(MACHINE_REG_UPDATE_DEV, value_name_, &saved_value_);
+    }
+    is_set_ = SUCCEEDED(RegKey::SetValue(MACHINE_REG_UPDATE_DEV,
+                                         value_name_,
+                                         value));
+  }
+
+  ~ScopedDevOverride() {
+    if (had_value_) {
+      RegKey::SetValue(MACHINE_REG_UPDATE_DEV, value_name_, saved_value_);
+    } else {
+      RegKey::DeleteValue(MACHINE_REG_UPDATE_DEV, value_name_);
+    }
+  }
+
+  bool is_set() const { return is_set_; }
+
+ private:
+  const TCHAR* value_name_;
+  bool had_value_;
+  T saved_value_;
+  bool is_set_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedDevOverride);
+};
+
+int TicksToMs(ULONGLONG ticks) {
+  return static_cast<int>(ticks * 1000 / HighresTimer::GetTimerFrequency());
+}
+
+// Returns true if |s| is readable before |timeout_ms| elapses.
+bool WaitForRead(SOCKET s, int timeout_ms) {
+  fd_set read_set;
+  FD_ZERO(&read_set);
+  FD_SET(s, &read_set);
+  timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+  return ::select(0, &read_set, NULL, NULL, &timeout) == 1;
+}
+
+// Reads the request of |s|, records the time its first byte is received in
+// |first_byte_ticks| if it was not recorded yet, and answers the request.
+void ServeRequest(SOCKET s, ULONGLONG* first_byte_ticks) {
+  CStringA request;
+  int content_length = 0;
+  int headers_length = -1;
+  while (headers_length < 0 ||
+         request.GetLength() < headers_length + content_length) {
+    if (!WaitForRead(s, kReceiveTimeoutMs)) {
+      break;
+    }
+    char buffer[4096] = {0};
+    const int received = ::recv(s, buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+      break;
+    }
+    if (!*first_byte_ticks) {
+      *first_byte_ticks = HighresTimer::GetCurrentTicks();
+    }
+    request.Append(buffer, received);
+
+    if (headers_length < 0) {
+      const int end = request.Find("\r\n\r\n");
+      if (end >= 0) {
+        headers_length = end + 4;
+        CStringA headers(request.Left(headers_length));
+        headers.MakeLower();
+        const int length = headers.Find("\ncontent-length:");
+        if (length >= 0) {
+          content_length = atoi(headers.GetString() + length + 16);
+        }
+      }
+    }
+  }
+
+  ::send(s, kResponse, static_cast<int>(strlen(kResponse)), 0);
+  ::shutdown(s, SD_SEND);
+}
+
+// Runs |command_line| once, serves its requests on |listen_socket| until it
+// exits, and prints the row of the run.
+bool RunOnce(int run, const CString& command_line, SOCKET listen_socket) {
+  CString mutable_command_line(command_line);
+  STARTUPINFO startup_info = { sizeof(startup_info) };
+  PROCESS_INFORMATION process_info = {0};
+
+  const ULONGLONG start = HighresTimer::GetCurrentTicks();
+  if (!::CreateProcess(NULL,
+                       mutable_command_line.GetBuffer(),
+                       NULL,
+                       NULL,
+                       false,
+                       0,
+                       NULL,
+                       NULL,
+                       &startup_info,
+                       &process_info)) {
+    _tprintf(_T("Cannot run %s, error %u\n"), command_line, ::GetLastError());
+    return false;
+  }
+  scoped_process process(process_info.hProcess);
+  scoped_handle thread(process_info.hThread);
+
+  ULONGLONG first_byte_ticks = 0;
+  int requests = 0;
+  while (::WaitForSingleObject(get(process), 0) == WAIT_TIMEOUT) {
+    if (TicksToMs(HighresTimer::GetCurrentTicks() - start) > kRunTimeoutMs) {
+      ::TerminateProcess(get(process), static_cast<UINT>(-1));
+      ::WaitForSingleObject(get(process), INFINITE);
+      break;
+    }
+    if (!WaitForRead(listen_socket, 100)) {
+      continue;
+    }
+    SOCKET s = ::accept(listen_socket, NULL, NULL);
+    if (s != INVALID_SOCKET) {
+      ServeRequest(s, &first_byte_ticks);
+      ::closesocket(s);
+      ++requests;
+    }
+  }
+  const ULONGLONG end = HighresTimer::GetCurrentTicks();
+
+  DWORD exit_code = 0;
+  ::GetExitCodeProcess(get(process), &exit_code);
+  _tprintf(_T("%d,%d,%d,0x%08x,%d\n"),
+           run,
+           first_byte_ticks ? TicksToMs(first_byte_ticks - start) : -1,
+           TicksToMs(end - start),
+           exit_code,
+           requests);
+  fflush(stdout);
+  return true;
+}
+
+int Run(const CString& exe, int runs, const CString& args) {
+  WSADATA wsa_data = {0};
+  if (::WSAStartup(MAKEWORD(2, 2), &wsa_data)) {
+    _tprintf(_T("Cannot initialize Winsock\n"));
+    return 1;
+  }
+
+  SOCKET listen_socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  sockaddr_in address = {0};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int address_length = sizeof(address);
+  if (listen_socket == INVALID_SOCKET ||
+      ::bind(listen_socket,
+             reinterpret_cast<sockaddr*>(&address),
+             sizeof(address)) ||
+      ::getsockname(listen_socket,
+                    reinterpret_cast<sockaddr*>(&address),
+                    &address_length) ||
+      ::listen(listen_socket, SOMAXCONN)) {
+    _tprintf(_T("Cannot listen on 127.0.0.1, error %d\n"),
+             ::WSAGetLastError());
+    ::WSACleanup();
+    return 1;
+  }
+
+  CString url;
+  SafeCStringFormat(&url, _T("http://127.0.0.1:%d/service/update2"),
+                    ntohs(address.sin_port));
+  CString command_line;
+  SafeCStringFormat(&command_line, _T("\"%s\" %s"), exe, args);
+
+  int result = 0;
+  {
+    ScopedDevOverride<CString> update_url(kRegValueNameUrl, url);
+    ScopedDevOverride<CString> ping_url(kRegValueNamePingUrl, url);
+    ScopedDevOverride<DWORD> jitter(kRegValueAutoUpdateJitterMs, 0);
+    if (!update_url.is_set() || !ping_url.is_set() || !jitter.is_set()) {
+      _tprintf(_T("Cannot write %s, the tool must be run elevated\n"),
+               MACHINE_REG_UPDATE_DEV);
+      result = 1;
+    } else {
+      _tprintf(_T("run,first_byte_ms,exit_ms,exit_code,requests\n"));
+      for (int run = 0; run != runs; ++run) {
+        RegKey::DeleteValue(MACHINE_REG_UPDATE, kRegValueLastChecked);
+        RegKey::DeleteValue(USER_REG_UPDATE, kRegValueLastChecked);
+        if (!RunOnce(run, command_line, listen_socket)) {
+          result = 1;
+          break;
+        }
+      }
+    }
+  }
+
+  ::closesocket(listen_socket);
+  ::WSACleanup();
+  return result;
+}
+
+}  // namespace
+
+}  // namespace omaha
+
+int _tmain(int argc, TCHAR* argv[]) {
+  if (argc < 2 || argc > 4) {
+    _tprintf(_T("Usage: StartupBenchmark <GoogleUpdate.exe> ")
+             _T("[<runs> [<args>]]\n"));
+    return -1;
+  }
+
+  const int runs = argc > 2 ? _ttoi(argv[2]) : 10;
+  if (runs <= 0) {
+    _tprintf(_T("<runs> must be positive\n"));
+    return -1;
+  }
+  const CString args(argc > 3 ? argv[3] : _T("/ua /installsource benchmark"));
+  return omaha::Run(argv[1], runs, args);
+}